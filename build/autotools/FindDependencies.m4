@@ -70,6 +70,26 @@ AC_SUBST(BSON_HAVE_CLOCK_GETTIME, 0)
 AC_SEARCH_LIBS([clock_gettime], [rt], [AC_SUBST(BSON_HAVE_CLOCK_GETTIME, 1)])
 
 
+# Check for the optional compressors of bson_compressed_writer_t
+AC_SUBST(BSON_HAVE_ZLIB, 0)
+AC_SUBST(BSON_HAVE_ZSTD, 0)
+AC_SUBST(BSON_HAVE_LZ4, 0)
+BSON_COMPRESSION_LIBS=""
+AC_CHECK_HEADER([zlib.h],
+                [AC_CHECK_LIB([z], [compress2],
+                              [AC_SUBST(BSON_HAVE_ZLIB, 1)
+                               BSON_COMPRESSION_LIBS="$BSON_COMPRESSION_LIBS -lz"])])
+AC_CHECK_HEADER([zstd.h],
+                [AC_CHECK_LIB([zstd], [ZSTD_compress],
+                              [AC_SUBST(BSON_HAVE_ZSTD, 1)
+                               BSON_COMPRESSION_LIBS="$BSON_COMPRESSION_LIBS -lzstd"])])
+AC_CHECK_HEADER([lz4.h],
+                [AC_CHECK_LIB([lz4], [LZ4_compress_default],
+                              [AC_SUBST(BSON_HAVE_LZ4, 1)
+                               BSON_COMPRESSION_LIBS="$BSON_COMPRESSION_LIBS -llz4"])])
+AC_SUBST(BSON_COMPRESSION_LIBS)
+
+
 # Check for pthreads. We might need to make this better to handle mingw,
 # but I actually think it is okay to just check for it even though we will
 # use win32 primatives.
@@ -42,7 +42,8 @@ Build configuration:
   Cross Compiling                                  : ${enable_crosscompile}
   Big endian                                       : ${enable_bigendian}
   Compile with native _Decimal128 (BID) support    : ${enable_decimal}
-  Link Time Optimization (experimental)            : ${enable_lto}${enable_experimental_text}
+  Link Time Optimization (experimental)            : ${enable_lto}
+  SystemTap/USDT static probes                     : ${enable_usdt}${enable_experimental_text}
 
 Documentation:
   man                                              : ${enable_man_pages}
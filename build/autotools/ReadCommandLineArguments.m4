@@ -86,6 +86,19 @@ AS_IF([test "$enable_experimental_features" = "yes"],
       [AC_SUBST(BSON_EXPERIMENTAL_FEATURES, 1)],
       [AC_SUBST(BSON_EXPERIMENTAL_FEATURES, 0)])
 
+# SystemTap/USDT static probes
+AC_ARG_ENABLE(usdt,
+   AC_HELP_STRING([--enable-usdt=@<:@no/yes@:>@],
+                  [Build SystemTap/USDT static probes [default=no]]),
+   [enable_usdt=$enableval],
+   [enable_usdt=no])
+
+AC_SUBST(BSON_HAVE_USDT, 0)
+AS_IF([test "$enable_usdt" = "yes"],
+      [AC_CHECK_HEADER([sys/sdt.h],
+                       [AC_SUBST(BSON_HAVE_USDT, 1)],
+                       [AC_MSG_ERROR([--enable-usdt requires sys/sdt.h (systemtap-sdt-dev).])])])
+
 AC_ARG_ENABLE([html-docs],
               [AS_HELP_STRING([--enable-html-docs=@<:@yes/no@:>@],
                               [Build HTML documentation.])],
@@ -0,0 +1,182 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * This program compares the speed of a compiled bcon_extract_plan_t with
+ * bcon_extract(), extracting the same 12 fields, some of them nested,
+ * from every document of a stream.
+ *
+ * Run it with the number of documents to generate, e.g.
+ *
+ *    ./bcon-extract-speed 1000000
+ */
+
+
+#include <bson.h>
+#include <bcon.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+   bcon_extract_plan_t *plan;
+   bson_writer_t *writer;
+   bson_reader_t *reader;
+   const bson_t *doc;
+   const bson_oid_t *id;
+   const char *host;
+   const char *status;
+   const char *region;
+   const char *method;
+   const char *path;
+   int32_t code;
+   int32_t version;
+   int32_t port;
+   int64_t ts;
+   int64_t bytes;
+   double latency;
+   bool cached;
+   bson_oid_t oid;
+   bson_t *b;
+   uint8_t *buf = NULL;
+   size_t buflen = 0;
+   int64_t start;
+   int64_t bcon_usec;
+   int64_t plan_usec;
+   int64_t bcon_sum = 0;
+   int64_t plan_sum = 0;
+   int n;
+   int i;
+
+   if (argc != 2 || (n = atoi (argv[1])) <= 0) {
+      fprintf (stderr, "usage: %s NUM_DOCUMENTS\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   writer = bson_writer_new (&buf, &buflen, 0, bson_realloc_ctx, NULL);
+
+   for (i = 0; i < n; i++) {
+      bson_oid_init (&oid, NULL);
+      bson_writer_begin (writer, &b);
+      BCON_APPEND (b,
+                   "_id", BCON_OID (&oid),
+                   "ts", BCON_DATE_TIME (1400000000000LL + i),
+                   "host", BCON_UTF8 ("app-server-01.example.com"),
+                   "pid", BCON_INT32 (4242),
+                   "status", BCON_UTF8 ((i % 3) ? "active" : "inactive"),
+                   "message", BCON_UTF8 ("request completed successfully"),
+                   "request", "{",
+                      "method", BCON_UTF8 ("GET"),
+                      "path", BCON_UTF8 ("/api/v1/items"),
+                      "headers", "{",
+                         "accept", BCON_UTF8 ("application/json"),
+                         "agent", BCON_UTF8 ("curl/7.35"),
+                      "}",
+                   "}",
+                   "response", "{",
+                      "code", BCON_INT32 (200),
+                      "bytes", BCON_INT64 (i * 10LL),
+                      "cached", BCON_BOOL (i % 2),
+                   "}",
+                   "meta", "{",
+                      "version", BCON_INT32 (3),
+                      "tags", "[", BCON_UTF8 ("a"), BCON_UTF8 ("b"), "]",
+                      "region", BCON_UTF8 ("us-east-1"),
+                      "port", BCON_INT32 (8080),
+                   "}",
+                   "latency", BCON_DOUBLE (i * 0.001));
+      bson_writer_end (writer);
+   }
+
+   reader = bson_reader_new_from_data (buf, bson_writer_get_length (writer));
+
+   start = bson_get_monotonic_time ();
+   while ((doc = bson_reader_read (reader, NULL))) {
+      if (!BCON_EXTRACT ((bson_t *)doc,
+                         "_id", BCONE_OID (id),
+                         "ts", BCONE_DATE_TIME (ts),
+                         "host", BCONE_UTF8 (host),
+                         "status", BCONE_UTF8 (status),
+                         "request", "{",
+                            "method", BCONE_UTF8 (method),
+                            "path", BCONE_UTF8 (path),
+                         "}",
+                         "response", "{",
+                            "code", BCONE_INT32 (code),
+                            "bytes", BCONE_INT64 (bytes),
+                            "cached", BCONE_BOOL (cached),
+                         "}",
+                         "meta", "{",
+                            "version", BCONE_INT32 (version),
+                            "region", BCONE_UTF8 (region),
+                            "port", BCONE_INT32 (port),
+                         "}",
+                         "latency", BCONE_DOUBLE (latency))) {
+         fprintf (stderr, "bcon_extract failed\n");
+         return EXIT_FAILURE;
+      }
+      bcon_sum += bytes + code + cached;
+   }
+   bcon_usec = bson_get_monotonic_time () - start;
+
+   bson_reader_reset (reader);
+
+   plan = BCON_EXTRACT_PLAN_NEW ("_id", BCONE_OID (id),
+                                 "ts", BCONE_DATE_TIME (ts),
+                                 "host", BCONE_UTF8 (host),
+                                 "status", BCONE_UTF8 (status),
+                                 "request", "{",
+                                    "method", BCONE_UTF8 (method),
+                                    "path", BCONE_UTF8 (path),
+                                 "}",
+                                 "response", "{",
+                                    "code", BCONE_INT32 (code),
+                                    "bytes", BCONE_INT64 (bytes),
+                                    "cached", BCONE_BOOL (cached),
+                                 "}",
+                                 "meta", "{",
+                                    "version", BCONE_INT32 (version),
+                                    "region", BCONE_UTF8 (region),
+                                    "port", BCONE_INT32 (port),
+                                 "}",
+                                 "latency", BCONE_DOUBLE (latency));
+
+   start = bson_get_monotonic_time ();
+   while ((doc = bson_reader_read (reader, NULL))) {
+      if (!bcon_extract_plan_execute (plan, doc)) {
+         fprintf (stderr, "bcon_extract_plan_execute failed\n");
+         return EXIT_FAILURE;
+      }
+      plan_sum += bytes + code + cached;
+   }
+   plan_usec = bson_get_monotonic_time () - start;
+
+   printf ("bcon_extract: %.0f docs/sec\n",
+           n / (BSON_MAX (bcon_usec, 1) / 1000000.0));
+   printf ("plan:         %.0f docs/sec\n",
+           n / (BSON_MAX (plan_usec, 1) / 1000000.0));
+
+   bcon_extract_plan_destroy (plan);
+   bson_reader_destroy (reader);
+   bson_writer_destroy (writer);
+   bson_free (buf);
+
+   return (bcon_sum == plan_sum) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
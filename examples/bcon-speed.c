@@ -21,8 +21,8 @@
 #include <stdlib.h>
 
 /*
- * This is a test for comparing the performance of BCON to regular
- * bson_append*() function calls.
+ * This is a test for comparing the performance of BCON and precompiled
+ * BCON templates to regular bson_append*() function calls.
  *
  * Maybe run the following a few times to get an idea of the performance
  * implications of using BCON. Generally, it's fast enough to be very
@@ -30,6 +30,7 @@
  *
  * time ./bcon-speed 100000 y
  * time ./bcon-speed 100000 n
+ * time ./bcon-speed 100000 t
  */
 
 
@@ -40,14 +41,16 @@ main (int   argc,
    int i;
    int n;
    int bcon;
+   bcon_template_t *tpl = NULL;
    bson_t bson, foo, bar, baz;
    bson_init(&bson);
 
    if (argc != 3) {
-      fprintf (stderr, "usage: bcon-speed NUM_ITERATIONS [y|n]\n"
+      fprintf (stderr, "usage: bcon-speed NUM_ITERATIONS [y|n|t]\n"
                        "\n"
                        "  y = perform speed tests with bcon\n"
                        "  n = perform speed tests with bson_append\n"
+                       "  t = perform speed tests with a bcon template\n"
                        "\n");
       return EXIT_FAILURE;
    }
@@ -57,8 +60,20 @@ main (int   argc,
    n = atoi(argv[1]);
    bcon = (argv[2][0] == 'y') ? 1 : 0;
 
+   if (argv[2][0] == 't') {
+      tpl = BCON_TEMPLATE_NEW(
+         "foo", "{",
+            "bar", "{",
+               "baz", "[", BCONT_INT32, BCONT_INT32, BCONT_INT32, "]",
+            "}",
+         "}"
+      );
+   }
+
    for (i = 0; i < n; i++) {
-      if (bcon) {
+      if (tpl) {
+         bcon_template_render(tpl, &bson, 1, 2, 3);
+      } else if (bcon) {
          BCON_APPEND(&bson,
             "foo", "{",
                "bar", "{",
@@ -82,6 +97,7 @@ main (int   argc,
    }
 
    bson_destroy(&bson);
+   bcon_template_destroy(tpl);
 
    return 0;
 }
@@ -0,0 +1,211 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * This program compares summarizing two fields of a stream of documents
+ * with a bson_iter_t loop against bson_aggregate_column() over columns
+ * extracted a batch at a time, reports the speed of the column kernels
+ * alone, and the speed of a bson_group_by_t over the same documents:
+ *
+ *    {"region": "r7", "qty": 3, "price": 9.99}
+ *
+ * Run it with the number of documents, e.g.
+ *
+ *    ./bson-aggregate-speed 1000000
+ */
+
+
+#include <bson.h>
+#include <bcon.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static uint8_t *
+make_documents (int     n,
+                size_t *len)
+{
+   uint8_t *buf = NULL;
+   size_t alloc = 0;
+   char region[16];
+   bson_t *doc;
+   int i;
+
+   *len = 0;
+
+   for (i = 0; i < n; i++) {
+      bson_snprintf (region, sizeof region, "r%d", i % 16);
+      doc = BCON_NEW ("region", BCON_UTF8 (region),
+                      "qty", BCON_INT32 (i % 1000),
+                      "price", BCON_DOUBLE ((i % 977) * 0.25));
+
+      if (*len + doc->len > alloc) {
+         alloc = BSON_MAX (alloc * 2, 4096);
+         buf = bson_realloc (buf, alloc);
+      }
+
+      memcpy (buf + *len, bson_get_data (doc), doc->len);
+      *len += doc->len;
+      bson_destroy (doc);
+   }
+
+   return buf;
+}
+
+
+static double
+per_sec (int     n,
+         int64_t usec)
+{
+   return n / (BSON_MAX (usec, 1) / 1000000.0);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+   bson_columnar_extractor_t *ext;
+   bson_aggregate_t qty;
+   bson_aggregate_t price;
+   bson_group_by_t *group_by;
+   bson_reader_t *reader;
+   bson_column_t columns[2];
+   bson_value_t value;
+   bson_error_t error;
+   const bson_t *doc;
+   bson_iter_t iter;
+   bson_t *spec;
+   uint8_t *buf;
+   size_t len;
+   int64_t start;
+   int64_t usec;
+   int64_t sum = 0;
+   int64_t min = INT64_MAX;
+   double dsum = 0;
+   double dmax = 0;
+   int reps;
+   int n;
+   int i;
+
+   if (argc != 2 || (n = atoi (argv[1])) <= 0) {
+      fprintf (stderr, "usage: %s NUM_DOCUMENTS\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   buf = make_documents (n, &len);
+
+   start = bson_get_monotonic_time ();
+   reader = bson_reader_new_from_data (buf, len);
+   while ((doc = bson_reader_read (reader, NULL))) {
+      if (bson_iter_init_find (&iter, doc, "qty")) {
+         sum += bson_iter_as_int64 (&iter);
+         min = BSON_MIN (min, bson_iter_as_int64 (&iter));
+      }
+      if (bson_iter_init_find (&iter, doc, "price")) {
+         dsum += bson_iter_double (&iter);
+         dmax = BSON_MAX (dmax, bson_iter_double (&iter));
+      }
+   }
+   bson_reader_destroy (reader);
+   usec = bson_get_monotonic_time () - start;
+   printf ("iter:     %.0f docs/sec\n", per_sec (n, usec));
+
+   ext = bson_columnar_extractor_new ();
+   if (!bson_columnar_extractor_add_column (ext, "qty", BSON_COLUMN_INT64, &error) ||
+       !bson_columnar_extractor_add_column (ext, "price", BSON_COLUMN_DOUBLE, &error)) {
+      fprintf (stderr, "%s\n", error.message);
+      return EXIT_FAILURE;
+   }
+
+   bson_aggregate_init (&qty);
+   bson_aggregate_init (&price);
+
+   start = bson_get_monotonic_time ();
+   reader = bson_reader_new_from_data (buf, len);
+   do {
+      bson_columnar_extractor_clear (ext);
+      if (!bson_columnar_extractor_append_reader (ext, reader,
+                                                  BSON_COLUMNAR_BATCH_SIZE,
+                                                  &error)) {
+         fprintf (stderr, "%s\n", error.message);
+         return EXIT_FAILURE;
+      }
+      bson_columnar_extractor_get_column (ext, 0, &columns[0]);
+      bson_columnar_extractor_get_column (ext, 1, &columns[1]);
+      bson_aggregate_column (&qty, &columns[0]);
+      bson_aggregate_column (&price, &columns[1]);
+   } while (bson_columnar_extractor_get_n_rows (ext) ==
+            BSON_COLUMNAR_BATCH_SIZE);
+   bson_reader_destroy (reader);
+   usec = bson_get_monotonic_time () - start;
+   printf ("columnar: %.0f docs/sec\n", per_sec (n, usec));
+
+   bson_aggregate_get (&qty, BSON_AGGREGATE_SUM, &value);
+   if (value.value.v_int64 != sum) {
+      fprintf (stderr, "sum mismatch\n");
+      return EXIT_FAILURE;
+   }
+
+   /* the kernels alone, over columns of every document */
+   bson_columnar_extractor_clear (ext);
+   reader = bson_reader_new_from_data (buf, len);
+   bson_columnar_extractor_append_reader (ext, reader, 0, &error);
+   bson_reader_destroy (reader);
+   bson_columnar_extractor_get_column (ext, 0, &columns[0]);
+   bson_columnar_extractor_get_column (ext, 1, &columns[1]);
+
+   reps = 20;
+   start = bson_get_monotonic_time ();
+   for (i = 0; i < reps; i++) {
+      bson_aggregate_init (&qty);
+      bson_aggregate_init (&price);
+      bson_aggregate_column (&qty, &columns[0]);
+      bson_aggregate_column (&price, &columns[1]);
+   }
+   usec = bson_get_monotonic_time () - start;
+   printf ("kernels:  %.2f GB/s\n",
+           per_sec (reps, usec) * 2.0 * n * 8 / 1e9);
+
+   spec = BCON_NEW ("_id", "$region",
+                    "n", "{", "$sum", BCON_INT32 (1), "}",
+                    "qty", "{", "$sum", "$qty", "}",
+                    "price", "{", "$max", "$price", "}");
+   if (!(group_by = bson_group_by_new (spec, &error))) {
+      fprintf (stderr, "%s\n", error.message);
+      return EXIT_FAILURE;
+   }
+
+   start = bson_get_monotonic_time ();
+   reader = bson_reader_new_from_data (buf, len);
+   if (!bson_group_by_append_reader (group_by, reader, 0, &error)) {
+      fprintf (stderr, "%s\n", error.message);
+      return EXIT_FAILURE;
+   }
+   bson_reader_destroy (reader);
+   usec = bson_get_monotonic_time () - start;
+   printf ("group by: %.0f docs/sec into %d groups\n", per_sec (n, usec),
+           (int)bson_group_by_get_n_groups (group_by));
+
+   bson_group_by_destroy (group_by);
+   bson_destroy (spec);
+   bson_columnar_extractor_destroy (ext);
+   bson_free (buf);
+
+   return (min >= 0 && dsum >= 0 && dmax >= 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
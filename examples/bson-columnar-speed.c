@@ -0,0 +1,224 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * This program compares the speed of extracting four fields from a stream
+ * of documents with bson_iter_find_descendant() against a
+ * bson_columnar_extractor_t using one and several threads. The documents
+ * look like:
+ *
+ *    {"qty": 3, "price": 9.99, "ts": Date,
+ *     "ship": {"city": "...", "zip": 10001}, "note": "..."}
+ *
+ * Run it with the number of documents and threads, e.g.
+ *
+ *    ./bson-columnar-speed 1000000 4
+ */
+
+
+#include <bson.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static uint8_t *
+make_documents (int     n,
+                size_t *len)
+{
+   uint8_t *buf = NULL;
+   size_t alloc = 0;
+   char city[32];
+   bson_t *doc;
+   int i;
+
+   *len = 0;
+
+   for (i = 0; i < n; i++) {
+      bson_snprintf (city, sizeof city, "city-%d", i % 97);
+      doc = BCON_NEW ("qty", BCON_INT32 (i),
+                      "price", BCON_DOUBLE (i * 0.25),
+                      "ts", BCON_DATE_TIME (1400000000000LL + i),
+                      "ship", "{",
+                         "city", BCON_UTF8 (city),
+                         "zip", BCON_INT32 (10001),
+                      "}",
+                      "note", BCON_UTF8 ("not extracted"));
+
+      if (*len + doc->len > alloc) {
+         alloc = BSON_MAX (alloc * 2, 4096);
+         buf = bson_realloc (buf, alloc);
+      }
+
+      memcpy (buf + *len, bson_get_data (doc), doc->len);
+      *len += doc->len;
+      bson_destroy (doc);
+   }
+
+   return buf;
+}
+
+
+static int64_t
+iter_extract (const uint8_t *buf,
+              size_t         len)
+{
+   bson_reader_t *reader;
+   const bson_t *doc;
+   bson_iter_t iter;
+   bson_iter_t child;
+   int64_t checksum = 0;
+
+   reader = bson_reader_new_from_data (buf, len);
+
+   while ((doc = bson_reader_read (reader, NULL))) {
+      if (bson_iter_init (&iter, doc) &&
+          bson_iter_find_descendant (&iter, "qty", &child)) {
+         checksum += bson_iter_as_int64 (&child);
+      }
+      if (bson_iter_init (&iter, doc) &&
+          bson_iter_find_descendant (&iter, "price", &child)) {
+         checksum += (int64_t)bson_iter_double (&child);
+      }
+      if (bson_iter_init (&iter, doc) &&
+          bson_iter_find_descendant (&iter, "ts", &child)) {
+         checksum += bson_iter_date_time (&child) & 1;
+      }
+      if (bson_iter_init (&iter, doc) &&
+          bson_iter_find_descendant (&iter, "ship.city", &child)) {
+         uint32_t utf8_len;
+
+         bson_iter_utf8 (&child, &utf8_len);
+         checksum += utf8_len;
+      }
+   }
+
+   bson_reader_destroy (reader);
+
+   return checksum;
+}
+
+
+static int64_t
+columnar_extract (const uint8_t *buf,
+                  size_t         len,
+                  uint32_t       n_threads)
+{
+   bson_columnar_extractor_t *ext;
+   bson_reader_t *reader;
+   bson_column_t column;
+   bson_error_t error;
+   const int64_t *i64;
+   const double *dbl;
+   const int32_t *offsets;
+   int64_t checksum = 0;
+   size_t i;
+
+   ext = bson_columnar_extractor_new ();
+   bson_columnar_extractor_set_n_threads (ext, n_threads);
+
+   if (!bson_columnar_extractor_add_column (ext, "qty", BSON_COLUMN_INT64, &error) ||
+       !bson_columnar_extractor_add_column (ext, "price", BSON_COLUMN_DOUBLE, &error) ||
+       !bson_columnar_extractor_add_column (ext, "ts", BSON_COLUMN_DATE_TIME, &error) ||
+       !bson_columnar_extractor_add_column (ext, "ship.city", BSON_COLUMN_UTF8, &error)) {
+      fprintf (stderr, "%s\n", error.message);
+      exit (EXIT_FAILURE);
+   }
+
+   reader = bson_reader_new_from_data (buf, len);
+
+   if (!bson_columnar_extractor_append_reader (ext, reader, 0, &error)) {
+      fprintf (stderr, "%s\n", error.message);
+      exit (EXIT_FAILURE);
+   }
+
+   bson_columnar_extractor_get_column (ext, 0, &column);
+   for (i64 = column.values, i = 0; i < column.length; i++) {
+      checksum += i64[i];
+   }
+
+   bson_columnar_extractor_get_column (ext, 1, &column);
+   for (dbl = column.values, i = 0; i < column.length; i++) {
+      checksum += (int64_t)dbl[i];
+   }
+
+   bson_columnar_extractor_get_column (ext, 2, &column);
+   for (i64 = column.values, i = 0; i < column.length; i++) {
+      checksum += i64[i] & 1;
+   }
+
+   bson_columnar_extractor_get_column (ext, 3, &column);
+   for (offsets = column.values, i = 0; i < column.length; i++) {
+      checksum += offsets[i + 1] - offsets[i];
+   }
+
+   bson_reader_destroy (reader);
+   bson_columnar_extractor_destroy (ext);
+
+   return checksum;
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+   uint8_t *buf;
+   size_t len;
+   int64_t start;
+   int64_t usec;
+   int64_t expected;
+   int64_t checksum;
+   int n_threads;
+   int n;
+
+   if (argc != 3 ||
+       (n = atoi (argv[1])) <= 0 ||
+       (n_threads = atoi (argv[2])) <= 0) {
+      fprintf (stderr, "usage: %s NUM_DOCUMENTS NUM_THREADS\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   buf = make_documents (n, &len);
+
+   start = bson_get_monotonic_time ();
+   expected = iter_extract (buf, len);
+   usec = bson_get_monotonic_time () - start;
+   printf ("iter:               %.0f docs/sec\n",
+           n / (BSON_MAX (usec, 1) / 1000000.0));
+
+   start = bson_get_monotonic_time ();
+   checksum = columnar_extract (buf, len, 1);
+   usec = bson_get_monotonic_time () - start;
+   printf ("columnar, 1 thread: %.0f docs/sec\n",
+           n / (BSON_MAX (usec, 1) / 1000000.0));
+
+   if (checksum != expected) {
+      fprintf (stderr, "checksum mismatch\n");
+      return EXIT_FAILURE;
+   }
+
+   start = bson_get_monotonic_time ();
+   checksum = columnar_extract (buf, len, (uint32_t)n_threads);
+   usec = bson_get_monotonic_time () - start;
+   printf ("columnar, %d threads: %.0f docs/sec\n", n_threads,
+           n / (BSON_MAX (usec, 1) / 1000000.0));
+
+   bson_free (buf);
+
+   return (checksum == expected) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * This program converts a file of concatenated BSON documents to a
+ * block-compressed stream and back, and reports the speed of each, e.g.
+ *
+ *    ./bson-compress -c zlib -t 4 dump.bson dump.bsonz
+ *    ./bson-compress -d -t 4 dump.bsonz dump.bson
+ */
+
+
+#include <bson.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static bool
+parse_compressor (const char        *name,
+                  bson_compressor_t *compressor)
+{
+   static const char *names[] = { "none", "zlib", "zstd", "lz4" };
+   int i;
+
+   for (i = 0; i < 4; i++) {
+      if (!strcmp (name, names[i])) {
+         *compressor = (bson_compressor_t)i;
+         return bson_compressor_is_supported (*compressor);
+      }
+   }
+
+   return false;
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+   bson_compressor_t compressor = BSON_COMPRESSOR_ZLIB;
+   bson_compressed_writer_t *compressed = NULL;
+   bson_reader_t *reader;
+   bson_error_t error;
+   const bson_t *doc;
+   bool decompress = false;
+   bool ok = true;
+   int64_t start;
+   int64_t usec;
+   uint32_t n_threads = 0;
+   FILE *out = NULL;
+   int n = 0;
+   int i;
+
+   for (i = 1; i < argc - 2; i++) {
+      if (!strcmp (argv[i], "-d")) {
+         decompress = true;
+      } else if (!strcmp (argv[i], "-c") && i + 1 < argc - 2) {
+         if (!parse_compressor (argv[++i], &compressor)) {
+            fprintf (stderr, "%s is not supported\n", argv[i]);
+            return EXIT_FAILURE;
+         }
+      } else if (!strcmp (argv[i], "-t") && i + 1 < argc - 2) {
+         n_threads = (uint32_t)atoi (argv[++i]);
+      } else {
+         break;
+      }
+   }
+
+   if (argc < 3 || i != argc - 2) {
+      fprintf (stderr, "usage: %s [-d] [-c none|zlib|zstd|lz4] "
+               "[-t THREADS] INPUT OUTPUT\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   start = bson_get_monotonic_time ();
+
+   if (decompress) {
+      reader = bson_reader_new_from_compressed_file (argv[i], n_threads,
+                                                     &error);
+      if (reader && !(out = fopen (argv[i + 1], "wb"))) {
+         perror (argv[i + 1]);
+         return EXIT_FAILURE;
+      }
+   } else {
+      reader = bson_reader_new_from_file (argv[i], &error);
+      compressed = bson_compressed_writer_new_from_file (
+         argv[i + 1], compressor, n_threads, &error);
+      ok = compressed != NULL;
+   }
+
+   if (!reader || !ok) {
+      fprintf (stderr, "%s\n", error.message);
+      return EXIT_FAILURE;
+   }
+
+   while (ok && (doc = bson_reader_read (reader, NULL))) {
+      if (decompress) {
+         ok = fwrite (bson_get_data (doc), 1, doc->len, out) == doc->len;
+      } else {
+         ok = bson_compressed_writer_write (compressed, doc, &error);
+      }
+      n++;
+   }
+
+   if (decompress) {
+      ok = (fclose (out) == 0) && ok;
+   } else {
+      ok = bson_compressed_writer_close (compressed, &error) && ok;
+      bson_compressed_writer_destroy (compressed);
+   }
+
+   if (!ok) {
+      fprintf (stderr, "%s\n", decompress ? "write failed" : error.message);
+      return EXIT_FAILURE;
+   }
+
+   usec = bson_get_monotonic_time () - start;
+   printf ("%d documents, %.0f MB/s of documents\n", n,
+           bson_reader_tell (reader) / (BSON_MAX (usec, 1) / 1e6) / 1e6);
+
+   bson_reader_destroy (reader);
+
+   return EXIT_SUCCESS;
+}
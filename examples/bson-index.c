@@ -0,0 +1,122 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * This program builds a sidecar index for a file of BSON documents, and
+ * uses it to print individual documents by ordinal or by _id without
+ * scanning the file.
+ *
+ *   bson-index FILE             build FILE.idx
+ *   bson-index FILE N           print document number N
+ *   bson-index FILE --id JSON   print the document whose _id is JSON,
+ *                               for example '{"$oid": "..."}' or 42
+ */
+
+
+#include <bson.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+static void
+print_doc (const bson_t *doc)
+{
+   char *str;
+
+   str = bson_as_json (doc, NULL);
+   fprintf (stdout, "%s\n", str);
+   bson_free (str);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+   bson_index_t *index;
+   bson_error_t error;
+   bson_iter_t iter;
+   bson_t *query;
+   bson_t doc;
+   char *index_path;
+   char *json;
+   bool found;
+   int ret = 0;
+
+   if (argc != 2 && argc != 3 && !(argc == 4 && !strcmp (argv[2], "--id"))) {
+      fprintf (stderr,
+               "usage: %s FILE [N | --id JSON]\n"
+               "Builds FILE.idx, or prints a document using it.\n",
+               argv[0]);
+      return 1;
+   }
+
+   index_path = bson_strdup_printf ("%s.idx", argv[1]);
+
+   if (argc == 2) {
+      if (!bson_index_build (argv[1], index_path, &error)) {
+         fprintf (stderr, "Failed to index \"%s\": %s\n",
+                  argv[1], error.message);
+         ret = 1;
+      }
+
+      bson_free (index_path);
+
+      return ret;
+   }
+
+   if (!(index = bson_index_new (argv[1], index_path, &error))) {
+      fprintf (stderr, "Failed to open \"%s\": %s\n", argv[1], error.message);
+      bson_free (index_path);
+      return 1;
+   }
+
+   if (argc == 3) {
+      found = bson_index_get (index, strtoull (argv[2], NULL, 10), &doc);
+   } else {
+      /*
+       * Wrap the _id in a document so that any JSON value may be used.
+       */
+      json = bson_strdup_printf ("{\"_id\": %s}", argv[3]);
+      query = bson_new_from_json ((const uint8_t *)json, -1, &error);
+      bson_free (json);
+
+      if (!query) {
+         fprintf (stderr, "Invalid _id: %s\n", error.message);
+         bson_index_destroy (index);
+         bson_free (index_path);
+         return 1;
+      }
+
+      found = bson_iter_init_find (&iter, query, "_id") &&
+              bson_index_find_id (index, bson_iter_value (&iter), &doc);
+
+      bson_destroy (query);
+   }
+
+   if (found) {
+      print_doc (&doc);
+   } else {
+      fprintf (stderr, "No such document.\n");
+      ret = 1;
+   }
+
+   bson_index_destroy (index);
+   bson_free (index_path);
+
+   return ret;
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * This program compares the speed of bson_matcher_t with the common
+ * approach of calling bson_iter_find_descendant() for every predicate of
+ * the filter:
+ *
+ *    {"status": "active",
+ *     "age": {"$gte": 21, "$lt": 65},
+ *     "meta.region": {"$in": ["us", "eu"]}}
+ *
+ * Run it with the number of documents to generate, e.g.
+ *
+ *    ./bson-matcher-speed 1000000
+ */
+
+
+#include <bson.h>
+#include <bcon.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+static const char *gRegions[] = { "us", "eu", "ap", "sa" };
+
+
+static bool
+find_utf8 (const bson_t *doc,
+           const char   *path,
+           const char   *value)
+{
+   bson_iter_t iter;
+   bson_iter_t child;
+
+   return bson_iter_init (&iter, doc) &&
+          bson_iter_find_descendant (&iter, path, &child) &&
+          BSON_ITER_HOLDS_UTF8 (&child) &&
+          !strcmp (bson_iter_utf8 (&child, NULL), value);
+}
+
+
+static bool
+find_int32 (const bson_t *doc,
+            const char   *path,
+            int32_t      *value)
+{
+   bson_iter_t iter;
+   bson_iter_t child;
+
+   if (bson_iter_init (&iter, doc) &&
+       bson_iter_find_descendant (&iter, path, &child) &&
+       BSON_ITER_HOLDS_INT32 (&child)) {
+      *value = bson_iter_int32 (&child);
+      return true;
+   }
+
+   return false;
+}
+
+
+static bool
+naive_match (const bson_t *doc)
+{
+   int32_t age;
+
+   return find_utf8 (doc, "status", "active") &&
+          find_int32 (doc, "age", &age) && age >= 21 &&
+          find_int32 (doc, "age", &age) && age < 65 &&
+          (find_utf8 (doc, "meta.region", "us") ||
+           find_utf8 (doc, "meta.region", "eu"));
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+   bson_matcher_t *matcher;
+   bson_writer_t *writer;
+   bson_reader_t *reader;
+   bson_error_t error;
+   const bson_t *doc;
+   bson_t *filter;
+   bson_t *b;
+   uint8_t *buf = NULL;
+   size_t buflen = 0;
+   int64_t start;
+   int64_t naive_usec;
+   int64_t matcher_usec;
+   int naive_count = 0;
+   int matcher_count = 0;
+   int n;
+   int i;
+
+   if (argc != 2 || (n = atoi (argv[1])) <= 0) {
+      fprintf (stderr, "usage: %s NUM_DOCUMENTS\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   /*
+    * Generate documents shaped like log records, with the fields the
+    * filter needs spread among fields it does not.
+    */
+   writer = bson_writer_new (&buf, &buflen, 0, bson_realloc_ctx, NULL);
+
+   for (i = 0; i < n; i++) {
+      bson_writer_begin (writer, &b);
+      BCON_APPEND (b,
+                   "_id", BCON_INT32 (i),
+                   "ts", BCON_DATE_TIME (1400000000000LL + i),
+                   "host", BCON_UTF8 ("app-server-01.example.com"),
+                   "status", BCON_UTF8 ((i % 3) ? "active" : "inactive"),
+                   "message", BCON_UTF8 ("request completed successfully"),
+                   "age", BCON_INT32 (i % 90),
+                   "meta", "{",
+                      "version", BCON_INT32 (3),
+                      "tags", "[", BCON_UTF8 ("a"), BCON_UTF8 ("b"), "]",
+                      "region", BCON_UTF8 (gRegions[i % 4]),
+                   "}",
+                   "latency", BCON_DOUBLE (i * 0.001));
+      bson_writer_end (writer);
+   }
+
+   filter = BCON_NEW ("status", BCON_UTF8 ("active"),
+                      "age", "{",
+                         "$gte", BCON_INT32 (21),
+                         "$lt", BCON_INT32 (65),
+                      "}",
+                      "meta.region", "{",
+                         "$in", "[", BCON_UTF8 ("us"), BCON_UTF8 ("eu"), "]",
+                      "}");
+
+   if (!(matcher = bson_matcher_new (filter, &error))) {
+      fprintf (stderr, "%s\n", error.message);
+      return EXIT_FAILURE;
+   }
+
+   reader = bson_reader_new_from_data (buf, bson_writer_get_length (writer));
+
+   start = bson_get_monotonic_time ();
+   while ((doc = bson_reader_read (reader, NULL))) {
+      naive_count += naive_match (doc);
+   }
+   naive_usec = bson_get_monotonic_time () - start;
+
+   bson_reader_reset (reader);
+
+   start = bson_get_monotonic_time ();
+   while ((doc = bson_reader_read (reader, NULL))) {
+      matcher_count += bson_matcher_match (matcher, doc);
+   }
+   matcher_usec = bson_get_monotonic_time () - start;
+
+   printf ("naive:   %d matches, %.0f docs/sec\n",
+           naive_count, n / (BSON_MAX (naive_usec, 1) / 1000000.0));
+   printf ("matcher: %d matches, %.0f docs/sec\n",
+           matcher_count, n / (BSON_MAX (matcher_usec, 1) / 1000000.0));
+
+   bson_reader_destroy (reader);
+   bson_matcher_destroy (matcher);
+   bson_destroy (filter);
+   bson_writer_destroy (writer);
+   bson_free (buf);
+
+   return (naive_count == matcher_count) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -20,6 +20,7 @@
  */
 
 #include <bson.h>
+#include <bson-visit.h>
 #include <stdio.h>
 #include <math.h>
 
@@ -88,14 +89,8 @@ compar_bson_type_metrics (const void *a,
 /*
  * Forward declarations.
  */
-static bool bson_metrics_visit_array (const bson_iter_t *iter,
-                                      const char        *key,
-                                      const bson_t      *v_array,
-                                      void              *data);
-static bool bson_metrics_visit_document (const bson_iter_t *iter,
-                                         const char        *key,
-                                         const bson_t      *v_document,
-                                         void              *data);
+static bool bson_metrics_visit_all (bson_iter_t *iter,
+                                    void        *data);
 
 static bool
 bson_metrics_visit_utf8 (const bson_iter_t *iter,
@@ -125,32 +120,6 @@ bson_metrics_visit_before (const bson_iter_t *iter,
    return false;
 }
 
-static const bson_visitor_t bson_metrics_visitors = {
-   bson_metrics_visit_before,
-   NULL, /* visit_after */
-   NULL, /* visit_corrupt */
-   NULL, /* visit_double */
-   bson_metrics_visit_utf8,
-   bson_metrics_visit_document,
-   bson_metrics_visit_array,
-   NULL, /* visit_binary */
-   NULL, /* visit_undefined */
-   NULL, /* visit_oid */
-   NULL, /* visit_bool */
-   NULL, /* visit_date_time */
-   NULL, /* visit_null */
-   NULL, /* visit_regex */
-   NULL, /* visit_dbpointer */
-   NULL, /* visit_code */
-   NULL, /* visit_symbol */
-   NULL, /* visit_codewscope */
-   NULL, /* visit_int32 */
-   NULL, /* visit_timestamp */
-   NULL, /* visit_int64 */
-   NULL, /* visit_maxkey */
-   NULL, /* visit_minkey */
-};
-
 static bool
 bson_metrics_visit_document (const bson_iter_t *iter,
                              const char        *key,
@@ -167,7 +136,7 @@ bson_metrics_visit_document (const bson_iter_t *iter,
 
    if (bson_iter_init (&child, v_document)) {
       state->depth++;
-      bson_iter_visit_all (&child, &bson_metrics_visitors, data);
+      bson_metrics_visit_all (&child, data);
       state->depth--;
    }
 
@@ -190,13 +159,29 @@ bson_metrics_visit_array (const bson_iter_t *iter,
 
    if (bson_iter_init (&child, v_array)) {
       state->depth++;
-      bson_iter_visit_all (&child, &bson_metrics_visitors, data);
+      bson_metrics_visit_all (&child, data);
       state->depth--;
    }
 
    return false;
 }
 
+/*
+ * Only four callbacks are set, so a walker specialized for them at compile
+ * time skips the other types instead of testing thirty function pointers.
+ */
+static const bson_visitor_t bson_metrics_visitor = {
+   bson_metrics_visit_before,
+   NULL, /* visit_after */
+   NULL, /* visit_corrupt */
+   NULL, /* visit_double */
+   bson_metrics_visit_utf8,
+   bson_metrics_visit_document,
+   bson_metrics_visit_array,
+};
+
+BSON_VISIT_SPECIALIZE (bson_metrics_visit_all, bson_metrics_visitor)
+
 static void
 bson_metrics (const bson_t *bson,
               size_t       *length,
@@ -207,7 +192,7 @@ bson_metrics (const bson_t *bson,
    ++state->doc_count;
 
    if (bson_iter_init (&iter, bson)) {
-      bson_iter_visit_all (&iter, &bson_metrics_visitors, data);
+      bson_metrics_visit_all (&iter, data);
    }
 }
 
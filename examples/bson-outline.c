@@ -0,0 +1,181 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * This program prints an outline of each BSON document in the provided
+ * files: the key, type and size of every field, indented by depth. Files
+ * are read in 4 KB chunks and fed to a bson_pull_parser_t, so memory use
+ * does not grow with the size of a document, and long strings and
+ * binaries are counted slice by slice rather than buffered.
+ */
+
+
+#include <bson.h>
+#include <stdio.h>
+
+
+static const char *
+type_name (bson_type_t type)
+{
+   switch (type) {
+   case BSON_TYPE_DOUBLE:     return "double";
+   case BSON_TYPE_UTF8:       return "string";
+   case BSON_TYPE_DOCUMENT:   return "document";
+   case BSON_TYPE_ARRAY:      return "array";
+   case BSON_TYPE_BINARY:     return "binary";
+   case BSON_TYPE_UNDEFINED:  return "undefined";
+   case BSON_TYPE_OID:        return "oid";
+   case BSON_TYPE_BOOL:       return "bool";
+   case BSON_TYPE_DATE_TIME:  return "date";
+   case BSON_TYPE_NULL:       return "null";
+   case BSON_TYPE_REGEX:      return "regex";
+   case BSON_TYPE_DBPOINTER:  return "dbpointer";
+   case BSON_TYPE_CODE:       return "code";
+   case BSON_TYPE_SYMBOL:     return "symbol";
+   case BSON_TYPE_CODEWSCOPE: return "code with scope";
+   case BSON_TYPE_INT32:      return "int32";
+   case BSON_TYPE_TIMESTAMP:  return "timestamp";
+   case BSON_TYPE_INT64:      return "int64";
+   case BSON_TYPE_DECIMAL128: return "decimal128";
+   case BSON_TYPE_MAXKEY:     return "maxkey";
+   case BSON_TYPE_MINKEY:     return "minkey";
+   case BSON_TYPE_EOD:
+   default:                   return "?";
+   }
+}
+
+
+static bool
+outline (bson_pull_parser_t *parser,
+         bson_error_t       *error)
+{
+   bson_pull_event_t event;
+   bson_value_t value;
+   size_t len;
+
+   for (;;) {
+      event = bson_pull_parser_next (parser, error);
+
+      switch (event) {
+      case BSON_PULL_NEED_INPUT:
+         return true;
+      case BSON_PULL_DOCUMENT_BEGIN:
+         bson_pull_parser_get_value (parser, &value);
+
+         if (!bson_pull_parser_get_depth (parser)) {
+            printf ("--- document (%u bytes)\n", value.value.v_doc.data_len);
+         } else {
+            printf ("%*s%s: %s (%u bytes)\n",
+                    (int)bson_pull_parser_get_depth (parser) * 2, "",
+                    bson_pull_parser_get_key (parser, NULL),
+                    type_name (bson_pull_parser_get_type (parser)),
+                    value.value.v_doc.data_len);
+         }
+
+         break;
+      case BSON_PULL_VALUE:
+         printf ("%*s%s: %s\n",
+                 (int)bson_pull_parser_get_depth (parser) * 2, "",
+                 bson_pull_parser_get_key (parser, NULL),
+                 type_name (bson_pull_parser_get_type (parser)));
+         break;
+      case BSON_PULL_VALUE_BEGIN:
+         bson_pull_parser_get_value (parser, &value);
+         printf ("%*s%s: %s (%u bytes, sliced)\n",
+                 (int)bson_pull_parser_get_depth (parser) * 2, "",
+                 bson_pull_parser_get_key (parser, NULL),
+                 type_name (bson_pull_parser_get_type (parser)),
+                 value.value_type == BSON_TYPE_BINARY ?
+                    value.value.v_binary.data_len : value.value.v_utf8.len);
+         break;
+      case BSON_PULL_VALUE_SLICE:
+         /* a proxy would forward the slice here */
+         bson_pull_parser_get_slice (parser, &len);
+         break;
+      case BSON_PULL_DOCUMENT_END:
+      case BSON_PULL_VALUE_END:
+         break;
+      case BSON_PULL_ERROR:
+      default:
+         return false;
+      }
+   }
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+   bson_pull_parser_t *parser;
+   bson_error_t error;
+   uint8_t buf[4096];
+   const char *filename;
+   FILE *file;
+   size_t n;
+   bool ok;
+   int i;
+
+   /*
+    * Print program usage if no arguments are provided.
+    */
+   if (argc == 1) {
+      fprintf (stderr,
+               "usage: %s [FILE | -]...\nUse - for STDIN.\n",
+               argv[0]);
+      return 1;
+   }
+
+   parser = bson_pull_parser_new ();
+
+   for (i = 1; i < argc; i++) {
+      filename = argv[i];
+
+      if (strcmp (filename, "-") == 0) {
+         file = stdin;
+      } else if (!(file = fopen (filename, "rb"))) {
+         fprintf (stderr, "Failed to open \"%s\"\n", filename);
+         continue;
+      }
+
+      /*
+       * Feed each chunk once the previous one has been consumed.
+       */
+      ok = true;
+
+      while (ok && (n = fread (buf, 1, sizeof buf, file)) > 0) {
+         bson_pull_parser_feed (parser, buf, n);
+         ok = outline (parser, &error);
+      }
+
+      if (!ok) {
+         fprintf (stderr, "%s: %s\n", filename, error.message);
+      } else if (bson_pull_parser_get_depth (parser)) {
+         fprintf (stderr, "%s: truncated document\n", filename);
+      }
+
+      bson_pull_parser_reset (parser);
+
+      if (file != stdin) {
+         fclose (file);
+      }
+   }
+
+   bson_pull_parser_destroy (parser);
+
+   return 0;
+}
@@ -0,0 +1,237 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * This program compares passing a stream of documents from one process to
+ * another through a bson_shm_ring_t against writing them to a pipe read
+ * by a bson_reader_t. Each document carries the time it was built, so the
+ * consumer reports the latency of delivery as well as throughput:
+ *
+ *    {"i": 1, "ts": 123456789, "name": "document"}
+ *
+ * Run it with the number of documents, e.g.
+ *
+ *    ./bson-shm-ring-speed 1000000
+ */
+
+
+#include <bson.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+# include <sys/mman.h>
+# include <sys/wait.h>
+# include <unistd.h>
+
+
+#define CAPACITY (1 << 22)
+
+
+static int
+compare_int64 (const void *a,
+               const void *b)
+{
+   int64_t x = *(const int64_t *)a;
+   int64_t y = *(const int64_t *)b;
+
+   return x < y ? -1 : x > y;
+}
+
+
+static void
+append_fields (bson_t *b,
+               int     i)
+{
+   BSON_APPEND_INT32 (b, "i", i);
+   BSON_APPEND_INT64 (b, "ts", bson_get_monotonic_time ());
+   BSON_APPEND_UTF8 (b, "name", "document");
+}
+
+
+/* records the latency of a document, and returns false if it is corrupt */
+static bool
+consume (const bson_t *doc,
+         int           expected,
+         int64_t      *latency)
+{
+   bson_iter_t iter;
+
+   if (!bson_iter_init_find (&iter, doc, "i") ||
+       bson_iter_int32 (&iter) != expected ||
+       !bson_iter_init_find (&iter, doc, "ts")) {
+      return false;
+   }
+
+   *latency = bson_get_monotonic_time () - bson_iter_int64 (&iter);
+
+   return true;
+}
+
+
+static void
+report (const char *name,
+        int64_t    *latencies,
+        int         n,
+        int64_t     usec)
+{
+   qsort (latencies, (size_t)n, sizeof *latencies, compare_int64);
+   printf ("%-5s %10.0f docs/sec   latency p50 %5" PRId64 " usec"
+           "   p99 %6" PRId64 " usec   max %7" PRId64 " usec\n",
+           name, n / (BSON_MAX (usec, 1) / 1000000.0),
+           latencies[n / 2], latencies[(int64_t)n * 99 / 100],
+           latencies[n - 1]);
+}
+
+
+static bool
+run_ring (int      n,
+          int64_t *latencies)
+{
+   bson_shm_ring_t *ring;
+   bson_error_t error;
+   const bson_t *doc;
+   size_t size;
+   int64_t start;
+   bson_t *b;
+   void *mem;
+   pid_t pid;
+   int i;
+
+   size = bson_shm_ring_get_required_size (CAPACITY);
+   mem = mmap (NULL, size, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+   if (mem == MAP_FAILED) {
+      perror ("mmap");
+      return false;
+   }
+
+   if (!(ring = bson_shm_ring_new (mem, size, &error))) {
+      fprintf (stderr, "%s\n", error.message);
+      return false;
+   }
+
+   start = bson_get_monotonic_time ();
+
+   if ((pid = fork ()) == 0) {
+      for (i = 0; i < n; i++) {
+         bson_shm_ring_begin (ring, 128, -1, &b);
+         append_fields (b, i);
+         bson_shm_ring_end (ring, b);
+      }
+      bson_shm_ring_close (ring);
+      _exit (0);
+   }
+
+   for (i = 0; (doc = bson_shm_ring_read (ring, -1, NULL)); i++) {
+      if (i >= n || !consume (doc, i, &latencies[i])) {
+         fprintf (stderr, "corrupt document %d\n", i);
+         return false;
+      }
+   }
+
+   waitpid (pid, NULL, 0);
+   report ("ring", latencies, n, bson_get_monotonic_time () - start);
+   bson_shm_ring_destroy (ring);
+   munmap (mem, size);
+
+   return i == n;
+}
+
+
+static bool
+run_pipe (int      n,
+          int64_t *latencies)
+{
+   bson_reader_t *reader;
+   const bson_t *doc;
+   int64_t start;
+   bson_t b;
+   pid_t pid;
+   int fds[2];
+   int i;
+
+   if (pipe (fds) != 0) {
+      perror ("pipe");
+      return false;
+   }
+
+   start = bson_get_monotonic_time ();
+
+   if ((pid = fork ()) == 0) {
+      close (fds[0]);
+      for (i = 0; i < n; i++) {
+         bson_init (&b);
+         append_fields (&b, i);
+         if (write (fds[1], bson_get_data (&b), b.len) != (ssize_t)b.len) {
+            _exit (1);
+         }
+         bson_destroy (&b);
+      }
+      _exit (0);
+   }
+
+   close (fds[1]);
+   reader = bson_reader_new_from_fd (fds[0], true);
+
+   for (i = 0; (doc = bson_reader_read (reader, NULL)); i++) {
+      if (i >= n || !consume (doc, i, &latencies[i])) {
+         fprintf (stderr, "corrupt document %d\n", i);
+         return false;
+      }
+   }
+
+   waitpid (pid, NULL, 0);
+   report ("pipe", latencies, n, bson_get_monotonic_time () - start);
+   bson_reader_destroy (reader);
+
+   return i == n;
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+   int64_t *latencies;
+   bool ret;
+   int n;
+
+   if (argc != 2 || (n = atoi (argv[1])) <= 0) {
+      fprintf (stderr, "usage: %s NUM_DOCUMENTS\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   latencies = bson_malloc ((size_t)n * sizeof *latencies);
+   ret = run_ring (n, latencies) && run_pipe (n, latencies);
+   bson_free (latencies);
+
+   return ret ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#else
+
+int
+main (int   argc,
+      char *argv[])
+{
+   fprintf (stderr, "%s needs fork() and mmap()\n", argv[0]);
+
+   return EXIT_FAILURE;
+}
+
+#endif
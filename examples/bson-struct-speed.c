@@ -0,0 +1,234 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * This program compares the speed of bson_encode_struct() and
+ * bson_decode_struct() with the handwritten bson_append_*() and
+ * bson_iter_find() code they replace, for a struct like:
+ *
+ *    {"_id": ObjectId, "user": "...", "qty": 3, "price": 9.99,
+ *     "paid": true, "ts": Date, "ship": {"city": "...", "zip": 10001}}
+ *
+ * Run it with the number of round trips to perform, e.g.
+ *
+ *    ./bson-struct-speed 1000000
+ */
+
+
+#include <bson.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+typedef struct
+{
+   const char *city;
+   int32_t     zip;
+} address_t;
+
+
+typedef struct
+{
+   bson_oid_t  id;
+   const char *user;
+   int32_t     qty;
+   double      price;
+   bool        paid;
+   int64_t     ts;
+   address_t   ship;
+} order_t;
+
+
+static const bson_struct_field_t gAddressFields[] = {
+   BSON_STRUCT_FIELD (address_t, city, "city", BSON_STRUCT_UTF8),
+   BSON_STRUCT_FIELD (address_t, zip, "zip", BSON_STRUCT_INT32),
+};
+
+
+static const bson_struct_field_t gOrderFields[] = {
+   BSON_STRUCT_FIELD (order_t, id, "_id", BSON_STRUCT_OID),
+   BSON_STRUCT_FIELD (order_t, user, "user", BSON_STRUCT_UTF8),
+   BSON_STRUCT_FIELD (order_t, qty, "qty", BSON_STRUCT_INT32),
+   BSON_STRUCT_FIELD (order_t, price, "price", BSON_STRUCT_DOUBLE),
+   BSON_STRUCT_FIELD (order_t, paid, "paid", BSON_STRUCT_BOOL),
+   BSON_STRUCT_FIELD (order_t, ts, "ts", BSON_STRUCT_DATE_TIME),
+   BSON_STRUCT_FIELD_DOCUMENT (order_t, ship, "ship", gAddressFields),
+};
+
+
+static void
+manual_encode (const order_t *order,
+               bson_t        *doc)
+{
+   bson_t child;
+
+   bson_append_oid (doc, "_id", -1, &order->id);
+   bson_append_utf8 (doc, "user", -1, order->user, -1);
+   bson_append_int32 (doc, "qty", -1, order->qty);
+   bson_append_double (doc, "price", -1, order->price);
+   bson_append_bool (doc, "paid", -1, order->paid);
+   bson_append_date_time (doc, "ts", -1, order->ts);
+   bson_append_document_begin (doc, "ship", -1, &child);
+   bson_append_utf8 (&child, "city", -1, order->ship.city, -1);
+   bson_append_int32 (&child, "zip", -1, order->ship.zip);
+   bson_append_document_end (doc, &child);
+}
+
+
+static bool
+manual_decode (const bson_t *doc,
+               order_t      *order)
+{
+   bson_iter_t iter;
+   bson_iter_t child;
+
+#define FIND(_iter, _key, _holds) \
+   (bson_iter_init (&iter, doc) && \
+    bson_iter_find ((_iter), (_key)) && \
+    _holds ((_iter)))
+
+   if (!FIND (&iter, "_id", BSON_ITER_HOLDS_OID)) {
+      return false;
+   }
+   bson_oid_copy (bson_iter_oid (&iter), &order->id);
+
+   if (!FIND (&iter, "user", BSON_ITER_HOLDS_UTF8)) {
+      return false;
+   }
+   order->user = bson_iter_utf8 (&iter, NULL);
+
+   if (!FIND (&iter, "qty", BSON_ITER_HOLDS_INT32)) {
+      return false;
+   }
+   order->qty = bson_iter_int32 (&iter);
+
+   if (!FIND (&iter, "price", BSON_ITER_HOLDS_DOUBLE)) {
+      return false;
+   }
+   order->price = bson_iter_double (&iter);
+
+   if (!FIND (&iter, "paid", BSON_ITER_HOLDS_BOOL)) {
+      return false;
+   }
+   order->paid = bson_iter_bool (&iter);
+
+   if (!FIND (&iter, "ts", BSON_ITER_HOLDS_DATE_TIME)) {
+      return false;
+   }
+   order->ts = bson_iter_date_time (&iter);
+
+   if (!FIND (&iter, "ship", BSON_ITER_HOLDS_DOCUMENT) ||
+       !bson_iter_recurse (&iter, &child)) {
+      return false;
+   }
+
+   if (!bson_iter_find (&child, "city") || !BSON_ITER_HOLDS_UTF8 (&child)) {
+      return false;
+   }
+   order->ship.city = bson_iter_utf8 (&child, NULL);
+
+   if (!bson_iter_recurse (&iter, &child) ||
+       !bson_iter_find (&child, "zip") ||
+       !BSON_ITER_HOLDS_INT32 (&child)) {
+      return false;
+   }
+   order->ship.zip = bson_iter_int32 (&child);
+
+#undef FIND
+
+   return true;
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+   bson_struct_desc_t *desc;
+   bson_error_t error;
+   order_t order;
+   order_t decoded;
+   int64_t start;
+   int64_t manual_usec;
+   int64_t desc_usec;
+   int64_t checksum[2] = { 0 };
+   bson_t doc;
+   int n;
+   int i;
+
+   if (argc != 2 || (n = atoi (argv[1])) <= 0) {
+      fprintf (stderr, "usage: %s NUM_ROUND_TRIPS\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   if (!(desc = bson_struct_desc_new (gOrderFields,
+                                      sizeof gOrderFields / sizeof gOrderFields[0],
+                                      &error))) {
+      fprintf (stderr, "%s\n", error.message);
+      return EXIT_FAILURE;
+   }
+
+   memset (&order, 0, sizeof order);
+   bson_oid_init (&order.id, NULL);
+   order.user = "customer-00042";
+   order.price = 9.99;
+   order.paid = true;
+   order.ts = 1400000000000LL;
+   order.ship.city = "New York";
+   order.ship.zip = 10001;
+
+   bson_init (&doc);
+
+   start = bson_get_monotonic_time ();
+   for (i = 0; i < n; i++) {
+      order.qty = i;
+      bson_reinit (&doc);
+      manual_encode (&order, &doc);
+      if (!manual_decode (&doc, &decoded)) {
+         fprintf (stderr, "manual decode failed\n");
+         return EXIT_FAILURE;
+      }
+      checksum[0] += decoded.qty + decoded.ship.zip;
+   }
+   manual_usec = bson_get_monotonic_time () - start;
+
+   start = bson_get_monotonic_time ();
+   for (i = 0; i < n; i++) {
+      order.qty = i;
+      bson_reinit (&doc);
+      if (!bson_encode_struct (desc, &order, &doc)) {
+         fprintf (stderr, "descriptor encode failed\n");
+         return EXIT_FAILURE;
+      }
+      if (!bson_decode_struct (desc, &doc, &decoded, &error)) {
+         fprintf (stderr, "%s\n", error.message);
+         return EXIT_FAILURE;
+      }
+      checksum[1] += decoded.qty + decoded.ship.zip;
+   }
+   desc_usec = bson_get_monotonic_time () - start;
+
+   printf ("manual:     %.0f round trips/sec\n",
+           n / (BSON_MAX (manual_usec, 1) / 1000000.0));
+   printf ("descriptor: %.0f round trips/sec\n",
+           n / (BSON_MAX (desc_usec, 1) / 1000000.0));
+
+   bson_destroy (&doc);
+   bson_struct_desc_destroy (desc);
+
+   return (checksum[0] == checksum[1]) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
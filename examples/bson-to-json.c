@@ -17,7 +17,7 @@
 
 /*
  * This program will print each BSON document contained in the provided files
- * as a JSON string to STDOUT.
+ * as a JSON string to STDOUT, converting on several threads.
  */
 
 
@@ -25,15 +25,16 @@
 #include <stdio.h>
 
 
+#define N_THREADS 4
+
+
 int
 main (int   argc,
       char *argv[])
 {
    bson_reader_t *reader;
-   const bson_t *b;
    bson_error_t error;
    const char *filename;
-   char *str;
    int i;
 
    /*
@@ -63,12 +64,12 @@ main (int   argc,
       }
 
       /*
-       * Convert each incoming document to JSON and print to stdout.
+       * Convert each incoming document to JSON and print it to stdout on a
+       * line of its own, in the order the documents were read.
        */
-      while ((b = bson_reader_read (reader, NULL))) {
-         str = bson_as_json(b, NULL);
-         fprintf(stdout, "%s\n", str);
-         bson_free(str);
+      if (!bson_to_jsonl (reader, STDOUT_FILENO, N_THREADS, &error)) {
+         fprintf (stderr, "Failed to convert \"%s\": %s\n",
+                  filename, error.message);
       }
 
       /*
@@ -17,25 +17,62 @@
 
 /*
  * This program will print each JSON document contained in the provided files
- * as a BSON string to STDOUT.
+ * as a BSON string to STDOUT. Each file holds one JSON document per line;
+ * lines are parsed on several threads and written in order, and lines that
+ * cannot be parsed are reported to STDERR.
  */
 
 
 #include <bson.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <unistd.h>
+
+
+#define N_THREADS 4
+
+
+typedef struct
+{
+   const char *filename;
+   int         n_errors;
+} ingest_t;
+
+
+static bool
+write_line (uint64_t            line,
+            const bson_t       *doc,
+            const bson_error_t *error,
+            void               *data)
+{
+   ingest_t *ingest = data;
+
+   if (error) {
+      fprintf (stderr, "%s:%" PRIu64 ": %s\n",
+               ingest->filename, line, error->message);
+      ingest->n_errors++;
+      return true;
+   }
+
+   if (fwrite (bson_get_data (doc), 1, doc->len, stdout) != doc->len) {
+      fprintf (stderr, "Failed to write to stdout, exiting.\n");
+      exit (1);
+   }
+
+   return true;
+}
 
 
 int
 main (int   argc,
       char *argv[])
 {
-   bson_json_reader_t *reader;
    bson_error_t error;
-   const char *filename;
-   bson_t doc = BSON_INITIALIZER;
+   ingest_t ingest;
+   int ret = 0;
+   int fd;
    int i;
-   int b;
 
    /*
     * Print program usage if no arguments are provided.
@@ -49,40 +86,39 @@ main (int   argc,
     * Process command line arguments expecting each to be a filename.
     */
    for (i = 1; i < argc; i++) {
-      filename = argv[i];
+      ingest.filename = argv[i];
+      ingest.n_errors = 0;
 
       /*
        * Open the filename provided in command line arguments.
        */
-      if (0 == strcmp (filename, "-")) {
-         reader = bson_json_reader_new_from_fd (STDIN_FILENO, false);
-      } else {
-         if (!(reader = bson_json_reader_new_from_file (filename, &error))) {
-            fprintf (stderr, "Failed to open \"%s\": %s\n",
-                     filename, error.message);
-            continue;
-         }
+      if (0 == strcmp (ingest.filename, "-")) {
+         fd = STDIN_FILENO;
+      } else if (-1 == (fd = open (ingest.filename, O_RDONLY))) {
+         fprintf (stderr, "Failed to open \"%s\"\n", ingest.filename);
+         ret = 1;
+         continue;
       }
 
       /*
-       * Convert each incoming document to BSON and print to stdout.
+       * Convert each incoming line to BSON and print to stdout.
        */
-      while ((b = bson_json_reader_read (reader, &doc, &error))) {
-         if (b < 0) {
-            fprintf (stderr, "Error in json parsing:\n%s\n", error.message);
-            abort ();
-         }
-
-         if (fwrite (bson_get_data(&doc), 1, doc.len, stdout) != doc.len) {
-            fprintf (stderr, "Failed to write to stdout, exiting.\n");
-            exit (1);
-         }
-         bson_reinit (&doc);
+      if (!bson_jsonl_ingest (fd, N_THREADS, BSON_JSONL_NONE, write_line,
+                              &ingest, &error)) {
+         fprintf (stderr, "%s\n", error.message);
+         ret = 1;
+      }
+
+      if (ingest.n_errors) {
+         ret = 1;
       }
 
-      bson_json_reader_destroy (reader);
-      bson_destroy (&doc);
+      if (fd != STDIN_FILENO) {
+         close (fd);
+      }
    }
 
-   return 0;
+   fflush (stdout);
+
+   return ret;
 }
@@ -23,6 +23,7 @@
 
 #include "bcon.h"
 #include "bson-config.h"
+#include "bson-private.h"
 
 /* These stack manipulation macros are used to manage append recursion in
  * bcon_append_ctx_va().  They take care of some awkward dereference rules (the
@@ -203,6 +204,7 @@ typedef union bcon_extract {
 
 static const char *gBconMagic = "BCON_MAGIC";
 static const char *gBconeMagic = "BCONE_MAGIC";
+static const char *gBcontMagic = "BCONT_MAGIC";
 
 const char *
 bson_bcon_magic (void)
@@ -217,6 +219,13 @@ bson_bcone_magic (void)
    return gBconeMagic;
 }
 
+
+const char *
+bson_bcont_magic (void)
+{
+   return gBcontMagic;
+}
+
 static void
 _noop (void)
 {
@@ -461,11 +470,11 @@ _bcon_extract_single (const bson_iter_t *iter,
 }
 
 /* Consumes ap, storing output values into u and returning the type of the
- * captured token.
+ * token starting with mark, the arg already taken from ap.
  *
  * The basic workflow goes like this:
  *
- * 1. Look at the current arg.  It will be a char *
+ * 1. Look at the mark.  It will be a char *
  *    a. If it's a NULL, we're done processing.
  *    b. If it's BCON_MAGIC (a symbol with storage in this module)
  *       I. The next token is the type
@@ -476,15 +485,14 @@ _bcon_extract_single (const bson_iter_t *iter,
  *       II. If not, just call it a UTF8 token and pass that back
  */
 static bcon_type_t
-_bcon_append_tokenize (va_list       *ap,
-                       bcon_append_t *u)
+_bcon_append_tokenize_mark (const char    *mark,
+                            va_list       *ap,
+                            bcon_append_t *u)
 {
-   char *mark;
    bcon_type_t type;
 
-   mark = va_arg (*ap, char *);
-
    assert (mark != BCONE_MAGIC);
+   assert (mark != BCONT_MAGIC);
 
    if (mark == NULL) {
       type = BCON_TYPE_END;
@@ -586,7 +594,7 @@ _bcon_append_tokenize (va_list       *ap,
 
       default:
          type = BCON_TYPE_UTF8;
-         u->UTF8 = mark;
+         u->UTF8 = (char *)mark;
          break;
       }
    }
@@ -595,6 +603,15 @@ _bcon_append_tokenize (va_list       *ap,
 }
 
 
+/* as _bcon_append_tokenize_mark(), consuming the mark from ap too */
+static bcon_type_t
+_bcon_append_tokenize (va_list       *ap,
+                       bcon_append_t *u)
+{
+   return _bcon_append_tokenize_mark (va_arg (*ap, char *), ap, u);
+}
+
+
 /* Consumes ap, storing output values into u and returning the type of the
  * captured token.
  *
@@ -1051,3 +1068,954 @@ bcon_new (void *unused,
 
    return bson;
 }
+
+
+/* A compiled template is a list of ops over a buffer of constant bytes.
+ * CONST copies a run of the buffer, VALUE encodes the next placeholder
+ * value, and BEGIN and END bracket an embedded document whose length
+ * depends on variable-size placeholder values: BEGIN follows its length
+ * slot and END follows its trailing byte, so rendering can patch the
+ * length in. The lengths of all other documents are in the buffer. */
+
+typedef enum
+{
+   BCON_TEMPLATE_OP_CONST,
+   BCON_TEMPLATE_OP_VALUE,
+   BCON_TEMPLATE_OP_BEGIN,
+   BCON_TEMPLATE_OP_END,
+   BCON_TEMPLATE_OP_NOOP,
+} bcon_template_op_type_t;
+
+typedef struct
+{
+   bcon_template_op_type_t op;
+   bcon_type_t             type;
+   uint32_t                offset;
+   uint32_t                len;
+} bcon_template_op_t;
+
+typedef struct
+{
+   bool     is_array;
+   bool     variable;
+   uint32_t i;
+   uint32_t slot;
+   uint32_t size;
+   uint32_t begin;
+} bcon_template_frame_t;
+
+struct _bcon_template_t
+{
+   uint8_t            *buf;
+   uint32_t            buflen;
+   uint32_t            bufalloc;
+   bcon_template_op_t *ops;
+   uint32_t            n_ops;
+   uint32_t            ops_alloc;
+   uint32_t            n_values;
+   uint32_t            size;
+};
+
+/* a placeholder value taken from the va_list */
+typedef struct
+{
+   const void *ptr;
+   uint32_t    len;
+   union {
+      int32_t        INT32;
+      int64_t        INT64;
+      double         DOUBLE;
+      bool           BOOL;
+      bson_subtype_t subtype;
+   } v;
+} bcon_template_value_t;
+
+#define BCON_TEMPLATE_INLINE_VALUES 16
+
+
+static bcon_template_op_t *
+_bcon_template_push_op (bcon_template_t        *tpl,
+                        bcon_template_op_type_t op)
+{
+   bcon_template_op_t *ret;
+
+   if (tpl->n_ops == tpl->ops_alloc) {
+      tpl->ops_alloc = tpl->ops_alloc ? tpl->ops_alloc * 2 : 16;
+      tpl->ops = bson_realloc (tpl->ops, tpl->ops_alloc * sizeof *tpl->ops);
+   }
+
+   ret = &tpl->ops[tpl->n_ops++];
+   memset (ret, 0, sizeof *ret);
+   ret->op = op;
+
+   return ret;
+}
+
+
+/* appends constant bytes, extending the last op if it is a CONST */
+static void
+_bcon_template_emit (bcon_template_t *tpl,
+                     const void      *data,
+                     uint32_t         len)
+{
+   bcon_template_op_t *op;
+
+   if (!len) {
+      return;
+   }
+
+   if (tpl->buflen + len > tpl->bufalloc) {
+      tpl->bufalloc = (uint32_t)bson_next_power_of_two (tpl->buflen + len);
+      tpl->buf = bson_realloc (tpl->buf, tpl->bufalloc);
+   }
+
+   memcpy (tpl->buf + tpl->buflen, data, len);
+
+   if (tpl->n_ops && tpl->ops[tpl->n_ops - 1].op == BCON_TEMPLATE_OP_CONST) {
+      tpl->ops[tpl->n_ops - 1].len += len;
+   } else {
+      op = _bcon_template_push_op (tpl, BCON_TEMPLATE_OP_CONST);
+      op->offset = tpl->buflen;
+      op->len = len;
+   }
+
+   tpl->buflen += len;
+   tpl->size += len;
+}
+
+
+static void
+_bcon_template_emit_header (bcon_template_t *tpl,
+                            bson_type_t      type,
+                            const char      *key)
+{
+   uint8_t type_byte = (uint8_t)type;
+
+   _bcon_template_emit (tpl, &type_byte, 1);
+   _bcon_template_emit (tpl, key, (uint32_t)strlen (key) + 1);
+}
+
+
+/* appends the elements of a scratch document, without its length and
+ * trailing byte */
+static void
+_bcon_template_emit_elements (bcon_template_t *tpl,
+                              const bson_t    *doc)
+{
+   _bcon_template_emit (tpl, bson_get_data (doc) + 4, doc->len - 5);
+}
+
+
+static bson_type_t
+_bcon_template_placeholder_type (bcon_type_t type)
+{
+   switch ((int)type) {
+   case BCON_TYPE_UTF8:
+      return BSON_TYPE_UTF8;
+   case BCON_TYPE_DOUBLE:
+      return BSON_TYPE_DOUBLE;
+   case BCON_TYPE_DOCUMENT:
+      return BSON_TYPE_DOCUMENT;
+   case BCON_TYPE_ARRAY:
+      return BSON_TYPE_ARRAY;
+   case BCON_TYPE_BIN:
+      return BSON_TYPE_BINARY;
+   case BCON_TYPE_OID:
+      return BSON_TYPE_OID;
+   case BCON_TYPE_BOOL:
+      return BSON_TYPE_BOOL;
+   case BCON_TYPE_DATE_TIME:
+      return BSON_TYPE_DATE_TIME;
+   case BCON_TYPE_INT32:
+      return BSON_TYPE_INT32;
+   case BCON_TYPE_INT64:
+      return BSON_TYPE_INT64;
+   default:
+      assert (0);
+      return BSON_TYPE_EOD;
+   }
+}
+
+
+/* the encoded size of a placeholder's value, or 0 if it varies */
+static uint32_t
+_bcon_template_placeholder_size (bcon_type_t type)
+{
+   switch ((int)type) {
+   case BCON_TYPE_DOUBLE:
+   case BCON_TYPE_DATE_TIME:
+   case BCON_TYPE_INT64:
+      return 8;
+   case BCON_TYPE_OID:
+      return 12;
+   case BCON_TYPE_BOOL:
+      return 1;
+   case BCON_TYPE_INT32:
+      return 4;
+   default:
+      return 0;
+   }
+}
+
+
+/* Compiles a template from the same tokens as bcon_append_ctx_va(), plus
+ * BCONT_MAGIC placeholders. Constant values are encoded by appending them
+ * to a scratch document with _bcon_append_single(), and copying the
+ * element out. */
+bcon_template_t *
+bcon_template_new_va (va_list *ap)
+{
+   bcon_template_frame_t stack[BCON_STACK_MAX];
+   bcon_template_frame_t *frame;
+   bcon_template_op_t *op;
+   bcon_template_t *tpl;
+   bcon_append_t u = { 0 };
+   bcon_type_t type;
+   bson_iter_t iter;
+   const char *mark;
+   const char *key;
+   uint32_t size;
+   uint32_t i;
+   uint32_t j;
+   uint32_t le;
+   char i_str[16];
+   bson_t scratch;
+   int n = 0;
+
+   tpl = bson_malloc0 (sizeof *tpl);
+   bson_init (&scratch);
+
+   frame = &stack[0];
+   memset (frame, 0, sizeof *frame);
+
+   while (1) {
+      if (frame->is_array) {
+         bson_uint32_to_string (frame->i, &key, i_str, sizeof i_str);
+         frame->i++;
+      } else {
+         type = _bcon_append_tokenize (ap, &u);
+
+         if (type == BCON_TYPE_END) {
+            break;
+         }
+
+         if (type == BCON_TYPE_BCON) {
+            _bcon_template_emit_elements (tpl, u.BCON);
+            continue;
+         }
+
+         if (type != BCON_TYPE_DOC_END) {
+            assert (type == BCON_TYPE_UTF8);
+            key = u.UTF8;
+         }
+      }
+
+      if (!frame->is_array && type == BCON_TYPE_DOC_END) {
+         /* handled below with the other closing tokens */
+      } else if ((mark = va_arg (*ap, const char *)) == BCONT_MAGIC) {
+         type = va_arg (*ap, bcon_type_t);
+         _bcon_template_emit_header (
+            tpl, _bcon_template_placeholder_type (type), key);
+         op = _bcon_template_push_op (tpl, BCON_TEMPLATE_OP_VALUE);
+         op->type = type;
+         tpl->n_values++;
+
+         if ((size = _bcon_template_placeholder_size (type))) {
+            tpl->size += size;
+         } else {
+            frame->variable = true;
+         }
+
+         continue;
+      } else {
+         type = _bcon_append_tokenize_mark (mark, ap, &u);
+         assert (type != BCON_TYPE_END);
+      }
+
+      switch ((int)type) {
+      case BCON_TYPE_BCON:
+         assert (frame->is_array);
+         frame->i--;
+
+         if (bson_iter_init (&iter, u.BCON)) {
+            while (bson_iter_next (&iter)) {
+               bson_uint32_to_string (frame->i, &key, i_str, sizeof i_str);
+               frame->i++;
+               bson_reinit (&scratch);
+               bson_append_iter (&scratch, key, -1, &iter);
+               _bcon_template_emit_elements (tpl, &scratch);
+            }
+         }
+
+         break;
+      case BCON_TYPE_DOC_START:
+      case BCON_TYPE_ARRAY_START:
+         assert (n < (BCON_STACK_MAX - 1));
+         _bcon_template_emit_header (tpl,
+                                     type == BCON_TYPE_DOC_START ?
+                                     BSON_TYPE_DOCUMENT : BSON_TYPE_ARRAY,
+                                     key);
+         frame = &stack[++n];
+         frame->is_array = (type == BCON_TYPE_ARRAY_START);
+         frame->variable = false;
+         frame->i = 0;
+         frame->slot = tpl->buflen;
+         frame->size = tpl->size;
+         le = 0;
+         _bcon_template_emit (tpl, &le, sizeof le);
+         frame->begin = tpl->n_ops;
+         _bcon_template_push_op (tpl, BCON_TEMPLATE_OP_BEGIN);
+         break;
+      case BCON_TYPE_DOC_END:
+      case BCON_TYPE_ARRAY_END:
+         assert (n != 0);
+         assert (frame->is_array == (type == BCON_TYPE_ARRAY_END));
+         le = 0;
+         _bcon_template_emit (tpl, &le, 1);
+
+         if (frame->variable) {
+            _bcon_template_push_op (tpl, BCON_TEMPLATE_OP_END);
+            stack[n - 1].variable = true;
+         } else {
+            le = BSON_UINT32_TO_LE (tpl->size - frame->size);
+            memcpy (tpl->buf + frame->slot, &le, sizeof le);
+            tpl->ops[frame->begin].op = BCON_TEMPLATE_OP_NOOP;
+         }
+
+         frame = &stack[--n];
+         break;
+      default:
+         bson_reinit (&scratch);
+         _bcon_append_single (&scratch, type, key, &u);
+         _bcon_template_emit_elements (tpl, &scratch);
+         break;
+      }
+   }
+
+   assert (n == 0);
+
+   /* drop the BEGIN ops of constant-length documents, and merge the CONST
+    * ops on either side of them */
+   for (i = 0, j = 0; i < tpl->n_ops; i++) {
+      if (tpl->ops[i].op == BCON_TEMPLATE_OP_NOOP) {
+         continue;
+      }
+
+      if (j && tpl->ops[i].op == BCON_TEMPLATE_OP_CONST &&
+          tpl->ops[j - 1].op == BCON_TEMPLATE_OP_CONST) {
+         tpl->ops[j - 1].len += tpl->ops[i].len;
+      } else {
+         tpl->ops[j++] = tpl->ops[i];
+      }
+   }
+
+   tpl->n_ops = j;
+
+   bson_destroy (&scratch);
+
+   return tpl;
+}
+
+
+bcon_template_t *
+bcon_template_new (void *unused,
+                   ...)
+{
+   bcon_template_t *tpl;
+   va_list ap;
+
+   va_start (ap, unused);
+   tpl = bcon_template_new_va (&ap);
+   va_end (ap);
+
+   return tpl;
+}
+
+
+void
+bcon_template_destroy (bcon_template_t *tpl)
+{
+   if (tpl) {
+      bson_free (tpl->buf);
+      bson_free (tpl->ops);
+      bson_free (tpl);
+   }
+}
+
+
+/* takes the next placeholder value from ap, returning the size of its
+ * encoding if that varies */
+static size_t
+_bcon_template_take_value (bcon_type_t            type,
+                           va_list               *ap,
+                           bcon_template_value_t *value)
+{
+   const bson_t *doc;
+   size_t len;
+
+   switch ((int)type) {
+   case BCON_TYPE_UTF8:
+      value->ptr = va_arg (*ap, const char *);
+      assert (value->ptr);
+      len = strlen ((const char *)value->ptr);
+      value->len = len > INT32_MAX ? INT32_MAX : (uint32_t)len;
+      return len + 5;
+   case BCON_TYPE_DOUBLE:
+      value->v.DOUBLE = va_arg (*ap, double);
+      break;
+   case BCON_TYPE_DOCUMENT:
+   case BCON_TYPE_ARRAY:
+      doc = va_arg (*ap, const bson_t *);
+      value->ptr = bson_get_data (doc);
+      value->len = doc->len;
+      return doc->len;
+   case BCON_TYPE_BIN:
+      value->v.subtype = va_arg (*ap, bson_subtype_t);
+      value->ptr = va_arg (*ap, const uint8_t *);
+      value->len = va_arg (*ap, uint32_t);
+
+      if (value->v.subtype == BSON_SUBTYPE_BINARY_DEPRECATED) {
+         return (size_t)value->len + 9;
+      }
+
+      return (size_t)value->len + 5;
+   case BCON_TYPE_OID:
+      value->ptr = va_arg (*ap, const bson_oid_t *);
+      break;
+   case BCON_TYPE_BOOL:
+      value->v.BOOL = va_arg (*ap, int);
+      break;
+   case BCON_TYPE_DATE_TIME:
+   case BCON_TYPE_INT64:
+      value->v.INT64 = va_arg (*ap, int64_t);
+      break;
+   case BCON_TYPE_INT32:
+      value->v.INT32 = va_arg (*ap, int32_t);
+      break;
+   default:
+      assert (0);
+      break;
+   }
+
+   return 0;
+}
+
+
+static uint8_t *
+_bcon_template_write_value (bcon_type_t                  type,
+                            const bcon_template_value_t *value,
+                            uint8_t                     *out)
+{
+   uint32_t u32;
+   uint64_t u64;
+   double dbl;
+
+   switch ((int)type) {
+   case BCON_TYPE_UTF8:
+      u32 = BSON_UINT32_TO_LE (value->len + 1);
+      memcpy (out, &u32, 4);
+      memcpy (out + 4, value->ptr, value->len);
+      out[4 + value->len] = '\0';
+      return out + value->len + 5;
+   case BCON_TYPE_DOUBLE:
+      dbl = BSON_DOUBLE_TO_LE (value->v.DOUBLE);
+      memcpy (out, &dbl, 8);
+      return out + 8;
+   case BCON_TYPE_DOCUMENT:
+   case BCON_TYPE_ARRAY:
+      memcpy (out, value->ptr, value->len);
+      return out + value->len;
+   case BCON_TYPE_BIN:
+      if (value->v.subtype == BSON_SUBTYPE_BINARY_DEPRECATED) {
+         u32 = BSON_UINT32_TO_LE (value->len + 4);
+         memcpy (out, &u32, 4);
+         out[4] = (uint8_t)value->v.subtype;
+         u32 = BSON_UINT32_TO_LE (value->len);
+         memcpy (out + 5, &u32, 4);
+         out += 9;
+      } else {
+         u32 = BSON_UINT32_TO_LE (value->len);
+         memcpy (out, &u32, 4);
+         out[4] = (uint8_t)value->v.subtype;
+         out += 5;
+      }
+
+      memcpy (out, value->ptr, value->len);
+      return out + value->len;
+   case BCON_TYPE_OID:
+      memcpy (out, value->ptr, 12);
+      return out + 12;
+   case BCON_TYPE_BOOL:
+      *out = value->v.BOOL ? 1 : 0;
+      return out + 1;
+   case BCON_TYPE_DATE_TIME:
+   case BCON_TYPE_INT64:
+      u64 = BSON_UINT64_TO_LE ((uint64_t)value->v.INT64);
+      memcpy (out, &u64, 8);
+      return out + 8;
+   case BCON_TYPE_INT32:
+      u32 = BSON_UINT32_TO_LE ((uint32_t)value->v.INT32);
+      memcpy (out, &u32, 4);
+      return out + 4;
+   default:
+      assert (0);
+      return out;
+   }
+}
+
+
+/* Appends the template's fields to bson, taking a value from ap for each
+ * placeholder. The values are taken first to size the output, so bson
+ * grows at most once, then the constant runs and values are copied in and
+ * the variable document lengths patched. Returns false, leaving bson
+ * unchanged, if it would exceed the maximum document size. */
+bool
+bcon_template_render_va (const bcon_template_t *tpl,
+                         bson_t                *bson,
+                         va_list               *ap)
+{
+   bcon_template_value_t inline_values[BCON_TEMPLATE_INLINE_VALUES];
+   bcon_template_value_t *values = inline_values;
+   const bcon_template_op_t *op;
+   uint32_t stack[BCON_STACK_MAX];
+   uint32_t old_len;
+   uint32_t le;
+   uint32_t i;
+   uint32_t v = 0;
+   size_t size;
+   uint8_t *buf;
+   uint8_t *out;
+   bool ret = false;
+   int n = 0;
+
+   BSON_ASSERT (tpl);
+   BSON_ASSERT (bson);
+
+   if (tpl->n_values > BCON_TEMPLATE_INLINE_VALUES) {
+      values = bson_malloc (tpl->n_values * sizeof *values);
+   }
+
+   size = tpl->size;
+
+   for (i = 0; i < tpl->n_ops; i++) {
+      if (tpl->ops[i].op == BCON_TEMPLATE_OP_VALUE) {
+         size += _bcon_template_take_value (tpl->ops[i].type, ap, &values[v++]);
+      }
+   }
+
+   old_len = bson->len;
+
+   if (size > (size_t)INT32_MAX - old_len ||
+       !(buf = bson_reserve_buffer (bson, (uint32_t)(old_len + size)))) {
+      goto cleanup;
+   }
+
+   /* the new fields replace the trailing byte of bson */
+   out = buf + old_len - 1;
+   v = 0;
+
+   for (i = 0; i < tpl->n_ops; i++) {
+      op = &tpl->ops[i];
+
+      switch (op->op) {
+      case BCON_TEMPLATE_OP_CONST:
+         memcpy (out, tpl->buf + op->offset, op->len);
+         out += op->len;
+         break;
+      case BCON_TEMPLATE_OP_VALUE:
+         out = _bcon_template_write_value (op->type, &values[v++], out);
+         break;
+      case BCON_TEMPLATE_OP_BEGIN:
+         stack[n++] = (uint32_t)(out - buf) - 4;
+         break;
+      case BCON_TEMPLATE_OP_END:
+         n--;
+         le = BSON_UINT32_TO_LE ((uint32_t)(out - buf) - stack[n]);
+         memcpy (buf + stack[n], &le, sizeof le);
+         break;
+      case BCON_TEMPLATE_OP_NOOP:
+      default:
+         break;
+      }
+   }
+
+   *out = '\0';
+
+   le = BSON_UINT32_TO_LE (bson->len);
+   memcpy (buf, &le, sizeof le);
+
+   ret = true;
+
+cleanup:
+   if (values != inline_values) {
+      bson_free (values);
+   }
+
+   return ret;
+}
+
+
+bool
+bcon_template_render (const bcon_template_t *tpl,
+                      bson_t                *bson,
+                      ...)
+{
+   va_list ap;
+   bool ret;
+
+   va_start (ap, bson);
+   ret = bcon_template_render_va (tpl, bson, &ap);
+   va_end (ap);
+
+   return ret;
+}
+
+
+/* A compiled extraction plan has a level for the document and for each
+ * requested sub-document. A level's entries are found by key with an
+ * open-addressed hash table, and each entry records the generation of the
+ * last execution that matched it, so that only the first of repeated keys
+ * is extracted without clearing flags between documents. */
+
+typedef struct
+{
+   char           *key;
+   uint32_t        key_len;
+   bcon_type_t     type;
+   bcon_extract_t  val;
+   uint32_t        child;
+   uint32_t        seen;
+} bcon_extract_plan_entry_t;
+
+typedef struct
+{
+   bcon_extract_plan_entry_t *entries;
+   uint32_t                   n_entries;
+   uint32_t                   entries_alloc;
+   uint32_t                  *slots;
+   uint32_t                   mask;
+} bcon_extract_plan_level_t;
+
+struct _bcon_extract_plan_t
+{
+   bcon_extract_plan_level_t *levels;
+   uint32_t                   n_levels;
+   uint32_t                   levels_alloc;
+   uint32_t                   generation;
+};
+
+
+static uint32_t
+_bcon_extract_plan_hash (const char *key,
+                         uint32_t    len)
+{
+   uint32_t hash = 2166136261u;
+   uint32_t i;
+
+   /* FNV-1a */
+   for (i = 0; i < len; i++) {
+      hash ^= (uint8_t)key[i];
+      hash *= 16777619u;
+   }
+
+   return hash;
+}
+
+
+static uint32_t
+_bcon_extract_plan_add_level (bcon_extract_plan_t *plan)
+{
+   if (plan->n_levels == plan->levels_alloc) {
+      plan->levels_alloc = plan->levels_alloc ? plan->levels_alloc * 2 : 4;
+      plan->levels = bson_realloc (plan->levels,
+                                   plan->levels_alloc * sizeof *plan->levels);
+   }
+
+   memset (&plan->levels[plan->n_levels], 0, sizeof *plan->levels);
+
+   return plan->n_levels++;
+}
+
+
+static bcon_extract_plan_entry_t *
+_bcon_extract_plan_add_entry (bcon_extract_plan_t  *plan,
+                              uint32_t              level_idx,
+                              const char           *key,
+                              bcon_type_t           type,
+                              const bcon_extract_t *val)
+{
+   bcon_extract_plan_level_t *level = &plan->levels[level_idx];
+   bcon_extract_plan_entry_t *entry;
+   uint32_t i;
+
+   for (i = 0; i < level->n_entries; i++) {
+      /* every key of a level must be distinct */
+      assert (strcmp (level->entries[i].key, key) != 0);
+   }
+
+   if (level->n_entries == level->entries_alloc) {
+      level->entries_alloc = level->entries_alloc ? level->entries_alloc * 2 : 8;
+      level->entries = bson_realloc (
+         level->entries, level->entries_alloc * sizeof *level->entries);
+   }
+
+   entry = &level->entries[level->n_entries++];
+   memset (entry, 0, sizeof *entry);
+   entry->key = bson_strdup (key);
+   entry->key_len = (uint32_t)strlen (key);
+   entry->type = type;
+   entry->val = *val;
+
+   return entry;
+}
+
+
+/* builds each level's hash table, at most half full */
+static void
+_bcon_extract_plan_build_slots (bcon_extract_plan_t *plan)
+{
+   bcon_extract_plan_level_t *level;
+   uint32_t n_slots;
+   uint32_t slot;
+   uint32_t i;
+   uint32_t j;
+
+   for (i = 0; i < plan->n_levels; i++) {
+      level = &plan->levels[i];
+      n_slots = (uint32_t)bson_next_power_of_two (level->n_entries * 2 + 1);
+      level->slots = bson_malloc0 (n_slots * sizeof *level->slots);
+      level->mask = n_slots - 1;
+
+      for (j = 0; j < level->n_entries; j++) {
+         slot = _bcon_extract_plan_hash (level->entries[j].key,
+                                         level->entries[j].key_len);
+
+         while (level->slots[slot & level->mask]) {
+            slot++;
+         }
+
+         level->slots[slot & level->mask] = j + 1;
+      }
+   }
+}
+
+
+/* Compiles a plan from the same tokens as bcon_extract_ctx_va(). The
+ * spec's '{' and '[' open a new level under the entry for their key. */
+bcon_extract_plan_t *
+bcon_extract_plan_new_va (va_list *ap)
+{
+   bcon_extract_ctx_frame_t stack[BCON_STACK_MAX];
+   uint32_t levels[BCON_STACK_MAX];
+   bcon_extract_plan_entry_t *entry;
+   bcon_extract_plan_t *plan;
+   bcon_extract_t u = { 0 };
+   bcon_type_t type;
+   const char *key;
+   char i_str[16];
+   int n = 0;
+
+   plan = bson_malloc0 (sizeof *plan);
+   levels[0] = _bcon_extract_plan_add_level (plan);
+   stack[0].is_array = false;
+   stack[0].i = 0;
+
+   while (1) {
+      if (stack[n].is_array) {
+         bson_uint32_to_string (stack[n].i, &key, i_str, sizeof i_str);
+         stack[n].i++;
+      } else {
+         type = _bcon_extract_tokenize (ap, &u);
+
+         if (type == BCON_TYPE_END) {
+            break;
+         }
+
+         if (type == BCON_TYPE_DOC_END) {
+            assert (n != 0);
+            n--;
+            continue;
+         }
+
+         assert (type == BCON_TYPE_RAW);
+
+         key = u.key;
+      }
+
+      type = _bcon_extract_tokenize (ap, &u);
+      assert (type != BCON_TYPE_END);
+
+      if (type == BCON_TYPE_DOC_END) {
+         assert (n != 0 && !stack[n].is_array);
+         n--;
+      } else if (type == BCON_TYPE_ARRAY_END) {
+         assert (n != 0 && stack[n].is_array);
+         n--;
+      } else {
+         entry = _bcon_extract_plan_add_entry (plan, levels[n], key, type, &u);
+
+         if (type == BCON_TYPE_DOC_START || type == BCON_TYPE_ARRAY_START) {
+            assert (n < (BCON_STACK_MAX - 1));
+            entry->child = _bcon_extract_plan_add_level (plan);
+            n++;
+            levels[n] = entry->child;
+            stack[n].is_array = (type == BCON_TYPE_ARRAY_START);
+            stack[n].i = 0;
+         }
+      }
+   }
+
+   assert (n == 0);
+
+   _bcon_extract_plan_build_slots (plan);
+
+   return plan;
+}
+
+
+bcon_extract_plan_t *
+bcon_extract_plan_new (void *unused,
+                       ...)
+{
+   bcon_extract_plan_t *plan;
+   va_list ap;
+
+   va_start (ap, unused);
+   plan = bcon_extract_plan_new_va (&ap);
+   va_end (ap);
+
+   return plan;
+}
+
+
+void
+bcon_extract_plan_destroy (bcon_extract_plan_t *plan)
+{
+   uint32_t i;
+   uint32_t j;
+
+   if (plan) {
+      for (i = 0; i < plan->n_levels; i++) {
+         for (j = 0; j < plan->levels[i].n_entries; j++) {
+            bson_free (plan->levels[i].entries[j].key);
+         }
+
+         bson_free (plan->levels[i].entries);
+         bson_free (plan->levels[i].slots);
+      }
+
+      bson_free (plan->levels);
+      bson_free (plan);
+   }
+}
+
+
+static bcon_extract_plan_entry_t *
+_bcon_extract_plan_lookup (bcon_extract_plan_level_t *level,
+                           const char                *key,
+                           uint32_t                   key_len)
+{
+   bcon_extract_plan_entry_t *entry;
+   uint32_t slot;
+   uint32_t idx;
+
+   slot = _bcon_extract_plan_hash (key, key_len);
+
+   while ((idx = level->slots[slot & level->mask])) {
+      entry = &level->entries[idx - 1];
+
+      if (entry->key_len == key_len && !memcmp (entry->key, key, key_len)) {
+         return entry;
+      }
+
+      slot++;
+   }
+
+   return NULL;
+}
+
+
+/* extracts the entries of a level from the elements after iter, stopping
+ * as soon as all of them are found */
+static bool
+_bcon_extract_plan_run (bcon_extract_plan_t       *plan,
+                        bcon_extract_plan_level_t *level,
+                        bson_iter_t               *iter)
+{
+   bcon_extract_plan_entry_t *entry;
+   bson_iter_t child;
+   uint32_t found = 0;
+
+   while (found < level->n_entries && bson_iter_next (iter)) {
+      entry = _bcon_extract_plan_lookup (level, bson_iter_key (iter),
+                                         _bson_iter_key_len (iter));
+
+      if (!entry || entry->seen == plan->generation) {
+         continue;
+      }
+
+      entry->seen = plan->generation;
+      found++;
+
+      switch ((int)entry->type) {
+      case BCON_TYPE_DOC_START:
+
+         if (!BSON_ITER_HOLDS_DOCUMENT (iter) ||
+             !bson_iter_recurse (iter, &child) ||
+             !_bcon_extract_plan_run (plan, &plan->levels[entry->child],
+                                      &child)) {
+            return false;
+         }
+
+         break;
+      case BCON_TYPE_ARRAY_START:
+
+         if (!BSON_ITER_HOLDS_ARRAY (iter) ||
+             !bson_iter_recurse (iter, &child) ||
+             !_bcon_extract_plan_run (plan, &plan->levels[entry->child],
+                                      &child)) {
+            return false;
+         }
+
+         break;
+      default:
+
+         if (!_bcon_extract_single (iter, entry->type, &entry->val)) {
+            return false;
+         }
+
+         break;
+      }
+   }
+
+   return found == level->n_entries;
+}
+
+
+/* Fills in the plan's outputs from bson.  Like bcon_extract(), returns
+ * false if a requested key is missing or has the wrong type, in which case
+ * some outputs may have been written. */
+bool
+bcon_extract_plan_execute (bcon_extract_plan_t *plan,
+                           const bson_t        *bson)
+{
+   bson_iter_t iter;
+   uint32_t i;
+   uint32_t j;
+
+   BSON_ASSERT (plan);
+   BSON_ASSERT (bson);
+
+   if (++plan->generation == 0) {
+      for (i = 0; i < plan->n_levels; i++) {
+         for (j = 0; j < plan->levels[i].n_entries; j++) {
+            plan->levels[i].entries[j].seen = 0;
+         }
+      }
+
+      plan->generation = 1;
+   }
+
+   return bson_iter_init (&iter, bson) &&
+          _bcon_extract_plan_run (plan, &plan->levels[0], &iter);
+}
@@ -177,8 +177,21 @@ BCON_ENSURE_DECLARE (const_bson_iter_ptr, const bson_iter_t *)
 #define BCONE_ITER(_val) BCONE_MAGIC, BCON_TYPE_ITER, \
    BCON_ENSURE_STORAGE (bson_iter_ptr, (_val))
 
+/* placeholders for values supplied to bcon_template_render() */
+#define BCONT_UTF8 BCONT_MAGIC, BCON_TYPE_UTF8
+#define BCONT_DOUBLE BCONT_MAGIC, BCON_TYPE_DOUBLE
+#define BCONT_DOCUMENT BCONT_MAGIC, BCON_TYPE_DOCUMENT
+#define BCONT_ARRAY BCONT_MAGIC, BCON_TYPE_ARRAY
+#define BCONT_BIN BCONT_MAGIC, BCON_TYPE_BIN
+#define BCONT_OID BCONT_MAGIC, BCON_TYPE_OID
+#define BCONT_BOOL BCONT_MAGIC, BCON_TYPE_BOOL
+#define BCONT_DATE_TIME BCONT_MAGIC, BCON_TYPE_DATE_TIME
+#define BCONT_INT32 BCONT_MAGIC, BCON_TYPE_INT32
+#define BCONT_INT64 BCONT_MAGIC, BCON_TYPE_INT64
+
 #define BCON_MAGIC  bson_bcon_magic()
 #define BCONE_MAGIC bson_bcone_magic()
+#define BCONT_MAGIC bson_bcont_magic()
 
 typedef enum
 {
@@ -305,8 +318,80 @@ bcon_new (void *unused,
 #define BCON_NEW(...) \
    bcon_new (NULL, __VA_ARGS__, (void *)NULL)
 
+/**
+ * bcon_template_t:
+ *
+ * A BCON spec compiled once, with its keys, constant values and the
+ * lengths of embedded documents already encoded. The BCONT_* placeholders
+ * in the spec are filled in by each bcon_template_render(), which takes
+ * the raw values in order: const char * for BCONT_UTF8, double,
+ * const bson_t *, const bson_t *, then bson_subtype_t, const uint8_t *
+ * and uint32_t for BCONT_BIN, const bson_oid_t *, bool, int64_t, int32_t
+ * and int64_t.
+ *
+ *    tpl = BCON_TEMPLATE_NEW ("find", BCONT_UTF8,
+ *                             "filter", "{", "_id", BCONT_INT32, "}");
+ *    bcon_template_render (tpl, &cmd, "users", (int32_t) 42);
+ *
+ * A compiled template is immutable and may be shared between threads.
+ */
+typedef struct _bcon_template_t bcon_template_t;
+
+bcon_template_t *
+bcon_template_new (void *unused,
+                   ...) BSON_GNUC_NULL_TERMINATED;
+bcon_template_t *
+bcon_template_new_va (va_list *ap);
+void
+bcon_template_destroy (bcon_template_t *tpl);
+bool
+bcon_template_render (const bcon_template_t *tpl,
+                      bson_t                *bson,
+                      ...);
+bool
+bcon_template_render_va (const bcon_template_t *tpl,
+                         bson_t                *bson,
+                         va_list               *ap);
+
+#define BCON_TEMPLATE_NEW(...) \
+   bcon_template_new (NULL, __VA_ARGS__, (void *)NULL)
+
+/**
+ * bcon_extract_plan_t:
+ *
+ * A BCON extraction spec compiled once, as for bcon_extract(), with a
+ * hash table of the keys requested at each level of nesting. Each
+ * bcon_extract_plan_execute() fills in the spec's output pointers in a
+ * single pass over the document and its requested sub-documents.
+ *
+ *    plan = BCON_EXTRACT_PLAN_NEW ("name", BCONE_UTF8 (name),
+ *                                  "addr", "{", "zip", BCONE_INT32 (zip), "}");
+ *    while ((doc = bson_reader_read (reader, NULL))) {
+ *       if (bcon_extract_plan_execute (plan, doc)) { ... }
+ *    }
+ *
+ * A plan writes to the same outputs each time, so it must not be executed
+ * by more than one thread at a time.
+ */
+typedef struct _bcon_extract_plan_t bcon_extract_plan_t;
+
+bcon_extract_plan_t *
+bcon_extract_plan_new (void *unused,
+                       ...) BSON_GNUC_NULL_TERMINATED;
+bcon_extract_plan_t *
+bcon_extract_plan_new_va (va_list *ap);
+void
+bcon_extract_plan_destroy (bcon_extract_plan_t *plan);
+bool
+bcon_extract_plan_execute (bcon_extract_plan_t *plan,
+                           const bson_t        *bson);
+
+#define BCON_EXTRACT_PLAN_NEW(...) \
+   bcon_extract_plan_new (NULL, __VA_ARGS__, (void *)NULL)
+
 const char *bson_bcon_magic  (void) BSON_GNUC_CONST;
 const char *bson_bcone_magic (void) BSON_GNUC_CONST;
+const char *bson_bcont_magic (void) BSON_GNUC_CONST;
 
 
 BSON_END_DECLS
@@ -0,0 +1,1336 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "bson.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bson-aggregate.h"
+#include "bson-memory.h"
+#include "bson-private.h"
+
+
+/*
+ * The column kernels are written without branches and with independent
+ * accumulators so that the compiler can vectorize them. Int64 columns are
+ * summed as separate sums of the high and low 32 bits of each value,
+ * which cannot overflow within a block, so the block's exact sum is
+ * known and overflow is only checked once per block.
+ *
+ * A group-by finds each distinct path of a document once and looks its
+ * key up in an open-addressed hash table. Integral numbers are keyed as
+ * int64s, so that 1, NumberLong(1) and 1.0 fall in the same group.
+ */
+
+
+/* the int64 kernel's block size, so that the partial sums cannot overflow */
+#define BSON_AGGREGATE_BLOCK (1 << 24)
+
+
+typedef struct
+{
+   char                *name;
+   bson_aggregate_op_t  op;
+   int                  path;     /* index into paths, or -1 */
+   bson_value_t         constant; /* summed per document if path is -1 */
+} bson_group_by_field_t;
+
+
+typedef struct
+{
+   uint32_t      hash;
+   uint8_t       tag;
+   uint32_t      key_len;
+   uint8_t      *key;
+   bson_value_t  value;
+} bson_group_by_group_t;
+
+
+struct _bson_group_by_t
+{
+   int                    key;          /* index into paths, or -1 */
+   bson_value_t           key_constant; /* the only key if key is -1 */
+   char                 **paths;
+   uint32_t               n_paths;
+   bson_iter_t           *iters;
+   bool                  *found;
+   bson_group_by_field_t *fields;
+   uint32_t               n_fields;
+   bson_group_by_group_t *groups;
+   size_t                 n_groups;
+   size_t                 groups_alloc;
+   bson_aggregate_t      *aggregates;   /* n_fields per group */
+   uint32_t              *slots;        /* group index + 1, or 0 */
+   size_t                 n_slots;
+};
+
+
+static double
+_bson_aggregate_nan (void)
+{
+   uint64_t bits = 0x7FF8000000000000ULL;
+   double nan;
+
+   memcpy (&nan, &bits, sizeof nan);
+
+   return nan;
+}
+
+
+static void
+_bson_aggregate_sum_int64 (bson_aggregate_t *aggregate, /* IN */
+                           int64_t           v)         /* IN */
+{
+   int64_t sum = aggregate->int64_sum;
+
+   if ((v > 0 && sum > INT64_MAX - v) || (v < 0 && sum < INT64_MIN - v)) {
+      aggregate->double_sum += (double)sum + (double)v;
+      aggregate->int64_sum = 0;
+      aggregate->overflow = true;
+   } else {
+      aggregate->int64_sum = sum + v;
+   }
+}
+
+
+static BSON_INLINE void
+_bson_aggregate_int64 (bson_aggregate_t *aggregate, /* IN */
+                       int64_t           v)         /* IN */
+{
+   aggregate->count++;
+   _bson_aggregate_sum_int64 (aggregate, v);
+   aggregate->int64_min = BSON_MIN (aggregate->int64_min, v);
+   aggregate->int64_max = BSON_MAX (aggregate->int64_max, v);
+}
+
+
+static BSON_INLINE void
+_bson_aggregate_double (bson_aggregate_t *aggregate, /* IN */
+                        double            v)         /* IN */
+{
+   aggregate->count++;
+   aggregate->n_doubles++;
+   aggregate->double_sum += v;
+
+   if (v != v) {
+      aggregate->n_nan++;
+   } else {
+      aggregate->double_min = BSON_MIN (aggregate->double_min, v);
+      aggregate->double_max = BSON_MAX (aggregate->double_max, v);
+   }
+}
+
+
+#ifdef BSON_EXPERIMENTAL_FEATURES
+static double
+_bson_aggregate_decimal128_to_double (const bson_decimal128_t *dec) /* IN */
+{
+   char str[BSON_DECIMAL128_STRING];
+
+   bson_decimal128_to_string (dec, str);
+
+   return strtod (str, NULL);
+}
+#endif /* BSON_EXPERIMENTAL_FEATURES */
+
+
+/* adds the exact sum hi * 2^32 + lo of a block of int64 values */
+static void
+_bson_aggregate_sum_block (bson_aggregate_t *aggregate, /* IN */
+                           int64_t           hi,        /* IN */
+                           int64_t           lo)        /* IN */
+{
+   hi += lo >> 32;
+   lo &= 0xFFFFFFFF;
+
+   if (hi >= INT32_MIN && hi <= INT32_MAX) {
+      _bson_aggregate_sum_int64 (aggregate, hi * 4294967296LL + lo);
+   } else {
+      aggregate->double_sum += (double)hi * 4294967296.0 + (double)lo;
+      aggregate->overflow = true;
+   }
+}
+
+
+/* whether the 64 rows of @validity are all valid */
+static BSON_INLINE bool
+_bson_aggregate_all_valid (const uint8_t *validity) /* IN */
+{
+   uint64_t bits;
+
+   memcpy (&bits, validity, sizeof bits);
+
+   return bits == UINT64_MAX;
+}
+
+
+static void
+_bson_aggregate_int64_column (bson_aggregate_t    *aggregate, /* IN */
+                              const bson_column_t *column)    /* IN */
+{
+   const int64_t *values = column->values;
+   const uint8_t *validity = column->validity;
+   size_t n = column->length;
+   size_t block_end;
+   size_t run_end;
+   size_t i;
+   size_t j;
+   size_t k;
+   int64_t hi[4];
+   int64_t lo[4];
+   int64_t min[4] = { INT64_MAX, INT64_MAX, INT64_MAX, INT64_MAX };
+   int64_t max[4] = { INT64_MIN, INT64_MIN, INT64_MIN, INT64_MIN };
+   int64_t v;
+   bool valid;
+
+   for (i = 0; i < n; i = block_end) {
+      block_end = BSON_MIN (n, i + BSON_AGGREGATE_BLOCK);
+      memset (hi, 0, sizeof hi);
+      memset (lo, 0, sizeof lo);
+
+      /* runs of 64 rows, so that a run without nulls needs no masking */
+      for (j = i; j < block_end; j = run_end) {
+         run_end = BSON_MIN (block_end, j + 64);
+
+         if (run_end - j == 64 &&
+             (!column->null_count ||
+              _bson_aggregate_all_valid (&validity[j / 8]))) {
+            for (; j < run_end; j += 4) {
+               for (k = 0; k < 4; k++) {
+                  v = values[j + k];
+                  hi[k] += v >> 32;
+                  lo[k] += v & 0xFFFFFFFF;
+                  min[k] = v < min[k] ? v : min[k];
+                  max[k] = v > max[k] ? v : max[k];
+               }
+            }
+         } else {
+            for (; j < run_end; j++) {
+               valid = !column->null_count ||
+                       ((validity[j / 8] >> (j % 8)) & 1);
+               v = valid ? values[j] : 0;
+               hi[0] += v >> 32;
+               lo[0] += v & 0xFFFFFFFF;
+               v = valid ? values[j] : INT64_MAX;
+               min[0] = v < min[0] ? v : min[0];
+               v = valid ? values[j] : INT64_MIN;
+               max[0] = v > max[0] ? v : max[0];
+            }
+         }
+      }
+
+      for (k = 0; k < 4; k++) {
+         _bson_aggregate_sum_block (aggregate, hi[k], lo[k]);
+      }
+   }
+
+   for (k = 0; k < 4; k++) {
+      aggregate->int64_min = BSON_MIN (aggregate->int64_min, min[k]);
+      aggregate->int64_max = BSON_MAX (aggregate->int64_max, max[k]);
+   }
+
+   aggregate->count += n - column->null_count;
+}
+
+
+static void
+_bson_aggregate_double_column (bson_aggregate_t    *aggregate, /* IN */
+                               const bson_column_t *column)    /* IN */
+{
+   const double *values = column->values;
+   const uint8_t *validity = column->validity;
+   size_t n = column->length;
+   size_t run_end;
+   size_t j;
+   size_t k;
+   uint64_t n_nan = 0;
+   double sum[4] = { 0.0, 0.0, 0.0, 0.0 };
+   double min[4] = { HUGE_VAL, HUGE_VAL, HUGE_VAL, HUGE_VAL };
+   double max[4] = { -HUGE_VAL, -HUGE_VAL, -HUGE_VAL, -HUGE_VAL };
+   double v;
+   bool valid;
+
+   /* NaN is ignored by min and max, since any comparison with it is false */
+   for (j = 0; j < n; j = run_end) {
+      run_end = BSON_MIN (n, j + 64);
+
+      if (run_end - j == 64 &&
+          (!column->null_count ||
+           _bson_aggregate_all_valid (&validity[j / 8]))) {
+         for (; j < run_end; j += 4) {
+            for (k = 0; k < 4; k++) {
+               v = values[j + k];
+               sum[k] += v;
+               n_nan += (v != v);
+               min[k] = v < min[k] ? v : min[k];
+               max[k] = v > max[k] ? v : max[k];
+            }
+         }
+      } else {
+         for (; j < run_end; j++) {
+            valid = !column->null_count ||
+                    ((validity[j / 8] >> (j % 8)) & 1);
+            v = valid ? values[j] : 0.0;
+            sum[0] += v;
+            n_nan += (v != v);
+            v = valid ? values[j] : HUGE_VAL;
+            min[0] = v < min[0] ? v : min[0];
+            v = valid ? values[j] : -HUGE_VAL;
+            max[0] = v > max[0] ? v : max[0];
+         }
+      }
+   }
+
+   for (k = 0; k < 4; k++) {
+      aggregate->double_sum += sum[k];
+      aggregate->double_min = BSON_MIN (aggregate->double_min, min[k]);
+      aggregate->double_max = BSON_MAX (aggregate->double_max, max[k]);
+   }
+
+   aggregate->count += n - column->null_count;
+   aggregate->n_doubles += n - column->null_count;
+   aggregate->n_nan += n_nan;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_aggregate_init --
+ *
+ *       Initialize @aggregate with no values.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @aggregate is initialized.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+bson_aggregate_init (bson_aggregate_t *aggregate) /* OUT */
+{
+   BSON_ASSERT (aggregate);
+
+   memset (aggregate, 0, sizeof *aggregate);
+   aggregate->int64_min = INT64_MAX;
+   aggregate->int64_max = INT64_MIN;
+   aggregate->double_min = HUGE_VAL;
+   aggregate->double_max = -HUGE_VAL;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_aggregate_column --
+ *
+ *       Add the non-null values of @column, which must be a
+ *       BSON_COLUMN_INT64 or BSON_COLUMN_DOUBLE column, to @aggregate.
+ *
+ * Returns:
+ *       true if successful; false if @column is of another type.
+ *
+ * Side effects:
+ *       @aggregate is updated if successful.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_aggregate_column (bson_aggregate_t    *aggregate, /* IN */
+                       const bson_column_t *column)    /* IN */
+{
+   BSON_ASSERT (aggregate);
+   BSON_ASSERT (column);
+
+   switch (column->type) {
+   case BSON_COLUMN_INT64:
+      _bson_aggregate_int64_column (aggregate, column);
+      return true;
+   case BSON_COLUMN_DOUBLE:
+      _bson_aggregate_double_column (aggregate, column);
+      return true;
+   case BSON_COLUMN_DATE_TIME:
+   case BSON_COLUMN_BOOL:
+   case BSON_COLUMN_UTF8:
+   default:
+      return false;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_aggregate_value --
+ *
+ *       Add @value to @aggregate if it is an int32, int64, double or
+ *       decimal128.
+ *
+ * Returns:
+ *       true if @value was added; false if it is not a number.
+ *
+ * Side effects:
+ *       @aggregate is updated if @value is a number.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_aggregate_value (bson_aggregate_t   *aggregate, /* IN */
+                      const bson_value_t *value)     /* IN */
+{
+   BSON_ASSERT (aggregate);
+   BSON_ASSERT (value);
+
+   switch (value->value_type) {
+   case BSON_TYPE_INT32:
+      _bson_aggregate_int64 (aggregate, value->value.v_int32);
+      return true;
+   case BSON_TYPE_INT64:
+      _bson_aggregate_int64 (aggregate, value->value.v_int64);
+      return true;
+   case BSON_TYPE_DOUBLE:
+      _bson_aggregate_double (aggregate, value->value.v_double);
+      return true;
+#ifdef BSON_EXPERIMENTAL_FEATURES
+   case BSON_TYPE_DECIMAL128:
+      _bson_aggregate_double (
+         aggregate,
+         _bson_aggregate_decimal128_to_double (&value->value.v_decimal128));
+      return true;
+#endif /* BSON_EXPERIMENTAL_FEATURES */
+   default:
+      return false;
+   }
+}
+
+
+static void
+_bson_aggregate_iter (bson_aggregate_t  *aggregate, /* IN */
+                      const bson_iter_t *iter)      /* IN */
+{
+#ifdef BSON_EXPERIMENTAL_FEATURES
+   bson_decimal128_t dec;
+#endif
+
+   switch (bson_iter_type (iter)) {
+   case BSON_TYPE_INT32:
+      _bson_aggregate_int64 (aggregate, bson_iter_int32 (iter));
+      break;
+   case BSON_TYPE_INT64:
+      _bson_aggregate_int64 (aggregate, bson_iter_int64 (iter));
+      break;
+   case BSON_TYPE_DOUBLE:
+      _bson_aggregate_double (aggregate, bson_iter_double (iter));
+      break;
+#ifdef BSON_EXPERIMENTAL_FEATURES
+   case BSON_TYPE_DECIMAL128:
+      if (bson_iter_decimal128 (iter, &dec)) {
+         _bson_aggregate_double (aggregate,
+                                 _bson_aggregate_decimal128_to_double (&dec));
+      }
+      break;
+#endif /* BSON_EXPERIMENTAL_FEATURES */
+   default:
+      break;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_aggregate_merge --
+ *
+ *       Add the values of @other to @aggregate, as when combining the
+ *       aggregates of several threads.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @aggregate is updated.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+bson_aggregate_merge (bson_aggregate_t       *aggregate, /* IN */
+                      const bson_aggregate_t *other)     /* IN */
+{
+   BSON_ASSERT (aggregate);
+   BSON_ASSERT (other);
+
+   aggregate->count += other->count;
+   aggregate->n_doubles += other->n_doubles;
+   aggregate->n_nan += other->n_nan;
+   aggregate->overflow |= other->overflow;
+   _bson_aggregate_sum_int64 (aggregate, other->int64_sum);
+   aggregate->double_sum += other->double_sum;
+   aggregate->int64_min = BSON_MIN (aggregate->int64_min, other->int64_min);
+   aggregate->int64_max = BSON_MAX (aggregate->int64_max, other->int64_max);
+   aggregate->double_min = BSON_MIN (aggregate->double_min,
+                                     other->double_min);
+   aggregate->double_max = BSON_MAX (aggregate->double_max,
+                                     other->double_max);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_aggregate_get --
+ *
+ *       Get a result of @aggregate, following MongoDB's $group
+ *       accumulators:
+ *
+ *       BSON_AGGREGATE_COUNT is the number of values, as an int64.
+ *
+ *       BSON_AGGREGATE_SUM is an int64 if every value was an integer and
+ *       their sum did not overflow, and a double otherwise.
+ *
+ *       BSON_AGGREGATE_MIN and BSON_AGGREGATE_MAX are the least and
+ *       greatest values, as an int64 or a double. NaN is less than any
+ *       other number.
+ *
+ *       BSON_AGGREGATE_AVG is the mean of the values, as a double.
+ *
+ *       MIN, MAX and AVG are null if there are no values.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @value is initialized. It needs no cleanup.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+bson_aggregate_get (const bson_aggregate_t *aggregate, /* IN */
+                    bson_aggregate_op_t     op,        /* IN */
+                    bson_value_t           *value)     /* OUT */
+{
+   bool has_int;
+   bool has_double;
+
+   BSON_ASSERT (aggregate);
+   BSON_ASSERT (value);
+
+   memset (value, 0, sizeof *value);
+   value->value_type = BSON_TYPE_NULL;
+
+   has_int = aggregate->count > aggregate->n_doubles;
+   has_double = aggregate->n_doubles > aggregate->n_nan;
+
+   switch (op) {
+   case BSON_AGGREGATE_COUNT:
+      value->value_type = BSON_TYPE_INT64;
+      value->value.v_int64 = (int64_t)aggregate->count;
+      break;
+   case BSON_AGGREGATE_SUM:
+      if (!aggregate->n_doubles && !aggregate->overflow) {
+         value->value_type = BSON_TYPE_INT64;
+         value->value.v_int64 = aggregate->int64_sum;
+      } else {
+         value->value_type = BSON_TYPE_DOUBLE;
+         value->value.v_double = aggregate->double_sum +
+                                 (double)aggregate->int64_sum;
+      }
+      break;
+   case BSON_AGGREGATE_MIN:
+      if (!aggregate->count) {
+         break;
+      }
+
+      if (aggregate->n_nan) {
+         value->value_type = BSON_TYPE_DOUBLE;
+         value->value.v_double = _bson_aggregate_nan ();
+      } else if (has_int && (!has_double || (double)aggregate->int64_min <=
+                                            aggregate->double_min)) {
+         value->value_type = BSON_TYPE_INT64;
+         value->value.v_int64 = aggregate->int64_min;
+      } else {
+         value->value_type = BSON_TYPE_DOUBLE;
+         value->value.v_double = aggregate->double_min;
+      }
+      break;
+   case BSON_AGGREGATE_MAX:
+      if (!aggregate->count) {
+         break;
+      }
+
+      if (has_int && (!has_double || (double)aggregate->int64_max >=
+                                     aggregate->double_max)) {
+         value->value_type = BSON_TYPE_INT64;
+         value->value.v_int64 = aggregate->int64_max;
+      } else {
+         value->value_type = BSON_TYPE_DOUBLE;
+         value->value.v_double = has_double ? aggregate->double_max :
+                                 _bson_aggregate_nan ();
+      }
+      break;
+   case BSON_AGGREGATE_AVG:
+      if (!aggregate->count) {
+         break;
+      }
+
+      value->value_type = BSON_TYPE_DOUBLE;
+      value->value.v_double = (aggregate->double_sum +
+                               (double)aggregate->int64_sum) /
+                              (double)aggregate->count;
+      break;
+   default:
+      break;
+   }
+}
+
+
+static bool
+_bson_aggregate_is_number (const bson_iter_t *iter) /* IN */
+{
+   switch (bson_iter_type (iter)) {
+   case BSON_TYPE_INT32:
+   case BSON_TYPE_INT64:
+   case BSON_TYPE_DOUBLE:
+#ifdef BSON_EXPERIMENTAL_FEATURES
+   case BSON_TYPE_DECIMAL128:
+#endif
+      return true;
+   default:
+      return false;
+   }
+}
+
+
+static bool
+_bson_group_by_valid_path (const char *path) /* IN */
+{
+   return *path && path[0] != '.' && path[strlen (path) - 1] != '.' &&
+          !strstr (path, "..");
+}
+
+
+/* returns the index of @path in group_by->paths, adding it if needed */
+static int
+_bson_group_by_add_path (bson_group_by_t *group_by, /* IN */
+                         const char      *path)     /* IN */
+{
+   uint32_t i;
+
+   for (i = 0; i < group_by->n_paths; i++) {
+      if (!strcmp (group_by->paths[i], path)) {
+         return (int)i;
+      }
+   }
+
+   group_by->paths = bson_realloc (
+      group_by->paths, (group_by->n_paths + 1) * sizeof *group_by->paths);
+   group_by->paths[group_by->n_paths] = bson_strdup (path);
+
+   return (int)group_by->n_paths++;
+}
+
+
+static bool
+_bson_group_by_add_field (bson_group_by_t *group_by, /* IN */
+                          bson_iter_t     *iter,     /* IN */
+                          bson_error_t    *error)    /* OUT */
+{
+   static const struct {
+      const char          *name;
+      bson_aggregate_op_t  op;
+   } ops[] = {
+      { "$sum", BSON_AGGREGATE_SUM },
+      { "$min", BSON_AGGREGATE_MIN },
+      { "$max", BSON_AGGREGATE_MAX },
+      { "$avg", BSON_AGGREGATE_AVG },
+   };
+   bson_group_by_field_t field;
+   const char *name = bson_iter_key (iter);
+   const char *path;
+   bson_iter_t child;
+   uint32_t i;
+
+   memset (&field, 0, sizeof field);
+   field.path = -1;
+
+   if (name[0] == '$' || strchr (name, '.')) {
+      bson_set_error (error,
+                      BSON_ERROR_AGGREGATE,
+                      BSON_ERROR_AGGREGATE_INVALID,
+                      "Invalid field name \"%s\".", name);
+      return false;
+   }
+
+   for (i = 0; i < group_by->n_fields; i++) {
+      if (!strcmp (group_by->fields[i].name, name)) {
+         bson_set_error (error,
+                         BSON_ERROR_AGGREGATE,
+                         BSON_ERROR_AGGREGATE_INVALID,
+                         "Duplicate field \"%s\".", name);
+         return false;
+      }
+   }
+
+   if (!BSON_ITER_HOLDS_DOCUMENT (iter) || !bson_iter_recurse (iter, &child) ||
+       !bson_iter_next (&child)) {
+      goto invalid;
+   }
+
+   for (i = 0; i < sizeof ops / sizeof ops[0]; i++) {
+      if (!strcmp (bson_iter_key (&child), ops[i].name)) {
+         break;
+      }
+   }
+
+   if (i == sizeof ops / sizeof ops[0]) {
+      goto invalid;
+   }
+
+   field.op = ops[i].op;
+
+   if (BSON_ITER_HOLDS_UTF8 (&child) &&
+       (path = bson_iter_utf8 (&child, NULL))[0] == '$') {
+      if (!_bson_group_by_valid_path (path + 1)) {
+         goto invalid;
+      }
+
+      field.path = _bson_group_by_add_path (group_by, path + 1);
+   } else if (field.op == BSON_AGGREGATE_SUM && _bson_aggregate_is_number (&child)) {
+      bson_value_copy (bson_iter_value (&child), &field.constant);
+   } else {
+      goto invalid;
+   }
+
+   if (bson_iter_next (&child)) {
+      goto invalid;
+   }
+
+   field.name = bson_strdup (name);
+   group_by->fields = bson_realloc (
+      group_by->fields, (group_by->n_fields + 1) * sizeof *group_by->fields);
+   group_by->fields[group_by->n_fields++] = field;
+
+   return true;
+
+invalid:
+   bson_set_error (error,
+                   BSON_ERROR_AGGREGATE,
+                   BSON_ERROR_AGGREGATE_INVALID,
+                   "Field \"%s\" must be a document of one $sum, $min, $max "
+                   "or $avg of a \"$path\", or a $sum of a number.", name);
+   return false;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_group_by_new --
+ *
+ *       Compile @spec into a bson_group_by_t.
+ *
+ *       @spec uses the syntax of MongoDB's $group stage. Its "_id" is
+ *       either a "$path" to group documents by, or a constant to put
+ *       every document in one group. Each other field is a document with
+ *       one accumulator: $sum, $min, $max or $avg of a "$path", or a $sum
+ *       of a number, such as {"$sum": 1} to count documents.
+ *
+ *       Documents missing the "_id" path are grouped under null. Numbers
+ *       of different types are grouped together if they are equal.
+ *
+ * Returns:
+ *       A newly allocated bson_group_by_t that should be freed with
+ *       bson_group_by_destroy(), or NULL and @error is set if @spec is
+ *       invalid.
+ *
+ * Side effects:
+ *       @error may be set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bson_group_by_t *
+bson_group_by_new (const bson_t *spec,  /* IN */
+                   bson_error_t *error) /* OUT */
+{
+   bson_group_by_t *group_by;
+   const char *path;
+   bson_iter_t iter;
+   bool has_id = false;
+
+   BSON_ASSERT (spec);
+
+   group_by = bson_malloc0 (sizeof *group_by);
+   group_by->key = -1;
+   group_by->key_constant.value_type = BSON_TYPE_NULL;
+
+   if (!bson_iter_init (&iter, spec)) {
+      bson_set_error (error,
+                      BSON_ERROR_AGGREGATE,
+                      BSON_ERROR_AGGREGATE_CORRUPT,
+                      "The $group spec is corrupt.");
+      goto failure;
+   }
+
+   while (bson_iter_next (&iter)) {
+      if (strcmp (bson_iter_key (&iter), "_id") != 0) {
+         if (!_bson_group_by_add_field (group_by, &iter, error)) {
+            goto failure;
+         }
+      } else if (has_id) {
+         bson_set_error (error,
+                         BSON_ERROR_AGGREGATE,
+                         BSON_ERROR_AGGREGATE_INVALID,
+                         "Duplicate field \"_id\".");
+         goto failure;
+      } else if (BSON_ITER_HOLDS_UTF8 (&iter) &&
+                 (path = bson_iter_utf8 (&iter, NULL))[0] == '$') {
+         if (!_bson_group_by_valid_path (path + 1)) {
+            bson_set_error (error,
+                            BSON_ERROR_AGGREGATE,
+                            BSON_ERROR_AGGREGATE_INVALID,
+                            "Invalid _id path \"%s\".", path);
+            goto failure;
+         }
+
+         group_by->key = _bson_group_by_add_path (group_by, path + 1);
+         has_id = true;
+      } else if (bson_iter_value (&iter)) {
+         bson_value_copy (bson_iter_value (&iter), &group_by->key_constant);
+         has_id = true;
+      } else {
+         bson_set_error (error,
+                         BSON_ERROR_AGGREGATE,
+                         BSON_ERROR_AGGREGATE_INVALID,
+                         "Unsupported _id type 0x%02x.",
+                         (int)bson_iter_type (&iter));
+         goto failure;
+      }
+   }
+
+   if (!has_id) {
+      bson_set_error (error,
+                      BSON_ERROR_AGGREGATE,
+                      BSON_ERROR_AGGREGATE_INVALID,
+                      "The $group spec must have an \"_id\".");
+      goto failure;
+   }
+
+   group_by->iters = bson_malloc0 (
+      BSON_MAX (group_by->n_paths, 1) * sizeof *group_by->iters);
+   group_by->found = bson_malloc0 (
+      BSON_MAX (group_by->n_paths, 1) * sizeof *group_by->found);
+
+   return group_by;
+
+failure:
+   bson_group_by_destroy (group_by);
+
+   return NULL;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_group_by_destroy --
+ *
+ *       Free a bson_group_by_t and its groups.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+bson_group_by_destroy (bson_group_by_t *group_by) /* IN */
+{
+   uint32_t i;
+
+   if (!group_by) {
+      return;
+   }
+
+   bson_group_by_clear (group_by);
+
+   for (i = 0; i < group_by->n_paths; i++) {
+      bson_free (group_by->paths[i]);
+   }
+
+   for (i = 0; i < group_by->n_fields; i++) {
+      bson_free (group_by->fields[i].name);
+      bson_value_destroy (&group_by->fields[i].constant);
+   }
+
+   bson_value_destroy (&group_by->key_constant);
+   bson_free (group_by->paths);
+   bson_free (group_by->iters);
+   bson_free (group_by->found);
+   bson_free (group_by->fields);
+   bson_free (group_by->groups);
+   bson_free (group_by->aggregates);
+   bson_free (group_by->slots);
+   bson_free (group_by);
+}
+
+
+static uint32_t
+_bson_group_by_hash (uint8_t        tag, /* IN */
+                     const uint8_t *key, /* IN */
+                     uint32_t       len) /* IN */
+{
+   uint32_t hash = 2166136261u;
+   uint32_t i;
+
+   /* FNV-1a */
+   hash = (hash ^ tag) * 16777619u;
+
+   for (i = 0; i < len; i++) {
+      hash ^= key[i];
+      hash *= 16777619u;
+   }
+
+   return hash;
+}
+
+
+static size_t
+_bson_group_by_add_group (bson_group_by_t *group_by, /* IN */
+                          uint32_t         hash,     /* IN */
+                          uint8_t          tag,      /* IN */
+                          const uint8_t   *key,      /* IN */
+                          uint32_t         key_len,  /* IN */
+                          bson_iter_t     *iter)     /* IN */
+{
+   bson_group_by_group_t *group;
+   size_t i;
+
+   if (group_by->n_groups == group_by->groups_alloc) {
+      group_by->groups_alloc = BSON_MAX (group_by->groups_alloc * 2, 16);
+      group_by->groups = bson_realloc (
+         group_by->groups,
+         group_by->groups_alloc * sizeof *group_by->groups);
+      group_by->aggregates = bson_realloc (
+         group_by->aggregates,
+         group_by->groups_alloc * group_by->n_fields *
+         sizeof *group_by->aggregates);
+   }
+
+   group = &group_by->groups[group_by->n_groups];
+   group->hash = hash;
+   group->tag = tag;
+   group->key_len = key_len;
+   group->key = key_len ? bson_malloc (key_len) : NULL;
+
+   if (key_len) {
+      memcpy (group->key, key, key_len);
+   }
+
+   if (iter) {
+      bson_value_copy (bson_iter_value (iter), &group->value);
+   } else if (group_by->key < 0) {
+      bson_value_copy (&group_by->key_constant, &group->value);
+   } else {
+      memset (&group->value, 0, sizeof group->value);
+      group->value.value_type = BSON_TYPE_NULL;
+   }
+
+   for (i = 0; i < group_by->n_fields; i++) {
+      bson_aggregate_init (
+         &group_by->aggregates[group_by->n_groups * group_by->n_fields + i]);
+   }
+
+   return group_by->n_groups++;
+}
+
+
+static void
+_bson_group_by_rehash (bson_group_by_t *group_by) /* IN */
+{
+   size_t mask;
+   size_t slot;
+   size_t i;
+
+   group_by->n_slots = BSON_MAX (group_by->n_slots * 2, 32);
+   bson_free (group_by->slots);
+   group_by->slots = bson_malloc0 (group_by->n_slots *
+                                   sizeof *group_by->slots);
+   mask = group_by->n_slots - 1;
+
+   for (i = 0; i < group_by->n_groups; i++) {
+      slot = group_by->groups[i].hash & mask;
+
+      while (group_by->slots[slot]) {
+         slot = (slot + 1) & mask;
+      }
+
+      group_by->slots[slot] = (uint32_t)(i + 1);
+   }
+}
+
+
+/*
+ * finds or adds the group of the key at @iter, or of null if not found;
+ * fails if the key is a new value that cannot be boxed, such as a
+ * decimal128 without BSON_EXPERIMENTAL_FEATURES
+ */
+static bool
+_bson_group_by_lookup (bson_group_by_t *group_by, /* IN */
+                       bson_iter_t     *iter,     /* IN */
+                       bool             found,    /* IN */
+                       size_t          *group_id, /* OUT */
+                       bson_error_t    *error)    /* OUT */
+{
+   bson_group_by_group_t *group;
+   const uint8_t *key = NULL;
+   uint8_t number[8];
+   uint32_t key_len = 0;
+   uint32_t hash;
+   uint8_t tag = BSON_TYPE_NULL;
+   size_t mask;
+   size_t slot;
+   int64_t i64;
+   double d;
+
+   if (found) {
+      tag = (uint8_t)bson_iter_type (iter);
+
+      switch (tag) {
+      case BSON_TYPE_INT32:
+      case BSON_TYPE_INT64:
+         tag = BSON_TYPE_INT64;
+         i64 = bson_iter_as_int64 (iter);
+         memcpy (number, &i64, sizeof number);
+         key = number;
+         key_len = sizeof number;
+         break;
+      case BSON_TYPE_DOUBLE:
+         d = bson_iter_double (iter);
+
+         if (d >= -9223372036854775808.0 && d < 9223372036854775808.0 &&
+             (double)(int64_t)d == d) {
+            tag = BSON_TYPE_INT64;
+            i64 = (int64_t)d;
+            memcpy (number, &i64, sizeof number);
+         } else {
+            if (d != d) {
+               d = _bson_aggregate_nan ();
+            }
+
+            memcpy (number, &d, sizeof number);
+         }
+
+         key = number;
+         key_len = sizeof number;
+         break;
+      case BSON_TYPE_NULL:
+         break;
+      default:
+         /* the value's bytes, which follow the key */
+         key = iter->raw + iter->key + _bson_iter_key_len (iter) + 1;
+         key_len = (uint32_t)(iter->raw + iter->next_off - key);
+         break;
+      }
+   }
+
+   hash = _bson_group_by_hash (tag, key, key_len);
+
+   if ((group_by->n_groups + 1) * 2 > group_by->n_slots) {
+      _bson_group_by_rehash (group_by);
+   }
+
+   mask = group_by->n_slots - 1;
+
+   for (slot = hash & mask; group_by->slots[slot]; slot = (slot + 1) & mask) {
+      group = &group_by->groups[group_by->slots[slot] - 1];
+
+      if (group->hash == hash && group->tag == tag &&
+          group->key_len == key_len &&
+          (!key_len || !memcmp (group->key, key, key_len))) {
+         *group_id = group_by->slots[slot] - 1;
+         return true;
+      }
+   }
+
+   if (found && tag != BSON_TYPE_NULL && !bson_iter_value (iter)) {
+      bson_set_error (error,
+                      BSON_ERROR_AGGREGATE,
+                      BSON_ERROR_AGGREGATE_UNSUPPORTED,
+                      "Unsupported _id type 0x%02x.",
+                      (int)bson_iter_type (iter));
+      return false;
+   }
+
+   group_by->slots[slot] = (uint32_t)(group_by->n_groups + 1);
+   *group_id = _bson_group_by_add_group (
+      group_by, hash, tag, key, key_len,
+      (found && tag != BSON_TYPE_NULL) ? iter : NULL);
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_group_by_append --
+ *
+ *       Add @bson to its group and accumulate its fields.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set if @bson is
+ *       corrupt or its group key has an unsupported type.
+ *
+ * Side effects:
+ *       @error may be set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_group_by_append (bson_group_by_t *group_by, /* IN */
+                      const bson_t    *bson,     /* IN */
+                      bson_error_t    *error)    /* OUT */
+{
+   bson_group_by_field_t *field;
+   bson_aggregate_t *aggregates;
+   bson_iter_t iter;
+   size_t group;
+   uint32_t i;
+
+   BSON_ASSERT (group_by);
+   BSON_ASSERT (bson);
+
+   if (!bson_iter_init (&iter, bson)) {
+      bson_set_error (error,
+                      BSON_ERROR_AGGREGATE,
+                      BSON_ERROR_AGGREGATE_CORRUPT,
+                      "The document is corrupt.");
+      return false;
+   }
+
+   for (i = 0; i < group_by->n_paths; i++) {
+      group_by->found[i] =
+         bson_iter_init (&iter, bson) &&
+         bson_iter_find_descendant (&iter, group_by->paths[i],
+                                    &group_by->iters[i]);
+   }
+
+   if (group_by->key < 0) {
+      group = group_by->n_groups ? 0 : _bson_group_by_add_group (
+         group_by, 0, BSON_TYPE_NULL, NULL, 0, NULL);
+   } else if (!_bson_group_by_lookup (group_by,
+                                      &group_by->iters[group_by->key],
+                                      group_by->found[group_by->key],
+                                      &group, error)) {
+      return false;
+   }
+
+   aggregates = &group_by->aggregates[group * group_by->n_fields];
+
+   for (i = 0; i < group_by->n_fields; i++) {
+      field = &group_by->fields[i];
+
+      if (field->path < 0) {
+         bson_aggregate_value (&aggregates[i], &field->constant);
+      } else if (group_by->found[field->path]) {
+         _bson_aggregate_iter (&aggregates[i],
+                               &group_by->iters[field->path]);
+      }
+   }
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_group_by_append_reader --
+ *
+ *       Read documents from @reader until it is exhausted, or until
+ *       @max_docs have been read if it is not 0, and append each of them.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set if a
+ *       document is corrupt.
+ *
+ * Side effects:
+ *       @reader is advanced and @error may be set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_group_by_append_reader (bson_group_by_t *group_by, /* IN */
+                             bson_reader_t   *reader,   /* IN */
+                             size_t           max_docs, /* IN */
+                             bson_error_t    *error)    /* OUT */
+{
+   const bson_t *doc;
+   size_t n = 0;
+   bool eof = false;
+
+   BSON_ASSERT (group_by);
+   BSON_ASSERT (reader);
+
+   while (!max_docs || n < max_docs) {
+      if (!(doc = bson_reader_read (reader, &eof))) {
+         if (!eof) {
+            bson_set_error (error,
+                            BSON_ERROR_AGGREGATE,
+                            BSON_ERROR_AGGREGATE_CORRUPT,
+                            "Corrupt document after %" PRIu64 " documents.",
+                            (uint64_t)n);
+            return false;
+         }
+
+         break;
+      }
+
+      if (!bson_group_by_append (group_by, doc, error)) {
+         return false;
+      }
+
+      n++;
+   }
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_group_by_get_n_groups --
+ *
+ *       Get the number of groups.
+ *
+ * Returns:
+ *       The number of groups.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+size_t
+bson_group_by_get_n_groups (const bson_group_by_t *group_by) /* IN */
+{
+   BSON_ASSERT (group_by);
+
+   return group_by->n_groups;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_group_by_get_group --
+ *
+ *       Initialize @group with the result of group @i, in the order the
+ *       groups were first seen: a document of its "_id" and each field of
+ *       the spec.
+ *
+ * Returns:
+ *       true if successful; false if there is no such group.
+ *
+ * Side effects:
+ *       @group is initialized if successful, and should be freed with
+ *       bson_destroy().
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_group_by_get_group (const bson_group_by_t *group_by, /* IN */
+                         size_t                 i,        /* IN */
+                         bson_t                *group)    /* OUT */
+{
+   const bson_aggregate_t *aggregates;
+   bson_value_t value;
+   uint32_t j;
+
+   BSON_ASSERT (group_by);
+   BSON_ASSERT (group);
+
+   if (i >= group_by->n_groups) {
+      return false;
+   }
+
+   aggregates = &group_by->aggregates[i * group_by->n_fields];
+
+   bson_init (group);
+   bson_append_value (group, "_id", 3, &group_by->groups[i].value);
+
+   for (j = 0; j < group_by->n_fields; j++) {
+      bson_aggregate_get (&aggregates[j], group_by->fields[j].op, &value);
+      bson_append_value (group, group_by->fields[j].name, -1, &value);
+   }
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_group_by_clear --
+ *
+ *       Remove every group from @group_by.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+bson_group_by_clear (bson_group_by_t *group_by) /* IN */
+{
+   size_t i;
+
+   BSON_ASSERT (group_by);
+
+   for (i = 0; i < group_by->n_groups; i++) {
+      bson_free (group_by->groups[i].key);
+      bson_value_destroy (&group_by->groups[i].value);
+   }
+
+   group_by->n_groups = 0;
+
+   if (group_by->slots) {
+      memset (group_by->slots, 0,
+              group_by->n_slots * sizeof *group_by->slots);
+   }
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef BSON_AGGREGATE_H
+#define BSON_AGGREGATE_H
+
+
+#if !defined (BSON_INSIDE) && !defined (BSON_COMPILATION)
+# error "Only <bson.h> can be included directly."
+#endif
+
+
+#include "bson-columnar.h"
+#include "bson-compat.h"
+#include "bson-reader.h"
+#include "bson-types.h"
+
+
+BSON_BEGIN_DECLS
+
+
+#define BSON_ERROR_AGGREGATE_INVALID     1
+#define BSON_ERROR_AGGREGATE_CORRUPT     2
+#define BSON_ERROR_AGGREGATE_UNSUPPORTED 3
+
+
+/**
+ * bson_aggregate_op_t:
+ *
+ * The result to get from a bson_aggregate_t.
+ */
+typedef enum
+{
+   BSON_AGGREGATE_COUNT,
+   BSON_AGGREGATE_SUM,
+   BSON_AGGREGATE_MIN,
+   BSON_AGGREGATE_MAX,
+   BSON_AGGREGATE_AVG,
+} bson_aggregate_op_t;
+
+
+/**
+ * bson_aggregate_t:
+ *
+ * The running count, sum, minimum and maximum of a set of numbers. Int32,
+ * int64 and double values are accepted, as are decimal128 values when
+ * BSON_EXPERIMENTAL_FEATURES is enabled, which are converted to doubles.
+ * Integers are summed exactly unless the sum overflows, in which case it
+ * becomes a double.
+ *
+ * The fields are private; use bson_aggregate_get().
+ */
+typedef struct
+{
+   /*< private >*/
+   uint64_t count;
+   uint64_t n_doubles;
+   uint64_t n_nan;
+   bool     overflow;
+   int64_t  int64_sum;
+   int64_t  int64_min;
+   int64_t  int64_max;
+   double   double_sum;
+   double   double_min;
+   double   double_max;
+} bson_aggregate_t;
+
+
+/**
+ * bson_group_by_t:
+ *
+ * A compiled MongoDB-style $group stage, which groups documents by the
+ * value at a path and aggregates numeric fields of each group.
+ *
+ * A bson_group_by_t is not thread-safe.
+ */
+typedef struct _bson_group_by_t bson_group_by_t;
+
+
+void             bson_aggregate_init           (bson_aggregate_t       *aggregate);
+bool             bson_aggregate_column         (bson_aggregate_t       *aggregate,
+                                                const bson_column_t    *column);
+bool             bson_aggregate_value          (bson_aggregate_t       *aggregate,
+                                                const bson_value_t     *value);
+void             bson_aggregate_merge          (bson_aggregate_t       *aggregate,
+                                                const bson_aggregate_t *other);
+void             bson_aggregate_get            (const bson_aggregate_t *aggregate,
+                                                bson_aggregate_op_t     op,
+                                                bson_value_t           *value);
+bson_group_by_t *bson_group_by_new             (const bson_t           *spec,
+                                                bson_error_t           *error);
+void             bson_group_by_destroy         (bson_group_by_t        *group_by);
+bool             bson_group_by_append          (bson_group_by_t        *group_by,
+                                                const bson_t           *bson,
+                                                bson_error_t           *error);
+bool             bson_group_by_append_reader   (bson_group_by_t        *group_by,
+                                                bson_reader_t          *reader,
+                                                size_t                  max_docs,
+                                                bson_error_t           *error);
+size_t           bson_group_by_get_n_groups    (const bson_group_by_t  *group_by);
+bool             bson_group_by_get_group       (const bson_group_by_t  *group_by,
+                                                size_t                  i,
+                                                bson_t                 *group);
+void             bson_group_by_clear           (bson_group_by_t        *group_by);
+
+
+BSON_END_DECLS
+
+
+#endif /* BSON_AGGREGATE_H */
@@ -0,0 +1,85 @@
+/*
+ * Copyright 2016 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef BSON_BATCH_PRIVATE_H
+#define BSON_BATCH_PRIVATE_H
+
+
+#include "bson-compat.h"
+#include "bson-error.h"
+#include "bson-macros.h"
+#include "bson-thread-private.h"
+
+
+BSON_BEGIN_DECLS
+
+
+#define BSON_BATCH_MAX_THREADS 64
+
+
+/*
+ * The threads converting a batch of jobs, one thread per job. Compressed
+ * streams and JSON lines fill one batch while the other is converted.
+ */
+typedef struct
+{
+   uint8_t        *jobs;
+   size_t          job_size;
+   uint32_t        n_jobs;
+   void         *(*func) (void *);
+   bson_thread_t   threads[BSON_BATCH_MAX_THREADS];
+   bool            started[BSON_BATCH_MAX_THREADS];
+   bool            running;
+} bson_batch_t;
+
+
+void
+_bson_batch_start (bson_batch_t  *batch,
+                   void          *jobs,
+                   size_t         job_size,
+                   uint32_t       n_jobs,
+                   uint32_t       n_threads,
+                   void        *(*func) (void *));
+void
+_bson_batch_join (bson_batch_t *batch);
+void
+_bson_batch_reserve (uint8_t **buf,
+                     size_t   *alloc,
+                     size_t    size);
+void
+_bson_batch_set_io_error (bson_error_t *error,
+                          uint32_t      domain,
+                          uint32_t      code,
+                          const char   *what,
+                          const char   *stream,
+                          int           errnum);
+bool
+_bson_would_block (void);
+ssize_t
+_bson_fd_read (int     fd,
+               void   *buf,
+               size_t  len);
+bool
+_bson_fd_write (int         fd,
+                const void *buf,
+                size_t      len);
+
+
+BSON_END_DECLS
+
+
+#endif /* BSON_BATCH_PRIVATE_H */
@@ -0,0 +1,330 @@
+/*
+ * Copyright 2016 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "bson.h"
+
+#include <errno.h>
+#ifdef BSON_OS_WIN32
+# include <io.h>
+#else
+# include <poll.h>
+# include <unistd.h>
+#endif
+
+#include "bson-batch-private.h"
+#include "bson-memory.h"
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_batch_start --
+ *
+ *       Start a thread running @func on each of the @n_jobs jobs of
+ *       @job_size bytes at @jobs, or leave them all to
+ *       _bson_batch_join() if @n_threads is 0. A job whose thread cannot
+ *       be created is also run by _bson_batch_join().
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @batch is running until _bson_batch_join() is called.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_bson_batch_start (bson_batch_t  *batch,     /* IN */
+                   void          *jobs,      /* IN */
+                   size_t         job_size,  /* IN */
+                   uint32_t       n_jobs,    /* IN */
+                   uint32_t       n_threads, /* IN */
+                   void        *(*func) (void *))
+{
+   uint32_t i;
+
+   BSON_ASSERT (batch);
+   BSON_ASSERT (n_jobs <= BSON_BATCH_MAX_THREADS);
+
+   batch->jobs = jobs;
+   batch->job_size = job_size;
+   batch->n_jobs = n_jobs;
+   batch->func = func;
+
+   for (i = 0; i < n_jobs; i++) {
+      batch->started[i] =
+         n_threads > 0 &&
+         !bson_thread_create (&batch->threads[i], func,
+                              batch->jobs + i * job_size);
+   }
+
+   batch->running = true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_batch_join --
+ *
+ *       Wait for the threads of @batch, running the jobs that have no
+ *       thread on the calling thread. Does nothing unless @batch is
+ *       running.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Every job of @batch has run.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_bson_batch_join (bson_batch_t *batch) /* IN */
+{
+   uint32_t i;
+
+   BSON_ASSERT (batch);
+
+   if (!batch->running) {
+      return;
+   }
+
+   for (i = 0; i < batch->n_jobs; i++) {
+      if (batch->started[i]) {
+         bson_thread_join (batch->threads[i]);
+      } else {
+         batch->func (batch->jobs + i * batch->job_size);
+      }
+   }
+
+   batch->running = false;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_batch_reserve --
+ *
+ *       Grow the buffer at @buf, of @alloc bytes, to a power of two of at
+ *       least @size bytes.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @buf and @alloc are updated.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_bson_batch_reserve (uint8_t **buf,   /* IN */
+                     size_t   *alloc, /* IN */
+                     size_t    size)  /* IN */
+{
+   if (size > *alloc) {
+      *alloc = bson_next_power_of_two (size);
+      *buf = bson_realloc (*buf, *alloc);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_batch_set_io_error --
+ *
+ *       Set @error to "Failed to @what @stream", followed by the
+ *       description of @errnum.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @error is set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_bson_batch_set_io_error (bson_error_t *error,  /* OUT */
+                          uint32_t      domain, /* IN */
+                          uint32_t      code,   /* IN */
+                          const char   *what,   /* IN */
+                          const char   *stream, /* IN */
+                          int           errnum) /* IN */
+{
+   char errmsg_buf[BSON_ERROR_BUFFER_SIZE];
+   char *errmsg;
+
+   errmsg = bson_strerror_r (errnum, errmsg_buf, sizeof errmsg_buf);
+   bson_set_error (error, domain, code,
+                   "Failed to %s %s: %s", what, stream, errmsg);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_would_block --
+ *
+ *       Check whether a read or write that returned -1 failed only
+ *       because its non-blocking descriptor was not ready.
+ *
+ * Returns:
+ *       true if errno is EAGAIN or EWOULDBLOCK.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_bson_would_block (void)
+{
+#if defined (EWOULDBLOCK) && EWOULDBLOCK != EAGAIN
+   return errno == EAGAIN || errno == EWOULDBLOCK;
+#else
+   return errno == EAGAIN;
+#endif
+}
+
+
+/*
+ * Waits for a non-blocking @fd whose last read or write failed with EAGAIN
+ * or EWOULDBLOCK to become readable or, if @writing, writable. Returns
+ * false, with errno set, if the failure was another error or @fd cannot
+ * be polled.
+ */
+static bool
+_bson_fd_wait (int  fd,      /* IN */
+               bool writing) /* IN */
+{
+#ifndef BSON_OS_WIN32
+   struct pollfd pfd;
+   int ret;
+#endif
+
+   if (!_bson_would_block ()) {
+      return false;
+   }
+
+#ifdef BSON_OS_WIN32
+   /* the descriptors of files and pipes cannot be polled */
+   return false;
+#else
+   pfd.fd = fd;
+   pfd.events = writing ? POLLOUT : POLLIN;
+   pfd.revents = 0;
+
+   do {
+      ret = poll (&pfd, 1, -1);
+   } while (ret < 0 && errno == EINTR);
+
+   return ret > 0;
+#endif
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_fd_read --
+ *
+ *       Read up to @len bytes from @fd, retrying when interrupted and
+ *       waiting for a non-blocking @fd to become readable.
+ *
+ * Returns:
+ *       The number of bytes read, 0 at the end of the file, or -1 on
+ *       failure with errno set.
+ *
+ * Side effects:
+ *       @buf is filled.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+ssize_t
+_bson_fd_read (int     fd,  /* IN */
+               void   *buf, /* OUT */
+               size_t  len) /* IN */
+{
+   ssize_t ret;
+
+   do {
+#ifdef BSON_OS_WIN32
+      ret = _read (fd, buf, (unsigned int)len);
+#else
+      ret = read (fd, buf, len);
+#endif
+   } while (ret < 0 && (errno == EINTR || _bson_fd_wait (fd, false)));
+
+   return ret;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_fd_write --
+ *
+ *       Write all @len bytes of @buf to @fd, retrying when interrupted
+ *       and waiting for a non-blocking @fd to become writable.
+ *
+ * Returns:
+ *       true if successful; otherwise false with errno set.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_bson_fd_write (int         fd,  /* IN */
+                const void *buf, /* IN */
+                size_t      len) /* IN */
+{
+   size_t total = 0;
+   ssize_t ret;
+
+   while (total < len) {
+#ifdef BSON_OS_WIN32
+      ret = _write (fd, (const uint8_t *)buf + total,
+                    (unsigned int)(len - total));
+#else
+      ret = write (fd, (const uint8_t *)buf + total, len - total);
+#endif
+
+      if (ret < 0 && (errno == EINTR || _bson_fd_wait (fd, true))) {
+         continue;
+      }
+
+      if (ret <= 0) {
+         return false;
+      }
+
+      total += (size_t)ret;
+   }
+
+   return true;
+}
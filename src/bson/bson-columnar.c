@@ -0,0 +1,1129 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "bson.h"
+
+#include <string.h>
+
+#include "bson-columnar.h"
+#include "bson-memory.h"
+#include "bson-private.h"
+#include "bson-thread-private.h"
+
+
+/*
+ * Paths are compiled into a tree of keys, so a document is scanned once
+ * for all of them. Each row's matching field is recorded in its column's
+ * staging arrays as a type and a raw 64-bit value, and the values are
+ * then coerced to the column's type a column at a time.
+ *
+ * A batch is split between the workers in runs of rows. Each run but the
+ * first starts on a byte of the bitmaps, so no two workers share a byte.
+ * UTF8 strings are copied into per-worker buffers, which are appended to
+ * the column in order once the workers finish.
+ */
+
+
+#define BSON_COLUMNAR_MAX_WORKERS 64
+
+
+typedef struct
+{
+   char     *key;
+   uint32_t  key_len;
+   int       column;
+   uint32_t *children;
+   uint32_t  n_children;
+} bson_columnar_node_t;
+
+
+typedef struct
+{
+   char                *path;
+   bson_column_type_t   type;
+   uint8_t             *validity;
+   uint8_t             *values;
+   uint8_t             *data;
+   size_t               data_len;
+   size_t               data_alloc;
+   size_t               null_count;
+   uint8_t             *tags;
+   int64_t             *raw;
+   const char         **strs;
+} bson_columnar_column_t;
+
+
+typedef struct
+{
+   size_t   null_count;
+   uint8_t *data;
+   size_t   data_len;
+   size_t   data_alloc;
+} bson_columnar_worker_column_t;
+
+
+typedef struct
+{
+   bson_columnar_extractor_t     *extractor;
+   size_t                         begin;
+   size_t                         end;
+   bool                           corrupt;
+   bson_columnar_worker_column_t *columns;
+} bson_columnar_worker_t;
+
+
+struct _bson_columnar_extractor_t
+{
+   bson_columnar_node_t   *nodes;
+   uint32_t                n_nodes;
+   bson_columnar_column_t *columns;
+   uint32_t                n_columns;
+   uint32_t                n_threads;
+   bson_columnar_worker_t *workers;
+   uint32_t                n_workers;
+   bson_thread_t          *threads;
+   size_t                  n_rows;
+   size_t                  rows_alloc;
+   const uint8_t         **docs;
+   uint32_t               *doc_lens;
+   size_t                 *doc_offsets;
+   uint8_t                *arena;
+   size_t                  arena_alloc;
+};
+
+
+static uint32_t
+_bson_columnar_add_node (bson_columnar_extractor_t *extractor, /* IN */
+                         uint32_t                   parent,    /* IN */
+                         const char                *key,       /* IN */
+                         uint32_t                   key_len)   /* IN */
+{
+   bson_columnar_node_t *node;
+   bson_columnar_node_t *p;
+   uint32_t i;
+
+   p = &extractor->nodes[parent];
+
+   for (i = 0; i < p->n_children; i++) {
+      node = &extractor->nodes[p->children[i]];
+
+      if (node->key_len == key_len && !memcmp (node->key, key, key_len)) {
+         return p->children[i];
+      }
+   }
+
+   extractor->nodes = bson_realloc (
+      extractor->nodes, (extractor->n_nodes + 1) * sizeof *extractor->nodes);
+   node = &extractor->nodes[extractor->n_nodes];
+   memset (node, 0, sizeof *node);
+   node->key = bson_strndup (key, key_len);
+   node->key_len = key_len;
+   node->column = -1;
+
+   p = &extractor->nodes[parent];
+   p->children = bson_realloc (p->children,
+                               (p->n_children + 1) * sizeof *p->children);
+   p->children[p->n_children++] = extractor->n_nodes;
+
+   return extractor->n_nodes++;
+}
+
+
+/* grows a column's buffers from @old_alloc to @new_alloc rows, zeroing new
+ * bitmap bytes */
+static void
+_bson_columnar_grow_column (bson_columnar_column_t *column,    /* IN */
+                            size_t                  old_alloc, /* IN */
+                            size_t                  new_alloc) /* IN */
+{
+   size_t old_bytes = (old_alloc + 7) / 8;
+   size_t new_bytes = (new_alloc + 7) / 8;
+
+   column->validity = bson_realloc (column->validity, new_bytes);
+   memset (column->validity + old_bytes, 0, new_bytes - old_bytes);
+
+   switch (column->type) {
+   case BSON_COLUMN_BOOL:
+      column->values = bson_realloc (column->values, new_bytes);
+      memset (column->values + old_bytes, 0, new_bytes - old_bytes);
+      break;
+   case BSON_COLUMN_UTF8:
+      column->values = bson_realloc (column->values,
+                                     (new_alloc + 1) * sizeof (int32_t));
+
+      if (!old_alloc) {
+         memset (column->values, 0, sizeof (int32_t));
+      }
+
+      break;
+   case BSON_COLUMN_INT64:
+   case BSON_COLUMN_DOUBLE:
+   case BSON_COLUMN_DATE_TIME:
+   default:
+      column->values = bson_realloc (column->values, new_alloc * 8);
+      break;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_columnar_extractor_new --
+ *
+ *       Create a new bson_columnar_extractor_t with no columns, using a
+ *       single thread.
+ *
+ * Returns:
+ *       A newly allocated bson_columnar_extractor_t that should be freed
+ *       with bson_columnar_extractor_destroy().
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bson_columnar_extractor_t *
+bson_columnar_extractor_new (void)
+{
+   bson_columnar_extractor_t *extractor;
+
+   extractor = bson_malloc0 (sizeof *extractor);
+   extractor->nodes = bson_malloc0 (sizeof *extractor->nodes);
+   extractor->nodes[0].column = -1;
+   extractor->n_nodes = 1;
+   extractor->n_threads = 1;
+   extractor->docs = bson_malloc (BSON_COLUMNAR_BATCH_SIZE *
+                                  sizeof *extractor->docs);
+   extractor->doc_lens = bson_malloc (BSON_COLUMNAR_BATCH_SIZE *
+                                      sizeof *extractor->doc_lens);
+   extractor->doc_offsets = bson_malloc (BSON_COLUMNAR_BATCH_SIZE *
+                                         sizeof *extractor->doc_offsets);
+
+   return extractor;
+}
+
+
+static void
+_bson_columnar_free_workers (bson_columnar_extractor_t *extractor) /* IN */
+{
+   uint32_t i;
+   uint32_t j;
+
+   for (i = 0; i < extractor->n_workers; i++) {
+      for (j = 0; j < extractor->n_columns; j++) {
+         bson_free (extractor->workers[i].columns[j].data);
+      }
+
+      bson_free (extractor->workers[i].columns);
+   }
+
+   bson_free (extractor->workers);
+   bson_free (extractor->threads);
+   extractor->workers = NULL;
+   extractor->threads = NULL;
+   extractor->n_workers = 0;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_columnar_extractor_destroy --
+ *
+ *       Free @extractor and its columns.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+bson_columnar_extractor_destroy (bson_columnar_extractor_t *extractor) /* IN */
+{
+   bson_columnar_column_t *column;
+   uint32_t i;
+
+   if (!extractor) {
+      return;
+   }
+
+   _bson_columnar_free_workers (extractor);
+
+   for (i = 0; i < extractor->n_nodes; i++) {
+      bson_free (extractor->nodes[i].key);
+      bson_free (extractor->nodes[i].children);
+   }
+
+   for (i = 0; i < extractor->n_columns; i++) {
+      column = &extractor->columns[i];
+      bson_free (column->path);
+      bson_free (column->validity);
+      bson_free (column->values);
+      bson_free (column->data);
+      bson_free (column->tags);
+      bson_free (column->raw);
+      bson_free ((void *)column->strs);
+   }
+
+   bson_free (extractor->nodes);
+   bson_free (extractor->columns);
+   bson_free ((void *)extractor->docs);
+   bson_free (extractor->doc_lens);
+   bson_free (extractor->doc_offsets);
+   bson_free (extractor->arena);
+   bson_free (extractor);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_columnar_extractor_add_column --
+ *
+ *       Add a column of @type holding the field at the dotted @path of
+ *       each document. Columns are numbered in the order they are added,
+ *       and may only be added before any rows.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set if @path is
+ *       empty, has an empty part, or is already a column, or if rows have
+ *       been appended.
+ *
+ * Side effects:
+ *       @error may be set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_columnar_extractor_add_column (bson_columnar_extractor_t *extractor, /* IN */
+                                    const char                *path,      /* IN */
+                                    bson_column_type_t         type,      /* IN */
+                                    bson_error_t              *error)     /* OUT */
+{
+   bson_columnar_column_t *column;
+   const char *part;
+   const char *dot;
+   uint32_t node = 0;
+   size_t len;
+
+   BSON_ASSERT (extractor);
+   BSON_ASSERT (path);
+
+   if (extractor->n_rows) {
+      bson_set_error (error,
+                      BSON_ERROR_COLUMNAR,
+                      BSON_ERROR_COLUMNAR_INVALID,
+                      "Columns cannot be added while there are rows.");
+      return false;
+   }
+
+   if (type > BSON_COLUMN_UTF8) {
+      bson_set_error (error,
+                      BSON_ERROR_COLUMNAR,
+                      BSON_ERROR_COLUMNAR_INVALID,
+                      "Unknown type %d for column \"%s\".", (int)type, path);
+      return false;
+   }
+
+   if (!*path || path[0] == '.' || path[strlen (path) - 1] == '.' ||
+       strstr (path, "..")) {
+      bson_set_error (error,
+                      BSON_ERROR_COLUMNAR,
+                      BSON_ERROR_COLUMNAR_INVALID,
+                      "Invalid column path \"%s\".", path);
+      return false;
+   }
+
+   for (part = path; ; part = dot + 1) {
+      dot = strchr (part, '.');
+      len = dot ? (size_t)(dot - part) : strlen (part);
+      node = _bson_columnar_add_node (extractor, node, part, (uint32_t)len);
+
+      if (!dot) {
+         break;
+      }
+   }
+
+   if (extractor->nodes[node].column >= 0) {
+      bson_set_error (error,
+                      BSON_ERROR_COLUMNAR,
+                      BSON_ERROR_COLUMNAR_INVALID,
+                      "Column \"%s\" is already extracted.", path);
+      return false;
+   }
+
+   /* workers are sized for the columns when next needed */
+   _bson_columnar_free_workers (extractor);
+
+   extractor->nodes[node].column = (int)extractor->n_columns;
+   extractor->columns = bson_realloc (
+      extractor->columns,
+      (extractor->n_columns + 1) * sizeof *extractor->columns);
+
+   column = &extractor->columns[extractor->n_columns++];
+   memset (column, 0, sizeof *column);
+   column->path = bson_strdup (path);
+   column->type = type;
+   column->tags = bson_malloc0 (BSON_COLUMNAR_BATCH_SIZE);
+   column->raw = bson_malloc0 (BSON_COLUMNAR_BATCH_SIZE *
+                               sizeof *column->raw);
+
+   if (type == BSON_COLUMN_UTF8) {
+      column->strs = bson_malloc0 (BSON_COLUMNAR_BATCH_SIZE *
+                                   sizeof *column->strs);
+   }
+
+   if (extractor->rows_alloc) {
+      _bson_columnar_grow_column (column, 0, extractor->rows_alloc);
+   }
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_columnar_extractor_set_n_threads --
+ *
+ *       Set the number of threads that extract each batch of documents.
+ *       The calling thread is one of them.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+bson_columnar_extractor_set_n_threads (bson_columnar_extractor_t *extractor, /* IN */
+                                       uint32_t                   n_threads) /* IN */
+{
+   BSON_ASSERT (extractor);
+
+   if (n_threads != extractor->n_threads) {
+      _bson_columnar_free_workers (extractor);
+      extractor->n_threads = n_threads ? n_threads : 1;
+   }
+}
+
+
+static void
+_bson_columnar_prepare_workers (bson_columnar_extractor_t *extractor) /* IN */
+{
+   uint32_t i;
+
+   if (extractor->workers) {
+      return;
+   }
+
+   extractor->n_workers = extractor->n_threads;
+   extractor->workers = bson_malloc0 (extractor->n_workers *
+                                      sizeof *extractor->workers);
+   extractor->threads = bson_malloc0 (extractor->n_workers *
+                                      sizeof *extractor->threads);
+
+   for (i = 0; i < extractor->n_workers; i++) {
+      extractor->workers[i].extractor = extractor;
+      extractor->workers[i].columns = bson_malloc0 (
+         BSON_MAX (extractor->n_columns, 1) *
+         sizeof *extractor->workers[i].columns);
+   }
+}
+
+
+/* grows the columns to hold at least @n_rows */
+static void
+_bson_columnar_reserve (bson_columnar_extractor_t *extractor, /* IN */
+                        size_t                     n_rows)    /* IN */
+{
+   size_t alloc;
+   uint32_t i;
+
+   if (n_rows <= extractor->rows_alloc) {
+      return;
+   }
+
+   alloc = BSON_MAX (extractor->rows_alloc * 2, BSON_MAX (n_rows, 64));
+
+   for (i = 0; i < extractor->n_columns; i++) {
+      _bson_columnar_grow_column (&extractor->columns[i],
+                                  extractor->rows_alloc, alloc);
+   }
+
+   extractor->rows_alloc = alloc;
+}
+
+
+/* clears the bitmap bits of rows that were extracted but not kept */
+static void
+_bson_columnar_truncate (bson_columnar_extractor_t *extractor) /* IN */
+{
+   bson_columnar_column_t *column;
+   size_t byte = extractor->n_rows / 8;
+   size_t n_bytes = (extractor->rows_alloc + 7) / 8;
+   uint8_t mask = (uint8_t)((1u << (extractor->n_rows % 8)) - 1);
+   uint32_t i;
+
+   if (byte >= n_bytes) {
+      return;
+   }
+
+   for (i = 0; i < extractor->n_columns; i++) {
+      column = &extractor->columns[i];
+      column->validity[byte] &= mask;
+      memset (column->validity + byte + 1, 0, n_bytes - byte - 1);
+
+      if (column->type == BSON_COLUMN_BOOL) {
+         column->values[byte] &= mask;
+         memset (column->values + byte + 1, 0, n_bytes - byte - 1);
+      }
+   }
+}
+
+
+static void
+_bson_columnar_record (bson_columnar_column_t *column, /* IN */
+                       const bson_iter_t      *iter,   /* IN */
+                       size_t                  row)    /* IN */
+{
+   uint32_t len;
+   double dbl;
+
+   /* the first of repeated keys wins, as for bson_iter_find() */
+   if (column->tags[row] != BSON_TYPE_EOD) {
+      return;
+   }
+
+   column->tags[row] = (uint8_t)bson_iter_type (iter);
+
+   switch (bson_iter_type (iter)) {
+   case BSON_TYPE_INT32:
+      column->raw[row] = bson_iter_int32 (iter);
+      break;
+   case BSON_TYPE_INT64:
+      column->raw[row] = bson_iter_int64 (iter);
+      break;
+   case BSON_TYPE_DATE_TIME:
+      column->raw[row] = bson_iter_date_time (iter);
+      break;
+   case BSON_TYPE_DOUBLE:
+      dbl = bson_iter_double (iter);
+      memcpy (&column->raw[row], &dbl, sizeof dbl);
+      break;
+   case BSON_TYPE_BOOL:
+      column->raw[row] = bson_iter_bool (iter);
+      break;
+   case BSON_TYPE_UTF8:
+
+      if (column->strs) {
+         column->strs[row] = bson_iter_utf8 (iter, &len);
+         column->raw[row] = len;
+      }
+
+      break;
+   default:
+      break;
+   }
+}
+
+
+static bool
+_bson_columnar_scan (bson_columnar_extractor_t  *extractor, /* IN */
+                     const bson_columnar_node_t *node,      /* IN */
+                     bson_iter_t                *iter,      /* IN */
+                     size_t                      row)       /* IN */
+{
+   const bson_columnar_node_t *child;
+   bson_iter_t sub;
+   const char *key;
+   uint32_t key_len;
+   uint32_t i;
+
+   while (bson_iter_next (iter)) {
+      key = bson_iter_key (iter);
+      key_len = _bson_iter_key_len (iter);
+      child = NULL;
+
+      for (i = 0; i < node->n_children; i++) {
+         child = &extractor->nodes[node->children[i]];
+
+         if (child->key_len == key_len && !memcmp (child->key, key, key_len)) {
+            break;
+         }
+
+         child = NULL;
+      }
+
+      if (!child) {
+         continue;
+      }
+
+      if (child->column >= 0) {
+         _bson_columnar_record (&extractor->columns[child->column], iter, row);
+      }
+
+      if (child->n_children &&
+          (BSON_ITER_HOLDS_DOCUMENT (iter) || BSON_ITER_HOLDS_ARRAY (iter))) {
+         if (!bson_iter_recurse (iter, &sub) ||
+             !_bson_columnar_scan (extractor, child, &sub, row)) {
+            return false;
+         }
+      }
+   }
+
+   return !iter->err_off;
+}
+
+
+static BSON_INLINE bool
+_bson_columnar_is_int (uint8_t tag) /* IN */
+{
+   return tag == BSON_TYPE_INT32 || tag == BSON_TYPE_INT64;
+}
+
+
+/* whether a double can be converted to an int64 */
+static BSON_INLINE bool
+_bson_columnar_double_fits (int64_t raw) /* IN */
+{
+   double dbl;
+
+   memcpy (&dbl, &raw, sizeof dbl);
+
+   return dbl >= -9223372036854775808.0 && dbl < 9223372036854775808.0;
+}
+
+
+static BSON_INLINE bool
+_bson_columnar_is_valid (bson_column_type_t type, /* IN */
+                         uint8_t            tag,  /* IN */
+                         int64_t            raw)  /* IN */
+{
+   switch (type) {
+   case BSON_COLUMN_INT64:
+      return _bson_columnar_is_int (tag) ||
+             (tag == BSON_TYPE_DOUBLE && _bson_columnar_double_fits (raw));
+   case BSON_COLUMN_DOUBLE:
+      return _bson_columnar_is_int (tag) || tag == BSON_TYPE_DOUBLE;
+   case BSON_COLUMN_DATE_TIME:
+      return tag == BSON_TYPE_DATE_TIME;
+   case BSON_COLUMN_BOOL:
+      return tag == BSON_TYPE_BOOL;
+   case BSON_COLUMN_UTF8:
+      return tag == BSON_TYPE_UTF8;
+   default:
+      return false;
+   }
+}
+
+
+/* coerces the staged values of rows [begin, end) of the batch */
+static void
+_bson_columnar_coerce (bson_columnar_extractor_t *extractor, /* IN */
+                       bson_columnar_worker_t    *worker,    /* IN */
+                       uint32_t                   c)         /* IN */
+{
+   bson_columnar_column_t *column = &extractor->columns[c];
+   bson_columnar_worker_column_t *wc = &worker->columns[c];
+   const uint8_t *tags = column->tags;
+   const int64_t *raw = column->raw;
+   size_t base = extractor->n_rows;
+   size_t row;
+   size_t i;
+   int32_t *offsets;
+   int64_t *i64;
+   double *dbl;
+   double d;
+
+   switch (column->type) {
+   case BSON_COLUMN_INT64:
+      i64 = (int64_t *)column->values + base;
+
+      for (i = worker->begin; i < worker->end; i++) {
+         memcpy (&d, &raw[i], sizeof d);
+         i64[i] = _bson_columnar_is_int (tags[i]) ? raw[i] :
+                  (tags[i] == BSON_TYPE_DOUBLE &&
+                   _bson_columnar_double_fits (raw[i])) ? (int64_t)d : 0;
+      }
+
+      break;
+   case BSON_COLUMN_DOUBLE:
+      dbl = (double *)column->values + base;
+
+      /* without branches, so that it can be vectorized */
+      for (i = worker->begin; i < worker->end; i++) {
+         memcpy (&d, &raw[i], sizeof d);
+         dbl[i] = (tags[i] == BSON_TYPE_DOUBLE) ? d :
+                  _bson_columnar_is_int (tags[i]) ? (double)raw[i] : 0.0;
+      }
+
+      break;
+   case BSON_COLUMN_DATE_TIME:
+      i64 = (int64_t *)column->values + base;
+
+      for (i = worker->begin; i < worker->end; i++) {
+         i64[i] = (tags[i] == BSON_TYPE_DATE_TIME) ? raw[i] : 0;
+      }
+
+      break;
+   case BSON_COLUMN_BOOL:
+
+      for (i = worker->begin; i < worker->end; i++) {
+         if (tags[i] == BSON_TYPE_BOOL && raw[i]) {
+            row = base + i;
+            column->values[row / 8] |= (uint8_t)(1u << (row % 8));
+         }
+      }
+
+      break;
+   case BSON_COLUMN_UTF8:
+      /* offsets are relative to the worker's buffer until merged */
+      offsets = (int32_t *)column->values + base + 1;
+
+      for (i = worker->begin; i < worker->end; i++) {
+         if (tags[i] == BSON_TYPE_UTF8 && raw[i]) {
+            if (wc->data_len + (size_t)raw[i] > wc->data_alloc) {
+               wc->data_alloc = bson_next_power_of_two (
+                  wc->data_len + (size_t)raw[i]);
+               wc->data = bson_realloc (wc->data, wc->data_alloc);
+            }
+
+            memcpy (wc->data + wc->data_len, column->strs[i], (size_t)raw[i]);
+            wc->data_len += (size_t)raw[i];
+         }
+
+         offsets[i] = (int32_t)BSON_MIN (wc->data_len, (size_t)INT32_MAX);
+      }
+
+      break;
+   default:
+      break;
+   }
+
+   for (i = worker->begin; i < worker->end; i++) {
+      if (_bson_columnar_is_valid (column->type, tags[i], raw[i])) {
+         row = base + i;
+         column->validity[row / 8] |= (uint8_t)(1u << (row % 8));
+      } else {
+         wc->null_count++;
+      }
+   }
+}
+
+
+static void *
+_bson_columnar_worker_main (void *data) /* IN */
+{
+   bson_columnar_worker_t *worker = data;
+   bson_columnar_extractor_t *extractor = worker->extractor;
+   bson_columnar_column_t *column;
+   bson_iter_t iter;
+   size_t n = worker->end - worker->begin;
+   size_t i;
+   uint32_t c;
+
+   for (c = 0; c < extractor->n_columns; c++) {
+      column = &extractor->columns[c];
+      memset (column->tags + worker->begin, 0, n);
+      memset (column->raw + worker->begin, 0, n * sizeof *column->raw);
+      worker->columns[c].null_count = 0;
+      worker->columns[c].data_len = 0;
+   }
+
+   for (i = worker->begin; i < worker->end; i++) {
+      if (!bson_iter_init_from_data (&iter, extractor->docs[i],
+                                     extractor->doc_lens[i]) ||
+          !_bson_columnar_scan (extractor, &extractor->nodes[0], &iter, i)) {
+         worker->corrupt = true;
+         return NULL;
+      }
+   }
+
+   for (c = 0; c < extractor->n_columns; c++) {
+      _bson_columnar_coerce (extractor, worker, c);
+   }
+
+   return NULL;
+}
+
+
+/* extracts the @n documents in extractor->docs as new rows */
+static bool
+_bson_columnar_extract_batch (bson_columnar_extractor_t *extractor, /* IN */
+                              size_t                     n,         /* IN */
+                              bson_error_t              *error)     /* OUT */
+{
+   bson_columnar_worker_t *worker;
+   bson_columnar_column_t *column;
+   bool started[BSON_COLUMNAR_MAX_WORKERS];
+   int32_t *offsets;
+   size_t total;
+   size_t per;
+   size_t begin = 0;
+   size_t end;
+   size_t i;
+   uint32_t n_workers;
+   uint32_t w;
+   uint32_t c;
+
+   _bson_columnar_prepare_workers (extractor);
+   _bson_columnar_reserve (extractor, extractor->n_rows + n);
+
+   /* runs of at least a byte of rows each */
+   n_workers = (uint32_t)BSON_MIN (extractor->n_workers, (n + 7) / 8);
+   n_workers = BSON_MIN (BSON_MAX (n_workers, 1), BSON_COLUMNAR_MAX_WORKERS);
+   per = ((n + n_workers - 1) / n_workers + 7) & ~(size_t)7;
+
+   for (w = 0; w < n_workers; w++) {
+      worker = &extractor->workers[w];
+
+      if (w == n_workers - 1) {
+         end = n;
+      } else {
+         end = (w + 1) * per;
+         end += (8 - (extractor->n_rows + end) % 8) % 8;
+         end = BSON_MIN (end, n);
+      }
+
+      worker->begin = begin;
+      worker->end = end;
+      worker->corrupt = false;
+      begin = end;
+   }
+
+   for (w = 1; w < n_workers; w++) {
+      started[w] = !bson_thread_create (&extractor->threads[w],
+                                        _bson_columnar_worker_main,
+                                        &extractor->workers[w]);
+   }
+
+   _bson_columnar_worker_main (&extractor->workers[0]);
+
+   for (w = 1; w < n_workers; w++) {
+      if (started[w]) {
+         bson_thread_join (extractor->threads[w]);
+      } else {
+         _bson_columnar_worker_main (&extractor->workers[w]);
+      }
+   }
+
+   for (w = 0; w < n_workers; w++) {
+      if (extractor->workers[w].corrupt) {
+         _bson_columnar_truncate (extractor);
+         bson_set_error (error,
+                         BSON_ERROR_COLUMNAR,
+                         BSON_ERROR_COLUMNAR_CORRUPT,
+                         "Corrupt document in batch starting at row %"
+                         PRIu64 ".", (uint64_t)extractor->n_rows);
+         return false;
+      }
+   }
+
+   for (c = 0; c < extractor->n_columns; c++) {
+      if (extractor->columns[c].type != BSON_COLUMN_UTF8) {
+         continue;
+      }
+
+      total = extractor->columns[c].data_len;
+
+      for (w = 0; w < n_workers; w++) {
+         total += extractor->workers[w].columns[c].data_len;
+      }
+
+      if (total > INT32_MAX) {
+         _bson_columnar_truncate (extractor);
+         bson_set_error (error,
+                         BSON_ERROR_COLUMNAR,
+                         BSON_ERROR_COLUMNAR_OVERFLOW,
+                         "Column \"%s\" would exceed 2GiB of string data.",
+                         extractor->columns[c].path);
+         return false;
+      }
+   }
+
+   for (c = 0; c < extractor->n_columns; c++) {
+      column = &extractor->columns[c];
+
+      for (w = 0; w < n_workers; w++) {
+         worker = &extractor->workers[w];
+         column->null_count += worker->columns[c].null_count;
+
+         if (column->type != BSON_COLUMN_UTF8) {
+            continue;
+         }
+
+         if (column->data_len + worker->columns[c].data_len >
+             column->data_alloc) {
+            column->data_alloc = bson_next_power_of_two (
+               column->data_len + worker->columns[c].data_len);
+            column->data = bson_realloc (column->data, column->data_alloc);
+         }
+
+         if (worker->columns[c].data_len) {
+            memcpy (column->data + column->data_len, worker->columns[c].data,
+                    worker->columns[c].data_len);
+         }
+
+         offsets = (int32_t *)column->values + extractor->n_rows + 1;
+
+         for (i = worker->begin; i < worker->end; i++) {
+            offsets[i] += (int32_t)column->data_len;
+         }
+
+         column->data_len += worker->columns[c].data_len;
+      }
+   }
+
+   extractor->n_rows += n;
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_columnar_extractor_append --
+ *
+ *       Extract the fields of @bson as a new row.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set if @bson is
+ *       corrupt or a UTF8 column would exceed 2GiB.
+ *
+ * Side effects:
+ *       @error may be set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_columnar_extractor_append (bson_columnar_extractor_t *extractor, /* IN */
+                                const bson_t              *bson,      /* IN */
+                                bson_error_t              *error)     /* OUT */
+{
+   BSON_ASSERT (extractor);
+   BSON_ASSERT (bson);
+
+   extractor->docs[0] = bson_get_data (bson);
+   extractor->doc_lens[0] = bson->len;
+
+   return _bson_columnar_extract_batch (extractor, 1, error);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_columnar_extractor_append_reader --
+ *
+ *       Read documents from @reader until it is exhausted, or until
+ *       @max_rows have been read if it is not 0, and extract them as new
+ *       rows in batches of BSON_COLUMNAR_BATCH_SIZE.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set if a
+ *       document is corrupt or a UTF8 column would exceed 2GiB, in which
+ *       case the rows of the failed batch are not added.
+ *
+ * Side effects:
+ *       @reader is advanced and @error may be set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_columnar_extractor_append_reader (bson_columnar_extractor_t *extractor, /* IN */
+                                       bson_reader_t             *reader,    /* IN */
+                                       size_t                     max_rows,  /* IN */
+                                       bson_error_t              *error)     /* OUT */
+{
+   const bson_t *doc = NULL;
+   size_t appended = 0;
+   size_t arena_len;
+   size_t n;
+   size_t i;
+   bool done = false;
+   bool eof = false;
+
+   BSON_ASSERT (extractor);
+   BSON_ASSERT (reader);
+
+   while (!done && (!max_rows || appended < max_rows)) {
+      n = 0;
+      arena_len = 0;
+
+      /* copy the batch, since the reader may reuse its buffer */
+      while (n < BSON_COLUMNAR_BATCH_SIZE &&
+             (!max_rows || appended + n < max_rows)) {
+         if (!(doc = bson_reader_read (reader, &eof))) {
+            done = true;
+            break;
+         }
+
+         if (arena_len + doc->len > extractor->arena_alloc) {
+            extractor->arena_alloc = bson_next_power_of_two (arena_len +
+                                                             doc->len);
+            extractor->arena = bson_realloc (extractor->arena,
+                                             extractor->arena_alloc);
+         }
+
+         memcpy (extractor->arena + arena_len, bson_get_data (doc), doc->len);
+         extractor->doc_offsets[n] = arena_len;
+         extractor->doc_lens[n] = doc->len;
+         arena_len += doc->len;
+         n++;
+      }
+
+      for (i = 0; i < n; i++) {
+         extractor->docs[i] = extractor->arena + extractor->doc_offsets[i];
+      }
+
+      if (n && !_bson_columnar_extract_batch (extractor, n, error)) {
+         return false;
+      }
+
+      appended += n;
+   }
+
+   if (done && !eof) {
+      bson_set_error (error,
+                      BSON_ERROR_COLUMNAR,
+                      BSON_ERROR_COLUMNAR_CORRUPT,
+                      "Corrupt document after row %" PRIu64 ".",
+                      (uint64_t)extractor->n_rows);
+      return false;
+   }
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_columnar_extractor_get_n_rows --
+ *
+ *       Get the number of rows extracted since @extractor was created or
+ *       last cleared.
+ *
+ * Returns:
+ *       The number of rows.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+size_t
+bson_columnar_extractor_get_n_rows (const bson_columnar_extractor_t *extractor) /* IN */
+{
+   BSON_ASSERT (extractor);
+
+   return extractor->n_rows;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_columnar_extractor_get_column --
+ *
+ *       Describe the @i'th column added to @extractor in @column.
+ *
+ * Returns:
+ *       true if successful; false if there is no such column.
+ *
+ * Side effects:
+ *       @column is initialized if successful.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_columnar_extractor_get_column (const bson_columnar_extractor_t *extractor, /* IN */
+                                    size_t                           i,         /* IN */
+                                    bson_column_t                   *column)    /* OUT */
+{
+   const bson_columnar_column_t *c;
+
+   BSON_ASSERT (extractor);
+   BSON_ASSERT (column);
+
+   if (i >= extractor->n_columns) {
+      return false;
+   }
+
+   c = &extractor->columns[i];
+   column->path = c->path;
+   column->type = c->type;
+   column->length = extractor->n_rows;
+   column->null_count = c->null_count;
+   column->validity = c->validity;
+   column->values = c->values;
+   column->data = c->data;
+   column->data_len = c->data_len;
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_columnar_extractor_clear --
+ *
+ *       Remove all rows from @extractor, keeping its columns and buffers
+ *       for the next rows.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Buffers returned by bson_columnar_extractor_get_column() are
+ *       invalidated.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+bson_columnar_extractor_clear (bson_columnar_extractor_t *extractor) /* IN */
+{
+   uint32_t i;
+
+   BSON_ASSERT (extractor);
+
+   extractor->n_rows = 0;
+   _bson_columnar_truncate (extractor);
+
+   for (i = 0; i < extractor->n_columns; i++) {
+      extractor->columns[i].null_count = 0;
+      extractor->columns[i].data_len = 0;
+   }
+}
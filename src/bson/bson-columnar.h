@@ -0,0 +1,127 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef BSON_COLUMNAR_H
+#define BSON_COLUMNAR_H
+
+
+#if !defined (BSON_INSIDE) && !defined (BSON_COMPILATION)
+# error "Only <bson.h> can be included directly."
+#endif
+
+
+#include "bson-compat.h"
+#include "bson-reader.h"
+#include "bson-types.h"
+
+
+BSON_BEGIN_DECLS
+
+
+#define BSON_ERROR_COLUMNAR_INVALID  1
+#define BSON_ERROR_COLUMNAR_CORRUPT  2
+#define BSON_ERROR_COLUMNAR_OVERFLOW 3
+
+
+/*
+ * Documents read from a bson_reader_t are extracted this many at a time,
+ * each batch split between the extractor's threads.
+ */
+#define BSON_COLUMNAR_BATCH_SIZE 4096
+
+
+/**
+ * bson_column_type_t:
+ *
+ * The type of a column's values. Integer and double fields are coerced to
+ * BSON_COLUMN_INT64 and BSON_COLUMN_DOUBLE columns; a double is only
+ * coerced to an int64 if it is in range. Any other field, or a missing
+ * one, is null.
+ */
+typedef enum
+{
+   BSON_COLUMN_INT64,     /* int64_t values */
+   BSON_COLUMN_DOUBLE,    /* double values */
+   BSON_COLUMN_DATE_TIME, /* int64_t milliseconds since the epoch */
+   BSON_COLUMN_BOOL,      /* one bit per value */
+   BSON_COLUMN_UTF8,      /* int32_t offsets into data, length + 1 */
+} bson_column_type_t;
+
+
+/**
+ * bson_column_t:
+ *
+ * A column of extracted values, laid out as an Apache Arrow array: bit i of
+ * @validity, least significant bit first, is set if row i is not null, and
+ * @values holds one value per row whether or not it is null. UTF8 values
+ * are the bytes of @data from offset i to offset i + 1.
+ *
+ * The buffers belong to the extractor and are valid until its next
+ * append, clear, or destroy.
+ */
+typedef struct
+{
+   const char         *path;
+   bson_column_type_t  type;
+   size_t              length;
+   size_t              null_count;
+   const uint8_t      *validity;
+   const void         *values;
+   const uint8_t      *data;
+   size_t              data_len;
+} bson_column_t;
+
+
+/**
+ * bson_columnar_extractor_t:
+ *
+ * Extracts fields from a stream of documents into columns, finding all of
+ * them in a single pass over each document. Paths are dotted, as for
+ * bson_iter_find_descendant().
+ *
+ * An extractor is not thread-safe, though it may use several threads to
+ * extract each batch.
+ */
+typedef struct _bson_columnar_extractor_t bson_columnar_extractor_t;
+
+
+bson_columnar_extractor_t *bson_columnar_extractor_new           (void);
+void                       bson_columnar_extractor_destroy       (bson_columnar_extractor_t       *extractor);
+bool                       bson_columnar_extractor_add_column    (bson_columnar_extractor_t       *extractor,
+                                                                  const char                      *path,
+                                                                  bson_column_type_t               type,
+                                                                  bson_error_t                    *error);
+void                       bson_columnar_extractor_set_n_threads (bson_columnar_extractor_t       *extractor,
+                                                                  uint32_t                         n_threads);
+bool                       bson_columnar_extractor_append        (bson_columnar_extractor_t       *extractor,
+                                                                  const bson_t                    *bson,
+                                                                  bson_error_t                    *error);
+bool                       bson_columnar_extractor_append_reader (bson_columnar_extractor_t       *extractor,
+                                                                  bson_reader_t                   *reader,
+                                                                  size_t                           max_rows,
+                                                                  bson_error_t                    *error);
+size_t                     bson_columnar_extractor_get_n_rows    (const bson_columnar_extractor_t *extractor);
+bool                       bson_columnar_extractor_get_column    (const bson_columnar_extractor_t *extractor,
+                                                                  size_t                           i,
+                                                                  bson_column_t                   *column);
+void                       bson_columnar_extractor_clear         (bson_columnar_extractor_t       *extractor);
+
+
+BSON_END_DECLS
+
+
+#endif /* BSON_COLUMNAR_H */
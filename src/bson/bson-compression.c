@@ -0,0 +1,1237 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "bson.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#ifdef BSON_OS_WIN32
+# include <io.h>
+# include <share.h>
+#else
+# include <unistd.h>
+#endif
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef BSON_HAVE_ZLIB
+# include <zlib.h>
+#endif
+#ifdef BSON_HAVE_ZSTD
+# include <zstd.h>
+#endif
+#ifdef BSON_HAVE_LZ4
+# include <lz4.h>
+#endif
+
+#include "bson-batch-private.h"
+#include "bson-compression.h"
+#include "bson-memory.h"
+#include "bson-private.h"
+
+
+/*
+ * A compressed stream starts with a magic number and a version, and is
+ * followed by blocks, with all integers stored little-endian:
+ *
+ *    uint32 compressor       a bson_compressor_t
+ *    uint32 compressed_len   bytes that follow the header
+ *    uint32 len              bytes of documents once decompressed
+ *
+ * A block holds whole documents, so any block can be decompressed on its
+ * own, and a block that does not shrink is stored uncompressed.
+ *
+ * Readers and writers keep two batches of blocks. While the caller reads
+ * from or writes to one, the other is decompressed or compressed by a
+ * thread per block; the batches then swap.
+ */
+
+
+#define BSON_COMPRESSION_MAGIC       0x5a4e5342 /* "BSNZ" */
+#define BSON_COMPRESSION_VERSION     1
+#define BSON_COMPRESSION_HEADER_SIZE 8
+#define BSON_COMPRESSION_BLOCK_HEADER_SIZE 12
+#define BSON_COMPRESSION_MAX_BLOCK_SIZE (1024 * 1024 * 1024)
+
+
+typedef struct
+{
+   uint8_t           *data;      /* the documents */
+   size_t             len;
+   size_t             alloc;
+   uint8_t           *packed;    /* the block as it is stored */
+   size_t             packed_len;
+   size_t             packed_alloc;
+   bson_compressor_t  compressor;
+   int                level;
+   bool               ok;
+} bson_compression_block_t;
+
+
+typedef struct
+{
+   bson_compression_block_t  blocks[BSON_COMPRESSION_MAX_THREADS];
+   uint32_t                  n_blocks;
+   bson_batch_t              threads;
+   bool                      failed;    /* the stream fails after it */
+} bson_compression_batch_t;
+
+
+BSON_STATIC_ASSERT (BSON_COMPRESSION_MAX_THREADS <= BSON_BATCH_MAX_THREADS);
+
+
+struct _bson_compressed_writer_t
+{
+   int                       fd;
+   bool                      close_on_destroy;
+   bson_compressor_t         compressor;
+   int                       level;
+   size_t                    block_size;
+   uint32_t                  n_threads;
+   uint32_t                  batch_size;
+   bson_compression_batch_t  batches[2];
+   int                       filling;
+   bool                      building;
+   bson_t                    build;
+   bool                      closed;
+   bool                      failed;
+   bson_error_t              error;
+};
+
+
+typedef struct
+{
+   int                       fd;
+   bool                      close_on_destroy;
+   uint32_t                  n_threads;
+   uint32_t                  batch_size;
+   bson_compression_batch_t  batches[2];
+   int                       current;
+   uint32_t                  block;
+   size_t                    offset;
+} bson_compressed_reader_t;
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_compressor_is_supported --
+ *
+ *       Check whether @compressor was found when libbson was built.
+ *       BSON_COMPRESSOR_NONE is always supported.
+ *
+ * Returns:
+ *       true if @compressor can be read and written.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_compressor_is_supported (bson_compressor_t compressor) /* IN */
+{
+   switch (compressor) {
+   case BSON_COMPRESSOR_NONE:
+      return true;
+#ifdef BSON_HAVE_ZLIB
+   case BSON_COMPRESSOR_ZLIB:
+      return true;
+#endif
+#ifdef BSON_HAVE_ZSTD
+   case BSON_COMPRESSOR_ZSTD:
+      return true;
+#endif
+#ifdef BSON_HAVE_LZ4
+   case BSON_COMPRESSOR_LZ4:
+      return true;
+#endif
+   default:
+      return false;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_compression_pack --
+ *
+ *       Compress @block->data into @block->packed with @block->compressor,
+ *       or copy it if it does not shrink.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_bson_compression_pack (bson_compression_block_t *block) /* IN */
+{
+   size_t bound = block->len;
+   size_t len = 0;
+
+   switch (block->compressor) {
+#ifdef BSON_HAVE_ZLIB
+   case BSON_COMPRESSOR_ZLIB:
+      bound = compressBound ((uLong)block->len);
+      break;
+#endif
+#ifdef BSON_HAVE_ZSTD
+   case BSON_COMPRESSOR_ZSTD:
+      bound = ZSTD_compressBound (block->len);
+      break;
+#endif
+#ifdef BSON_HAVE_LZ4
+   case BSON_COMPRESSOR_LZ4:
+      bound = (size_t)LZ4_compressBound ((int)block->len);
+      break;
+#endif
+   default:
+      break;
+   }
+
+   _bson_batch_reserve (&block->packed, &block->packed_alloc,
+                        BSON_MAX (bound, block->len));
+
+   switch (block->compressor) {
+#ifdef BSON_HAVE_ZLIB
+   case BSON_COMPRESSOR_ZLIB:
+      {
+         uLongf dest_len = (uLongf)bound;
+
+         if (compress2 (block->packed, &dest_len, block->data,
+                        (uLong)block->len,
+                        block->level < 0 ? Z_DEFAULT_COMPRESSION
+                                         : block->level) == Z_OK) {
+            len = (size_t)dest_len;
+         }
+      }
+      break;
+#endif
+#ifdef BSON_HAVE_ZSTD
+   case BSON_COMPRESSOR_ZSTD:
+      len = ZSTD_compress (block->packed, bound, block->data, block->len,
+                           block->level < 0 ? 0 : block->level);
+
+      if (ZSTD_isError (len)) {
+         len = 0;
+      }
+      break;
+#endif
+#ifdef BSON_HAVE_LZ4
+   case BSON_COMPRESSOR_LZ4:
+      len = (size_t)LZ4_compress_default ((const char *)block->data,
+                                          (char *)block->packed,
+                                          (int)block->len, (int)bound);
+      break;
+#endif
+   default:
+      break;
+   }
+
+   if (!len || len >= block->len) {
+      block->compressor = BSON_COMPRESSOR_NONE;
+      memcpy (block->packed, block->data, block->len);
+      len = block->len;
+   }
+
+   block->packed_len = len;
+   block->ok = true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_compression_unpack --
+ *
+ *       Decompress @block->packed into @block->data, and check that it
+ *       holds the bytes its header claims.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_bson_compression_unpack (bson_compression_block_t *block) /* IN */
+{
+   size_t len = 0;
+
+   block->ok = false;
+
+   if (block->compressor == BSON_COMPRESSOR_NONE) {
+      uint8_t *tmp;
+      size_t alloc;
+
+      /* take the stored bytes rather than copying them */
+      if (block->packed_len == block->len) {
+         tmp = block->data;
+         block->data = block->packed;
+         block->packed = tmp;
+         alloc = block->alloc;
+         block->alloc = block->packed_alloc;
+         block->packed_alloc = alloc;
+         block->ok = true;
+      }
+
+      return;
+   }
+
+   _bson_batch_reserve (&block->data, &block->alloc, block->len);
+
+   switch (block->compressor) {
+#ifdef BSON_HAVE_ZLIB
+   case BSON_COMPRESSOR_ZLIB:
+      {
+         uLongf dest_len = (uLongf)block->len;
+
+         if (uncompress (block->data, &dest_len, block->packed,
+                         (uLong)block->packed_len) == Z_OK) {
+            len = (size_t)dest_len;
+         }
+      }
+      break;
+#endif
+#ifdef BSON_HAVE_ZSTD
+   case BSON_COMPRESSOR_ZSTD:
+      len = ZSTD_decompress (block->data, block->len, block->packed,
+                             block->packed_len);
+
+      if (ZSTD_isError (len)) {
+         len = 0;
+      }
+      break;
+#endif
+#ifdef BSON_HAVE_LZ4
+   case BSON_COMPRESSOR_LZ4:
+      {
+         int ret;
+
+         ret = LZ4_decompress_safe ((const char *)block->packed,
+                                    (char *)block->data,
+                                    (int)block->packed_len,
+                                    (int)block->len);
+         len = ret > 0 ? (size_t)ret : 0;
+      }
+      break;
+#endif
+   default:
+      break;
+   }
+
+   block->ok = (len == block->len);
+}
+
+
+static void *
+_bson_compression_pack_main (void *data) /* IN */
+{
+   _bson_compression_pack ((bson_compression_block_t *)data);
+
+   return NULL;
+}
+
+
+static void *
+_bson_compression_unpack_main (void *data) /* IN */
+{
+   _bson_compression_unpack ((bson_compression_block_t *)data);
+
+   return NULL;
+}
+
+
+static void
+_bson_compression_batch_destroy (bson_compression_batch_t *batch) /* IN */
+{
+   uint32_t i;
+
+   _bson_batch_join (&batch->threads);
+
+   for (i = 0; i < BSON_COMPRESSION_MAX_THREADS; i++) {
+      bson_free (batch->blocks[i].data);
+      bson_free (batch->blocks[i].packed);
+   }
+}
+
+
+/* reads up to @len bytes, stopping early only at the end of the file */
+static ssize_t
+_bson_compression_read (int     fd,  /* IN */
+                        void   *buf, /* OUT */
+                        size_t  len) /* IN */
+{
+   size_t total = 0;
+   ssize_t ret;
+
+   while (total < len) {
+      ret = _bson_fd_read (fd, (uint8_t *)buf + total, len - total);
+
+      if (ret < 0) {
+         return -1;
+      }
+
+      if (ret == 0) {
+         break;
+      }
+
+      total += (size_t)ret;
+   }
+
+   return (ssize_t)total;
+}
+
+
+static int
+_bson_compression_open (const char *path,    /* IN */
+                        bool        writing) /* IN */
+{
+   int fd;
+
+#ifdef BSON_OS_WIN32
+   if (_sopen_s (&fd, path,
+                 writing ? (_O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY)
+                         : (_O_RDONLY | _O_BINARY),
+                 _SH_DENYNO, _S_IREAD | _S_IWRITE) != 0) {
+      fd = -1;
+   }
+#else
+   fd = writing ? open (path, O_WRONLY | O_CREAT | O_TRUNC, 0666)
+                : open (path, O_RDONLY);
+#endif
+
+   return fd;
+}
+
+
+static void
+_bson_compression_close (int fd) /* IN */
+{
+#ifdef BSON_OS_WIN32
+   _close (fd);
+#else
+   close (fd);
+#endif
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_compressed_writer_new --
+ *
+ *       Create a writer that compresses blocks of documents with
+ *       @compressor, using up to @n_threads threads besides the caller's,
+ *       and writes them to @fd. With @n_threads 0 the caller compresses
+ *       each block.
+ *
+ * Returns:
+ *       A writer to be freed with bson_compressed_writer_destroy(), or
+ *       NULL with @error set if @compressor is not supported.
+ *
+ * Side effects:
+ *       The stream header is written to @fd.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bson_compressed_writer_t *
+bson_compressed_writer_new (int                fd,               /* IN */
+                            bool               close_on_destroy, /* IN */
+                            bson_compressor_t  compressor,       /* IN */
+                            uint32_t           n_threads,        /* IN */
+                            bson_error_t      *error)            /* OUT */
+{
+   bson_compressed_writer_t *writer;
+   uint32_t header[2];
+
+   if (!bson_compressor_is_supported (compressor)) {
+      bson_set_error (error,
+                      BSON_ERROR_COMPRESSION,
+                      BSON_ERROR_COMPRESSION_UNSUPPORTED,
+                      "Compressor %d is not supported", (int)compressor);
+      return NULL;
+   }
+
+   header[0] = BSON_UINT32_TO_LE (BSON_COMPRESSION_MAGIC);
+   header[1] = BSON_UINT32_TO_LE (BSON_COMPRESSION_VERSION);
+
+   if (!_bson_fd_write (fd, header, sizeof header)) {
+      _bson_batch_set_io_error (error, BSON_ERROR_COMPRESSION,
+                                BSON_ERROR_COMPRESSION_IO, "write",
+                                "compressed stream", errno);
+      return NULL;
+   }
+
+   writer = bson_malloc0 (sizeof *writer);
+   writer->fd = fd;
+   writer->close_on_destroy = close_on_destroy;
+   writer->compressor = compressor;
+   writer->level = -1;
+   writer->block_size = BSON_COMPRESSED_BLOCK_SIZE;
+   writer->n_threads = BSON_MIN (n_threads, BSON_COMPRESSION_MAX_THREADS);
+   writer->batch_size = BSON_MAX (writer->n_threads, 1);
+
+   return writer;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_compressed_writer_new_from_file --
+ *
+ *       Create or truncate the file at @path and write to it as
+ *       bson_compressed_writer_new() does.
+ *
+ * Returns:
+ *       A writer to be freed with bson_compressed_writer_destroy(), or
+ *       NULL with @error set.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bson_compressed_writer_t *
+bson_compressed_writer_new_from_file (const char        *path,       /* IN */
+                                      bson_compressor_t  compressor, /* IN */
+                                      uint32_t           n_threads,  /* IN */
+                                      bson_error_t      *error)      /* OUT */
+{
+   bson_compressed_writer_t *writer;
+   int fd;
+
+   BSON_ASSERT (path);
+
+   if (!bson_compressor_is_supported (compressor)) {
+      bson_set_error (error,
+                      BSON_ERROR_COMPRESSION,
+                      BSON_ERROR_COMPRESSION_UNSUPPORTED,
+                      "Compressor %d is not supported", (int)compressor);
+      return NULL;
+   }
+
+   if ((fd = _bson_compression_open (path, true)) == -1) {
+      _bson_batch_set_io_error (error, BSON_ERROR_COMPRESSION,
+                                BSON_ERROR_COMPRESSION_IO, "open",
+                                "compressed stream", errno);
+      return NULL;
+   }
+
+   if (!(writer = bson_compressed_writer_new (fd, true, compressor,
+                                              n_threads, error))) {
+      _bson_compression_close (fd);
+   }
+
+   return writer;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_compressed_writer_set_block_size --
+ *
+ *       Set the bytes of documents after which a block is compressed, up
+ *       to 1GiB. Larger blocks compress better, and smaller blocks give
+ *       the threads of a reader work sooner.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+bson_compressed_writer_set_block_size (bson_compressed_writer_t *writer,     /* IN */
+                                       size_t                    block_size) /* IN */
+{
+   BSON_ASSERT (writer);
+
+   writer->block_size =
+      BSON_MIN (BSON_MAX (block_size, 1), BSON_COMPRESSION_MAX_BLOCK_SIZE);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_compressed_writer_set_level --
+ *
+ *       Set the compression level passed to the compressor, or -1 for the
+ *       compressor's default. LZ4 has no levels.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+bson_compressed_writer_set_level (bson_compressed_writer_t *writer, /* IN */
+                                  int                       level)  /* IN */
+{
+   BSON_ASSERT (writer);
+
+   writer->level = level;
+}
+
+
+static bson_compression_block_t *
+_bson_compressed_writer_block (bson_compressed_writer_t *writer) /* IN */
+{
+   bson_compression_batch_t *batch = &writer->batches[writer->filling];
+
+   return &batch->blocks[batch->n_blocks];
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_compressed_writer_drain --
+ *
+ *       Wait for the batch that is not being filled, and write its blocks.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_bson_compressed_writer_drain (bson_compressed_writer_t *writer) /* IN */
+{
+   bson_compression_batch_t *batch = &writer->batches[!writer->filling];
+   bson_compression_block_t *block;
+   uint32_t header[3];
+   uint32_t i;
+
+   _bson_batch_join (&batch->threads);
+
+   for (i = 0; i < batch->n_blocks; i++) {
+      block = &batch->blocks[i];
+
+      if (writer->failed) {
+         break;
+      }
+
+      header[0] = BSON_UINT32_TO_LE ((uint32_t)block->compressor);
+      header[1] = BSON_UINT32_TO_LE ((uint32_t)block->packed_len);
+      header[2] = BSON_UINT32_TO_LE ((uint32_t)block->len);
+
+      if (!_bson_fd_write (writer->fd, header, sizeof header) ||
+          !_bson_fd_write (writer->fd, block->packed, block->packed_len)) {
+         _bson_batch_set_io_error (&writer->error, BSON_ERROR_COMPRESSION,
+                                   BSON_ERROR_COMPRESSION_IO, "write",
+                                   "compressed stream", errno);
+         writer->failed = true;
+      }
+   }
+
+   for (i = 0; i < batch->n_blocks; i++) {
+      batch->blocks[i].len = 0;
+   }
+
+   batch->n_blocks = 0;
+
+   return !writer->failed;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_compressed_writer_flush --
+ *
+ *       End the block being filled. Once a batch is full, or if @all,
+ *       write the batch before it and start compressing this one.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_bson_compressed_writer_flush (bson_compressed_writer_t *writer, /* IN */
+                               bool                      all)    /* IN */
+{
+   bson_compression_batch_t *batch = &writer->batches[writer->filling];
+   bson_compression_block_t *block = &batch->blocks[batch->n_blocks];
+
+   if (block->len) {
+      block->compressor = writer->compressor;
+      block->level = writer->level;
+      batch->n_blocks++;
+   }
+
+   if (batch->n_blocks < writer->batch_size && !all) {
+      return true;
+   }
+
+   if (!_bson_compressed_writer_drain (writer)) {
+      return false;
+   }
+
+   _bson_batch_start (&batch->threads, batch->blocks, sizeof batch->blocks[0],
+                      batch->n_blocks, writer->n_threads,
+                      _bson_compression_pack_main);
+   writer->filling = !writer->filling;
+
+   return !all || _bson_compressed_writer_drain (writer);
+}
+
+
+static bool
+_bson_compressed_writer_get_error (bson_compressed_writer_t *writer, /* IN */
+                                   bson_error_t             *error)  /* OUT */
+{
+   if (writer->failed) {
+      if (error) {
+         memcpy (error, &writer->error, sizeof *error);
+      }
+
+      return false;
+   }
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_compressed_writer_begin --
+ *
+ *       Begin a document built in place in the current block, like
+ *       bson_writer_begin(). Finish it with bson_compressed_writer_end()
+ *       or bson_compressed_writer_rollback().
+ *
+ * Returns:
+ *       true and @bson, or false if an earlier write failed, in which case
+ *       bson_compressed_writer_close() reports the error.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_compressed_writer_begin (bson_compressed_writer_t  *writer, /* IN */
+                              bson_t                   **bson)   /* OUT */
+{
+   bson_compression_block_t *block;
+   bson_impl_alloc_t *b;
+
+   BSON_ASSERT (writer);
+   BSON_ASSERT (!writer->building);
+   BSON_ASSERT (!writer->closed);
+   BSON_ASSERT (bson);
+
+   if (writer->failed) {
+      return false;
+   }
+
+   block = _bson_compressed_writer_block (writer);
+   _bson_batch_reserve (&block->data, &block->alloc, block->len + 5);
+
+   memset (&writer->build, 0, sizeof (bson_t));
+
+   b = (bson_impl_alloc_t *)&writer->build;
+   b->flags = BSON_FLAG_STATIC | BSON_FLAG_NO_FREE;
+   b->len = 5;
+   b->parent = NULL;
+   b->buf = &block->data;
+   b->buflen = &block->alloc;
+   b->offset = block->len;
+   b->alloc = NULL;
+   b->alloclen = 0;
+   b->realloc = bson_realloc_ctx;
+   b->realloc_func_ctx = NULL;
+
+   memset (block->data + block->len + 1, 0, 4);
+   block->data[block->len] = 5;
+
+   writer->building = true;
+   *bson = &writer->build;
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_compressed_writer_end --
+ *
+ *       Add the document begun with bson_compressed_writer_begin() to the
+ *       current block.
+ *
+ * Returns:
+ *       true, or false with @error set if writing a finished batch of
+ *       blocks failed.
+ *
+ * Side effects:
+ *       A full block is queued for compression, and once a batch of
+ *       blocks is queued, the previous batch is written.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_compressed_writer_end (bson_compressed_writer_t *writer, /* IN */
+                            bson_t                   *bson,   /* IN */
+                            bson_error_t             *error)  /* OUT */
+{
+   bson_compression_block_t *block;
+
+   BSON_ASSERT (writer);
+   BSON_ASSERT (writer->building);
+   BSON_ASSERT (bson == &writer->build);
+
+   writer->building = false;
+   block = _bson_compressed_writer_block (writer);
+   block->len += bson->len;
+   memset (&writer->build, 0, sizeof (bson_t));
+
+   if (block->len >= writer->block_size) {
+      _bson_compressed_writer_flush (writer, false);
+   }
+
+   return _bson_compressed_writer_get_error (writer, error);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_compressed_writer_rollback --
+ *
+ *       Abandon the document begun with bson_compressed_writer_begin().
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+bson_compressed_writer_rollback (bson_compressed_writer_t *writer, /* IN */
+                                 bson_t                   *bson)   /* IN */
+{
+   BSON_ASSERT (writer);
+   BSON_ASSERT (writer->building);
+   BSON_ASSERT (bson == &writer->build);
+
+   writer->building = false;
+   memset (&writer->build, 0, sizeof (bson_t));
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_compressed_writer_write --
+ *
+ *       Copy @bson to the current block.
+ *
+ * Returns:
+ *       true, or false with @error set as for bson_compressed_writer_end().
+ *
+ * Side effects:
+ *       As for bson_compressed_writer_end().
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_compressed_writer_write (bson_compressed_writer_t *writer, /* IN */
+                              const bson_t             *bson,   /* IN */
+                              bson_error_t             *error)  /* OUT */
+{
+   bson_compression_block_t *block;
+
+   BSON_ASSERT (writer);
+   BSON_ASSERT (!writer->building);
+   BSON_ASSERT (!writer->closed);
+   BSON_ASSERT (bson);
+
+   if (writer->failed) {
+      return _bson_compressed_writer_get_error (writer, error);
+   }
+
+   block = _bson_compressed_writer_block (writer);
+   _bson_batch_reserve (&block->data, &block->alloc,
+                        block->len + bson->len);
+   memcpy (block->data + block->len, bson_get_data (bson), bson->len);
+   block->len += bson->len;
+
+   if (block->len >= writer->block_size) {
+      _bson_compressed_writer_flush (writer, false);
+   }
+
+   return _bson_compressed_writer_get_error (writer, error);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_compressed_writer_close --
+ *
+ *       Compress and write the remaining blocks. No documents may be
+ *       written after this.
+ *
+ * Returns:
+ *       true if every block was written, otherwise false with @error set.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_compressed_writer_close (bson_compressed_writer_t *writer, /* IN */
+                              bson_error_t             *error)  /* OUT */
+{
+   BSON_ASSERT (writer);
+   BSON_ASSERT (!writer->building);
+
+   if (!writer->closed) {
+      writer->closed = true;
+
+      if (!writer->failed) {
+         _bson_compressed_writer_flush (writer, true);
+      }
+   }
+
+   return _bson_compressed_writer_get_error (writer, error);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_compressed_writer_destroy --
+ *
+ *       Close @writer if it is open, ignoring errors, and free it.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       The file descriptor is closed if @close_on_destroy was set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+bson_compressed_writer_destroy (bson_compressed_writer_t *writer) /* IN */
+{
+   if (writer) {
+      BSON_ASSERT (!writer->building);
+
+      bson_compressed_writer_close (writer, NULL);
+
+      _bson_compression_batch_destroy (&writer->batches[0]);
+      _bson_compression_batch_destroy (&writer->batches[1]);
+
+      if (writer->close_on_destroy) {
+         _bson_compression_close (writer->fd);
+      }
+
+      bson_free (writer);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_compressed_reader_fill --
+ *
+ *       Read the next batch of blocks into @batch and start decompressing
+ *       them.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_bson_compressed_reader_fill (bson_compressed_reader_t *reader, /* IN */
+                              bson_compression_batch_t *batch)  /* IN */
+{
+   bson_compression_block_t *block;
+   uint32_t header[3];
+   ssize_t ret;
+   uint32_t n;
+
+   batch->failed = false;
+
+   for (n = 0; n < reader->batch_size; n++) {
+      block = &batch->blocks[n];
+      ret = _bson_compression_read (reader->fd, header, sizeof header);
+
+      if (ret == 0) {
+         break;
+      }
+
+      if (ret != (ssize_t)sizeof header) {
+         batch->failed = true;
+         break;
+      }
+
+      block->compressor = (bson_compressor_t)BSON_UINT32_FROM_LE (header[0]);
+      block->packed_len = BSON_UINT32_FROM_LE (header[1]);
+      block->len = BSON_UINT32_FROM_LE (header[2]);
+
+      /* blocks that do not shrink are stored, and none is larger than a
+       * writer makes them */
+      if (!block->len || block->len > BSON_COMPRESSION_MAX_BLOCK_SIZE ||
+          block->packed_len > block->len) {
+         batch->failed = true;
+         break;
+      }
+
+      _bson_batch_reserve (&block->packed, &block->packed_alloc,
+                           block->packed_len);
+      ret = _bson_compression_read (reader->fd, block->packed,
+                                    block->packed_len);
+
+      if (ret != (ssize_t)block->packed_len) {
+         batch->failed = true;
+         break;
+      }
+   }
+
+   batch->n_blocks = n;
+   _bson_batch_start (&batch->threads, batch->blocks, sizeof batch->blocks[0],
+                      batch->n_blocks, reader->n_threads,
+                      _bson_compression_unpack_main);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_compressed_reader_read --
+ *
+ *       The bson_reader_read_func_t of a compressed reader. It copies out
+ *       the documents of one batch while the next is decompressed.
+ *
+ * Returns:
+ *       The bytes copied to @buf, 0 at the end of the stream, or -1 if
+ *       the stream is corrupt or cannot be read.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static ssize_t
+_bson_compressed_reader_read (void   *handle, /* IN */
+                              void   *buf,    /* OUT */
+                              size_t  count)  /* IN */
+{
+   bson_compressed_reader_t *reader = handle;
+   bson_compression_batch_t *batch;
+   bson_compression_block_t *block;
+   bson_compression_batch_t *next;
+   size_t n;
+
+   for (;;) {
+      batch = &reader->batches[reader->current];
+
+      if (reader->block < batch->n_blocks) {
+         block = &batch->blocks[reader->block];
+
+         if (!block->ok) {
+            return -1;
+         }
+
+         if (reader->offset < block->len) {
+            n = BSON_MIN (count, block->len - reader->offset);
+            memcpy (buf, block->data + reader->offset, n);
+            reader->offset += n;
+
+            return (ssize_t)n;
+         }
+
+         reader->block++;
+         reader->offset = 0;
+         continue;
+      }
+
+      if (batch->failed) {
+         return -1;
+      }
+
+      next = &reader->batches[!reader->current];
+      _bson_batch_join (&next->threads);
+
+      if (!next->n_blocks && !next->failed) {
+         return 0;
+      }
+
+      reader->current = !reader->current;
+      reader->block = 0;
+      reader->offset = 0;
+
+      if (!next->failed) {
+         _bson_compressed_reader_fill (reader, batch);
+      }
+   }
+}
+
+
+static void
+_bson_compressed_reader_destroy (void *handle) /* IN */
+{
+   bson_compressed_reader_t *reader = handle;
+
+   _bson_compression_batch_destroy (&reader->batches[0]);
+   _bson_compression_batch_destroy (&reader->batches[1]);
+
+   if (reader->close_on_destroy) {
+      _bson_compression_close (reader->fd);
+   }
+
+   bson_free (reader);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_reader_new_from_compressed_fd --
+ *
+ *       Create a bson_reader_t that reads a stream written by a
+ *       bson_compressed_writer_t from @fd. Up to @n_threads threads
+ *       decompress the blocks ahead of the reader; with @n_threads 0 the
+ *       reader decompresses each block when it reaches it.
+ *
+ *       bson_reader_read() returns NULL without @reached_eof if a block is
+ *       corrupt or uses a compressor that is not supported.
+ *
+ * Returns:
+ *       A bson_reader_t to be freed with bson_reader_destroy(), or NULL
+ *       with @error set if @fd does not start a compressed stream.
+ *
+ * Side effects:
+ *       The first batch of blocks is read.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bson_reader_t *
+bson_reader_new_from_compressed_fd (int           fd,               /* IN */
+                                    bool          close_on_destroy, /* IN */
+                                    uint32_t      n_threads,        /* IN */
+                                    bson_error_t *error)            /* OUT */
+{
+   bson_compressed_reader_t *reader;
+   uint32_t header[2];
+   ssize_t ret;
+
+   ret = _bson_compression_read (fd, header, sizeof header);
+
+   if (ret < 0) {
+      _bson_batch_set_io_error (error, BSON_ERROR_COMPRESSION,
+                                BSON_ERROR_COMPRESSION_IO, "read",
+                                "compressed stream", errno);
+      return NULL;
+   }
+
+   if (ret != (ssize_t)sizeof header ||
+       BSON_UINT32_FROM_LE (header[0]) != BSON_COMPRESSION_MAGIC) {
+      bson_set_error (error,
+                      BSON_ERROR_COMPRESSION,
+                      BSON_ERROR_COMPRESSION_CORRUPT,
+                      "Not a compressed BSON stream");
+      return NULL;
+   }
+
+   if (BSON_UINT32_FROM_LE (header[1]) != BSON_COMPRESSION_VERSION) {
+      bson_set_error (error,
+                      BSON_ERROR_COMPRESSION,
+                      BSON_ERROR_COMPRESSION_CORRUPT,
+                      "Unsupported compressed stream version %u",
+                      (unsigned)BSON_UINT32_FROM_LE (header[1]));
+      return NULL;
+   }
+
+   reader = bson_malloc0 (sizeof *reader);
+   reader->fd = fd;
+   reader->close_on_destroy = close_on_destroy;
+   reader->n_threads = BSON_MIN (n_threads, BSON_COMPRESSION_MAX_THREADS);
+   reader->batch_size = BSON_MAX (reader->n_threads, 1);
+
+   /* the current batch starts empty, so the first read swaps to this */
+   _bson_compressed_reader_fill (reader, &reader->batches[1]);
+
+   return bson_reader_new_from_handle (reader,
+                                       _bson_compressed_reader_read,
+                                       _bson_compressed_reader_destroy);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_reader_new_from_compressed_file --
+ *
+ *       Open the file at @path and read it as
+ *       bson_reader_new_from_compressed_fd() does.
+ *
+ * Returns:
+ *       A bson_reader_t to be freed with bson_reader_destroy(), or NULL
+ *       with @error set.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bson_reader_t *
+bson_reader_new_from_compressed_file (const char   *path,      /* IN */
+                                      uint32_t      n_threads, /* IN */
+                                      bson_error_t *error)     /* OUT */
+{
+   bson_reader_t *reader;
+   int fd;
+
+   BSON_ASSERT (path);
+
+   if ((fd = _bson_compression_open (path, false)) == -1) {
+      _bson_batch_set_io_error (error, BSON_ERROR_COMPRESSION,
+                                BSON_ERROR_COMPRESSION_IO, "open",
+                                "compressed stream", errno);
+      return NULL;
+   }
+
+   if (!(reader = bson_reader_new_from_compressed_fd (fd, true, n_threads,
+                                                      error))) {
+      _bson_compression_close (fd);
+   }
+
+   return reader;
+}
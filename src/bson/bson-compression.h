@@ -0,0 +1,112 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef BSON_COMPRESSION_H
+#define BSON_COMPRESSION_H
+
+
+#if !defined (BSON_INSIDE) && !defined (BSON_COMPILATION)
+# error "Only <bson.h> can be included directly."
+#endif
+
+
+#include "bson-compat.h"
+#include "bson-reader.h"
+#include "bson-types.h"
+
+
+BSON_BEGIN_DECLS
+
+
+#define BSON_ERROR_COMPRESSION_UNSUPPORTED 1
+#define BSON_ERROR_COMPRESSION_IO          2
+#define BSON_ERROR_COMPRESSION_CORRUPT     3
+
+
+/*
+ * The documents a block holds before it is compressed, unless
+ * bson_compressed_writer_set_block_size() is called.
+ */
+#define BSON_COMPRESSED_BLOCK_SIZE (256 * 1024)
+
+
+/*
+ * The most threads a compressed reader or writer starts at once.
+ */
+#define BSON_COMPRESSION_MAX_THREADS 64
+
+
+typedef enum
+{
+   BSON_COMPRESSOR_NONE = 0,
+   BSON_COMPRESSOR_ZLIB = 1,
+   BSON_COMPRESSOR_ZSTD = 2,
+   BSON_COMPRESSOR_LZ4  = 3,
+} bson_compressor_t;
+
+
+/**
+ * bson_compressed_writer_t:
+ *
+ * Writes documents to a file in blocks that are each compressed on their
+ * own and hold whole documents, so that blocks can be compressed and
+ * decompressed in parallel. Read the file back with
+ * bson_reader_new_from_compressed_file().
+ */
+typedef struct _bson_compressed_writer_t bson_compressed_writer_t;
+
+
+bool                      bson_compressor_is_supported           (bson_compressor_t         compressor);
+bson_compressed_writer_t *bson_compressed_writer_new             (int                       fd,
+                                                                  bool                      close_on_destroy,
+                                                                  bson_compressor_t         compressor,
+                                                                  uint32_t                  n_threads,
+                                                                  bson_error_t             *error);
+bson_compressed_writer_t *bson_compressed_writer_new_from_file   (const char               *path,
+                                                                  bson_compressor_t         compressor,
+                                                                  uint32_t                  n_threads,
+                                                                  bson_error_t             *error);
+void                      bson_compressed_writer_set_block_size  (bson_compressed_writer_t *writer,
+                                                                  size_t                    block_size);
+void                      bson_compressed_writer_set_level       (bson_compressed_writer_t *writer,
+                                                                  int                       level);
+bool                      bson_compressed_writer_begin           (bson_compressed_writer_t *writer,
+                                                                  bson_t                  **bson);
+bool                      bson_compressed_writer_end             (bson_compressed_writer_t *writer,
+                                                                  bson_t                   *bson,
+                                                                  bson_error_t             *error);
+void                      bson_compressed_writer_rollback        (bson_compressed_writer_t *writer,
+                                                                  bson_t                   *bson);
+bool                      bson_compressed_writer_write           (bson_compressed_writer_t *writer,
+                                                                  const bson_t             *bson,
+                                                                  bson_error_t             *error);
+bool                      bson_compressed_writer_close           (bson_compressed_writer_t *writer,
+                                                                  bson_error_t             *error);
+void                      bson_compressed_writer_destroy         (bson_compressed_writer_t *writer);
+bson_reader_t            *bson_reader_new_from_compressed_fd     (int                       fd,
+                                                                  bool                      close_on_destroy,
+                                                                  uint32_t                  n_threads,
+                                                                  bson_error_t             *error);
+bson_reader_t            *bson_reader_new_from_compressed_file   (const char               *path,
+                                                                  uint32_t                  n_threads,
+                                                                  bson_error_t             *error);
+
+
+BSON_END_DECLS
+
+
+#endif /* BSON_COMPRESSION_H */
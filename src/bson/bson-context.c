@@ -28,6 +28,7 @@
 #include "bson-context-private.h"
 #include "bson-md5.h"
 #include "bson-memory.h"
+#include "bson-trace-private.h"
 #include "bson-thread-private.h"
 
 #ifdef BSON_HAVE_SYSCALL_TID
@@ -232,6 +233,83 @@ _bson_context_get_oid_seq32 (bson_context_t *context, /* IN */
 }
 
 
+#ifdef BSON_HAVE_USDT
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_context_seq32_traced --
+ * _bson_context_seq64_traced --
+ *
+ *       Used instead of the atomic add while the oid__contention probe
+ *       is attached. A compare-and-swap loop lets us count how many
+ *       times another thread took the sequence number first.
+ *
+ * Returns:
+ *       The incremented sequence number, like bson_atomic_int_add().
+ *
+ * Side effects:
+ *       Fires the oid__contention probe if a race was lost.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static int32_t
+_bson_context_seq32_traced (bson_context_t *context) /* IN */
+{
+   int64_t start = bson_get_monotonic_time ();
+   uint32_t retries = 0;
+   int32_t seq;
+   int32_t next;
+
+   for (;;) {
+      seq = *(volatile int32_t *)&context->seq32;
+      next = (int32_t)((uint32_t)seq + 1);
+
+      if (__sync_bool_compare_and_swap (&context->seq32, seq, next)) {
+         break;
+      }
+
+      retries++;
+   }
+
+   if (retries) {
+      BSON_PROBE3 (oid__contention, 32, retries,
+                   bson_get_monotonic_time () - start);
+   }
+
+   return next;
+}
+
+
+static int64_t
+_bson_context_seq64_traced (bson_context_t *context) /* IN */
+{
+   int64_t start = bson_get_monotonic_time ();
+   uint32_t retries = 0;
+   int64_t seq;
+   int64_t next;
+
+   for (;;) {
+      seq = *(volatile int64_t *)&context->seq64;
+      next = (int64_t)((uint64_t)seq + 1);
+
+      if (__sync_bool_compare_and_swap (&context->seq64, seq, next)) {
+         break;
+      }
+
+      retries++;
+   }
+
+   if (retries) {
+      BSON_PROBE3 (oid__contention, 64, retries,
+                   bson_get_monotonic_time () - start);
+   }
+
+   return next;
+}
+#endif
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -252,7 +330,16 @@ static void
 _bson_context_get_oid_seq32_threadsafe (bson_context_t *context, /* IN */
                                         bson_oid_t     *oid)     /* OUT */
 {
-   int32_t seq = bson_atomic_int_add (&context->seq32, 1);
+   int32_t seq;
+
+#ifdef BSON_HAVE_USDT
+   if (BSON_PROBE_ENABLED (oid__contention)) {
+      seq = _bson_context_seq32_traced (context);
+   } else
+#endif
+   {
+      seq = bson_atomic_int_add (&context->seq32, 1);
+   }
 
    seq = BSON_UINT32_TO_BE (seq);
    memcpy (&oid->bytes[9], ((uint8_t *)&seq) + 1, 3);
@@ -309,7 +396,16 @@ static void
 _bson_context_get_oid_seq64_threadsafe (bson_context_t *context, /* IN */
                                         bson_oid_t     *oid)     /* OUT */
 {
-   int64_t seq = bson_atomic_int64_add (&context->seq64, 1);
+   int64_t seq;
+
+#ifdef BSON_HAVE_USDT
+   if (BSON_PROBE_ENABLED (oid__contention)) {
+      seq = _bson_context_seq64_traced (context);
+   } else
+#endif
+   {
+      seq = bson_atomic_int64_add (&context->seq64, 1);
+   }
 
    seq = BSON_UINT64_TO_BE (seq);
    memcpy (&oid->bytes[4], &seq, sizeof (seq));
@@ -27,8 +27,19 @@
 BSON_BEGIN_DECLS
 
 
-#define BSON_ERROR_JSON   1
-#define BSON_ERROR_READER 2
+#define BSON_ERROR_JSON       1
+#define BSON_ERROR_READER     2
+#define BSON_ERROR_INDEX      3
+#define BSON_ERROR_MATCHER    4
+#define BSON_ERROR_PROJECTION 5
+#define BSON_ERROR_IOVEC      6
+#define BSON_ERROR_STRUCT     7
+#define BSON_ERROR_COLUMNAR   8
+#define BSON_ERROR_AGGREGATE  9
+#define BSON_ERROR_PULL      10
+#define BSON_ERROR_SHM_RING  11
+#define BSON_ERROR_COMPRESSION 12
+#define BSON_ERROR_JSONL     13
 
 
 void  bson_set_error  (bson_error_t *error,
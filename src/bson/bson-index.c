@@ -0,0 +1,810 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "bson.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#ifdef BSON_OS_WIN32
+# include <io.h>
+# include <share.h>
+#else
+# include <sys/mman.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "bson-index.h"
+#include "bson-memory.h"
+#include "bson-private.h"
+
+
+/*
+ * The index file is laid out as follows, with all integers stored
+ * little-endian:
+ *
+ *    char     magic[8];              "BSONIDX1"
+ *    uint64_t file_size;             size of the indexed file
+ *    uint64_t n_docs;
+ *    uint64_t n_ids;
+ *    uint64_t offsets[n_docs];       offset of each document by ordinal
+ *    uint64_t id_offsets[n_ids];     offsets of documents sorted by _id
+ *
+ * The _id table stores offsets rather than keys so that it stays compact;
+ * keys are read from the mapped file while searching. Keys are ordered by
+ * type, then encoded length, then encoded bytes, which is sufficient for
+ * exact-match lookups.
+ */
+#define BSON_INDEX_MAGIC       "BSONIDX1"
+#define BSON_INDEX_HEADER_SIZE 32
+
+
+typedef struct
+{
+   const uint8_t *data;
+   size_t         len;
+#ifdef BSON_OS_WIN32
+   HANDLE         mapping;
+#endif
+} bson_index_map_t;
+
+
+struct _bson_index_t
+{
+   bson_index_map_t file;
+   bson_index_map_t index;
+   uint64_t         n_docs;
+   uint64_t         n_ids;
+   const uint8_t   *offsets;
+   const uint8_t   *id_offsets;
+};
+
+
+typedef struct
+{
+   uint8_t        type;
+   const uint8_t *key;
+   uint32_t       key_len;
+} bson_index_key_t;
+
+
+typedef struct
+{
+   uint64_t         offset;
+   size_t           key_off;
+   bson_index_key_t key;
+} bson_index_entry_t;
+
+
+static BSON_INLINE uint64_t
+_bson_index_read_uint64 (const uint8_t *p) /* IN */
+{
+   uint64_t v;
+
+   memcpy (&v, p, sizeof v);
+
+   return BSON_UINT64_FROM_LE (v);
+}
+
+
+static BSON_INLINE void
+_bson_index_write_uint64 (uint8_t  *p, /* OUT */
+                          uint64_t  v) /* IN */
+{
+   v = BSON_UINT64_TO_LE (v);
+   memcpy (p, &v, sizeof v);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_index_key_from_iter --
+ *
+ *       Fill @key with the type and encoded value of the field @iter
+ *       points to.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @key points into the buffer being iterated.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_bson_index_key_from_iter (const bson_iter_t *iter, /* IN */
+                           bson_index_key_t  *key)  /* OUT */
+{
+   uint32_t value;
+
+   /* the value follows the key; null and similar types have none */
+   value = iter->key + _bson_iter_key_len (iter) + 1;
+
+   key->type = (uint8_t)bson_iter_type (iter);
+   key->key = iter->raw + value;
+   key->key_len = iter->next_off - value;
+}
+
+
+static int
+_bson_index_key_compare (const bson_index_key_t *a, /* IN */
+                         const bson_index_key_t *b) /* IN */
+{
+   int ret;
+
+   if (a->type != b->type) {
+      return (a->type < b->type) ? -1 : 1;
+   }
+
+   if (a->key_len != b->key_len) {
+      return (a->key_len < b->key_len) ? -1 : 1;
+   }
+
+   ret = memcmp (a->key, b->key, a->key_len);
+
+   return (ret < 0) ? -1 : (ret > 0);
+}
+
+
+static int
+_bson_index_entry_compare (const void *a, /* IN */
+                           const void *b) /* IN */
+{
+   const bson_index_entry_t *ea = a;
+   const bson_index_entry_t *eb = b;
+   int ret;
+
+   if ((ret = _bson_index_key_compare (&ea->key, &eb->key))) {
+      return ret;
+   }
+
+   /* keep duplicate _ids in file order so lookups return the first */
+   if (ea->offset != eb->offset) {
+      return (ea->offset < eb->offset) ? -1 : 1;
+   }
+
+   return 0;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_index_doc_at --
+ *
+ *       Initialize @doc as a read-only view of the document at @offset
+ *       within the mapped file.
+ *
+ * Returns:
+ *       true if a well-formed document lies at @offset; otherwise false.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_bson_index_doc_at (const bson_index_t *index,  /* IN */
+                    uint64_t            offset, /* IN */
+                    bson_t             *doc)    /* OUT */
+{
+   int32_t len;
+
+   if (index->file.len < 5 || offset > index->file.len - 5) {
+      return false;
+   }
+
+   memcpy (&len, index->file.data + offset, sizeof len);
+   len = BSON_UINT32_FROM_LE (len);
+
+   if (len < 5 || (uint64_t)len > index->file.len - offset) {
+      return false;
+   }
+
+   return bson_init_static (doc, index->file.data + offset, (size_t)len);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_index_map --
+ *
+ *       Map the file at @path read-only into memory.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set.
+ *
+ * Side effects:
+ *       @map must be released with _bson_index_unmap().
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_bson_index_map (const char       *path,  /* IN */
+                 bson_index_map_t *map,   /* OUT */
+                 bson_error_t     *error) /* OUT */
+{
+   char errmsg_buf[BSON_ERROR_BUFFER_SIZE];
+   char *errmsg;
+#ifdef BSON_OS_WIN32
+   LARGE_INTEGER size;
+   HANDLE file;
+
+   memset (map, 0, sizeof *map);
+
+   file = CreateFileA (path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                       OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+   if (file == INVALID_HANDLE_VALUE) {
+      goto failure;
+   }
+
+   if (!GetFileSizeEx (file, &size)) {
+      CloseHandle (file);
+      goto failure;
+   }
+
+   map->len = (size_t)size.QuadPart;
+
+   if (map->len) {
+      map->mapping = CreateFileMapping (file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+      if (map->mapping) {
+         map->data = MapViewOfFile (map->mapping, FILE_MAP_READ, 0, 0, 0);
+      }
+
+      if (!map->data) {
+         if (map->mapping) {
+            CloseHandle (map->mapping);
+         }
+         CloseHandle (file);
+         goto failure;
+      }
+   }
+
+   CloseHandle (file);
+
+   return true;
+
+failure:
+   errmsg = bson_strerror_r (EIO, errmsg_buf, sizeof errmsg_buf);
+#else
+   struct stat st;
+   void *data;
+   int fd;
+
+   memset (map, 0, sizeof *map);
+
+   if ((fd = open (path, O_RDONLY)) == -1) {
+      goto failure;
+   }
+
+   if (fstat (fd, &st) != 0) {
+      close (fd);
+      goto failure;
+   }
+
+   map->len = (size_t)st.st_size;
+
+   if (map->len) {
+      data = mmap (NULL, map->len, PROT_READ, MAP_SHARED, fd, 0);
+
+      if (data == MAP_FAILED) {
+         close (fd);
+         goto failure;
+      }
+
+      map->data = data;
+   }
+
+   close (fd);
+
+   return true;
+
+failure:
+   errmsg = bson_strerror_r (errno, errmsg_buf, sizeof errmsg_buf);
+#endif
+   bson_set_error (error,
+                   BSON_ERROR_INDEX,
+                   BSON_ERROR_INDEX_IO,
+                   "Failed to map \"%s\": %s", path, errmsg);
+
+   return false;
+}
+
+
+static void
+_bson_index_unmap (bson_index_map_t *map) /* IN */
+{
+   if (map->data) {
+#ifdef BSON_OS_WIN32
+      UnmapViewOfFile (map->data);
+      CloseHandle (map->mapping);
+#else
+      munmap ((void *)map->data, map->len);
+#endif
+   }
+
+   memset (map, 0, sizeof *map);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_index_write_file --
+ *
+ *       Write @len bytes of @data to a new file at @path, replacing any
+ *       existing file.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_bson_index_write_file (const char    *path,  /* IN */
+                        const uint8_t *data,  /* IN */
+                        size_t         len,   /* IN */
+                        bson_error_t  *error) /* OUT */
+{
+   char errmsg_buf[BSON_ERROR_BUFFER_SIZE];
+   char *errmsg;
+   ssize_t r;
+   int fd;
+
+#ifdef BSON_OS_WIN32
+   if (_sopen_s (&fd, path, (_O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY),
+                 _SH_DENYNO, (_S_IREAD | _S_IWRITE)) != 0) {
+      fd = -1;
+   }
+#else
+   fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+
+   if (fd == -1) {
+      goto failure;
+   }
+
+   while (len) {
+#ifdef BSON_OS_WIN32
+      r = _write (fd, data, (unsigned int)len);
+#else
+      r = write (fd, data, len);
+#endif
+
+      if (r < 0 && errno == EINTR) {
+         continue;
+      }
+
+      if (r <= 0) {
+         goto failure;
+      }
+
+      data += r;
+      len -= (size_t)r;
+   }
+
+#ifdef BSON_OS_WIN32
+   if (_close (fd) != 0) {
+#else
+   if (close (fd) != 0) {
+#endif
+      fd = -1;
+      goto failure;
+   }
+
+   return true;
+
+failure:
+   errmsg = bson_strerror_r (errno, errmsg_buf, sizeof errmsg_buf);
+   bson_set_error (error,
+                   BSON_ERROR_INDEX,
+                   BSON_ERROR_INDEX_IO,
+                   "Failed to write \"%s\": %s", path, errmsg);
+
+   if (fd != -1) {
+#ifdef BSON_OS_WIN32
+      _close (fd);
+#else
+      close (fd);
+#endif
+   }
+
+   return false;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_index_build --
+ *
+ *       Build a sidecar index at @index_path for the sequence of BSON
+ *       documents in the file at @path, in a single streaming pass.
+ *
+ *       The index records the byte offset of every document and a table
+ *       of offsets sorted by each document's "_id" field. Documents
+ *       without an "_id" are reachable only by ordinal.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set.
+ *
+ * Side effects:
+ *       @index_path is created or replaced.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_index_build (const char   *path,       /* IN */
+                  const char   *index_path, /* IN */
+                  bson_error_t *error)      /* OUT */
+{
+   bson_index_entry_t *entries = NULL;
+   bson_reader_t *reader;
+   const bson_t *doc;
+   bson_iter_t iter;
+   struct stat st;
+   uint64_t *offsets = NULL;
+   uint8_t *keys = NULL;
+   uint8_t *buf = NULL;
+   uint8_t *p;
+   size_t n_docs = 0;
+   size_t n_docs_alloc = 0;
+   size_t n_ids = 0;
+   size_t n_ids_alloc = 0;
+   size_t keys_len = 0;
+   size_t keys_alloc = 0;
+   size_t buflen;
+   size_t i;
+   off_t offset;
+   bool eof = false;
+   bool ret = false;
+
+   BSON_ASSERT (path);
+   BSON_ASSERT (index_path);
+
+   if (!(reader = bson_reader_new_from_file (path, error))) {
+      return false;
+   }
+
+   for (;;) {
+      offset = bson_reader_tell (reader);
+
+      if (!(doc = bson_reader_read (reader, &eof))) {
+         break;
+      }
+
+      if (n_docs == n_docs_alloc) {
+         n_docs_alloc = n_docs_alloc ? n_docs_alloc * 2 : 1024;
+         offsets = bson_realloc (offsets, n_docs_alloc * sizeof *offsets);
+      }
+
+      offsets[n_docs++] = (uint64_t)offset;
+
+      if (!bson_iter_init_find (&iter, doc, "_id")) {
+         continue;
+      }
+
+      if (n_ids == n_ids_alloc) {
+         n_ids_alloc = n_ids_alloc ? n_ids_alloc * 2 : 1024;
+         entries = bson_realloc (entries, n_ids_alloc * sizeof *entries);
+      }
+
+      _bson_index_key_from_iter (&iter, &entries[n_ids].key);
+
+      while (keys_len + entries[n_ids].key.key_len > keys_alloc) {
+         keys_alloc = keys_alloc ? keys_alloc * 2 : 4096;
+         keys = bson_realloc (keys, keys_alloc);
+      }
+
+      /* the reader reuses its buffer, so keep a copy of each key */
+      memcpy (keys + keys_len, entries[n_ids].key.key,
+              entries[n_ids].key.key_len);
+      entries[n_ids].key_off = keys_len;
+      entries[n_ids].offset = (uint64_t)offset;
+      keys_len += entries[n_ids].key.key_len;
+      n_ids++;
+   }
+
+   /* a truncated final document also reports eof */
+   if (!eof || stat (path, &st) != 0 || st.st_size != offset) {
+      bson_set_error (error,
+                      BSON_ERROR_INDEX,
+                      BSON_ERROR_INDEX_CORRUPT,
+                      "Corrupt BSON document at offset %" PRId64,
+                      (int64_t)offset);
+      goto cleanup;
+   }
+
+   for (i = 0; i < n_ids; i++) {
+      entries[i].key.key = keys + entries[i].key_off;
+   }
+
+   if (n_ids) {
+      qsort (entries, n_ids, sizeof *entries, _bson_index_entry_compare);
+   }
+
+   buflen = BSON_INDEX_HEADER_SIZE + (n_docs + n_ids) * sizeof (uint64_t);
+   buf = bson_malloc (buflen);
+
+   memcpy (buf, BSON_INDEX_MAGIC, 8);
+   _bson_index_write_uint64 (buf + 8, (uint64_t)st.st_size);
+   _bson_index_write_uint64 (buf + 16, n_docs);
+   _bson_index_write_uint64 (buf + 24, n_ids);
+
+   p = buf + BSON_INDEX_HEADER_SIZE;
+
+   for (i = 0; i < n_docs; i++, p += 8) {
+      _bson_index_write_uint64 (p, offsets[i]);
+   }
+
+   for (i = 0; i < n_ids; i++, p += 8) {
+      _bson_index_write_uint64 (p, entries[i].offset);
+   }
+
+   ret = _bson_index_write_file (index_path, buf, buflen, error);
+
+cleanup:
+   bson_reader_destroy (reader);
+   bson_free (offsets);
+   bson_free (entries);
+   bson_free (keys);
+   bson_free (buf);
+
+   return ret;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_index_new --
+ *
+ *       Open the file at @path together with the sidecar index at
+ *       @index_path created by bson_index_build().
+ *
+ * Returns:
+ *       A newly allocated bson_index_t that should be freed with
+ *       bson_index_destroy(), or NULL and @error is set if either file
+ *       could not be mapped or the index does not match @path.
+ *
+ * Side effects:
+ *       @error may be set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bson_index_t *
+bson_index_new (const char   *path,       /* IN */
+                const char   *index_path, /* IN */
+                bson_error_t *error)      /* OUT */
+{
+   bson_index_t *index;
+   uint64_t file_size;
+   uint64_t max_entries;
+
+   BSON_ASSERT (path);
+   BSON_ASSERT (index_path);
+
+   index = bson_malloc0 (sizeof *index);
+
+   if (!_bson_index_map (path, &index->file, error) ||
+       !_bson_index_map (index_path, &index->index, error)) {
+      goto failure;
+   }
+
+   if (index->index.len < BSON_INDEX_HEADER_SIZE ||
+       memcmp (index->index.data, BSON_INDEX_MAGIC, 8) != 0) {
+      bson_set_error (error,
+                      BSON_ERROR_INDEX,
+                      BSON_ERROR_INDEX_CORRUPT,
+                      "\"%s\" is not a BSON index", index_path);
+      goto failure;
+   }
+
+   file_size = _bson_index_read_uint64 (index->index.data + 8);
+   index->n_docs = _bson_index_read_uint64 (index->index.data + 16);
+   index->n_ids = _bson_index_read_uint64 (index->index.data + 24);
+   max_entries = (index->index.len - BSON_INDEX_HEADER_SIZE) / 8;
+
+   if (index->n_docs > max_entries ||
+       index->n_ids > max_entries - index->n_docs ||
+       index->index.len != BSON_INDEX_HEADER_SIZE +
+                           (index->n_docs + index->n_ids) * 8) {
+      bson_set_error (error,
+                      BSON_ERROR_INDEX,
+                      BSON_ERROR_INDEX_CORRUPT,
+                      "\"%s\" is truncated", index_path);
+      goto failure;
+   }
+
+   if (file_size != (uint64_t)index->file.len) {
+      bson_set_error (error,
+                      BSON_ERROR_INDEX,
+                      BSON_ERROR_INDEX_STALE,
+                      "\"%s\" does not match the size of \"%s\"",
+                      index_path, path);
+      goto failure;
+   }
+
+   index->offsets = index->index.data + BSON_INDEX_HEADER_SIZE;
+   index->id_offsets = index->offsets + (index->n_docs * 8);
+
+   return index;
+
+failure:
+   bson_index_destroy (index);
+
+   return NULL;
+}
+
+
+void
+bson_index_destroy (bson_index_t *index) /* IN */
+{
+   if (index) {
+      _bson_index_unmap (&index->file);
+      _bson_index_unmap (&index->index);
+      bson_free (index);
+   }
+}
+
+
+uint64_t
+bson_index_get_count (const bson_index_t *index) /* IN */
+{
+   BSON_ASSERT (index);
+
+   return index->n_docs;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_index_get --
+ *
+ *       Fetch the document at position @ordinal in the file, in constant
+ *       time.
+ *
+ * Returns:
+ *       true and @doc is initialized as a read-only view if the document
+ *       exists; otherwise false.
+ *
+ * Side effects:
+ *       @doc is valid until @index is destroyed and need not be
+ *       destroyed itself.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_index_get (const bson_index_t *index,   /* IN */
+                uint64_t            ordinal, /* IN */
+                bson_t             *doc)     /* OUT */
+{
+   BSON_ASSERT (index);
+   BSON_ASSERT (doc);
+
+   if (ordinal >= index->n_docs) {
+      return false;
+   }
+
+   return _bson_index_doc_at (
+      index, _bson_index_read_uint64 (index->offsets + (ordinal * 8)), doc);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_index_find_id --
+ *
+ *       Fetch the first document in the file whose "_id" field equals
+ *       @id, using a binary search of the index.
+ *
+ *       Values match only if they have the same BSON type and encoding;
+ *       for example, an int32 @id does not match a double "_id".
+ *
+ * Returns:
+ *       true and @doc is initialized as a read-only view if a document
+ *       was found; otherwise false.
+ *
+ * Side effects:
+ *       @doc is valid until @index is destroyed and need not be
+ *       destroyed itself.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_index_find_id (const bson_index_t *index, /* IN */
+                    const bson_value_t *id,    /* IN */
+                    bson_t             *doc)   /* OUT */
+{
+   bson_index_key_t needle;
+   bson_index_key_t key;
+   bson_iter_t iter;
+   bson_t tmp;
+   bson_t mid_doc;
+   uint64_t lo;
+   uint64_t hi;
+   uint64_t mid;
+   bool ret = false;
+
+   BSON_ASSERT (index);
+   BSON_ASSERT (id);
+   BSON_ASSERT (doc);
+
+   bson_init (&tmp);
+
+   if (!bson_append_value (&tmp, "_id", 3, id) ||
+       !bson_iter_init_find (&iter, &tmp, "_id")) {
+      goto cleanup;
+   }
+
+   _bson_index_key_from_iter (&iter, &needle);
+
+   lo = 0;
+   hi = index->n_ids;
+
+   while (lo < hi) {
+      mid = lo + ((hi - lo) / 2);
+
+      if (!_bson_index_doc_at (
+             index, _bson_index_read_uint64 (index->id_offsets + (mid * 8)),
+             &mid_doc) ||
+          !bson_iter_init_find (&iter, &mid_doc, "_id")) {
+         goto cleanup;
+      }
+
+      _bson_index_key_from_iter (&iter, &key);
+
+      if (_bson_index_key_compare (&key, &needle) < 0) {
+         lo = mid + 1;
+      } else {
+         hi = mid;
+      }
+   }
+
+   if (lo < index->n_ids &&
+       _bson_index_doc_at (
+          index, _bson_index_read_uint64 (index->id_offsets + (lo * 8)),
+          doc) &&
+       bson_iter_init_find (&iter, doc, "_id")) {
+      _bson_index_key_from_iter (&iter, &key);
+      ret = (_bson_index_key_compare (&key, &needle) == 0);
+   }
+
+cleanup:
+   bson_destroy (&tmp);
+
+   return ret;
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef BSON_INDEX_H
+#define BSON_INDEX_H
+
+
+#if !defined (BSON_INSIDE) && !defined (BSON_COMPILATION)
+# error "Only <bson.h> can be included directly."
+#endif
+
+
+#include "bson-compat.h"
+#include "bson-types.h"
+#include "bson-value.h"
+
+
+BSON_BEGIN_DECLS
+
+
+#define BSON_ERROR_INDEX_IO      1
+#define BSON_ERROR_INDEX_CORRUPT 2
+#define BSON_ERROR_INDEX_STALE   3
+
+
+/**
+ * bson_index_t:
+ *
+ * A bson_index_t provides random access into a file containing a sequence
+ * of BSON documents using a sidecar index file built with
+ * bson_index_build(). The index maps each document ordinal to its byte
+ * offset and keeps a table of offsets sorted by _id.
+ *
+ * Both files are memory mapped. Documents returned by bson_index_get() and
+ * bson_index_find_id() are read-only views into the mapping and remain
+ * valid until the bson_index_t is destroyed.
+ */
+typedef struct _bson_index_t bson_index_t;
+
+
+bool          bson_index_build     (const char         *path,
+                                    const char         *index_path,
+                                    bson_error_t       *error);
+bson_index_t *bson_index_new       (const char         *path,
+                                    const char         *index_path,
+                                    bson_error_t       *error);
+void          bson_index_destroy   (bson_index_t       *index);
+uint64_t      bson_index_get_count (const bson_index_t *index);
+bool          bson_index_get       (const bson_index_t *index,
+                                    uint64_t            ordinal,
+                                    bson_t             *doc);
+bool          bson_index_find_id   (const bson_index_t *index,
+                                    const bson_value_t *id,
+                                    bson_t             *doc);
+
+
+BSON_END_DECLS
+
+
+#endif /* BSON_INDEX_H */
@@ -0,0 +1,797 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "bson.h"
+
+#include <errno.h>
+#ifdef BSON_OS_WIN32
+# include <io.h>
+#else
+# include <limits.h>
+# include <unistd.h>
+#endif
+#include <string.h>
+
+#include "bson-iovec.h"
+#include "bson-memory.h"
+#include "bson-private.h"
+
+
+/*
+ * Documents and values smaller than this are copied into the owned buffer
+ * rather than borrowed, since a separate segment costs more to gather than
+ * copying a few bytes.
+ */
+#define BSON_IOVEC_BORROW_MIN 64
+
+#ifndef IOV_MAX
+# define IOV_MAX 1024
+#endif
+
+
+/*
+ * A segment refers either to borrowed memory, or to a range of the
+ * builder's owned buffer. Owned segments are kept as offsets, since the
+ * owned buffer may move as it grows; pointers are resolved when the
+ * iovecs are requested.
+ */
+typedef struct
+{
+   const uint8_t *borrowed;
+   size_t         off;
+   size_t         len;
+} bson_iovec_segment_t;
+
+
+typedef struct
+{
+   size_t   prefix_off;
+   uint32_t start;
+} bson_iovec_frame_t;
+
+
+struct _bson_iovec_builder_t
+{
+   uint8_t              *owned;
+   size_t                owned_len;
+   size_t                owned_alloc;
+   bson_iovec_segment_t *segments;
+   size_t                n_segments;
+   size_t                segments_alloc;
+   bson_iovec_frame_t   *frames;
+   size_t                depth;
+   size_t                frames_alloc;
+   uint32_t              length;
+   bson_iovec_t         *iovecs;
+   bool                  finished;
+};
+
+
+static const uint8_t gZero;
+
+
+static void
+_bson_iovec_builder_push_segment (bson_iovec_builder_t *builder,  /* IN */
+                                  const uint8_t        *borrowed, /* IN */
+                                  size_t                off,      /* IN */
+                                  size_t                len)      /* IN */
+{
+   bson_iovec_segment_t *last;
+
+   if (builder->n_segments) {
+      last = &builder->segments[builder->n_segments - 1];
+
+      /* coalesce adjacent owned ranges */
+      if (!borrowed && !last->borrowed && last->off + last->len == off) {
+         last->len += len;
+         return;
+      }
+   }
+
+   if (builder->n_segments == builder->segments_alloc) {
+      builder->segments_alloc = builder->segments_alloc ?
+                                builder->segments_alloc * 2 : 16;
+      builder->segments = bson_realloc (
+         builder->segments,
+         builder->segments_alloc * sizeof *builder->segments);
+   }
+
+   builder->segments[builder->n_segments].borrowed = borrowed;
+   builder->segments[builder->n_segments].off = off;
+   builder->segments[builder->n_segments].len = len;
+   builder->n_segments++;
+}
+
+
+static void
+_bson_iovec_builder_copy (bson_iovec_builder_t *builder, /* IN */
+                          const void           *data,    /* IN */
+                          size_t                len)     /* IN */
+{
+   if (!len) {
+      return;
+   }
+
+   if (builder->owned_len + len > builder->owned_alloc) {
+      while (builder->owned_len + len > builder->owned_alloc) {
+         builder->owned_alloc *= 2;
+      }
+      builder->owned = bson_realloc (builder->owned, builder->owned_alloc);
+   }
+
+   memcpy (builder->owned + builder->owned_len, data, len);
+   _bson_iovec_builder_push_segment (builder, NULL, builder->owned_len, len);
+   builder->owned_len += len;
+   builder->length += (uint32_t)len;
+}
+
+
+static void
+_bson_iovec_builder_borrow (bson_iovec_builder_t *builder, /* IN */
+                            const uint8_t        *data,    /* IN */
+                            size_t                len)     /* IN */
+{
+   if (len < BSON_IOVEC_BORROW_MIN) {
+      _bson_iovec_builder_copy (builder, data, len);
+      return;
+   }
+
+   _bson_iovec_builder_push_segment (builder, data, 0, len);
+   builder->length += (uint32_t)len;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_iovec_builder_header --
+ *
+ *       Check that an element with a @value_len byte value can be appended,
+ *       and if so write its type and key.
+ *
+ * Returns:
+ *       true if successful; false if the builder is finished or the
+ *       document would exceed the maximum BSON size.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_bson_iovec_builder_header (bson_iovec_builder_t *builder,    /* IN */
+                            uint8_t               type,       /* IN */
+                            const char           *key,        /* IN */
+                            int                   key_length, /* IN */
+                            size_t                value_len)  /* IN */
+{
+   if (builder->finished) {
+      return false;
+   }
+
+   if (key_length < 0) {
+      key_length = (int)strlen (key);
+   }
+
+   /* leave room for the trailing bytes of every open document */
+   if ((size_t)builder->length + 1 + key_length + 1 + value_len +
+       builder->depth > (size_t)INT32_MAX) {
+      return false;
+   }
+
+   _bson_iovec_builder_copy (builder, &type, 1);
+   _bson_iovec_builder_copy (builder, key, key_length);
+   _bson_iovec_builder_copy (builder, &gZero, 1);
+
+   return true;
+}
+
+
+static void
+_bson_iovec_builder_begin (bson_iovec_builder_t *builder) /* IN */
+{
+   static const uint8_t placeholder[4];
+
+   if (builder->depth == builder->frames_alloc) {
+      builder->frames_alloc *= 2;
+      builder->frames = bson_realloc (
+         builder->frames, builder->frames_alloc * sizeof *builder->frames);
+   }
+
+   builder->frames[builder->depth].prefix_off = builder->owned_len;
+   builder->frames[builder->depth].start = builder->length;
+   builder->depth++;
+
+   _bson_iovec_builder_copy (builder, placeholder, sizeof placeholder);
+}
+
+
+static void
+_bson_iovec_builder_end (bson_iovec_builder_t *builder) /* IN */
+{
+   bson_iovec_frame_t *frame;
+   uint32_t le;
+
+   _bson_iovec_builder_copy (builder, &gZero, 1);
+
+   frame = &builder->frames[--builder->depth];
+   le = BSON_UINT32_TO_LE (builder->length - frame->start);
+   memcpy (builder->owned + frame->prefix_off, &le, sizeof le);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_iovec_builder_new --
+ *
+ *       Create a new bson_iovec_builder_t containing an empty document.
+ *
+ * Returns:
+ *       A newly allocated bson_iovec_builder_t that should be freed with
+ *       bson_iovec_builder_destroy().
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bson_iovec_builder_t *
+bson_iovec_builder_new (void)
+{
+   bson_iovec_builder_t *builder;
+
+   builder = bson_malloc0 (sizeof *builder);
+   builder->owned_alloc = 256;
+   builder->owned = bson_malloc (builder->owned_alloc);
+   builder->frames_alloc = 8;
+   builder->frames = bson_malloc (builder->frames_alloc *
+                                  sizeof *builder->frames);
+
+   _bson_iovec_builder_begin (builder);
+
+   return builder;
+}
+
+
+void
+bson_iovec_builder_destroy (bson_iovec_builder_t *builder) /* IN */
+{
+   if (builder) {
+      bson_free (builder->owned);
+      bson_free (builder->segments);
+      bson_free (builder->frames);
+      bson_free (builder->iovecs);
+      bson_free (builder);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_iovec_builder_append_document --
+ *
+ *       Append @value as an embedded document. @value is referenced, not
+ *       copied, and must not be modified or freed until @builder is
+ *       destroyed.
+ *
+ * Returns:
+ *       true if successful; false if the builder is finished or the
+ *       document would exceed the maximum BSON size.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_iovec_builder_append_document (bson_iovec_builder_t *builder,    /* IN */
+                                    const char           *key,        /* IN */
+                                    int                   key_length, /* IN */
+                                    const bson_t         *value)      /* IN */
+{
+   BSON_ASSERT (builder);
+   BSON_ASSERT (key);
+   BSON_ASSERT (value);
+
+   if (!_bson_iovec_builder_header (builder, BSON_TYPE_DOCUMENT, key,
+                                    key_length, value->len)) {
+      return false;
+   }
+
+   _bson_iovec_builder_borrow (builder, bson_get_data (value), value->len);
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_iovec_builder_append_array --
+ *
+ *       Append @array as an embedded array. @array is referenced, not
+ *       copied, and must not be modified or freed until @builder is
+ *       destroyed.
+ *
+ * Returns:
+ *       true if successful; false if the builder is finished or the
+ *       document would exceed the maximum BSON size.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_iovec_builder_append_array (bson_iovec_builder_t *builder,    /* IN */
+                                 const char           *key,        /* IN */
+                                 int                   key_length, /* IN */
+                                 const bson_t         *array)      /* IN */
+{
+   BSON_ASSERT (builder);
+   BSON_ASSERT (key);
+   BSON_ASSERT (array);
+
+   if (!_bson_iovec_builder_header (builder, BSON_TYPE_ARRAY, key,
+                                    key_length, array->len)) {
+      return false;
+   }
+
+   _bson_iovec_builder_borrow (builder, bson_get_data (array), array->len);
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_iovec_builder_append_iter --
+ *
+ *       Append the value @iter is positioned on, using the key of @iter if
+ *       @key is NULL. The value is referenced in the buffer @iter is
+ *       iterating, which must not be modified or freed until @builder is
+ *       destroyed.
+ *
+ * Returns:
+ *       true if successful; false if the builder is finished or the
+ *       document would exceed the maximum BSON size.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_iovec_builder_append_iter (bson_iovec_builder_t *builder,    /* IN */
+                                const char           *key,        /* IN */
+                                int                   key_length, /* IN */
+                                const bson_iter_t    *iter)       /* IN */
+{
+   uint32_t value;
+   size_t value_len;
+
+   BSON_ASSERT (builder);
+   BSON_ASSERT (iter);
+
+   /* the value follows the key, and runs to the next element */
+   value = iter->key + _bson_iter_key_len (iter) + 1;
+   value_len = iter->next_off - value;
+
+   if (!key) {
+      key = bson_iter_key (iter);
+      key_length = (int)_bson_iter_key_len (iter);
+   }
+
+   if (!_bson_iovec_builder_header (builder, (uint8_t)bson_iter_type (iter),
+                                    key, key_length, value_len)) {
+      return false;
+   }
+
+   _bson_iovec_builder_borrow (builder, iter->raw + value, value_len);
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_iovec_builder_append_value --
+ *
+ *       Append a copy of @value. This is intended for small scalar values;
+ *       use bson_iovec_builder_append_document() and friends to avoid
+ *       copying large ones.
+ *
+ * Returns:
+ *       true if successful; false if the builder is finished or the
+ *       document would exceed the maximum BSON size.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_iovec_builder_append_value (bson_iovec_builder_t *builder,    /* IN */
+                                 const char           *key,        /* IN */
+                                 int                   key_length, /* IN */
+                                 const bson_value_t   *value)      /* IN */
+{
+   bson_t tmp = BSON_INITIALIZER;
+   bool ret = false;
+
+   BSON_ASSERT (builder);
+   BSON_ASSERT (key);
+   BSON_ASSERT (value);
+
+   if (builder->finished) {
+      return false;
+   }
+
+   /* encode the element, then copy it without the enclosing document */
+   if (bson_append_value (&tmp, key, key_length, value) &&
+       (size_t)builder->length + tmp.len - 5 + builder->depth <=
+       (size_t)INT32_MAX) {
+      _bson_iovec_builder_copy (builder, bson_get_data (&tmp) + 4,
+                                tmp.len - 5);
+      ret = true;
+   }
+
+   bson_destroy (&tmp);
+
+   return ret;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_iovec_builder_concat --
+ *
+ *       Append the fields of @src. They are referenced, not copied, and
+ *       @src must not be modified or freed until @builder is destroyed.
+ *
+ * Returns:
+ *       true if successful; false if the builder is finished or the
+ *       document would exceed the maximum BSON size.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_iovec_builder_concat (bson_iovec_builder_t *builder, /* IN */
+                           const bson_t         *src)     /* IN */
+{
+   BSON_ASSERT (builder);
+   BSON_ASSERT (src);
+
+   if (builder->finished ||
+       (size_t)builder->length + src->len - 5 + builder->depth >
+       (size_t)INT32_MAX) {
+      return false;
+   }
+
+   if (src->len > 5) {
+      _bson_iovec_builder_borrow (builder, bson_get_data (src) + 4,
+                                  src->len - 5);
+   }
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_iovec_builder_begin_document --
+ *
+ *       Begin an embedded document. Fields appended until the matching
+ *       call to bson_iovec_builder_end_document() are written to it, and
+ *       its length prefix is filled in when it ends.
+ *
+ * Returns:
+ *       true if successful; false if the builder is finished or the
+ *       document would exceed the maximum BSON size.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_iovec_builder_begin_document (bson_iovec_builder_t *builder,    /* IN */
+                                   const char           *key,        /* IN */
+                                   int                   key_length) /* IN */
+{
+   BSON_ASSERT (builder);
+   BSON_ASSERT (key);
+
+   if (!_bson_iovec_builder_header (builder, BSON_TYPE_DOCUMENT, key,
+                                    key_length, 5)) {
+      return false;
+   }
+
+   _bson_iovec_builder_begin (builder);
+
+   return true;
+}
+
+
+bool
+bson_iovec_builder_end_document (bson_iovec_builder_t *builder) /* IN */
+{
+   BSON_ASSERT (builder);
+
+   /* the top-level document is ended by bson_iovec_builder_get_iovecs() */
+   if (builder->finished || builder->depth < 2) {
+      return false;
+   }
+
+   _bson_iovec_builder_end (builder);
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_iovec_builder_begin_array --
+ *
+ *       Begin an embedded array. As with bson_append_array_begin(), the
+ *       caller supplies the keys "0", "1", ... of its elements.
+ *
+ * Returns:
+ *       true if successful; false if the builder is finished or the
+ *       document would exceed the maximum BSON size.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_iovec_builder_begin_array (bson_iovec_builder_t *builder,    /* IN */
+                                const char           *key,        /* IN */
+                                int                   key_length) /* IN */
+{
+   BSON_ASSERT (builder);
+   BSON_ASSERT (key);
+
+   if (!_bson_iovec_builder_header (builder, BSON_TYPE_ARRAY, key,
+                                    key_length, 5)) {
+      return false;
+   }
+
+   _bson_iovec_builder_begin (builder);
+
+   return true;
+}
+
+
+bool
+bson_iovec_builder_end_array (bson_iovec_builder_t *builder) /* IN */
+{
+   return bson_iovec_builder_end_document (builder);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_iovec_builder_get_iovecs --
+ *
+ *       Finish the document and return its segments. No more fields may be
+ *       appended afterwards.
+ *
+ * Parameters:
+ *       @builder: A bson_iovec_builder_t.
+ *       @n_iovecs: A location for the number of segments.
+ *       @length: An optional location for the length of the document.
+ *
+ * Returns:
+ *       An array of segments owned by @builder, or NULL if an embedded
+ *       document or array has not been ended.
+ *
+ * Side effects:
+ *       @builder is finished.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+const bson_iovec_t *
+bson_iovec_builder_get_iovecs (bson_iovec_builder_t *builder,  /* IN */
+                               size_t               *n_iovecs, /* OUT */
+                               uint32_t             *length)   /* OUT */
+{
+   bson_iovec_segment_t *segment;
+   size_t i;
+
+   BSON_ASSERT (builder);
+   BSON_ASSERT (n_iovecs);
+
+   if (!builder->finished) {
+      if (builder->depth != 1) {
+         *n_iovecs = 0;
+         return NULL;
+      }
+
+      _bson_iovec_builder_end (builder);
+      builder->finished = true;
+
+      builder->iovecs = bson_malloc (builder->n_segments *
+                                     sizeof *builder->iovecs);
+
+      for (i = 0; i < builder->n_segments; i++) {
+         segment = &builder->segments[i];
+         builder->iovecs[i].iov_base = (void *)(segment->borrowed ?
+                                                segment->borrowed :
+                                                builder->owned + segment->off);
+         builder->iovecs[i].iov_len = segment->len;
+      }
+   }
+
+   *n_iovecs = builder->n_segments;
+
+   if (length) {
+      *length = builder->length;
+   }
+
+   return builder->iovecs;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_iovec_builder_flatten --
+ *
+ *       Finish the document and copy it into @dst, which is initialized.
+ *
+ * Returns:
+ *       true if successful; false if an embedded document or array has not
+ *       been ended, in which case @dst is initialized as an empty document.
+ *
+ * Side effects:
+ *       @builder is finished. @dst must be freed with bson_destroy().
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_iovec_builder_flatten (bson_iovec_builder_t *builder, /* IN */
+                            bson_t               *dst)     /* OUT */
+{
+   const bson_iovec_t *iov;
+   uint8_t *out;
+   uint32_t length;
+   size_t n_iovecs;
+   size_t i;
+
+   BSON_ASSERT (builder);
+   BSON_ASSERT (dst);
+
+   bson_init (dst);
+
+   if (!(iov = bson_iovec_builder_get_iovecs (builder, &n_iovecs, &length)) ||
+       !(out = bson_reserve_buffer (dst, length))) {
+      return false;
+   }
+
+   for (i = 0; i < n_iovecs; i++) {
+      memcpy (out, iov[i].iov_base, iov[i].iov_len);
+      out += iov[i].iov_len;
+   }
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_iovec_builder_write_fd --
+ *
+ *       Finish the document and write it to @fd, using writev() where it
+ *       is available. Partial writes are retried until the whole document
+ *       is written.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set.
+ *
+ * Side effects:
+ *       @builder is finished.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_iovec_builder_write_fd (bson_iovec_builder_t *builder, /* IN */
+                             int                   fd,      /* IN */
+                             bson_error_t         *error)   /* OUT */
+{
+   const bson_iovec_t *iovecs;
+   bson_iovec_t iov[IOV_MAX];
+   size_t n_iovecs;
+   size_t i = 0;
+   size_t skip = 0;
+   size_t n;
+   ssize_t ret;
+
+   BSON_ASSERT (builder);
+
+   if (!(iovecs = bson_iovec_builder_get_iovecs (builder, &n_iovecs, NULL))) {
+      bson_set_error (error,
+                      BSON_ERROR_IOVEC,
+                      BSON_ERROR_IOVEC_WRITE,
+                      "Document has unterminated embedded documents");
+      return false;
+   }
+
+   /* @skip is the number of bytes of iovecs[i] already written */
+   while (i < n_iovecs) {
+      for (n = 0; n < IOV_MAX && i + n < n_iovecs; n++) {
+         iov[n] = iovecs[i + n];
+      }
+
+      iov[0].iov_base = (char *)iov[0].iov_base + skip;
+      iov[0].iov_len -= skip;
+
+#ifdef BSON_OS_WIN32
+      ret = _write (fd, iov[0].iov_base, (unsigned int)iov[0].iov_len);
+#else
+      ret = writev (fd, iov, (int)n);
+#endif
+
+      if (ret < 0) {
+         if (errno == EINTR) {
+            continue;
+         }
+
+         bson_set_error (error,
+                         BSON_ERROR_IOVEC,
+                         BSON_ERROR_IOVEC_WRITE,
+                         "Failed to write document: %s", strerror (errno));
+         return false;
+      }
+
+      ret += skip;
+
+      while (i < n_iovecs && (size_t)ret >= iovecs[i].iov_len) {
+         ret -= iovecs[i].iov_len;
+         i++;
+      }
+
+      skip = (size_t)ret;
+   }
+
+   return true;
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef BSON_IOVEC_H
+#define BSON_IOVEC_H
+
+
+#if !defined (BSON_INSIDE) && !defined (BSON_COMPILATION)
+# error "Only <bson.h> can be included directly."
+#endif
+
+
+#include "bson-compat.h"
+#include "bson-types.h"
+
+#ifndef BSON_OS_WIN32
+# include <sys/uio.h>
+#endif
+
+
+BSON_BEGIN_DECLS
+
+
+#define BSON_ERROR_IOVEC_WRITE 1
+
+
+/**
+ * bson_iovec_t:
+ *
+ * A scatter-gather segment. This is struct iovec on POSIX systems and is
+ * layout-compatible with WSABUF on Windows.
+ */
+#ifdef BSON_OS_WIN32
+typedef struct
+{
+   u_long  iov_len;
+   char   *iov_base;
+} bson_iovec_t;
+#else
+typedef struct iovec bson_iovec_t;
+#endif
+
+
+/**
+ * bson_iovec_builder_t:
+ *
+ * Builds a BSON document as a list of segments instead of a contiguous
+ * buffer. Type bytes, keys, and length prefixes are written to small
+ * segments owned by the builder, while documents and values appended from
+ * existing buffers are referenced in place rather than copied.
+ *
+ * Borrowed buffers must not be modified or freed until the builder is
+ * destroyed.
+ */
+typedef struct _bson_iovec_builder_t bson_iovec_builder_t;
+
+
+bson_iovec_builder_t *bson_iovec_builder_new             (void);
+void                  bson_iovec_builder_destroy         (bson_iovec_builder_t *builder);
+bool                  bson_iovec_builder_append_document (bson_iovec_builder_t *builder,
+                                                          const char           *key,
+                                                          int                   key_length,
+                                                          const bson_t         *value);
+bool                  bson_iovec_builder_append_array    (bson_iovec_builder_t *builder,
+                                                          const char           *key,
+                                                          int                   key_length,
+                                                          const bson_t         *array);
+bool                  bson_iovec_builder_append_iter     (bson_iovec_builder_t *builder,
+                                                          const char           *key,
+                                                          int                   key_length,
+                                                          const bson_iter_t    *iter);
+bool                  bson_iovec_builder_append_value    (bson_iovec_builder_t *builder,
+                                                          const char           *key,
+                                                          int                   key_length,
+                                                          const bson_value_t   *value);
+bool                  bson_iovec_builder_concat          (bson_iovec_builder_t *builder,
+                                                          const bson_t         *src);
+bool                  bson_iovec_builder_begin_document  (bson_iovec_builder_t *builder,
+                                                          const char           *key,
+                                                          int                   key_length);
+bool                  bson_iovec_builder_end_document    (bson_iovec_builder_t *builder);
+bool                  bson_iovec_builder_begin_array     (bson_iovec_builder_t *builder,
+                                                          const char           *key,
+                                                          int                   key_length);
+bool                  bson_iovec_builder_end_array       (bson_iovec_builder_t *builder);
+const bson_iovec_t   *bson_iovec_builder_get_iovecs      (bson_iovec_builder_t *builder,
+                                                          size_t               *n_iovecs,
+                                                          uint32_t             *length);
+bool                  bson_iovec_builder_flatten         (bson_iovec_builder_t *builder,
+                                                          bson_t               *dst);
+bool                  bson_iovec_builder_write_fd        (bson_iovec_builder_t *builder,
+                                                          int                   fd,
+                                                          bson_error_t         *error);
+
+
+BSON_END_DECLS
+
+
+#endif /* BSON_IOVEC_H */
@@ -17,6 +17,7 @@
 
 #include "bson-iter.h"
 #include "bson-config.h"
+#include "bson-private.h"
 #ifdef BSON_EXPERIMENTAL_FEATURES
 #include "bson-decimal128.h"
 #endif
@@ -123,6 +124,63 @@ bson_iter_recurse (const bson_iter_t *iter,  /* IN */
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_iter_init_from_data --
+ *
+ *       Initializes @iter to iterate the BSON document of @length bytes at
+ *       @data, without requiring a bson_t. The length prefix of @data must
+ *       match @length.
+ *
+ * Returns:
+ *       true if @iter was initialized; false if @data is not a BSON
+ *       document of @length bytes.
+ *
+ * Side effects:
+ *       @iter is initialized.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_iter_init_from_data (bson_iter_t   *iter,   /* OUT */
+                          const uint8_t *data,   /* IN */
+                          size_t         length) /* IN */
+{
+   uint32_t len_le;
+
+   BSON_ASSERT (iter);
+   BSON_ASSERT (data);
+
+   if (BSON_UNLIKELY ((length < 5) || (length > INT_MAX))) {
+      memset (iter, 0, sizeof *iter);
+      return false;
+   }
+
+   memcpy (&len_le, data, sizeof (len_le));
+
+   if (BSON_UNLIKELY ((size_t)BSON_UINT32_FROM_LE (len_le) != length)) {
+      memset (iter, 0, sizeof *iter);
+      return false;
+   }
+
+   iter->raw = data;
+   iter->len = (uint32_t)length;
+   iter->off = 0;
+   iter->type = 0;
+   iter->key = 0;
+   iter->d1 = 0;
+   iter->d2 = 0;
+   iter->d3 = 0;
+   iter->d4 = 0;
+   iter->next_off = 4;
+   iter->err_off = 0;
+
+   return true;
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -373,6 +431,41 @@ bson_iter_key (const bson_iter_t *iter) /* IN */
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_iter_key_len --
+ *
+ *       Retrieves the length of the key of the current field, without
+ *       scanning it.
+ *
+ * Returns:
+ *       The length of the key in bytes, not including the trailing NUL.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+uint32_t
+_bson_iter_key_len (const bson_iter_t *iter) /* IN */
+{
+   BSON_ASSERT (iter);
+
+   /* types without a value, such as null, have no value offset */
+   switch (ITER_TYPE (iter)) {
+   case BSON_TYPE_MAXKEY:
+   case BSON_TYPE_MINKEY:
+   case BSON_TYPE_NULL:
+   case BSON_TYPE_UNDEFINED:
+      return iter->next_off - iter->key - 1;
+   default:
+      return iter->d1 - iter->key - 1;
+   }
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -1762,6 +1855,9 @@ bson_iter_array (const bson_iter_t  *iter,      /* IN */
  *       @iter will no longer be valid after this function has executed and
  *       will need to be reinitialized if intending to reuse.
  *
+ *       _bson_iter_visit_all_inline() in bson-visit.h is a copy of this
+ *       function for BSON_VISIT_SPECIALIZE(); keep them in step.
+ *
  * Returns:
  *       true if successfully visited all fields or callback requested
  *       early termination, otherwise false.
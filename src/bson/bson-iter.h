@@ -208,6 +208,12 @@ bson_iter_init (bson_iter_t  *iter,
                 const bson_t *bson);
 
 
+bool
+bson_iter_init_from_data (bson_iter_t   *iter,
+                          const uint8_t *data,
+                          size_t         length);
+
+
 bool
 bson_iter_init_find (bson_iter_t  *iter,
                      const bson_t *bson,
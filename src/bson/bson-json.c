@@ -22,8 +22,11 @@
 
 #include "bson.h"
 #include "bson-config.h"
+#include "bson-batch-private.h"
 #include "bson-json.h"
 #include "bson-iso8601-private.h"
+#include "bson-stats-private.h"
+#include "bson-trace-private.h"
 #include "b64_pton.h"
 
 #include <yajl/yajl_parser.h>
@@ -168,6 +171,10 @@ struct _bson_json_reader_t
    bson_json_reader_bson_t      bson;
    yajl_handle                  yh;
    bson_error_t                *error;
+   bool                         nonblocking;
+   bool                         would_block;
+   bool                         in_progress; /* a document is half read */
+   int64_t                      probe_start; /* for the json__end probe */
 };
 
 
@@ -175,6 +182,7 @@ typedef struct
 {
    int fd;
    bool do_close;
+   bool nonblocking;
 } bson_json_reader_handle_fd_t;
 
 
@@ -1077,6 +1085,11 @@ _bson_json_read_parse_error (bson_json_reader_t *reader, /* IN */
  *       is so that you can chain together bson_json_reader_t with
  *       other components like bson_writer_t.
  *
+ *       If the reader is non-blocking and its callback has no data yet,
+ *       0 is returned and bson_json_reader_would_block() returns true.
+ *       If part of a document had been read, the next call resumes it,
+ *       and must be passed the same @bson.
+ *
  * Returns:
  *       1 if successful and data was read.
  *       0 if successful and no data was read.
@@ -1106,11 +1119,22 @@ bson_json_reader_read (bson_json_reader_t *reader, /* IN */
    p = &reader->producer;
    yh = reader->yh;
 
-   reader->bson.bson = bson;
-   reader->bson.n = -1;
-   reader->bson.read_state = BSON_JSON_REGULAR;
+   if (reader->in_progress) {
+      /* the parser already has every byte read so far */
+      BSON_ASSERT (reader->bson.bson == bson);
+      read_something = true;
+   } else {
+      reader->bson.bson = bson;
+      reader->bson.n = -1;
+      reader->bson.read_state = BSON_JSON_REGULAR;
+      reader->producer.all_whitespace = true;
+      reader->probe_start = BSON_PROBE_CLOCK (json__end);
+      BSON_PROBE0 (json__start);
+   }
+
    reader->error = error;
-   reader->producer.all_whitespace = true;
+   reader->in_progress = false;
+   reader->would_block = false;
 
    for (;; ) {
       if (!read_something &&
@@ -1128,6 +1152,12 @@ bson_json_reader_read (bson_json_reader_t *reader, /* IN */
       }
 
       if (r < 0) {
+         if (reader->nonblocking && _bson_would_block ()) {
+            reader->would_block = true;
+            reader->in_progress = read_something;
+            goto cleanup;
+         }
+
          if (error) {
             bson_set_error (error,
                             BSON_ERROR_JSON,
@@ -1166,6 +1196,11 @@ bson_json_reader_read (bson_json_reader_t *reader, /* IN */
 
 cleanup:
 
+   if (!reader->in_progress) {
+      BSON_PROBE3 (json__end, ret, bson->len,
+                   BSON_PROBE_ELAPSED (reader->probe_start));
+   }
+
    return ret;
 }
 
@@ -1230,6 +1265,8 @@ typedef struct
    const uint8_t *data;
    size_t         len;
    size_t         bytes_parsed;
+   bool           nonblocking;
+   bool           eof;
 } bson_json_data_reader_t;
 
 
@@ -1241,6 +1278,11 @@ _bson_json_data_reader_cb (void    *_ctx,
    size_t bytes;
    bson_json_data_reader_t *ctx = (bson_json_data_reader_t *)_ctx;
 
+   if (ctx->nonblocking && !ctx->eof && ctx->bytes_parsed == ctx->len) {
+      errno = EAGAIN;
+      return -1;
+   }
+
    if (!ctx->data) {
       return -1;
    }
@@ -1277,6 +1319,7 @@ bson_json_data_reader_ingest (bson_json_reader_t *reader, /* IN */
    ctx->data = data;
    ctx->len = len;
    ctx->bytes_parsed = 0;
+   ctx->eof = !len;
 }
 
 
@@ -1317,11 +1360,14 @@ bson_init_from_json (bson_t       *bson,  /* OUT */
                      bson_error_t *error) /* OUT */
 {
    bson_json_reader_t *reader;
+   int64_t stats_start;
    int r;
 
    BSON_ASSERT (bson);
    BSON_ASSERT (data);
 
+   stats_start = _bson_stats_start ();
+
    if (len < 0) {
       len = strlen (data);
    }
@@ -1333,6 +1379,8 @@ bson_init_from_json (bson_t       *bson,  /* OUT */
    r = bson_json_reader_read (reader, bson, error);
    bson_json_reader_destroy (reader);
 
+   _bson_stats_end (BSON_STATS_INIT_FROM_JSON, (size_t)len, stats_start);
+
    if (r != 1) {
       bson_destroy (bson);
       return false;
@@ -1375,7 +1423,7 @@ _bson_json_reader_handle_fd_read (void    *handle, /* IN */
 #else
       ret = read (fd->fd, buf, len);
 #endif
-      if ((ret == -1) && (errno == EAGAIN)) {
+      if ((ret == -1) && (errno == EAGAIN) && !fd->nonblocking) {
          goto again;
       }
    }
@@ -1431,3 +1479,73 @@ bson_json_reader_new_from_file (const char   *path,  /* IN */
 
    return bson_json_reader_new_from_fd (fd, true);
 }
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_json_reader_set_nonblocking --
+ *
+ *       Set whether a callback returning -1 with errno set to EAGAIN or
+ *       EWOULDBLOCK means that no data is available yet, rather than
+ *       failure. See bson_json_reader_read().
+ *
+ *       A non-blocking reader created with bson_json_reader_new_from_fd()
+ *       returns at once when its descriptor would block, and one created
+ *       with bson_json_data_reader_new() waits for more data once it has
+ *       parsed what was ingested, until 0 bytes are ingested to mark the
+ *       end of the stream.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+bson_json_reader_set_nonblocking (bson_json_reader_t *reader,      /* IN */
+                                  bool                nonblocking) /* IN */
+{
+   bson_json_reader_producer_t *p;
+
+   BSON_ASSERT (reader);
+
+   p = &reader->producer;
+   reader->nonblocking = nonblocking;
+
+   if (p->cb == _bson_json_reader_handle_fd_read) {
+      ((bson_json_reader_handle_fd_t *)p->data)->nonblocking = nonblocking;
+   } else if (p->cb == _bson_json_data_reader_cb) {
+      ((bson_json_data_reader_t *)p->data)->nonblocking = nonblocking;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_json_reader_would_block --
+ *
+ *       Check whether the last call to bson_json_reader_read() returned 0
+ *       because the rest of the input has not arrived yet, rather than at
+ *       the end of the stream.
+ *
+ * Returns:
+ *       true if a non-blocking reader needs more data.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_json_reader_would_block (const bson_json_reader_t *reader) /* IN */
+{
+   BSON_ASSERT (reader);
+
+   return reader->would_block;
+}
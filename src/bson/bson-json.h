@@ -57,6 +57,9 @@ bson_json_reader_t *bson_json_reader_new_from_fd   (int                   fd,
 bson_json_reader_t *bson_json_reader_new_from_file (const char           *filename,
                                                     bson_error_t         *error);
 void                bson_json_reader_destroy       (bson_json_reader_t   *reader);
+void                bson_json_reader_set_nonblocking (bson_json_reader_t *reader,
+                                                      bool                nonblocking);
+bool                bson_json_reader_would_block   (const bson_json_reader_t *reader);
 int                 bson_json_reader_read          (bson_json_reader_t   *reader,
                                                     bson_t               *bson,
                                                     bson_error_t         *error);
@@ -0,0 +1,825 @@
+/*
+ * Copyright 2016 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "bson.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include "bson-batch-private.h"
+#include "bson-jsonl.h"
+#include "bson-memory.h"
+#include "bson-private.h"
+
+
+/*
+ * Conversions between BSON streams and JSON lines, one document per line.
+ *
+ * The calling thread frames the input into chunks of about
+ * BSON_JSONL_CHUNK_SIZE bytes of whole documents, and collects chunks into
+ * batches of one chunk per thread. While a thread per chunk converts one
+ * batch, the caller frames the next; the caller then waits for the first
+ * batch and writes its chunks in order, each with a single write, so the
+ * output is in input order whatever the number of threads.
+ *
+ * bson_jsonl_ingest() runs the same pipeline the other way: chunks are
+ * whole lines of JSON cut at the last newline, threads parse them into
+ * BSON, and the caller delivers the documents in order. Unordered, each
+ * thread delivers its documents as it parses them.
+ */
+
+
+typedef struct _bson_jsonl_ingest_t bson_jsonl_ingest_t;
+
+
+typedef struct
+{
+   uint64_t line;
+   size_t   offset;   /* of the document in bson_jsonl_chunk_t.docs */
+   ssize_t  error;    /* or the index of its error, if not -1 */
+} bson_jsonl_line_t;
+
+
+typedef struct
+{
+   uint8_t             *data;     /* the BSON documents, or JSON lines */
+   size_t               len;
+   size_t               alloc;
+   uint64_t             first;    /* the index of the first document, or
+                                   * the number of the first line */
+   bson_string_t       *json;     /* the JSON lines */
+   uint64_t             failed;   /* the document that could not be
+                                   * converted */
+   bool                 ok;
+
+   /* bson_jsonl_ingest() only */
+   bson_jsonl_ingest_t *ingest;
+   uint8_t             *docs;     /* the parsed documents */
+   size_t               docs_alloc;
+   bson_jsonl_line_t   *lines;
+   size_t               n_lines;
+   size_t               lines_alloc;
+   bson_error_t        *errors;
+   size_t               n_errors;
+   size_t               errors_alloc;
+} bson_jsonl_chunk_t;
+
+
+typedef struct
+{
+   bson_jsonl_chunk_t  chunks[BSON_JSONL_MAX_THREADS];
+   uint32_t            n_chunks;
+   bson_batch_t        threads;
+} bson_jsonl_batch_t;
+
+
+BSON_STATIC_ASSERT (BSON_JSONL_MAX_THREADS <= BSON_BATCH_MAX_THREADS);
+
+
+typedef struct
+{
+   int                 fd;
+   uint32_t            n_threads;
+   uint32_t            batch_size;
+   bson_jsonl_batch_t  batches[2];
+   int                 filling;
+   uint64_t            n_docs;
+   bool                failed;
+   bson_error_t        error;
+} bson_jsonl_export_t;
+
+
+struct _bson_jsonl_ingest_t
+{
+   int                   fd;
+   uint32_t              n_threads;
+   uint32_t              batch_size;
+   bson_jsonl_batch_t    batches[2];
+   int                   filling;
+   uint64_t              n_lines;
+   bson_jsonl_flags_t    flags;
+   bson_jsonl_ingest_cb  cb;
+   void                 *data;
+   volatile int32_t      stopped;  /* set once a callback returns false */
+   bool                  failed;
+   bson_error_t          error;
+};
+
+
+static void
+_bson_jsonl_batch_destroy (bson_jsonl_batch_t *batch) /* IN */
+{
+   uint32_t i;
+
+   _bson_batch_join (&batch->threads);
+
+   for (i = 0; i < BSON_JSONL_MAX_THREADS; i++) {
+      bson_free (batch->chunks[i].data);
+
+      if (batch->chunks[i].json) {
+         bson_string_free (batch->chunks[i].json, true);
+      }
+
+      bson_free (batch->chunks[i].docs);
+      bson_free (batch->chunks[i].lines);
+      bson_free (batch->chunks[i].errors);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_jsonl_render --
+ *
+ *       Convert the documents in @chunk->data to JSON lines in
+ *       @chunk->json, stopping at the first that cannot be converted.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_bson_jsonl_render (bson_jsonl_chunk_t *chunk) /* IN */
+{
+   bson_string_t *json;
+   uint64_t index = chunk->first;
+   uint32_t len;
+   size_t offset = 0;
+   bson_t b;
+
+   if (!chunk->json) {
+      chunk->json = bson_string_new (NULL);
+   }
+
+   json = chunk->json;
+   json->len = 0;
+   json->str [0] = '\0';
+
+   /* as in bson_as_json(), expect about twice the size of the BSON */
+   if (chunk->len < (1U << 30) && json->alloc < 2 * chunk->len) {
+      json->alloc = (uint32_t)bson_next_power_of_two (2 * chunk->len);
+      json->str = bson_realloc (json->str, json->alloc);
+   }
+
+   chunk->ok = true;
+
+   while (offset < chunk->len) {
+      memcpy (&len, chunk->data + offset, sizeof len);
+      len = BSON_UINT32_FROM_LE (len);
+
+      /* the reader has already checked the framing */
+      BSON_ASSERT (bson_init_static (&b, chunk->data + offset, len));
+
+      if (!_bson_as_json_append (&b, true, json)) {
+         chunk->ok = false;
+         chunk->failed = index;
+         return;
+      }
+
+      bson_string_append_c (json, '\n');
+      offset += len;
+      index++;
+   }
+}
+
+
+static void *
+_bson_jsonl_render_main (void *data) /* IN */
+{
+   _bson_jsonl_render ((bson_jsonl_chunk_t *)data);
+
+   return NULL;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_jsonl_export_drain --
+ *
+ *       Wait for the batch that is not being filled, and write its chunks
+ *       up to the first document that could not be converted.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_bson_jsonl_export_drain (bson_jsonl_export_t *jsonl) /* IN */
+{
+   bson_jsonl_batch_t *batch = &jsonl->batches[!jsonl->filling];
+   bson_jsonl_chunk_t *chunk;
+   uint32_t i;
+
+   _bson_batch_join (&batch->threads);
+
+   for (i = 0; i < batch->n_chunks && !jsonl->failed; i++) {
+      chunk = &batch->chunks[i];
+
+      if (!_bson_fd_write (jsonl->fd, chunk->json->str,
+                           chunk->json->len)) {
+         _bson_batch_set_io_error (&jsonl->error, BSON_ERROR_JSONL,
+                                   BSON_ERROR_JSONL_IO, "write",
+                                   "JSON lines", errno);
+         jsonl->failed = true;
+      } else if (!chunk->ok) {
+         bson_set_error (&jsonl->error,
+                         BSON_ERROR_JSONL,
+                         BSON_ERROR_JSONL_INVALID,
+                         "Document %" PRIu64 " cannot be converted to JSON",
+                         chunk->failed);
+         jsonl->failed = true;
+      }
+   }
+
+   for (i = 0; i < batch->n_chunks; i++) {
+      batch->chunks[i].len = 0;
+   }
+
+   batch->n_chunks = 0;
+
+   return !jsonl->failed;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_jsonl_export_flush --
+ *
+ *       End the chunk being filled. Once a batch is full, or if @all,
+ *       write the batch before it and start converting this one.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_bson_jsonl_export_flush (bson_jsonl_export_t *jsonl, /* IN */
+                          bool                 all)    /* IN */
+{
+   bson_jsonl_batch_t *batch = &jsonl->batches[jsonl->filling];
+
+   if (batch->chunks[batch->n_chunks].len) {
+      batch->n_chunks++;
+   }
+
+   if (batch->n_chunks < jsonl->batch_size && !all) {
+      return true;
+   }
+
+   if (!_bson_jsonl_export_drain (jsonl)) {
+      return false;
+   }
+
+   _bson_batch_start (&batch->threads, batch->chunks, sizeof batch->chunks[0],
+                      batch->n_chunks, jsonl->n_threads,
+                      _bson_jsonl_render_main);
+   jsonl->filling = !jsonl->filling;
+
+   return !all || _bson_jsonl_export_drain (jsonl);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_to_jsonl --
+ *
+ *       Read every document from @reader and write it to @fd as JSON
+ *       lines, in the format of bson_as_json() with each document
+ *       followed by a newline. Up to @n_threads threads besides the
+ *       caller's convert documents, and the output is in input order
+ *       whatever their number. With @n_threads 0 the caller converts
+ *       every document itself.
+ *
+ * Returns:
+ *       true if every document was read, converted and written.
+ *       Otherwise false and @error is set; the documents before the one
+ *       that failed have been written. A non-blocking @reader that runs
+ *       out of data fails with BSON_ERROR_JSONL_WOULD_BLOCK, while a
+ *       non-blocking @fd is waited for.
+ *
+ * Side effects:
+ *       @reader is read to its end or to the document that failed.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_to_jsonl (bson_reader_t *reader,    /* IN */
+               int            fd,        /* IN */
+               uint32_t       n_threads, /* IN */
+               bson_error_t  *error)     /* OUT */
+{
+   bson_jsonl_export_t *jsonl;
+   bson_jsonl_batch_t *batch;
+   bson_jsonl_chunk_t *chunk;
+   const bson_t *b;
+   bool eof = false;
+   bool ret;
+
+   BSON_ASSERT (reader);
+
+   jsonl = bson_malloc0 (sizeof *jsonl);
+   jsonl->fd = fd;
+   jsonl->n_threads = BSON_MIN (n_threads, BSON_JSONL_MAX_THREADS);
+   jsonl->batch_size = BSON_MAX (jsonl->n_threads, 1);
+
+   while ((b = bson_reader_read (reader, &eof))) {
+      batch = &jsonl->batches[jsonl->filling];
+      chunk = &batch->chunks[batch->n_chunks];
+
+      if (!chunk->len) {
+         chunk->first = jsonl->n_docs;
+      }
+
+      _bson_batch_reserve (&chunk->data, &chunk->alloc, chunk->len + b->len);
+      memcpy (chunk->data + chunk->len, bson_get_data (b), b->len);
+      chunk->len += b->len;
+      jsonl->n_docs++;
+
+      if (chunk->len >= BSON_JSONL_CHUNK_SIZE &&
+          !_bson_jsonl_export_flush (jsonl, false)) {
+         break;
+      }
+   }
+
+   if (!jsonl->failed) {
+      _bson_jsonl_export_flush (jsonl, true);
+   }
+
+   if (!jsonl->failed && !eof && bson_reader_would_block (reader)) {
+      bson_set_error (&jsonl->error,
+                      BSON_ERROR_JSONL,
+                      BSON_ERROR_JSONL_WOULD_BLOCK,
+                      "The reader would block at document %" PRIu64,
+                      jsonl->n_docs);
+      jsonl->failed = true;
+   } else if (!jsonl->failed && !eof) {
+      bson_set_error (&jsonl->error,
+                      BSON_ERROR_JSONL,
+                      BSON_ERROR_JSONL_CORRUPT,
+                      "Corrupt BSON at document %" PRIu64,
+                      jsonl->n_docs);
+      jsonl->failed = true;
+   }
+
+   ret = !jsonl->failed;
+
+   if (!ret && error) {
+      memcpy (error, &jsonl->error, sizeof *error);
+   }
+
+   _bson_jsonl_batch_destroy (&jsonl->batches[0]);
+   _bson_jsonl_batch_destroy (&jsonl->batches[1]);
+   bson_free (jsonl);
+
+   return ret;
+}
+
+
+static bool
+_bson_jsonl_is_blank (const uint8_t *line, /* IN */
+                      const uint8_t *end)  /* IN */
+{
+   for (; line < end; line++) {
+      if (*line != ' ' && *line != '\t' && *line != '\r') {
+         return false;
+      }
+   }
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_jsonl_parse_line --
+ *
+ *       Parse the single JSON document on @line into @bson, with the
+ *       reader in @reader, which is created on first use. A reader that
+ *       failed cannot go on, so it is destroyed and the next line creates
+ *       another.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_bson_jsonl_parse_line (bson_json_reader_t **reader, /* INOUT */
+                        const uint8_t       *line,   /* IN */
+                        size_t               len,    /* IN */
+                        bson_t              *bson,   /* OUT */
+                        bson_error_t        *error)  /* OUT */
+{
+   bson_t extra;
+   int r;
+
+   if (!*reader) {
+      *reader = bson_json_data_reader_new (true, 0);
+   }
+
+   bson_json_data_reader_ingest (*reader, line, len);
+   r = bson_json_reader_read (*reader, bson, error);
+
+   if (r == 1) {
+      bson_init (&extra);
+      r = bson_json_reader_read (*reader, &extra, NULL);
+      bson_destroy (&extra);
+
+      if (r == 0) {
+         return true;
+      }
+
+      bson_set_error (error,
+                      BSON_ERROR_JSON,
+                      BSON_JSON_ERROR_READ_CORRUPT_JS,
+                      "More than one JSON document on the line");
+   } else if (r == 0) {
+      bson_set_error (error,
+                      BSON_ERROR_JSON,
+                      BSON_JSON_ERROR_READ_CORRUPT_JS,
+                      "Incomplete JSON document on the line");
+   }
+
+   bson_json_reader_destroy (*reader);
+   *reader = NULL;
+
+   return false;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_jsonl_parse --
+ *
+ *       Parse each line of @chunk->data that is not blank. Unordered, pass
+ *       each to the callback at once; otherwise append its document to
+ *       @chunk->docs or its error to @chunk->errors, for
+ *       _bson_jsonl_ingest_drain() to deliver.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_bson_jsonl_parse (bson_jsonl_chunk_t *chunk) /* IN */
+{
+   bson_jsonl_ingest_t *ingest = chunk->ingest;
+   bson_json_reader_t *reader = NULL;
+   bson_writer_t *writer = NULL;
+   bson_jsonl_line_t *entry;
+   const uint8_t *line = chunk->data;
+   const uint8_t *end = chunk->data + chunk->len;
+   const uint8_t *eol;
+   bson_error_t error;
+   uint64_t n = chunk->first;
+   bson_t doc;
+   bson_t *b;
+   bool ok;
+
+   chunk->n_lines = 0;
+   chunk->n_errors = 0;
+
+   if (ingest->flags & BSON_JSONL_UNORDERED) {
+      bson_init (&doc);
+   } else {
+      writer = bson_writer_new (&chunk->docs, &chunk->docs_alloc, 0,
+                                bson_realloc_ctx, NULL);
+   }
+
+   for (; line < end && !ingest->stopped; line = eol + 1, n++) {
+      eol = memchr (line, '\n', (size_t)(end - line));
+
+      if (!eol) {
+         eol = end;
+      }
+
+      if (_bson_jsonl_is_blank (line, eol)) {
+         continue;
+      }
+
+      if (!writer) {
+         bson_reinit (&doc);
+         ok = _bson_jsonl_parse_line (&reader, line, (size_t)(eol - line),
+                                      &doc, &error);
+
+         if (!ingest->cb (n, ok ? &doc : NULL, ok ? NULL : &error,
+                          ingest->data)) {
+            bson_atomic_int_add (&ingest->stopped, 1);
+         }
+
+         continue;
+      }
+
+      if (chunk->n_lines == chunk->lines_alloc) {
+         chunk->lines_alloc = BSON_MAX (16, 2 * chunk->lines_alloc);
+         chunk->lines = bson_realloc (
+            chunk->lines, chunk->lines_alloc * sizeof *chunk->lines);
+      }
+
+      entry = &chunk->lines[chunk->n_lines++];
+      entry->line = n;
+      entry->offset = bson_writer_get_length (writer);
+      entry->error = -1;
+
+      bson_writer_begin (writer, &b);
+
+      if (_bson_jsonl_parse_line (&reader, line, (size_t)(eol - line),
+                                  b, &error)) {
+         bson_writer_end (writer);
+         continue;
+      }
+
+      bson_writer_rollback (writer);
+
+      if (chunk->n_errors == chunk->errors_alloc) {
+         chunk->errors_alloc = BSON_MAX (4, 2 * chunk->errors_alloc);
+         chunk->errors = bson_realloc (
+            chunk->errors, chunk->errors_alloc * sizeof *chunk->errors);
+      }
+
+      memcpy (&chunk->errors[chunk->n_errors], &error, sizeof error);
+      entry->error = (ssize_t)chunk->n_errors++;
+   }
+
+   if (reader) {
+      bson_json_reader_destroy (reader);
+   }
+
+   if (writer) {
+      bson_writer_destroy (writer);
+   } else {
+      bson_destroy (&doc);
+   }
+}
+
+
+static void *
+_bson_jsonl_parse_main (void *data) /* IN */
+{
+   _bson_jsonl_parse ((bson_jsonl_chunk_t *)data);
+
+   return NULL;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_jsonl_ingest_drain --
+ *
+ *       Wait for the batch that is not being filled, and deliver the lines
+ *       of its chunks in order, until the callback stops the ingest.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_bson_jsonl_ingest_drain (bson_jsonl_ingest_t *ingest) /* IN */
+{
+   bson_jsonl_batch_t *batch = &ingest->batches[!ingest->filling];
+   bson_jsonl_chunk_t *chunk;
+   bson_jsonl_line_t *entry;
+   const bson_error_t *error;
+   uint32_t len;
+   uint32_t i;
+   size_t j;
+   bson_t b;
+   bool ok;
+
+   _bson_batch_join (&batch->threads);
+
+   for (i = 0; i < batch->n_chunks; i++) {
+      chunk = &batch->chunks[i];
+
+      if (ingest->flags & BSON_JSONL_UNORDERED) {
+         chunk->len = 0;
+         continue;
+      }
+
+      for (j = 0; j < chunk->n_lines && !ingest->stopped; j++) {
+         entry = &chunk->lines[j];
+
+         if (entry->error == -1) {
+            memcpy (&len, chunk->docs + entry->offset, sizeof len);
+            BSON_ASSERT (bson_init_static (&b, chunk->docs + entry->offset,
+                                           BSON_UINT32_FROM_LE (len)));
+            ok = ingest->cb (entry->line, &b, NULL, ingest->data);
+         } else {
+            error = &chunk->errors[entry->error];
+            ok = ingest->cb (entry->line, NULL, error, ingest->data);
+         }
+
+         if (!ok) {
+            ingest->stopped = 1;
+         }
+      }
+
+      chunk->len = 0;
+   }
+
+   batch->n_chunks = 0;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_jsonl_ingest_flush --
+ *
+ *       End the chunk being filled. Once a batch is full, or if @all,
+ *       deliver the batch before it and start parsing this one.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_bson_jsonl_ingest_flush (bson_jsonl_ingest_t *ingest, /* IN */
+                          bool                 all)    /* IN */
+{
+   bson_jsonl_batch_t *batch = &ingest->batches[ingest->filling];
+
+   if (batch->chunks[batch->n_chunks].len) {
+      batch->n_chunks++;
+   }
+
+   if (batch->n_chunks < ingest->batch_size && !all) {
+      return;
+   }
+
+   _bson_jsonl_ingest_drain (ingest);
+   _bson_batch_start (&batch->threads, batch->chunks, sizeof batch->chunks[0],
+                      batch->n_chunks, ingest->n_threads,
+                      _bson_jsonl_parse_main);
+   ingest->filling = !ingest->filling;
+
+   if (all) {
+      _bson_jsonl_ingest_drain (ingest);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_jsonl_ingest --
+ *
+ *       Read JSON lines from @fd to its end, one JSON document per line,
+ *       and parse each line that is not blank into BSON. @cb receives the
+ *       number of each line, counted from 1, with its document or with
+ *       the error that kept it from parsing; the document is only valid
+ *       during the call. Up to @n_threads threads besides the caller's
+ *       parse lines; with @n_threads 0 the caller parses every line itself.
+ *
+ *       @cb is called from the calling thread with the lines in order,
+ *       unless @flags contains BSON_JSONL_UNORDERED: then the threads call
+ *       it concurrently as they parse, in no particular order.
+ *
+ *       Once @cb returns false no more lines are parsed, though when
+ *       unordered other threads may still deliver a few lines, those
+ *       they parse before they see that it did.
+ *
+ * Returns:
+ *       true if @fd was read to its end or @cb stopped the ingest.
+ *       Otherwise false and @error is set; the lines read before the
+ *       failure have been delivered.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_jsonl_ingest (int                   fd,        /* IN */
+                   uint32_t              n_threads, /* IN */
+                   bson_jsonl_flags_t    flags,     /* IN */
+                   bson_jsonl_ingest_cb  cb,        /* IN */
+                   void                 *data,      /* IN */
+                   bson_error_t         *error)     /* OUT */
+{
+   bson_jsonl_ingest_t *ingest;
+   bson_jsonl_batch_t *batch;
+   bson_jsonl_chunk_t *chunk;
+   bson_jsonl_chunk_t *next;
+   const uint8_t *nl;
+   size_t tail;
+   size_t end;
+   size_t i;
+   ssize_t r;
+   bool ret;
+   int j;
+
+   BSON_ASSERT (cb);
+
+   ingest = bson_malloc0 (sizeof *ingest);
+   ingest->fd = fd;
+   ingest->n_threads = BSON_MIN (n_threads, BSON_JSONL_MAX_THREADS);
+   ingest->batch_size = BSON_MAX (ingest->n_threads, 1);
+   ingest->flags = flags;
+   ingest->cb = cb;
+   ingest->data = data;
+
+   for (j = 0; j < 2; j++) {
+      for (i = 0; i < BSON_JSONL_MAX_THREADS; i++) {
+         ingest->batches[j].chunks[i].ingest = ingest;
+      }
+   }
+
+   while (!ingest->stopped) {
+      batch = &ingest->batches[ingest->filling];
+      chunk = &batch->chunks[batch->n_chunks];
+
+      if (!chunk->len) {
+         chunk->first = ingest->n_lines + 1;
+      }
+
+      _bson_batch_reserve (&chunk->data, &chunk->alloc,
+                           chunk->len + BSON_JSONL_CHUNK_SIZE);
+      r = _bson_fd_read (ingest->fd, chunk->data + chunk->len,
+                         BSON_JSONL_CHUNK_SIZE);
+
+      if (r < 0) {
+         _bson_batch_set_io_error (&ingest->error, BSON_ERROR_JSONL,
+                                   BSON_ERROR_JSONL_IO, "read",
+                                   "JSON lines", errno);
+         ingest->failed = true;
+      }
+
+      if (r <= 0) {
+         break;
+      }
+
+      chunk->len += (size_t)r;
+
+      if (chunk->len < BSON_JSONL_CHUNK_SIZE) {
+         continue;
+      }
+
+      /* cut the chunk after its last newline; a longer line grows it */
+      for (end = chunk->len; end > 0 && chunk->data[end - 1] != '\n'; end--) {
+      }
+
+      if (!end) {
+         continue;
+      }
+
+      for (nl = chunk->data;
+           (nl = memchr (nl, '\n', end - (size_t)(nl - chunk->data)));
+           nl++) {
+         ingest->n_lines++;
+      }
+
+      tail = chunk->len - end;
+      chunk->len = end;
+      _bson_jsonl_ingest_flush (ingest, false);
+
+      /* threads only read up to chunk->len, so the tail is still ours */
+      batch = &ingest->batches[ingest->filling];
+      next = &batch->chunks[batch->n_chunks];
+      next->first = ingest->n_lines + 1;
+
+      if (tail) {
+         _bson_batch_reserve (&next->data, &next->alloc, tail);
+         memcpy (next->data, chunk->data + end, tail);
+         next->len = tail;
+      }
+   }
+
+   if (ingest->failed) {
+      /* drop the partial line the read failed in */
+      batch = &ingest->batches[ingest->filling];
+      chunk = &batch->chunks[batch->n_chunks];
+
+      while (chunk->len > 0 && chunk->data[chunk->len - 1] != '\n') {
+         chunk->len--;
+      }
+   }
+
+   if (!ingest->stopped) {
+      _bson_jsonl_ingest_flush (ingest, true);
+   }
+
+   ret = !ingest->failed;
+
+   if (!ret && error) {
+      memcpy (error, &ingest->error, sizeof *error);
+   }
+
+   _bson_jsonl_batch_destroy (&ingest->batches[0]);
+   _bson_jsonl_batch_destroy (&ingest->batches[1]);
+   bson_free (ingest);
+
+   return ret;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright 2016 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef BSON_JSONL_H
+#define BSON_JSONL_H
+
+
+#if !defined (BSON_INSIDE) && !defined (BSON_COMPILATION)
+# error "Only <bson.h> can be included directly."
+#endif
+
+
+#include "bson-compat.h"
+#include "bson-reader.h"
+#include "bson-types.h"
+
+
+BSON_BEGIN_DECLS
+
+
+#define BSON_ERROR_JSONL_IO          1
+#define BSON_ERROR_JSONL_CORRUPT     2
+#define BSON_ERROR_JSONL_INVALID     3
+#define BSON_ERROR_JSONL_WOULD_BLOCK 4
+
+
+/*
+ * The input a thread converts at once, in bytes.
+ */
+#define BSON_JSONL_CHUNK_SIZE (1024 * 1024)
+
+
+/*
+ * The most threads a conversion starts at once.
+ */
+#define BSON_JSONL_MAX_THREADS 64
+
+
+typedef enum
+{
+   BSON_JSONL_NONE      = 0,
+   BSON_JSONL_UNORDERED = (1 << 0),
+} bson_jsonl_flags_t;
+
+
+/*
+ * Receives each line bson_jsonl_ingest() parses, numbered from 1: either
+ * its document or the error that kept it from parsing. Return false to
+ * stop the ingest.
+ */
+typedef bool (*bson_jsonl_ingest_cb) (uint64_t            line,
+                                      const bson_t       *doc,
+                                      const bson_error_t *error,
+                                      void               *data);
+
+
+bool bson_to_jsonl (bson_reader_t *reader,
+                    int            fd,
+                    uint32_t       n_threads,
+                    bson_error_t  *error);
+bool bson_jsonl_ingest (int                   fd,
+                        uint32_t              n_threads,
+                        bson_jsonl_flags_t    flags,
+                        bson_jsonl_ingest_cb  cb,
+                        void                 *data,
+                        bson_error_t         *error);
+
+
+BSON_END_DECLS
+
+
+#endif /* BSON_JSONL_H */
@@ -0,0 +1,1196 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "bson.h"
+
+#include <string.h>
+
+#include "bson-matcher.h"
+#include "bson-memory.h"
+
+
+/*
+ * A filter is compiled into two structures:
+ *
+ *  - A tree of predicate nodes. $and and $or nodes hold children, while
+ *    comparison nodes refer to a slot holding the value at their path.
+ *  - A trie of the paths the predicates need, split on '.'. Each node of
+ *    the trie that ends a path owns a slot.
+ *
+ * The predicate tree is evaluated with short-circuiting. Whenever a
+ * predicate needs a slot that has not been filled yet, the walk of the
+ * document, guided by the trie, resumes until the slot is filled or the
+ * walk completes. The walk leaves each level as soon as every key the
+ * trie needs there has been seen, so no field is visited twice.
+ */
+
+
+#define BSON_MATCHER_STACK_DEPTH 4
+#define BSON_MATCHER_STACK_SLOTS 8
+#define BSON_MATCHER_STACK_PATHS 32
+
+
+typedef enum
+{
+   BSON_MATCHER_OP_AND,
+   BSON_MATCHER_OP_OR,
+   BSON_MATCHER_OP_EQ,
+   BSON_MATCHER_OP_NE,
+   BSON_MATCHER_OP_GT,
+   BSON_MATCHER_OP_GTE,
+   BSON_MATCHER_OP_LT,
+   BSON_MATCHER_OP_LTE,
+   BSON_MATCHER_OP_IN,
+   BSON_MATCHER_OP_NIN,
+   BSON_MATCHER_OP_EXISTS,
+   BSON_MATCHER_OP_TYPE,
+} bson_matcher_op_t;
+
+
+/* matches any numeric type in $type */
+#define BSON_MATCHER_TYPE_NUMBER -1
+
+
+typedef struct _bson_matcher_node_t bson_matcher_node_t;
+typedef struct _bson_matcher_path_t bson_matcher_path_t;
+
+
+struct _bson_matcher_node_t
+{
+   bson_matcher_op_t    op;
+   uint32_t             slot;
+   bson_value_t         value;      /* $eq, $ne, $gt, $gte, $lt, $lte */
+   bson_value_t        *values;     /* $in, $nin */
+   uint32_t             n_values;
+   bool                 has_null;   /* $in, $nin contain null */
+   bool                 exists;     /* $exists */
+   int                  type;       /* $type */
+   bson_matcher_node_t *children;   /* $and, $or */
+   uint32_t             n_children;
+};
+
+
+struct _bson_matcher_path_t
+{
+   char                *key;
+   size_t               key_len;
+   int32_t              slot;
+   uint32_t             index;
+   bson_matcher_path_t *children;
+   uint32_t             n_children;
+};
+
+
+struct _bson_matcher_t
+{
+   bson_t              *filter;
+   bson_matcher_node_t  root;
+   bson_matcher_path_t  paths;
+   uint32_t             n_slots;
+   uint32_t             n_paths;
+   uint32_t             max_depth;
+};
+
+
+typedef struct
+{
+   bson_iter_t                iter;
+   const bson_matcher_path_t *path;
+   uint32_t                   pending;
+} bson_matcher_frame_t;
+
+
+typedef struct
+{
+   bson_matcher_frame_t *frames;
+   uint32_t              depth;
+   bson_value_t         *slots;
+   uint8_t              *visited;
+} bson_matcher_state_t;
+
+
+static const struct {
+   const char *name;
+   int         type;
+} gBsonMatcherTypes[] = {
+   { "double", BSON_TYPE_DOUBLE },
+   { "string", BSON_TYPE_UTF8 },
+   { "object", BSON_TYPE_DOCUMENT },
+   { "array", BSON_TYPE_ARRAY },
+   { "binData", BSON_TYPE_BINARY },
+   { "undefined", BSON_TYPE_UNDEFINED },
+   { "objectId", BSON_TYPE_OID },
+   { "bool", BSON_TYPE_BOOL },
+   { "date", BSON_TYPE_DATE_TIME },
+   { "null", BSON_TYPE_NULL },
+   { "regex", BSON_TYPE_REGEX },
+   { "dbPointer", BSON_TYPE_DBPOINTER },
+   { "javascript", BSON_TYPE_CODE },
+   { "symbol", BSON_TYPE_SYMBOL },
+   { "javascriptWithScope", BSON_TYPE_CODEWSCOPE },
+   { "int", BSON_TYPE_INT32 },
+   { "timestamp", BSON_TYPE_TIMESTAMP },
+   { "long", BSON_TYPE_INT64 },
+   { "decimal", BSON_TYPE_DECIMAL128 },
+   { "minKey", BSON_TYPE_MINKEY },
+   { "maxKey", BSON_TYPE_MAXKEY },
+   { "number", BSON_MATCHER_TYPE_NUMBER },
+};
+
+
+static bool
+_bson_matcher_compile_doc (bson_matcher_t      *matcher,
+                           bson_iter_t         *iter,
+                           bson_matcher_node_t *parent,
+                           bson_error_t        *error);
+
+
+static bson_matcher_node_t *
+_bson_matcher_node_append (bson_matcher_node_t *parent, /* IN */
+                           bson_matcher_op_t    op)     /* IN */
+{
+   bson_matcher_node_t *node;
+
+   parent->children = bson_realloc (
+      parent->children, (parent->n_children + 1) * sizeof *parent->children);
+   node = &parent->children[parent->n_children++];
+   memset (node, 0, sizeof *node);
+   node->op = op;
+
+   return node;
+}
+
+
+static void
+_bson_matcher_node_destroy (bson_matcher_node_t *node) /* IN */
+{
+   uint32_t i;
+
+   for (i = 0; i < node->n_children; i++) {
+      _bson_matcher_node_destroy (&node->children[i]);
+   }
+
+   bson_free (node->children);
+   bson_free (node->values);
+}
+
+
+static void
+_bson_matcher_path_destroy (bson_matcher_path_t *path) /* IN */
+{
+   uint32_t i;
+
+   for (i = 0; i < path->n_children; i++) {
+      _bson_matcher_path_destroy (&path->children[i]);
+   }
+
+   bson_free (path->children);
+   bson_free (path->key);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_matcher_add_path --
+ *
+ *       Add the dotted @path to the trie of paths in @matcher.
+ *
+ * Returns:
+ *       The slot that will hold the value found at @path. Predicates on
+ *       the same path share a slot.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static uint32_t
+_bson_matcher_add_path (bson_matcher_t *matcher, /* IN */
+                        const char     *path)    /* IN */
+{
+   bson_matcher_path_t *node = &matcher->paths;
+   bson_matcher_path_t *child;
+   const char *dot;
+   uint32_t depth = 0;
+   size_t len;
+   uint32_t i;
+
+   for (;;) {
+      dot = strchr (path, '.');
+      len = dot ? (size_t)(dot - path) : strlen (path);
+      child = NULL;
+
+      for (i = 0; i < node->n_children; i++) {
+         if (node->children[i].key_len == len &&
+             !memcmp (node->children[i].key, path, len)) {
+            child = &node->children[i];
+            break;
+         }
+      }
+
+      if (!child) {
+         node->children = bson_realloc (
+            node->children, (node->n_children + 1) * sizeof *node->children);
+         child = &node->children[node->n_children++];
+         memset (child, 0, sizeof *child);
+         child->key = bson_strndup (path, len);
+         child->key_len = len;
+         child->slot = -1;
+         child->index = matcher->n_paths++;
+      }
+
+      node = child;
+      depth++;
+
+      if (!dot) {
+         break;
+      }
+
+      path = dot + 1;
+   }
+
+   if (node->slot < 0) {
+      node->slot = (int32_t)matcher->n_slots++;
+   }
+
+   matcher->max_depth = BSON_MAX (matcher->max_depth, depth);
+
+   return (uint32_t)node->slot;
+}
+
+
+static bool
+_bson_matcher_compile_type (bson_iter_t         *iter,  /* IN */
+                            bson_matcher_node_t *node,  /* IN */
+                            bson_error_t        *error) /* OUT */
+{
+   const char *name;
+   size_t i;
+
+   if (BSON_ITER_HOLDS_UTF8 (iter)) {
+      name = bson_iter_utf8 (iter, NULL);
+
+      for (i = 0; i < sizeof gBsonMatcherTypes / sizeof gBsonMatcherTypes[0];
+           i++) {
+         if (!strcmp (name, gBsonMatcherTypes[i].name)) {
+            node->type = gBsonMatcherTypes[i].type;
+            return true;
+         }
+      }
+
+      bson_set_error (error,
+                      BSON_ERROR_MATCHER,
+                      BSON_ERROR_MATCHER_INVALID,
+                      "Unknown $type \"%s\"", name);
+      return false;
+   }
+
+   if (BSON_ITER_HOLDS_INT32 (iter) ||
+       BSON_ITER_HOLDS_INT64 (iter) ||
+       BSON_ITER_HOLDS_DOUBLE (iter)) {
+      node->type = (int)bson_iter_as_int64 (iter);
+      return true;
+   }
+
+   bson_set_error (error,
+                   BSON_ERROR_MATCHER,
+                   BSON_ERROR_MATCHER_INVALID,
+                   "$type requires a string or number");
+   return false;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_matcher_iter_value --
+ *
+ *       Box the current value of @iter into @value. Without
+ *       BSON_EXPERIMENTAL_FEATURES, bson_iter_value() cannot box a
+ *       decimal128; @value then only holds its type, which satisfies no
+ *       comparison but can still be tested with $exists and $type.
+ *
+ * Returns:
+ *       true if the value was boxed.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_bson_matcher_iter_value (bson_iter_t  *iter,  /* IN */
+                          bson_value_t *value) /* OUT */
+{
+   const bson_value_t *v;
+
+   if ((v = bson_iter_value (iter))) {
+      *value = *v;
+      return true;
+   }
+
+   memset (value, 0, sizeof *value);
+   value->value_type = bson_iter_type (iter);
+
+   return false;
+}
+
+
+static bool
+_bson_matcher_operand (bson_iter_t  *iter,  /* IN */
+                       bson_value_t *value, /* OUT */
+                       bson_error_t *error) /* OUT */
+{
+   if (!_bson_matcher_iter_value (iter, value)) {
+      bson_set_error (error,
+                      BSON_ERROR_MATCHER,
+                      BSON_ERROR_MATCHER_INVALID,
+                      "Unsupported type 0x%02x for \"%s\"",
+                      (int)bson_iter_type (iter), bson_iter_key (iter));
+      return false;
+   }
+
+   return true;
+}
+
+
+static bool
+_bson_matcher_compile_in (bson_iter_t         *iter,  /* IN */
+                          bson_matcher_node_t *node,  /* IN */
+                          bson_error_t        *error) /* OUT */
+{
+   bson_iter_t child;
+
+   if (!BSON_ITER_HOLDS_ARRAY (iter) || !bson_iter_recurse (iter, &child)) {
+      bson_set_error (error,
+                      BSON_ERROR_MATCHER,
+                      BSON_ERROR_MATCHER_INVALID,
+                      "%s requires an array", bson_iter_key (iter));
+      return false;
+   }
+
+   while (bson_iter_next (&child)) {
+      node->values = bson_realloc (
+         node->values, (node->n_values + 1) * sizeof *node->values);
+
+      if (!_bson_matcher_operand (&child, &node->values[node->n_values],
+                                  error)) {
+         return false;
+      }
+
+      node->n_values++;
+
+      if (BSON_ITER_HOLDS_NULL (&child)) {
+         node->has_null = true;
+      }
+   }
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_matcher_compile_path --
+ *
+ *       Compile the condition on a single path, either a value to compare
+ *       for equality or a document of operators such as
+ *       {"$gt": 1, "$lt": 5}, into predicate nodes appended to @parent.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_bson_matcher_compile_path (bson_matcher_t      *matcher, /* IN */
+                            bson_iter_t         *iter,    /* IN */
+                            bson_matcher_node_t *parent,  /* IN */
+                            bson_error_t        *error)   /* OUT */
+{
+   static const struct {
+      const char        *name;
+      bson_matcher_op_t  op;
+   } ops[] = {
+      { "$eq", BSON_MATCHER_OP_EQ },
+      { "$ne", BSON_MATCHER_OP_NE },
+      { "$gt", BSON_MATCHER_OP_GT },
+      { "$gte", BSON_MATCHER_OP_GTE },
+      { "$lt", BSON_MATCHER_OP_LT },
+      { "$lte", BSON_MATCHER_OP_LTE },
+      { "$in", BSON_MATCHER_OP_IN },
+      { "$nin", BSON_MATCHER_OP_NIN },
+      { "$exists", BSON_MATCHER_OP_EXISTS },
+      { "$type", BSON_MATCHER_OP_TYPE },
+   };
+   bson_matcher_node_t *node;
+   bson_iter_t child;
+   const char *key;
+   uint32_t slot;
+   size_t i;
+
+   slot = _bson_matcher_add_path (matcher, bson_iter_key (iter));
+
+   if (!BSON_ITER_HOLDS_DOCUMENT (iter) ||
+       !bson_iter_recurse (iter, &child) ||
+       !bson_iter_next (&child) ||
+       bson_iter_key (&child)[0] != '$') {
+      node = _bson_matcher_node_append (parent, BSON_MATCHER_OP_EQ);
+      node->slot = slot;
+      return _bson_matcher_operand (iter, &node->value, error);
+   }
+
+   do {
+      key = bson_iter_key (&child);
+
+      for (i = 0; i < sizeof ops / sizeof ops[0]; i++) {
+         if (!strcmp (key, ops[i].name)) {
+            break;
+         }
+      }
+
+      if (i == sizeof ops / sizeof ops[0]) {
+         bson_set_error (error,
+                         BSON_ERROR_MATCHER,
+                         BSON_ERROR_MATCHER_INVALID,
+                         "Unknown operator \"%s\"", key);
+         return false;
+      }
+
+      node = _bson_matcher_node_append (parent, ops[i].op);
+      node->slot = slot;
+
+      switch (node->op) {
+      case BSON_MATCHER_OP_IN:
+      case BSON_MATCHER_OP_NIN:
+         if (!_bson_matcher_compile_in (&child, node, error)) {
+            return false;
+         }
+         break;
+      case BSON_MATCHER_OP_EXISTS:
+         node->exists = bson_iter_as_bool (&child);
+         break;
+      case BSON_MATCHER_OP_TYPE:
+         if (!_bson_matcher_compile_type (&child, node, error)) {
+            return false;
+         }
+         break;
+      case BSON_MATCHER_OP_AND:
+      case BSON_MATCHER_OP_OR:
+         BSON_ASSERT (false);
+         break;
+      default:
+         if (!_bson_matcher_operand (&child, &node->value, error)) {
+            return false;
+         }
+         break;
+      }
+   } while (bson_iter_next (&child));
+
+   return true;
+}
+
+
+static bool
+_bson_matcher_compile_logical (bson_matcher_t      *matcher, /* IN */
+                               bson_iter_t         *iter,    /* IN */
+                               bson_matcher_node_t *parent,  /* IN */
+                               bson_matcher_op_t    op,      /* IN */
+                               bson_error_t        *error)   /* OUT */
+{
+   bson_matcher_node_t *node;
+   bson_matcher_node_t *clause;
+   bson_iter_t child;
+   bson_iter_t grandchild;
+
+   if (!BSON_ITER_HOLDS_ARRAY (iter) || !bson_iter_recurse (iter, &child)) {
+      bson_set_error (error,
+                      BSON_ERROR_MATCHER,
+                      BSON_ERROR_MATCHER_INVALID,
+                      "%s requires an array", bson_iter_key (iter));
+      return false;
+   }
+
+   node = _bson_matcher_node_append (parent, op);
+
+   while (bson_iter_next (&child)) {
+      if (!BSON_ITER_HOLDS_DOCUMENT (&child) ||
+          !bson_iter_recurse (&child, &grandchild)) {
+         bson_set_error (error,
+                         BSON_ERROR_MATCHER,
+                         BSON_ERROR_MATCHER_INVALID,
+                         "%s requires an array of documents",
+                         bson_iter_key (iter));
+         return false;
+      }
+
+      clause = _bson_matcher_node_append (node, BSON_MATCHER_OP_AND);
+
+      if (!_bson_matcher_compile_doc (matcher, &grandchild, clause, error)) {
+         return false;
+      }
+   }
+
+   if (!node->n_children) {
+      bson_set_error (error,
+                      BSON_ERROR_MATCHER,
+                      BSON_ERROR_MATCHER_INVALID,
+                      "%s requires a nonempty array", bson_iter_key (iter));
+      return false;
+   }
+
+   return true;
+}
+
+
+static bool
+_bson_matcher_compile_doc (bson_matcher_t      *matcher, /* IN */
+                           bson_iter_t         *iter,    /* IN */
+                           bson_matcher_node_t *parent,  /* IN */
+                           bson_error_t        *error)   /* OUT */
+{
+   const char *key;
+
+   while (bson_iter_next (iter)) {
+      key = bson_iter_key (iter);
+
+      if (!strcmp (key, "$and")) {
+         if (!_bson_matcher_compile_logical (matcher, iter, parent,
+                                             BSON_MATCHER_OP_AND, error)) {
+            return false;
+         }
+      } else if (!strcmp (key, "$or")) {
+         if (!_bson_matcher_compile_logical (matcher, iter, parent,
+                                             BSON_MATCHER_OP_OR, error)) {
+            return false;
+         }
+      } else if (key[0] == '$') {
+         bson_set_error (error,
+                         BSON_ERROR_MATCHER,
+                         BSON_ERROR_MATCHER_INVALID,
+                         "Unknown operator \"%s\"", key);
+         return false;
+      } else if (!_bson_matcher_compile_path (matcher, iter, parent, error)) {
+         return false;
+      }
+   }
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_matcher_new --
+ *
+ *       Compile @filter into a bson_matcher_t.
+ *
+ *       @filter uses the syntax of a MongoDB query. Each field names a
+ *       dotted path and either a value the path must equal or a document
+ *       of operators: $eq, $ne, $gt, $gte, $lt, $lte, $in, $nin, $exists
+ *       and $type. The top level and each clause of $and and $or may
+ *       combine any number of such conditions.
+ *
+ *       As with bson_iter_find_descendant(), path components name fields
+ *       of embedded documents or indexes of arrays. If the value at a path
+ *       is an array, a comparison matches if either the array or any of
+ *       its elements matches. Numbers of different types compare by
+ *       value; other values compare only with values of the same type.
+ *
+ * Returns:
+ *       A newly allocated bson_matcher_t that should be freed with
+ *       bson_matcher_destroy(), or NULL and @error is set if @filter is
+ *       invalid.
+ *
+ * Side effects:
+ *       @error may be set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bson_matcher_t *
+bson_matcher_new (const bson_t *filter, /* IN */
+                  bson_error_t *error)  /* OUT */
+{
+   bson_matcher_t *matcher;
+   bson_iter_t iter;
+
+   BSON_ASSERT (filter);
+
+   matcher = bson_malloc0 (sizeof *matcher);
+   matcher->filter = bson_copy (filter);
+   matcher->root.op = BSON_MATCHER_OP_AND;
+   matcher->paths.slot = -1;
+
+   if (!bson_iter_init (&iter, matcher->filter)) {
+      bson_set_error (error,
+                      BSON_ERROR_MATCHER,
+                      BSON_ERROR_MATCHER_INVALID,
+                      "Invalid filter document");
+      bson_matcher_destroy (matcher);
+      return NULL;
+   }
+
+   if (!_bson_matcher_compile_doc (matcher, &iter, &matcher->root, error)) {
+      bson_matcher_destroy (matcher);
+      return NULL;
+   }
+
+   return matcher;
+}
+
+
+void
+bson_matcher_destroy (bson_matcher_t *matcher) /* IN */
+{
+   if (matcher) {
+      _bson_matcher_node_destroy (&matcher->root);
+      _bson_matcher_path_destroy (&matcher->paths);
+      bson_destroy (matcher->filter);
+      bson_free (matcher);
+   }
+}
+
+
+static BSON_INLINE bool
+_bson_matcher_is_number (bson_type_t type) /* IN */
+{
+   return type == BSON_TYPE_DOUBLE ||
+          type == BSON_TYPE_INT32 ||
+          type == BSON_TYPE_INT64;
+}
+
+
+static BSON_INLINE int
+_bson_matcher_memcmp (const void *a,     /* IN */
+                      uint32_t    a_len, /* IN */
+                      const void *b,     /* IN */
+                      uint32_t    b_len) /* IN */
+{
+   int ret;
+
+   ret = memcmp (a, b, BSON_MIN (a_len, b_len));
+
+   if (ret) {
+      return (ret < 0) ? -1 : 1;
+   }
+
+   return (a_len < b_len) ? -1 : (a_len > b_len);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_matcher_compare --
+ *
+ *       Compare @a with @b for $gt, $gte, $lt and $lte.
+ *
+ * Returns:
+ *       true and @cmp is set to -1, 0 or 1 if the values are ordered;
+ *       otherwise false, such as for values of different types.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_bson_matcher_compare (const bson_value_t *a,   /* IN */
+                       const bson_value_t *b,   /* IN */
+                       int                *cmp) /* OUT */
+{
+   double da;
+   double db;
+   int64_t ia;
+   int64_t ib;
+
+   if (_bson_matcher_is_number (a->value_type) &&
+       _bson_matcher_is_number (b->value_type)) {
+      if (a->value_type != BSON_TYPE_DOUBLE &&
+          b->value_type != BSON_TYPE_DOUBLE) {
+         ia = (a->value_type == BSON_TYPE_INT32) ? a->value.v_int32
+                                                 : a->value.v_int64;
+         ib = (b->value_type == BSON_TYPE_INT32) ? b->value.v_int32
+                                                 : b->value.v_int64;
+         *cmp = (ia < ib) ? -1 : (ia > ib);
+         return true;
+      }
+
+#define AS_DOUBLE(v) \
+   ((v)->value_type == BSON_TYPE_DOUBLE ? (v)->value.v_double : \
+    (v)->value_type == BSON_TYPE_INT32 ? (double)(v)->value.v_int32 : \
+    (double)(v)->value.v_int64)
+
+      da = AS_DOUBLE (a);
+      db = AS_DOUBLE (b);
+
+#undef AS_DOUBLE
+
+      if (da != da || db != db) {
+         return false;
+      }
+
+      *cmp = (da < db) ? -1 : (da > db);
+      return true;
+   }
+
+   if (a->value_type != b->value_type) {
+      return false;
+   }
+
+   switch (a->value_type) {
+   case BSON_TYPE_UTF8:
+      *cmp = _bson_matcher_memcmp (a->value.v_utf8.str, a->value.v_utf8.len,
+                                   b->value.v_utf8.str, b->value.v_utf8.len);
+      return true;
+   case BSON_TYPE_SYMBOL:
+      *cmp = _bson_matcher_memcmp (a->value.v_symbol.symbol,
+                                   a->value.v_symbol.len,
+                                   b->value.v_symbol.symbol,
+                                   b->value.v_symbol.len);
+      return true;
+   case BSON_TYPE_DOCUMENT:
+   case BSON_TYPE_ARRAY:
+      *cmp = _bson_matcher_memcmp (a->value.v_doc.data,
+                                   a->value.v_doc.data_len,
+                                   b->value.v_doc.data,
+                                   b->value.v_doc.data_len);
+      return true;
+   case BSON_TYPE_BINARY:
+      if (a->value.v_binary.data_len != b->value.v_binary.data_len) {
+         *cmp = (a->value.v_binary.data_len < b->value.v_binary.data_len)
+                ? -1 : 1;
+      } else if (a->value.v_binary.subtype != b->value.v_binary.subtype) {
+         *cmp = (a->value.v_binary.subtype < b->value.v_binary.subtype)
+                ? -1 : 1;
+      } else {
+         *cmp = _bson_matcher_memcmp (a->value.v_binary.data,
+                                      a->value.v_binary.data_len,
+                                      b->value.v_binary.data,
+                                      b->value.v_binary.data_len);
+      }
+      return true;
+   case BSON_TYPE_OID:
+      *cmp = bson_oid_compare (&a->value.v_oid, &b->value.v_oid);
+      *cmp = (*cmp < 0) ? -1 : (*cmp > 0);
+      return true;
+   case BSON_TYPE_BOOL:
+      *cmp = (int)a->value.v_bool - (int)b->value.v_bool;
+      return true;
+   case BSON_TYPE_DATE_TIME:
+      *cmp = (a->value.v_datetime < b->value.v_datetime) ? -1 :
+             (a->value.v_datetime > b->value.v_datetime);
+      return true;
+   case BSON_TYPE_TIMESTAMP:
+      if (a->value.v_timestamp.timestamp != b->value.v_timestamp.timestamp) {
+         *cmp = (a->value.v_timestamp.timestamp <
+                 b->value.v_timestamp.timestamp) ? -1 : 1;
+      } else {
+         *cmp = (a->value.v_timestamp.increment <
+                 b->value.v_timestamp.increment) ? -1 :
+                (a->value.v_timestamp.increment >
+                 b->value.v_timestamp.increment);
+      }
+      return true;
+   case BSON_TYPE_NULL:
+   case BSON_TYPE_UNDEFINED:
+   case BSON_TYPE_MINKEY:
+   case BSON_TYPE_MAXKEY:
+      *cmp = 0;
+      return true;
+   default:
+      return false;
+   }
+}
+
+
+static bool
+_bson_matcher_equal (const bson_value_t *a, /* IN */
+                     const bson_value_t *b) /* IN */
+{
+   int cmp;
+
+   if (_bson_matcher_compare (a, b, &cmp)) {
+      return cmp == 0;
+   }
+
+   if (a->value_type != b->value_type) {
+      return false;
+   }
+
+   switch (a->value_type) {
+   case BSON_TYPE_REGEX:
+      return !strcmp (a->value.v_regex.regex, b->value.v_regex.regex) &&
+             !strcmp (a->value.v_regex.options, b->value.v_regex.options);
+   case BSON_TYPE_CODE:
+      return !_bson_matcher_memcmp (a->value.v_code.code,
+                                    a->value.v_code.code_len,
+                                    b->value.v_code.code,
+                                    b->value.v_code.code_len);
+   case BSON_TYPE_CODEWSCOPE:
+      return !_bson_matcher_memcmp (a->value.v_codewscope.code,
+                                    a->value.v_codewscope.code_len,
+                                    b->value.v_codewscope.code,
+                                    b->value.v_codewscope.code_len) &&
+             !_bson_matcher_memcmp (a->value.v_codewscope.scope_data,
+                                    a->value.v_codewscope.scope_len,
+                                    b->value.v_codewscope.scope_data,
+                                    b->value.v_codewscope.scope_len);
+   case BSON_TYPE_DBPOINTER:
+      return !_bson_matcher_memcmp (a->value.v_dbpointer.collection,
+                                    a->value.v_dbpointer.collection_len,
+                                    b->value.v_dbpointer.collection,
+                                    b->value.v_dbpointer.collection_len) &&
+             bson_oid_equal (&a->value.v_dbpointer.oid,
+                             &b->value.v_dbpointer.oid);
+#ifdef BSON_EXPERIMENTAL_FEATURES
+   case BSON_TYPE_DECIMAL128:
+      return a->value.v_decimal128.high == b->value.v_decimal128.high &&
+             a->value.v_decimal128.low == b->value.v_decimal128.low;
+#endif
+   default:
+      return false;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_matcher_test_value --
+ *
+ *       Test a single value against the comparison in @node. $ne and $nin
+ *       are tested as $eq and $in; the caller negates the result.
+ *
+ * Returns:
+ *       true if @value satisfies @node.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_bson_matcher_test_value (const bson_matcher_node_t *node,  /* IN */
+                          const bson_value_t        *value) /* IN */
+{
+   uint32_t i;
+   int cmp;
+
+   switch (node->op) {
+   case BSON_MATCHER_OP_EQ:
+   case BSON_MATCHER_OP_NE:
+      return _bson_matcher_equal (value, &node->value);
+   case BSON_MATCHER_OP_GT:
+      return _bson_matcher_compare (value, &node->value, &cmp) && cmp > 0;
+   case BSON_MATCHER_OP_GTE:
+      return _bson_matcher_compare (value, &node->value, &cmp) && cmp >= 0;
+   case BSON_MATCHER_OP_LT:
+      return _bson_matcher_compare (value, &node->value, &cmp) && cmp < 0;
+   case BSON_MATCHER_OP_LTE:
+      return _bson_matcher_compare (value, &node->value, &cmp) && cmp <= 0;
+   case BSON_MATCHER_OP_IN:
+   case BSON_MATCHER_OP_NIN:
+      for (i = 0; i < node->n_values; i++) {
+         if (_bson_matcher_equal (value, &node->values[i])) {
+            return true;
+         }
+      }
+      return false;
+   case BSON_MATCHER_OP_TYPE:
+      if (node->type == BSON_MATCHER_TYPE_NUMBER) {
+         return _bson_matcher_is_number (value->value_type) ||
+                value->value_type == BSON_TYPE_DECIMAL128;
+      }
+      return (int)value->value_type == node->type;
+   case BSON_MATCHER_OP_AND:
+   case BSON_MATCHER_OP_OR:
+   case BSON_MATCHER_OP_EXISTS:
+   default:
+      BSON_ASSERT (false);
+      return false;
+   }
+}
+
+
+static bool
+_bson_matcher_test_any (const bson_matcher_node_t *node,  /* IN */
+                        const bson_value_t        *value) /* IN */
+{
+   bson_value_t element;
+   bson_iter_t iter;
+   bson_t array;
+
+   if (value->value_type == BSON_TYPE_EOD) {
+      /* a missing field is equal to null */
+      switch (node->op) {
+      case BSON_MATCHER_OP_EQ:
+      case BSON_MATCHER_OP_NE:
+         return node->value.value_type == BSON_TYPE_NULL;
+      case BSON_MATCHER_OP_IN:
+      case BSON_MATCHER_OP_NIN:
+         return node->has_null;
+      default:
+         return false;
+      }
+   }
+
+   if (_bson_matcher_test_value (node, value)) {
+      return true;
+   }
+
+   if (value->value_type == BSON_TYPE_ARRAY &&
+       bson_init_static (&array, value->value.v_doc.data,
+                         value->value.v_doc.data_len) &&
+       bson_iter_init (&iter, &array)) {
+      while (bson_iter_next (&iter)) {
+         _bson_matcher_iter_value (&iter, &element);
+
+         if (_bson_matcher_test_value (node, &element)) {
+            return true;
+         }
+      }
+   }
+
+   return false;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_matcher_step --
+ *
+ *       Advance the walk of the document by one field, storing its value
+ *       in a slot if the trie names it, and descending into it if the
+ *       trie names any of its children. Only the first occurrence of a
+ *       key is used, as with bson_iter_find().
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @state is updated. The walk is complete once state->depth is 0.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_bson_matcher_step (bson_matcher_state_t *state) /* IN */
+{
+   const bson_matcher_path_t *child;
+   bson_matcher_frame_t *frame;
+   const char *key;
+   uint32_t i;
+
+   frame = &state->frames[state->depth - 1];
+
+   if (!frame->pending || !bson_iter_next (&frame->iter)) {
+      state->depth--;
+      return;
+   }
+
+   key = bson_iter_key (&frame->iter);
+
+   for (i = 0; i < frame->path->n_children; i++) {
+      child = &frame->path->children[i];
+
+      if (key[0] != child->key[0] ||
+          state->visited[child->index] ||
+          memcmp (key, child->key, child->key_len) != 0 ||
+          key[child->key_len] != '\0') {
+         continue;
+      }
+
+      state->visited[child->index] = 1;
+      frame->pending--;
+
+      if (child->slot >= 0) {
+         _bson_matcher_iter_value (&frame->iter, &state->slots[child->slot]);
+      }
+
+      if (child->n_children &&
+          (BSON_ITER_HOLDS_DOCUMENT (&frame->iter) ||
+           BSON_ITER_HOLDS_ARRAY (&frame->iter)) &&
+          bson_iter_recurse (&frame->iter, &frame[1].iter)) {
+         frame[1].path = child;
+         frame[1].pending = child->n_children;
+         state->depth++;
+      }
+
+      break;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_matcher_lookup --
+ *
+ *       Fetch the value at the path for @slot, walking the document only
+ *       as far as needed to find it.
+ *
+ * Returns:
+ *       The value, whose type is BSON_TYPE_EOD if the path is missing.
+ *
+ * Side effects:
+ *       @state is updated.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static const bson_value_t *
+_bson_matcher_lookup (bson_matcher_state_t *state, /* IN */
+                      uint32_t              slot)  /* IN */
+{
+   while (state->slots[slot].value_type == BSON_TYPE_EOD && state->depth) {
+      _bson_matcher_step (state);
+   }
+
+   return &state->slots[slot];
+}
+
+
+static bool
+_bson_matcher_eval (const bson_matcher_node_t *node,  /* IN */
+                    bson_matcher_state_t      *state) /* IN */
+{
+   uint32_t i;
+
+   switch (node->op) {
+   case BSON_MATCHER_OP_AND:
+      for (i = 0; i < node->n_children; i++) {
+         if (!_bson_matcher_eval (&node->children[i], state)) {
+            return false;
+         }
+      }
+      return true;
+   case BSON_MATCHER_OP_OR:
+      for (i = 0; i < node->n_children; i++) {
+         if (_bson_matcher_eval (&node->children[i], state)) {
+            return true;
+         }
+      }
+      return false;
+   case BSON_MATCHER_OP_EXISTS:
+      return (_bson_matcher_lookup (state, node->slot)->value_type !=
+              BSON_TYPE_EOD) == node->exists;
+   case BSON_MATCHER_OP_NE:
+   case BSON_MATCHER_OP_NIN:
+      return !_bson_matcher_test_any (node,
+                                      _bson_matcher_lookup (state, node->slot));
+   default:
+      return _bson_matcher_test_any (node,
+                                     _bson_matcher_lookup (state, node->slot));
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_matcher_match --
+ *
+ *       Evaluate @matcher against @doc.
+ *
+ *       Predicates are evaluated in the order they appear in the filter,
+ *       and the document is walked only as far as the next predicate
+ *       requires, so a document that fails an early predicate is not
+ *       scanned any further.
+ *
+ * Returns:
+ *       true if @doc matches the filter; otherwise false.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_matcher_match (const bson_matcher_t *matcher, /* IN */
+                    const bson_t         *doc)     /* IN */
+{
+   bson_matcher_frame_t stack_frames[BSON_MATCHER_STACK_DEPTH];
+   bson_value_t stack_slots[BSON_MATCHER_STACK_SLOTS];
+   uint8_t stack_visited[BSON_MATCHER_STACK_PATHS];
+   bson_matcher_state_t state;
+   uint32_t i;
+   bool ret;
+
+   BSON_ASSERT (matcher);
+   BSON_ASSERT (doc);
+
+   state.frames = stack_frames;
+   state.slots = stack_slots;
+   state.visited = stack_visited;
+
+   if (matcher->max_depth > BSON_MATCHER_STACK_DEPTH) {
+      state.frames = bson_malloc (matcher->max_depth * sizeof *state.frames);
+   }
+
+   if (matcher->n_slots > BSON_MATCHER_STACK_SLOTS) {
+      state.slots = bson_malloc (matcher->n_slots * sizeof *state.slots);
+   }
+
+   if (matcher->n_paths > BSON_MATCHER_STACK_PATHS) {
+      state.visited = bson_malloc (matcher->n_paths);
+   }
+
+   for (i = 0; i < matcher->n_slots; i++) {
+      state.slots[i].value_type = BSON_TYPE_EOD;
+   }
+
+   memset (state.visited, 0, matcher->n_paths);
+
+   state.depth = 0;
+
+   if (matcher->max_depth && bson_iter_init (&state.frames[0].iter, doc)) {
+      state.frames[0].path = &matcher->paths;
+      state.frames[0].pending = matcher->paths.n_children;
+      state.depth = 1;
+   }
+
+   ret = _bson_matcher_eval (&matcher->root, &state);
+
+   if (state.frames != stack_frames) {
+      bson_free (state.frames);
+   }
+
+   if (state.slots != stack_slots) {
+      bson_free (state.slots);
+   }
+
+   if (state.visited != stack_visited) {
+      bson_free (state.visited);
+   }
+
+   return ret;
+}
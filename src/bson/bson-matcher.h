@@ -0,0 +1,61 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef BSON_MATCHER_H
+#define BSON_MATCHER_H
+
+
+#if !defined (BSON_INSIDE) && !defined (BSON_COMPILATION)
+# error "Only <bson.h> can be included directly."
+#endif
+
+
+#include "bson-compat.h"
+#include "bson-types.h"
+
+
+BSON_BEGIN_DECLS
+
+
+#define BSON_ERROR_MATCHER_INVALID 1
+
+
+/**
+ * bson_matcher_t:
+ *
+ * A bson_matcher_t is a query filter in the style of MongoDB's find(),
+ * compiled once so that it can be evaluated against many documents.
+ *
+ * Matching makes a single pass over the document, visiting only the
+ * fields named by the filter and stopping once all of them have been
+ * found. A compiled matcher is immutable and may be shared between
+ * threads.
+ */
+typedef struct _bson_matcher_t bson_matcher_t;
+
+
+bson_matcher_t *bson_matcher_new     (const bson_t         *filter,
+                                      bson_error_t         *error);
+bool            bson_matcher_match   (const bson_matcher_t *matcher,
+                                      const bson_t         *doc);
+void            bson_matcher_destroy (bson_matcher_t       *matcher);
+
+
+BSON_END_DECLS
+
+
+#endif /* BSON_MATCHER_H */
@@ -0,0 +1,321 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "bson.h"
+
+#include <string.h>
+
+#include "bson-memory.h"
+#include "bson-pool.h"
+#include "bson-private.h"
+
+
+struct _bson_pool_t
+{
+   bson_t   **idle;
+   uint32_t   n_idle;
+   uint32_t   idle_alloc;
+   uint32_t   n_outstanding;
+   uint32_t   high_water;
+   uint32_t   releases;
+   size_t     idle_bytes;
+   size_t     max_size;
+   uint64_t   n_acquired;
+   uint64_t   n_reused;
+   uint64_t   n_freed;
+};
+
+
+static BSON_INLINE size_t
+_bson_pool_capacity (const bson_t *bson) /* IN */
+{
+   if (bson->flags & BSON_FLAG_INLINE) {
+      return 0;
+   }
+
+   return ((const bson_impl_alloc_t *)bson)->alloclen;
+}
+
+
+static void
+_bson_pool_free (bson_pool_t *pool, /* IN */
+                 bson_t      *bson) /* IN */
+{
+   pool->n_freed++;
+   bson_destroy (bson);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_pool_new --
+ *
+ *       Create a new, empty bson_pool_t.
+ *
+ * Returns:
+ *       A newly allocated bson_pool_t that should be freed with
+ *       bson_pool_destroy().
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bson_pool_t *
+bson_pool_new (void)
+{
+   bson_pool_t *pool;
+
+   pool = bson_malloc0 (sizeof *pool);
+   pool->max_size = BSON_POOL_MAX_RETAINED;
+
+   return pool;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_pool_destroy --
+ *
+ *       Free @pool and its idle documents. Documents that have been
+ *       acquired and not released are not freed, and should be freed
+ *       with bson_destroy().
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+bson_pool_destroy (bson_pool_t *pool) /* IN */
+{
+   uint32_t i;
+
+   if (pool) {
+      for (i = 0; i < pool->n_idle; i++) {
+         bson_destroy (pool->idle[i]);
+      }
+
+      bson_free (pool->idle);
+      bson_free (pool);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_pool_acquire --
+ *
+ *       Take an empty document from @pool. The most recently released
+ *       document is reused first, keeping the buffer it had grown to.
+ *
+ * Returns:
+ *       An empty bson_t that should be returned with bson_pool_release(),
+ *       or may be freed with bson_destroy().
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bson_t *
+bson_pool_acquire (bson_pool_t *pool) /* IN */
+{
+   bson_t *bson;
+
+   BSON_ASSERT (pool);
+
+   pool->n_acquired++;
+
+   if (pool->n_idle) {
+      bson = pool->idle[--pool->n_idle];
+      pool->idle_bytes -= _bson_pool_capacity (bson);
+      pool->n_reused++;
+      bson_reinit (bson);
+   } else {
+      bson = bson_new ();
+   }
+
+   if (++pool->n_outstanding > pool->high_water) {
+      pool->high_water = pool->n_outstanding;
+   }
+
+   return bson;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_pool_release --
+ *
+ *       Return @bson to @pool for reuse. @bson must have been acquired
+ *       from @pool, and must not be used after this call.
+ *
+ *       Documents whose buffers grew beyond the pool's maximum size are
+ *       freed instead of retained. Every BSON_POOL_TRIM_INTERVAL releases,
+ *       the pool is trimmed with bson_pool_trim().
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+bson_pool_release (bson_pool_t *pool, /* IN */
+                   bson_t      *bson) /* IN */
+{
+   size_t capacity;
+
+   BSON_ASSERT (pool);
+   BSON_ASSERT (bson);
+   BSON_ASSERT (pool->n_outstanding);
+   BSON_ASSERT (!(bson->flags & (BSON_FLAG_STATIC |
+                                 BSON_FLAG_RDONLY |
+                                 BSON_FLAG_CHILD |
+                                 BSON_FLAG_IN_CHILD |
+                                 BSON_FLAG_NO_FREE)));
+
+   pool->n_outstanding--;
+
+   capacity = _bson_pool_capacity (bson);
+
+   if (capacity > pool->max_size) {
+      _bson_pool_free (pool, bson);
+   } else {
+      if (pool->n_idle == pool->idle_alloc) {
+         pool->idle_alloc = pool->idle_alloc ? pool->idle_alloc * 2 : 16;
+         pool->idle = bson_realloc (pool->idle,
+                                    pool->idle_alloc * sizeof *pool->idle);
+      }
+
+      pool->idle[pool->n_idle++] = bson;
+      pool->idle_bytes += capacity;
+   }
+
+   if (++pool->releases >= BSON_POOL_TRIM_INTERVAL) {
+      bson_pool_trim (pool);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_pool_set_max_size --
+ *
+ *       Set the largest buffer, in bytes, that a released document may
+ *       have and still be retained. The default is
+ *       BSON_POOL_MAX_RETAINED.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+bson_pool_set_max_size (bson_pool_t *pool,     /* IN */
+                        size_t       max_size) /* IN */
+{
+   BSON_ASSERT (pool);
+
+   pool->max_size = max_size;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_pool_trim --
+ *
+ *       Free idle documents that were not needed since the last trim.
+ *
+ *       The high-water mark is the largest number of documents that were
+ *       acquired at once since the last trim. Enough idle documents are
+ *       kept to reach it again, and the rest are freed. The high-water
+ *       mark then restarts from the number currently acquired.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+bson_pool_trim (bson_pool_t *pool) /* IN */
+{
+   uint32_t keep;
+   uint32_t drop;
+   uint32_t i;
+
+   BSON_ASSERT (pool);
+
+   keep = pool->high_water - pool->n_outstanding;
+
+   /* the least recently released documents are at the bottom */
+   if (pool->n_idle > keep) {
+      drop = pool->n_idle - keep;
+
+      for (i = 0; i < drop; i++) {
+         pool->idle_bytes -= _bson_pool_capacity (pool->idle[i]);
+         _bson_pool_free (pool, pool->idle[i]);
+      }
+
+      memmove (pool->idle, pool->idle + drop, keep * sizeof *pool->idle);
+      pool->n_idle = keep;
+   }
+
+   pool->high_water = pool->n_outstanding;
+   pool->releases = 0;
+}
+
+
+void
+bson_pool_get_stats (const bson_pool_t *pool,  /* IN */
+                     bson_pool_stats_t *stats) /* OUT */
+{
+   BSON_ASSERT (pool);
+   BSON_ASSERT (stats);
+
+   stats->n_acquired = pool->n_acquired;
+   stats->n_reused = pool->n_reused;
+   stats->n_freed = pool->n_freed;
+   stats->n_idle = pool->n_idle;
+   stats->n_outstanding = pool->n_outstanding;
+   stats->high_water = pool->high_water;
+   stats->idle_bytes = pool->idle_bytes;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef BSON_POOL_H
+#define BSON_POOL_H
+
+
+#if !defined (BSON_INSIDE) && !defined (BSON_COMPILATION)
+# error "Only <bson.h> can be included directly."
+#endif
+
+
+#include "bson-compat.h"
+#include "bson-types.h"
+
+
+BSON_BEGIN_DECLS
+
+
+/*
+ * Documents are trimmed from the idle list after this many releases, and
+ * documents whose buffers grew beyond this many bytes are not retained.
+ */
+#define BSON_POOL_TRIM_INTERVAL 4096
+#define BSON_POOL_MAX_RETAINED  (16 * 1024 * 1024)
+
+
+/**
+ * bson_pool_t:
+ *
+ * A pool of bson_t that keep their heap buffers between uses, so documents
+ * of a similar size can be built repeatedly without growing the buffer
+ * again each time.
+ *
+ * A pool is not thread-safe; use one per thread, or protect it with a
+ * mutex.
+ */
+typedef struct _bson_pool_t bson_pool_t;
+
+
+typedef struct
+{
+   uint64_t n_acquired;
+   uint64_t n_reused;
+   uint64_t n_freed;
+   uint32_t n_idle;
+   uint32_t n_outstanding;
+   uint32_t high_water;
+   size_t   idle_bytes;
+} bson_pool_stats_t;
+
+
+bson_pool_t *bson_pool_new          (void);
+void         bson_pool_destroy      (bson_pool_t       *pool);
+bson_t      *bson_pool_acquire      (bson_pool_t       *pool);
+void         bson_pool_release      (bson_pool_t       *pool,
+                                     bson_t            *bson);
+void         bson_pool_set_max_size (bson_pool_t       *pool,
+                                     size_t             max_size);
+void         bson_pool_trim         (bson_pool_t       *pool);
+void         bson_pool_get_stats    (const bson_pool_t *pool,
+                                     bson_pool_stats_t *stats);
+
+
+BSON_END_DECLS
+
+
+#endif /* BSON_POOL_H */
@@ -21,6 +21,7 @@
 
 #include "bson-macros.h"
 #include "bson-memory.h"
+#include "bson-string.h"
 #include "bson-types.h"
 
 
@@ -36,6 +37,7 @@ typedef enum
    BSON_FLAG_CHILD           = (1 << 3),
    BSON_FLAG_IN_CHILD        = (1 << 4),
    BSON_FLAG_NO_FREE         = (1 << 5),
+   BSON_FLAG_IN_RESERVE      = (1 << 6),
 } bson_flags_t;
 
 
@@ -75,6 +77,16 @@ BSON_ALIGNED_END (128);
 BSON_STATIC_ASSERT (sizeof (bson_impl_alloc_t) <= 128);
 
 
+uint32_t
+_bson_iter_key_len (const bson_iter_t *iter);
+
+
+bool
+_bson_as_json_append (const bson_t  *bson,
+                      bool           keys,
+                      bson_string_t *str);
+
+
 BSON_END_DECLS
 
 
@@ -0,0 +1,594 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "bson.h"
+
+#include <string.h>
+
+#include "bson-memory.h"
+#include "bson-private.h"
+#include "bson-projection.h"
+
+
+/*
+ * A specification is compiled into a trie of the paths it names. Applying
+ * a projection walks the source document once. Elements that are kept
+ * unchanged are copied in runs: adjacent kept elements are coalesced and
+ * copied with a single memcpy() when the run is broken. Only elements
+ * whose trie node has children are rewritten element by element.
+ *
+ * A projection never makes a document larger, so the destination is
+ * reserved at the size of the source before writing.
+ */
+
+
+typedef enum
+{
+   BSON_PROJECTION_INCLUDE,
+   BSON_PROJECTION_EXCLUDE,
+   BSON_PROJECTION_NESTED,
+} bson_projection_action_t;
+
+
+typedef struct _bson_projection_node_t bson_projection_node_t;
+
+
+struct _bson_projection_node_t
+{
+   char                     *key;
+   size_t                    key_len;
+   bson_projection_action_t  action;
+   bson_projection_node_t   *children;
+   uint32_t                  n_children;
+};
+
+
+struct _bson_projection_t
+{
+   bson_projection_node_t root;
+   bool                   decided;
+   bool                   include;
+};
+
+
+static void
+_bson_projection_node_destroy (bson_projection_node_t *node) /* IN */
+{
+   uint32_t i;
+
+   for (i = 0; i < node->n_children; i++) {
+      _bson_projection_node_destroy (&node->children[i]);
+   }
+
+   bson_free (node->children);
+   bson_free (node->key);
+}
+
+
+static bson_projection_node_t *
+_bson_projection_node_find (const bson_projection_node_t *node,    /* IN */
+                            const char                   *key,     /* IN */
+                            size_t                        key_len) /* IN */
+{
+   uint32_t i;
+
+   for (i = 0; i < node->n_children; i++) {
+      if (node->children[i].key_len == key_len &&
+          key[0] == node->children[i].key[0] &&
+          !memcmp (node->children[i].key, key, key_len)) {
+         return &node->children[i];
+      }
+   }
+
+   return NULL;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_projection_add_path --
+ *
+ *       Add the dotted @path to the trie rooted at @node with @action.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set if @path
+ *       collides with a path already added.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_bson_projection_add_path (bson_projection_node_t   *node,   /* IN */
+                           const char               *path,   /* IN */
+                           bson_projection_action_t  action, /* IN */
+                           bson_error_t             *error)  /* OUT */
+{
+   bson_projection_node_t *child;
+   const char *full_path = path;
+   const char *dot;
+   size_t len;
+
+   for (;;) {
+      dot = strchr (path, '.');
+      len = dot ? (size_t)(dot - path) : strlen (path);
+
+      if (!len) {
+         bson_set_error (error,
+                         BSON_ERROR_PROJECTION,
+                         BSON_ERROR_PROJECTION_INVALID,
+                         "Invalid path \"%s\"", full_path);
+         return false;
+      }
+
+      child = _bson_projection_node_find (node, path, len);
+
+      if (child) {
+         /* "a" and "a.b", or "a" twice, cannot both be projected */
+         if (child->action != BSON_PROJECTION_NESTED || !dot) {
+            bson_set_error (error,
+                            BSON_ERROR_PROJECTION,
+                            BSON_ERROR_PROJECTION_INVALID,
+                            "Path collision at \"%s\"", full_path);
+            return false;
+         }
+      } else {
+         node->children = bson_realloc (
+            node->children, (node->n_children + 1) * sizeof *node->children);
+         child = &node->children[node->n_children++];
+         memset (child, 0, sizeof *child);
+         child->key = bson_strndup (path, len);
+         child->key_len = len;
+         child->action = dot ? BSON_PROJECTION_NESTED : action;
+      }
+
+      if (!dot) {
+         return true;
+      }
+
+      node = child;
+      path = dot + 1;
+   }
+}
+
+
+static bool
+_bson_projection_compile (bson_projection_t *projection, /* IN */
+                          bson_iter_t       *iter,       /* IN */
+                          const char        *prefix,     /* IN */
+                          bson_error_t      *error)      /* OUT */
+{
+   bson_projection_action_t action;
+   bson_iter_t child;
+   char *path;
+   bool is_id;
+   bool ret = true;
+
+   while (ret && bson_iter_next (iter)) {
+      if (prefix) {
+         path = bson_strdup_printf ("%s.%s", prefix, bson_iter_key (iter));
+      } else {
+         path = bson_strdup (bson_iter_key (iter));
+      }
+
+      if (BSON_ITER_HOLDS_DOCUMENT (iter)) {
+         /* {"a": {"b": 1}} is equivalent to {"a.b": 1} */
+         ret = bson_iter_recurse (iter, &child) &&
+               _bson_projection_compile (projection, &child, path, error);
+         bson_free (path);
+         continue;
+      }
+
+      if (!BSON_ITER_HOLDS_BOOL (iter) &&
+          !BSON_ITER_HOLDS_INT32 (iter) &&
+          !BSON_ITER_HOLDS_INT64 (iter) &&
+          !BSON_ITER_HOLDS_DOUBLE (iter)) {
+         bson_set_error (error,
+                         BSON_ERROR_PROJECTION,
+                         BSON_ERROR_PROJECTION_INVALID,
+                         "Invalid value for \"%s\"", path);
+         bson_free (path);
+         return false;
+      }
+
+      action = bson_iter_as_bool (iter) ? BSON_PROJECTION_INCLUDE
+                                        : BSON_PROJECTION_EXCLUDE;
+      is_id = !strcmp (path, "_id");
+
+      if (is_id && action == BSON_PROJECTION_EXCLUDE) {
+         /* _id may be excluded from an inclusion projection */
+         ret = _bson_projection_add_path (&projection->root, path, action,
+                                          error);
+      } else if (!projection->decided) {
+         projection->decided = true;
+         projection->include = (action == BSON_PROJECTION_INCLUDE);
+      } else if (projection->include != (action == BSON_PROJECTION_INCLUDE)) {
+         bson_set_error (error,
+                         BSON_ERROR_PROJECTION,
+                         BSON_ERROR_PROJECTION_INVALID,
+                         "Cannot mix inclusion and exclusion at \"%s\"",
+                         path);
+         ret = false;
+      }
+
+      /* an included _id is already kept by default */
+      if (ret && !is_id) {
+         ret = _bson_projection_add_path (&projection->root, path, action,
+                                          error);
+      }
+
+      bson_free (path);
+   }
+
+   return ret;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_projection_new --
+ *
+ *       Compile @spec into a bson_projection_t.
+ *
+ *       @spec maps dotted paths to true or 1 to include them, or to false
+ *       or 0 to exclude them; inclusions and exclusions may not be mixed.
+ *       An inclusion projection keeps only the named paths, plus "_id"
+ *       unless @spec excludes it. An exclusion projection keeps every
+ *       path except those named.
+ *
+ *       Nested paths apply to embedded documents, and to each document in
+ *       an embedded array. An inclusion projection drops array elements
+ *       that are not documents.
+ *
+ * Returns:
+ *       A newly allocated bson_projection_t that should be freed with
+ *       bson_projection_destroy(), or NULL and @error is set if @spec is
+ *       invalid.
+ *
+ * Side effects:
+ *       @error may be set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bson_projection_t *
+bson_projection_new (const bson_t *spec,  /* IN */
+                     bson_error_t *error) /* OUT */
+{
+   bson_projection_t *projection;
+   bson_iter_t iter;
+
+   BSON_ASSERT (spec);
+
+   projection = bson_malloc0 (sizeof *projection);
+   projection->root.action = BSON_PROJECTION_NESTED;
+
+   if (!bson_iter_init (&iter, spec)) {
+      bson_set_error (error,
+                      BSON_ERROR_PROJECTION,
+                      BSON_ERROR_PROJECTION_INVALID,
+                      "Invalid projection document");
+      bson_projection_destroy (projection);
+      return NULL;
+   }
+
+   if (!_bson_projection_compile (projection, &iter, NULL, error)) {
+      bson_projection_destroy (projection);
+      return NULL;
+   }
+
+   return projection;
+}
+
+
+void
+bson_projection_destroy (bson_projection_t *projection) /* IN */
+{
+   if (projection) {
+      _bson_projection_node_destroy (&projection->root);
+      bson_free (projection);
+   }
+}
+
+
+static bool
+_bson_projection_apply_doc (const bson_projection_t      *projection,
+                            const bson_projection_node_t *node,
+                            bool                          top,
+                            const uint8_t                *data,
+                            uint32_t                      len,
+                            uint8_t                      *out,
+                            uint32_t                     *pos);
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_projection_apply_array --
+ *
+ *       Apply the paths below @node to each document in the array @data.
+ *       For an inclusion projection, elements that are not documents are
+ *       dropped and the remaining elements renumbered.
+ *
+ * Returns:
+ *       true if successful; false if the array is corrupt.
+ *
+ * Side effects:
+ *       The array is written to @out at @pos, and @pos is advanced.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_bson_projection_apply_array (const bson_projection_t      *projection, /* IN */
+                              const bson_projection_node_t *node,       /* IN */
+                              const uint8_t                *data,       /* IN */
+                              uint32_t                      len,        /* IN */
+                              uint8_t                      *out,        /* IN */
+                              uint32_t                     *pos)        /* IN */
+{
+   bson_iter_t iter;
+   const uint8_t *doc;
+   const char *key;
+   char keybuf[16];
+   uint32_t doc_len;
+   uint32_t start = *pos;
+   uint32_t index = 0;
+   uint32_t le;
+   size_t key_len;
+   bson_t array;
+
+   if (!bson_init_static (&array, data, len) ||
+       !bson_iter_init (&iter, &array)) {
+      return false;
+   }
+
+   *pos += 4;
+
+   while (bson_iter_next (&iter)) {
+      if (!BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+         if (!projection->include) {
+            memcpy (out + *pos, iter.raw + iter.off,
+                    iter.next_off - iter.off);
+            *pos += iter.next_off - iter.off;
+            index++;
+         }
+         continue;
+      }
+
+      key_len = bson_uint32_to_string (index++, &key, keybuf,
+                                       sizeof keybuf);
+
+      /*
+       * Keys of a well-formed array are never shorter than their new
+       * index. Keep any that are, so the output stays within the space
+       * reserved for it.
+       */
+      if (key_len > _bson_iter_key_len (&iter)) {
+         key = bson_iter_key (&iter);
+         key_len = _bson_iter_key_len (&iter);
+      }
+
+      out[(*pos)++] = BSON_TYPE_DOCUMENT;
+      memcpy (out + *pos, key, key_len + 1);
+      *pos += (uint32_t)key_len + 1;
+
+      bson_iter_document (&iter, &doc_len, &doc);
+
+      if (!_bson_projection_apply_doc (projection, node, false, doc,
+                                       doc_len, out, pos)) {
+         return false;
+      }
+   }
+
+   if (iter.err_off) {
+      return false;
+   }
+
+   out[(*pos)++] = '\0';
+   le = BSON_UINT32_TO_LE (*pos - start);
+   memcpy (out + start, &le, sizeof le);
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_projection_apply_doc --
+ *
+ *       Apply the paths below @node to the document @data.
+ *
+ * Returns:
+ *       true if successful; false if the document is corrupt.
+ *
+ * Side effects:
+ *       The document is written to @out at @pos, and @pos is advanced.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_bson_projection_apply_doc (const bson_projection_t      *projection, /* IN */
+                            const bson_projection_node_t *node,       /* IN */
+                            bool                          top,        /* IN */
+                            const uint8_t                *data,       /* IN */
+                            uint32_t                      len,        /* IN */
+                            uint8_t                      *out,        /* IN */
+                            uint32_t                     *pos)        /* IN */
+{
+   const bson_projection_node_t *child;
+   bson_iter_t iter;
+   const uint8_t *sub;
+   const char *key;
+   uint32_t sub_len;
+   uint32_t run_start = 0;
+   uint32_t run_end = 0;
+   uint32_t start = *pos;
+   uint32_t le;
+   bson_t doc;
+   bool keep;
+   bool ret;
+
+   if (!bson_init_static (&doc, data, len) || !bson_iter_init (&iter, &doc)) {
+      return false;
+   }
+
+   *pos += 4;
+
+#define FLUSH_RUN() \
+   do { \
+      if (run_end > run_start) { \
+         memcpy (out + *pos, data + run_start, run_end - run_start); \
+         *pos += run_end - run_start; \
+      } \
+      run_start = run_end = 0; \
+   } while (0)
+
+   while (bson_iter_next (&iter)) {
+      key = bson_iter_key (&iter);
+      child = _bson_projection_node_find (node, key,
+                                          _bson_iter_key_len (&iter));
+
+      if (child && child->action == BSON_PROJECTION_NESTED &&
+          (BSON_ITER_HOLDS_DOCUMENT (&iter) || BSON_ITER_HOLDS_ARRAY (&iter))) {
+         FLUSH_RUN ();
+
+         /* copy the type and key, then rewrite the value */
+         memcpy (out + *pos, data + iter.off, iter.d1 - iter.off);
+         *pos += iter.d1 - iter.off;
+
+         if (BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+            bson_iter_document (&iter, &sub_len, &sub);
+            ret = _bson_projection_apply_doc (projection, child, false, sub,
+                                              sub_len, out, pos);
+         } else {
+            bson_iter_array (&iter, &sub_len, &sub);
+            ret = _bson_projection_apply_array (projection, child, sub,
+                                                sub_len, out, pos);
+         }
+
+         if (!ret) {
+            return false;
+         }
+
+         continue;
+      }
+
+      if (child) {
+         keep = (child->action == BSON_PROJECTION_INCLUDE) ||
+                (child->action == BSON_PROJECTION_NESTED &&
+                 !projection->include);
+      } else {
+         keep = !projection->include || (top && !strcmp (key, "_id"));
+      }
+
+      if (!keep) {
+         FLUSH_RUN ();
+         continue;
+      }
+
+      /* extend the current run, or start a new one */
+      if (run_end != iter.off) {
+         FLUSH_RUN ();
+         run_start = iter.off;
+      }
+
+      run_end = iter.next_off;
+   }
+
+   FLUSH_RUN ();
+
+#undef FLUSH_RUN
+
+   if (iter.err_off) {
+      return false;
+   }
+
+   out[(*pos)++] = '\0';
+   le = BSON_UINT32_TO_LE (*pos - start);
+   memcpy (out + start, &le, sizeof le);
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_projection_apply --
+ *
+ *       Initialize @dst with the fields of @src selected by @projection.
+ *
+ * Parameters:
+ *       @projection: A bson_projection_t.
+ *       @src: The document to project.
+ *       @dst: An uninitialized bson_t.
+ *
+ * Returns:
+ *       true if successful; otherwise false if @src is invalid, in which
+ *       case @dst is initialized as an empty document.
+ *
+ * Side effects:
+ *       @dst is initialized and must be freed with bson_destroy().
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_projection_apply (const bson_projection_t *projection, /* IN */
+                       const bson_t            *src,        /* IN */
+                       bson_t                  *dst)        /* OUT */
+{
+   bson_iter_t iter;
+   uint8_t *out;
+   uint32_t pos = 0;
+
+   BSON_ASSERT (projection);
+   BSON_ASSERT (src);
+   BSON_ASSERT (dst);
+
+   bson_init (dst);
+
+   if (!bson_iter_init (&iter, src)) {
+      return false;
+   }
+
+   if (!(out = bson_reserve_buffer (dst, src->len))) {
+      return false;
+   }
+
+   if (!_bson_projection_apply_doc (projection, &projection->root, true,
+                                    bson_get_data (src), src->len, out,
+                                    &pos)) {
+      bson_destroy (dst);
+      bson_init (dst);
+      return false;
+   }
+
+   BSON_ASSERT (pos <= src->len);
+
+   /* trim the reservation to the projected length */
+   dst->len = pos;
+
+   return true;
+}
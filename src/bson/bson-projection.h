@@ -0,0 +1,60 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef BSON_PROJECTION_H
+#define BSON_PROJECTION_H
+
+
+#if !defined (BSON_INSIDE) && !defined (BSON_COMPILATION)
+# error "Only <bson.h> can be included directly."
+#endif
+
+
+#include "bson-compat.h"
+#include "bson-types.h"
+
+
+BSON_BEGIN_DECLS
+
+
+#define BSON_ERROR_PROJECTION_INVALID 1
+
+
+/**
+ * bson_projection_t:
+ *
+ * A bson_projection_t selects fields of a document, in the style of the
+ * projection argument of MongoDB's find(). It is compiled once from a
+ * specification and may then be applied to many documents.
+ *
+ * A compiled projection is immutable and may be shared between threads.
+ */
+typedef struct _bson_projection_t bson_projection_t;
+
+
+bson_projection_t *bson_projection_new     (const bson_t            *spec,
+                                            bson_error_t            *error);
+bool               bson_projection_apply   (const bson_projection_t *projection,
+                                            const bson_t            *src,
+                                            bson_t                  *dst);
+void               bson_projection_destroy (bson_projection_t       *projection);
+
+
+BSON_END_DECLS
+
+
+#endif /* BSON_PROJECTION_H */
@@ -0,0 +1,1046 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "bson.h"
+
+#include <string.h>
+
+#include "bson-memory.h"
+#include "bson-pull-parser.h"
+
+
+/*
+ * The parser is a state machine that consumes as much of the fed input as
+ * it can, and stops at each event. A field's type, key and any value that
+ * is not sliced are copied to a scratch buffer laid out as a document of
+ * that one field, so that a complete value can be validated and returned
+ * by a bson_iter_t. Slices point into the fed input.
+ *
+ * The end offset of each open document is kept on a stack, and every
+ * length read is checked against the innermost one, so that a corrupt
+ * length is caught before the bytes it claims have arrived.
+ */
+
+
+typedef enum
+{
+   BSON_PULL_STATE_LENGTH,       /* a top-level document's length */
+   BSON_PULL_STATE_TYPE,
+   BSON_PULL_STATE_KEY,
+   BSON_PULL_STATE_CHILD_LENGTH,
+   BSON_PULL_STATE_PREFIX,       /* a value's length prefix */
+   BSON_PULL_STATE_SUBTYPE,      /* a sliced binary's subtype */
+   BSON_PULL_STATE_OLD_LENGTH,   /* the inner length of subtype 2 */
+   BSON_PULL_STATE_VALUE,        /* a value of known length */
+   BSON_PULL_STATE_CSTRING,      /* the cstrings of a regex */
+   BSON_PULL_STATE_SLICE,
+   BSON_PULL_STATE_SLICE_NUL,    /* the NUL after a sliced string */
+   BSON_PULL_STATE_ERROR,
+} bson_pull_state_t;
+
+
+typedef struct
+{
+   uint64_t end;  /* offset of the end of the document */
+   uint8_t  type;
+} bson_pull_level_t;
+
+
+/* the type, then the key, follow the scratch document's length */
+#define BSON_PULL_KEY_OFFSET 5
+
+
+struct _bson_pull_parser_t
+{
+   bson_pull_state_t  state;
+   const uint8_t     *input;
+   size_t             input_len;
+   size_t             input_off;
+   size_t             slice_size;
+   uint8_t           *scratch;
+   size_t             scratch_len;
+   size_t             scratch_alloc;
+   size_t             need;        /* bytes left to read in this state */
+   uint32_t           n_cstrings;  /* cstrings left to read */
+   uint64_t           doc_offset;  /* stream offset of the document */
+   uint64_t           pos;         /* offset within the document */
+   bson_pull_level_t *levels;      /* each open document */
+   uint32_t           depth;
+   uint32_t           levels_alloc;
+   uint8_t            type;
+   uint64_t           remaining;   /* bytes of the sliced value left */
+   bson_pull_event_t  event;
+   uint32_t           event_depth;
+   bool               has_key;
+   bson_value_t       value;
+   bson_iter_t        iter;
+   const uint8_t     *slice;
+   size_t             slice_len;
+   bson_error_t       error;
+};
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_pull_parser_new --
+ *
+ *       Create a new bson_pull_parser_t with no input.
+ *
+ * Returns:
+ *       A newly allocated bson_pull_parser_t that should be freed with
+ *       bson_pull_parser_destroy().
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bson_pull_parser_t *
+bson_pull_parser_new (void)
+{
+   bson_pull_parser_t *parser;
+
+   parser = bson_malloc0 (sizeof *parser);
+   parser->slice_size = BSON_PULL_SLICE_SIZE;
+   parser->scratch_alloc = 64;
+   parser->scratch = bson_malloc (parser->scratch_alloc);
+   parser->levels_alloc = 8;
+   parser->levels = bson_malloc (parser->levels_alloc *
+                                 sizeof *parser->levels);
+   bson_pull_parser_reset (parser);
+
+   return parser;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_pull_parser_destroy --
+ *
+ *       Free a bson_pull_parser_t.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+bson_pull_parser_destroy (bson_pull_parser_t *parser) /* IN */
+{
+   if (parser) {
+      bson_free (parser->scratch);
+      bson_free (parser->levels);
+      bson_free (parser);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_pull_parser_set_slice_size --
+ *
+ *       Set the size above which strings, code, symbols and binaries are
+ *       returned in slices of at most @slice_size bytes, rather than as a
+ *       single BSON_PULL_VALUE. The default is BSON_PULL_SLICE_SIZE.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+bson_pull_parser_set_slice_size (bson_pull_parser_t *parser,     /* IN */
+                                 size_t              slice_size) /* IN */
+{
+   BSON_ASSERT (parser);
+   BSON_ASSERT (slice_size > 0);
+
+   parser->slice_size = slice_size;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_pull_parser_feed --
+ *
+ *       Give the parser its next chunk of input, which may end anywhere
+ *       in a document. Only call this once bson_pull_parser_next() has
+ *       returned BSON_PULL_NEED_INPUT.
+ *
+ *       @data must remain valid until the parser next returns
+ *       BSON_PULL_NEED_INPUT, since slices point into it.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+bson_pull_parser_feed (bson_pull_parser_t *parser, /* IN */
+                       const uint8_t      *data,   /* IN */
+                       size_t              length) /* IN */
+{
+   BSON_ASSERT (parser);
+   BSON_ASSERT (data || !length);
+   BSON_ASSERT (parser->input_off == parser->input_len);
+
+   parser->input = data;
+   parser->input_len = length;
+   parser->input_off = 0;
+}
+
+
+static void
+_bson_pull_append (bson_pull_parser_t *parser, /* IN */
+                   const uint8_t      *data,   /* IN */
+                   size_t              length) /* IN */
+{
+   if (!length) {
+      return;
+   }
+
+   if (parser->scratch_len + length > parser->scratch_alloc) {
+      parser->scratch_alloc = bson_next_power_of_two (parser->scratch_len +
+                                                      length);
+      parser->scratch = bson_realloc (parser->scratch,
+                                      parser->scratch_alloc);
+   }
+
+   memcpy (parser->scratch + parser->scratch_len, data, length);
+   parser->scratch_len += length;
+}
+
+
+/* copies input to the scratch buffer until parser->need bytes are read */
+static bool
+_bson_pull_read (bson_pull_parser_t *parser) /* IN */
+{
+   size_t n;
+
+   n = BSON_MIN (parser->need, parser->input_len - parser->input_off);
+   _bson_pull_append (parser, parser->input + parser->input_off, n);
+   parser->input_off += n;
+   parser->pos += n;
+   parser->need -= n;
+
+   return parser->need == 0;
+}
+
+
+/* copies input up to a NUL byte that must come before the document ends */
+static bool
+_bson_pull_read_cstring (bson_pull_parser_t *parser,  /* IN */
+                         bool               *corrupt) /* OUT */
+{
+   const uint8_t *start = parser->input + parser->input_off;
+   const uint8_t *nul;
+   uint64_t room;
+   size_t n;
+
+   room = parser->levels[parser->depth - 1].end - 1 - parser->pos;
+   n = (size_t)BSON_MIN ((uint64_t)(parser->input_len - parser->input_off),
+                         room);
+   nul = n ? memchr (start, '\0', n) : NULL;
+
+   if (nul) {
+      n = (size_t)(nul - start) + 1;
+   }
+
+   _bson_pull_append (parser, start, n);
+   parser->input_off += n;
+   parser->pos += n;
+   *corrupt = !nul && n == room;
+
+   return nul != NULL;
+}
+
+
+static uint32_t
+_bson_pull_uint32 (const bson_pull_parser_t *parser) /* IN */
+{
+   uint32_t v;
+
+   memcpy (&v, parser->scratch + parser->scratch_len - 4, sizeof v);
+
+   return BSON_UINT32_FROM_LE (v);
+}
+
+
+static bson_pull_event_t
+_bson_pull_corrupt (bson_pull_parser_t *parser, /* IN */
+                    const char         *reason) /* IN */
+{
+   bson_set_error (&parser->error,
+                   BSON_ERROR_PULL,
+                   BSON_ERROR_PULL_CORRUPT,
+                   "Corrupt BSON at offset %" PRIu64 ": %s.",
+                   parser->doc_offset + parser->pos, reason);
+   parser->state = BSON_PULL_STATE_ERROR;
+
+   return BSON_PULL_ERROR;
+}
+
+
+static bson_pull_event_t
+_bson_pull_emit (bson_pull_parser_t *parser,      /* IN */
+                 bson_pull_event_t   event,       /* IN */
+                 uint32_t            event_depth, /* IN */
+                 bool                has_key)     /* IN */
+{
+   parser->event = event;
+   parser->event_depth = event_depth;
+   parser->has_key = has_key;
+
+   return event;
+}
+
+
+/* the value's length if it is fixed, or -1 */
+static int
+_bson_pull_fixed_len (uint8_t type) /* IN */
+{
+   switch (type) {
+   case BSON_TYPE_DOUBLE:
+   case BSON_TYPE_DATE_TIME:
+   case BSON_TYPE_TIMESTAMP:
+   case BSON_TYPE_INT64:
+      return 8;
+   case BSON_TYPE_OID:
+      return 12;
+   case BSON_TYPE_BOOL:
+      return 1;
+   case BSON_TYPE_INT32:
+      return 4;
+   case BSON_TYPE_DECIMAL128:
+      return 16;
+   case BSON_TYPE_UNDEFINED:
+   case BSON_TYPE_NULL:
+   case BSON_TYPE_MAXKEY:
+   case BSON_TYPE_MINKEY:
+      return 0;
+   default:
+      return -1;
+   }
+}
+
+
+static bool
+_bson_pull_is_known_type (uint8_t type) /* IN */
+{
+   switch (type) {
+   case BSON_TYPE_UTF8:
+   case BSON_TYPE_DOCUMENT:
+   case BSON_TYPE_ARRAY:
+   case BSON_TYPE_BINARY:
+   case BSON_TYPE_REGEX:
+   case BSON_TYPE_DBPOINTER:
+   case BSON_TYPE_CODE:
+   case BSON_TYPE_SYMBOL:
+   case BSON_TYPE_CODEWSCOPE:
+      return true;
+   default:
+      return _bson_pull_fixed_len (type) >= 0;
+   }
+}
+
+
+/* sets the state that reads the value of the field whose key was read */
+static bool
+_bson_pull_begin_value (bson_pull_parser_t *parser) /* IN */
+{
+   switch (parser->type) {
+   case BSON_TYPE_DOCUMENT:
+   case BSON_TYPE_ARRAY:
+      parser->state = BSON_PULL_STATE_CHILD_LENGTH;
+      parser->need = 4;
+      break;
+   case BSON_TYPE_UTF8:
+   case BSON_TYPE_CODE:
+   case BSON_TYPE_SYMBOL:
+   case BSON_TYPE_BINARY:
+   case BSON_TYPE_DBPOINTER:
+   case BSON_TYPE_CODEWSCOPE:
+      parser->state = BSON_PULL_STATE_PREFIX;
+      parser->need = 4;
+      break;
+   case BSON_TYPE_REGEX:
+      parser->state = BSON_PULL_STATE_CSTRING;
+      parser->n_cstrings = 2;
+      break;
+   default:
+      parser->state = BSON_PULL_STATE_VALUE;
+      parser->need = (size_t)_bson_pull_fixed_len (parser->type);
+      break;
+   }
+
+   /* a regex's cstrings are checked as they are read */
+   return parser->pos + parser->need <=
+          parser->levels[parser->depth - 1].end - 1;
+}
+
+
+/* sets the state that reads the rest of a length-prefixed value */
+static bson_pull_event_t
+_bson_pull_prefix (bson_pull_parser_t *parser) /* IN */
+{
+   int32_t n = (int32_t)_bson_pull_uint32 (parser);
+   int64_t rest;
+   bool sliced;
+
+   switch (parser->type) {
+   case BSON_TYPE_BINARY:
+      rest = (int64_t)n + 1;
+      break;
+   case BSON_TYPE_DBPOINTER:
+      rest = n < 1 ? -1 : (int64_t)n + 12;
+      break;
+   case BSON_TYPE_CODEWSCOPE:
+      rest = n < 14 ? -1 : (int64_t)n - 4;
+      break;
+   default:
+      rest = n < 1 ? -1 : (int64_t)n;
+      break;
+   }
+
+   if (rest < 1 ||
+       parser->pos + (uint64_t)rest >
+       parser->levels[parser->depth - 1].end - 1) {
+      return _bson_pull_corrupt (parser, "invalid value length");
+   }
+
+   sliced = 4 + (uint64_t)rest > parser->slice_size &&
+            parser->type != BSON_TYPE_DBPOINTER &&
+            parser->type != BSON_TYPE_CODEWSCOPE;
+
+   if (!sliced) {
+      parser->state = BSON_PULL_STATE_VALUE;
+      parser->need = (size_t)rest;
+      return BSON_PULL_NEED_INPUT;
+   }
+
+   memset (&parser->value, 0, sizeof parser->value);
+   parser->value.value_type = (bson_type_t)parser->type;
+
+   switch (parser->type) {
+   case BSON_TYPE_BINARY:
+      /* the subtype is read before the slices begin */
+      parser->value.value.v_binary.data_len = (uint32_t)n;
+      parser->remaining = (uint64_t)n;
+      parser->state = BSON_PULL_STATE_SUBTYPE;
+      parser->need = 1;
+      return BSON_PULL_NEED_INPUT;
+   case BSON_TYPE_CODE:
+      parser->value.value.v_code.code_len = (uint32_t)n - 1;
+      break;
+   case BSON_TYPE_SYMBOL:
+      parser->value.value.v_symbol.len = (uint32_t)n - 1;
+      break;
+   default:
+      parser->value.value.v_utf8.len = (uint32_t)n - 1;
+      break;
+   }
+
+   parser->remaining = (uint64_t)n - 1;
+   parser->state = BSON_PULL_STATE_SLICE;
+
+   return _bson_pull_emit (parser, BSON_PULL_VALUE_BEGIN, parser->depth,
+                           true);
+}
+
+
+/* validates the scratch document of one field and returns its value */
+static bson_pull_event_t
+_bson_pull_finish_value (bson_pull_parser_t *parser) /* IN */
+{
+   const bson_value_t *value;
+   uint32_t len;
+
+   _bson_pull_append (parser, (const uint8_t *)"", 1);
+   len = BSON_UINT32_TO_LE ((uint32_t)parser->scratch_len);
+   memcpy (parser->scratch, &len, sizeof len);
+
+   if (!bson_iter_init_from_data (&parser->iter, parser->scratch,
+                                  parser->scratch_len) ||
+       !bson_iter_next (&parser->iter)) {
+      return _bson_pull_corrupt (parser, "invalid value");
+   }
+
+   /* without BSON_EXPERIMENTAL_FEATURES a decimal128 cannot be boxed */
+   if (!(value = bson_iter_value (&parser->iter))) {
+      return _bson_pull_corrupt (parser, "unsupported type");
+   }
+
+   parser->value = *value;
+   parser->state = BSON_PULL_STATE_TYPE;
+
+   return _bson_pull_emit (parser, BSON_PULL_VALUE, parser->depth, true);
+}
+
+
+static bson_pull_event_t
+_bson_pull_parser_next (bson_pull_parser_t *parser) /* IN */
+{
+   bson_pull_event_t event;
+   uint32_t len;
+   uint64_t start;
+   bool corrupt;
+   uint8_t byte;
+   size_t n;
+
+   parser->event = BSON_PULL_NEED_INPUT;
+
+   for (;;) {
+      switch (parser->state) {
+      case BSON_PULL_STATE_LENGTH:
+         if (!_bson_pull_read (parser)) {
+            goto need_input;
+         }
+
+         len = _bson_pull_uint32 (parser);
+
+         if (len < 5 || len > INT32_MAX) {
+            return _bson_pull_corrupt (parser, "invalid document length");
+         }
+
+         parser->levels[0].end = len;
+         parser->levels[0].type = BSON_TYPE_DOCUMENT;
+         parser->depth = 1;
+         parser->type = BSON_TYPE_DOCUMENT;
+         memset (&parser->value, 0, sizeof parser->value);
+         parser->value.value_type = BSON_TYPE_DOCUMENT;
+         parser->value.value.v_doc.data_len = len;
+         parser->state = BSON_PULL_STATE_TYPE;
+
+         return _bson_pull_emit (parser, BSON_PULL_DOCUMENT_BEGIN, 0, false);
+
+      case BSON_PULL_STATE_TYPE:
+         if (parser->input_off == parser->input_len) {
+            goto need_input;
+         }
+
+         byte = parser->input[parser->input_off++];
+         parser->pos++;
+
+         if (!byte) {
+            if (parser->pos != parser->levels[parser->depth - 1].end) {
+               return _bson_pull_corrupt (parser,
+                                          "document ended before its length");
+            }
+
+            parser->depth--;
+            parser->type = parser->levels[parser->depth].type;
+
+            if (!parser->depth) {
+               parser->doc_offset += parser->pos;
+               parser->pos = 0;
+               parser->scratch_len = 0;
+               parser->need = 4;
+               parser->state = BSON_PULL_STATE_LENGTH;
+            }
+
+            return _bson_pull_emit (parser, BSON_PULL_DOCUMENT_END,
+                                    parser->depth, false);
+         }
+
+         if (parser->pos >= parser->levels[parser->depth - 1].end) {
+            return _bson_pull_corrupt (parser, "missing end of document");
+         }
+
+         if (!_bson_pull_is_known_type (byte)) {
+            return _bson_pull_corrupt (parser, "unknown type");
+         }
+
+         parser->type = byte;
+         parser->scratch_len = 4;
+         _bson_pull_append (parser, &byte, 1);
+         parser->state = BSON_PULL_STATE_KEY;
+         break;
+
+      case BSON_PULL_STATE_KEY:
+         if (!_bson_pull_read_cstring (parser, &corrupt)) {
+            if (corrupt) {
+               return _bson_pull_corrupt (parser, "key is not terminated");
+            }
+
+            goto need_input;
+         }
+
+         if (!_bson_pull_begin_value (parser)) {
+            return _bson_pull_corrupt (parser, "value exceeds document");
+         }
+
+         break;
+
+      case BSON_PULL_STATE_CHILD_LENGTH:
+         if (!_bson_pull_read (parser)) {
+            goto need_input;
+         }
+
+         start = parser->pos - 4;
+         len = _bson_pull_uint32 (parser);
+         parser->scratch_len -= 4;
+
+         if (len < 5 ||
+             start + len > parser->levels[parser->depth - 1].end - 1) {
+            return _bson_pull_corrupt (parser, "invalid document length");
+         }
+
+         if (parser->depth == parser->levels_alloc) {
+            parser->levels_alloc *= 2;
+            parser->levels = bson_realloc (
+               parser->levels,
+               parser->levels_alloc * sizeof *parser->levels);
+         }
+
+         parser->levels[parser->depth].end = start + len;
+         parser->levels[parser->depth].type = parser->type;
+         parser->depth++;
+         memset (&parser->value, 0, sizeof parser->value);
+         parser->value.value_type = (bson_type_t)parser->type;
+         parser->value.value.v_doc.data_len = len;
+         parser->state = BSON_PULL_STATE_TYPE;
+
+         return _bson_pull_emit (parser, BSON_PULL_DOCUMENT_BEGIN,
+                                 parser->depth - 1, true);
+
+      case BSON_PULL_STATE_PREFIX:
+         if (!_bson_pull_read (parser)) {
+            goto need_input;
+         }
+
+         if ((event = _bson_pull_prefix (parser)) != BSON_PULL_NEED_INPUT) {
+            return event;
+         }
+
+         break;
+
+      case BSON_PULL_STATE_SUBTYPE:
+         if (!_bson_pull_read (parser)) {
+            goto need_input;
+         }
+
+         parser->value.value.v_binary.subtype =
+            (bson_subtype_t)parser->scratch[parser->scratch_len - 1];
+
+         if (parser->value.value.v_binary.subtype ==
+             BSON_SUBTYPE_BINARY_DEPRECATED) {
+            /* sliced like the value bson_iter_binary() returns */
+            parser->state = BSON_PULL_STATE_OLD_LENGTH;
+            parser->need = 4;
+            break;
+         }
+
+         parser->state = BSON_PULL_STATE_SLICE;
+
+         return _bson_pull_emit (parser, BSON_PULL_VALUE_BEGIN,
+                                 parser->depth, true);
+
+      case BSON_PULL_STATE_OLD_LENGTH:
+         if (!_bson_pull_read (parser)) {
+            goto need_input;
+         }
+
+         if (parser->remaining < 4 ||
+             _bson_pull_uint32 (parser) != parser->remaining - 4) {
+            return _bson_pull_corrupt (parser, "invalid value length");
+         }
+
+         parser->remaining -= 4;
+         parser->value.value.v_binary.data_len = (uint32_t)parser->remaining;
+         parser->state = BSON_PULL_STATE_SLICE;
+
+         return _bson_pull_emit (parser, BSON_PULL_VALUE_BEGIN,
+                                 parser->depth, true);
+
+      case BSON_PULL_STATE_VALUE:
+         if (!_bson_pull_read (parser)) {
+            goto need_input;
+         }
+
+         return _bson_pull_finish_value (parser);
+
+      case BSON_PULL_STATE_CSTRING:
+         if (!_bson_pull_read_cstring (parser, &corrupt)) {
+            if (corrupt) {
+               return _bson_pull_corrupt (parser, "regex is not terminated");
+            }
+
+            goto need_input;
+         }
+
+         if (!--parser->n_cstrings) {
+            return _bson_pull_finish_value (parser);
+         }
+
+         break;
+
+      case BSON_PULL_STATE_SLICE:
+         if (!parser->remaining) {
+            if (parser->type == BSON_TYPE_BINARY) {
+               parser->state = BSON_PULL_STATE_TYPE;
+               return _bson_pull_emit (parser, BSON_PULL_VALUE_END,
+                                       parser->depth, true);
+            }
+
+            parser->state = BSON_PULL_STATE_SLICE_NUL;
+            break;
+         }
+
+         if (parser->input_off == parser->input_len) {
+            goto need_input;
+         }
+
+         n = (size_t)BSON_MIN ((uint64_t)(parser->input_len -
+                                          parser->input_off),
+                               parser->remaining);
+         n = BSON_MIN (n, parser->slice_size);
+         parser->slice = parser->input + parser->input_off;
+         parser->slice_len = n;
+         parser->input_off += n;
+         parser->pos += n;
+         parser->remaining -= n;
+
+         return _bson_pull_emit (parser, BSON_PULL_VALUE_SLICE,
+                                 parser->depth, true);
+
+      case BSON_PULL_STATE_SLICE_NUL:
+         if (parser->input_off == parser->input_len) {
+            goto need_input;
+         }
+
+         parser->pos++;
+
+         if (parser->input[parser->input_off++] != '\0') {
+            return _bson_pull_corrupt (parser, "string is not terminated");
+         }
+
+         parser->state = BSON_PULL_STATE_TYPE;
+
+         return _bson_pull_emit (parser, BSON_PULL_VALUE_END, parser->depth,
+                                 true);
+
+      case BSON_PULL_STATE_ERROR:
+      default:
+         return BSON_PULL_ERROR;
+      }
+   }
+
+need_input:
+   /* the depth is only 0 between documents */
+   parser->event_depth = parser->depth +
+                         (parser->state == BSON_PULL_STATE_LENGTH &&
+                          parser->scratch_len > 0);
+   parser->has_key = false;
+
+   return BSON_PULL_NEED_INPUT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_pull_parser_next --
+ *
+ *       Parse the input fed so far until the next event.
+ *
+ *       BSON_PULL_DOCUMENT_BEGIN is returned for each top-level document,
+ *       embedded document and array, as soon as its length has been read,
+ *       and BSON_PULL_DOCUMENT_END after its last field. BSON_PULL_VALUE
+ *       is returned for each other field once its value is complete.
+ *
+ *       Strings, code, symbols and binaries longer than the slice size
+ *       are returned as a BSON_PULL_VALUE_BEGIN, then a
+ *       BSON_PULL_VALUE_SLICE for each part of the value, pointing into
+ *       the fed input, then a BSON_PULL_VALUE_END.
+ *
+ *       BSON_PULL_NEED_INPUT is returned once the input has been
+ *       consumed, and BSON_PULL_ERROR if it is corrupt, after which the
+ *       parser must be reset.
+ *
+ * Returns:
+ *       The next event.
+ *
+ * Side effects:
+ *       @error is set if BSON_PULL_ERROR is returned.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bson_pull_event_t
+bson_pull_parser_next (bson_pull_parser_t *parser, /* IN */
+                       bson_error_t       *error)  /* OUT */
+{
+   BSON_ASSERT (parser);
+
+   if (_bson_pull_parser_next (parser) == BSON_PULL_ERROR) {
+      parser->event = BSON_PULL_ERROR;
+
+      if (error) {
+         memcpy (error, &parser->error, sizeof *error);
+      }
+
+      return BSON_PULL_ERROR;
+   }
+
+   return parser->event;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_pull_parser_get_depth --
+ *
+ *       Get the number of documents enclosing the current event's field,
+ *       which is 0 for a top-level document. After BSON_PULL_NEED_INPUT
+ *       it is the number of documents open, so it is 0 only if the input
+ *       ended between documents.
+ *
+ * Returns:
+ *       The depth.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+uint32_t
+bson_pull_parser_get_depth (const bson_pull_parser_t *parser) /* IN */
+{
+   BSON_ASSERT (parser);
+
+   return parser->event_depth;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_pull_parser_get_key --
+ *
+ *       Get the key of the current event's field, which is valid until
+ *       the next call to bson_pull_parser_next(). Top-level documents and
+ *       BSON_PULL_DOCUMENT_END events have no key.
+ *
+ * Returns:
+ *       The key, or NULL.
+ *
+ * Side effects:
+ *       @key_len is set to the key's length if not NULL.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+const char *
+bson_pull_parser_get_key (const bson_pull_parser_t *parser,  /* IN */
+                          uint32_t                 *key_len) /* OUT */
+{
+   const char *key;
+
+   BSON_ASSERT (parser);
+
+   if (!parser->has_key) {
+      if (key_len) {
+         *key_len = 0;
+      }
+
+      return NULL;
+   }
+
+   key = (const char *)parser->scratch + BSON_PULL_KEY_OFFSET;
+
+   if (key_len) {
+      *key_len = (uint32_t)strlen (key);
+   }
+
+   return key;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_pull_parser_get_type --
+ *
+ *       Get the type of the current event's field or document.
+ *
+ * Returns:
+ *       A bson_type_t, or BSON_TYPE_EOD if the event has no field.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bson_type_t
+bson_pull_parser_get_type (const bson_pull_parser_t *parser) /* IN */
+{
+   BSON_ASSERT (parser);
+
+   switch (parser->event) {
+   case BSON_PULL_DOCUMENT_BEGIN:
+   case BSON_PULL_DOCUMENT_END:
+   case BSON_PULL_VALUE:
+   case BSON_PULL_VALUE_BEGIN:
+   case BSON_PULL_VALUE_SLICE:
+   case BSON_PULL_VALUE_END:
+      return (bson_type_t)parser->type;
+   case BSON_PULL_NEED_INPUT:
+   case BSON_PULL_ERROR:
+   default:
+      return BSON_TYPE_EOD;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_pull_parser_get_value --
+ *
+ *       Get the value of a BSON_PULL_VALUE event, which points into the
+ *       parser and is valid until the next call to
+ *       bson_pull_parser_next().
+ *
+ *       For BSON_PULL_DOCUMENT_BEGIN and BSON_PULL_VALUE_BEGIN events the
+ *       value has the length of the document or value, and the subtype of
+ *       a binary, but its data is NULL.
+ *
+ * Returns:
+ *       true if successful; false if the event has no value.
+ *
+ * Side effects:
+ *       @value is initialized if successful. It needs no cleanup.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_pull_parser_get_value (const bson_pull_parser_t *parser, /* IN */
+                            bson_value_t             *value)  /* OUT */
+{
+   BSON_ASSERT (parser);
+   BSON_ASSERT (value);
+
+   switch (parser->event) {
+   case BSON_PULL_DOCUMENT_BEGIN:
+   case BSON_PULL_VALUE:
+   case BSON_PULL_VALUE_BEGIN:
+      *value = parser->value;
+      return true;
+   case BSON_PULL_NEED_INPUT:
+   case BSON_PULL_DOCUMENT_END:
+   case BSON_PULL_VALUE_SLICE:
+   case BSON_PULL_VALUE_END:
+   case BSON_PULL_ERROR:
+   default:
+      return false;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_pull_parser_get_slice --
+ *
+ *       Get the bytes of a BSON_PULL_VALUE_SLICE event: part of a string,
+ *       excluding its NUL terminator, or of a binary, excluding its
+ *       subtype. They point into the fed input.
+ *
+ * Returns:
+ *       The slice, or NULL if the event is not a slice.
+ *
+ * Side effects:
+ *       @length is set to the length of the slice.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+const uint8_t *
+bson_pull_parser_get_slice (const bson_pull_parser_t *parser, /* IN */
+                            size_t                   *length) /* OUT */
+{
+   BSON_ASSERT (parser);
+   BSON_ASSERT (length);
+
+   if (parser->event != BSON_PULL_VALUE_SLICE) {
+      *length = 0;
+      return NULL;
+   }
+
+   *length = parser->slice_len;
+
+   return parser->slice;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_pull_parser_reset --
+ *
+ *       Discard the parser's input and state, as at the start of a new
+ *       stream. This recovers the parser after BSON_PULL_ERROR.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+bson_pull_parser_reset (bson_pull_parser_t *parser) /* IN */
+{
+   BSON_ASSERT (parser);
+
+   parser->state = BSON_PULL_STATE_LENGTH;
+   parser->input = NULL;
+   parser->input_len = 0;
+   parser->input_off = 0;
+   parser->scratch_len = 0;
+   parser->need = 4;
+   parser->doc_offset = 0;
+   parser->pos = 0;
+   parser->depth = 0;
+   parser->event = BSON_PULL_NEED_INPUT;
+   parser->event_depth = 0;
+   parser->has_key = false;
+   memset (&parser->error, 0, sizeof parser->error);
+}
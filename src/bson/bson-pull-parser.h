@@ -0,0 +1,96 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef BSON_PULL_PARSER_H
+#define BSON_PULL_PARSER_H
+
+
+#if !defined (BSON_INSIDE) && !defined (BSON_COMPILATION)
+# error "Only <bson.h> can be included directly."
+#endif
+
+
+#include "bson-compat.h"
+#include "bson-types.h"
+
+
+BSON_BEGIN_DECLS
+
+
+#define BSON_ERROR_PULL_CORRUPT 1
+
+
+/*
+ * Strings and binaries longer than this are returned in slices by
+ * default, rather than buffered as a whole.
+ */
+#define BSON_PULL_SLICE_SIZE 4096
+
+
+/**
+ * bson_pull_event_t:
+ *
+ * The events returned by bson_pull_parser_next().
+ */
+typedef enum
+{
+   BSON_PULL_NEED_INPUT,     /* every byte fed has been consumed */
+   BSON_PULL_DOCUMENT_BEGIN, /* a document, embedded document or array */
+   BSON_PULL_DOCUMENT_END,
+   BSON_PULL_VALUE,          /* any other complete field */
+   BSON_PULL_VALUE_BEGIN,    /* a field returned in slices begins */
+   BSON_PULL_VALUE_SLICE,
+   BSON_PULL_VALUE_END,
+   BSON_PULL_ERROR,
+} bson_pull_event_t;
+
+
+/**
+ * bson_pull_parser_t:
+ *
+ * A resumable parser for a stream of BSON documents that is fed input in
+ * chunks of any size and returns an event for each document and field as
+ * soon as it has arrived. Only keys and small values are buffered, so its
+ * memory use does not depend on the size of the documents.
+ */
+typedef struct _bson_pull_parser_t bson_pull_parser_t;
+
+
+bson_pull_parser_t *bson_pull_parser_new            (void);
+void                bson_pull_parser_destroy        (bson_pull_parser_t       *parser);
+void                bson_pull_parser_set_slice_size (bson_pull_parser_t       *parser,
+                                                     size_t                    slice_size);
+void                bson_pull_parser_feed           (bson_pull_parser_t       *parser,
+                                                     const uint8_t            *data,
+                                                     size_t                    length);
+bson_pull_event_t   bson_pull_parser_next           (bson_pull_parser_t       *parser,
+                                                     bson_error_t             *error);
+uint32_t            bson_pull_parser_get_depth      (const bson_pull_parser_t *parser);
+const char         *bson_pull_parser_get_key        (const bson_pull_parser_t *parser,
+                                                     uint32_t                 *key_len);
+bson_type_t         bson_pull_parser_get_type       (const bson_pull_parser_t *parser);
+bool                bson_pull_parser_get_value      (const bson_pull_parser_t *parser,
+                                                     bson_value_t             *value);
+const uint8_t      *bson_pull_parser_get_slice      (const bson_pull_parser_t *parser,
+                                                     size_t                   *length);
+void                bson_pull_parser_reset          (bson_pull_parser_t       *parser);
+
+
+BSON_END_DECLS
+
+
+#endif /* BSON_PULL_PARSER_H */
@@ -27,8 +27,11 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include "bson-batch-private.h"
 #include "bson-reader.h"
 #include "bson-memory.h"
+#include "bson-stats-private.h"
+#include "bson-trace-private.h"
 
 
 typedef enum
@@ -42,8 +45,11 @@ typedef struct
 {
    bson_reader_type_t         type;
    void                      *handle;
-   bool                       done   : 1;
-   bool                       failed : 1;
+   bool                       done        : 1;
+   bool                       failed      : 1;
+   bool                       nonblocking : 1;
+   bool                       would_block : 1;
+   bool                       eof_pending : 1;
    size_t                     end;
    size_t                     len;
    size_t                     offset;
@@ -59,9 +65,16 @@ typedef struct
 {
    int fd;
    bool do_close;
+   bool nonblocking;
+   bool would_block;  /* the last read found no data available */
 } bson_reader_handle_fd_t;
 
 
+static ssize_t _bson_reader_handle_fd_read (void   *handle,
+                                            void   *buf,
+                                            size_t  len);
+
+
 typedef struct
 {
    bson_reader_type_t type;
@@ -72,6 +85,36 @@ typedef struct
 } bson_reader_data_t;
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_reader_handle_read_would_block --
+ *
+ *       Check whether the read function of @reader that returned -1
+ *       failed only because no data was available yet. A reader created
+ *       with bson_reader_new_from_fd() records this as it reads, so the
+ *       answer does not depend on errno surviving until now.
+ *
+ * Returns:
+ *       true if the read would have blocked.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_bson_reader_handle_read_would_block (bson_reader_handle_t *reader) /* IN */
+{
+   if (reader->read_func == _bson_reader_handle_fd_read) {
+      return ((bson_reader_handle_fd_t *)reader->handle)->would_block;
+   }
+
+   return _bson_would_block ();
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -81,6 +124,10 @@ typedef struct
  *       in @reader is filled or we have reached end-of-stream or
  *       read failure.
  *
+ *       A non-blocking reader whose read function would block, or that
+ *       has no read function and is waiting for bson_reader_feed(),
+ *       keeps its buffer and sets @reader->would_block instead.
+ *
  * Returns:
  *       None.
  *
@@ -95,12 +142,25 @@ _bson_reader_handle_fill_buffer (bson_reader_handle_t *reader) /* IN */
 {
    ssize_t ret;
 
+   if (!reader->read_func) {
+      /* the buffer holds no complete document, so a fed end is reached */
+      reader->done = reader->done || reader->eof_pending;
+      reader->would_block = !reader->done;
+      return;
+   }
+
    /*
     * Handle first read specially.
     */
    if ((!reader->done) && (!reader->offset) && (!reader->end)) {
       ret = reader->read_func (reader->handle, &reader->data[0], reader->len);
 
+      if (ret < 0 && reader->nonblocking &&
+          _bson_reader_handle_read_would_block (reader)) {
+         reader->would_block = true;
+         return;
+      }
+
       if (ret <= 0) {
          reader->done = true;
          return;
@@ -127,7 +187,10 @@ _bson_reader_handle_fill_buffer (bson_reader_handle_t *reader) /* IN */
                             &reader->data[reader->end],
                             reader->len - reader->end);
 
-   if (ret <= 0) {
+   if (ret < 0 && reader->nonblocking &&
+       _bson_reader_handle_read_would_block (reader)) {
+      reader->would_block = true;
+   } else if (ret <= 0) {
       reader->done = true;
       reader->failed = (ret < 0);
    } else {
@@ -186,8 +249,8 @@ bson_reader_new_from_handle (void                       *handle,
       bson_reader_set_destroy_func ((bson_reader_t *)real, df);
    }
 
-   _bson_reader_handle_fill_buffer (real);
-
+   /* the first read is deferred so that a non-blocking reader can be
+    * created before data is available */
    return (bson_reader_t *)real;
 }
 
@@ -257,6 +320,10 @@ _bson_reader_handle_fd_read (void   *handle, /* IN */
    bson_reader_handle_fd_t *fd = handle;
    ssize_t ret = -1;
 
+   if (fd) {
+      fd->would_block = false;
+   }
+
    if (fd && (fd->fd != -1)) {
    again:
 #ifdef BSON_OS_WIN32
@@ -264,8 +331,12 @@ _bson_reader_handle_fd_read (void   *handle, /* IN */
 #else
       ret = read (fd->fd, buf, len);
 #endif
-      if ((ret == -1) && (errno == EAGAIN)) {
-         goto again;
+      if ((ret == -1) && _bson_would_block ()) {
+         if (!fd->nonblocking) {
+            goto again;
+         }
+
+         fd->would_block = true;
       }
    }
 
@@ -401,13 +472,184 @@ static void
 _bson_reader_handle_grow_buffer (bson_reader_handle_t *reader) /* IN */
 {
    size_t size;
+   int64_t start;
 
+   start = BSON_PROBE_CLOCK (reader__grow);
    size = reader->len * 2;
    reader->data = bson_realloc (reader->data, size);
+   BSON_PROBE3 (reader__grow, reader->len, size, BSON_PROBE_ELAPSED (start));
    reader->len = size;
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_reader_new_from_feed --
+ *
+ *       Create a new bson_reader_t that reads the data given to it with
+ *       bson_reader_feed(), for callers that do their own I/O such as an
+ *       event loop. It is non-blocking: bson_reader_read() returns NULL
+ *       and bson_reader_would_block() returns true when the next document
+ *       has not been fed in full.
+ *
+ * Returns:
+ *       A newly allocated bson_reader_t that should be freed with
+ *       bson_reader_destroy().
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bson_reader_t *
+bson_reader_new_from_feed (void)
+{
+   bson_reader_handle_t *real;
+
+   real = bson_malloc0 (sizeof *real);
+   real->type = BSON_READER_HANDLE;
+   real->data = bson_malloc0 (1024);
+   real->len = 1024;
+   real->nonblocking = true;
+
+   return (bson_reader_t *)real;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_reader_feed --
+ *
+ *       Append @length bytes of the stream to a reader created with
+ *       bson_reader_new_from_feed(). The bytes are copied, and may end
+ *       anywhere in a document. Feeding 0 bytes marks the end of the
+ *       stream, as a read() of 0 bytes would. Documents fed before the
+ *       end are still returned by bson_reader_read().
+ *
+ *       The document last returned by bson_reader_read() is invalidated.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+bson_reader_feed (bson_reader_t *reader, /* IN */
+                  const uint8_t *data,   /* IN */
+                  size_t         length) /* IN */
+{
+   bson_reader_handle_t *real = (bson_reader_handle_t *)reader;
+
+   BSON_ASSERT (reader);
+   BSON_ASSERT (reader->type == BSON_READER_HANDLE);
+   BSON_ASSERT (!real->read_func);
+   BSON_ASSERT (data || !length);
+
+   if (!length) {
+      /* documents already fed are still read before the end */
+      real->eof_pending = true;
+      return;
+   }
+
+   /*
+    * Discard the documents already read, then make room.
+    */
+   memmove (&real->data[0],
+            &real->data[real->offset],
+            real->end - real->offset);
+   real->end -= real->offset;
+   real->offset = 0;
+
+   while (real->len - real->end < length) {
+      _bson_reader_handle_grow_buffer (real);
+   }
+
+   memcpy (&real->data[real->end], data, length);
+   real->end += length;
+   real->bytes_read += length;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_reader_set_nonblocking --
+ *
+ *       Set whether a read function returning -1 with errno set to EAGAIN
+ *       or EWOULDBLOCK means that no data is available yet, rather than
+ *       failure. A non-blocking reader keeps the part of a document it
+ *       has read, bson_reader_read() returns NULL with
+ *       bson_reader_would_block() true, and the read is resumed by the
+ *       next call to bson_reader_read().
+ *
+ *       By default a reader created with bson_reader_new_from_fd() retries
+ *       the read, which spins on a descriptor with O_NONBLOCK set.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+bson_reader_set_nonblocking (bson_reader_t *reader,      /* IN */
+                             bool           nonblocking) /* IN */
+{
+   bson_reader_handle_t *real = (bson_reader_handle_t *)reader;
+
+   BSON_ASSERT (reader);
+   BSON_ASSERT (reader->type == BSON_READER_HANDLE);
+
+   real->nonblocking = nonblocking;
+
+   if (real->read_func == _bson_reader_handle_fd_read) {
+      ((bson_reader_handle_fd_t *)real->handle)->nonblocking = nonblocking;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_reader_would_block --
+ *
+ *       Check whether the last call to bson_reader_read() returned NULL
+ *       because the rest of the stream has not arrived yet. Wait until
+ *       the underlying descriptor is readable, or call bson_reader_feed(),
+ *       then call bson_reader_read() again.
+ *
+ * Returns:
+ *       true if a non-blocking reader needs more data.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_reader_would_block (const bson_reader_t *reader) /* IN */
+{
+   BSON_ASSERT (reader);
+
+   if (reader->type != BSON_READER_HANDLE) {
+      return false;
+   }
+
+   return ((const bson_reader_handle_t *)reader)->would_block;
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -462,12 +704,16 @@ _bson_reader_handle_read (bson_reader_handle_t *reader,      /* IN */
                           bool                 *reached_eof) /* IN */
 {
    int32_t blen;
+   int64_t start;
 
    if (reached_eof) {
       *reached_eof = false;
    }
 
-   while (!reader->done) {
+   reader->would_block = false;
+   start = BSON_PROBE_CLOCK (reader__document);
+
+   while (!reader->done && !reader->would_block) {
       if ((reader->end - reader->offset) < 4) {
          _bson_reader_handle_fill_buffer (reader);
          continue;
@@ -495,6 +741,9 @@ _bson_reader_handle_read (bson_reader_handle_t *reader,      /* IN */
          return NULL;
       }
 
+      BSON_PROBE3 (reader__document, _bson_reader_handle_tell (reader), blen,
+                   BSON_PROBE_ELAPSED (start));
+
       reader->offset += blen;
 
       return &reader->inline_bson;
@@ -710,21 +959,34 @@ const bson_t *
 bson_reader_read (bson_reader_t *reader,      /* IN */
                   bool          *reached_eof) /* OUT */
 {
+   const bson_t *b = NULL;
+   int64_t stats_start;
+
    BSON_ASSERT (reader);
 
+   stats_start = _bson_stats_start ();
+
    switch (reader->type) {
    case BSON_READER_HANDLE:
-      return _bson_reader_handle_read ((bson_reader_handle_t *)reader, reached_eof);
+      b = _bson_reader_handle_read ((bson_reader_handle_t *)reader,
+                                    reached_eof);
+      break;
 
    case BSON_READER_DATA:
-      return _bson_reader_data_read ((bson_reader_data_t *)reader, reached_eof);
+      b = _bson_reader_data_read ((bson_reader_data_t *)reader, reached_eof);
+      break;
 
    default:
       fprintf (stderr, "No such reader type: %02x\n", reader->type);
       break;
    }
 
-   return NULL;
+   /* only calls that return a document are timed */
+   if (b) {
+      _bson_stats_end (BSON_STATS_READER_READ, b->len, stats_start);
+   }
+
+   return b;
 }
 
 
@@ -837,3 +1099,424 @@ bson_reader_reset (bson_reader_t *reader)
 
    real->offset = 0;
 }
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_reader_resync_check --
+ *
+ *       Check whether @buf begins a plausible chain of BSON documents.
+ *
+ *       A candidate must have a length prefix in the range
+ *       [5, BSON_READER_RESYNC_MAX_SIZE], a known element type (or the
+ *       terminating NUL for an empty document) in its first field, a
+ *       trailing NUL byte, and must pass structural validation. The
+ *       bytes following the candidate must in turn look like a document
+ *       until BSON_READER_RESYNC_CHAIN documents have been checked or the
+ *       candidate ends exactly at end of stream.
+ *
+ * Parameters:
+ *       @buf: The bytes available at the candidate offset.
+ *       @len: The number of bytes in @buf.
+ *       @eof: If no more bytes will follow @buf.
+ *       @depth: The position of this candidate within the chain.
+ *       @needed: (out): Bytes needed from @buf to decide, if -1 is
+ *          returned.
+ *
+ * Returns:
+ *       1 if the candidate is plausible, 0 if it is not, or -1 if more
+ *       data is required to decide.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static int
+_bson_reader_resync_check (const uint8_t *buf,    /* IN */
+                           size_t         len,    /* IN */
+                           bool           eof,    /* IN */
+                           int            depth,  /* IN */
+                           size_t        *needed) /* OUT */
+{
+   bson_t b;
+   int32_t blen;
+   int ret;
+
+   if (len < 5) {
+      if (eof) {
+         /* a chain that ends exactly at end of stream is complete */
+         return (depth > 0 && len == 0) ? 1 : 0;
+      }
+
+      *needed = 5;
+      return -1;
+   }
+
+   memcpy (&blen, buf, sizeof blen);
+   blen = BSON_UINT32_FROM_LE (blen);
+
+   if (blen < 5 || blen > BSON_READER_RESYNC_MAX_SIZE) {
+      return 0;
+   }
+
+   switch (buf[4]) {
+   case BSON_TYPE_EOD:
+      if (blen != 5) {
+         return 0;
+      }
+      break;
+   case BSON_TYPE_DOUBLE:
+   case BSON_TYPE_UTF8:
+   case BSON_TYPE_DOCUMENT:
+   case BSON_TYPE_ARRAY:
+   case BSON_TYPE_BINARY:
+   case BSON_TYPE_UNDEFINED:
+   case BSON_TYPE_OID:
+   case BSON_TYPE_BOOL:
+   case BSON_TYPE_DATE_TIME:
+   case BSON_TYPE_NULL:
+   case BSON_TYPE_REGEX:
+   case BSON_TYPE_DBPOINTER:
+   case BSON_TYPE_CODE:
+   case BSON_TYPE_SYMBOL:
+   case BSON_TYPE_CODEWSCOPE:
+   case BSON_TYPE_INT32:
+   case BSON_TYPE_TIMESTAMP:
+   case BSON_TYPE_INT64:
+   case BSON_TYPE_DECIMAL128:
+   case BSON_TYPE_MAXKEY:
+   case BSON_TYPE_MINKEY:
+      break;
+   default:
+      return 0;
+   }
+
+   if ((size_t)blen > len) {
+      if (eof) {
+         return 0;
+      }
+
+      *needed = (size_t)blen;
+      return -1;
+   }
+
+   if (buf[blen - 1] != '\0') {
+      return 0;
+   }
+
+   if (!bson_init_static (&b, buf, (uint32_t)blen) ||
+       !bson_validate (&b, BSON_VALIDATE_NONE, NULL)) {
+      return 0;
+   }
+
+   if (depth + 1 >= BSON_READER_RESYNC_CHAIN) {
+      return 1;
+   }
+
+   ret = _bson_reader_resync_check (buf + blen, len - blen, eof, depth + 1,
+                                    needed);
+
+   if (ret == -1) {
+      *needed += (size_t)blen;
+   }
+
+   return ret;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_reader_handle_seek --
+ *
+ *       Reposition @reader so that the next byte consumed is at @offset
+ *       within the underlying stream.
+ *
+ *       Readers created with bson_reader_new_from_fd() are repositioned
+ *       with lseek(). Other handles cannot seek, so they may only move
+ *       forward by reading and discarding data.
+ *
+ * Returns:
+ *       true if @reader is now positioned at @offset; otherwise false.
+ *
+ * Side effects:
+ *       Buffered data is discarded.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_bson_reader_handle_seek (bson_reader_handle_t *reader, /* IN */
+                          off_t                 offset) /* IN */
+{
+   bson_reader_handle_fd_t *fd;
+   size_t avail;
+   off_t skip;
+
+   if (reader->read_func == _bson_reader_handle_fd_read) {
+      fd = reader->handle;
+
+#ifdef BSON_OS_WIN32
+      if (_lseek (fd->fd, offset, SEEK_SET) == -1) {
+#else
+      if (lseek (fd->fd, offset, SEEK_SET) == -1) {
+#endif
+         return false;
+      }
+
+      reader->done = false;
+      reader->failed = false;
+      reader->offset = 0;
+      reader->end = 0;
+      reader->bytes_read = (size_t)offset;
+
+      _bson_reader_handle_fill_buffer (reader);
+
+      return true;
+   }
+
+   skip = offset - _bson_reader_handle_tell (reader);
+
+   if (skip < 0) {
+      return false;
+   }
+
+   while (skip) {
+      avail = reader->end - reader->offset;
+
+      if (!avail) {
+         if (reader->done || reader->would_block) {
+            return false;
+         }
+
+         _bson_reader_handle_fill_buffer (reader);
+         continue;
+      }
+
+      avail = BSON_MIN (avail, (size_t)skip);
+      reader->offset += avail;
+      skip -= (off_t)avail;
+   }
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_reader_handle_resync --
+ *
+ *       Scan forward from the current position of @reader to the next
+ *       plausible document boundary, buffering as much of the stream as
+ *       is needed to validate each candidate chain.
+ *
+ * Returns:
+ *       true if a boundary was found; otherwise false.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_bson_reader_handle_resync (bson_reader_handle_t *reader) /* IN */
+{
+   size_t needed = 0;
+   size_t avail;
+   int r;
+
+   for (;;) {
+      avail = reader->end - reader->offset;
+
+      r = _bson_reader_resync_check (&reader->data[reader->offset], avail,
+                                     reader->done, 0, &needed);
+
+      if (r == 1) {
+         return true;
+      }
+
+      if (r == 0) {
+         if (!avail) {
+            return false;
+         }
+
+         reader->offset++;
+         continue;
+      }
+
+      while (needed > reader->len) {
+         _bson_reader_handle_grow_buffer (reader);
+      }
+
+      if (reader->would_block) {
+         return false;
+      }
+
+      _bson_reader_handle_fill_buffer (reader);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_reader_seek_resync --
+ *
+ *       Position @reader at the first plausible document boundary at or
+ *       after @offset within the underlying stream.
+ *
+ *       BSON streams are framed only by the length prefix of each
+ *       document, so an arbitrary offset usually falls inside a document.
+ *       Candidates are found with length-prefix and trailing-NUL
+ *       heuristics and accepted only once a chain of
+ *       BSON_READER_RESYNC_CHAIN documents validates. This allows byte
+ *       ranges of a large file to be scanned independently.
+ *
+ *       Readers created with bson_reader_new_from_data() and
+ *       bson_reader_new_from_fd() can seek to any offset. Other handle
+ *       based readers can only move forward from bson_reader_tell().
+ *
+ * Returns:
+ *       true if @reader is positioned at a document boundary, which may
+ *       be queried with bson_reader_tell(); otherwise false if no
+ *       boundary exists before end of stream or @offset is unreachable.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_reader_seek_resync (bson_reader_t *reader, /* IN */
+                         off_t          offset) /* IN */
+{
+   BSON_ASSERT (reader);
+
+   if (offset < 0) {
+      return false;
+   }
+
+   switch (reader->type) {
+   case BSON_READER_HANDLE:
+      {
+         bson_reader_handle_t *real = (bson_reader_handle_t *)reader;
+
+         real->would_block = false;
+
+         if (!_bson_reader_handle_seek (real, offset)) {
+            return false;
+         }
+
+         return _bson_reader_handle_resync (real);
+      }
+
+   case BSON_READER_DATA:
+      {
+         bson_reader_data_t *real = (bson_reader_data_t *)reader;
+         size_t needed;
+
+         if ((size_t)offset > real->length) {
+            return false;
+         }
+
+         for (real->offset = (size_t)offset;
+              real->offset < real->length;
+              real->offset++) {
+            if (_bson_reader_resync_check (&real->data[real->offset],
+                                           real->length - real->offset,
+                                           true, 0, &needed) == 1) {
+               return true;
+            }
+         }
+
+         return false;
+      }
+
+   default:
+      fprintf (stderr, "No such reader type: %02x\n", reader->type);
+      return false;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_partition_file --
+ *
+ *       Split the file at @path into @n_parts byte ranges that each start
+ *       on a document boundary, so that each range may be scanned by a
+ *       separate thread or process.
+ *
+ *       @offsets must have room for @n_parts + 1 entries. Part i spans
+ *       from offsets[i] up to, but not including, offsets[i + 1].
+ *       offsets[0] is always 0 and offsets[n_parts] is the file size. A
+ *       part is empty if no boundary was found within its range.
+ *
+ *       To scan a part, create a reader with bson_reader_new_from_file(),
+ *       call bson_reader_seek_resync() with offsets[i], and read until
+ *       bson_reader_tell() reaches offsets[i + 1].
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set.
+ *
+ * Side effects:
+ *       @error may be set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_partition_file (const char   *path,    /* IN */
+                     uint32_t      n_parts, /* IN */
+                     off_t        *offsets, /* OUT */
+                     bson_error_t *error)   /* OUT */
+{
+   char errmsg_buf[BSON_ERROR_BUFFER_SIZE];
+   char *errmsg;
+   bson_reader_t *reader;
+   struct stat st;
+   off_t target;
+   uint32_t i;
+
+   BSON_ASSERT (path);
+   BSON_ASSERT (n_parts);
+   BSON_ASSERT (offsets);
+
+   if (stat (path, &st) != 0) {
+      errmsg = bson_strerror_r (errno, errmsg_buf, sizeof errmsg_buf);
+      bson_set_error (error,
+                      BSON_ERROR_READER,
+                      BSON_ERROR_READER_BADFD,
+                      "%s", errmsg);
+      return false;
+   }
+
+   if (!(reader = bson_reader_new_from_file (path, error))) {
+      return false;
+   }
+
+   offsets[0] = 0;
+   offsets[n_parts] = (off_t)st.st_size;
+
+   for (i = 1; i < n_parts; i++) {
+      target = (off_t)(((uint64_t)st.st_size * i) / n_parts);
+      target = BSON_MAX (target, offsets[i - 1]);
+
+      if (bson_reader_seek_resync (reader, target)) {
+         offsets[i] = bson_reader_tell (reader);
+      } else {
+         offsets[i] = offsets[n_parts];
+      }
+   }
+
+   bson_reader_destroy (reader);
+
+   return true;
+}
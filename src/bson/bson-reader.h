@@ -35,6 +35,25 @@ BSON_BEGIN_DECLS
 #define BSON_ERROR_READER_BADFD 1
 
 
+/**
+ * BSON_READER_RESYNC_MAX_SIZE:
+ *
+ * The largest document length that bson_reader_seek_resync() will accept
+ * as a plausible boundary. This matches the largest document MongoDB will
+ * store, and bounds how far ahead the reader buffers while probing.
+ */
+#define BSON_READER_RESYNC_MAX_SIZE (16 * 1024 * 1024)
+
+
+/**
+ * BSON_READER_RESYNC_CHAIN:
+ *
+ * The number of consecutive documents that must validate (or end exactly
+ * at end of stream) before bson_reader_seek_resync() accepts a boundary.
+ */
+#define BSON_READER_RESYNC_CHAIN 3
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -53,7 +72,8 @@ BSON_BEGIN_DECLS
  *
  * Returns:
  *       0 for end of stream.
- *       -1 for read failure.
+ *       -1 for read failure, or with errno set to EAGAIN if no data is
+ *          available yet and the reader is non-blocking.
  *       Greater than zero for number of bytes read into @buf.
  *
  * Side effects:
@@ -99,15 +119,28 @@ bson_reader_t *bson_reader_new_from_file    (const char                 *path,
                                              bson_error_t               *error);
 bson_reader_t *bson_reader_new_from_data    (const uint8_t              *data,
                                              size_t                      length);
+bson_reader_t *bson_reader_new_from_feed    (void);
+void           bson_reader_feed             (bson_reader_t              *reader,
+                                             const uint8_t              *data,
+                                             size_t                      length);
 void           bson_reader_destroy          (bson_reader_t              *reader);
 void           bson_reader_set_read_func    (bson_reader_t              *reader,
                                              bson_reader_read_func_t     func);
 void           bson_reader_set_destroy_func (bson_reader_t              *reader,
                                              bson_reader_destroy_func_t  func);
+void           bson_reader_set_nonblocking  (bson_reader_t              *reader,
+                                             bool                        nonblocking);
+bool           bson_reader_would_block      (const bson_reader_t        *reader);
 const bson_t  *bson_reader_read             (bson_reader_t              *reader,
                                              bool                       *reached_eof);
 off_t          bson_reader_tell             (bson_reader_t              *reader);
 void           bson_reader_reset            (bson_reader_t              *reader);
+bool           bson_reader_seek_resync      (bson_reader_t              *reader,
+                                             off_t                       offset);
+bool           bson_partition_file          (const char                 *path,
+                                             uint32_t                    n_parts,
+                                             off_t                      *offsets,
+                                             bson_error_t               *error);
 
 BSON_END_DECLS
 
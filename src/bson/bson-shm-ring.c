@@ -0,0 +1,1211 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "bson.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifndef BSON_OS_WIN32
+# include <sched.h>
+# include <sys/mman.h>
+# include <time.h>
+# include <unistd.h>
+#endif
+#ifdef __linux__
+# include <linux/futex.h>
+# include <sys/syscall.h>
+#endif
+
+#include "bson-atomic.h"
+#include "bson-clock.h"
+#include "bson-memory.h"
+#include "bson-private.h"
+#include "bson-shm-ring.h"
+
+
+/*
+ * The shared memory starts with a header and is followed by a data area of
+ * "capacity" bytes, a power of two. Positions are 64-bit byte counts that
+ * only grow, and are masked by the capacity to find an offset.
+ *
+ * Each record is a header of two 32-bit integers, the document's length
+ * and the record's span, followed by the document. Spans are multiples of
+ * eight. A length of zero marks padding up to the end of the data area or
+ * a rolled back document, which the consumer skips. A record never wraps.
+ *
+ * Producers reserve records by advancing "head" with a compare and swap,
+ * and publish them in the order they were reserved by advancing
+ * "committed", so a producer that is slow to build a document holds back
+ * those reserved after it. The consumer reads records up to "committed",
+ * and frees them by advancing "tail".
+ *
+ * The producers' and the consumer's positions are kept in separate cache
+ * lines. Each side sleeps on a sequence counter the other side bumps,
+ * with a futex on Linux and by polling elsewhere. A sleeper counts itself
+ * in the matching "waiting" field for as long as it may sleep, and the
+ * other side only makes the wake system call while that count is not 0.
+ */
+
+
+#define BSON_SHM_RING_MAGIC        0x52534f42 /* "BOSR" */
+#define BSON_SHM_RING_VERSION      1
+#define BSON_SHM_RING_MIN_CAPACITY 1024
+#define BSON_SHM_RING_MAX_CAPACITY ((size_t)1 << 31)
+#define BSON_SHM_RING_RECORD_SIZE  8
+#define BSON_SHM_RING_ALIGN(n)     (((n) + 7) & ~(uint64_t)7)
+
+
+typedef struct
+{
+   uint32_t         magic;
+   uint32_t         version;
+   uint64_t         capacity;
+   uint8_t          padding0[48];
+
+   /* written by producers */
+   volatile int64_t head;              /* end of the reserved records */
+   volatile int64_t committed;         /* end of the published records */
+   volatile int32_t data_seq;          /* bumped on each publication */
+   volatile int32_t consumer_waiting;  /* consumers that may sleep */
+   uint8_t          padding1[40];
+
+   /* written by the consumer */
+   volatile int64_t tail;              /* end of the freed records */
+   volatile int32_t space_seq;         /* bumped each time tail moves */
+   volatile int32_t producers_waiting; /* producers that may sleep */
+   uint8_t          padding2[48];
+
+   volatile int32_t closed;
+   uint8_t          padding3[60];
+} bson_shm_ring_header_t;
+
+
+BSON_STATIC_ASSERT (sizeof (bson_shm_ring_header_t) ==
+                    BSON_SHM_RING_HEADER_SIZE);
+
+
+typedef struct
+{
+   uint32_t len;   /* length of the document, or 0 to skip */
+   uint32_t span;  /* bytes to the next record */
+} bson_shm_ring_record_t;
+
+
+struct _bson_shm_ring_t
+{
+   bson_shm_ring_header_t *header;
+   uint8_t                *data;
+   uint64_t                capacity;
+   void                   *map;          /* the mapping we own, if any */
+   size_t                  map_len;
+
+   /* the document between bson_shm_ring_begin and end */
+   bool                    building;
+   bson_t                  build;
+   uint8_t                *build_buf;
+   size_t                  build_buflen;
+   int64_t                 build_pos;
+   uint32_t                build_pad;
+   uint32_t                build_span;
+
+   /* the consumer's view of the last document read */
+   int64_t                 read_pos;     /* tail, once it is released */
+   bool                    reading;
+   bson_t                  read;
+};
+
+
+#if defined(__sun) && defined(__SVR4)
+# include <atomic.h>
+# define bson_shm_ring_cas(p,o,n) \
+   (atomic_cas_64 ((volatile uint64_t *)(p), (uint64_t)(o), \
+                   (uint64_t)(n)) == (uint64_t)(o))
+#elif defined(_WIN32)
+# define bson_shm_ring_cas(p,o,n) \
+   (InterlockedCompareExchange64 ((volatile LONGLONG *)(p), (LONGLONG)(n), \
+                                  (LONGLONG)(o)) == (LONGLONG)(o))
+#else
+# define bson_shm_ring_cas(p,o,n) __sync_bool_compare_and_swap ((p), (o), (n))
+#endif
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_shm_ring_load --
+ *
+ *       Read a position written by the other side, and order any reads of
+ *       the data it covers after it.
+ *
+ *       A 32-bit platform cannot read a 64-bit integer in one instruction,
+ *       so it reads through an atomic add instead.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static BSON_INLINE int64_t
+_bson_shm_ring_load (volatile int64_t *p) /* IN */
+{
+#if BSON_WORD_SIZE == 64
+   int64_t v = *p;
+
+   bson_memory_barrier ();
+
+   return v;
+#else
+   return bson_atomic_int64_add (p, 0);
+#endif
+}
+
+
+static BSON_INLINE void
+_bson_shm_ring_store (volatile int64_t *p, /* IN */
+                      int64_t           v) /* IN */
+{
+   bson_memory_barrier ();
+#if BSON_WORD_SIZE == 64
+   *p = v;
+   bson_memory_barrier ();
+#else
+   {
+      int64_t old;
+
+      do {
+         old = *p;
+      } while (!bson_shm_ring_cas (p, old, v));
+   }
+#endif
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_shm_ring_deadline --
+ *
+ *       Convert a timeout in microseconds to a monotonic deadline. A
+ *       negative timeout never expires.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static int64_t
+_bson_shm_ring_deadline (int64_t timeout_usec) /* IN */
+{
+   if (timeout_usec < 0) {
+      return -1;
+   }
+
+   return bson_get_monotonic_time () + timeout_usec;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_shm_ring_wait --
+ *
+ *       Sleep until @seq no longer holds @val, or a wakeup, or @deadline.
+ *       Wakeups may be spurious, so the caller checks its condition again.
+ *
+ * Returns:
+ *       false if @deadline has passed.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_bson_shm_ring_wait (volatile int32_t *seq,      /* IN */
+                     int32_t           val,      /* IN */
+                     int64_t           deadline) /* IN */
+{
+   int64_t remaining = 1000;
+
+   if (deadline >= 0) {
+      remaining = deadline - bson_get_monotonic_time ();
+
+      if (remaining <= 0) {
+         return false;
+      }
+   }
+
+#ifdef __linux__
+   {
+      struct timespec ts;
+
+      ts.tv_sec = (time_t)(remaining / 1000000);
+      ts.tv_nsec = (long)(remaining % 1000000) * 1000;
+
+      /* not FUTEX_PRIVATE_FLAG, the other side may be another process */
+      syscall (SYS_futex, seq, FUTEX_WAIT, val,
+               deadline >= 0 ? &ts : NULL, NULL, 0);
+   }
+#elif defined(BSON_OS_WIN32)
+   if (*seq == val) {
+      Sleep (remaining < 1000 ? 0 : 1);
+   }
+#else
+   if (*seq == val) {
+      struct timespec ts;
+
+      ts.tv_sec = 0;
+      ts.tv_nsec = (long)(remaining < 100 ? remaining : 100) * 1000;
+      nanosleep (&ts, NULL);
+   }
+#endif
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_shm_ring_wake --
+ *
+ *       Bump @seq, and wake those sleeping on it if @waiting counts any,
+ *       or always if @waiting is NULL.
+ *
+ *       A sleeper adds itself to @waiting before it checks its condition
+ *       for the last time, and removes itself once awake, so reading the
+ *       count after bumping @seq cannot miss one.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_bson_shm_ring_wake (volatile int32_t *seq,     /* IN */
+                     volatile int32_t *waiting) /* IN */
+{
+   bson_atomic_int_add (seq, 1);
+   bson_memory_barrier ();
+
+   if (!waiting || *waiting) {
+#ifdef __linux__
+      syscall (SYS_futex, seq, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+#endif
+   }
+}
+
+
+static void
+_bson_shm_ring_yield (void)
+{
+#ifdef BSON_OS_WIN32
+   SwitchToThread ();
+#else
+   sched_yield ();
+#endif
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_shm_ring_get_required_size --
+ *
+ *       Get the bytes of shared memory a ring of @capacity bytes of data
+ *       needs.
+ *
+ * Returns:
+ *       The size, or 0 if @capacity is not a power of two from 1024 to
+ *       2^31.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+size_t
+bson_shm_ring_get_required_size (size_t capacity) /* IN */
+{
+   if (capacity < BSON_SHM_RING_MIN_CAPACITY ||
+       capacity > BSON_SHM_RING_MAX_CAPACITY ||
+       (capacity & (capacity - 1)) != 0) {
+      return 0;
+   }
+
+   return BSON_SHM_RING_HEADER_SIZE + capacity;
+}
+
+
+static bson_shm_ring_t *
+_bson_shm_ring_create (void   *mem,      /* IN */
+                       size_t  capacity) /* IN */
+{
+   bson_shm_ring_t *ring;
+
+   ring = bson_malloc0 (sizeof *ring);
+   ring->header = (bson_shm_ring_header_t *)mem;
+   ring->data = (uint8_t *)mem + BSON_SHM_RING_HEADER_SIZE;
+   ring->capacity = capacity;
+   ring->read_pos = _bson_shm_ring_load (&ring->header->tail);
+
+   return ring;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_shm_ring_new --
+ *
+ *       Format @mem as an empty ring, using the largest capacity that fits
+ *       in @size bytes. @mem must be aligned to 64 bytes and shared with
+ *       the processes that call bson_shm_ring_attach() on it.
+ *
+ * Returns:
+ *       A ring to be freed with bson_shm_ring_destroy(), or NULL with
+ *       @error set.
+ *
+ * Side effects:
+ *       @mem is overwritten.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bson_shm_ring_t *
+bson_shm_ring_new (void         *mem,   /* IN */
+                   size_t        size,  /* IN */
+                   bson_error_t *error) /* OUT */
+{
+   bson_shm_ring_header_t *header;
+   size_t capacity;
+
+   BSON_ASSERT (mem);
+
+   if (((uintptr_t)mem & 63) != 0) {
+      bson_set_error (error,
+                      BSON_ERROR_SHM_RING,
+                      BSON_ERROR_SHM_RING_INVALID,
+                      "Ring memory is not aligned to 64 bytes");
+      return NULL;
+   }
+
+   if (size < BSON_SHM_RING_HEADER_SIZE + BSON_SHM_RING_MIN_CAPACITY) {
+      bson_set_error (error,
+                      BSON_ERROR_SHM_RING,
+                      BSON_ERROR_SHM_RING_INVALID,
+                      "Ring memory of %" PRIu64 " bytes is too small",
+                      (uint64_t)size);
+      return NULL;
+   }
+
+   capacity = BSON_SHM_RING_MAX_CAPACITY;
+
+   while (BSON_SHM_RING_HEADER_SIZE + capacity > size) {
+      capacity >>= 1;
+   }
+
+   header = (bson_shm_ring_header_t *)mem;
+   memset (header, 0, sizeof *header);
+   header->capacity = capacity;
+   header->version = BSON_SHM_RING_VERSION;
+   bson_memory_barrier ();
+   header->magic = BSON_SHM_RING_MAGIC;
+   bson_memory_barrier ();
+
+   return _bson_shm_ring_create (mem, capacity);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_shm_ring_attach --
+ *
+ *       Use a ring another process formatted with bson_shm_ring_new().
+ *
+ * Returns:
+ *       A ring to be freed with bson_shm_ring_destroy(), or NULL with
+ *       @error set.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bson_shm_ring_t *
+bson_shm_ring_attach (void         *mem,   /* IN */
+                      size_t        size,  /* IN */
+                      bson_error_t *error) /* OUT */
+{
+   const bson_shm_ring_header_t *header;
+
+   BSON_ASSERT (mem);
+
+   header = (const bson_shm_ring_header_t *)mem;
+
+   if (((uintptr_t)mem & 63) != 0 ||
+       size < BSON_SHM_RING_HEADER_SIZE ||
+       header->magic != BSON_SHM_RING_MAGIC) {
+      bson_set_error (error,
+                      BSON_ERROR_SHM_RING,
+                      BSON_ERROR_SHM_RING_INVALID,
+                      "Memory does not hold a ring");
+      return NULL;
+   }
+
+   bson_memory_barrier ();
+
+   if (header->version != BSON_SHM_RING_VERSION) {
+      bson_set_error (error,
+                      BSON_ERROR_SHM_RING,
+                      BSON_ERROR_SHM_RING_INVALID,
+                      "Unsupported ring version %u",
+                      (unsigned)header->version);
+      return NULL;
+   }
+
+   if (!bson_shm_ring_get_required_size ((size_t)header->capacity) ||
+       BSON_SHM_RING_HEADER_SIZE + header->capacity > size) {
+      bson_set_error (error,
+                      BSON_ERROR_SHM_RING,
+                      BSON_ERROR_SHM_RING_INVALID,
+                      "Ring capacity does not fit its memory");
+      return NULL;
+   }
+
+   return _bson_shm_ring_create (mem, (size_t)header->capacity);
+}
+
+
+#ifndef BSON_OS_WIN32
+static void *
+_bson_shm_ring_map (int           fd,    /* IN */
+                    size_t        len,   /* IN */
+                    bson_error_t *error) /* OUT */
+{
+   char errmsg_buf[BSON_ERROR_BUFFER_SIZE];
+   char *errmsg;
+   void *mem;
+
+   mem = mmap (NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+   if (mem == MAP_FAILED) {
+      errmsg = bson_strerror_r (errno, errmsg_buf, sizeof errmsg_buf);
+      bson_set_error (error,
+                      BSON_ERROR_SHM_RING,
+                      BSON_ERROR_SHM_RING_MAP,
+                      "Failed to map ring: %s", errmsg);
+      return NULL;
+   }
+
+   return mem;
+}
+#endif
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_shm_ring_new_from_fd --
+ *
+ *       Size the shared memory file @fd, such as one from memfd_create()
+ *       or shm_open(), for a ring of @capacity bytes, map it and format
+ *       it. @fd may be closed once the ring is created.
+ *
+ * Returns:
+ *       A ring to be freed with bson_shm_ring_destroy(), or NULL with
+ *       @error set.
+ *
+ * Side effects:
+ *       The file is truncated and overwritten.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bson_shm_ring_t *
+bson_shm_ring_new_from_fd (int           fd,       /* IN */
+                           size_t        capacity, /* IN */
+                           bson_error_t *error)    /* OUT */
+{
+#ifdef BSON_OS_WIN32
+   bson_set_error (error,
+                   BSON_ERROR_SHM_RING,
+                   BSON_ERROR_SHM_RING_MAP,
+                   "Mapping a ring from a file descriptor is not supported");
+   return NULL;
+#else
+   char errmsg_buf[BSON_ERROR_BUFFER_SIZE];
+   char *errmsg;
+   bson_shm_ring_t *ring;
+   size_t len;
+   void *mem;
+
+   len = bson_shm_ring_get_required_size (capacity);
+
+   if (!len) {
+      bson_set_error (error,
+                      BSON_ERROR_SHM_RING,
+                      BSON_ERROR_SHM_RING_INVALID,
+                      "Ring capacity %" PRIu64 " is not a power of two "
+                      "from 1024 to 2^31", (uint64_t)capacity);
+      return NULL;
+   }
+
+   if (ftruncate (fd, (off_t)len) != 0) {
+      errmsg = bson_strerror_r (errno, errmsg_buf, sizeof errmsg_buf);
+      bson_set_error (error,
+                      BSON_ERROR_SHM_RING,
+                      BSON_ERROR_SHM_RING_MAP,
+                      "Failed to size ring: %s", errmsg);
+      return NULL;
+   }
+
+   if (!(mem = _bson_shm_ring_map (fd, len, error))) {
+      return NULL;
+   }
+
+   ring = bson_shm_ring_new (mem, len, error);
+   BSON_ASSERT (ring);
+   ring->map = mem;
+   ring->map_len = len;
+
+   return ring;
+#endif
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_shm_ring_attach_fd --
+ *
+ *       Map the shared memory file @fd, which holds a ring created by
+ *       bson_shm_ring_new_from_fd().
+ *
+ * Returns:
+ *       A ring to be freed with bson_shm_ring_destroy(), or NULL with
+ *       @error set.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bson_shm_ring_t *
+bson_shm_ring_attach_fd (int           fd,    /* IN */
+                         bson_error_t *error) /* OUT */
+{
+#ifdef BSON_OS_WIN32
+   bson_set_error (error,
+                   BSON_ERROR_SHM_RING,
+                   BSON_ERROR_SHM_RING_MAP,
+                   "Mapping a ring from a file descriptor is not supported");
+   return NULL;
+#else
+   char errmsg_buf[BSON_ERROR_BUFFER_SIZE];
+   char *errmsg;
+   bson_shm_ring_t *ring;
+   struct stat st;
+   size_t len;
+   void *mem;
+
+   if (fstat (fd, &st) != 0) {
+      errmsg = bson_strerror_r (errno, errmsg_buf, sizeof errmsg_buf);
+      bson_set_error (error,
+                      BSON_ERROR_SHM_RING,
+                      BSON_ERROR_SHM_RING_MAP,
+                      "Failed to map ring: %s", errmsg);
+      return NULL;
+   }
+
+   len = (size_t)st.st_size;
+
+   if (len < BSON_SHM_RING_HEADER_SIZE) {
+      bson_set_error (error,
+                      BSON_ERROR_SHM_RING,
+                      BSON_ERROR_SHM_RING_INVALID,
+                      "Memory does not hold a ring");
+      return NULL;
+   }
+
+   if (!(mem = _bson_shm_ring_map (fd, len, error))) {
+      return NULL;
+   }
+
+   if (!(ring = bson_shm_ring_attach (mem, len, error))) {
+      munmap (mem, len);
+      return NULL;
+   }
+
+   ring->map = mem;
+   ring->map_len = len;
+
+   return ring;
+#endif
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_shm_ring_destroy --
+ *
+ *       Free @ring, and unmap its memory if it mapped it. The shared
+ *       memory itself is untouched.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Documents from @ring are no longer valid.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+bson_shm_ring_destroy (bson_shm_ring_t *ring) /* IN */
+{
+   if (ring) {
+      BSON_ASSERT (!ring->building);
+
+#ifndef BSON_OS_WIN32
+      if (ring->map) {
+         munmap (ring->map, ring->map_len);
+      }
+#endif
+
+      bson_free (ring);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_shm_ring_get_max_size --
+ *
+ *       Get the largest document that fits in @ring: a record may take
+ *       at most half of its capacity, so one never waits on a record that
+ *       could not wrap.
+ *
+ * Returns:
+ *       The size in bytes.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+size_t
+bson_shm_ring_get_max_size (const bson_shm_ring_t *ring) /* IN */
+{
+   BSON_ASSERT (ring);
+
+   return (size_t)(ring->capacity / 2 - BSON_SHM_RING_RECORD_SIZE);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_shm_ring_reserve --
+ *
+ *       Reserve a record of @span bytes, and if it would cross the end of
+ *       the data area, the padding up to it.
+ *
+ * Returns:
+ *       true and the padding's position and size, or false if the ring
+ *       was closed or was still full at @deadline.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_bson_shm_ring_reserve (bson_shm_ring_t *ring,     /* IN */
+                        uint32_t         span,     /* IN */
+                        int64_t          deadline, /* IN */
+                        int64_t         *pos,      /* OUT */
+                        uint32_t        *pad)      /* OUT */
+{
+   bson_shm_ring_header_t *header = ring->header;
+   uint64_t offset;
+   int64_t head;
+   int64_t end;
+   int32_t seq;
+   bool waited;
+
+   for (;;) {
+      if (header->closed) {
+         return false;
+      }
+
+      head = _bson_shm_ring_load (&header->head);
+      offset = (uint64_t)head & (ring->capacity - 1);
+      *pad = 0;
+
+      if (offset + span > ring->capacity) {
+         *pad = (uint32_t)(ring->capacity - offset);
+      }
+
+      end = head + *pad + span;
+
+      if ((uint64_t)(end - _bson_shm_ring_load (&header->tail)) <=
+          ring->capacity) {
+         if (bson_shm_ring_cas (&header->head, head, end)) {
+            *pos = head;
+            return true;
+         }
+
+         continue;
+      }
+
+      seq = header->space_seq;
+      bson_atomic_int_add (&header->producers_waiting, 1);
+      bson_memory_barrier ();
+
+      if ((uint64_t)(end - _bson_shm_ring_load (&header->tail)) <=
+          ring->capacity || header->closed) {
+         bson_atomic_int_add (&header->producers_waiting, -1);
+         continue;
+      }
+
+      waited = _bson_shm_ring_wait (&header->space_seq, seq, deadline);
+      bson_atomic_int_add (&header->producers_waiting, -1);
+
+      if (!waited) {
+         return false;
+      }
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_shm_ring_publish --
+ *
+ *       Write the headers of a reserved record and its padding, and make
+ *       them visible to the consumer once the records reserved before
+ *       them are.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_bson_shm_ring_publish (bson_shm_ring_t *ring, /* IN */
+                        int64_t          pos,  /* IN */
+                        uint32_t         pad,  /* IN */
+                        uint32_t         span, /* IN */
+                        uint32_t         len)  /* IN */
+{
+   bson_shm_ring_header_t *header = ring->header;
+   bson_shm_ring_record_t *record;
+   uint64_t mask = ring->capacity - 1;
+
+   if (pad) {
+      record = (bson_shm_ring_record_t *)(ring->data + ((uint64_t)pos & mask));
+      record->len = 0;
+      record->span = pad;
+   }
+
+   record =
+      (bson_shm_ring_record_t *)(ring->data + ((uint64_t)(pos + pad) & mask));
+   record->len = len;
+   record->span = span;
+
+   while (_bson_shm_ring_load (&header->committed) != pos) {
+      _bson_shm_ring_yield ();
+   }
+
+   _bson_shm_ring_store (&header->committed, pos + pad + span);
+   _bson_shm_ring_wake (&header->data_seq, &header->consumer_waiting);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_shm_ring_begin --
+ *
+ *       Reserve room for a document of up to @max_size bytes and begin
+ *       building it in place, like bson_writer_begin(). Appending past
+ *       @max_size fails. The document must be finished with
+ *       bson_shm_ring_end() or bson_shm_ring_rollback() before @ring
+ *       begins another.
+ *
+ *       Waits up to @timeout_usec for the consumer to free room; 0 does
+ *       not wait and a negative timeout waits forever.
+ *
+ * Returns:
+ *       true and @bson, or false if @max_size exceeds
+ *       bson_shm_ring_get_max_size(), the ring was closed or the timeout
+ *       passed.
+ *
+ * Side effects:
+ *       Records reserved after this one are not read until it ends.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_shm_ring_begin (bson_shm_ring_t  *ring,         /* IN */
+                     uint32_t          max_size,     /* IN */
+                     int64_t           timeout_usec, /* IN */
+                     bson_t          **bson)         /* OUT */
+{
+   bson_impl_alloc_t *b;
+   int64_t pos;
+   uint32_t pad;
+   uint64_t span;
+
+   BSON_ASSERT (ring);
+   BSON_ASSERT (!ring->building);
+   BSON_ASSERT (bson);
+
+   if (max_size < 5) {
+      max_size = 5;
+   }
+
+   if (max_size > bson_shm_ring_get_max_size (ring)) {
+      return false;
+   }
+
+   span = BSON_SHM_RING_RECORD_SIZE + BSON_SHM_RING_ALIGN (max_size);
+
+   if (!_bson_shm_ring_reserve (ring, (uint32_t)span,
+                                _bson_shm_ring_deadline (timeout_usec),
+                                &pos, &pad)) {
+      return false;
+   }
+
+   ring->building = true;
+   ring->build_pos = pos;
+   ring->build_pad = pad;
+   ring->build_span = (uint32_t)span;
+   ring->build_buf = ring->data +
+                     ((uint64_t)(pos + pad) & (ring->capacity - 1)) +
+                     BSON_SHM_RING_RECORD_SIZE;
+   ring->build_buflen = (size_t)(span - BSON_SHM_RING_RECORD_SIZE);
+
+   memset (&ring->build, 0, sizeof (bson_t));
+
+   b = (bson_impl_alloc_t *)&ring->build;
+   b->flags = BSON_FLAG_STATIC | BSON_FLAG_NO_FREE;
+   b->len = 5;
+   b->parent = NULL;
+   b->buf = &ring->build_buf;
+   b->buflen = &ring->build_buflen;
+   b->offset = 0;
+   b->alloc = NULL;
+   b->alloclen = 0;
+   b->realloc = NULL;
+   b->realloc_func_ctx = NULL;
+
+   memset (ring->build_buf + 1, 0, 4);
+   ring->build_buf[0] = 5;
+
+   *bson = &ring->build;
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_shm_ring_end --
+ *
+ *       Publish the document begun with bson_shm_ring_begin(), returning
+ *       its unused room to the ring if no record was reserved after it.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Waits for the records reserved before this one to be published.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+bson_shm_ring_end (bson_shm_ring_t *ring, /* IN */
+                   bson_t          *bson) /* IN */
+{
+   int64_t reserved_end;
+   uint32_t span;
+
+   BSON_ASSERT (ring);
+   BSON_ASSERT (ring->building);
+   BSON_ASSERT (bson == &ring->build);
+
+   span = (uint32_t)(BSON_SHM_RING_RECORD_SIZE +
+                     BSON_SHM_RING_ALIGN (bson->len));
+   reserved_end = ring->build_pos + ring->build_pad + ring->build_span;
+
+   if (span < ring->build_span &&
+       bson_shm_ring_cas (&ring->header->head, reserved_end,
+                          reserved_end - (ring->build_span - span))) {
+      ring->build_span = span;
+   }
+
+   _bson_shm_ring_publish (ring, ring->build_pos, ring->build_pad,
+                           ring->build_span, bson->len);
+
+   ring->building = false;
+   memset (&ring->build, 0, sizeof (bson_t));
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_shm_ring_rollback --
+ *
+ *       Abandon the document begun with bson_shm_ring_begin().
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       If a record was reserved after this one, this one is published as
+ *       a record the consumer skips.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+bson_shm_ring_rollback (bson_shm_ring_t *ring, /* IN */
+                        bson_t          *bson) /* IN */
+{
+   int64_t reserved_end;
+
+   BSON_ASSERT (ring);
+   BSON_ASSERT (ring->building);
+   BSON_ASSERT (bson == &ring->build);
+
+   reserved_end = ring->build_pos + ring->build_pad + ring->build_span;
+
+   if (!bson_shm_ring_cas (&ring->header->head, reserved_end,
+                           ring->build_pos)) {
+      _bson_shm_ring_publish (ring, ring->build_pos, ring->build_pad,
+                              ring->build_span, 0);
+   }
+
+   ring->building = false;
+   memset (&ring->build, 0, sizeof (bson_t));
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_shm_ring_push --
+ *
+ *       Copy @bson into @ring. See bson_shm_ring_begin() for
+ *       @timeout_usec.
+ *
+ * Returns:
+ *       true if @bson was published, otherwise false as for
+ *       bson_shm_ring_begin().
+ *
+ * Side effects:
+ *       Waits for the records reserved before this one to be published.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_shm_ring_push (bson_shm_ring_t *ring,         /* IN */
+                    const bson_t    *bson,         /* IN */
+                    int64_t          timeout_usec) /* IN */
+{
+   int64_t pos;
+   uint32_t pad;
+   uint64_t span;
+
+   BSON_ASSERT (ring);
+   BSON_ASSERT (!ring->building);
+   BSON_ASSERT (bson);
+
+   if (bson->len > bson_shm_ring_get_max_size (ring)) {
+      return false;
+   }
+
+   span = BSON_SHM_RING_RECORD_SIZE + BSON_SHM_RING_ALIGN (bson->len);
+
+   if (!_bson_shm_ring_reserve (ring, (uint32_t)span,
+                                _bson_shm_ring_deadline (timeout_usec),
+                                &pos, &pad)) {
+      return false;
+   }
+
+   memcpy (ring->data + ((uint64_t)(pos + pad) & (ring->capacity - 1)) +
+           BSON_SHM_RING_RECORD_SIZE,
+           bson_get_data (bson), bson->len);
+   _bson_shm_ring_publish (ring, pos, pad, (uint32_t)span, bson->len);
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_shm_ring_close --
+ *
+ *       Mark the end of the stream. The consumer reads the documents
+ *       already published, then reaches EOF. Producers must have finished
+ *       their documents, and fail to begin new ones.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Wakes the consumer and any waiting producers.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+bson_shm_ring_close (bson_shm_ring_t *ring) /* IN */
+{
+   bson_shm_ring_header_t *header;
+
+   BSON_ASSERT (ring);
+
+   header = ring->header;
+   header->closed = 1;
+   bson_memory_barrier ();
+
+   _bson_shm_ring_wake (&header->data_seq, NULL);
+   _bson_shm_ring_wake (&header->space_seq, NULL);
+}
+
+
+static void
+_bson_shm_ring_release (bson_shm_ring_t *ring) /* IN */
+{
+   bson_shm_ring_header_t *header = ring->header;
+
+   if (header->tail != ring->read_pos) {
+      _bson_shm_ring_store (&header->tail, ring->read_pos);
+      _bson_shm_ring_wake (&header->space_seq, &header->producers_waiting);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_shm_ring_read --
+ *
+ *       Read the next document from @ring, waiting up to @timeout_usec as
+ *       for bson_shm_ring_begin(). Only one process or thread may read a
+ *       ring.
+ *
+ * Returns:
+ *       A document that points into the ring and is valid until the next
+ *       call, or NULL on timeout or at the end of the stream. If
+ *       @reached_eof is not NULL it is set to true at the end of the
+ *       stream.
+ *
+ * Side effects:
+ *       The previous document's room is returned to producers.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+const bson_t *
+bson_shm_ring_read (bson_shm_ring_t *ring,         /* IN */
+                    int64_t          timeout_usec, /* IN */
+                    bool            *reached_eof)  /* OUT */
+{
+   bson_shm_ring_header_t *header;
+   const bson_shm_ring_record_t *record;
+   int64_t deadline = -2;
+   int64_t committed;
+   int32_t seq;
+   bool waited;
+
+   BSON_ASSERT (ring);
+
+   header = ring->header;
+
+   if (reached_eof) {
+      *reached_eof = false;
+   }
+
+   if (ring->reading) {
+      ring->reading = false;
+      _bson_shm_ring_release (ring);
+   }
+
+   for (;;) {
+      committed = _bson_shm_ring_load (&header->committed);
+
+      while (ring->read_pos != committed) {
+         record = (const bson_shm_ring_record_t *)(
+            ring->data + ((uint64_t)ring->read_pos & (ring->capacity - 1)));
+         ring->read_pos += record->span;
+
+         if (record->len &&
+             bson_init_static (&ring->read,
+                               (const uint8_t *)(record + 1),
+                               record->len)) {
+            ring->reading = true;
+            return &ring->read;
+         }
+      }
+
+      /* free any padding skipped before sleeping */
+      _bson_shm_ring_release (ring);
+
+      if (header->closed) {
+         bson_memory_barrier ();
+
+         if (_bson_shm_ring_load (&header->committed) == ring->read_pos) {
+            if (reached_eof) {
+               *reached_eof = true;
+            }
+
+            return NULL;
+         }
+
+         continue;
+      }
+
+      seq = header->data_seq;
+      bson_atomic_int_add (&header->consumer_waiting, 1);
+      bson_memory_barrier ();
+
+      if (_bson_shm_ring_load (&header->committed) != ring->read_pos ||
+          header->closed) {
+         bson_atomic_int_add (&header->consumer_waiting, -1);
+         continue;
+      }
+
+      if (deadline == -2) {
+         deadline = _bson_shm_ring_deadline (timeout_usec);
+      }
+
+      waited = _bson_shm_ring_wait (&header->data_seq, seq, deadline);
+      bson_atomic_int_add (&header->consumer_waiting, -1);
+
+      if (!waited) {
+         return NULL;
+      }
+   }
+}
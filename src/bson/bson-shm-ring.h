@@ -0,0 +1,90 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef BSON_SHM_RING_H
+#define BSON_SHM_RING_H
+
+
+#if !defined (BSON_INSIDE) && !defined (BSON_COMPILATION)
+# error "Only <bson.h> can be included directly."
+#endif
+
+
+#include "bson-compat.h"
+#include "bson-types.h"
+
+
+BSON_BEGIN_DECLS
+
+
+#define BSON_ERROR_SHM_RING_INVALID 1
+#define BSON_ERROR_SHM_RING_MAP     2
+
+
+/*
+ * The bytes of shared memory before a ring's data, which hold its
+ * positions and wakeup counters.
+ */
+#define BSON_SHM_RING_HEADER_SIZE 256
+
+
+/**
+ * bson_shm_ring_t:
+ *
+ * A lock-free ring of BSON documents in memory shared between processes,
+ * with any number of producers and a single consumer. Producers build
+ * documents in place and consumers read them in place, so a document is
+ * never copied or framed by a pipe.
+ */
+typedef struct _bson_shm_ring_t bson_shm_ring_t;
+
+
+size_t           bson_shm_ring_get_required_size (size_t            capacity);
+bson_shm_ring_t *bson_shm_ring_new               (void             *mem,
+                                                  size_t            size,
+                                                  bson_error_t     *error);
+bson_shm_ring_t *bson_shm_ring_attach            (void             *mem,
+                                                  size_t            size,
+                                                  bson_error_t     *error);
+bson_shm_ring_t *bson_shm_ring_new_from_fd       (int               fd,
+                                                  size_t            capacity,
+                                                  bson_error_t     *error);
+bson_shm_ring_t *bson_shm_ring_attach_fd         (int               fd,
+                                                  bson_error_t     *error);
+void             bson_shm_ring_destroy           (bson_shm_ring_t  *ring);
+size_t           bson_shm_ring_get_max_size      (const bson_shm_ring_t *ring);
+bool             bson_shm_ring_begin             (bson_shm_ring_t  *ring,
+                                                  uint32_t          max_size,
+                                                  int64_t           timeout_usec,
+                                                  bson_t          **bson);
+void             bson_shm_ring_end               (bson_shm_ring_t  *ring,
+                                                  bson_t           *bson);
+void             bson_shm_ring_rollback          (bson_shm_ring_t  *ring,
+                                                  bson_t           *bson);
+bool             bson_shm_ring_push              (bson_shm_ring_t  *ring,
+                                                  const bson_t     *bson,
+                                                  int64_t           timeout_usec);
+void             bson_shm_ring_close             (bson_shm_ring_t  *ring);
+const bson_t    *bson_shm_ring_read              (bson_shm_ring_t  *ring,
+                                                  int64_t           timeout_usec,
+                                                  bool             *reached_eof);
+
+
+BSON_END_DECLS
+
+
+#endif /* BSON_SHM_RING_H */
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2016 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef BSON_STATS_PRIVATE_H
+#define BSON_STATS_PRIVATE_H
+
+
+#include "bson-compat.h"
+#include "bson-macros.h"
+
+
+BSON_BEGIN_DECLS
+
+
+typedef enum
+{
+   BSON_STATS_INIT_FROM_JSON,
+   BSON_STATS_AS_JSON,
+   BSON_STATS_VALIDATE,
+   BSON_STATS_READER_READ,
+   BSON_STATS_N_OPS
+} bson_stats_op_t;
+
+
+extern volatile bool _bson_stats_enabled;
+
+
+int64_t
+_bson_stats_now (void);
+
+void
+_bson_stats_record (bson_stats_op_t op,
+                    size_t          size,
+                    int64_t         start);
+
+
+/*
+ * Time an instrumented call:
+ *
+ *    int64_t start = _bson_stats_start ();
+ *    ...
+ *    _bson_stats_end (BSON_STATS_VALIDATE, bson->len, start);
+ *
+ * While collection is off, start is 0 and nothing is recorded.
+ */
+#define _bson_stats_start() \
+   (BSON_UNLIKELY (_bson_stats_enabled) ? _bson_stats_now () : 0)
+
+#define _bson_stats_end(op, size, start) \
+   do { \
+      if (BSON_UNLIKELY ((start) != 0)) { \
+         _bson_stats_record ((op), (size), (start)); \
+      } \
+   } while (0)
+
+
+BSON_END_DECLS
+
+
+#endif /* BSON_STATS_PRIVATE_H */
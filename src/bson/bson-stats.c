@@ -0,0 +1,559 @@
+/*
+ * Copyright 2016 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "bson.h"
+
+#include <string.h>
+
+#if defined(BSON_HAVE_CLOCK_GETTIME)
+# include <time.h>
+#endif
+
+#include "bson-stats.h"
+#include "bson-stats-private.h"
+#include "bson-thread-private.h"
+
+
+/*
+ * Histograms are log-linear like HdrHistogram: values below
+ * BSON_STATS_SUB_COUNT nanoseconds get a bucket each, and every power of
+ * two above is split into BSON_STATS_SUB_COUNT buckets, so a bucket is
+ * never wider than 1/8th of its lower bound. Durations of
+ * 2^BSON_STATS_MAX_EXP ns (about 18 minutes) or more share the last bucket.
+ */
+#define BSON_STATS_SUB_BITS  3
+#define BSON_STATS_SUB_COUNT (1 << BSON_STATS_SUB_BITS)
+#define BSON_STATS_MAX_EXP   40
+#define BSON_STATS_N_BUCKETS \
+   ((BSON_STATS_MAX_EXP - BSON_STATS_SUB_BITS + 1) * BSON_STATS_SUB_COUNT)
+
+/*
+ * Input sizes are bucketed by powers of 16 from 64 bytes: below 64 bytes,
+ * below 1 KiB, below 16 KiB, below 256 KiB, below 4 MiB, and the rest.
+ */
+#define BSON_STATS_N_SIZES 6
+
+
+typedef struct
+{
+   uint64_t count;
+   uint64_t sum;
+   uint64_t min;
+   uint64_t max;
+   uint64_t buckets [BSON_STATS_N_BUCKETS];
+} bson_stats_histogram_t;
+
+
+typedef struct _bson_stats_thread_t
+{
+   struct _bson_stats_thread_t *prev;
+   struct _bson_stats_thread_t *next;
+   bson_stats_histogram_t       hist [BSON_STATS_N_OPS][BSON_STATS_N_SIZES];
+} bson_stats_thread_t;
+
+
+static const char *gStatsOpNames [BSON_STATS_N_OPS] = {
+   "bson_init_from_json",
+   "bson_as_json",
+   "bson_validate",
+   "bson_reader_read",
+};
+
+static const char *gStatsSizeNames [BSON_STATS_N_SIZES] = {
+   "0-63",
+   "64-1023",
+   "1024-16383",
+   "16384-262143",
+   "262144-4194303",
+   "4194304+",
+};
+
+
+volatile bool _bson_stats_enabled;
+
+static bson_once_t gStatsOnce = BSON_ONCE_INIT;
+static bson_mutex_t gStatsMutex;
+static bson_thread_key_t gStatsKey;
+static bool gStatsKeyValid;
+
+/* live threads, and the totals of threads that have exited */
+static bson_stats_thread_t *gStatsThreads;
+static bson_stats_thread_t gStatsRetired;
+
+
+static int
+_bson_stats_msb (uint64_t v) /* IN */
+{
+#if defined(__GNUC__)
+   return 63 - __builtin_clzll (v);
+#else
+   int r = 0;
+
+   while (v >>= 1) {
+      r++;
+   }
+
+   return r;
+#endif
+}
+
+
+static int
+_bson_stats_bucket (uint64_t v) /* IN */
+{
+   int e;
+
+   if (v < BSON_STATS_SUB_COUNT) {
+      return (int)v;
+   }
+
+   e = _bson_stats_msb (v);
+
+   if (e >= BSON_STATS_MAX_EXP) {
+      return BSON_STATS_N_BUCKETS - 1;
+   }
+
+   return (e - BSON_STATS_SUB_BITS + 1) * BSON_STATS_SUB_COUNT +
+          (int)((v >> (e - BSON_STATS_SUB_BITS)) & (BSON_STATS_SUB_COUNT - 1));
+}
+
+
+/* the largest value counted in bucket @i */
+static uint64_t
+_bson_stats_bucket_max (int i) /* IN */
+{
+   int e;
+   uint64_t low;
+
+   if (i < BSON_STATS_SUB_COUNT) {
+      return (uint64_t)i;
+   }
+
+   e = i / BSON_STATS_SUB_COUNT + BSON_STATS_SUB_BITS - 1;
+   low = (uint64_t)(BSON_STATS_SUB_COUNT + i % BSON_STATS_SUB_COUNT)
+         << (e - BSON_STATS_SUB_BITS);
+
+   return low + ((uint64_t)1 << (e - BSON_STATS_SUB_BITS)) - 1;
+}
+
+
+static int
+_bson_stats_size_class (size_t size) /* IN */
+{
+   int c;
+
+   if (size < 64) {
+      return 0;
+   }
+
+   c = (_bson_stats_msb ((uint64_t)size) - 6) / 4 + 1;
+
+   return BSON_MIN (c, BSON_STATS_N_SIZES - 1);
+}
+
+
+static void
+_bson_stats_merge (bson_stats_thread_t       *dst, /* IN */
+                   const bson_stats_thread_t *src) /* IN */
+{
+   const bson_stats_histogram_t *s;
+   bson_stats_histogram_t *d;
+   int op;
+   int size;
+   int i;
+
+   for (op = 0; op < BSON_STATS_N_OPS; op++) {
+      for (size = 0; size < BSON_STATS_N_SIZES; size++) {
+         s = &src->hist [op][size];
+         d = &dst->hist [op][size];
+
+         if (!s->count) {
+            continue;
+         }
+
+         if (!d->count || s->min < d->min) {
+            d->min = s->min;
+         }
+
+         d->max = BSON_MAX (d->max, s->max);
+         d->count += s->count;
+         d->sum += s->sum;
+
+         for (i = 0; i < BSON_STATS_N_BUCKETS; i++) {
+            d->buckets [i] += s->buckets [i];
+         }
+      }
+   }
+}
+
+
+static
+BSON_THREAD_KEY_DTOR (_bson_stats_thread_exit, data)
+{
+   bson_stats_thread_t *t = data;
+
+   if (!t) {
+      return;
+   }
+
+   bson_mutex_lock (&gStatsMutex);
+
+   _bson_stats_merge (&gStatsRetired, t);
+
+   if (t->prev) {
+      t->prev->next = t->next;
+   } else {
+      gStatsThreads = t->next;
+   }
+
+   if (t->next) {
+      t->next->prev = t->prev;
+   }
+
+   bson_mutex_unlock (&gStatsMutex);
+
+   bson_free (t);
+}
+
+
+static
+BSON_ONCE_FUN (_bson_stats_init)
+{
+   bson_mutex_init (&gStatsMutex);
+   gStatsKeyValid =
+      !bson_thread_key_create (&gStatsKey, _bson_stats_thread_exit);
+
+   BSON_ONCE_RETURN;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_stats_now --
+ *
+ *       A monotonic clock in nanoseconds for timing instrumented calls.
+ *       On platforms without clock_gettime() or QueryPerformanceCounter()
+ *       it only has the resolution of bson_get_monotonic_time().
+ *
+ * Returns:
+ *       Nanoseconds since an arbitrary point in the past.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+int64_t
+_bson_stats_now (void)
+{
+#if defined(BSON_HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+   struct timespec ts;
+
+   clock_gettime (CLOCK_MONOTONIC, &ts);
+
+   return ((int64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+#elif defined(_WIN32)
+   LARGE_INTEGER freq;
+   LARGE_INTEGER now;
+
+   QueryPerformanceFrequency (&freq);
+   QueryPerformanceCounter (&now);
+
+   return (int64_t)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+   return bson_get_monotonic_time () * 1000;
+#endif
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_stats_record --
+ *
+ *       Record a call to @op on @size bytes of input that started at
+ *       @start, as returned by _bson_stats_now(), in the calling thread's
+ *       histograms. Use _bson_stats_end() rather than calling this.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       The thread's histograms are allocated on first use.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_bson_stats_record (bson_stats_op_t op,    /* IN */
+                    size_t          size,  /* IN */
+                    int64_t         start) /* IN */
+{
+   bson_stats_histogram_t *h;
+   bson_stats_thread_t *t;
+   int64_t now;
+   uint64_t elapsed;
+
+   now = _bson_stats_now ();
+   elapsed = now > start ? (uint64_t)(now - start) : 0;
+
+   bson_once (&gStatsOnce, _bson_stats_init);
+
+   if (!gStatsKeyValid) {
+      return;
+   }
+
+   t = bson_thread_key_get (gStatsKey);
+
+   if (BSON_UNLIKELY (!t)) {
+      t = bson_malloc0 (sizeof *t);
+      bson_thread_key_set (gStatsKey, t);
+
+      bson_mutex_lock (&gStatsMutex);
+      t->next = gStatsThreads;
+
+      if (gStatsThreads) {
+         gStatsThreads->prev = t;
+      }
+
+      gStatsThreads = t;
+      bson_mutex_unlock (&gStatsMutex);
+   }
+
+   h = &t->hist [op][_bson_stats_size_class (size)];
+
+   if (!h->count || elapsed < h->min) {
+      h->min = elapsed;
+   }
+
+   if (elapsed > h->max) {
+      h->max = elapsed;
+   }
+
+   h->count++;
+   h->sum += elapsed;
+   h->buckets [_bson_stats_bucket (elapsed)]++;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_stats_set_enabled --
+ *
+ *       Start or stop collecting latency histograms. Histograms collected
+ *       so far are kept; see bson_stats_reset().
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+bson_stats_set_enabled (bool enabled) /* IN */
+{
+   bson_once (&gStatsOnce, _bson_stats_init);
+
+   _bson_stats_enabled = enabled;
+}
+
+
+bool
+bson_stats_get_enabled (void)
+{
+   return _bson_stats_enabled;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_stats_reset --
+ *
+ *       Clear the histograms of every thread. Calls that are recorded
+ *       while this runs may be lost.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+bson_stats_reset (void)
+{
+   bson_stats_thread_t *t;
+
+   bson_once (&gStatsOnce, _bson_stats_init);
+
+   bson_mutex_lock (&gStatsMutex);
+
+   memset (gStatsRetired.hist, 0, sizeof gStatsRetired.hist);
+
+   for (t = gStatsThreads; t; t = t->next) {
+      memset (t->hist, 0, sizeof t->hist);
+   }
+
+   bson_mutex_unlock (&gStatsMutex);
+}
+
+
+static uint64_t
+_bson_stats_percentile (const bson_stats_histogram_t *h,    /* IN */
+                        uint64_t                      tenk) /* IN */
+{
+   uint64_t target;
+   uint64_t seen = 0;
+   int i;
+
+   /* the smallest value that at least @tenk / 10000 of calls took */
+   target = BSON_MAX ((h->count * tenk + 9999) / 10000, 1);
+
+   for (i = 0; i < BSON_STATS_N_BUCKETS; i++) {
+      seen += h->buckets [i];
+
+      if (seen >= target) {
+         return BSON_MIN (_bson_stats_bucket_max (i), h->max);
+      }
+   }
+
+   return h->max;
+}
+
+
+static void
+_bson_stats_append_histogram (bson_t                       *doc, /* IN */
+                              const bson_stats_histogram_t *h)   /* IN */
+{
+   bson_t buckets;
+   bson_t bucket;
+   char str[16];
+   const char *key;
+   uint32_t n = 0;
+   int i;
+
+   BSON_APPEND_INT64 (doc, "count", (int64_t)h->count);
+   BSON_APPEND_INT64 (doc, "sum_ns", (int64_t)h->sum);
+   BSON_APPEND_INT64 (doc, "min_ns", (int64_t)h->min);
+   BSON_APPEND_INT64 (doc, "max_ns", (int64_t)h->max);
+   BSON_APPEND_INT64 (doc, "p50_ns", (int64_t)_bson_stats_percentile (h, 5000));
+   BSON_APPEND_INT64 (doc, "p90_ns", (int64_t)_bson_stats_percentile (h, 9000));
+   BSON_APPEND_INT64 (doc, "p99_ns", (int64_t)_bson_stats_percentile (h, 9900));
+   BSON_APPEND_INT64 (doc, "p999_ns",
+                      (int64_t)_bson_stats_percentile (h, 9990));
+
+   /* only the buckets that counted something, as upper bounds */
+   BSON_APPEND_ARRAY_BEGIN (doc, "buckets", &buckets);
+
+   for (i = 0; i < BSON_STATS_N_BUCKETS; i++) {
+      if (!h->buckets [i]) {
+         continue;
+      }
+
+      bson_uint32_to_string (n++, &key, str, sizeof str);
+      bson_append_document_begin (&buckets, key, -1, &bucket);
+      BSON_APPEND_INT64 (&bucket, "le_ns",
+                         (int64_t)_bson_stats_bucket_max (i));
+      BSON_APPEND_INT64 (&bucket, "count", (int64_t)h->buckets [i]);
+      bson_append_document_end (&buckets, &bucket);
+   }
+
+   bson_append_array_end (doc, &buckets);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_stats_snapshot --
+ *
+ *       Merge the histograms of every thread, including threads that have
+ *       exited, into a new document. It has an "enabled" field, then one
+ *       document per operation holding one document per input size class
+ *       that has been recorded. Each has "count", "sum_ns", "min_ns",
+ *       "max_ns", "p50_ns", "p90_ns", "p99_ns", "p999_ns" and "buckets",
+ *       an array of { "le_ns", "count" } for the non-empty buckets.
+ *
+ *       Threads are not stopped, so a snapshot taken while they record
+ *       may be off by the calls in flight.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @snapshot is initialized and must be freed with bson_destroy().
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+bson_stats_snapshot (bson_t *snapshot) /* OUT */
+{
+   bson_stats_thread_t *total;
+   bson_stats_thread_t *t;
+   bson_t op_doc;
+   bson_t size_doc;
+   int op;
+   int size;
+
+   BSON_ASSERT (snapshot);
+
+   bson_once (&gStatsOnce, _bson_stats_init);
+
+   total = bson_malloc0 (sizeof *total);
+
+   bson_mutex_lock (&gStatsMutex);
+
+   _bson_stats_merge (total, &gStatsRetired);
+
+   for (t = gStatsThreads; t; t = t->next) {
+      _bson_stats_merge (total, t);
+   }
+
+   bson_mutex_unlock (&gStatsMutex);
+
+   bson_init (snapshot);
+   BSON_APPEND_BOOL (snapshot, "enabled", _bson_stats_enabled);
+
+   for (op = 0; op < BSON_STATS_N_OPS; op++) {
+      bson_append_document_begin (snapshot, gStatsOpNames [op], -1, &op_doc);
+
+      for (size = 0; size < BSON_STATS_N_SIZES; size++) {
+         if (!total->hist [op][size].count) {
+            continue;
+         }
+
+         bson_append_document_begin (&op_doc, gStatsSizeNames [size], -1,
+                                     &size_doc);
+         _bson_stats_append_histogram (&size_doc, &total->hist [op][size]);
+         bson_append_document_end (&op_doc, &size_doc);
+      }
+
+      bson_append_document_end (snapshot, &op_doc);
+   }
+
+   bson_free (total);
+}
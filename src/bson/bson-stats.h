@@ -0,0 +1,51 @@
+/*
+ * Copyright 2016 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef BSON_STATS_H
+#define BSON_STATS_H
+
+
+#if !defined (BSON_INSIDE) && !defined (BSON_COMPILATION)
+# error "Only <bson.h> can be included directly."
+#endif
+
+
+#include "bson-compat.h"
+#include "bson-types.h"
+
+
+BSON_BEGIN_DECLS
+
+
+/*
+ * Latency histograms for bson_init_from_json(), bson_as_json(),
+ * bson_validate() and bson_reader_read(), keyed by the size of the input.
+ *
+ * Collection is off until bson_stats_set_enabled() turns it on; until then
+ * each instrumented call only tests a flag. Each thread records into its
+ * own histograms without locking, and bson_stats_snapshot() merges them.
+ */
+void bson_stats_set_enabled (bool    enabled);
+bool bson_stats_get_enabled (void);
+void bson_stats_reset       (void);
+void bson_stats_snapshot    (bson_t *snapshot);
+
+
+BSON_END_DECLS
+
+
+#endif /* BSON_STATS_H */
@@ -258,11 +258,26 @@ bson_string_append_printf (bson_string_t *string,
                            ...)
 {
    va_list args;
+   char buf[64];
    char *ret;
+   int n;
 
    BSON_ASSERT (string);
    BSON_ASSERT (format);
 
+   /*
+    * Most callers format a number, so try a stack buffer first and only
+    * allocate a temporary string for longer output.
+    */
+   va_start (args, format);
+   n = bson_vsnprintf (buf, sizeof buf, format, args);
+   va_end (args);
+
+   if (n >= 0 && (size_t)n < sizeof buf) {
+      bson_string_append (string, buf);
+      return;
+   }
+
    va_start (args, format);
    ret = bson_strdupv_printf (format, args);
    va_end (args);
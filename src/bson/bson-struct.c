@@ -0,0 +1,637 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "bson.h"
+
+#include <string.h>
+
+#include "bson-memory.h"
+#include "bson-private.h"
+#include "bson-struct.h"
+
+
+/*
+ * A compiled field keeps its key with the trailing NUL, ready to be
+ * copied after the type byte. Fields are looked up while decoding with a
+ * perfect hash: a seed is searched for at compile time such that every key
+ * hashes to a distinct slot of a power-of-two table.
+ */
+typedef struct
+{
+   bson_struct_type_t         type;
+   size_t                     offset;
+   char                      *key;
+   uint32_t                   key_len;
+   struct _bson_struct_desc_t *nested;
+} bson_struct_cfield_t;
+
+
+struct _bson_struct_desc_t
+{
+   bson_struct_cfield_t *fields;
+   uint32_t              n_fields;
+   uint32_t              fixed_len;
+   uint32_t              seed;
+   uint32_t              mask;
+   int32_t              *slots;
+};
+
+
+#define BSON_STRUCT_MAX_SEEDS 256
+
+
+static BSON_INLINE uint32_t
+_bson_struct_hash (const char *key,  /* IN */
+                   uint32_t    len,  /* IN */
+                   uint32_t    seed) /* IN */
+{
+   uint32_t h = 2166136261u ^ seed;
+   uint32_t i;
+
+   for (i = 0; i < len; i++) {
+      h ^= (uint8_t)key[i];
+      h *= 16777619u;
+   }
+
+   return h ^ (h >> 15);
+}
+
+
+/* the encoded size of a value, or 0 if it varies with the struct */
+static uint32_t
+_bson_struct_value_size (bson_struct_type_t type) /* IN */
+{
+   switch (type) {
+   case BSON_STRUCT_INT32:
+      return 4;
+   case BSON_STRUCT_INT64:
+   case BSON_STRUCT_DOUBLE:
+   case BSON_STRUCT_DATE_TIME:
+      return 8;
+   case BSON_STRUCT_BOOL:
+      return 1;
+   case BSON_STRUCT_OID:
+      return 12;
+   case BSON_STRUCT_UTF8:
+   case BSON_STRUCT_DOCUMENT:
+   default:
+      return 0;
+   }
+}
+
+
+static bool
+_bson_struct_build_slots (bson_struct_desc_t *desc) /* IN */
+{
+   bson_struct_cfield_t *field;
+   uint32_t size;
+   uint32_t seed;
+   uint32_t slot;
+   uint32_t i;
+
+   /* try sparser tables until a seed separates every key */
+   for (size = 4; size < desc->n_fields * 2; size <<= 1) {}
+
+   for (; size <= BSON_MAX (desc->n_fields, 4) * 64; size <<= 1) {
+      desc->slots = bson_realloc (desc->slots, size * sizeof *desc->slots);
+      desc->mask = size - 1;
+
+      for (seed = 0; seed < BSON_STRUCT_MAX_SEEDS; seed++) {
+         memset (desc->slots, 0xff, size * sizeof *desc->slots);
+
+         for (i = 0; i < desc->n_fields; i++) {
+            field = &desc->fields[i];
+            slot = _bson_struct_hash (field->key, field->key_len, seed) &
+                   desc->mask;
+
+            if (desc->slots[slot] != -1) {
+               break;
+            }
+
+            desc->slots[slot] = (int32_t)i;
+         }
+
+         if (i == desc->n_fields) {
+            desc->seed = seed;
+            return true;
+         }
+      }
+   }
+
+   return false;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_struct_desc_new --
+ *
+ *       Compile the @n_fields descriptions in @fields, including the
+ *       descriptions of embedded structs.
+ *
+ * Returns:
+ *       A newly allocated bson_struct_desc_t that should be freed with
+ *       bson_struct_desc_destroy(), or NULL and @error is set if a key is
+ *       empty or repeated, or a type is unknown.
+ *
+ * Side effects:
+ *       @error may be set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bson_struct_desc_t *
+bson_struct_desc_new (const bson_struct_field_t *fields,   /* IN */
+                      size_t                     n_fields, /* IN */
+                      bson_error_t              *error)    /* OUT */
+{
+   bson_struct_desc_t *desc;
+   bson_struct_cfield_t *field;
+   size_t key_len;
+   size_t i;
+   size_t j;
+
+   BSON_ASSERT (fields || !n_fields);
+
+   desc = bson_malloc0 (sizeof *desc);
+   desc->fields = bson_malloc0 (BSON_MAX (n_fields, 1) * sizeof *desc->fields);
+
+   /* the length prefix and trailing byte */
+   desc->fixed_len = 5;
+
+   for (i = 0; i < n_fields; i++) {
+      key_len = fields[i].key ? strlen (fields[i].key) : 0;
+
+      if (!key_len || key_len > INT32_MAX ||
+          fields[i].type < BSON_STRUCT_INT32 ||
+          fields[i].type > BSON_STRUCT_DOCUMENT) {
+         bson_set_error (error,
+                         BSON_ERROR_STRUCT,
+                         BSON_ERROR_STRUCT_INVALID,
+                         "Invalid description of field %u",
+                         (unsigned)i);
+         goto failure;
+      }
+
+      for (j = 0; j < i; j++) {
+         if (!strcmp (fields[i].key, fields[j].key)) {
+            bson_set_error (error,
+                            BSON_ERROR_STRUCT,
+                            BSON_ERROR_STRUCT_INVALID,
+                            "Duplicate key \"%s\"", fields[i].key);
+            goto failure;
+         }
+      }
+
+      field = &desc->fields[desc->n_fields++];
+      field->type = fields[i].type;
+      field->offset = fields[i].offset;
+      field->key = bson_strdup (fields[i].key);
+      field->key_len = (uint32_t)key_len;
+
+      if (field->type == BSON_STRUCT_DOCUMENT) {
+         field->nested = bson_struct_desc_new (fields[i].fields,
+                                               fields[i].n_fields, error);
+         if (!field->nested) {
+            goto failure;
+         }
+      }
+
+      /* the type byte, key, and NUL, plus any value of fixed size */
+      desc->fixed_len += 1 + field->key_len + 1 +
+                         _bson_struct_value_size (field->type);
+   }
+
+   if (!_bson_struct_build_slots (desc)) {
+      bson_set_error (error,
+                      BSON_ERROR_STRUCT,
+                      BSON_ERROR_STRUCT_INVALID,
+                      "Failed to build key table");
+      goto failure;
+   }
+
+   return desc;
+
+failure:
+   bson_struct_desc_destroy (desc);
+
+   return NULL;
+}
+
+
+void
+bson_struct_desc_destroy (bson_struct_desc_t *desc) /* IN */
+{
+   uint32_t i;
+
+   if (desc) {
+      for (i = 0; i < desc->n_fields; i++) {
+         bson_free (desc->fields[i].key);
+         bson_struct_desc_destroy (desc->fields[i].nested);
+      }
+
+      bson_free (desc->fields);
+      bson_free (desc->slots);
+      bson_free (desc);
+   }
+}
+
+
+/* the encoded size of the document for the struct at @src */
+static size_t
+_bson_struct_size (const bson_struct_desc_t *desc, /* IN */
+                   const uint8_t            *src)  /* IN */
+{
+   const bson_struct_cfield_t *field;
+   const char *str;
+   size_t size = desc->fixed_len;
+   uint32_t i;
+
+   for (i = 0; i < desc->n_fields; i++) {
+      field = &desc->fields[i];
+
+      if (field->type == BSON_STRUCT_UTF8) {
+         memcpy (&str, src + field->offset, sizeof str);
+         if (str) {
+            size += 4 + strlen (str) + 1;
+         }
+      } else if (field->type == BSON_STRUCT_DOCUMENT) {
+         size += _bson_struct_size (field->nested, src + field->offset);
+      }
+   }
+
+   return size;
+}
+
+
+static uint8_t *
+_bson_struct_write_document (const bson_struct_desc_t *desc,
+                             const uint8_t            *src,
+                             uint8_t                  *out);
+
+
+/* write the elements for the struct at @src, returning the end */
+static uint8_t *
+_bson_struct_write_fields (const bson_struct_desc_t *desc, /* IN */
+                           const uint8_t            *src,  /* IN */
+                           uint8_t                  *out)  /* IN */
+{
+   const bson_struct_cfield_t *field;
+   const uint8_t *value;
+   const char *str = NULL;
+   uint32_t le32;
+   uint64_t le64;
+   int64_t i64;
+   int32_t i32;
+   double dbl;
+   size_t len;
+   uint32_t i;
+
+   for (i = 0; i < desc->n_fields; i++) {
+      field = &desc->fields[i];
+      value = src + field->offset;
+
+      switch (field->type) {
+      case BSON_STRUCT_INT32:
+         *out++ = BSON_TYPE_INT32;
+         break;
+      case BSON_STRUCT_INT64:
+         *out++ = BSON_TYPE_INT64;
+         break;
+      case BSON_STRUCT_DOUBLE:
+         *out++ = BSON_TYPE_DOUBLE;
+         break;
+      case BSON_STRUCT_BOOL:
+         *out++ = BSON_TYPE_BOOL;
+         break;
+      case BSON_STRUCT_DATE_TIME:
+         *out++ = BSON_TYPE_DATE_TIME;
+         break;
+      case BSON_STRUCT_OID:
+         *out++ = BSON_TYPE_OID;
+         break;
+      case BSON_STRUCT_UTF8:
+         memcpy (&str, value, sizeof str);
+         *out++ = str ? BSON_TYPE_UTF8 : BSON_TYPE_NULL;
+         break;
+      case BSON_STRUCT_DOCUMENT:
+      default:
+         *out++ = BSON_TYPE_DOCUMENT;
+         break;
+      }
+
+      memcpy (out, field->key, field->key_len + 1);
+      out += field->key_len + 1;
+
+      switch (field->type) {
+      case BSON_STRUCT_INT32:
+         memcpy (&i32, value, sizeof i32);
+         le32 = BSON_UINT32_TO_LE ((uint32_t)i32);
+         memcpy (out, &le32, 4);
+         out += 4;
+         break;
+      case BSON_STRUCT_INT64:
+      case BSON_STRUCT_DATE_TIME:
+         memcpy (&i64, value, sizeof i64);
+         le64 = BSON_UINT64_TO_LE ((uint64_t)i64);
+         memcpy (out, &le64, 8);
+         out += 8;
+         break;
+      case BSON_STRUCT_DOUBLE:
+         memcpy (&dbl, value, sizeof dbl);
+         dbl = BSON_DOUBLE_TO_LE (dbl);
+         memcpy (out, &dbl, 8);
+         out += 8;
+         break;
+      case BSON_STRUCT_BOOL:
+         *out++ = *(const bool *)value ? 1 : 0;
+         break;
+      case BSON_STRUCT_OID:
+         memcpy (out, value, 12);
+         out += 12;
+         break;
+      case BSON_STRUCT_UTF8:
+         if (str) {
+            len = strlen (str);
+            le32 = BSON_UINT32_TO_LE ((uint32_t)len + 1);
+            memcpy (out, &le32, 4);
+            memcpy (out + 4, str, len + 1);
+            out += 4 + len + 1;
+         }
+         break;
+      case BSON_STRUCT_DOCUMENT:
+      default:
+         out = _bson_struct_write_document (field->nested, value, out);
+         break;
+      }
+   }
+
+   return out;
+}
+
+
+static uint8_t *
+_bson_struct_write_document (const bson_struct_desc_t *desc, /* IN */
+                             const uint8_t            *src,  /* IN */
+                             uint8_t                  *out)  /* IN */
+{
+   uint8_t *start = out;
+   uint32_t le32;
+
+   out = _bson_struct_write_fields (desc, src, out + 4);
+   *out++ = '\0';
+   le32 = BSON_UINT32_TO_LE ((uint32_t)(out - start));
+   memcpy (start, &le32, 4);
+
+   return out;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_encode_struct --
+ *
+ *       Append the members of the struct at @src described by @desc to
+ *       @dst. The encoded size is computed first, so @dst grows at most
+ *       once.
+ *
+ * Returns:
+ *       true if successful; false if @dst cannot be appended to or would
+ *       exceed the maximum BSON size.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_encode_struct (const bson_struct_desc_t *desc, /* IN */
+                    const void               *src,  /* IN */
+                    bson_t                   *dst)  /* IN */
+{
+   uint32_t old_len;
+   uint32_t le;
+   size_t size;
+   uint8_t *buf;
+   uint8_t *end;
+
+   BSON_ASSERT (desc);
+   BSON_ASSERT (src);
+   BSON_ASSERT (dst);
+
+   old_len = dst->len;
+   size = _bson_struct_size (desc, src) - 5;
+
+   if (size > (size_t)INT32_MAX - old_len) {
+      return false;
+   }
+
+   if (!(buf = bson_reserve_buffer (dst, (uint32_t)(old_len + size)))) {
+      return false;
+   }
+
+   /* the new fields replace the trailing byte of @dst */
+   end = _bson_struct_write_fields (desc, src, buf + old_len - 1);
+   *end = '\0';
+
+   le = BSON_UINT32_TO_LE (dst->len);
+   memcpy (buf, &le, sizeof le);
+
+   return true;
+}
+
+
+static bool
+_bson_struct_read (const bson_struct_desc_t *desc,  /* IN */
+                   bson_iter_t              *iter,  /* IN */
+                   uint8_t                  *dst,   /* OUT */
+                   bson_error_t             *error) /* OUT */
+{
+   const bson_struct_cfield_t *field;
+   const char *key;
+   const char *str;
+   uint8_t *value;
+   bson_iter_t child;
+   uint32_t key_len;
+   int32_t slot;
+   int32_t i32;
+   int64_t i64;
+   double dbl;
+   bool b;
+
+   while (bson_iter_next (iter)) {
+      key = bson_iter_key (iter);
+      key_len = _bson_iter_key_len (iter);
+      slot = desc->slots[_bson_struct_hash (key, key_len, desc->seed) &
+                         desc->mask];
+
+      if (slot < 0) {
+         continue;
+      }
+
+      field = &desc->fields[slot];
+
+      if (field->key_len != key_len || memcmp (field->key, key, key_len)) {
+         continue;
+      }
+
+      value = dst + field->offset;
+
+      switch (field->type) {
+      case BSON_STRUCT_INT32:
+         if (!BSON_ITER_HOLDS_INT32 (iter)) {
+            goto type_error;
+         }
+         i32 = bson_iter_int32_unsafe (iter);
+         memcpy (value, &i32, sizeof i32);
+         break;
+      case BSON_STRUCT_INT64:
+         if (BSON_ITER_HOLDS_INT64 (iter)) {
+            i64 = bson_iter_int64_unsafe (iter);
+         } else if (BSON_ITER_HOLDS_INT32 (iter)) {
+            i64 = bson_iter_int32_unsafe (iter);
+         } else {
+            goto type_error;
+         }
+         memcpy (value, &i64, sizeof i64);
+         break;
+      case BSON_STRUCT_DOUBLE:
+         if (BSON_ITER_HOLDS_DOUBLE (iter)) {
+            dbl = bson_iter_double_unsafe (iter);
+         } else if (BSON_ITER_HOLDS_INT32 (iter)) {
+            dbl = bson_iter_int32_unsafe (iter);
+         } else if (BSON_ITER_HOLDS_INT64 (iter)) {
+            dbl = (double)bson_iter_int64_unsafe (iter);
+         } else {
+            goto type_error;
+         }
+         memcpy (value, &dbl, sizeof dbl);
+         break;
+      case BSON_STRUCT_BOOL:
+         if (!BSON_ITER_HOLDS_BOOL (iter)) {
+            goto type_error;
+         }
+         b = bson_iter_bool (iter);
+         memcpy (value, &b, sizeof b);
+         break;
+      case BSON_STRUCT_DATE_TIME:
+         if (!BSON_ITER_HOLDS_DATE_TIME (iter)) {
+            goto type_error;
+         }
+         i64 = bson_iter_date_time (iter);
+         memcpy (value, &i64, sizeof i64);
+         break;
+      case BSON_STRUCT_OID:
+         if (!BSON_ITER_HOLDS_OID (iter)) {
+            goto type_error;
+         }
+         memcpy (value, bson_iter_oid (iter), sizeof (bson_oid_t));
+         break;
+      case BSON_STRUCT_UTF8:
+         if (BSON_ITER_HOLDS_UTF8 (iter)) {
+            str = bson_iter_utf8 (iter, NULL);
+         } else if (BSON_ITER_HOLDS_NULL (iter)) {
+            str = NULL;
+         } else {
+            goto type_error;
+         }
+         memcpy (value, &str, sizeof str);
+         break;
+      case BSON_STRUCT_DOCUMENT:
+      default:
+         if (!BSON_ITER_HOLDS_DOCUMENT (iter)) {
+            goto type_error;
+         }
+         if (!bson_iter_recurse (iter, &child) ||
+             !_bson_struct_read (field->nested, &child, value, error)) {
+            return false;
+         }
+         break;
+      }
+   }
+
+   if (iter->err_off) {
+      bson_set_error (error,
+                      BSON_ERROR_STRUCT,
+                      BSON_ERROR_STRUCT_CORRUPT,
+                      "Corrupt BSON document");
+      return false;
+   }
+
+   return true;
+
+type_error:
+   bson_set_error (error,
+                   BSON_ERROR_STRUCT,
+                   BSON_ERROR_STRUCT_TYPE,
+                   "Field \"%s\" has unexpected type 0x%02x",
+                   field->key, (unsigned)bson_iter_type (iter));
+
+   return false;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_decode_struct --
+ *
+ *       Fill in the members of the struct at @dst described by @desc from
+ *       the fields of @src, in a single pass over @src. Fields of @src
+ *       that are not described are ignored, and members whose fields are
+ *       missing are left unchanged.
+ *
+ *       Integer fields are widened to BSON_STRUCT_INT64 and
+ *       BSON_STRUCT_DOUBLE members. BSON_STRUCT_UTF8 members point into
+ *       @src, which must outlive them.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set if a field
+ *       has an incompatible type or @src is corrupt. @dst may have been
+ *       partially filled in.
+ *
+ * Side effects:
+ *       @error may be set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_decode_struct (const bson_struct_desc_t *desc,  /* IN */
+                    const bson_t             *src,   /* IN */
+                    void                     *dst,   /* OUT */
+                    bson_error_t             *error) /* OUT */
+{
+   bson_iter_t iter;
+
+   BSON_ASSERT (desc);
+   BSON_ASSERT (src);
+   BSON_ASSERT (dst);
+
+   if (!bson_iter_init (&iter, src)) {
+      bson_set_error (error,
+                      BSON_ERROR_STRUCT,
+                      BSON_ERROR_STRUCT_CORRUPT,
+                      "Corrupt BSON document");
+      return false;
+   }
+
+   return _bson_struct_read (desc, &iter, dst, error);
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef BSON_STRUCT_H
+#define BSON_STRUCT_H
+
+
+#if !defined (BSON_INSIDE) && !defined (BSON_COMPILATION)
+# error "Only <bson.h> can be included directly."
+#endif
+
+
+#include <stddef.h>
+
+#include "bson-compat.h"
+#include "bson-types.h"
+
+
+BSON_BEGIN_DECLS
+
+
+#define BSON_ERROR_STRUCT_INVALID 1
+#define BSON_ERROR_STRUCT_TYPE    2
+#define BSON_ERROR_STRUCT_CORRUPT 3
+
+
+/**
+ * bson_struct_type_t:
+ *
+ * The C type of a struct member described by a bson_struct_field_t, and
+ * the BSON type it is encoded as.
+ */
+typedef enum
+{
+   BSON_STRUCT_INT32,     /* int32_t, as int32 */
+   BSON_STRUCT_INT64,     /* int64_t, as int64 */
+   BSON_STRUCT_DOUBLE,    /* double, as double */
+   BSON_STRUCT_BOOL,      /* bool, as bool */
+   BSON_STRUCT_DATE_TIME, /* int64_t milliseconds, as date_time */
+   BSON_STRUCT_OID,       /* bson_oid_t, as oid */
+   BSON_STRUCT_UTF8,      /* const char *, as utf8, or null if NULL */
+   BSON_STRUCT_DOCUMENT,  /* an embedded struct, as document */
+} bson_struct_type_t;
+
+
+/**
+ * bson_struct_field_t:
+ *
+ * Describes one member of a C struct: the key it is stored under, its
+ * type, and its offset. A BSON_STRUCT_DOCUMENT member is itself a struct
+ * described by @fields.
+ *
+ * Use BSON_STRUCT_FIELD() and BSON_STRUCT_FIELD_DOCUMENT() to fill these
+ * in, e.g.:
+ *
+ *    static const bson_struct_field_t point_fields[] = {
+ *       BSON_STRUCT_FIELD (point_t, x, "x", BSON_STRUCT_DOUBLE),
+ *       BSON_STRUCT_FIELD (point_t, y, "y", BSON_STRUCT_DOUBLE),
+ *    };
+ */
+typedef struct _bson_struct_field_t
+{
+   const char                        *key;
+   bson_struct_type_t                 type;
+   size_t                             offset;
+   const struct _bson_struct_field_t *fields;
+   size_t                             n_fields;
+} bson_struct_field_t;
+
+
+#define BSON_STRUCT_FIELD(_struct, _member, _key, _type) \
+   { (_key), (_type), offsetof (_struct, _member), NULL, 0 }
+#define BSON_STRUCT_FIELD_DOCUMENT(_struct, _member, _key, _fields) \
+   { (_key), BSON_STRUCT_DOCUMENT, offsetof (_struct, _member), (_fields), \
+     sizeof (_fields) / sizeof ((_fields)[0]) }
+
+
+/**
+ * bson_struct_desc_t:
+ *
+ * A table of bson_struct_field_t compiled for encoding and decoding. Keys
+ * are pre-encoded, and decoding looks fields up with a perfect hash of
+ * their keys.
+ *
+ * A compiled descriptor is immutable and may be shared between threads.
+ */
+typedef struct _bson_struct_desc_t bson_struct_desc_t;
+
+
+bson_struct_desc_t *bson_struct_desc_new     (const bson_struct_field_t *fields,
+                                              size_t                     n_fields,
+                                              bson_error_t              *error);
+void                bson_struct_desc_destroy (bson_struct_desc_t        *desc);
+bool                bson_encode_struct       (const bson_struct_desc_t  *desc,
+                                              const void                *src,
+                                              bson_t                    *dst);
+bool                bson_decode_struct       (const bson_struct_desc_t  *desc,
+                                              const bson_t              *src,
+                                              void                      *dst,
+                                              bson_error_t              *error);
+
+
+BSON_END_DECLS
+
+
+#endif /* BSON_STRUCT_H */
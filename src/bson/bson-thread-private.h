@@ -46,6 +46,11 @@ BSON_BEGIN_DECLS
 #  define bson_once                       pthread_once
 #  define BSON_ONCE_FUN(n)                void n(void)
 #  define BSON_ONCE_RETURN                return
+#  define bson_thread_key_t               pthread_key_t
+#  define bson_thread_key_create(_k,_d)   pthread_key_create((_k), (_d))
+#  define bson_thread_key_get             pthread_getspecific
+#  define bson_thread_key_set             pthread_setspecific
+#  define BSON_THREAD_KEY_DTOR(n,d)       void n(void *d)
 #  ifdef BSON_PTHREAD_ONCE_INIT_NEEDS_BRACES
 #    define BSON_ONCE_INIT                {PTHREAD_ONCE_INIT}
 #  else
@@ -65,6 +70,11 @@ BSON_BEGIN_DECLS
 #  define bson_once(o, c)                 InitOnceExecuteOnce(o, c, NULL, NULL)
 #  define BSON_ONCE_FUN(n)                BOOL CALLBACK n(PINIT_ONCE _ignored_a, PVOID _ignored_b, PVOID *_ignored_c)
 #  define BSON_ONCE_RETURN                return true
+#  define bson_thread_key_t               DWORD
+#  define bson_thread_key_create(_k,_d)   ((*(_k) = FlsAlloc(_d)) == FLS_OUT_OF_INDEXES)
+#  define bson_thread_key_get             FlsGetValue
+#  define bson_thread_key_set             FlsSetValue
+#  define BSON_THREAD_KEY_DTOR(n,d)       VOID WINAPI n(PVOID d)
 #endif
 
 
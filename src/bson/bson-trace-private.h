@@ -0,0 +1,141 @@
+/*
+ * Copyright 2016 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef BSON_TRACE_PRIVATE_H
+#define BSON_TRACE_PRIVATE_H
+
+
+#include "bson-config.h"
+#include "bson-clock.h"
+#include "bson-macros.h"
+
+
+/*
+ * SystemTap / USDT static probes for the "libbson" provider.
+ *
+ * Probes are only compiled in when libbson is configured with
+ * --enable-usdt (autotools) or -DENABLE_USDT=ON (CMake). Otherwise every
+ * macro below expands to nothing and its arguments are never evaluated.
+ *
+ * When compiled in, each probe has a semaphore that the tracer increments
+ * while attached. BSON_PROBEn() tests it before evaluating its arguments,
+ * and BSON_PROBE_CLOCK() only reads the clock while it is set, so an
+ * unattached probe costs a single load and branch.
+ *
+ * Durations are in microseconds, from bson_get_monotonic_time(). A
+ * duration is 0 if the tracer attached while the operation was running.
+ * The probes and their arguments are listed in doc/bson_performance.page;
+ * keep it in sync with the semaphores below.
+ */
+
+
+#ifdef BSON_HAVE_USDT
+
+# define _SDT_HAS_SEMAPHORES 1
+# include <sys/sdt.h>
+
+# ifdef BSON_PROBE_DEFINE_SEMAPHORES
+#  define _BSON_PROBE_SEMAPHORE(name) \
+   __attribute__ ((section (".probes"))) \
+   volatile unsigned short libbson_##name##_semaphore = 0
+# else
+#  define _BSON_PROBE_SEMAPHORE(name) \
+   extern volatile unsigned short libbson_##name##_semaphore
+# endif
+
+_BSON_PROBE_SEMAPHORE (bson__grow);
+_BSON_PROBE_SEMAPHORE (reader__grow);
+_BSON_PROBE_SEMAPHORE (reader__document);
+_BSON_PROBE_SEMAPHORE (json__start);
+_BSON_PROBE_SEMAPHORE (json__end);
+_BSON_PROBE_SEMAPHORE (validate__fail);
+_BSON_PROBE_SEMAPHORE (oid__contention);
+
+# define BSON_PROBE_ENABLED(name) \
+   BSON_UNLIKELY (libbson_##name##_semaphore != 0)
+
+# define BSON_PROBE_CLOCK(name) \
+   (BSON_PROBE_ENABLED (name) ? bson_get_monotonic_time () : 0)
+
+# define BSON_PROBE_ELAPSED(start) \
+   ((start) ? bson_get_monotonic_time () - (start) : 0)
+
+# define BSON_PROBE0(name) \
+   do { \
+      if (BSON_PROBE_ENABLED (name)) { \
+         DTRACE_PROBE (libbson, name); \
+      } \
+   } while (0)
+
+# define BSON_PROBE1(name, a1) \
+   do { \
+      if (BSON_PROBE_ENABLED (name)) { \
+         DTRACE_PROBE1 (libbson, name, a1); \
+      } \
+   } while (0)
+
+# define BSON_PROBE2(name, a1, a2) \
+   do { \
+      if (BSON_PROBE_ENABLED (name)) { \
+         DTRACE_PROBE2 (libbson, name, a1, a2); \
+      } \
+   } while (0)
+
+# define BSON_PROBE3(name, a1, a2, a3) \
+   do { \
+      if (BSON_PROBE_ENABLED (name)) { \
+         DTRACE_PROBE3 (libbson, name, a1, a2, a3); \
+      } \
+   } while (0)
+
+# define BSON_PROBE4(name, a1, a2, a3, a4) \
+   do { \
+      if (BSON_PROBE_ENABLED (name)) { \
+         DTRACE_PROBE4 (libbson, name, a1, a2, a3, a4); \
+      } \
+   } while (0)
+
+#else
+
+/*
+ * The arguments are referenced in dead code, so variables that only feed
+ * a probe do not trigger unused-variable warnings.
+ */
+# define BSON_PROBE_ENABLED(name) 0
+# define BSON_PROBE_CLOCK(name) ((int64_t) 0)
+# define BSON_PROBE_ELAPSED(start) ((void) (start), (int64_t) 0)
+
+# define BSON_PROBE0(name) do { } while (0)
+
+# define BSON_PROBE1(name, a1) \
+   do { if (0) { (void) (a1); } } while (0)
+
+# define BSON_PROBE2(name, a1, a2) \
+   do { if (0) { (void) (a1); (void) (a2); } } while (0)
+
+# define BSON_PROBE3(name, a1, a2, a3) \
+   do { if (0) { (void) (a1); (void) (a2); (void) (a3); } } while (0)
+
+# define BSON_PROBE4(name, a1, a2, a3, a4) \
+   do { \
+      if (0) { (void) (a1); (void) (a2); (void) (a3); (void) (a4); } \
+   } while (0)
+
+#endif /* BSON_HAVE_USDT */
+
+
+#endif /* BSON_TRACE_PRIVATE_H */
@@ -334,6 +334,20 @@ typedef struct _bson_value_t
 BSON_ALIGNED_END (8);
 
 
+/**
+ * bson_field_t:
+ *
+ * A key and value for bson_append_many(). @key_length may be -1 if @key
+ * is NUL-terminated; if @key is NULL the field's index is used.
+ */
+typedef struct
+{
+   const char   *key;
+   int           key_length;
+   bson_value_t  value;
+} bson_field_t;
+
+
 /**
  * bson_iter_t:
  *
@@ -0,0 +1,37 @@
+/*
+ * Copyright 2016 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef BSON_UTF8_PRIVATE_H
+#define BSON_UTF8_PRIVATE_H
+
+
+#include "bson-compat.h"
+#include "bson-macros.h"
+#include "bson-string.h"
+
+
+BSON_BEGIN_DECLS
+
+bool
+_bson_utf8_escape_for_json_append (bson_string_t *str,
+                                   const char    *utf8,
+                                   ssize_t        utf8_len);
+
+BSON_END_DECLS
+
+
+#endif /* BSON_UTF8_PRIVATE_H */
@@ -20,6 +20,7 @@
 #include "bson-memory.h"
 #include "bson-string.h"
 #include "bson-utf8.h"
+#include "bson-utf8-private.h"
 
 
 /*
@@ -237,41 +238,39 @@ bson_utf8_validate (const char *utf8,       /* IN */
 /*
  *--------------------------------------------------------------------------
  *
- * bson_utf8_escape_for_json --
- *
- *       Allocates a new string matching @utf8 except that special
- *       characters in JSON will be escaped. The resulting string is also
- *       UTF-8 encoded.
+ * _bson_utf8_escape_for_json_append --
  *
- *       Both " and \ characters will be escaped. Additionally, if a NUL
- *       byte is found before @utf8_len bytes, it will be converted to the
- *       two byte UTF-8 sequence.
+ *       Like bson_utf8_escape_for_json(), but appends the escaped string
+ *       to @str instead of allocating a new one.
  *
  * Parameters:
+ *       @str: The string to append to.
  *       @utf8: A UTF-8 encoded string.
  *       @utf8_len: The length of @utf8 in bytes or -1 if NUL terminated.
  *
  * Returns:
- *       A newly allocated string that should be freed with bson_free().
+ *       true if successful, false if @utf8 is invalid UTF-8.
  *
  * Side effects:
- *       None.
+ *       @str is appended to. On failure @str is left unchanged.
  *
  *--------------------------------------------------------------------------
  */
 
-char *
-bson_utf8_escape_for_json (const char *utf8,     /* IN */
-                           ssize_t     utf8_len) /* IN */
+bool
+_bson_utf8_escape_for_json_append (bson_string_t *str,      /* IN */
+                                   const char    *utf8,     /* IN */
+                                   ssize_t        utf8_len) /* IN */
 {
    bson_unichar_t c;
-   bson_string_t *str;
    bool length_provided = true;
    const char *end;
+   uint32_t start_len;
 
+   BSON_ASSERT (str);
    BSON_ASSERT (utf8);
 
-   str = bson_string_new (NULL);
+   start_len = str->len;
 
    if (utf8_len < 0) {
       length_provided = false;
@@ -322,12 +321,58 @@ bson_utf8_escape_for_json (const char *utf8,     /* IN */
             utf8++;
          } else {
             /* invalid UTF-8 */
-            bson_string_free (str, true);
-            return NULL;
+            str->len = start_len;
+            str->str [start_len] = '\0';
+            return false;
          }
       }
    }
 
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_utf8_escape_for_json --
+ *
+ *       Allocates a new string matching @utf8 except that special
+ *       characters in JSON will be escaped. The resulting string is also
+ *       UTF-8 encoded.
+ *
+ *       Both " and \ characters will be escaped. Additionally, if a NUL
+ *       byte is found before @utf8_len bytes, it will be converted to the
+ *       two byte UTF-8 sequence.
+ *
+ * Parameters:
+ *       @utf8: A UTF-8 encoded string.
+ *       @utf8_len: The length of @utf8 in bytes or -1 if NUL terminated.
+ *
+ * Returns:
+ *       A newly allocated string that should be freed with bson_free().
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+char *
+bson_utf8_escape_for_json (const char *utf8,     /* IN */
+                           ssize_t     utf8_len) /* IN */
+{
+   bson_string_t *str;
+
+   BSON_ASSERT (utf8);
+
+   str = bson_string_new (NULL);
+
+   if (!_bson_utf8_escape_for_json_append (str, utf8, utf8_len)) {
+      bson_string_free (str, true);
+      return NULL;
+   }
+
    return bson_string_free (str, false);
 }
 
@@ -0,0 +1,327 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "bson.h"
+
+#include <string.h>
+
+#include "bson-view.h"
+
+
+/*
+ * Functions that need a bson_t wrap the view in one on the stack. This
+ * does not copy the document.
+ */
+static BSON_INLINE void
+_bson_view_as_bson (const bson_view_t *view, /* IN */
+                    bson_t            *bson) /* OUT */
+{
+   bool r;
+
+   r = bson_init_static (bson, view->data, view->len);
+   BSON_ASSERT (r);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_view_init --
+ *
+ *       Initialize @view to refer to the BSON document of @length bytes at
+ *       @data. The memory at @data is not copied, and must outlive @view.
+ *
+ * Returns:
+ *       true if @data has a valid length prefix and trailing byte;
+ *       otherwise false.
+ *
+ * Side effects:
+ *       @view is initialized.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_view_init (bson_view_t   *view,   /* OUT */
+                const uint8_t *data,   /* IN */
+                size_t         length) /* IN */
+{
+   uint32_t len_le;
+
+   BSON_ASSERT (view);
+   BSON_ASSERT (data);
+
+   view->data = NULL;
+   view->len = 0;
+
+   if ((length < 5) || (length > INT_MAX)) {
+      return false;
+   }
+
+   memcpy (&len_le, data, sizeof (len_le));
+
+   if ((size_t)BSON_UINT32_FROM_LE (len_le) != length) {
+      return false;
+   }
+
+   if (data[length - 1]) {
+      return false;
+   }
+
+   view->data = data;
+   view->len = (uint32_t)length;
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_view_init_from_bson --
+ *
+ *       Initialize @view to refer to the contents of @bson. @view is
+ *       invalidated if @bson is modified or destroyed.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @view is initialized.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+bson_view_init_from_bson (bson_view_t  *view, /* OUT */
+                          const bson_t *bson) /* IN */
+{
+   BSON_ASSERT (view);
+   BSON_ASSERT (bson);
+
+   view->data = bson_get_data (bson);
+   view->len = bson->len;
+}
+
+
+bool
+bson_view_iter_init (bson_iter_t       *iter, /* OUT */
+                     const bson_view_t *view) /* IN */
+{
+   BSON_ASSERT (iter);
+   BSON_ASSERT (view);
+
+   if (!view->data) {
+      memset (iter, 0, sizeof *iter);
+      return false;
+   }
+
+   return bson_iter_init_from_data (iter, view->data, view->len);
+}
+
+
+bool
+bson_view_iter_init_find (bson_iter_t       *iter, /* OUT */
+                          const bson_view_t *view, /* IN */
+                          const char        *key)  /* IN */
+{
+   BSON_ASSERT (key);
+
+   return bson_view_iter_init (iter, view) && bson_iter_find (iter, key);
+}
+
+
+bool
+bson_view_iter_init_find_case (bson_iter_t       *iter, /* OUT */
+                               const bson_view_t *view, /* IN */
+                               const char        *key)  /* IN */
+{
+   BSON_ASSERT (key);
+
+   return bson_view_iter_init (iter, view) &&
+          bson_iter_find_case (iter, key);
+}
+
+
+bool
+bson_view_has_field (const bson_view_t *view, /* IN */
+                     const char        *key)  /* IN */
+{
+   bson_iter_t iter;
+   bson_iter_t child;
+
+   BSON_ASSERT (view);
+   BSON_ASSERT (key);
+
+   if (NULL != strchr (key, '.')) {
+      return (bson_view_iter_init (&iter, view) &&
+              bson_iter_find_descendant (&iter, key, &child));
+   }
+
+   return bson_view_iter_init_find (&iter, view, key);
+}
+
+
+uint32_t
+bson_view_count_keys (const bson_view_t *view) /* IN */
+{
+   uint32_t count = 0;
+   bson_iter_t iter;
+
+   BSON_ASSERT (view);
+
+   if (bson_view_iter_init (&iter, view)) {
+      while (bson_iter_next (&iter)) {
+         count++;
+      }
+   }
+
+   return count;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_view_as_json --
+ *
+ *       Like bson_as_json(), for the document @view refers to.
+ *
+ * Returns:
+ *       A newly allocated string that should be freed with bson_free(),
+ *       or NULL if @view is not initialized or the document is corrupt.
+ *
+ * Side effects:
+ *       @length is set to the length of the string, if non-NULL.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+char *
+bson_view_as_json (const bson_view_t *view,   /* IN */
+                   size_t            *length) /* OUT */
+{
+   bson_t bson;
+
+   BSON_ASSERT (view);
+
+   if (!view->data) {
+      if (length) {
+         *length = 0;
+      }
+      return NULL;
+   }
+
+   _bson_view_as_bson (view, &bson);
+
+   return bson_as_json (&bson, length);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_view_validate --
+ *
+ *       Like bson_validate(), for the document @view refers to.
+ *
+ * Returns:
+ *       true if the document is valid; otherwise false and @offset is set
+ *       to the offset of the first invalid byte, if non-NULL.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_view_validate (const bson_view_t     *view,   /* IN */
+                    bson_validate_flags_t  flags,  /* IN */
+                    size_t                *offset) /* OUT */
+{
+   bson_t bson;
+
+   BSON_ASSERT (view);
+
+   if (!view->data) {
+      if (offset) {
+         *offset = 0;
+      }
+      return false;
+   }
+
+   _bson_view_as_bson (view, &bson);
+
+   return bson_validate (&bson, flags, offset);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_view_compare --
+ *
+ *       Compare two documents by their bytes, with the same ordering as
+ *       bson_compare().
+ *
+ * Returns:
+ *       Less than zero, zero, or greater than zero, as @view sorts before,
+ *       with, or after @other.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+int
+bson_view_compare (const bson_view_t *view,  /* IN */
+                   const bson_view_t *other) /* IN */
+{
+   size_t len1;
+   size_t len2;
+   int64_t ret;
+
+   BSON_ASSERT (view);
+   BSON_ASSERT (other);
+   BSON_ASSERT (view->data);
+   BSON_ASSERT (other->data);
+
+   len1 = view->len - 4;
+   len2 = other->len - 4;
+
+   if (len1 == len2) {
+      return memcmp (view->data + 4, other->data + 4, len1);
+   }
+
+   ret = memcmp (view->data + 4, other->data + 4, BSON_MIN (len1, len2));
+
+   if (ret == 0) {
+      ret = (int64_t) (len1 - len2);
+   }
+
+   return (ret < 0) ? -1 : (ret > 0);
+}
+
+
+bool
+bson_view_equal (const bson_view_t *view,  /* IN */
+                 const bson_view_t *other) /* IN */
+{
+   return !bson_view_compare (view, other);
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef BSON_VIEW_H
+#define BSON_VIEW_H
+
+
+#if !defined (BSON_INSIDE) && !defined (BSON_COMPILATION)
+# error "Only <bson.h> can be included directly."
+#endif
+
+
+#include "bson-compat.h"
+#include "bson-iter.h"
+#include "bson-types.h"
+
+
+BSON_BEGIN_DECLS
+
+
+/**
+ * bson_view_t:
+ *
+ * A read-only reference to a BSON document in memory owned by someone
+ * else. Unlike a bson_t initialized with bson_init_static(), which is 128
+ * bytes and 128-byte aligned, a bson_view_t is a pointer and a length, so
+ * large arrays of them stay compact.
+ *
+ * A view initialized with bson_view_init() has a valid length prefix and
+ * trailing byte; its contents are validated lazily, as with bson_t.
+ */
+typedef struct
+{
+   const uint8_t *data;
+   uint32_t       len;
+} bson_view_t;
+
+
+bool     bson_view_init                (bson_view_t          *view,
+                                        const uint8_t        *data,
+                                        size_t                length);
+void     bson_view_init_from_bson      (bson_view_t          *view,
+                                        const bson_t         *bson);
+bool     bson_view_iter_init           (bson_iter_t          *iter,
+                                        const bson_view_t    *view);
+bool     bson_view_iter_init_find      (bson_iter_t          *iter,
+                                        const bson_view_t    *view,
+                                        const char           *key);
+bool     bson_view_iter_init_find_case (bson_iter_t          *iter,
+                                        const bson_view_t    *view,
+                                        const char           *key);
+bool     bson_view_has_field           (const bson_view_t    *view,
+                                        const char           *key);
+uint32_t bson_view_count_keys          (const bson_view_t    *view);
+char    *bson_view_as_json             (const bson_view_t    *view,
+                                        size_t               *length);
+bool     bson_view_validate            (const bson_view_t    *view,
+                                        bson_validate_flags_t flags,
+                                        size_t               *offset);
+int      bson_view_compare             (const bson_view_t    *view,
+                                        const bson_view_t    *other);
+bool     bson_view_equal               (const bson_view_t    *view,
+                                        const bson_view_t    *other);
+
+
+BSON_END_DECLS
+
+
+#endif /* BSON_VIEW_H */
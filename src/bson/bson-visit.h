@@ -0,0 +1,394 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef BSON_VISIT_H
+#define BSON_VISIT_H
+
+
+/*
+ * Unlike the other headers, this one is not included by <bson.h>, since its
+ * inline functions need everything <bson.h> declares. Include it after.
+ */
+#ifndef BSON_H
+# error "Include <bson.h> before <bson-visit.h>."
+#endif
+
+
+#include <string.h>
+
+
+/*
+ * The specialized walker must be inlined into each function generated by
+ * BSON_VISIT_SPECIALIZE() for the visitor's callbacks to be resolved at
+ * compile time, so ask for it rather than leave it to the optimizer.
+ */
+#if defined(_MSC_VER)
+# define _BSON_VISIT_INLINE static __forceinline
+#elif defined(__GNUC__)
+# define _BSON_VISIT_INLINE static BSON_INLINE __attribute__((always_inline))
+#else
+# define _BSON_VISIT_INLINE static BSON_INLINE
+#endif
+
+
+BSON_BEGIN_DECLS
+
+
+/**
+ * BSON_VISIT_SPECIALIZE:
+ * @name: the name of the function to generate.
+ * @visitor: a static const bson_visitor_t defined before the macro is
+ *           used, such as { my_visit_before, NULL, NULL, my_visit_double }.
+ *
+ * Generates a function
+ *
+ *    static bool name (bson_iter_t *iter, void *data);
+ *
+ * that behaves exactly like bson_iter_visit_all() with @visitor.
+ * bson_iter_visit_all() calls every callback through the function-pointer
+ * table, and must check each of its thirty slots at run time. Here the
+ * table is a constant known where the walker is inlined, so each callback
+ * is a direct call the compiler can inline and the fields of types
+ * without a callback are skipped without decoding.
+ *
+ * A callback that descends into an embedded document calls @name, which
+ * can be declared ahead of it as a static function.
+ */
+#define BSON_VISIT_SPECIALIZE(name, visitor) \
+   static bool \
+   name (bson_iter_t *iter, \
+         void        *data) \
+   { \
+      return _bson_iter_visit_all_inline (iter, &(visitor), data); \
+   }
+
+
+#define _BSON_VISIT_FIELD(name) visitor->visit_##name && visitor->visit_##name
+
+
+/*
+ * The body of bson_iter_visit_all(), written against the public bson_iter_t
+ * API so it can be inlined into callers with a constant @visitor. Changes
+ * to either must be made to both.
+ */
+_BSON_VISIT_INLINE bool
+_bson_iter_visit_all_inline (bson_iter_t          *iter,    /* INOUT */
+                             const bson_visitor_t *visitor, /* IN */
+                             void                 *data)    /* IN */
+{
+   const uint8_t *raw;
+   uint32_t next_off;
+   const char *key;
+   uint8_t type;
+
+   raw = iter->raw;
+   next_off = iter->next_off;
+
+   while (bson_iter_next (iter)) {
+      key = bson_iter_key_unsafe (iter);
+
+      if (*key && !bson_utf8_validate (key, strlen (key), false)) {
+         iter->err_off = iter->off;
+         break;
+      }
+
+      if (_BSON_VISIT_FIELD (before) (iter, key, data)) {
+         return true;
+      }
+
+      switch (bson_iter_type (iter)) {
+      case BSON_TYPE_DOUBLE:
+         if (_BSON_VISIT_FIELD (double) (iter, key, bson_iter_double (iter),
+                                         data)) {
+            return true;
+         }
+         break;
+      case BSON_TYPE_UTF8:
+         {
+            uint32_t utf8_len;
+            const char *utf8;
+
+            utf8 = bson_iter_utf8 (iter, &utf8_len);
+
+            if (!bson_utf8_validate (utf8, utf8_len, true)) {
+               iter->err_off = iter->off;
+               return true;
+            }
+
+            if (_BSON_VISIT_FIELD (utf8) (iter, key, utf8_len, utf8, data)) {
+               return true;
+            }
+         }
+         break;
+      case BSON_TYPE_DOCUMENT:
+         if (visitor->visit_document) {
+            const uint8_t *docbuf = NULL;
+            uint32_t doclen = 0;
+            bson_t b;
+
+            bson_iter_document (iter, &doclen, &docbuf);
+
+            if (bson_init_static (&b, docbuf, doclen) &&
+                visitor->visit_document (iter, key, &b, data)) {
+               return true;
+            }
+         }
+         break;
+      case BSON_TYPE_ARRAY:
+         if (visitor->visit_array) {
+            const uint8_t *docbuf = NULL;
+            uint32_t doclen = 0;
+            bson_t b;
+
+            bson_iter_array (iter, &doclen, &docbuf);
+
+            if (bson_init_static (&b, docbuf, doclen) &&
+                visitor->visit_array (iter, key, &b, data)) {
+               return true;
+            }
+         }
+         break;
+      case BSON_TYPE_BINARY:
+         if (visitor->visit_binary) {
+            const uint8_t *binary = NULL;
+            bson_subtype_t subtype = BSON_SUBTYPE_BINARY;
+            uint32_t binary_len = 0;
+
+            bson_iter_binary (iter, &subtype, &binary_len, &binary);
+
+            if (visitor->visit_binary (iter, key, subtype, binary_len,
+                                       binary, data)) {
+               return true;
+            }
+         }
+         break;
+      case BSON_TYPE_UNDEFINED:
+         if (_BSON_VISIT_FIELD (undefined) (iter, key, data)) {
+            return true;
+         }
+         break;
+      case BSON_TYPE_OID:
+         if (_BSON_VISIT_FIELD (oid) (iter, key, bson_iter_oid (iter), data)) {
+            return true;
+         }
+         break;
+      case BSON_TYPE_BOOL:
+         if (_BSON_VISIT_FIELD (bool) (iter, key, bson_iter_bool (iter),
+                                       data)) {
+            return true;
+         }
+         break;
+      case BSON_TYPE_DATE_TIME:
+         if (_BSON_VISIT_FIELD (date_time) (iter, key,
+                                            bson_iter_date_time (iter),
+                                            data)) {
+            return true;
+         }
+         break;
+      case BSON_TYPE_NULL:
+         if (_BSON_VISIT_FIELD (null) (iter, key, data)) {
+            return true;
+         }
+         break;
+      case BSON_TYPE_REGEX:
+         if (visitor->visit_regex) {
+            const char *regex;
+            const char *options = NULL;
+
+            regex = bson_iter_regex (iter, &options);
+
+            if (visitor->visit_regex (iter, key, regex, options, data)) {
+               return true;
+            }
+         }
+         break;
+      case BSON_TYPE_DBPOINTER:
+         if (visitor->visit_dbpointer) {
+            uint32_t collection_len = 0;
+            const char *collection = NULL;
+            const bson_oid_t *oid = NULL;
+
+            bson_iter_dbpointer (iter, &collection_len, &collection, &oid);
+
+            if (visitor->visit_dbpointer (iter, key, collection_len,
+                                          collection, oid, data)) {
+               return true;
+            }
+         }
+         break;
+      case BSON_TYPE_CODE:
+         if (visitor->visit_code) {
+            uint32_t code_len;
+            const char *code;
+
+            code = bson_iter_code (iter, &code_len);
+
+            if (visitor->visit_code (iter, key, code_len, code, data)) {
+               return true;
+            }
+         }
+         break;
+      case BSON_TYPE_SYMBOL:
+         if (visitor->visit_symbol) {
+            uint32_t symbol_len;
+            const char *symbol;
+
+            symbol = bson_iter_symbol (iter, &symbol_len);
+
+            if (visitor->visit_symbol (iter, key, symbol_len, symbol, data)) {
+               return true;
+            }
+         }
+         break;
+      case BSON_TYPE_CODEWSCOPE:
+         if (visitor->visit_codewscope) {
+            uint32_t length = 0;
+            const char *code;
+            const uint8_t *docbuf = NULL;
+            uint32_t doclen = 0;
+            bson_t b;
+
+            code = bson_iter_codewscope (iter, &length, &doclen, &docbuf);
+
+            if (bson_init_static (&b, docbuf, doclen) &&
+                visitor->visit_codewscope (iter, key, length, code, &b,
+                                           data)) {
+               return true;
+            }
+         }
+         break;
+      case BSON_TYPE_INT32:
+         if (_BSON_VISIT_FIELD (int32) (iter, key, bson_iter_int32 (iter),
+                                        data)) {
+            return true;
+         }
+         break;
+      case BSON_TYPE_TIMESTAMP:
+         if (visitor->visit_timestamp) {
+            uint32_t timestamp;
+            uint32_t increment;
+
+            bson_iter_timestamp (iter, &timestamp, &increment);
+
+            if (visitor->visit_timestamp (iter, key, timestamp, increment,
+                                          data)) {
+               return true;
+            }
+         }
+         break;
+      case BSON_TYPE_INT64:
+         if (_BSON_VISIT_FIELD (int64) (iter, key, bson_iter_int64 (iter),
+                                        data)) {
+            return true;
+         }
+         break;
+#ifdef BSON_EXPERIMENTAL_FEATURES
+      case BSON_TYPE_DECIMAL128:
+         if (visitor->visit_decimal128) {
+            bson_decimal128_t dec;
+
+            bson_iter_decimal128 (iter, &dec);
+
+            if (visitor->visit_decimal128 (iter, key, &dec, data)) {
+               return true;
+            }
+         }
+         break;
+#endif
+      case BSON_TYPE_MAXKEY:
+         if (_BSON_VISIT_FIELD (maxkey) (iter, key, data)) {
+            return true;
+         }
+         break;
+      case BSON_TYPE_MINKEY:
+         if (_BSON_VISIT_FIELD (minkey) (iter, key, data)) {
+            return true;
+         }
+         break;
+      case BSON_TYPE_EOD:
+      default:
+         break;
+      }
+
+      if (_BSON_VISIT_FIELD (after) (iter, key, data)) {
+         return true;
+      }
+
+      raw = iter->raw;
+      next_off = iter->next_off;
+   }
+
+   if (iter->err_off) {
+      /*
+       * bson_iter_next() does not say why it failed. The type byte of a
+       * field of a type it does not support is followed by a terminated
+       * key, or it would have failed on the key instead.
+       */
+      type = raw[next_off];
+
+      if (visitor->visit_unsupported_type &&
+          type > BSON_TYPE_DECIMAL128 &&
+          type != BSON_TYPE_MAXKEY &&
+          type != BSON_TYPE_MINKEY) {
+         key = (const char *)raw + next_off + 1;
+
+         if (bson_utf8_validate (key, strlen (key), false)) {
+            visitor->visit_unsupported_type (iter, key, type, data);
+            return false;
+         }
+      }
+
+      if (visitor->visit_corrupt) {
+         visitor->visit_corrupt (iter, data);
+      }
+   }
+
+   return false;
+}
+
+
+#undef _BSON_VISIT_FIELD
+
+
+BSON_END_DECLS
+
+
+#ifdef __cplusplus
+
+/*
+ * bson_iter_visit_all_specialized:
+ *
+ * The C++ equivalent of BSON_VISIT_SPECIALIZE(): each instantiation for a
+ * constant bson_visitor_t with external linkage is a walker with the
+ * visitor's callbacks resolved at compile time.
+ *
+ *    extern const bson_visitor_t my_visitor;
+ *    const bson_visitor_t my_visitor = { ... };
+ *    bson_iter_visit_all_specialized<&my_visitor> (&iter, data);
+ */
+template <const bson_visitor_t *Visitor>
+inline bool
+bson_iter_visit_all_specialized (bson_iter_t *iter,
+                                 void        *data)
+{
+   return _bson_iter_visit_all_inline (iter, Visitor, data);
+}
+
+#endif /* __cplusplus */
+
+
+#endif /* BSON_VISIT_H */
@@ -0,0 +1,519 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "bson.h"
+
+#include <string.h>
+
+#include "bson-walker.h"
+
+
+/*
+ * The number of frames kept inside the walker before its stack moves to
+ * the heap.
+ */
+#define BSON_WALKER_INLINE_FRAMES 8
+
+
+typedef struct
+{
+   const uint8_t *raw;
+   uint32_t       len;
+   uint32_t       off;
+} bson_walker_frame_t;
+
+
+typedef struct
+{
+   bson_iter_t          iter;
+   const uint8_t       *data;
+   size_t               err_offset;
+   uint32_t             depth;
+   uint32_t             max_depth;
+   int                  flags;
+   bool                 enter;
+   bool                 done;
+   bson_walk_event_t    event;
+   uint32_t             n_heap_frames;
+   bson_walker_frame_t *heap_frames;   /* NULL while the frames fit inline */
+   bson_walker_frame_t  frames [BSON_WALKER_INLINE_FRAMES];
+} bson_walker_impl_t;
+
+
+BSON_STATIC_ASSERT (sizeof (bson_walker_impl_t) <= sizeof (bson_walker_t));
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_walker_init --
+ *
+ *       Initialize @walker to walk @bson, which must outlive @walker. The
+ *       walk starts before the first field of @bson and descends into
+ *       embedded documents however deeply they are nested.
+ *
+ * Returns:
+ *       true if @bson has a valid length prefix; otherwise false.
+ *
+ * Side effects:
+ *       @walker is initialized, and must be freed with
+ *       bson_walker_destroy().
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_walker_init (bson_walker_t *walker, /* OUT */
+                  const bson_t  *bson)   /* IN */
+{
+   BSON_ASSERT (walker);
+   BSON_ASSERT (bson);
+
+   return bson_walker_init_from_data (walker, bson_get_data (bson),
+                                      bson->len);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_walker_init_from_data --
+ *
+ *       Like bson_walker_init(), for the BSON document of @length bytes at
+ *       @data.
+ *
+ * Returns:
+ *       true if @data has a valid length prefix and trailing byte;
+ *       otherwise false.
+ *
+ * Side effects:
+ *       @walker is initialized.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_walker_init_from_data (bson_walker_t *walker, /* OUT */
+                            const uint8_t *data,   /* IN */
+                            size_t         length) /* IN */
+{
+   bson_walker_impl_t *impl = (bson_walker_impl_t *)walker;
+
+   BSON_ASSERT (walker);
+   BSON_ASSERT (data);
+
+   impl->data = data;
+   impl->err_offset = 0;
+   impl->depth = 0;
+   impl->max_depth = UINT32_MAX;
+   impl->flags = BSON_WALKER_NONE;
+   impl->enter = false;
+   impl->heap_frames = NULL;
+   impl->n_heap_frames = 0;
+
+   if (!bson_iter_init_from_data (&impl->iter, data, length) ||
+       data[length - 1]) {
+      impl->done = true;
+      impl->event = BSON_WALK_CORRUPT;
+      return false;
+   }
+
+   impl->done = false;
+   impl->event = BSON_WALK_END;
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_walker_destroy --
+ *
+ *       Free the stack @walker grew on the heap, if any. @walker may be
+ *       initialized again afterwards.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+bson_walker_destroy (bson_walker_t *walker) /* IN */
+{
+   bson_walker_impl_t *impl = (bson_walker_impl_t *)walker;
+
+   if (walker) {
+      bson_free (impl->heap_frames);
+      impl->heap_frames = NULL;
+      impl->n_heap_frames = 0;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_walker_set_max_depth --
+ *
+ *       Limit the walk to @max_depth levels of embedded documents. An
+ *       embedded document nested deeper is returned as
+ *       BSON_WALK_TOO_DEEP and its fields are skipped. With a limit of 0
+ *       only the top-level fields are walked. By default there is no
+ *       limit.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+bson_walker_set_max_depth (bson_walker_t *walker,    /* IN */
+                           uint32_t       max_depth) /* IN */
+{
+   BSON_ASSERT (walker);
+
+   ((bson_walker_impl_t *)walker)->max_depth = max_depth;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_walker_set_flags --
+ *
+ *       Set the bson_walker_flags_t for the walk. By default the scope of
+ *       a code with scope field is not descended into; with
+ *       BSON_WALKER_SCOPES it is walked like an embedded document.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+bson_walker_set_flags (bson_walker_t       *walker, /* IN */
+                       bson_walker_flags_t  flags)  /* IN */
+{
+   BSON_ASSERT (walker);
+
+   ((bson_walker_impl_t *)walker)->flags = flags;
+}
+
+
+static bson_walk_event_t
+_bson_walker_corrupt (bson_walker_impl_t *impl,   /* IN */
+                      size_t              offset) /* IN */
+{
+   impl->err_offset = offset;
+   impl->done = true;
+   impl->event = BSON_WALK_CORRUPT;
+
+   return BSON_WALK_CORRUPT;
+}
+
+
+/*
+ * Returns the frame for level @depth of the stack, first moving the stack
+ * to the heap or doubling it there if it is full.
+ */
+static bson_walker_frame_t *
+_bson_walker_frame (bson_walker_impl_t *impl,  /* IN */
+                    uint32_t            depth) /* IN */
+{
+   if (depth < BSON_WALKER_INLINE_FRAMES) {
+      return &impl->frames[depth];
+   }
+
+   if (depth >= impl->n_heap_frames) {
+      if (!impl->heap_frames) {
+         impl->n_heap_frames = 2 * BSON_WALKER_INLINE_FRAMES;
+         impl->heap_frames =
+            bson_malloc (impl->n_heap_frames * sizeof *impl->heap_frames);
+      } else {
+         impl->n_heap_frames *= 2;
+         impl->heap_frames = bson_realloc (
+            impl->heap_frames,
+            impl->n_heap_frames * sizeof *impl->heap_frames);
+      }
+   }
+
+   return &impl->heap_frames[depth];
+}
+
+
+/*
+ * Pushes a frame for the field at the iterator and moves the iterator to
+ * the start of the document it holds.
+ */
+static bool
+_bson_walker_push (bson_walker_impl_t *impl) /* IN */
+{
+   bson_walker_frame_t *frame;
+   bson_iter_t *iter = &impl->iter;
+   bson_iter_t child;
+   const uint8_t *data = NULL;
+   uint32_t code_len;
+   uint32_t len = 0;
+
+   switch (bson_iter_type (iter)) {
+   case BSON_TYPE_DOCUMENT:
+      bson_iter_document (iter, &len, &data);
+      break;
+   case BSON_TYPE_ARRAY:
+      bson_iter_array (iter, &len, &data);
+      break;
+   case BSON_TYPE_CODEWSCOPE:
+      bson_iter_codewscope (iter, &code_len, &len, &data);
+      break;
+   default:
+      BSON_ASSERT (false);
+      return false;
+   }
+
+   if (!data || !bson_iter_init_from_data (&child, data, len) ||
+       data[len - 1]) {
+      return false;
+   }
+
+   frame = _bson_walker_frame (impl, impl->depth++);
+   frame->raw = iter->raw;
+   frame->len = iter->len;
+   frame->off = iter->off;
+
+   *iter = child;
+
+   return true;
+}
+
+
+/*
+ * Pops the top frame, leaving the iterator on the field holding the
+ * document that just ended.
+ */
+static void
+_bson_walker_pop (bson_walker_impl_t *impl) /* IN */
+{
+   bson_walker_frame_t *frame;
+   bson_iter_t *iter = &impl->iter;
+   bool r;
+
+   frame = _bson_walker_frame (impl, --impl->depth);
+   iter->raw = frame->raw;
+   iter->len = frame->len;
+   iter->next_off = frame->off;
+   iter->err_off = 0;
+
+   r = bson_iter_next (iter);
+   BSON_ASSERT (r);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_walker_next --
+ *
+ *       Advance @walker to the next event of a depth-first walk.
+ *
+ *       BSON_WALK_VALUE, BSON_WALK_DOCUMENT_BEGIN and BSON_WALK_TOO_DEEP
+ *       are returned for a field, which bson_walker_get_iter() is on.
+ *       The fields of an embedded document or array follow its
+ *       BSON_WALK_DOCUMENT_BEGIN, and are followed by a
+ *       BSON_WALK_DOCUMENT_END for which the iterator is back on the
+ *       field holding it.
+ *
+ *       A field whose key is not valid UTF-8, or an embedded document
+ *       whose length or trailing byte is invalid, is reported as
+ *       corruption like any other malformed field.
+ *
+ * Returns:
+ *       The next event. Once BSON_WALK_END or BSON_WALK_CORRUPT has been
+ *       returned it is returned for every subsequent call.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bson_walk_event_t
+bson_walker_next (bson_walker_t *walker) /* IN */
+{
+   bson_walker_impl_t *impl = (bson_walker_impl_t *)walker;
+   bson_iter_t *iter;
+   const uint8_t *raw;
+   const char *key;
+
+   BSON_ASSERT (walker);
+
+   if (impl->done) {
+      return impl->event;
+   }
+
+   iter = &impl->iter;
+
+   if (impl->enter) {
+      impl->enter = false;
+
+      if (!_bson_walker_push (impl)) {
+         return _bson_walker_corrupt (impl,
+                                      bson_walker_get_offset (walker));
+      }
+   }
+
+   raw = iter->raw;
+
+   if (!bson_iter_next (iter)) {
+      if (iter->err_off) {
+         return _bson_walker_corrupt (impl, (size_t)(raw - impl->data) +
+                                      iter->err_off);
+      }
+
+      if (!impl->depth) {
+         impl->done = true;
+         impl->event = BSON_WALK_END;
+         return BSON_WALK_END;
+      }
+
+      _bson_walker_pop (impl);
+
+      return BSON_WALK_DOCUMENT_END;
+   }
+
+   key = bson_iter_key (iter);
+
+   if (*key && !bson_utf8_validate (key, strlen (key), false)) {
+      return _bson_walker_corrupt (impl, bson_walker_get_offset (walker));
+   }
+
+   switch (bson_iter_type (iter)) {
+   case BSON_TYPE_CODEWSCOPE:
+      if (!(impl->flags & BSON_WALKER_SCOPES)) {
+         return BSON_WALK_VALUE;
+      }
+      /* FALL THROUGH */
+   case BSON_TYPE_DOCUMENT:
+   case BSON_TYPE_ARRAY:
+      if (impl->depth >= impl->max_depth) {
+         return BSON_WALK_TOO_DEEP;
+      }
+
+      impl->enter = true;
+      return BSON_WALK_DOCUMENT_BEGIN;
+   default:
+      return BSON_WALK_VALUE;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_walker_get_iter --
+ *
+ *       Fetch the iterator on the field of the current event. It is valid
+ *       until the next call to bson_walker_next(), and must not be
+ *       advanced.
+ *
+ * Returns:
+ *       A bson_iter_t owned by @walker.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+const bson_iter_t *
+bson_walker_get_iter (const bson_walker_t *walker) /* IN */
+{
+   BSON_ASSERT (walker);
+
+   return &((const bson_walker_impl_t *)walker)->iter;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_walker_get_depth --
+ *
+ *       Fetch the number of documents enclosing the field of the current
+ *       event, not counting the top-level document; 0 for its fields.
+ *
+ * Returns:
+ *       The depth of the current field.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+uint32_t
+bson_walker_get_depth (const bson_walker_t *walker) /* IN */
+{
+   BSON_ASSERT (walker);
+
+   return ((const bson_walker_impl_t *)walker)->depth;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_walker_get_offset --
+ *
+ *       Fetch the offset of the field of the current event from the
+ *       start of the top-level document or, after BSON_WALK_CORRUPT, the
+ *       offset of the corruption.
+ *
+ * Returns:
+ *       A byte offset.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+size_t
+bson_walker_get_offset (const bson_walker_t *walker) /* IN */
+{
+   const bson_walker_impl_t *impl = (const bson_walker_impl_t *)walker;
+
+   BSON_ASSERT (walker);
+
+   if (impl->done) {
+      return impl->err_offset;
+   }
+
+   return (size_t)(impl->iter.raw - impl->data) + impl->iter.off;
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef BSON_WALKER_H
+#define BSON_WALKER_H
+
+
+#if !defined (BSON_INSIDE) && !defined (BSON_COMPILATION)
+# error "Only <bson.h> can be included directly."
+#endif
+
+
+#include "bson-compat.h"
+#include "bson-types.h"
+
+
+BSON_BEGIN_DECLS
+
+
+/**
+ * bson_walk_event_t:
+ *
+ * The events returned by bson_walker_next().
+ */
+typedef enum
+{
+   BSON_WALK_END,            /* every field has been walked */
+   BSON_WALK_DOCUMENT_BEGIN, /* an embedded document or array */
+   BSON_WALK_DOCUMENT_END,
+   BSON_WALK_VALUE,          /* any other field */
+   BSON_WALK_TOO_DEEP,       /* an embedded document past the depth limit */
+   BSON_WALK_CORRUPT,
+} bson_walk_event_t;
+
+
+/**
+ * bson_walker_flags_t:
+ *
+ * Flags changing which fields a bson_walker_t descends into.
+ */
+typedef enum
+{
+   BSON_WALKER_NONE   = 0,
+   BSON_WALKER_SCOPES = 1 << 0, /* the scope of code with scope fields */
+} bson_walker_flags_t;
+
+
+/**
+ * bson_walker_t:
+ *
+ * A non-recursive, depth-first walk over a document and everything
+ * embedded in it, returned as a flat stream of events. Where a visitor
+ * recursing through bson_iter_visit_all() uses a C stack frame, a bson_t
+ * and a bson_iter_t per level, the walker keeps one bson_iter_t and a
+ * stack of twelve or sixteen byte frames. The first levels of the stack
+ * are kept inline so the walker can live on the stack; deeper documents
+ * grow it on the heap until bson_walker_destroy().
+ *
+ * The contents of bson_walker_t are private.
+ */
+BSON_ALIGNED_BEGIN (128)
+typedef struct
+{
+   /*< private >*/
+   uint8_t padding[256];
+} bson_walker_t
+BSON_ALIGNED_END (128);
+
+
+bool               bson_walker_init           (bson_walker_t       *walker,
+                                               const bson_t        *bson);
+bool               bson_walker_init_from_data (bson_walker_t       *walker,
+                                               const uint8_t       *data,
+                                               size_t               length);
+void               bson_walker_destroy        (bson_walker_t       *walker);
+void               bson_walker_set_max_depth  (bson_walker_t       *walker,
+                                               uint32_t             max_depth);
+void               bson_walker_set_flags      (bson_walker_t       *walker,
+                                               bson_walker_flags_t  flags);
+bson_walk_event_t  bson_walker_next           (bson_walker_t       *walker);
+const bson_iter_t *bson_walker_get_iter       (const bson_walker_t *walker);
+uint32_t           bson_walker_get_depth      (const bson_walker_t *walker);
+size_t             bson_walker_get_offset     (const bson_walker_t *walker);
+
+
+BSON_END_DECLS
+
+
+#endif /* BSON_WALKER_H */
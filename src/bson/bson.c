@@ -19,7 +19,12 @@
 #include "bson-config.h"
 #include "b64_ntop.h"
 #include "bson-private.h"
+#include "bson-stats-private.h"
 #include "bson-string.h"
+#include "bson-utf8-private.h"
+
+#define BSON_PROBE_DEFINE_SEMAPHORES
+#include "bson-trace-private.h"
 
 #include <stdarg.h>
 #include <string.h>
@@ -31,8 +36,11 @@
 #endif
 
 
+/* the most bson_as_json() reserves before it has written anything */
+#define BSON_AS_JSON_MAX_RESERVE (64 * 1024)
+
+
 typedef enum {
-   BSON_VALIDATE_PHASE_START,
    BSON_VALIDATE_PHASE_TOP,
    BSON_VALIDATE_PHASE_LF_REF_KEY,
    BSON_VALIDATE_PHASE_LF_REF_UTF8,
@@ -48,9 +56,12 @@ typedef enum {
  */
 typedef struct
 {
-   bson_validate_flags_t flags;
-   ssize_t               err_offset;
-   bson_validate_phase_t phase;
+   bson_validate_flags_t  flags;
+   ssize_t                err_offset;
+   bson_validate_phase_t  phase;
+   bson_validate_phase_t *phases;       /* phase of each enclosing document */
+   uint32_t               n_phases;
+   bson_validate_phase_t  inline_phases [16];
 } bson_validate_state_t;
 
 
@@ -63,19 +74,6 @@ typedef struct
 } bson_json_state_t;
 
 
-/*
- * Forward declarations.
- */
-static bool _bson_as_json_visit_array    (const bson_iter_t *iter,
-                                          const char        *key,
-                                          const bson_t      *v_array,
-                                          void              *data);
-static bool _bson_as_json_visit_document (const bson_iter_t *iter,
-                                          const char        *key,
-                                          const bson_t      *v_document,
-                                          void              *data);
-
-
 /*
  * Globals.
  */
@@ -107,6 +105,7 @@ _bson_impl_inline_grow (bson_impl_inline_t *impl, /* IN */
    bson_impl_alloc_t *alloc = (bson_impl_alloc_t *)impl;
    uint8_t *data;
    size_t req;
+   int64_t start;
 
    if (((size_t)impl->len + size) <= sizeof impl->data) {
       return true;
@@ -115,6 +114,7 @@ _bson_impl_inline_grow (bson_impl_inline_t *impl, /* IN */
    req = bson_next_power_of_two (impl->len + size);
 
    if (req <= INT32_MAX) {
+      start = BSON_PROBE_CLOCK (bson__grow);
       data = bson_malloc (req);
 
       memcpy (data, impl->data, impl->len);
@@ -129,6 +129,9 @@ _bson_impl_inline_grow (bson_impl_inline_t *impl, /* IN */
       alloc->realloc = bson_realloc_ctx;
       alloc->realloc_func_ctx = NULL;
 
+      BSON_PROBE3 (bson__grow, sizeof impl->data, req,
+                   BSON_PROBE_ELAPSED (start));
+
       return true;
    }
 
@@ -158,6 +161,8 @@ _bson_impl_alloc_grow (bson_impl_alloc_t *impl, /* IN */
                        size_t             size) /* IN */
 {
    size_t req;
+   size_t old_len;
+   int64_t start;
 
    /*
     * Determine how many bytes we need for this document in the buffer
@@ -172,8 +177,11 @@ _bson_impl_alloc_grow (bson_impl_alloc_t *impl, /* IN */
    req = bson_next_power_of_two (req);
 
    if ((req <= INT32_MAX) && impl->realloc) {
+      start = BSON_PROBE_CLOCK (bson__grow);
+      old_len = *impl->buflen;
       *impl->buf = impl->realloc (*impl->buf, req, impl->realloc_func_ctx);
       *impl->buflen = req;
+      BSON_PROBE3 (bson__grow, old_len, req, BSON_PROBE_ELAPSED (start));
       return true;
    }
 
@@ -823,6 +831,213 @@ bson_append_binary (bson_t         *bson,       /* IN */
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_append_reserve --
+ *
+ *       Start a field of @type whose value is @header, then @length bytes
+ *       for the caller to fill, then @trailer bytes written at commit.
+ *
+ *       The field is written after the end of @bson, over its trailing
+ *       NUL byte, but @bson->len is not changed until
+ *       bson_append_reserve_commit(). Until then the header records how
+ *       many bytes were reserved, and @bson is marked as working on a
+ *       child so that nothing else is appended.
+ *
+ * Returns:
+ *       A pointer to the @length reserved bytes, or NULL if @bson cannot
+ *       be appended to or would overflow.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static uint8_t *
+_bson_append_reserve (bson_t        *bson,       /* IN */
+                      uint8_t        type,       /* IN */
+                      const char    *key,        /* IN */
+                      int            key_length, /* IN */
+                      const uint8_t *header,     /* IN */
+                      uint32_t       header_len, /* IN */
+                      uint32_t       length,     /* IN */
+                      uint32_t       trailer)    /* IN */
+{
+   uint64_t n_bytes;
+   uint8_t *buf;
+
+   BSON_ASSERT (bson);
+   BSON_ASSERT (key);
+
+   if (bson->flags & (BSON_FLAG_IN_CHILD | BSON_FLAG_RDONLY)) {
+      return NULL;
+   }
+
+   if (key_length < 0) {
+      key_length = (int)strlen (key);
+   }
+
+   n_bytes = 1 + (uint64_t)key_length + 1 + header_len + length + trailer;
+
+   if (BSON_UNLIKELY (n_bytes > (BSON_MAX_SIZE - bson->len))) {
+      return NULL;
+   }
+
+   if (BSON_UNLIKELY (!_bson_grow (bson, (uint32_t)n_bytes))) {
+      return NULL;
+   }
+
+   buf = _bson_data (bson) + bson->len - 1;
+   *buf++ = type;
+   memcpy (buf, key, key_length);
+   buf += key_length;
+   *buf++ = '\0';
+   memcpy (buf, header, header_len);
+
+   bson->flags |= (BSON_FLAG_IN_CHILD | BSON_FLAG_IN_RESERVE);
+
+   return buf + header_len;
+}
+
+
+uint8_t *
+bson_append_binary_reserve (bson_t         *bson,       /* IN */
+                            const char     *key,        /* IN */
+                            int             key_length, /* IN */
+                            bson_subtype_t  subtype,    /* IN */
+                            uint32_t        length)     /* IN */
+{
+   uint8_t header[9];
+   uint32_t length_le;
+   uint32_t header_len = 5;
+
+   /* a @length that would wrap is rejected by _bson_append_reserve() */
+   if (subtype == BSON_SUBTYPE_BINARY_DEPRECATED) {
+      length_le = BSON_UINT32_TO_LE (length + 4);
+      memcpy (&header[0], &length_le, 4);
+      header[4] = (uint8_t)subtype;
+      length_le = BSON_UINT32_TO_LE (length);
+      memcpy (&header[5], &length_le, 4);
+      header_len = 9;
+   } else {
+      length_le = BSON_UINT32_TO_LE (length);
+      memcpy (&header[0], &length_le, 4);
+      header[4] = (uint8_t)subtype;
+   }
+
+   return _bson_append_reserve (bson, BSON_TYPE_BINARY, key, key_length,
+                                header, header_len, length, 0);
+}
+
+
+char *
+bson_append_utf8_reserve (bson_t     *bson,       /* IN */
+                          const char *key,        /* IN */
+                          int         key_length, /* IN */
+                          uint32_t    length)     /* IN */
+{
+   uint32_t length_le;
+
+   length_le = BSON_UINT32_TO_LE (length + 1);
+
+   return (char *)_bson_append_reserve (bson, BSON_TYPE_UTF8, key,
+                                        key_length, (uint8_t *)&length_le, 4,
+                                        length, 1);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * bson_append_reserve_commit --
+ *
+ *       Finish the field started by bson_append_binary_reserve() or
+ *       bson_append_utf8_reserve() with the first @length bytes that were
+ *       reserved.
+ *
+ * Returns:
+ *       true if successful; false if @length is larger than reserved, in
+ *       which case the field is still pending.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+bson_append_reserve_commit (bson_t   *bson,   /* IN */
+                            uint32_t  length) /* IN */
+{
+   uint32_t reserved;
+   uint32_t length_le;
+   uint8_t *start;
+   uint8_t *buf;
+   bool deprecated;
+
+   BSON_ASSERT (bson);
+   BSON_ASSERT ((bson->flags & BSON_FLAG_IN_RESERVE));
+
+   /* the type, key and header written by _bson_append_reserve() */
+   start = _bson_data (bson) + bson->len - 1;
+   buf = start + 1;
+   buf += strlen ((const char *)buf) + 1;
+   memcpy (&reserved, buf, 4);
+   reserved = BSON_UINT32_FROM_LE (reserved);
+
+   if (*start == BSON_TYPE_UTF8) {
+      if (length > reserved - 1) {
+         return false;
+      }
+
+      length_le = BSON_UINT32_TO_LE (length + 1);
+      memcpy (buf, &length_le, 4);
+      buf += 4 + length;
+      *buf++ = '\0';
+   } else {
+      BSON_ASSERT (*start == BSON_TYPE_BINARY);
+
+      deprecated = buf[4] == BSON_SUBTYPE_BINARY_DEPRECATED;
+
+      if (length > (deprecated ? reserved - 4 : reserved)) {
+         return false;
+      }
+
+      length_le = BSON_UINT32_TO_LE (deprecated ? length + 4 : length);
+      memcpy (buf, &length_le, 4);
+      buf += 5;
+
+      if (deprecated) {
+         length_le = BSON_UINT32_TO_LE (length);
+         memcpy (buf, &length_le, 4);
+         buf += 4;
+      }
+
+      buf += length;
+   }
+
+   bson->flags &= ~(BSON_FLAG_IN_CHILD | BSON_FLAG_IN_RESERVE);
+   bson->len += (uint32_t)(buf - start);
+   _bson_data (bson)[bson->len - 1] = '\0';
+   _bson_encode_length (bson);
+
+   return true;
+}
+
+
+void
+bson_append_reserve_cancel (bson_t *bson) /* IN */
+{
+   BSON_ASSERT (bson);
+   BSON_ASSERT ((bson->flags & BSON_FLAG_IN_RESERVE));
+
+   bson->flags &= ~(BSON_FLAG_IN_CHILD | BSON_FLAG_IN_RESERVE);
+   _bson_data (bson)[bson->len - 1] = '\0';
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -1827,88 +2042,517 @@ bson_append_value (bson_t             *bson,
 }
 
 
-void
-bson_init (bson_t *bson)
+/* a document or array value must be a well-formed, length-prefixed buffer */
+static bool
+_bson_field_doc_ok (const uint8_t *data,     /* IN */
+                    uint32_t       data_len) /* IN */
 {
-   bson_impl_inline_t *impl = (bson_impl_inline_t *)bson;
+   uint32_t len_le;
 
-   BSON_ASSERT (bson);
+   if (!data || data_len < 5 || data_len > INT_MAX) {
+      return false;
+   }
 
-   impl->flags = BSON_FLAG_INLINE | BSON_FLAG_STATIC;
-   impl->len = 5;
-   impl->data[0] = 5;
-   impl->data[1] = 0;
-   impl->data[2] = 0;
-   impl->data[3] = 0;
-   impl->data[4] = 0;
+   memcpy (&len_le, data, sizeof len_le);
+
+   return BSON_UINT32_FROM_LE (len_le) == data_len && !data[data_len - 1];
 }
 
 
-void
-bson_reinit (bson_t *bson)
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_field_value_len --
+ *
+ *       Compute how @value is appended: the type byte to write, which
+ *       differs from @value's type where bson_append_value() would write a
+ *       null or plain code instead, and the number of bytes after the key.
+ *
+ * Returns:
+ *       true if successful; false if @value cannot be appended.
+ *
+ * Side effects:
+ *       @type and @len are set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_bson_field_value_len (const bson_value_t *value, /* IN */
+                       uint8_t            *type,  /* OUT */
+                       uint64_t           *len)   /* OUT */
 {
-   uint8_t *data;
+   const char *str;
 
-   BSON_ASSERT (bson);
+   *type = (uint8_t)value->value_type;
 
-   data = _bson_data (bson);
+   switch (value->value_type) {
+   case BSON_TYPE_DOUBLE:
+   case BSON_TYPE_DATE_TIME:
+   case BSON_TYPE_TIMESTAMP:
+   case BSON_TYPE_INT64:
+      *len = 8;
+      return true;
+   case BSON_TYPE_INT32:
+      *len = 4;
+      return true;
+   case BSON_TYPE_BOOL:
+      *len = 1;
+      return true;
+   case BSON_TYPE_OID:
+      *len = 12;
+      return true;
+   case BSON_TYPE_UNDEFINED:
+   case BSON_TYPE_NULL:
+   case BSON_TYPE_MAXKEY:
+   case BSON_TYPE_MINKEY:
+      *len = 0;
+      return true;
+   case BSON_TYPE_UTF8:
+      if (!value->value.v_utf8.str) {
+         *type = BSON_TYPE_NULL;
+         *len = 0;
+         return true;
+      }
 
-   bson->len = 5;
+      *len = 4 + (uint64_t)value->value.v_utf8.len + 1;
+      return true;
+   case BSON_TYPE_SYMBOL:
+      if (!value->value.v_symbol.symbol) {
+         *type = BSON_TYPE_NULL;
+         *len = 0;
+         return true;
+      }
 
-   data [0] = 5;
-   data [1] = 0;
-   data [2] = 0;
-   data [3] = 0;
-   data [4] = 0;
-}
+      *len = 4 + (uint64_t)value->value.v_symbol.len + 1;
+      return true;
+   case BSON_TYPE_DOCUMENT:
+   case BSON_TYPE_ARRAY:
+      *len = value->value.v_doc.data_len;
+      return _bson_field_doc_ok (value->value.v_doc.data,
+                                 value->value.v_doc.data_len);
+   case BSON_TYPE_BINARY:
+      if (!value->value.v_binary.data) {
+         return false;
+      }
 
+      *len = 4 + 1 + (uint64_t)value->value.v_binary.data_len;
 
-bool
-bson_init_static (bson_t        *bson,
-                  const uint8_t *data,
-                  size_t         length)
-{
-   bson_impl_alloc_t *impl = (bson_impl_alloc_t *)bson;
-   uint32_t len_le;
+      if (value->value.v_binary.subtype == BSON_SUBTYPE_BINARY_DEPRECATED) {
+         *len += 4;
+      }
 
-   BSON_ASSERT (bson);
-   BSON_ASSERT (data);
+      return true;
+   case BSON_TYPE_REGEX:
+      str = value->value.v_regex.regex;
+      *len = strlen (str ? str : "") + 1;
+      str = value->value.v_regex.options;
+      *len += strlen (str ? str : "") + 1;
+      return true;
+   case BSON_TYPE_DBPOINTER:
+      if (!value->value.v_dbpointer.collection) {
+         return false;
+      }
 
-   if ((length < 5) || (length > INT_MAX)) {
-      return false;
-   }
+      *len = 4 + strlen (value->value.v_dbpointer.collection) + 1 + 12;
+      return true;
+   case BSON_TYPE_CODE:
+      if (!value->value.v_code.code) {
+         return false;
+      }
 
-   memcpy (&len_le, data, sizeof (len_le));
+      *len = 4 + strlen (value->value.v_code.code) + 1;
+      return true;
+   case BSON_TYPE_CODEWSCOPE:
+      if (!value->value.v_codewscope.code ||
+          !_bson_field_doc_ok (value->value.v_codewscope.scope_data,
+                               value->value.v_codewscope.scope_len)) {
+         return false;
+      }
 
-   if ((size_t)BSON_UINT32_FROM_LE (len_le) != length) {
-      return false;
-   }
+      *len = 4 + strlen (value->value.v_codewscope.code) + 1;
 
-   if (data[length - 1]) {
+      /* like bson_append_code_with_scope(), an empty scope is plain code */
+      if (value->value.v_codewscope.scope_len == 5) {
+         *type = BSON_TYPE_CODE;
+      } else {
+         *len += 4 + value->value.v_codewscope.scope_len;
+      }
+
+      return true;
+#ifdef BSON_EXPERIMENTAL_FEATURES
+   case BSON_TYPE_DECIMAL128:
+      *len = 16;
+      return true;
+#endif
+   case BSON_TYPE_EOD:
+   default:
       return false;
    }
+}
 
-   impl->flags = BSON_FLAG_STATIC | BSON_FLAG_RDONLY;
-   impl->len = (uint32_t)length;
-   impl->parent = NULL;
-   impl->depth = 0;
-   impl->buf = &impl->alloc;
-   impl->buflen = &impl->alloclen;
-   impl->offset = 0;
-   impl->alloc = (uint8_t *)data;
-   impl->alloclen = length;
-   impl->realloc = NULL;
-   impl->realloc_func_ctx = NULL;
 
-   return true;
+static BSON_INLINE uint8_t *
+_bson_field_write_u32 (uint8_t  *buf,   /* IN */
+                       uint32_t  value) /* IN */
+{
+   value = BSON_UINT32_TO_LE (value);
+   memcpy (buf, &value, 4);
+
+   return buf + 4;
 }
 
 
-bson_t *
-bson_new (void)
+static BSON_INLINE uint8_t *
+_bson_field_write_u64 (uint8_t  *buf,   /* IN */
+                       uint64_t  value) /* IN */
 {
-   bson_impl_inline_t *impl;
-   bson_t *bson;
+   value = BSON_UINT64_TO_LE (value);
+   memcpy (buf, &value, 8);
+
+   return buf + 8;
+}
+
+
+/* writes a length-prefixed, NUL-terminated string of @len bytes */
+static BSON_INLINE uint8_t *
+_bson_field_write_str (uint8_t    *buf, /* IN */
+                       const char *str, /* IN */
+                       uint32_t    len) /* IN */
+{
+   buf = _bson_field_write_u32 (buf, len + 1);
+   memcpy (buf, str, len);
+   buf[len] = '\0';
+
+   return buf + len + 1;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_field_value_write --
+ *
+ *       Write @value, after its key, as @type from _bson_field_value_len().
+ *
+ * Returns:
+ *       The position after the value.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static uint8_t *
+_bson_field_value_write (uint8_t            *buf,   /* IN */
+                         const bson_value_t *value, /* IN */
+                         uint8_t             type)  /* IN */
+{
+   const char *str;
+   uint32_t len;
+   double d;
+
+   if (type == BSON_TYPE_NULL) {
+      return buf;
+   }
+
+   switch (value->value_type) {
+   case BSON_TYPE_DOUBLE:
+      d = value->value.v_double;
+#if BSON_BYTE_ORDER == BSON_BIG_ENDIAN
+      d = BSON_DOUBLE_TO_LE (d);
+#endif
+      memcpy (buf, &d, 8);
+      return buf + 8;
+   case BSON_TYPE_DATE_TIME:
+      return _bson_field_write_u64 (buf, (uint64_t)value->value.v_datetime);
+   case BSON_TYPE_TIMESTAMP:
+      return _bson_field_write_u64 (
+         buf, ((uint64_t)value->value.v_timestamp.timestamp << 32) |
+              value->value.v_timestamp.increment);
+   case BSON_TYPE_INT64:
+      return _bson_field_write_u64 (buf, (uint64_t)value->value.v_int64);
+   case BSON_TYPE_INT32:
+      return _bson_field_write_u32 (buf, (uint32_t)value->value.v_int32);
+   case BSON_TYPE_BOOL:
+      *buf = !!value->value.v_bool;
+      return buf + 1;
+   case BSON_TYPE_OID:
+      memcpy (buf, &value->value.v_oid, 12);
+      return buf + 12;
+   case BSON_TYPE_UTF8:
+      return _bson_field_write_str (buf, value->value.v_utf8.str,
+                                    value->value.v_utf8.len);
+   case BSON_TYPE_SYMBOL:
+      return _bson_field_write_str (buf, value->value.v_symbol.symbol,
+                                    value->value.v_symbol.len);
+   case BSON_TYPE_DOCUMENT:
+   case BSON_TYPE_ARRAY:
+      memcpy (buf, value->value.v_doc.data, value->value.v_doc.data_len);
+      return buf + value->value.v_doc.data_len;
+   case BSON_TYPE_BINARY:
+      len = value->value.v_binary.data_len;
+
+      if (value->value.v_binary.subtype == BSON_SUBTYPE_BINARY_DEPRECATED) {
+         buf = _bson_field_write_u32 (buf, len + 4);
+         *buf++ = (uint8_t)value->value.v_binary.subtype;
+         buf = _bson_field_write_u32 (buf, len);
+      } else {
+         buf = _bson_field_write_u32 (buf, len);
+         *buf++ = (uint8_t)value->value.v_binary.subtype;
+      }
+
+      memcpy (buf, value->value.v_binary.data, len);
+      return buf + len;
+   case BSON_TYPE_REGEX:
+      str = value->value.v_regex.regex ? value->value.v_regex.regex : "";
+      len = (uint32_t)strlen (str) + 1;
+      memcpy (buf, str, len);
+      buf += len;
+      str = value->value.v_regex.options ? value->value.v_regex.options : "";
+      len = (uint32_t)strlen (str) + 1;
+      memcpy (buf, str, len);
+      return buf + len;
+   case BSON_TYPE_DBPOINTER:
+      str = value->value.v_dbpointer.collection;
+      buf = _bson_field_write_str (buf, str, (uint32_t)strlen (str));
+      memcpy (buf, &value->value.v_dbpointer.oid, 12);
+      return buf + 12;
+   case BSON_TYPE_CODE:
+      str = value->value.v_code.code;
+      return _bson_field_write_str (buf, str, (uint32_t)strlen (str));
+   case BSON_TYPE_CODEWSCOPE:
+      str = value->value.v_codewscope.code;
+      len = (uint32_t)strlen (str);
+
+      if (type == BSON_TYPE_CODE) {
+         return _bson_field_write_str (buf, str, len);
+      }
+
+      buf = _bson_field_write_u32 (
+         buf, 4 + 4 + len + 1 + value->value.v_codewscope.scope_len);
+      buf = _bson_field_write_str (buf, str, len);
+      memcpy (buf, value->value.v_codewscope.scope_data,
+              value->value.v_codewscope.scope_len);
+      return buf + value->value.v_codewscope.scope_len;
+#ifdef BSON_EXPERIMENTAL_FEATURES
+   case BSON_TYPE_DECIMAL128:
+      buf = _bson_field_write_u64 (buf, value->value.v_decimal128.low);
+      return _bson_field_write_u64 (buf, value->value.v_decimal128.high);
+#endif
+   case BSON_TYPE_UNDEFINED:
+   case BSON_TYPE_NULL:
+   case BSON_TYPE_MAXKEY:
+   case BSON_TYPE_MINKEY:
+   case BSON_TYPE_EOD:
+   default:
+      return buf;
+   }
+}
+
+
+/* the key of @field, or the index @i if it has none */
+static BSON_INLINE uint32_t
+_bson_field_key (const bson_field_t  *field, /* IN */
+                 size_t               i,     /* IN */
+                 char                *str,   /* IN */
+                 size_t               size,  /* IN */
+                 const char         **key)   /* OUT */
+{
+   if (!field->key) {
+      return (uint32_t)bson_uint32_to_string ((uint32_t)i, key, str, size);
+   }
+
+   *key = field->key;
+
+   if (field->key_length < 0) {
+      return (uint32_t)strlen (field->key);
+   }
+
+   return (uint32_t)field->key_length;
+}
+
+
+/*
+ * Appends @fields to @bson in one pass. NULL keys are numbered from
+ * @first_index, or if @counted is false, from the number of fields in
+ * @bson, counted only if a NULL key is found.
+ */
+static bool
+_bson_append_many (bson_t             *bson,        /* IN */
+                   bool                counted,     /* IN */
+                   uint32_t            first_index, /* IN */
+                   const bson_field_t *fields,      /* IN */
+                   size_t              n_fields)    /* IN */
+{
+   const char *key;
+   char str[16];
+   uint64_t total = 0;
+   uint64_t len;
+   uint32_t key_len;
+   uint32_t first = first_index;
+   uint8_t type;
+   uint8_t *buf;
+   size_t i;
+
+   BSON_ASSERT (bson);
+   BSON_ASSERT (fields || !n_fields);
+   BSON_ASSERT (!(bson->flags & BSON_FLAG_IN_CHILD));
+   BSON_ASSERT (!(bson->flags & BSON_FLAG_RDONLY));
+
+   /* size everything first, so that nothing is appended on failure */
+   for (i = 0; i < n_fields; i++) {
+      if (!_bson_field_value_len (&fields[i].value, &type, &len)) {
+         return false;
+      }
+
+      /* NULL keys continue from the fields already in @bson */
+      if (!fields[i].key && !counted) {
+         first = bson_count_keys (bson);
+         counted = true;
+      }
+
+      key_len = _bson_field_key (&fields[i], first + i, str, sizeof str,
+                                 &key);
+      total += 1 + (uint64_t)key_len + 1 + len;
+
+      if (BSON_UNLIKELY (total > (BSON_MAX_SIZE - bson->len))) {
+         return false;
+      }
+   }
+
+   if (!total) {
+      return true;
+   }
+
+   if (BSON_UNLIKELY (!_bson_grow (bson, (uint32_t)total))) {
+      return false;
+   }
+
+   buf = _bson_data (bson) + bson->len - 1;
+
+   for (i = 0; i < n_fields; i++) {
+      _bson_field_value_len (&fields[i].value, &type, &len);
+      key_len = _bson_field_key (&fields[i], first + i, str, sizeof str,
+                                 &key);
+
+      *buf++ = type;
+      memcpy (buf, key, key_len);
+      buf += key_len;
+      *buf++ = '\0';
+      buf = _bson_field_value_write (buf, &fields[i].value, type);
+   }
+
+   *buf = '\0';
+   bson->len += (uint32_t)total;
+   _bson_encode_length (bson);
+
+   return true;
+}
+
+
+bool
+bson_append_many (bson_t             *bson,     /* IN */
+                  const bson_field_t *fields,   /* IN */
+                  size_t              n_fields) /* IN */
+{
+   return _bson_append_many (bson, false, 0, fields, n_fields);
+}
+
+
+bool
+bson_append_many_array (bson_t             *bson,        /* IN */
+                        uint32_t            first_index, /* IN */
+                        const bson_field_t *fields,      /* IN */
+                        size_t              n_fields)    /* IN */
+{
+   return _bson_append_many (bson, true, first_index, fields, n_fields);
+}
+
+
+void
+bson_init (bson_t *bson)
+{
+   bson_impl_inline_t *impl = (bson_impl_inline_t *)bson;
+
+   BSON_ASSERT (bson);
+
+   impl->flags = BSON_FLAG_INLINE | BSON_FLAG_STATIC;
+   impl->len = 5;
+   impl->data[0] = 5;
+   impl->data[1] = 0;
+   impl->data[2] = 0;
+   impl->data[3] = 0;
+   impl->data[4] = 0;
+}
+
+
+void
+bson_reinit (bson_t *bson)
+{
+   uint8_t *data;
+
+   BSON_ASSERT (bson);
+
+   data = _bson_data (bson);
+
+   bson->len = 5;
+
+   data [0] = 5;
+   data [1] = 0;
+   data [2] = 0;
+   data [3] = 0;
+   data [4] = 0;
+}
+
+
+bool
+bson_init_static (bson_t        *bson,
+                  const uint8_t *data,
+                  size_t         length)
+{
+   bson_impl_alloc_t *impl = (bson_impl_alloc_t *)bson;
+   uint32_t len_le;
+
+   BSON_ASSERT (bson);
+   BSON_ASSERT (data);
+
+   if ((length < 5) || (length > INT_MAX)) {
+      return false;
+   }
+
+   memcpy (&len_le, data, sizeof (len_le));
+
+   if ((size_t)BSON_UINT32_FROM_LE (len_le) != length) {
+      return false;
+   }
+
+   if (data[length - 1]) {
+      return false;
+   }
+
+   impl->flags = BSON_FLAG_STATIC | BSON_FLAG_RDONLY;
+   impl->len = (uint32_t)length;
+   impl->parent = NULL;
+   impl->depth = 0;
+   impl->buf = &impl->alloc;
+   impl->buflen = &impl->alloclen;
+   impl->offset = 0;
+   impl->alloc = (uint8_t *)data;
+   impl->alloclen = length;
+   impl->realloc = NULL;
+   impl->realloc_func_ctx = NULL;
+
+   return true;
+}
+
+
+bson_t *
+bson_new (void)
+{
+   bson_impl_inline_t *impl;
+   bson_t *bson;
 
    bson = bson_malloc (sizeof *bson);
 
@@ -2387,6 +3031,32 @@ bson_equal (const bson_t *bson,
 }
 
 
+/*
+ * Appends @utf8 to @str as a quoted JSON string, escaping it in place
+ * rather than through a temporary copy. Returns false and leaves @str
+ * unchanged if @utf8 is invalid UTF-8.
+ */
+static bool
+_bson_as_json_append_quoted (bson_string_t *str,      /* IN */
+                             const char    *utf8,     /* IN */
+                             ssize_t        utf8_len) /* IN */
+{
+   uint32_t len = str->len;
+
+   bson_string_append (str, "\"");
+
+   if (!_bson_utf8_escape_for_json_append (str, utf8, utf8_len)) {
+      str->len = len;
+      str->str [len] = '\0';
+      return false;
+   }
+
+   bson_string_append (str, "\"");
+
+   return true;
+}
+
+
 static bool
 _bson_as_json_visit_utf8 (const bson_iter_t *iter,
                           const char        *key,
@@ -2395,19 +3065,8 @@ _bson_as_json_visit_utf8 (const bson_iter_t *iter,
                           void              *data)
 {
    bson_json_state_t *state = data;
-   char *escaped;
-
-   escaped = bson_utf8_escape_for_json (v_utf8, v_utf8_len);
-
-   if (escaped) {
-      bson_string_append (state->str, "\"");
-      bson_string_append (state->str, escaped);
-      bson_string_append (state->str, "\"");
-      bson_free (escaped);
-      return false;
-   }
 
-   return true;
+   return !_bson_as_json_append_quoted (state->str, v_utf8, v_utf8_len);
 }
 
 
@@ -2682,22 +3341,17 @@ _bson_as_json_visit_before (const bson_iter_t *iter,
                             void              *data)
 {
    bson_json_state_t *state = data;
-   char *escaped;
 
    if (state->count) {
       bson_string_append (state->str, ", ");
    }
 
    if (state->keys) {
-      escaped = bson_utf8_escape_for_json (key, -1);
-      if (escaped) {
-         bson_string_append (state->str, "\"");
-         bson_string_append (state->str, escaped);
-         bson_string_append (state->str, "\" : ");
-         bson_free (escaped);
-      } else {
+      if (!_bson_as_json_append_quoted (state->str, key, -1)) {
          return true;
       }
+
+      bson_string_append (state->str, " : ");
    }
 
    state->count++;
@@ -2714,19 +3368,8 @@ _bson_as_json_visit_code (const bson_iter_t *iter,
                           void              *data)
 {
    bson_json_state_t *state = data;
-   char *escaped;
-
-   escaped = bson_utf8_escape_for_json (v_code, v_code_len);
-
-   if (escaped) {
-      bson_string_append (state->str, "\"");
-      bson_string_append (state->str, escaped);
-      bson_string_append (state->str, "\"");
-      bson_free (escaped);
-      return false;
-   }
 
-   return true;
+   return !_bson_as_json_append_quoted (state->str, v_code, v_code_len);
 }
 
 
@@ -2756,168 +3399,303 @@ _bson_as_json_visit_codewscope (const bson_iter_t *iter,
                                 void              *data)
 {
    bson_json_state_t *state = data;
-   char *escaped;
-
-   escaped = bson_utf8_escape_for_json (v_code, v_code_len);
-
-   if (escaped) {
-      bson_string_append (state->str, "\"");
-      bson_string_append (state->str, escaped);
-      bson_string_append (state->str, "\"");
-      bson_free (escaped);
-      return false;
-   }
 
-   return true;
+   return !_bson_as_json_append_quoted (state->str, v_code, v_code_len);
 }
 
 
-static const bson_visitor_t bson_as_json_visitors = {
-   _bson_as_json_visit_before,
-   NULL, /* visit_after */
-   NULL, /* visit_corrupt */
-   _bson_as_json_visit_double,
-   _bson_as_json_visit_utf8,
-   _bson_as_json_visit_document,
-   _bson_as_json_visit_array,
-   _bson_as_json_visit_binary,
-   _bson_as_json_visit_undefined,
-   _bson_as_json_visit_oid,
-   _bson_as_json_visit_bool,
-   _bson_as_json_visit_date_time,
-   _bson_as_json_visit_null,
-   _bson_as_json_visit_regex,
-   _bson_as_json_visit_dbpointer,
-   _bson_as_json_visit_code,
-   _bson_as_json_visit_symbol,
-   _bson_as_json_visit_codewscope,
-   _bson_as_json_visit_int32,
-   _bson_as_json_visit_timestamp,
-   _bson_as_json_visit_int64,
-   _bson_as_json_visit_maxkey,
-   _bson_as_json_visit_minkey,
-   NULL, /* visit_unsupported_type */
-#ifdef BSON_EXPERIMENTAL_FEATURES
-   _bson_as_json_visit_decimal128,
-#endif /* BSON_EXPERIMENTAL_FEATURES */
-};
-
-
+/*
+ * Appends the value of the field at @iter, which is not an embedded
+ * document or array, by calling the matching visitor above directly.
+ */
 static bool
-_bson_as_json_visit_document (const bson_iter_t *iter,
-                              const char        *key,
-                              const bson_t      *v_document,
-                              void              *data)
+_bson_as_json_visit_value (const bson_iter_t *iter,  /* IN */
+                           const char        *key,   /* IN */
+                           bson_json_state_t *state) /* IN */
 {
-   bson_json_state_t *state = data;
-   bson_json_state_t child_state = { 0, true };
-   bson_iter_t child;
-
-   if (state->depth >= BSON_MAX_RECURSION) {
-      bson_string_append (state->str, "{ ... }");
-      return false;
-   }
+   switch (bson_iter_type (iter)) {
+   case BSON_TYPE_DOUBLE:
+      return _bson_as_json_visit_double (iter, key, bson_iter_double (iter),
+                                         state);
+   case BSON_TYPE_UTF8:
+      {
+         uint32_t utf8_len;
+         const char *utf8;
 
-   if (bson_iter_init (&child, v_document)) {
-      child_state.str = bson_string_new ("{ ");
-      child_state.depth = state->depth + 1;
-      bson_iter_visit_all (&child, &bson_as_json_visitors, &child_state);
-      bson_string_append (child_state.str, " }");
-      bson_string_append (state->str, child_state.str->str);
-      bson_string_free (child_state.str, true);
-   }
+         utf8 = bson_iter_utf8 (iter, &utf8_len);
 
-   return false;
-}
+         if (!bson_utf8_validate (utf8, utf8_len, true)) {
+            return true;
+         }
 
+         return _bson_as_json_visit_utf8 (iter, key, utf8_len, utf8, state);
+      }
+   case BSON_TYPE_BINARY:
+      {
+         const uint8_t *binary = NULL;
+         bson_subtype_t subtype = BSON_SUBTYPE_BINARY;
+         uint32_t binary_len = 0;
 
-static bool
-_bson_as_json_visit_array (const bson_iter_t *iter,
-                           const char        *key,
-                           const bson_t      *v_array,
-                           void              *data)
-{
-   bson_json_state_t *state = data;
-   bson_json_state_t child_state = { 0, false };
-   bson_iter_t child;
+         bson_iter_binary (iter, &subtype, &binary_len, &binary);
 
-   if (state->depth >= BSON_MAX_RECURSION) {
-      bson_string_append (state->str, "{ ... }");
-      return false;
-   }
+         return _bson_as_json_visit_binary (iter, key, subtype, binary_len,
+                                            binary, state);
+      }
+   case BSON_TYPE_UNDEFINED:
+      return _bson_as_json_visit_undefined (iter, key, state);
+   case BSON_TYPE_OID:
+      return _bson_as_json_visit_oid (iter, key, bson_iter_oid (iter), state);
+   case BSON_TYPE_BOOL:
+      return _bson_as_json_visit_bool (iter, key, bson_iter_bool (iter),
+                                       state);
+   case BSON_TYPE_DATE_TIME:
+      return _bson_as_json_visit_date_time (iter, key,
+                                            bson_iter_date_time (iter),
+                                            state);
+   case BSON_TYPE_NULL:
+      return _bson_as_json_visit_null (iter, key, state);
+   case BSON_TYPE_REGEX:
+      {
+         const char *regex;
+         const char *options = NULL;
 
-   if (bson_iter_init (&child, v_array)) {
-      child_state.str = bson_string_new ("[ ");
-      child_state.depth = state->depth + 1;
-      bson_iter_visit_all (&child, &bson_as_json_visitors, &child_state);
-      bson_string_append (child_state.str, " ]");
-      bson_string_append (state->str, child_state.str->str);
-      bson_string_free (child_state.str, true);
-   }
+         regex = bson_iter_regex (iter, &options);
 
-   return false;
-}
+         return _bson_as_json_visit_regex (iter, key, regex, options, state);
+      }
+   case BSON_TYPE_DBPOINTER:
+      {
+         uint32_t collection_len = 0;
+         const char *collection = NULL;
+         const bson_oid_t *oid = NULL;
 
+         bson_iter_dbpointer (iter, &collection_len, &collection, &oid);
 
-char *
-bson_as_json (const bson_t *bson,
-              size_t       *length)
-{
-   bson_json_state_t state;
-   bson_iter_t iter;
+         return _bson_as_json_visit_dbpointer (iter, key, collection_len,
+                                               collection, oid, state);
+      }
+   case BSON_TYPE_CODE:
+      {
+         uint32_t code_len;
+         const char *code;
 
-   BSON_ASSERT (bson);
+         code = bson_iter_code (iter, &code_len);
 
-   if (length) {
-      *length = 0;
-   }
+         return _bson_as_json_visit_code (iter, key, code_len, code, state);
+      }
+   case BSON_TYPE_SYMBOL:
+      {
+         uint32_t symbol_len;
+         const char *symbol;
 
-   if (bson_empty0 (bson)) {
-      if (length) {
-         *length = 3;
+         symbol = bson_iter_symbol (iter, &symbol_len);
+
+         return _bson_as_json_visit_symbol (iter, key, symbol_len, symbol,
+                                            state);
       }
+   case BSON_TYPE_CODEWSCOPE:
+      {
+         uint32_t code_len = 0;
+         const char *code;
+         const uint8_t *scope = NULL;
+         uint32_t scope_len = 0;
 
-      return bson_strdup ("{ }");
+         /* only the code is printed, so the scope is not wrapped */
+         code = bson_iter_codewscope (iter, &code_len, &scope_len, &scope);
+
+         return _bson_as_json_visit_codewscope (iter, key, code_len, code,
+                                                NULL, state);
+      }
+   case BSON_TYPE_INT32:
+      return _bson_as_json_visit_int32 (iter, key, bson_iter_int32 (iter),
+                                        state);
+   case BSON_TYPE_TIMESTAMP:
+      {
+         uint32_t timestamp;
+         uint32_t increment;
+
+         bson_iter_timestamp (iter, &timestamp, &increment);
+
+         return _bson_as_json_visit_timestamp (iter, key, timestamp,
+                                               increment, state);
+      }
+   case BSON_TYPE_INT64:
+      return _bson_as_json_visit_int64 (iter, key, bson_iter_int64 (iter),
+                                        state);
+#ifdef BSON_EXPERIMENTAL_FEATURES
+   case BSON_TYPE_DECIMAL128:
+      {
+         bson_decimal128_t dec;
+
+         bson_iter_decimal128 (iter, &dec);
+
+         return _bson_as_json_visit_decimal128 (iter, key, &dec, state);
+      }
+#endif /* BSON_EXPERIMENTAL_FEATURES */
+   case BSON_TYPE_MAXKEY:
+      return _bson_as_json_visit_maxkey (iter, key, state);
+   case BSON_TYPE_MINKEY:
+      return _bson_as_json_visit_minkey (iter, key, state);
+   case BSON_TYPE_DOCUMENT:
+   case BSON_TYPE_ARRAY:
+   case BSON_TYPE_EOD:
+   default:
+      return false;
    }
+}
 
-   if (!bson_iter_init (&iter, bson)) {
-      return NULL;
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _bson_as_json_append --
+ *
+ *       Appends @bson to @str as a JSON object, or as a JSON array if
+ *       @keys is false. Embedded documents are formatted in place while
+ *       walking with a bson_walker_t, so nothing is copied once per level
+ *       of nesting and hostile input cannot exhaust the stack. Documents
+ *       nested deeper than BSON_MAX_RECURSION are formatted as "{ ... }".
+ *
+ * Returns:
+ *       true if successful, false if @bson is corrupt.
+ *
+ * Side effects:
+ *       @str is appended to. On failure @str is left unchanged.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_bson_as_json_append (const bson_t  *bson, /* IN */
+                      bool           keys, /* IN */
+                      bson_string_t *str)  /* IN */
+{
+   bool parent_keys[BSON_MAX_RECURSION];
+   bson_json_state_t state;
+   bson_walker_t walker;
+   bson_walk_event_t event;
+   const bson_iter_t *iter;
+   const char *key;
+   uint32_t start_len = str->len;
+   int64_t stats_start;
+
+   if (bson_empty (bson)) {
+      bson_string_append (str, keys ? "{ }" : "[ ]");
+      return true;
+   }
+
+   if (!bson_walker_init (&walker, bson)) {
+      return false;
    }
 
+   stats_start = _bson_stats_start ();
+   bson_walker_set_max_depth (&walker, BSON_MAX_RECURSION);
+
    state.count = 0;
-   state.keys = true;
-   state.str = bson_string_new ("{ ");
+   state.keys = keys;
+   state.str = str;
    state.depth = 0;
 
-   if (bson_iter_visit_all (&iter, &bson_as_json_visitors, &state) ||
-       iter.err_off) {
-      /*
-       * We were prematurely exited due to corruption or failed visitor.
-       */
-      bson_string_free (state.str, true);
-      if (length) {
-         *length = 0;
+   bson_string_append (str, keys ? "{ " : "[ ");
+
+   while ((event = bson_walker_next (&walker)) != BSON_WALK_END) {
+      iter = bson_walker_get_iter (&walker);
+      key = bson_iter_key_unsafe (iter);
+
+      switch (event) {
+      case BSON_WALK_DOCUMENT_BEGIN:
+         if (_bson_as_json_visit_before (iter, key, &state)) {
+            goto failure;
+         }
+
+         parent_keys[state.depth++] = state.keys;
+         state.count = 0;
+         state.keys = BSON_ITER_HOLDS_DOCUMENT (iter);
+         bson_string_append (str, state.keys ? "{ " : "[ ");
+         break;
+      case BSON_WALK_DOCUMENT_END:
+         bson_string_append (str, state.keys ? " }" : " ]");
+         state.keys = parent_keys[--state.depth];
+         /* the field holding the document has been counted */
+         state.count = 1;
+         break;
+      case BSON_WALK_TOO_DEEP:
+         if (_bson_as_json_visit_before (iter, key, &state)) {
+            goto failure;
+         }
+
+         bson_string_append (str, "{ ... }");
+         break;
+      case BSON_WALK_VALUE:
+         if (_bson_as_json_visit_before (iter, key, &state) ||
+             _bson_as_json_visit_value (iter, key, &state)) {
+            goto failure;
+         }
+         break;
+      case BSON_WALK_CORRUPT:
+      case BSON_WALK_END:
+      default:
+         goto failure;
       }
-      return NULL;
    }
 
-   bson_string_append (state.str, " }");
+   bson_string_append (str, keys ? " }" : " ]");
+
+   bson_walker_destroy (&walker);
+   _bson_stats_end (BSON_STATS_AS_JSON, bson->len, stats_start);
+
+   return true;
+
+failure:
+   /*
+    * We were prematurely exited due to corruption or failed visitor.
+    */
+   str->len = start_len;
+   str->str [start_len] = '\0';
+
+   bson_walker_destroy (&walker);
+   _bson_stats_end (BSON_STATS_AS_JSON, bson->len, stats_start);
+
+   return false;
+}
+
+
+static char *
+_bson_as_json (const bson_t *bson,   /* IN */
+               bool          keys,   /* IN */
+               size_t       *length) /* OUT */
+{
+   bson_string_t *str;
+
+   str = bson_string_new (NULL);
+
+   /*
+    * JSON is rarely more than twice the size of its BSON, so size the
+    * buffer up front instead of doubling it field by field. Past a modest
+    * size the buffer grows as it is written instead, so that a large
+    * document does not claim memory its JSON might never use.
+    */
+   str->alloc = (uint32_t)bson_next_power_of_two (
+      BSON_MIN (2 * bson->len, BSON_AS_JSON_MAX_RESERVE));
+   str->str = bson_realloc (str->str, str->alloc);
+
+   if (!_bson_as_json_append (bson, keys, str)) {
+      bson_string_free (str, true);
+      return NULL;
+   }
 
    if (length) {
-      *length = state.str->len;
+      *length = str->len;
    }
 
-   return bson_string_free (state.str, false);
+   return bson_string_free (str, false);
 }
 
 
 char *
-bson_array_as_json (const bson_t *bson,
-                    size_t       *length)
+bson_as_json (const bson_t *bson,
+              size_t       *length)
 {
-   bson_json_state_t state;
-   bson_iter_t iter;
-
    BSON_ASSERT (bson);
 
    if (length) {
@@ -2929,89 +3707,39 @@ bson_array_as_json (const bson_t *bson,
          *length = 3;
       }
 
-      return bson_strdup ("[ ]");
-   }
-
-   if (!bson_iter_init (&iter, bson)) {
-      return NULL;
-   }
-
-   state.count = 0;
-   state.keys = false;
-   state.str = bson_string_new ("[ ");
-   state.depth = 0;
-   bson_iter_visit_all (&iter, &bson_as_json_visitors, &state);
-
-   if (bson_iter_visit_all (&iter, &bson_as_json_visitors, &state) ||
-       iter.err_off) {
-      /*
-       * We were prematurely exited due to corruption or failed visitor.
-       */
-      bson_string_free (state.str, true);
-      if (length) {
-         *length = 0;
-      }
-      return NULL;
-   }
-
-   bson_string_append (state.str, " ]");
-
-   if (length) {
-      *length = state.str->len;
+      return bson_strdup ("{ }");
    }
 
-   return bson_string_free (state.str, false);
+   return _bson_as_json (bson, true, length);
 }
 
 
-static bool
-_bson_iter_validate_utf8 (const bson_iter_t *iter,
-                          const char        *key,
-                          size_t             v_utf8_len,
-                          const char        *v_utf8,
-                          void              *data)
+char *
+bson_array_as_json (const bson_t *bson,
+                    size_t       *length)
 {
-   bson_validate_state_t *state = data;
-   bool allow_null;
-
-   if ((state->flags & BSON_VALIDATE_UTF8)) {
-      allow_null = !!(state->flags & BSON_VALIDATE_UTF8_ALLOW_NULL);
+   BSON_ASSERT (bson);
 
-      if (!bson_utf8_validate (v_utf8, v_utf8_len, allow_null)) {
-         state->err_offset = iter->off;
-         return true;
-      }
+   if (length) {
+      *length = 0;
    }
 
-   if ((state->flags & BSON_VALIDATE_DOLLAR_KEYS)) {
-      if (state->phase == BSON_VALIDATE_PHASE_LF_REF_UTF8) {
-         state->phase = BSON_VALIDATE_PHASE_LF_ID_KEY;
-      } else if (state->phase == BSON_VALIDATE_PHASE_LF_DB_UTF8) {
-         state->phase = BSON_VALIDATE_PHASE_NOT_DBREF;
+   if (bson_empty0 (bson)) {
+      if (length) {
+         *length = 3;
       }
-   }
 
-   return false;
-}
-
-
-static void
-_bson_iter_validate_corrupt (const bson_iter_t *iter,
-                             void              *data)
-{
-   bson_validate_state_t *state = data;
+      return bson_strdup ("[ ]");
+   }
 
-   state->err_offset = iter->err_off;
+   return _bson_as_json (bson, false, length);
 }
 
 
 static bool
-_bson_iter_validate_before (const bson_iter_t *iter,
-                            const char        *key,
-                            void              *data)
+_bson_validate_key (bson_validate_state_t *state, /* IN */
+                    const char            *key)   /* IN */
 {
-   bson_validate_state_t *state = data;
-
    if ((state->flags & BSON_VALIDATE_DOLLAR_KEYS)) {
       if (key[0] == '$') {
          if (state->phase == BSON_VALIDATE_PHASE_LF_REF_KEY &&
@@ -3024,14 +3752,12 @@ _bson_iter_validate_before (const bson_iter_t *iter,
                     strcmp (key, "$db") == 0) {
             state->phase = BSON_VALIDATE_PHASE_LF_DB_UTF8;
          } else {
-            state->err_offset = iter->off;
-            return true;
+            return false;
          }
       } else if (state->phase == BSON_VALIDATE_PHASE_LF_ID_KEY ||
                  state->phase == BSON_VALIDATE_PHASE_LF_REF_UTF8 ||
                  state->phase == BSON_VALIDATE_PHASE_LF_DB_UTF8) {
-         state->err_offset = iter->off;
-         return true;
+         return false;
       } else {
          state->phase = BSON_VALIDATE_PHASE_NOT_DBREF;
       }
@@ -3039,97 +3765,123 @@ _bson_iter_validate_before (const bson_iter_t *iter,
 
    if ((state->flags & BSON_VALIDATE_DOT_KEYS)) {
       if (strstr (key, ".")) {
-         state->err_offset = iter->off;
-         return true;
+         return false;
       }
    }
 
-   return false;
+   return true;
 }
 
 
 static bool
-_bson_iter_validate_codewscope (const bson_iter_t *iter,
-                                const char        *key,
-                                size_t             v_code_len,
-                                const char        *v_code,
-                                const bson_t      *v_scope,
-                                void              *data)
+_bson_validate_utf8 (bson_validate_state_t *state,    /* IN */
+                     const char            *utf8,     /* IN */
+                     uint32_t               utf8_len) /* IN */
 {
-   bson_validate_state_t *state = data;
-   size_t offset;
+   bool allow_null;
 
-   if (!bson_validate (v_scope, state->flags, &offset)) {
-      state->err_offset = iter->off + offset;
-      return false;
+   if ((state->flags & BSON_VALIDATE_UTF8)) {
+      allow_null = !!(state->flags & BSON_VALIDATE_UTF8_ALLOW_NULL);
+
+      if (!bson_utf8_validate (utf8, utf8_len, allow_null)) {
+         return false;
+      }
+   }
+
+   if ((state->flags & BSON_VALIDATE_DOLLAR_KEYS)) {
+      if (state->phase == BSON_VALIDATE_PHASE_LF_REF_UTF8) {
+         state->phase = BSON_VALIDATE_PHASE_LF_ID_KEY;
+      } else if (state->phase == BSON_VALIDATE_PHASE_LF_DB_UTF8) {
+         state->phase = BSON_VALIDATE_PHASE_NOT_DBREF;
+      }
    }
 
    return true;
 }
 
 
-static bool
-_bson_iter_validate_document (const bson_iter_t *iter,
-                              const char        *key,
-                              const bson_t      *v_document,
-                              void              *data);
-
-
-static const bson_visitor_t bson_validate_funcs = {
-   _bson_iter_validate_before,
-   NULL, /* visit_after */
-   _bson_iter_validate_corrupt,
-   NULL, /* visit_double */
-   _bson_iter_validate_utf8,
-   _bson_iter_validate_document,
-   _bson_iter_validate_document, /* visit_array */
-   NULL, /* visit_binary */
-   NULL, /* visit_undefined */
-   NULL, /* visit_oid */
-   NULL, /* visit_bool */
-   NULL, /* visit_date_time */
-   NULL, /* visit_null */
-   NULL, /* visit_regex */
-   NULL, /* visit_dbpoint */
-   NULL, /* visit_code */
-   NULL, /* visit_symbol */
-   _bson_iter_validate_codewscope,
-};
+/*
+ * Saves the DBRef phase of the document enclosing level @depth, moving
+ * the saved phases to the heap once they outgrow @state.
+ */
+static void
+_bson_validate_push_phase (bson_validate_state_t *state, /* IN */
+                           uint32_t               depth) /* IN */
+{
+   if (depth >= state->n_phases) {
+      state->n_phases *= 2;
+
+      if (state->phases == state->inline_phases) {
+         state->phases = bson_malloc (state->n_phases * sizeof *state->phases);
+         memcpy (state->phases, state->inline_phases,
+                 sizeof state->inline_phases);
+      } else {
+         state->phases = bson_realloc (
+            state->phases, state->n_phases * sizeof *state->phases);
+      }
+   }
+
+   state->phases[depth] = state->phase;
+}
 
 
+/*
+ * Checks one event of the walk.
+ */
 static bool
-_bson_iter_validate_document (const bson_iter_t *iter,
-                              const char        *key,
-                              const bson_t      *v_document,
-                              void              *data)
+_bson_validate_event (bson_validate_state_t *state,  /* IN */
+                      bson_walker_t         *walker, /* IN */
+                      bson_walk_event_t      event)  /* IN */
 {
-   bson_validate_state_t *state = data;
-   bson_iter_t child;
-   bson_validate_phase_t phase = state->phase;
+   const bson_iter_t *iter;
+   const char *utf8;
+   uint32_t utf8_len;
 
-   if (!bson_iter_init (&child, v_document)) {
-      state->err_offset = iter->off;
-      return true;
-   }
+   iter = bson_walker_get_iter (walker);
 
-   if (state->phase == BSON_VALIDATE_PHASE_START) {
-      state->phase = BSON_VALIDATE_PHASE_TOP;
-   } else {
-      state->phase = BSON_VALIDATE_PHASE_LF_REF_KEY;
-   }
+   switch (event) {
+   case BSON_WALK_DOCUMENT_BEGIN:
+   case BSON_WALK_VALUE:
+      if (!_bson_validate_key (state, bson_iter_key_unsafe (iter))) {
+         return false;
+      }
 
-   bson_iter_visit_all (&child, &bson_validate_funcs, state);
+      if (bson_iter_type (iter) == BSON_TYPE_UTF8) {
+         utf8 = bson_iter_utf8 (iter, &utf8_len);
 
-   if (state->phase == BSON_VALIDATE_PHASE_LF_ID_KEY ||
-       state->phase == BSON_VALIDATE_PHASE_LF_REF_UTF8 ||
-       state->phase == BSON_VALIDATE_PHASE_LF_DB_UTF8) {
-       state->err_offset = iter->off;
-       return true;
-   }
+         if (!_bson_validate_utf8 (state, utf8, utf8_len)) {
+            return false;
+         }
+      }
 
-   state->phase = phase;
+      if (event == BSON_WALK_DOCUMENT_BEGIN) {
+         _bson_validate_push_phase (state, bson_walker_get_depth (walker));
 
-   return false;
+         /* a scope is checked like a top-level document */
+         if (bson_iter_type (iter) == BSON_TYPE_CODEWSCOPE) {
+            state->phase = BSON_VALIDATE_PHASE_TOP;
+         } else {
+            state->phase = BSON_VALIDATE_PHASE_LF_REF_KEY;
+         }
+      }
+
+      return true;
+   case BSON_WALK_DOCUMENT_END:
+      if (state->phase == BSON_VALIDATE_PHASE_LF_ID_KEY ||
+          state->phase == BSON_VALIDATE_PHASE_LF_REF_UTF8 ||
+          state->phase == BSON_VALIDATE_PHASE_LF_DB_UTF8) {
+         return false;
+      }
+
+      state->phase = state->phases[bson_walker_get_depth (walker)];
+
+      return true;
+   case BSON_WALK_TOO_DEEP:
+   case BSON_WALK_CORRUPT:
+   case BSON_WALK_END:
+   default:
+      return false;
+   }
 }
 
 
@@ -3138,22 +3890,53 @@ bson_validate (const bson_t         *bson,
                bson_validate_flags_t flags,
                size_t               *offset)
 {
-   bson_validate_state_t state = { flags, -1, BSON_VALIDATE_PHASE_START };
-   bson_iter_t iter;
+   bson_validate_state_t state;
+   bson_walk_event_t event;
+   bson_walker_t walker;
+   int64_t start;
+   int64_t stats_start;
+
+   start = BSON_PROBE_CLOCK (validate__fail);
+   stats_start = _bson_stats_start ();
 
-   if (!bson_iter_init (&iter, bson)) {
+   state.flags = flags;
+   state.err_offset = -1;
+   state.phase = BSON_VALIDATE_PHASE_TOP;
+   state.phases = state.inline_phases;
+   state.n_phases = sizeof state.inline_phases / sizeof state.inline_phases[0];
+
+   if (!bson_walker_init (&walker, bson)) {
       state.err_offset = 0;
       goto failure;
    }
 
-   _bson_iter_validate_document (&iter, NULL, bson, &state);
+   bson_walker_set_flags (&walker, BSON_WALKER_SCOPES);
+
+   while ((event = bson_walker_next (&walker)) != BSON_WALK_END) {
+      if (!_bson_validate_event (&state, &walker, event)) {
+         state.err_offset = (ssize_t)bson_walker_get_offset (&walker);
+         break;
+      }
+   }
 
 failure:
+   bson_walker_destroy (&walker);
+
+   if (state.phases != state.inline_phases) {
+      bson_free (state.phases);
+   }
+
+   if (state.err_offset >= 0) {
+      BSON_PROBE4 (validate__fail, state.err_offset, bson->len, flags,
+                   BSON_PROBE_ELAPSED (start));
+   }
 
    if (offset) {
       *offset = state.err_offset;
    }
 
+   _bson_stats_end (BSON_STATS_VALIDATE, bson->len, stats_start);
+
    return state.err_offset < 0;
 }
 
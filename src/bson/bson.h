@@ -20,32 +20,47 @@
 
 #define BSON_INSIDE
 
+#include "bson-aggregate.h"
 #include "bson-compat.h"
+#include "bson-compression.h"
 
 #include <string.h>
 #include <time.h>
 
 #include "bson-macros.h"
+#include "bson-matcher.h"
 #include "bson-config.h"
 #include "bson-atomic.h"
 #include "bson-context.h"
 #include "bson-clock.h"
+#include "bson-columnar.h"
 #ifdef BSON_EXPERIMENTAL_FEATURES
 #include "bson-decimal128.h"
 #endif
 #include "bson-error.h"
+#include "bson-index.h"
+#include "bson-iovec.h"
 #include "bson-iter.h"
 #include "bson-json.h"
+#include "bson-jsonl.h"
 #include "bson-keys.h"
 #include "bson-md5.h"
 #include "bson-memory.h"
 #include "bson-oid.h"
+#include "bson-pool.h"
+#include "bson-projection.h"
+#include "bson-pull-parser.h"
 #include "bson-reader.h"
+#include "bson-shm-ring.h"
+#include "bson-stats.h"
 #include "bson-string.h"
+#include "bson-struct.h"
 #include "bson-types.h"
 #include "bson-utf8.h"
 #include "bson-value.h"
 #include "bson-version.h"
+#include "bson-view.h"
+#include "bson-walker.h"
 #include "bson-version-functions.h"
 #include "bson-writer.h"
 #include "bcon.h"
@@ -521,6 +536,52 @@ bson_append_value (bson_t             *bson,
                    const bson_value_t *value);
 
 
+/**
+ * bson_append_many:
+ * @bson: A bson_t.
+ * @fields: An array of @n_fields fields.
+ * @n_fields: The number of fields to append.
+ *
+ * Appends @fields to @bson like calling bson_append_value() for each, but
+ * sizes them all first, grows @bson once, and writes them in one pass. A
+ * field with a NULL key gets its index in the array being built as key:
+ * the number of fields already in @bson plus its index in @fields. So a
+ * whole array can be appended in one call, or extended by another.
+ * Counting the fields already in @bson takes time proportional to them;
+ * use bson_append_many_array() to build a large array in batches.
+ *
+ * Either every field is appended or, if one cannot be or @bson would grow
+ * past the maximum size, none is.
+ *
+ * Returns: true if successful; false otherwise.
+ */
+bool
+bson_append_many (bson_t             *bson,
+                  const bson_field_t *fields,
+                  size_t              n_fields);
+
+
+/**
+ * bson_append_many_array:
+ * @bson: A bson_t.
+ * @first_index: The key of the first field with a NULL key.
+ * @fields: An array of @n_fields fields.
+ * @n_fields: The number of fields to append.
+ *
+ * Like bson_append_many(), but a field with a NULL key gets @first_index
+ * plus its index in @fields as key, without counting the fields already in
+ * @bson. Pass the number of elements appended so far to extend an array
+ * in batches in time proportional to each batch.
+ *
+ * Returns: true if successful; false otherwise.
+ */
+bool
+bson_append_many_array (bson_t             *bson,
+                        uint32_t            first_index,
+                        const bson_field_t *fields,
+                        size_t              n_fields);
+
+
 /**
  * bson_append_array:
  * @bson: A bson_t.
@@ -561,6 +622,75 @@ bson_append_binary (bson_t         *bson,
                     uint32_t        length);
 
 
+/**
+ * bson_append_binary_reserve:
+ * @bson: A bson_t.
+ * @key: The key for the field.
+ * @subtype: The bson_subtype_t of the binary.
+ * @length: The largest number of bytes the binary will hold.
+ *
+ * Starts appending a binary field of up to @length bytes, which the caller
+ * writes in place through the returned pointer instead of building it in a
+ * separate buffer. The field is finished by bson_append_reserve_commit()
+ * or dropped by bson_append_reserve_cancel(); @bson must not be used in
+ * between.
+ *
+ * Returns: A pointer to @length bytes inside @bson, or NULL if @bson
+ *   cannot be appended to or would overflow max size.
+ */
+uint8_t *
+bson_append_binary_reserve (bson_t         *bson,
+                            const char     *key,
+                            int             key_length,
+                            bson_subtype_t  subtype,
+                            uint32_t        length);
+
+
+/**
+ * bson_append_utf8_reserve:
+ * @bson: A bson_t.
+ * @key: The key for the field.
+ * @length: The largest number of bytes the string will hold.
+ *
+ * Like bson_append_binary_reserve() for a UTF-8 string. The caller must
+ * not write the trailing NUL, nor any other NUL byte.
+ *
+ * Returns: A pointer to @length bytes inside @bson, or NULL if @bson
+ *   cannot be appended to or would overflow max size.
+ */
+char *
+bson_append_utf8_reserve (bson_t     *bson,
+                          const char *key,
+                          int         key_length,
+                          uint32_t    length);
+
+
+/**
+ * bson_append_reserve_commit:
+ * @bson: A bson_t.
+ * @length: The number of bytes that were written.
+ *
+ * Finishes the field started by bson_append_binary_reserve() or
+ * bson_append_utf8_reserve(), keeping its first @length bytes.
+ *
+ * Returns: true if successful; false if @length is larger than reserved.
+ */
+bool
+bson_append_reserve_commit (bson_t   *bson,
+                            uint32_t  length);
+
+
+/**
+ * bson_append_reserve_cancel:
+ * @bson: A bson_t.
+ *
+ * Drops the field started by bson_append_binary_reserve() or
+ * bson_append_utf8_reserve(), leaving @bson as it was before.
+ */
+void
+bson_append_reserve_cancel (bson_t *bson);
+
+
 /**
  * bson_append_bool:
  * @bson: A bson_t.
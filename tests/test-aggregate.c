@@ -0,0 +1,492 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <assert.h>
+#include <bcon.h>
+#include <math.h>
+
+#include "bson-tests.h"
+#include "TestSuite.h"
+
+
+static void
+assert_int64 (const bson_aggregate_t *aggregate,
+              bson_aggregate_op_t     op,
+              int64_t                 expected)
+{
+   bson_value_t value;
+
+   bson_aggregate_get (aggregate, op, &value);
+   assert (value.value_type == BSON_TYPE_INT64);
+   assert (value.value.v_int64 == expected);
+}
+
+
+static void
+assert_double (const bson_aggregate_t *aggregate,
+               bson_aggregate_op_t     op,
+               double                  expected)
+{
+   bson_value_t value;
+
+   bson_aggregate_get (aggregate, op, &value);
+   assert (value.value_type == BSON_TYPE_DOUBLE);
+   assert (fabs (value.value.v_double - expected) < 1e-6);
+}
+
+
+static void
+assert_null (const bson_aggregate_t *aggregate,
+             bson_aggregate_op_t     op)
+{
+   bson_value_t value;
+
+   bson_aggregate_get (aggregate, op, &value);
+   assert (value.value_type == BSON_TYPE_NULL);
+}
+
+
+static void
+test_aggregate_value (void)
+{
+   bson_aggregate_t aggregate;
+   bson_aggregate_t other;
+   bson_value_t value;
+
+   bson_aggregate_init (&aggregate);
+   assert_int64 (&aggregate, BSON_AGGREGATE_COUNT, 0);
+   assert_int64 (&aggregate, BSON_AGGREGATE_SUM, 0);
+   assert_null (&aggregate, BSON_AGGREGATE_MIN);
+   assert_null (&aggregate, BSON_AGGREGATE_MAX);
+   assert_null (&aggregate, BSON_AGGREGATE_AVG);
+
+   value.value_type = BSON_TYPE_INT32;
+   value.value.v_int32 = 3;
+   assert (bson_aggregate_value (&aggregate, &value));
+   value.value_type = BSON_TYPE_INT64;
+   value.value.v_int64 = -5;
+   assert (bson_aggregate_value (&aggregate, &value));
+   value.value_type = BSON_TYPE_UTF8;
+   value.value.v_utf8.str = "7";
+   value.value.v_utf8.len = 1;
+   assert (!bson_aggregate_value (&aggregate, &value));
+
+   assert_int64 (&aggregate, BSON_AGGREGATE_COUNT, 2);
+   assert_int64 (&aggregate, BSON_AGGREGATE_SUM, -2);
+   assert_int64 (&aggregate, BSON_AGGREGATE_MIN, -5);
+   assert_int64 (&aggregate, BSON_AGGREGATE_MAX, 3);
+   assert_double (&aggregate, BSON_AGGREGATE_AVG, -1.0);
+
+   /* a double makes the sum a double, and is the max if greatest */
+   value.value_type = BSON_TYPE_DOUBLE;
+   value.value.v_double = 3.5;
+   assert (bson_aggregate_value (&aggregate, &value));
+#ifdef BSON_EXPERIMENTAL_FEATURES
+   value.value_type = BSON_TYPE_DECIMAL128;
+   assert (bson_decimal128_from_string ("-0.5", &value.value.v_decimal128));
+#else
+   value.value.v_double = -0.5;
+#endif
+   assert (bson_aggregate_value (&aggregate, &value));
+
+   assert_int64 (&aggregate, BSON_AGGREGATE_COUNT, 4);
+   assert_double (&aggregate, BSON_AGGREGATE_SUM, 1.0);
+   assert_int64 (&aggregate, BSON_AGGREGATE_MIN, -5);
+   assert_double (&aggregate, BSON_AGGREGATE_MAX, 3.5);
+   assert_double (&aggregate, BSON_AGGREGATE_AVG, 0.25);
+
+   /* an overflowing integer sum becomes a double */
+   bson_aggregate_init (&other);
+   value.value_type = BSON_TYPE_INT64;
+   value.value.v_int64 = INT64_MAX;
+   assert (bson_aggregate_value (&other, &value));
+   assert_int64 (&other, BSON_AGGREGATE_SUM, INT64_MAX);
+   assert (bson_aggregate_value (&other, &value));
+   bson_aggregate_get (&other, BSON_AGGREGATE_SUM, &value);
+   assert (value.value_type == BSON_TYPE_DOUBLE);
+   assert (value.value.v_double == 2.0 * (double)INT64_MAX);
+
+   bson_aggregate_merge (&aggregate, &other);
+   assert_int64 (&aggregate, BSON_AGGREGATE_COUNT, 6);
+   assert_int64 (&aggregate, BSON_AGGREGATE_MIN, -5);
+   assert_int64 (&aggregate, BSON_AGGREGATE_MAX, INT64_MAX);
+
+   /* NaN is the least number */
+   value.value_type = BSON_TYPE_DOUBLE;
+   value.value.v_double = strtod ("nan", NULL);
+   assert (bson_aggregate_value (&aggregate, &value));
+   bson_aggregate_get (&aggregate, BSON_AGGREGATE_MIN, &value);
+   assert (value.value_type == BSON_TYPE_DOUBLE);
+   assert (value.value.v_double != value.value.v_double);
+   assert_int64 (&aggregate, BSON_AGGREGATE_MAX, INT64_MAX);
+}
+
+
+static void
+test_aggregate_column (void)
+{
+   bson_columnar_extractor_t *extractor;
+   bson_aggregate_t expected[2];
+   bson_aggregate_t aggregate;
+   bson_column_t column;
+   bson_value_t value;
+   bson_error_t error;
+   bson_t *doc;
+   int64_t i;
+   int pass;
+
+   extractor = bson_columnar_extractor_new ();
+   assert (bson_columnar_extractor_add_column (extractor, "i",
+                                               BSON_COLUMN_INT64, &error));
+   assert (bson_columnar_extractor_add_column (extractor, "d",
+                                               BSON_COLUMN_DOUBLE, &error));
+   assert (bson_columnar_extractor_add_column (extractor, "s",
+                                               BSON_COLUMN_UTF8, &error));
+
+   /* the second pass has nulls, but only in its first 200 rows */
+   for (pass = 0; pass < 2; pass++) {
+      bson_aggregate_init (&expected[0]);
+      bson_aggregate_init (&expected[1]);
+
+      for (i = 0; i < 1003; i++) {
+         if (pass && i % 7 == 3 && i < 200) {
+            doc = BCON_NEW ("s", "x");
+         } else {
+            doc = BCON_NEW ("i", BCON_INT64 ((i * 7919) % 2003 - 1000),
+                            "d", BCON_DOUBLE ((double)(i % 101) * 0.5 - 20));
+            value.value_type = BSON_TYPE_INT64;
+            value.value.v_int64 = (i * 7919) % 2003 - 1000;
+            bson_aggregate_value (&expected[0], &value);
+            value.value_type = BSON_TYPE_DOUBLE;
+            value.value.v_double = (double)(i % 101) * 0.5 - 20;
+            bson_aggregate_value (&expected[1], &value);
+         }
+
+         assert (bson_columnar_extractor_append (extractor, doc, &error));
+         bson_destroy (doc);
+      }
+
+      bson_aggregate_init (&aggregate);
+      assert (bson_columnar_extractor_get_column (extractor, 0, &column));
+      assert (bson_aggregate_column (&aggregate, &column));
+      assert (aggregate.count == expected[0].count);
+      assert (aggregate.int64_sum == expected[0].int64_sum);
+      assert (aggregate.int64_min == expected[0].int64_min);
+      assert (aggregate.int64_max == expected[0].int64_max);
+      assert (!aggregate.overflow);
+
+      bson_aggregate_init (&aggregate);
+      assert (bson_columnar_extractor_get_column (extractor, 1, &column));
+      assert (bson_aggregate_column (&aggregate, &column));
+      assert (aggregate.count == expected[1].count);
+      assert (fabs (aggregate.double_sum - expected[1].double_sum) < 1e-6);
+      assert (aggregate.double_min == expected[1].double_min);
+      assert (aggregate.double_max == expected[1].double_max);
+
+      assert (bson_columnar_extractor_get_column (extractor, 2, &column));
+      assert (!bson_aggregate_column (&aggregate, &column));
+
+      bson_columnar_extractor_clear (extractor);
+   }
+
+   /* the exact sum of a column is kept despite intermediate overflow */
+   for (i = 0; i < 4; i++) {
+      doc = BCON_NEW ("i", BCON_INT64 (i % 2 ? INT64_MIN : INT64_MAX));
+      assert (bson_columnar_extractor_append (extractor, doc, &error));
+      bson_destroy (doc);
+   }
+
+   bson_aggregate_init (&aggregate);
+   assert (bson_columnar_extractor_get_column (extractor, 0, &column));
+   assert (bson_aggregate_column (&aggregate, &column));
+   assert_int64 (&aggregate, BSON_AGGREGATE_SUM, -2);
+   assert_int64 (&aggregate, BSON_AGGREGATE_MIN, INT64_MIN);
+   assert_int64 (&aggregate, BSON_AGGREGATE_MAX, INT64_MAX);
+
+   assert (bson_aggregate_column (&aggregate, &column));
+   bson_aggregate_get (&aggregate, BSON_AGGREGATE_SUM, &value);
+   assert (value.value_type == BSON_TYPE_INT64);
+   assert (value.value.v_int64 == -4);
+
+   bson_columnar_extractor_destroy (extractor);
+}
+
+
+static void
+assert_group (const bson_group_by_t *group_by,
+              size_t                 i,
+              const char            *json)
+{
+   bson_t group;
+   char *str;
+
+   assert (bson_group_by_get_group (group_by, i, &group));
+   str = bson_as_json (&group, NULL);
+
+   if (strcmp (str, json) != 0) {
+      fprintf (stderr, "expected %s\ngot      %s\n", json, str);
+      abort ();
+   }
+
+   bson_free (str);
+   bson_destroy (&group);
+}
+
+
+static void
+test_group_by_basic (void)
+{
+   bson_group_by_t *group_by;
+   bson_error_t error;
+   bson_t *spec;
+   bson_t *doc;
+   bson_t group;
+
+   spec = BCON_NEW ("_id", "$ship.city",
+                    "n", "{", "$sum", BCON_INT32 (1), "}",
+                    "qty", "{", "$sum", "$qty", "}",
+                    "low", "{", "$min", "$price", "}",
+                    "high", "{", "$max", "$price", "}",
+                    "avg", "{", "$avg", "$qty", "}");
+   group_by = bson_group_by_new (spec, &error);
+   assert (group_by);
+
+#define APPEND(...) \
+   doc = BCON_NEW (__VA_ARGS__); \
+   assert (bson_group_by_append (group_by, doc, &error)); \
+   bson_destroy (doc)
+
+   APPEND ("ship", "{", "city", "NYC", "}", "qty", BCON_INT32 (2),
+           "price", BCON_DOUBLE (1.5));
+   APPEND ("ship", "{", "city", "SF", "}", "qty", BCON_INT64 (5),
+           "price", BCON_INT32 (3));
+   APPEND ("ship", "{", "city", "NYC", "}", "qty", BCON_INT32 (4),
+           "price", BCON_INT32 (1));
+   APPEND ("qty", BCON_INT32 (1));
+   APPEND ("ship", "{", "city", BCON_NULL, "}", "qty", "text");
+   APPEND ("ship", "{", "city", BCON_INT32 (1), "}");
+   APPEND ("ship", "{", "city", BCON_DOUBLE (1.0), "}");
+   APPEND ("ship", "{", "city", BCON_INT64 (1), "}", "qty", BCON_INT32 (6));
+   APPEND ("ship", "{", "city", BCON_DOUBLE (1.5), "}");
+
+#undef APPEND
+
+   assert (bson_group_by_get_n_groups (group_by) == 5);
+   assert_group (group_by, 0,
+                 "{ \"_id\" : \"NYC\", \"n\" : 2, \"qty\" : 6, "
+                 "\"low\" : 1, \"high\" : 1.5, \"avg\" : 3 }");
+   assert_group (group_by, 1,
+                 "{ \"_id\" : \"SF\", \"n\" : 1, \"qty\" : 5, "
+                 "\"low\" : 3, \"high\" : 3, \"avg\" : 5 }");
+   assert_group (group_by, 2,
+                 "{ \"_id\" : null, \"n\" : 2, \"qty\" : 1, "
+                 "\"low\" : null, \"high\" : null, \"avg\" : 1 }");
+   assert_group (group_by, 3,
+                 "{ \"_id\" : 1, \"n\" : 3, \"qty\" : 6, "
+                 "\"low\" : null, \"high\" : null, \"avg\" : 6 }");
+   assert_group (group_by, 4,
+                 "{ \"_id\" : 1.5, \"n\" : 1, \"qty\" : 0, "
+                 "\"low\" : null, \"high\" : null, \"avg\" : null }");
+   assert (!bson_group_by_get_group (group_by, 5, &group));
+
+   bson_group_by_clear (group_by);
+   assert (bson_group_by_get_n_groups (group_by) == 0);
+   doc = BCON_NEW ("ship", "{", "city", "LA", "}");
+   assert (bson_group_by_append (group_by, doc, &error));
+   assert (bson_group_by_get_n_groups (group_by) == 1);
+   bson_destroy (doc);
+
+   bson_group_by_destroy (group_by);
+   bson_destroy (spec);
+
+   /* a constant _id puts every document in one group */
+   spec = BCON_NEW ("_id", BCON_NULL, "n", "{", "$sum", BCON_INT32 (2), "}");
+   group_by = bson_group_by_new (spec, &error);
+   assert (group_by);
+   doc = BCON_NEW ("a", BCON_INT32 (1));
+   assert (bson_group_by_append (group_by, doc, &error));
+   assert (bson_group_by_append (group_by, doc, &error));
+   assert_group (group_by, 0, "{ \"_id\" : null, \"n\" : 4 }");
+   bson_destroy (doc);
+   bson_group_by_destroy (group_by);
+   bson_destroy (spec);
+}
+
+
+static void
+test_group_by_reader (void)
+{
+   bson_group_by_t *group_by;
+   bson_reader_t *reader;
+   bson_error_t error;
+   uint8_t *buf = NULL;
+   size_t len = 0;
+   bson_t *spec;
+   bson_t *doc;
+   bson_t group;
+   bson_iter_t iter;
+   int64_t sums[10] = { 0 };
+   size_t i;
+   int k;
+
+   for (i = 0; i < 10000; i++) {
+      doc = BCON_NEW ("k", BCON_INT32 ((int32_t)(i * 31 % 10)),
+                      "v", BCON_INT64 ((int64_t)i));
+      sums[i * 31 % 10] += (int64_t)i;
+      buf = bson_realloc (buf, len + doc->len);
+      memcpy (buf + len, bson_get_data (doc), doc->len);
+      len += doc->len;
+      bson_destroy (doc);
+   }
+
+   spec = BCON_NEW ("_id", "$k", "v", "{", "$sum", "$v", "}");
+   group_by = bson_group_by_new (spec, &error);
+   assert (group_by);
+
+   reader = bson_reader_new_from_data (buf, len);
+   assert (bson_group_by_append_reader (group_by, reader, 4099, &error));
+   assert (bson_group_by_append_reader (group_by, reader, 0, &error));
+   bson_reader_destroy (reader);
+
+   assert (bson_group_by_get_n_groups (group_by) == 10);
+
+   for (i = 0; i < 10; i++) {
+      assert (bson_group_by_get_group (group_by, i, &group));
+      assert (bson_iter_init_find (&iter, &group, "_id"));
+      k = bson_iter_int32 (&iter);
+      assert (bson_iter_init_find (&iter, &group, "v"));
+      assert (bson_iter_int64 (&iter) == sums[k]);
+      bson_destroy (&group);
+   }
+
+   /* a truncated stream is corrupt */
+   reader = bson_reader_new_from_data (buf, len - 1);
+   assert (!bson_group_by_append_reader (group_by, reader, 0, &error));
+   assert (error.domain == BSON_ERROR_AGGREGATE);
+   assert (error.code == BSON_ERROR_AGGREGATE_CORRUPT);
+   bson_reader_destroy (reader);
+
+   bson_group_by_destroy (group_by);
+   bson_destroy (spec);
+   bson_free (buf);
+}
+
+
+static void
+test_group_by_errors (void)
+{
+   bson_error_t error;
+   bson_t *spec;
+   int i;
+
+   bson_t *specs[] = {
+      BCON_NEW ("n", "{", "$sum", BCON_INT32 (1), "}"),
+      BCON_NEW ("_id", "$", "n", "{", "$sum", BCON_INT32 (1), "}"),
+      BCON_NEW ("_id", "$a..b"),
+      BCON_NEW ("_id", BCON_NULL, "_id", BCON_NULL),
+      BCON_NEW ("_id", BCON_NULL, "n", BCON_INT32 (1)),
+      BCON_NEW ("_id", BCON_NULL, "n", "{", "$count", "$a", "}"),
+      BCON_NEW ("_id", BCON_NULL, "n", "{", "$min", BCON_INT32 (1), "}"),
+      BCON_NEW ("_id", BCON_NULL, "n", "{", "$sum", "a", "}"),
+      BCON_NEW ("_id", BCON_NULL, "n", "{", "$sum", "$a", "$max", "$a", "}"),
+      BCON_NEW ("_id", BCON_NULL, "n", "{", "}"),
+      BCON_NEW ("_id", BCON_NULL, "a.b", "{", "$sum", "$a", "}"),
+      BCON_NEW ("_id", BCON_NULL, "n", "{", "$sum", "$a", "}",
+                "n", "{", "$sum", "$b", "}"),
+   };
+
+   for (i = 0; i < (int)(sizeof specs / sizeof specs[0]); i++) {
+      spec = specs[i];
+      memset (&error, 0, sizeof error);
+      assert (!bson_group_by_new (spec, &error));
+      assert (error.domain == BSON_ERROR_AGGREGATE);
+      assert (error.code == BSON_ERROR_AGGREGATE_INVALID);
+      bson_destroy (spec);
+   }
+}
+
+
+/* {"r": <decimal128 1>} and {"_id": <decimal128 1>}, built by hand as
+ * bson_append_decimal128 is experimental */
+static const uint8_t gDecimal128Doc[] = {
+   24, 0, 0, 0,
+   0x13, 'r', 0,
+   1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x40, 0x30,
+   0
+};
+
+static const uint8_t gDecimal128Spec[] = {
+   26, 0, 0, 0,
+   0x13, '_', 'i', 'd', 0,
+   1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x40, 0x30,
+   0
+};
+
+
+static void
+test_group_by_decimal128 (void)
+{
+   bson_group_by_t *group_by;
+   bson_error_t error;
+   bson_t *spec;
+   bson_t doc;
+
+   assert (bson_init_static (&doc, gDecimal128Doc, sizeof gDecimal128Doc));
+
+   spec = BCON_NEW ("_id", "$r", "n", "{", "$sum", BCON_INT32 (1), "}");
+   group_by = bson_group_by_new (spec, &error);
+   assert (group_by);
+#ifdef BSON_EXPERIMENTAL_FEATURES
+   assert (bson_group_by_append (group_by, &doc, &error));
+   assert (bson_group_by_append (group_by, &doc, &error));
+   assert_cmpint (bson_group_by_get_n_groups (group_by), ==, 1);
+#else
+   assert (!bson_group_by_append (group_by, &doc, &error));
+   ASSERT_ERROR_CONTAINS (error, BSON_ERROR_AGGREGATE,
+                          BSON_ERROR_AGGREGATE_UNSUPPORTED,
+                          "Unsupported _id type");
+   assert_cmpint (bson_group_by_get_n_groups (group_by), ==, 0);
+#endif
+   bson_group_by_destroy (group_by);
+   bson_destroy (spec);
+
+   /* a constant decimal128 _id */
+   assert (bson_init_static (&doc, gDecimal128Spec, sizeof gDecimal128Spec));
+   group_by = bson_group_by_new (&doc, &error);
+#ifdef BSON_EXPERIMENTAL_FEATURES
+   assert (group_by);
+   bson_group_by_destroy (group_by);
+#else
+   assert (!group_by);
+   ASSERT_ERROR_CONTAINS (error, BSON_ERROR_AGGREGATE,
+                          BSON_ERROR_AGGREGATE_INVALID,
+                          "Unsupported _id type");
+#endif
+}
+
+
+void
+test_aggregate_install (TestSuite *suite)
+{
+   TestSuite_Add (suite, "/bson/aggregate/value", test_aggregate_value);
+   TestSuite_Add (suite, "/bson/aggregate/column", test_aggregate_column);
+   TestSuite_Add (suite, "/bson/group_by/basic", test_group_by_basic);
+   TestSuite_Add (suite, "/bson/group_by/reader", test_group_by_reader);
+   TestSuite_Add (suite, "/bson/group_by/errors", test_group_by_errors);
+   TestSuite_Add (suite, "/bson/group_by/decimal128",
+                  test_group_by_decimal128);
+}
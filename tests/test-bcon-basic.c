@@ -629,6 +629,158 @@ static void test_append_ctx (void)
 }
 
 
+static void
+test_template (void)
+{
+   bcon_template_t *tpl;
+   bson_t bcon, expected, sub, tags;
+   bson_oid_t oid;
+   int i;
+
+   bson_init (&bcon);
+   bson_init (&expected);
+   bson_init (&tags);
+   bson_oid_init_from_string (&oid, "000102030405060708090a0b");
+
+   BCON_APPEND (&tags, "0", "a", "1", "b");
+
+   tpl = BCON_TEMPLATE_NEW (
+      "find", BCONT_UTF8,
+      "filter", "{",
+         "_id", BCONT_OID,
+         "a", BCON_INT32 (1),
+         "b", "{", "c", BCONT_INT64, "d", BCONT_DATE_TIME, "}",
+         "e", "{", "f", BCONT_UTF8, "}",
+         "g", "{", "h", BCON_UTF8 ("constant"), "}",
+      "}",
+      "array", "[", BCONT_INT32, BCON_DOUBLE (1.5), BCONT_BOOL, "]",
+      "tags", BCONT_ARRAY,
+      "score", BCONT_DOUBLE,
+      "data", BCONT_BIN,
+      "sub", BCONT_DOCUMENT);
+
+   /* render repeatedly, with values of different lengths */
+   for (i = 0; i < 3; i++) {
+      bson_reinit (&bcon);
+      bson_reinit (&expected);
+      bson_init (&sub);
+      BCON_APPEND (&sub, "i", BCON_INT32 (i));
+
+      BCON_APPEND (&expected,
+         "find", BCON_UTF8 (i % 2 ? "x" : "collection"),
+         "filter", "{",
+            "_id", BCON_OID (&oid),
+            "a", BCON_INT32 (1),
+            "b", "{", "c", BCON_INT64 (i * 1000LL), "d", BCON_DATE_TIME (i), "}",
+            "e", "{", "f", BCON_UTF8 (i % 2 ? "longer string" : ""), "}",
+            "g", "{", "h", BCON_UTF8 ("constant"), "}",
+         "}",
+         "array", "[", BCON_INT32 (i), BCON_DOUBLE (1.5), BCON_BOOL (i % 2), "]",
+         "tags", BCON_ARRAY (&tags),
+         "score", BCON_DOUBLE (i * 0.5),
+         "data", BCON_BIN (BSON_SUBTYPE_BINARY, (const uint8_t *)"abc", i),
+         "sub", BCON_DOCUMENT (&sub));
+
+      assert (bcon_template_render (tpl, &bcon,
+                                    i % 2 ? "x" : "collection",
+                                    &oid,
+                                    (int64_t)(i * 1000LL),
+                                    (int64_t)i,
+                                    i % 2 ? "longer string" : "",
+                                    (int32_t)i,
+                                    (bool)(i % 2),
+                                    &tags,
+                                    i * 0.5,
+                                    BSON_SUBTYPE_BINARY,
+                                    (const uint8_t *)"abc",
+                                    (uint32_t)i,
+                                    &sub));
+
+      bson_eq_bson (&bcon, &expected);
+      bson_destroy (&sub);
+   }
+
+   bcon_template_destroy (tpl);
+   bson_destroy (&bcon);
+   bson_destroy (&expected);
+   bson_destroy (&tags);
+}
+
+
+static void
+test_template_append (void)
+{
+   bcon_template_t *tpl;
+   bson_t bcon, expected, child;
+
+   bson_init (&bcon);
+   bson_init (&expected);
+   bson_init (&child);
+
+   BCON_APPEND (&child, "x", BCON_INT32 (1));
+
+   tpl = BCON_TEMPLATE_NEW ("a", "[", BCON (&child), BCONT_UTF8, "]",
+                            BCON (&child),
+                            "old", BCONT_BIN);
+
+   BCON_APPEND (&bcon, "first", BCON_NULL);
+   assert (bcon_template_render (tpl, &bcon, "s", BSON_SUBTYPE_BINARY_DEPRECATED,
+                                 (const uint8_t *)"xyz", (uint32_t)3));
+
+   BCON_APPEND (&expected,
+                "first", BCON_NULL,
+                "a", "[", BCON_INT32 (1), BCON_UTF8 ("s"), "]",
+                "x", BCON_INT32 (1),
+                "old", BCON_BIN (BSON_SUBTYPE_BINARY_DEPRECATED,
+                                 (const uint8_t *)"xyz", 3));
+
+   bson_eq_bson (&bcon, &expected);
+
+   bcon_template_destroy (tpl);
+   bson_destroy (&bcon);
+   bson_destroy (&expected);
+   bson_destroy (&child);
+}
+
+
+static void
+test_template_many (void)
+{
+   bcon_template_t *tpl;
+   bson_t bcon, expected, child;
+   const char *key;
+   char buf[16];
+   int i;
+
+   bson_init (&bcon);
+   bson_init (&expected);
+
+   /* more placeholders than are taken into the stack */
+   tpl = BCON_TEMPLATE_NEW ("a", "[",
+      BCONT_INT32, BCONT_INT32, BCONT_INT32, BCONT_INT32, BCONT_INT32,
+      BCONT_INT32, BCONT_INT32, BCONT_INT32, BCONT_INT32, BCONT_INT32,
+      BCONT_INT32, BCONT_INT32, BCONT_INT32, BCONT_INT32, BCONT_INT32,
+      BCONT_INT32, BCONT_INT32, BCONT_INT32, BCONT_UTF8, "]");
+
+   assert (bcon_template_render (tpl, &bcon,
+      0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, "end"));
+
+   bson_append_array_begin (&expected, "a", -1, &child);
+   for (i = 0; i < 18; i++) {
+      bson_uint32_to_string (i, &key, buf, sizeof buf);
+      bson_append_int32 (&child, key, -1, i);
+   }
+   bson_append_utf8 (&child, "18", -1, "end", -1);
+   bson_append_array_end (&expected, &child);
+
+   bson_eq_bson (&bcon, &expected);
+
+   bcon_template_destroy (tpl);
+   bson_destroy (&bcon);
+   bson_destroy (&expected);
+}
+
+
 void
 test_bcon_basic_install (TestSuite *suite)
 {
@@ -662,4 +814,8 @@ test_bcon_basic_install (TestSuite *suite)
    TestSuite_Add (suite, "/bson/bcon/test_iter", test_iter);
    TestSuite_Add (suite, "/bson/bcon/test_bcon_new", test_bcon_new);
    TestSuite_Add (suite, "/bson/bcon/test_append_ctx", test_append_ctx);
+   TestSuite_Add (suite, "/bson/bcon/test_template", test_template);
+   TestSuite_Add (suite, "/bson/bcon/test_template_append",
+                  test_template_append);
+   TestSuite_Add (suite, "/bson/bcon/test_template_many", test_template_many);
 }
@@ -509,6 +509,119 @@ test_iter (void)
 }
 
 
+static void
+test_plan (void)
+{
+   bcon_extract_plan_t *plan;
+   const char *utf8;
+   const char *tag;
+   int32_t i32;
+   int64_t i64;
+   double dbl;
+   bool b;
+   bson_t sub;
+   bson_t *bcon;
+   int i;
+
+   plan = BCON_EXTRACT_PLAN_NEW (
+      "hello", BCONE_UTF8 (utf8),
+      "foo", "{",
+         "bar", BCONE_INT32 (i32),
+         "baz", "{", "deep", BCONE_INT64 (i64), "}",
+      "}",
+      "tags", "[", BCONE_SKIP (BSON_TYPE_UTF8), BCONE_UTF8 (tag), "]",
+      "sub", BCONE_DOCUMENT (sub),
+      "flag", BCONE_BOOL (b),
+      "score", BCONE_DOUBLE (dbl));
+
+   /* the requested fields in different orders, among others */
+   for (i = 0; i < 3; i++) {
+      if (i % 2) {
+         bcon = BCON_NEW (
+            "score", BCON_DOUBLE (i),
+            "other", BCON_INT32 (0),
+            "flag", BCON_BOOL (true),
+            "sub", "{", "x", BCON_INT32 (i), "}",
+            "tags", "[", BCON_UTF8 ("a"), BCON_UTF8 ("b"), BCON_UTF8 ("c"), "]",
+            "foo", "{",
+               "baz", "{", "deep", BCON_INT64 (i * 10LL), "}",
+               "bar", BCON_INT32 (i),
+               "ignored", BCON_NULL,
+            "}",
+            "hello", BCON_UTF8 ("odd"));
+      } else {
+         bcon = BCON_NEW (
+            "hello", BCON_UTF8 ("even"),
+            "foo", "{",
+               "bar", BCON_INT32 (i),
+               "baz", "{", "deep", BCON_INT64 (i * 10LL), "}",
+            "}",
+            "tags", "[", BCON_UTF8 ("a"), BCON_UTF8 ("b"), "]",
+            "sub", "{", "x", BCON_INT32 (i), "}",
+            "flag", BCON_BOOL (false),
+            "score", BCON_DOUBLE (i),
+            "hello", BCON_UTF8 ("repeated"));
+      }
+
+      assert (bcon_extract_plan_execute (plan, bcon));
+
+      assert (strcmp (utf8, i % 2 ? "odd" : "even") == 0);
+      assert (i32 == i);
+      assert (i64 == i * 10LL);
+      assert (strcmp (tag, "b") == 0);
+      assert (b == (i % 2));
+      assert (dbl == i);
+      assert (bcon_extract (&sub, "x", BCONE_INT32 (i32), NULL));
+      assert (i32 == i);
+
+      bson_destroy (bcon);
+   }
+
+   bcon_extract_plan_destroy (plan);
+}
+
+
+static void
+test_plan_failure (void)
+{
+   bcon_extract_plan_t *plan;
+   int32_t i32;
+   int32_t other;
+   bson_t *bcon;
+
+   plan = BCON_EXTRACT_PLAN_NEW ("a", "{", "b", BCONE_INT32 (i32), "}",
+                                 "c", BCONE_INT32 (other));
+
+   /* missing key */
+   bcon = BCON_NEW ("a", "{", "b", BCON_INT32 (1), "}");
+   assert (!bcon_extract_plan_execute (plan, bcon));
+   bson_destroy (bcon);
+
+   /* missing nested key */
+   bcon = BCON_NEW ("a", "{", "x", BCON_INT32 (1), "}", "c", BCON_INT32 (2));
+   assert (!bcon_extract_plan_execute (plan, bcon));
+   bson_destroy (bcon);
+
+   /* wrong type */
+   bcon = BCON_NEW ("a", "{", "b", BCON_UTF8 ("1"), "}", "c", BCON_INT32 (2));
+   assert (!bcon_extract_plan_execute (plan, bcon));
+   bson_destroy (bcon);
+
+   /* not a document */
+   bcon = BCON_NEW ("a", "[", BCON_INT32 (1), "]", "c", BCON_INT32 (2));
+   assert (!bcon_extract_plan_execute (plan, bcon));
+   bson_destroy (bcon);
+
+   bcon = BCON_NEW ("c", BCON_INT32 (2), "a", "{", "b", BCON_INT32 (1), "}");
+   assert (bcon_extract_plan_execute (plan, bcon));
+   assert (i32 == 1);
+   assert (other == 2);
+   bson_destroy (bcon);
+
+   bcon_extract_plan_destroy (plan);
+}
+
+
 void
 test_bcon_extract_install (TestSuite *suite)
 {
@@ -541,4 +654,7 @@ test_bcon_extract_install (TestSuite *suite)
    TestSuite_Add (suite, "/bson/bcon/extract/test_nested", test_nested);
    TestSuite_Add (suite, "/bson/bcon/extract/test_skip", test_skip);
    TestSuite_Add (suite, "/bson/bcon/extract/test_iter", test_iter);
+   TestSuite_Add (suite, "/bson/bcon/extract/test_plan", test_plan);
+   TestSuite_Add (suite, "/bson/bcon/extract/test_plan_failure",
+                  test_plan_failure);
 }
@@ -1022,6 +1022,26 @@ test_bson_validate (void)
 }
 
 
+static void
+test_bson_validate_utf8 (void)
+{
+   const char bad[] = "a\xc0\xaf" "b";
+   size_t offset;
+   bson_t b;
+
+   bson_init (&b);
+   assert (bson_append_utf8 (&b, "a", -1, bad, sizeof bad - 1));
+
+   /* UTF-8 is only checked when asked for */
+   assert (bson_validate (&b, BSON_VALIDATE_NONE, &offset));
+   assert (bson_validate (&b, BSON_VALIDATE_DOT_KEYS, &offset));
+   assert (!bson_validate (&b, BSON_VALIDATE_UTF8, &offset));
+   assert (offset == 4);
+
+   bson_destroy (&b);
+}
+
+
 static void
 test_bson_init (void)
 {
@@ -1941,6 +1961,348 @@ test_bson_visit_unsupported_type_empty_key (void)
 }
 
 
+/* a document with one field of every type bson_append_value() writes */
+static bson_t *
+append_many_all_types (void)
+{
+   bson_t *scope = BCON_NEW ("x", BCON_INT32 (1));
+   bson_t *doc = bson_new ();
+   bson_t *child = BCON_NEW ("a", "[", BCON_INT32 (1), "]");
+   bson_oid_t oid;
+
+   bson_oid_init_from_string (&oid, "1234567890abcdef12345678");
+
+   BSON_APPEND_DOUBLE (doc, "double", 1.5);
+   BSON_APPEND_UTF8 (doc, "utf8", "hello");
+   BSON_APPEND_DOCUMENT (doc, "document", child);
+   BSON_APPEND_ARRAY (doc, "array", child);
+   BSON_APPEND_BINARY (doc, "binary", BSON_SUBTYPE_UUID,
+                       (const uint8_t *)"0123456789abcdef", 16);
+   BSON_APPEND_BINARY (doc, "old-binary", BSON_SUBTYPE_BINARY_DEPRECATED,
+                       (const uint8_t *)"abc", 3);
+   BSON_APPEND_UNDEFINED (doc, "undefined");
+   BSON_APPEND_OID (doc, "oid", &oid);
+   BSON_APPEND_BOOL (doc, "bool", true);
+   BSON_APPEND_DATE_TIME (doc, "date_time", 1234567890123LL);
+   BSON_APPEND_NULL (doc, "null");
+   BSON_APPEND_REGEX (doc, "regex", "^a.*", "im");
+   BSON_APPEND_DBPOINTER (doc, "dbpointer", "db.coll", &oid);
+   BSON_APPEND_CODE (doc, "code", "function () {}");
+   BSON_APPEND_SYMBOL (doc, "symbol", "sym");
+   BSON_APPEND_CODE_WITH_SCOPE (doc, "code_w_scope", "x", scope);
+   BSON_APPEND_INT32 (doc, "int32", -7);
+   BSON_APPEND_TIMESTAMP (doc, "timestamp", 100, 5);
+   BSON_APPEND_INT64 (doc, "int64", -8);
+   BSON_APPEND_MAXKEY (doc, "maxkey");
+   BSON_APPEND_MINKEY (doc, "minkey");
+
+   bson_destroy (scope);
+   bson_destroy (child);
+
+   return doc;
+}
+
+
+static void
+test_bson_append_many (void)
+{
+   bson_field_t fields[32];
+   bson_t *expected;
+   bson_t *inline_expected;
+   bson_iter_t iter;
+   bson_t doc;
+   size_t n = 0;
+
+   expected = append_many_all_types ();
+
+   assert (bson_iter_init (&iter, expected));
+
+   while (bson_iter_next (&iter)) {
+      fields[n].key = bson_iter_key (&iter);
+      /* mix NUL-terminated and explicit key lengths */
+      fields[n].key_length = n % 2 ? -1 : (int)strlen (fields[n].key);
+      memcpy (&fields[n].value, bson_iter_value (&iter),
+              sizeof fields[n].value);
+      n++;
+   }
+
+   assert (n == 21);
+
+   /* the same bytes as separate appends, starting inline */
+   bson_init (&doc);
+   assert (bson_append_many (&doc, fields, n));
+   assert (doc.len == expected->len);
+   assert (!memcmp (bson_get_data (&doc), bson_get_data (expected), doc.len));
+   bson_destroy (&doc);
+
+   /* and after existing fields */
+   inline_expected = BCON_NEW ("first", BCON_INT32 (0));
+   bson_init (&doc);
+   BSON_APPEND_INT32 (&doc, "first", 0);
+   assert (bson_append_many (&doc, fields, 1));
+   BSON_APPEND_DOUBLE (inline_expected, "double", 1.5);
+   assert (bson_equal (&doc, inline_expected));
+   bson_destroy (&doc);
+   bson_destroy (inline_expected);
+
+   /* nothing to append */
+   bson_init (&doc);
+   assert (bson_append_many (&doc, NULL, 0));
+   assert (doc.len == 5);
+   bson_destroy (&doc);
+
+   bson_destroy (expected);
+}
+
+
+static void
+test_bson_append_many_array (void)
+{
+   bson_field_t fields[1100];
+   bson_t *expected;
+   bson_t child;
+   bson_t doc;
+   char str[16];
+   const char *key;
+   size_t i;
+
+   /* NULL keys are the field's index */
+   expected = bson_new ();
+   bson_append_array_begin (expected, "a", -1, &child);
+
+   for (i = 0; i < 1100; i++) {
+      fields[i].key = NULL;
+      fields[i].key_length = 0;
+      fields[i].value.value_type = BSON_TYPE_INT32;
+      fields[i].value.value.v_int32 = (int32_t)i * 3;
+
+      bson_uint32_to_string ((uint32_t)i, &key, str, sizeof str);
+      BSON_APPEND_INT32 (&child, key, (int32_t)i * 3);
+   }
+
+   bson_append_array_end (expected, &child);
+
+   bson_init (&doc);
+   bson_append_array_begin (&doc, "a", -1, &child);
+   assert (bson_append_many (&child, fields, 1100));
+   bson_append_array_end (&doc, &child);
+
+   assert (bson_equal (&doc, expected));
+   bson_destroy (&doc);
+
+   /* and continue from the elements already in the array */
+   bson_init (&doc);
+   bson_append_array_begin (&doc, "a", -1, &child);
+   assert (bson_append_many (&child, fields, 1000));
+   assert (bson_append_many (&child, fields + 1000, 100));
+   bson_append_array_end (&doc, &child);
+
+   assert (bson_equal (&doc, expected));
+   bson_destroy (&doc);
+
+   /* or from the index given instead */
+   bson_init (&doc);
+   bson_append_array_begin (&doc, "a", -1, &child);
+   assert (bson_append_many_array (&child, 0, fields, 1000));
+   assert (bson_append_many_array (&child, 1000, fields + 1000, 100));
+   bson_append_array_end (&doc, &child);
+
+   assert (bson_equal (&doc, expected));
+
+   bson_destroy (&doc);
+   bson_destroy (expected);
+}
+
+
+static void
+test_bson_append_many_array_batches (void)
+{
+   bson_field_t fields[1000];
+   bson_iter_t iter;
+   bson_t array;
+   char str[16];
+   const char *key;
+   uint32_t n = 0;
+   uint32_t i;
+   uint32_t j;
+
+   /* a large array built a batch at a time */
+   bson_init (&array);
+
+   for (i = 0; i < 200; i++) {
+      for (j = 0; j < 1000; j++) {
+         fields[j].key = NULL;
+         fields[j].key_length = 0;
+         fields[j].value.value_type = BSON_TYPE_INT32;
+         fields[j].value.value.v_int32 = (int32_t)(i * 1000 + j);
+      }
+
+      assert (bson_append_many_array (&array, i * 1000, fields, 1000));
+   }
+
+   assert (bson_iter_init (&iter, &array));
+
+   while (bson_iter_next (&iter)) {
+      bson_uint32_to_string (n, &key, str, sizeof str);
+      assert_cmpstr (bson_iter_key (&iter), key);
+      assert (bson_iter_int32 (&iter) == (int32_t)n);
+      n++;
+   }
+
+   assert (n == 200000);
+   assert (bson_count_keys (&array) == 200000);
+
+   bson_destroy (&array);
+}
+
+
+static void
+test_bson_append_many_errors (void)
+{
+   bson_field_t fields[3];
+   uint8_t bad_doc[5] = { 6, 0, 0, 0, 0 };
+   bson_t *expected;
+   bson_t doc;
+
+   fields[0].key = "a";
+   fields[0].key_length = -1;
+   fields[0].value.value_type = BSON_TYPE_INT32;
+   fields[0].value.value.v_int32 = 1;
+
+   /* like bson_append_value(), a NULL string is a null */
+   fields[1].key = "b";
+   fields[1].key_length = -1;
+   fields[1].value.value_type = BSON_TYPE_UTF8;
+   fields[1].value.value.v_utf8.str = NULL;
+   fields[1].value.value.v_utf8.len = 0;
+
+   expected = BCON_NEW ("a", BCON_INT32 (1), "b", BCON_NULL);
+   bson_init (&doc);
+   assert (bson_append_many (&doc, fields, 2));
+   assert (bson_equal (&doc, expected));
+   bson_destroy (expected);
+
+   /* a bad field appends nothing, even the good fields before it */
+   fields[2].key = "c";
+   fields[2].key_length = -1;
+   fields[2].value.value_type = BSON_TYPE_DOCUMENT;
+   fields[2].value.value.v_doc.data = bad_doc;
+   fields[2].value.value.v_doc.data_len = sizeof bad_doc;
+   assert (!bson_append_many (&doc, fields, 3));
+   assert (doc.len == 5 + 7 + 3);
+
+   fields[2].value.value_type = BSON_TYPE_EOD;
+   assert (!bson_append_many (&doc, fields, 3));
+   assert (doc.len == 5 + 7 + 3);
+
+   bson_destroy (&doc);
+}
+
+
+static void
+test_bson_append_reserve (void)
+{
+   const size_t big = 5 * 1024 * 1024;
+   bson_t *expected;
+   bson_t child;
+   bson_t doc;
+   uint8_t *data;
+   char *str;
+   size_t i;
+
+   /* reserve more than is written, starting inline */
+   expected = bson_new ();
+   BSON_APPEND_INT32 (expected, "a", 1);
+   BSON_APPEND_BINARY (expected, "bin", BSON_SUBTYPE_BINARY,
+                       (const uint8_t *)"abc", 3);
+   BSON_APPEND_BINARY (expected, "old", BSON_SUBTYPE_BINARY_DEPRECATED,
+                       (const uint8_t *)"de", 2);
+   bson_append_document_begin (expected, "doc", -1, &child);
+   BSON_APPEND_UTF8 (&child, "s", "hello");
+   bson_append_document_end (expected, &child);
+   BSON_APPEND_INT32 (expected, "z", 2);
+
+   bson_init (&doc);
+   BSON_APPEND_INT32 (&doc, "a", 1);
+
+   data = bson_append_binary_reserve (&doc, "bin", -1, BSON_SUBTYPE_BINARY,
+                                      10);
+   assert (data);
+   memcpy (data, "abc", 3);
+   assert (bson_append_reserve_commit (&doc, 3));
+
+   data = bson_append_binary_reserve (&doc, "old", 3,
+                                      BSON_SUBTYPE_BINARY_DEPRECATED, 2);
+   assert (data);
+   memcpy (data, "de", 2);
+   /* more than was reserved: the field stays pending */
+   assert (!bson_append_reserve_commit (&doc, 3));
+   assert (bson_append_reserve_commit (&doc, 2));
+
+   bson_append_document_begin (&doc, "doc", -1, &child);
+   /* the parent is busy while the child is open */
+   assert (!bson_append_utf8_reserve (&doc, "s", -1, 5));
+   str = bson_append_utf8_reserve (&child, "s", -1, 5);
+   assert (str);
+   memcpy (str, "hello", 5);
+   assert (bson_append_reserve_commit (&child, 5));
+   bson_append_document_end (&doc, &child);
+
+   BSON_APPEND_INT32 (&doc, "z", 2);
+
+   assert (bson_validate (&doc, BSON_VALIDATE_NONE, NULL));
+   assert (bson_equal (&doc, expected));
+   bson_destroy (&doc);
+   bson_destroy (expected);
+
+   /* a large value is written in place, growing the document once */
+   bson_init (&doc);
+   data = bson_append_binary_reserve (&doc, "big", -1, BSON_SUBTYPE_BINARY,
+                                      (uint32_t)big);
+   assert (data);
+
+   for (i = 0; i < big; i++) {
+      data[i] = (uint8_t)i;
+   }
+
+   assert (bson_append_reserve_commit (&doc, (uint32_t)big));
+   assert (doc.len == 5 + 1 + 4 + 4 + 1 + big);
+   assert (bson_validate (&doc, BSON_VALIDATE_NONE, NULL));
+   bson_destroy (&doc);
+}
+
+
+static void
+test_bson_append_reserve_cancel (void)
+{
+   bson_t *expected;
+   bson_t doc;
+   char *str;
+
+   expected = BCON_NEW ("a", BCON_INT32 (1), "b", BCON_UTF8 ("x"));
+
+   bson_init (&doc);
+   BSON_APPEND_INT32 (&doc, "a", 1);
+
+   str = bson_append_utf8_reserve (&doc, "dropped", -1, 100);
+   assert (str);
+   memset (str, 'y', 100);
+   /* no second field while one is pending */
+   assert (!bson_append_utf8_reserve (&doc, "b", -1, 1));
+   bson_append_reserve_cancel (&doc);
+
+   assert (bson_validate (&doc, BSON_VALIDATE_NONE, NULL));
+   str = bson_append_utf8_reserve (&doc, "b", -1, 1);
+   assert (str);
+   *str = 'x';
+   assert (bson_append_reserve_commit (&doc, 1));
+
+   assert (bson_equal (&doc, expected));
+   bson_destroy (&doc);
+   bson_destroy (expected);
+}
+
+
 void
 test_bson_install (TestSuite *suite)
 {
@@ -1981,6 +2343,7 @@ test_bson_install (TestSuite *suite)
    TestSuite_Add (suite, "/bson/utf8_key", test_bson_utf8_key);
    TestSuite_Add (suite, "/bson/validate", test_bson_validate);
    TestSuite_Add (suite, "/bson/validate/dbref", test_bson_validate_dbref);
+   TestSuite_Add (suite, "/bson/validate/utf8", test_bson_validate_utf8);
    TestSuite_Add (suite, "/bson/new_1mm", test_bson_new_1mm);
    TestSuite_Add (suite, "/bson/init_1mm", test_bson_init_1mm);
    TestSuite_Add (suite, "/bson/build_child", test_bson_build_child);
@@ -1997,6 +2360,16 @@ test_bson_install (TestSuite *suite)
    TestSuite_Add (suite, "/bson/macros", test_bson_macros);
    TestSuite_Add (suite, "/bson/clear", test_bson_clear);
    TestSuite_Add (suite, "/bson/steal", test_bson_steal);
+   TestSuite_Add (suite, "/bson/append_many", test_bson_append_many);
+   TestSuite_Add (suite, "/bson/append_many/array",
+                  test_bson_append_many_array);
+   TestSuite_Add (suite, "/bson/append_many/array/batches",
+                  test_bson_append_many_array_batches);
+   TestSuite_Add (suite, "/bson/append_many/errors",
+                  test_bson_append_many_errors);
+   TestSuite_Add (suite, "/bson/append_reserve", test_bson_append_reserve);
+   TestSuite_Add (suite, "/bson/append_reserve/cancel",
+                  test_bson_append_reserve_cancel);
    TestSuite_Add (suite, "/bson/reserve_buffer", test_bson_reserve_buffer);
    TestSuite_Add (suite, "/bson/reserve_buffer/errors", test_bson_reserve_buffer_errors);
    TestSuite_Add (suite, "/bson/destroy_with_steal", test_bson_destroy_with_steal);
@@ -0,0 +1,660 @@
+/*
+ * Copyright 2016 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Allocation and time budgets for canonical operations.
+ *
+ * The allocation tests install a counting bson_mem_vtable_t and assert an
+ * upper bound on the number of allocations each operation makes, so that
+ * an extra malloc per append or a lost inline fast path fails "make check"
+ * instead of showing up in load tests.
+ *
+ * The time tests run the same operations against the per-operation
+ * baselines in tests/json/budget/baselines.json and fail if one is more
+ * than BUDGET_TIME_FACTOR times slower. The baselines are deliberately
+ * coarse; run with --debug to print the measured times when updating
+ * them. Set BSON_TEST_TIME_BUDGET to another factor, or to 0 to skip the
+ * time tests, e.g. on a heavily loaded machine.
+ */
+
+
+#include <assert.h>
+#include <bcon.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BSON_INSIDE
+#include "bson-thread-private.h"
+#undef BSON_INSIDE
+
+#include "bson-tests.h"
+#include "TestSuite.h"
+
+
+#ifndef JSON_DIR
+# define JSON_DIR "tests/json"
+#endif
+
+#define BUDGET_BASELINES   JSON_DIR "/budget/baselines.json"
+#define BUDGET_TIME_FACTOR 10
+#define BUDGET_ROUNDS      5
+#define BUDGET_ROUND_NS    (2 * 1000 * 1000)
+#define BUDGET_STREAM_DOCS 100
+
+
+typedef struct
+{
+   int allocs;
+   int frees;
+} budget_counter_t;
+
+
+typedef struct
+{
+   bson_t   small;
+   uint8_t *stream;
+   size_t   stream_len;
+   char    *json;
+} budget_fixture_t;
+
+
+typedef struct
+{
+   const char *name;
+   void (*run) (const budget_fixture_t *fixture);
+   int max_allocs;
+} budget_op_t;
+
+
+static bson_thread_key_t gBudgetKey;
+
+
+/*
+ * The counting vtable stays installed for the whole run; only threads
+ * inside budget_begin()/budget_end() count, so tests running in parallel
+ * with --threads do not disturb each other.
+ */
+static void
+budget_count (bool alloc)
+{
+   budget_counter_t *counter;
+
+   if ((counter = bson_thread_key_get (gBudgetKey))) {
+      if (alloc) {
+         counter->allocs++;
+      } else {
+         counter->frees++;
+      }
+   }
+}
+
+
+static void *
+budget_malloc (size_t num_bytes)
+{
+   budget_count (true);
+   return malloc (num_bytes);
+}
+
+
+static void *
+budget_calloc (size_t n_members,
+               size_t num_bytes)
+{
+   budget_count (true);
+   return calloc (n_members, num_bytes);
+}
+
+
+static void *
+budget_realloc (void   *mem,
+                size_t  num_bytes)
+{
+   /* growing in place still costs a call into the allocator */
+   budget_count (true);
+
+   if (mem) {
+      budget_count (false);
+   }
+
+   return realloc (mem, num_bytes);
+}
+
+
+static void
+budget_free (void *mem)
+{
+   if (mem) {
+      budget_count (false);
+   }
+
+   free (mem);
+}
+
+
+static void
+budget_begin (budget_counter_t *counter)
+{
+   memset (counter, 0, sizeof *counter);
+   bson_thread_key_set (gBudgetKey, counter);
+}
+
+
+static void
+budget_end (void)
+{
+   bson_thread_key_set (gBudgetKey, NULL);
+}
+
+
+/*
+ * About 100 bytes, which must fit in the inline buffer of a bson_t. The
+ * subdocument is appended whole: bson_append_document_begin() always moves
+ * the parent to the heap, which budget_op_build_child() accounts for.
+ */
+static void
+budget_build_small (bson_t *b)
+{
+   bson_oid_t oid;
+   bson_t child;
+
+   bson_oid_init_from_string (&oid, "000102030405060708090a0b");
+   bson_init (&child);
+   BSON_APPEND_NULL (&child, "null");
+
+   BSON_APPEND_OID (b, "_id", &oid);
+   BSON_APPEND_UTF8 (b, "name", "budget");
+   BSON_APPEND_INT32 (b, "int32", 1);
+   BSON_APPEND_INT64 (b, "int64", 2);
+   BSON_APPEND_DOUBLE (b, "double", 3.0);
+   BSON_APPEND_BOOL (b, "bool", true);
+   BSON_APPEND_DATE_TIME (b, "date", 4);
+   BSON_APPEND_DOCUMENT (b, "sub", &child);
+   bson_destroy (&child);
+}
+
+
+static void
+budget_fixture_init (budget_fixture_t *fixture)
+{
+   bson_writer_t *writer;
+   bson_t *b;
+   int i;
+
+   bson_init (&fixture->small);
+   budget_build_small (&fixture->small);
+   assert (fixture->small.len >= 90 && fixture->small.len <= 120);
+
+   fixture->stream = NULL;
+   fixture->stream_len = 0;
+   writer = bson_writer_new (&fixture->stream, &fixture->stream_len, 0,
+                             bson_realloc_ctx, NULL);
+
+   for (i = 0; i < BUDGET_STREAM_DOCS; i++) {
+      assert (bson_writer_begin (writer, &b));
+      budget_build_small (b);
+      bson_writer_end (writer);
+   }
+
+   fixture->stream_len = bson_writer_get_length (writer);
+   bson_writer_destroy (writer);
+
+   fixture->json = bson_as_json (&fixture->small, NULL);
+}
+
+
+static void
+budget_fixture_destroy (budget_fixture_t *fixture)
+{
+   bson_destroy (&fixture->small);
+   bson_free (fixture->stream);
+   bson_free (fixture->json);
+}
+
+
+static void
+budget_op_build_inline (const budget_fixture_t *fixture)
+{
+   bson_t b;
+
+   bson_init (&b);
+   budget_build_small (&b);
+   assert (b.len == fixture->small.len);
+   bson_destroy (&b);
+}
+
+
+static void
+budget_op_build_new (const budget_fixture_t *fixture)
+{
+   bson_t *b;
+
+   b = bson_new ();
+   budget_build_small (b);
+   assert (b->len == fixture->small.len);
+   bson_destroy (b);
+}
+
+
+static void
+budget_op_build_child (const budget_fixture_t *fixture)
+{
+   bson_t b;
+   bson_t child;
+
+   bson_init (&b);
+   BSON_APPEND_DOCUMENT_BEGIN (&b, "sub", &child);
+   BSON_APPEND_INT32 (&child, "a", 1);
+   bson_append_document_end (&b, &child);
+   bson_destroy (&b);
+}
+
+
+static void
+budget_op_append_many (const budget_fixture_t *fixture)
+{
+   bson_field_t fields[6];
+   bson_t b;
+
+   memset (fields, 0, sizeof fields);
+
+   fields[0].key = "a";
+   fields[0].value.value_type = BSON_TYPE_INT32;
+   fields[0].value.value.v_int32 = 1;
+   fields[1].key = "b";
+   fields[1].value.value_type = BSON_TYPE_INT64;
+   fields[1].value.value.v_int64 = 2;
+   fields[2].key = "c";
+   fields[2].value.value_type = BSON_TYPE_DOUBLE;
+   fields[2].value.value.v_double = 3.0;
+   fields[3].key = "d";
+   fields[3].value.value_type = BSON_TYPE_UTF8;
+   fields[3].value.value.v_utf8.str = "budget";
+   fields[3].value.value.v_utf8.len = 6;
+   fields[4].key = "e";
+   fields[4].value.value_type = BSON_TYPE_BOOL;
+   fields[4].value.value.v_bool = true;
+   fields[5].key = "f";
+   fields[5].value.value_type = BSON_TYPE_NULL;
+
+   bson_init (&b);
+   assert (bson_append_many (&b, fields, 6));
+   bson_destroy (&b);
+}
+
+
+static void
+budget_op_iter (const budget_fixture_t *fixture)
+{
+   bson_iter_t iter;
+   bson_iter_t child;
+   int n = 0;
+
+   assert (bson_iter_init (&iter, &fixture->small));
+
+   while (bson_iter_next (&iter)) {
+      n++;
+
+      if (BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+         assert (bson_iter_recurse (&iter, &child));
+
+         while (bson_iter_next (&child)) {
+            n++;
+         }
+      }
+   }
+
+   assert (n == 9);
+}
+
+
+static void
+budget_op_validate (const budget_fixture_t *fixture)
+{
+   assert (bson_validate (&fixture->small, BSON_VALIDATE_UTF8, NULL));
+}
+
+
+static void
+budget_op_copy (const budget_fixture_t *fixture)
+{
+   bson_t *copy;
+
+   copy = bson_copy (&fixture->small);
+   bson_destroy (copy);
+}
+
+
+static void
+budget_op_as_json (const budget_fixture_t *fixture)
+{
+   char *str;
+
+   str = bson_as_json (&fixture->small, NULL);
+   bson_free (str);
+}
+
+
+static void
+budget_op_init_from_json (const budget_fixture_t *fixture)
+{
+   bson_t b;
+
+   assert (bson_init_from_json (&b, fixture->json, -1, NULL));
+   bson_destroy (&b);
+}
+
+
+static void
+budget_op_reader_data (const budget_fixture_t *fixture)
+{
+   bson_reader_t *reader;
+   const bson_t *b;
+   bool eof = false;
+   int n = 0;
+
+   reader = bson_reader_new_from_data (fixture->stream, fixture->stream_len);
+
+   while ((b = bson_reader_read (reader, &eof))) {
+      n++;
+   }
+
+   assert (eof);
+   assert (n == BUDGET_STREAM_DOCS);
+   bson_reader_destroy (reader);
+}
+
+
+/*
+ * max_allocs is an upper bound, not the exact count; lower it when an
+ * operation gets cheaper rather than raising it when one gets dearer.
+ */
+static const budget_op_t gBudgetOps[] = {
+   { "build_inline", budget_op_build_inline, 0 },
+   { "build_new", budget_op_build_new, 1 },
+   { "build_child", budget_op_build_child, 1 },
+   { "append_many", budget_op_append_many, 0 },
+   { "iter", budget_op_iter, 0 },
+   { "validate", budget_op_validate, 0 },
+   { "copy", budget_op_copy, 1 },
+   { "as_json", budget_op_as_json, 3 },
+   { "init_from_json", budget_op_init_from_json, 12 },
+   { "reader_data", budget_op_reader_data, 1 },
+};
+
+
+static void
+test_budget_allocations (void)
+{
+   budget_fixture_t fixture;
+   budget_counter_t counter;
+   size_t i;
+
+   budget_fixture_init (&fixture);
+
+   for (i = 0; i < sizeof gBudgetOps / sizeof gBudgetOps[0]; i++) {
+      budget_begin (&counter);
+      gBudgetOps[i].run (&fixture);
+      budget_end ();
+
+      if (test_suite_debug_output ()) {
+         fprintf (stderr, "%-16s %d allocs\n",
+                  gBudgetOps[i].name, counter.allocs);
+      }
+
+      if (counter.allocs > gBudgetOps[i].max_allocs) {
+         fprintf (stderr, "%s: %d allocations, budget is %d\n",
+                  gBudgetOps[i].name, counter.allocs,
+                  gBudgetOps[i].max_allocs);
+         abort ();
+      }
+
+      /* every operation cleans up after itself */
+      ASSERT_CMPINT (counter.allocs, ==, counter.frees);
+   }
+
+   budget_fixture_destroy (&fixture);
+}
+
+
+/* the reader allocates per stream, not per document */
+static void
+test_budget_allocations_reader (void)
+{
+   budget_counter_t counter;
+   bson_reader_t *reader;
+   bson_writer_t *writer;
+   uint8_t *buf = NULL;
+   size_t buflen = 0;
+   bson_t *b;
+   bool eof = false;
+   int n = 0;
+   int i;
+
+   writer = bson_writer_new (&buf, &buflen, 0, bson_realloc_ctx, NULL);
+
+   for (i = 0; i < 10 * BUDGET_STREAM_DOCS; i++) {
+      assert (bson_writer_begin (writer, &b));
+      BSON_APPEND_INT32 (b, "i", i);
+      bson_writer_end (writer);
+   }
+
+   buflen = bson_writer_get_length (writer);
+   bson_writer_destroy (writer);
+
+   budget_begin (&counter);
+   reader = bson_reader_new_from_data (buf, buflen);
+
+   while (bson_reader_read (reader, &eof)) {
+      n++;
+   }
+
+   bson_reader_destroy (reader);
+   budget_end ();
+
+   assert (eof);
+   ASSERT_CMPINT (n, ==, 10 * BUDGET_STREAM_DOCS);
+   ASSERT_CMPINT (counter.allocs, <=, 1);
+
+   bson_free (buf);
+}
+
+
+static int
+budget_count_json (int n_fields,
+                   bool from_json)
+{
+   budget_counter_t counter;
+   char key[16];
+   char *json;
+   bson_t b;
+   int i;
+
+   bson_init (&b);
+
+   for (i = 0; i < n_fields; i++) {
+      bson_snprintf (key, sizeof key, "key%d", i);
+      BSON_APPEND_UTF8 (&b, key, "value \"quoted\"");
+   }
+
+   json = bson_as_json (&b, NULL);
+   budget_begin (&counter);
+
+   if (from_json) {
+      bson_t parsed;
+
+      assert (bson_init_from_json (&parsed, json, -1, NULL));
+      bson_destroy (&parsed);
+   } else {
+      bson_free (bson_as_json (&b, NULL));
+   }
+
+   budget_end ();
+   bson_destroy (&b);
+   bson_free (json);
+
+   return counter.allocs;
+}
+
+
+/* converting to and from JSON allocates per document, not per field */
+static void
+test_budget_allocations_json (void)
+{
+   ASSERT_CMPINT (budget_count_json (1000, false), <=,
+                  budget_count_json (10, false));
+   ASSERT_CMPINT (budget_count_json (1000, true), <=,
+                  budget_count_json (10, true) + 8);
+}
+
+
+static int
+budget_time_factor (void)
+{
+   const char *env;
+
+   if ((env = getenv ("BSON_TEST_TIME_BUDGET"))) {
+      return atoi (env);
+   }
+
+   return BUDGET_TIME_FACTOR;
+}
+
+
+/* best of BUDGET_ROUNDS rounds, in nanoseconds per operation */
+static int64_t
+budget_time_op (const budget_op_t      *op,
+                const budget_fixture_t *fixture,
+                int64_t                 baseline_ns)
+{
+   int64_t iterations;
+   int64_t best = INT64_MAX;
+   int64_t start;
+   int64_t ns;
+   int64_t i;
+   int round;
+
+   iterations = BSON_MAX (1, BUDGET_ROUND_NS / BSON_MAX (1, baseline_ns));
+
+   for (round = 0; round < BUDGET_ROUNDS; round++) {
+      start = bson_get_monotonic_time ();
+
+      for (i = 0; i < iterations; i++) {
+         op->run (fixture);
+      }
+
+      ns = (bson_get_monotonic_time () - start) * 1000 / iterations;
+      best = BSON_MIN (best, ns);
+   }
+
+   return best;
+}
+
+
+static void
+test_budget_time (void *ctx)
+{
+   budget_fixture_t fixture;
+   bson_json_reader_t *json;
+   bson_error_t error;
+   bson_iter_t iter;
+   bson_t baselines;
+   int64_t baseline_ns;
+   int64_t ns;
+   size_t i;
+   int factor;
+   int failed = 0;
+
+   factor = budget_time_factor ();
+
+   json = bson_json_reader_new_from_file (BUDGET_BASELINES, &error);
+   assert (json);
+   bson_init (&baselines);
+   ASSERT_CMPINT (bson_json_reader_read (json, &baselines, &error), ==, 1);
+   bson_json_reader_destroy (json);
+
+   budget_fixture_init (&fixture);
+
+   for (i = 0; i < sizeof gBudgetOps / sizeof gBudgetOps[0]; i++) {
+      /* every operation needs a baseline */
+      assert (bson_iter_init_find (&iter, &baselines, gBudgetOps[i].name));
+      assert (BSON_ITER_HOLDS_INT32 (&iter) || BSON_ITER_HOLDS_INT64 (&iter));
+      baseline_ns = bson_iter_as_int64 (&iter);
+
+      ns = budget_time_op (&gBudgetOps[i], &fixture, baseline_ns);
+
+      if (test_suite_debug_output ()) {
+         fprintf (stderr, "%-16s %" PRId64 " ns (baseline %" PRId64 ")\n",
+                  gBudgetOps[i].name, ns, baseline_ns);
+      }
+
+      if (ns > baseline_ns * factor) {
+         fprintf (stderr, "%s: %" PRId64 " ns, budget is %" PRId64 " ns\n",
+                  gBudgetOps[i].name, ns, baseline_ns * factor);
+         failed++;
+      }
+   }
+
+   budget_fixture_destroy (&fixture);
+   bson_destroy (&baselines);
+
+   assert (!failed);
+}
+
+
+static int
+budget_time_enabled (void)
+{
+#if defined(__SANITIZE_ADDRESS__)
+   return 0;
+#elif defined(__has_feature)
+# if __has_feature(address_sanitizer)
+   return 0;
+# endif
+#endif
+
+   return budget_time_factor () > 0 && !test_suite_valgrind ();
+}
+
+
+void
+test_budget_install (TestSuite *suite)
+{
+   static const bson_mem_vtable_t vtable = {
+      budget_malloc,
+      budget_calloc,
+      budget_realloc,
+      budget_free,
+      { 0 }
+   };
+
+   /* install before any test runs, so no thread sees a partial vtable */
+   if (bson_thread_key_create (&gBudgetKey, NULL)) {
+      abort ();
+   }
+
+   bson_mem_set_vtable (&vtable);
+
+   TestSuite_Add (suite, "/budget/allocations", test_budget_allocations);
+   TestSuite_Add (suite, "/budget/allocations/reader",
+                  test_budget_allocations_reader);
+   TestSuite_Add (suite, "/budget/allocations/json",
+                  test_budget_allocations_json);
+   TestSuite_AddFull (suite, "/budget/time",
+                      test_budget_time, NULL, NULL,
+                      budget_time_enabled);
+}
@@ -0,0 +1,405 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <assert.h>
+#include <bcon.h>
+
+#include "bson-tests.h"
+#include "TestSuite.h"
+
+
+static bool
+is_valid (const bson_column_t *column,
+          size_t               row)
+{
+   return (column->validity[row / 8] >> (row % 8)) & 1;
+}
+
+
+static const char *
+utf8_at (const bson_column_t *column,
+         size_t               row,
+         int32_t             *len)
+{
+   const int32_t *offsets = column->values;
+
+   *len = offsets[row + 1] - offsets[row];
+
+   return (const char *)column->data + offsets[row];
+}
+
+
+static void
+add_columns (bson_columnar_extractor_t *extractor)
+{
+   bson_error_t error;
+
+   assert (bson_columnar_extractor_add_column (extractor, "i",
+                                               BSON_COLUMN_INT64, &error));
+   assert (bson_columnar_extractor_add_column (extractor, "d",
+                                               BSON_COLUMN_DOUBLE, &error));
+   assert (bson_columnar_extractor_add_column (extractor, "t",
+                                               BSON_COLUMN_DATE_TIME, &error));
+   assert (bson_columnar_extractor_add_column (extractor, "b",
+                                               BSON_COLUMN_BOOL, &error));
+   assert (bson_columnar_extractor_add_column (extractor, "s",
+                                               BSON_COLUMN_UTF8, &error));
+}
+
+
+static void
+test_columnar_types (void)
+{
+   bson_columnar_extractor_t *extractor;
+   bson_column_t column;
+   bson_error_t error;
+   const int64_t *i64;
+   const double *dbl;
+   const char *str;
+   int32_t len;
+   bson_t *docs[5];
+   int i;
+
+   docs[0] = BCON_NEW ("i", BCON_INT32 (-7), "d", BCON_INT64 (3),
+                       "t", BCON_DATE_TIME (1000), "b", BCON_BOOL (true),
+                       "s", BCON_UTF8 ("hello"));
+   docs[1] = BCON_NEW ("i", BCON_DOUBLE (2.9), "d", BCON_DOUBLE (1.5),
+                       "t", BCON_INT64 (5), "b", BCON_BOOL (false),
+                       "s", BCON_UTF8 (""));
+   docs[2] = BCON_NEW ("i", BCON_DOUBLE (1e300), "d", BCON_UTF8 ("x"),
+                       "b", BCON_INT32 (1), "s", BCON_NULL);
+   docs[3] = BCON_NEW ("other", BCON_INT32 (1));
+   docs[4] = BCON_NEW ("s", BCON_UTF8 ("world"), "i", BCON_INT64 (1LL << 40),
+                       "i", BCON_INT64 (1), "d", BCON_INT32 (-2));
+
+   extractor = bson_columnar_extractor_new ();
+   add_columns (extractor);
+
+   for (i = 0; i < 5; i++) {
+      assert (bson_columnar_extractor_append (extractor, docs[i], &error));
+      bson_destroy (docs[i]);
+   }
+
+   assert (bson_columnar_extractor_get_n_rows (extractor) == 5);
+   assert (!bson_columnar_extractor_get_column (extractor, 5, &column));
+
+   /* int32, int64 and in-range doubles are coerced; the first "i" wins */
+   assert (bson_columnar_extractor_get_column (extractor, 0, &column));
+   assert (!strcmp (column.path, "i"));
+   assert (column.type == BSON_COLUMN_INT64);
+   assert (column.length == 5);
+   assert (column.null_count == 2);
+   i64 = column.values;
+   assert (is_valid (&column, 0) && i64[0] == -7);
+   assert (is_valid (&column, 1) && i64[1] == 2);
+   assert (!is_valid (&column, 2) && i64[2] == 0);
+   assert (!is_valid (&column, 3));
+   assert (is_valid (&column, 4) && i64[4] == 1LL << 40);
+
+   assert (bson_columnar_extractor_get_column (extractor, 1, &column));
+   assert (column.null_count == 2);
+   dbl = column.values;
+   assert (is_valid (&column, 0) && dbl[0] == 3.0);
+   assert (is_valid (&column, 1) && dbl[1] == 1.5);
+   assert (!is_valid (&column, 2) && dbl[2] == 0.0);
+   assert (!is_valid (&column, 3));
+   assert (is_valid (&column, 4) && dbl[4] == -2.0);
+
+   /* only date_time fields fill a date_time column */
+   assert (bson_columnar_extractor_get_column (extractor, 2, &column));
+   assert (column.null_count == 4);
+   i64 = column.values;
+   assert (is_valid (&column, 0) && i64[0] == 1000);
+   assert (!is_valid (&column, 1) && i64[1] == 0);
+
+   assert (bson_columnar_extractor_get_column (extractor, 3, &column));
+   assert (column.null_count == 3);
+   assert (is_valid (&column, 0) && is_valid (&column, 1));
+   assert (((const uint8_t *)column.values)[0] == 1);
+
+   assert (bson_columnar_extractor_get_column (extractor, 4, &column));
+   assert (column.null_count == 2);
+   assert (column.data_len == 10);
+   str = utf8_at (&column, 0, &len);
+   assert (is_valid (&column, 0) && len == 5 && !memcmp (str, "hello", 5));
+   utf8_at (&column, 1, &len);
+   assert (is_valid (&column, 1) && len == 0);
+   utf8_at (&column, 2, &len);
+   assert (!is_valid (&column, 2) && len == 0);
+   str = utf8_at (&column, 4, &len);
+   assert (is_valid (&column, 4) && len == 5 && !memcmp (str, "world", 5));
+
+   bson_columnar_extractor_destroy (extractor);
+}
+
+
+static void
+test_columnar_nested (void)
+{
+   bson_columnar_extractor_t *extractor;
+   bson_column_t column;
+   bson_error_t error;
+   const int64_t *i64;
+   bson_t *doc;
+
+   extractor = bson_columnar_extractor_new ();
+   assert (bson_columnar_extractor_add_column (extractor, "a.b",
+                                               BSON_COLUMN_INT64, &error));
+   assert (bson_columnar_extractor_add_column (extractor, "a.c.d",
+                                               BSON_COLUMN_INT64, &error));
+   assert (bson_columnar_extractor_add_column (extractor, "arr.1",
+                                               BSON_COLUMN_INT64, &error));
+   assert (bson_columnar_extractor_add_column (extractor, "a",
+                                               BSON_COLUMN_INT64, &error));
+
+   doc = BCON_NEW ("x", BCON_NULL,
+                   "a", "{",
+                      "c", "{", "d", BCON_INT32 (3), "}",
+                      "b", BCON_INT32 (2),
+                   "}",
+                   "arr", "[", BCON_INT32 (10), BCON_INT32 (11), "]");
+   assert (bson_columnar_extractor_append (extractor, doc, &error));
+   bson_destroy (doc);
+
+   /* "a" is not a document, so its descendants are null */
+   doc = BCON_NEW ("a", BCON_INT32 (5), "arr", "[", BCON_INT32 (10), "]");
+   assert (bson_columnar_extractor_append (extractor, doc, &error));
+   bson_destroy (doc);
+
+   assert (bson_columnar_extractor_get_column (extractor, 0, &column));
+   i64 = column.values;
+   assert (is_valid (&column, 0) && i64[0] == 2);
+   assert (!is_valid (&column, 1));
+
+   assert (bson_columnar_extractor_get_column (extractor, 1, &column));
+   i64 = column.values;
+   assert (is_valid (&column, 0) && i64[0] == 3);
+   assert (!is_valid (&column, 1));
+
+   assert (bson_columnar_extractor_get_column (extractor, 2, &column));
+   i64 = column.values;
+   assert (is_valid (&column, 0) && i64[0] == 11);
+   assert (!is_valid (&column, 1));
+
+   assert (bson_columnar_extractor_get_column (extractor, 3, &column));
+   i64 = column.values;
+   assert (!is_valid (&column, 0));
+   assert (is_valid (&column, 1) && i64[1] == 5);
+
+   bson_columnar_extractor_destroy (extractor);
+}
+
+
+static void
+extract_stream (const uint8_t  *buf,
+                size_t          len,
+                uint32_t        n_threads,
+                bson_column_t  *columns,
+                bson_columnar_extractor_t **out)
+{
+   bson_columnar_extractor_t *extractor;
+   bson_reader_t *reader;
+   bson_error_t error;
+   int i;
+
+   extractor = bson_columnar_extractor_new ();
+   add_columns (extractor);
+   bson_columnar_extractor_set_n_threads (extractor, n_threads);
+
+   reader = bson_reader_new_from_data (buf, len);
+
+   /* in two calls, so the second starts in the middle of a bitmap byte */
+   assert (bson_columnar_extractor_append_reader (extractor, reader, 4099,
+                                                  &error));
+   assert (bson_columnar_extractor_get_n_rows (extractor) == 4099);
+   assert (bson_columnar_extractor_append_reader (extractor, reader, 0,
+                                                  &error));
+
+   for (i = 0; i < 5; i++) {
+      assert (bson_columnar_extractor_get_column (extractor, i, &columns[i]));
+   }
+
+   bson_reader_destroy (reader);
+   *out = extractor;
+}
+
+
+static void
+test_columnar_reader (void)
+{
+   bson_columnar_extractor_t *serial;
+   bson_columnar_extractor_t *parallel;
+   bson_column_t a[5];
+   bson_column_t b[5];
+   const int64_t *i64;
+   const char *str;
+   uint8_t *buf = NULL;
+   size_t buflen = 0;
+   size_t n = 10001;
+   int32_t len;
+   char name[32];
+   bson_t *doc;
+   size_t i;
+   int c;
+
+   for (i = 0; i < n; i++) {
+      bson_snprintf (name, sizeof name, "name-%d", (int)i);
+      doc = BCON_NEW ("i", BCON_INT32 ((int32_t)i));
+
+      if (i % 3) {
+         BCON_APPEND (doc, "d", BCON_DOUBLE (i * 0.5));
+      }
+
+      BCON_APPEND (doc,
+                   "t", BCON_DATE_TIME ((int64_t)i * 1000),
+                   "b", BCON_BOOL (i % 5 == 0),
+                   "s", BCON_UTF8 (i % 7 ? name : ""));
+      buf = bson_realloc (buf, buflen + doc->len);
+      memcpy (buf + buflen, bson_get_data (doc), doc->len);
+      buflen += doc->len;
+      bson_destroy (doc);
+   }
+
+   extract_stream (buf, buflen, 1, a, &serial);
+   extract_stream (buf, buflen, 4, b, &parallel);
+
+   assert (a[0].length == n);
+   i64 = a[0].values;
+
+   for (i = 0; i < n; i++) {
+      assert (is_valid (&a[0], i) && i64[i] == (int64_t)i);
+      assert (is_valid (&a[1], i) == (i % 3 != 0));
+      assert ((((const uint8_t *)a[3].values)[i / 8] >> (i % 8) & 1) ==
+              (i % 5 == 0));
+      bson_snprintf (name, sizeof name, "name-%d", (int)i);
+      str = utf8_at (&a[4], i, &len);
+      assert ((size_t)len == (i % 7 ? strlen (name) : 0));
+      assert (!memcmp (str, name, len));
+   }
+
+   /* the threads produce the same columns */
+   for (c = 0; c < 5; c++) {
+      assert (a[c].length == b[c].length);
+      assert (a[c].null_count == b[c].null_count);
+      assert (!memcmp (a[c].validity, b[c].validity, (n + 7) / 8));
+      assert (a[c].data_len == b[c].data_len);
+
+      switch (a[c].type) {
+      case BSON_COLUMN_BOOL:
+         assert (!memcmp (a[c].values, b[c].values, (n + 7) / 8));
+         break;
+      case BSON_COLUMN_UTF8:
+         assert (!memcmp (a[c].values, b[c].values, (n + 1) * 4));
+         assert (!memcmp (a[c].data, b[c].data, a[c].data_len));
+         break;
+      default:
+         assert (!memcmp (a[c].values, b[c].values, n * 8));
+         break;
+      }
+   }
+
+   assert (a[1].null_count == (n + 2) / 3);
+
+   /* cleared columns are refilled from the first row */
+   bson_columnar_extractor_clear (parallel);
+   assert (bson_columnar_extractor_get_n_rows (parallel) == 0);
+   doc = BCON_NEW ("b", BCON_BOOL (true), "s", BCON_UTF8 ("x"));
+   assert (bson_columnar_extractor_append (parallel, doc, NULL));
+   bson_destroy (doc);
+   assert (bson_columnar_extractor_get_column (parallel, 3, &b[3]));
+   assert (((const uint8_t *)b[3].values)[0] == 1);
+   assert (b[3].validity[0] == 1);
+   assert (b[3].null_count == 0);
+   assert (bson_columnar_extractor_get_column (parallel, 4, &b[4]));
+   assert (b[4].data_len == 1);
+   assert (((const int32_t *)b[4].values)[1] == 1);
+
+   bson_columnar_extractor_destroy (serial);
+   bson_columnar_extractor_destroy (parallel);
+   bson_free (buf);
+}
+
+
+static void
+test_columnar_errors (void)
+{
+   bson_columnar_extractor_t *extractor;
+   bson_reader_t *reader;
+   bson_column_t column;
+   bson_error_t error;
+   uint8_t buf[64];
+   bson_t *doc;
+
+   extractor = bson_columnar_extractor_new ();
+
+   assert (!bson_columnar_extractor_add_column (extractor, "",
+                                                BSON_COLUMN_INT64, &error));
+   assert (error.domain == BSON_ERROR_COLUMNAR);
+   assert (error.code == BSON_ERROR_COLUMNAR_INVALID);
+   assert (!bson_columnar_extractor_add_column (extractor, "a..b",
+                                                BSON_COLUMN_INT64, &error));
+   assert (!bson_columnar_extractor_add_column (extractor, "a.",
+                                                BSON_COLUMN_INT64, &error));
+   assert (!bson_columnar_extractor_add_column (extractor, ".a",
+                                                BSON_COLUMN_INT64, &error));
+   assert (bson_columnar_extractor_add_column (extractor, "a",
+                                               BSON_COLUMN_INT64, &error));
+   assert (!bson_columnar_extractor_add_column (extractor, "a",
+                                                BSON_COLUMN_DOUBLE, &error));
+   assert (error.code == BSON_ERROR_COLUMNAR_INVALID);
+
+   doc = BCON_NEW ("a", BCON_INT32 (1), "b", BCON_INT32 (2));
+   assert (bson_columnar_extractor_append (extractor, doc, &error));
+   assert (!bson_columnar_extractor_add_column (extractor, "b",
+                                                BSON_COLUMN_INT64, &error));
+   assert (error.code == BSON_ERROR_COLUMNAR_INVALID);
+
+   /* a document whose element runs past its end */
+   memcpy (buf, bson_get_data (doc), doc->len);
+   buf[4] = BSON_TYPE_UTF8;
+   reader = bson_reader_new_from_data (buf, doc->len);
+   assert (!bson_columnar_extractor_append_reader (extractor, reader, 0,
+                                                   &error));
+   assert (error.domain == BSON_ERROR_COLUMNAR);
+   assert (error.code == BSON_ERROR_COLUMNAR_CORRUPT);
+   assert (bson_columnar_extractor_get_n_rows (extractor) == 1);
+   assert (bson_columnar_extractor_get_column (extractor, 0, &column));
+   assert (column.validity[0] == 1);
+   bson_reader_destroy (reader);
+
+   /* columns may be added once the rows are cleared */
+   bson_columnar_extractor_clear (extractor);
+   assert (bson_columnar_extractor_add_column (extractor, "b",
+                                               BSON_COLUMN_INT64, &error));
+   assert (bson_columnar_extractor_append (extractor, doc, &error));
+   assert (bson_columnar_extractor_get_column (extractor, 1, &column));
+   assert (column.length == 1);
+   assert (((const int64_t *)column.values)[0] == 2);
+
+   bson_destroy (doc);
+   bson_columnar_extractor_destroy (extractor);
+}
+
+
+void
+test_columnar_install (TestSuite *suite)
+{
+   TestSuite_Add (suite, "/bson/columnar/types", test_columnar_types);
+   TestSuite_Add (suite, "/bson/columnar/nested", test_columnar_nested);
+   TestSuite_Add (suite, "/bson/columnar/reader", test_columnar_reader);
+   TestSuite_Add (suite, "/bson/columnar/errors", test_columnar_errors);
+}
@@ -0,0 +1,470 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <assert.h>
+#include <bcon.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+# include <unistd.h>
+#endif
+
+#define BSON_INSIDE
+#include "bson-thread-private.h"
+#undef BSON_INSIDE
+
+#include "bson-tests.h"
+#include "TestSuite.h"
+
+
+#ifndef BINARY_DIR
+# define BINARY_DIR "tests/binary"
+#endif
+
+
+#define N_DOCS 5000
+
+
+static const bson_compressor_t gCompressors[] = {
+   BSON_COMPRESSOR_NONE,
+   BSON_COMPRESSOR_ZLIB,
+   BSON_COMPRESSOR_ZSTD,
+   BSON_COMPRESSOR_LZ4,
+};
+
+
+/* writes N_DOCS documents, every tenth one rolled back, and returns the
+ * bytes of documents written */
+static size_t
+write_docs (const char        *path,
+            bson_compressor_t  compressor,
+            uint32_t           n_threads,
+            size_t             block_size)
+{
+   bson_compressed_writer_t *writer;
+   bson_error_t error;
+   size_t len = 0;
+   bson_t *b;
+   char str[32];
+   int i;
+
+   writer = bson_compressed_writer_new_from_file (path, compressor,
+                                                  n_threads, &error);
+   assert (writer);
+   bson_compressed_writer_set_block_size (writer, block_size);
+
+   for (i = 0; i < N_DOCS; i++) {
+      bson_snprintf (str, sizeof str, "document number %d", i);
+
+      if (i % 2) {
+         b = BCON_NEW ("i", BCON_INT32 (i), "s", BCON_UTF8 (str));
+         assert (bson_compressed_writer_write (writer, b, &error));
+         len += b->len;
+         bson_destroy (b);
+         continue;
+      }
+
+      assert (bson_compressed_writer_begin (writer, &b));
+      assert (BSON_APPEND_INT32 (b, "i", i));
+      assert (BSON_APPEND_UTF8 (b, "s", str));
+
+      if (i % 10 == 0) {
+         bson_compressed_writer_rollback (writer, b);
+      } else {
+         len += b->len;
+         assert (bson_compressed_writer_end (writer, b, &error));
+      }
+   }
+
+   assert (bson_compressed_writer_close (writer, &error));
+   bson_compressed_writer_destroy (writer);
+
+   return len;
+}
+
+
+static void
+read_docs (const char *path,
+           uint32_t    n_threads,
+           size_t      len)
+{
+   bson_reader_t *reader;
+   bson_error_t error;
+   const bson_t *doc;
+   bson_iter_t iter;
+   bool eof = false;
+   char str[32];
+   int i = 0;
+
+   reader = bson_reader_new_from_compressed_file (path, n_threads, &error);
+   assert (reader);
+
+   while ((doc = bson_reader_read (reader, &eof))) {
+      if (i % 10 == 0) {
+         i++;
+      }
+
+      bson_snprintf (str, sizeof str, "document number %d", i);
+      assert (bson_iter_init_find (&iter, doc, "i"));
+      assert (bson_iter_int32 (&iter) == i);
+      assert (bson_iter_init_find (&iter, doc, "s"));
+      assert_cmpstr (bson_iter_utf8 (&iter, NULL), str);
+      i++;
+   }
+
+   assert (eof);
+   assert (i == N_DOCS);
+   assert (bson_reader_tell (reader) == (off_t)len);
+   bson_reader_destroy (reader);
+}
+
+
+static void
+test_compression_roundtrip (void)
+{
+   const char *path = "test-compression.bsonz";
+   struct stat st;
+   size_t len;
+   size_t i;
+
+   for (i = 0; i < sizeof gCompressors / sizeof gCompressors[0]; i++) {
+      if (!bson_compressor_is_supported (gCompressors[i])) {
+         continue;
+      }
+
+      len = write_docs (path, gCompressors[i], 0, 4096);
+      read_docs (path, 0, len);
+      read_docs (path, 2, len);
+
+      assert (stat (path, &st) == 0);
+
+      if (gCompressors[i] != BSON_COMPRESSOR_NONE) {
+         assert ((size_t)st.st_size < len / 2);
+      }
+
+      len = write_docs (path, gCompressors[i], 3, 1000);
+      read_docs (path, 0, len);
+      read_docs (path, 5, len);
+
+      /* the default block size holds every document */
+      len = write_docs (path, gCompressors[i], 2, BSON_COMPRESSED_BLOCK_SIZE);
+      read_docs (path, 2, len);
+   }
+
+   unlink (path);
+}
+
+
+static void
+test_compression_large_document (void)
+{
+   const char *path = "test-compression-large.bsonz";
+   bson_compressed_writer_t *writer;
+   bson_reader_t *reader;
+   bson_error_t error;
+   const bson_t *doc;
+   char *str;
+   bson_t *b;
+   bool eof;
+
+   str = bson_malloc (100000);
+   memset (str, 'x', 99999);
+   str[99999] = '\0';
+
+   writer = bson_compressed_writer_new_from_file (path, BSON_COMPRESSOR_NONE,
+                                                  2, &error);
+   assert (writer);
+   bson_compressed_writer_set_block_size (writer, 1024);
+
+   /* a document larger than a block gets a block of its own */
+   b = BCON_NEW ("a", BCON_INT32 (1));
+   assert (bson_compressed_writer_write (writer, b, &error));
+   bson_destroy (b);
+
+   assert (bson_compressed_writer_begin (writer, &b));
+   assert (BSON_APPEND_UTF8 (b, "s", str));
+   assert (bson_compressed_writer_end (writer, b, &error));
+
+   b = BCON_NEW ("b", BCON_INT32 (2));
+   assert (bson_compressed_writer_write (writer, b, &error));
+   bson_destroy (b);
+   bson_compressed_writer_destroy (writer);
+
+   reader = bson_reader_new_from_compressed_file (path, 1, &error);
+   assert (reader);
+   doc = bson_reader_read (reader, NULL);
+   assert (doc && bson_has_field (doc, "a"));
+   doc = bson_reader_read (reader, NULL);
+   assert (doc && doc->len > 100000);
+   doc = bson_reader_read (reader, NULL);
+   assert (doc && bson_has_field (doc, "b"));
+   assert (!bson_reader_read (reader, &eof));
+   assert (eof);
+   bson_reader_destroy (reader);
+
+   bson_free (str);
+   unlink (path);
+}
+
+
+static void
+test_compression_empty (void)
+{
+   const char *path = "test-compression-empty.bsonz";
+   bson_compressed_writer_t *writer;
+   bson_reader_t *reader;
+   bson_error_t error;
+   bool eof = false;
+
+   writer = bson_compressed_writer_new_from_file (path, BSON_COMPRESSOR_NONE,
+                                                  0, &error);
+   assert (writer);
+   assert (bson_compressed_writer_close (writer, &error));
+   assert (bson_compressed_writer_close (writer, &error));
+   bson_compressed_writer_destroy (writer);
+
+   reader = bson_reader_new_from_compressed_file (path, 4, &error);
+   assert (reader);
+   assert (!bson_reader_read (reader, &eof));
+   assert (eof);
+   bson_reader_destroy (reader);
+
+   unlink (path);
+}
+
+
+static void
+test_compression_errors (void)
+{
+   const char *path = "test-compression-errors.bsonz";
+   bson_compressed_writer_t *writer;
+   bson_reader_t *reader;
+   bson_error_t error;
+   struct stat st;
+   const uint8_t huge[4] = { 0xff, 0xff, 0xff, 0xff };
+   bool eof = true;
+   uint32_t packed_len;
+   off_t offset;
+   int n = 0;
+   int fd;
+
+   assert (bson_compressor_is_supported (BSON_COMPRESSOR_NONE));
+   assert (!bson_compressor_is_supported ((bson_compressor_t)99));
+
+   writer = bson_compressed_writer_new_from_file (
+      path, (bson_compressor_t)99, 0, &error);
+   assert (!writer);
+   ASSERT_ERROR_CONTAINS (error, BSON_ERROR_COMPRESSION,
+                          BSON_ERROR_COMPRESSION_UNSUPPORTED,
+                          "not supported");
+
+   reader = bson_reader_new_from_compressed_file (
+      "test-compression-missing.bsonz", 0, &error);
+   assert (!reader);
+   ASSERT_ERROR_CONTAINS (error, BSON_ERROR_COMPRESSION,
+                          BSON_ERROR_COMPRESSION_IO, "Failed to open");
+
+   reader = bson_reader_new_from_compressed_file (
+      BINARY_DIR"/stream.bson", 0, &error);
+   assert (!reader);
+   ASSERT_ERROR_CONTAINS (error, BSON_ERROR_COMPRESSION,
+                          BSON_ERROR_COMPRESSION_CORRUPT,
+                          "Not a compressed BSON stream");
+
+#ifndef _WIN32
+   /* a truncated stream yields the documents of its whole blocks */
+   write_docs (path, BSON_COMPRESSOR_NONE, 0, 4096);
+   assert (stat (path, &st) == 0);
+   assert (truncate (path, st.st_size - 10) == 0);
+
+   reader = bson_reader_new_from_compressed_file (path, 2, &error);
+   assert (reader);
+
+   while (bson_reader_read (reader, &eof)) {
+      n++;
+   }
+
+   assert (!eof);
+   assert (n > 0 && n < N_DOCS);
+   bson_reader_destroy (reader);
+
+   /* a block claiming more than the largest block size is corrupt, here
+    * the second one, following the stored first block */
+   write_docs (path, BSON_COMPRESSOR_NONE, 0, 4096);
+   fd = open (path, O_RDWR);
+   assert (fd != -1);
+   assert (lseek (fd, 12, SEEK_SET) == 12);
+   assert (read (fd, &packed_len, sizeof packed_len) == sizeof packed_len);
+   offset = 8 + 12 + BSON_UINT32_FROM_LE (packed_len) + 8;
+   assert (lseek (fd, offset, SEEK_SET) == offset);
+   assert (write (fd, huge, sizeof huge) == (ssize_t)sizeof huge);
+   close (fd);
+
+   reader = bson_reader_new_from_compressed_file (path, 2, &error);
+   assert (reader);
+   n = 0;
+
+   while (bson_reader_read (reader, &eof)) {
+      n++;
+   }
+
+   assert (!eof);
+   assert (n > 0 && n < N_DOCS);
+   bson_reader_destroy (reader);
+
+   unlink (path);
+#endif
+}
+
+
+#ifndef _WIN32
+typedef struct
+{
+   int      fd;
+   uint8_t *data;
+   size_t   len;
+   size_t   alloc;
+} pipe_data_t;
+
+
+/* reads a pipe slowly, so that its writer keeps finding it full */
+static void *
+drain_worker (void *data)
+{
+   pipe_data_t *pd = data;
+   ssize_t r;
+
+   for (;;) {
+      if (pd->alloc - pd->len < 4096) {
+         pd->alloc = pd->alloc * 2 + 4096;
+         pd->data = bson_realloc (pd->data, pd->alloc);
+      }
+
+      r = read (pd->fd, pd->data + pd->len, 4096);
+
+      if (r == 0) {
+         break;
+      }
+
+      if (r > 0) {
+         pd->len += (size_t)r;
+         usleep (100);
+      }
+   }
+
+   return NULL;
+}
+
+
+/* writes a pipe slowly, so that its reader keeps finding it empty */
+static void *
+trickle_worker (void *data)
+{
+   pipe_data_t *pd = data;
+   size_t off;
+   size_t n;
+
+   for (off = 0; off < pd->len; off += n) {
+      n = BSON_MIN (pd->len - off, 1000);
+      assert (write (pd->fd, pd->data + off, n) == (ssize_t)n);
+      usleep (100);
+   }
+
+   close (pd->fd);
+
+   return NULL;
+}
+
+
+static void
+test_compression_nonblocking (void)
+{
+   bson_compressed_writer_t *writer;
+   bson_reader_t *reader;
+   bson_thread_t thread;
+   bson_error_t error;
+   pipe_data_t pd = { 0 };
+   const bson_t *doc;
+   bson_iter_t iter;
+   bool eof = false;
+   bson_t *b;
+   int fds[2];
+   int i;
+
+   /* a writer that finds a non-blocking pipe full waits for it */
+   assert (pipe (fds) == 0);
+   assert (fcntl (fds[1], F_SETFL, O_NONBLOCK) == 0);
+   pd.fd = fds[0];
+   bson_thread_create (&thread, drain_worker, &pd);
+
+   writer = bson_compressed_writer_new (fds[1], true, BSON_COMPRESSOR_NONE,
+                                        2, &error);
+   assert (writer);
+
+   for (i = 0; i < N_DOCS; i++) {
+      b = BCON_NEW ("i", BCON_INT32 (i), "s", BCON_UTF8 ("document"));
+      assert (bson_compressed_writer_write (writer, b, &error));
+      bson_destroy (b);
+   }
+
+   assert (bson_compressed_writer_close (writer, &error));
+   bson_compressed_writer_destroy (writer);
+
+   bson_thread_join (thread);
+   close (fds[0]);
+
+   /* a reader that finds a non-blocking pipe empty waits for it */
+   assert (pipe (fds) == 0);
+   assert (fcntl (fds[0], F_SETFL, O_NONBLOCK) == 0);
+   pd.fd = fds[1];
+   bson_thread_create (&thread, trickle_worker, &pd);
+
+   reader = bson_reader_new_from_compressed_fd (fds[0], true, 2, &error);
+   assert (reader);
+   i = 0;
+
+   while ((doc = bson_reader_read (reader, &eof))) {
+      assert (bson_iter_init_find (&iter, doc, "i"));
+      assert (bson_iter_int32 (&iter) == i);
+      i++;
+   }
+
+   assert (eof);
+   assert (i == N_DOCS);
+   bson_reader_destroy (reader);
+
+   bson_thread_join (thread);
+   bson_free (pd.data);
+}
+#endif
+
+
+void
+test_compression_install (TestSuite *suite)
+{
+   TestSuite_Add (suite, "/bson/compression/roundtrip",
+                  test_compression_roundtrip);
+   TestSuite_Add (suite, "/bson/compression/large_document",
+                  test_compression_large_document);
+   TestSuite_Add (suite, "/bson/compression/empty", test_compression_empty);
+   TestSuite_Add (suite, "/bson/compression/errors",
+                  test_compression_errors);
+#ifndef _WIN32
+   TestSuite_Add (suite, "/bson/compression/nonblocking",
+                  test_compression_nonblocking);
+#endif
+}
@@ -0,0 +1,241 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <assert.h>
+#include <fcntl.h>
+
+#include "bson-tests.h"
+#include "TestSuite.h"
+
+
+#ifndef BINARY_DIR
+# define BINARY_DIR "tests/binary"
+#endif
+
+
+static void
+write_dump (const char *path,
+            int         n_docs)
+{
+   bson_t doc;
+   ssize_t r;
+   char str[16];
+   int fd;
+   int i;
+
+   fd = bson_open (path, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+   assert (-1 != fd);
+
+   for (i = 0; i < n_docs; i++) {
+      bson_init (&doc);
+
+      /* every third document has no _id; _ids are written out of order */
+      if (i % 3 != 2) {
+         BSON_APPEND_INT32 (&doc, "_id", (i * 7919) % n_docs);
+      }
+
+      bson_snprintf (str, sizeof str, "%d", i);
+      BSON_APPEND_UTF8 (&doc, "n", str);
+
+      r = write (fd, bson_get_data (&doc), doc.len);
+      assert (r == (ssize_t)doc.len);
+
+      bson_destroy (&doc);
+   }
+
+   close (fd);
+}
+
+
+static void
+test_index_build (void)
+{
+   bson_index_t *index;
+   bson_error_t error;
+   bson_value_t id;
+   bson_iter_t iter;
+   bson_t doc;
+   char str[16];
+   int i;
+
+   write_dump ("test-index.bson", 1000);
+
+   assert (bson_index_build ("test-index.bson", "test-index.bson.idx", &error));
+
+   index = bson_index_new ("test-index.bson", "test-index.bson.idx", &error);
+   assert (index);
+   assert_cmpint (bson_index_get_count (index), ==, 1000);
+
+   for (i = 0; i < 1000; i++) {
+      assert (bson_index_get (index, i, &doc));
+      assert (bson_iter_init_find (&iter, &doc, "n"));
+      bson_snprintf (str, sizeof str, "%d", i);
+      assert_cmpstr (bson_iter_utf8 (&iter, NULL), str);
+   }
+
+   assert (!bson_index_get (index, 1000, &doc));
+
+   id.value_type = BSON_TYPE_INT32;
+
+   for (i = 0; i < 1000; i++) {
+      id.value.v_int32 = (i * 7919) % 1000;
+
+      if (i % 3 == 2) {
+         continue;
+      }
+
+      assert (bson_index_find_id (index, &id, &doc));
+      assert (bson_iter_init_find (&iter, &doc, "n"));
+      bson_snprintf (str, sizeof str, "%d", i);
+      assert_cmpstr (bson_iter_utf8 (&iter, NULL), str);
+   }
+
+   /* type must match as well as value */
+   id.value_type = BSON_TYPE_INT64;
+   id.value.v_int64 = 0;
+   assert (!bson_index_find_id (index, &id, &doc));
+
+   id.value_type = BSON_TYPE_INT32;
+   id.value.v_int32 = 1000;
+   assert (!bson_index_find_id (index, &id, &doc));
+
+   bson_index_destroy (index);
+
+   unlink ("test-index.bson");
+   unlink ("test-index.bson.idx");
+}
+
+
+static void
+test_index_stream (void)
+{
+   bson_index_t *index;
+   bson_error_t error;
+   bson_value_t id;
+   bson_t doc;
+
+   assert (bson_index_build (BINARY_DIR"/stream.bson", "test-stream.bson.idx",
+                             &error));
+
+   index = bson_index_new (BINARY_DIR"/stream.bson", "test-stream.bson.idx",
+                           &error);
+   assert (index);
+   assert_cmpint (bson_index_get_count (index), ==, 1000);
+   assert (bson_index_get (index, 999, &doc));
+   assert_cmpint (doc.len, ==, 5);
+
+   id.value_type = BSON_TYPE_NULL;
+   assert (!bson_index_find_id (index, &id, &doc));
+
+   bson_index_destroy (index);
+
+   unlink ("test-stream.bson.idx");
+}
+
+
+static void
+test_index_errors (void)
+{
+   bson_index_t *index;
+   bson_error_t error;
+
+   assert (!bson_index_build (BINARY_DIR"/stream_corrupt.bson",
+                              "test-corrupt.bson.idx", &error));
+   assert_cmpint (error.domain, ==, BSON_ERROR_INDEX);
+   assert_cmpint (error.code, ==, BSON_ERROR_INDEX_CORRUPT);
+
+   /* an index built for a different file is rejected */
+   write_dump ("test-index-stale.bson", 10);
+   assert (bson_index_build ("test-index-stale.bson",
+                             "test-index-stale.bson.idx", &error));
+   write_dump ("test-index-stale.bson", 20);
+
+   index = bson_index_new ("test-index-stale.bson",
+                           "test-index-stale.bson.idx", &error);
+   assert (!index);
+   assert_cmpint (error.domain, ==, BSON_ERROR_INDEX);
+   assert_cmpint (error.code, ==, BSON_ERROR_INDEX_STALE);
+
+   /* the data file is not an index */
+   index = bson_index_new ("test-index-stale.bson",
+                           "test-index-stale.bson", &error);
+   assert (!index);
+   assert_cmpint (error.code, ==, BSON_ERROR_INDEX_CORRUPT);
+
+   index = bson_index_new ("test-index-stale.bson",
+                           "does-not-exist.idx", &error);
+   assert (!index);
+   assert_cmpint (error.code, ==, BSON_ERROR_INDEX_IO);
+
+   unlink ("test-index-stale.bson");
+   unlink ("test-index-stale.bson.idx");
+}
+
+
+static void
+test_index_null_id (void)
+{
+   bson_index_t *index;
+   bson_error_t error;
+   bson_value_t id;
+   bson_iter_t iter;
+   bson_t *docs[2];
+   bson_t doc;
+   ssize_t r;
+   int fd;
+   int i;
+
+   docs[0] = BCON_NEW ("_id", BCON_INT32 (1), "n", BCON_UTF8 ("a"));
+   docs[1] = BCON_NEW ("_id", BCON_NULL, "n", BCON_UTF8 ("b"));
+
+   fd = bson_open ("test-index-null.bson", O_WRONLY | O_CREAT | O_TRUNC, 0640);
+   assert (-1 != fd);
+
+   for (i = 0; i < 2; i++) {
+      r = write (fd, bson_get_data (docs[i]), docs[i]->len);
+      assert (r == (ssize_t)docs[i]->len);
+      bson_destroy (docs[i]);
+   }
+
+   close (fd);
+
+   assert (bson_index_build ("test-index-null.bson",
+                             "test-index-null.bson.idx", &error));
+   index = bson_index_new ("test-index-null.bson",
+                           "test-index-null.bson.idx", &error);
+   assert (index);
+
+   id.value_type = BSON_TYPE_NULL;
+   assert (bson_index_find_id (index, &id, &doc));
+   assert (bson_iter_init_find (&iter, &doc, "n"));
+   assert_cmpstr (bson_iter_utf8 (&iter, NULL), "b");
+
+   bson_index_destroy (index);
+
+   unlink ("test-index-null.bson");
+   unlink ("test-index-null.bson.idx");
+}
+
+
+void
+test_index_install (TestSuite *suite)
+{
+   TestSuite_Add (suite, "/bson/index/build", test_index_build);
+   TestSuite_Add (suite, "/bson/index/stream", test_index_stream);
+   TestSuite_Add (suite, "/bson/index/errors", test_index_errors);
+   TestSuite_Add (suite, "/bson/index/null_id", test_index_null_id);
+}
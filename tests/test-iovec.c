@@ -0,0 +1,258 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <assert.h>
+#include <fcntl.h>
+
+#include "bson-tests.h"
+#include "TestSuite.h"
+
+
+#ifndef BINARY_DIR
+# define BINARY_DIR "tests/binary"
+#endif
+
+
+static bson_t *
+make_big (int n)
+{
+   bson_t *doc;
+   char key[16];
+   int i;
+
+   doc = bson_new ();
+   for (i = 0; i < n; i++) {
+      bson_snprintf (key, sizeof key, "%d", i);
+      BSON_APPEND_UTF8 (doc, key, "a value long enough to be borrowed");
+   }
+
+   return doc;
+}
+
+
+static void
+build (bson_iovec_builder_t *builder,
+       bson_t               *expected,
+       const bson_t         *big,
+       const bson_t         *small)
+{
+   bson_value_t value;
+   bson_iter_t iter;
+   bson_t child;
+   bson_t empty = BSON_INITIALIZER;
+
+   value.value_type = BSON_TYPE_INT32;
+   value.value.v_int32 = 42;
+
+   assert (bson_iovec_builder_append_value (builder, "n", -1, &value));
+   assert (bson_append_value (expected, "n", -1, &value));
+
+   assert (bson_iovec_builder_append_document (builder, "big", -1, big));
+   assert (bson_append_document (expected, "big", -1, big));
+
+   assert (bson_iovec_builder_append_document (builder, "small", -1, small));
+   assert (bson_append_document (expected, "small", -1, small));
+
+   assert (bson_iovec_builder_begin_document (builder, "nested", -1));
+   assert (bson_append_document_begin (expected, "nested", -1, &child));
+   assert (bson_iovec_builder_append_array (builder, "arr", -1, big));
+   assert (bson_append_array (&child, "arr", -1, big));
+   assert (bson_iovec_builder_begin_array (builder, "empty", -1));
+   assert (bson_iovec_builder_end_array (builder));
+   assert (bson_append_array (&child, "empty", -1, &empty));
+   assert (bson_iovec_builder_concat (builder, small));
+   assert (bson_concat (&child, small));
+   assert (bson_iovec_builder_end_document (builder));
+   assert (bson_append_document_end (expected, &child));
+
+   assert (bson_iter_init_find (&iter, small, "nothing"));
+   assert (bson_iovec_builder_append_iter (builder, NULL, 0, &iter));
+   assert (bson_append_iter (expected, NULL, 0, &iter));
+
+   assert (bson_iter_init_find (&iter, big, "3"));
+   assert (bson_iovec_builder_append_iter (builder, NULL, 0, &iter));
+   assert (bson_append_iter (expected, NULL, 0, &iter));
+   assert (bson_iovec_builder_append_iter (builder, "renamed", -1, &iter));
+   assert (bson_append_iter (expected, "renamed", -1, &iter));
+
+   assert (bson_iovec_builder_concat (builder, big));
+   assert (bson_concat (expected, big));
+}
+
+
+static void
+test_iovec_flatten (void)
+{
+   bson_iovec_builder_t *builder;
+   bson_t expected = BSON_INITIALIZER;
+   bson_t *big;
+   bson_t *small;
+   bson_t dst;
+
+   big = make_big (20);
+   small = BCON_NEW ("x", BCON_INT32 (1), "nothing", BCON_NULL);
+   builder = bson_iovec_builder_new ();
+
+   build (builder, &expected, big, small);
+
+   assert (bson_iovec_builder_flatten (builder, &dst));
+   assert (bson_validate (&dst, BSON_VALIDATE_NONE, NULL));
+   assert_cmpint (dst.len, ==, expected.len);
+   assert (bson_equal (&dst, &expected));
+
+   /* the builder is finished */
+   assert (!bson_iovec_builder_concat (builder, small));
+   assert (!bson_iovec_builder_begin_document (builder, "x", -1));
+
+   bson_destroy (&dst);
+   bson_iovec_builder_destroy (builder);
+   bson_destroy (&expected);
+   bson_destroy (small);
+   bson_destroy (big);
+}
+
+
+static void
+test_iovec_borrowed (void)
+{
+   bson_iovec_builder_t *builder;
+   const bson_iovec_t *iov;
+   const uint8_t *big_data;
+   bson_t *big;
+   bson_t *small;
+   uint32_t length;
+   size_t n_iovecs;
+   size_t total = 0;
+   size_t i;
+   bool found_big = false;
+
+   big = make_big (20);
+   small = BCON_NEW ("x", BCON_INT32 (1));
+   big_data = bson_get_data (big);
+   builder = bson_iovec_builder_new ();
+
+   assert (bson_iovec_builder_append_document (builder, "a", -1, big));
+   assert (bson_iovec_builder_append_document (builder, "b", -1, small));
+   assert (bson_iovec_builder_append_document (builder, "c", -1, small));
+
+   iov = bson_iovec_builder_get_iovecs (builder, &n_iovecs, &length);
+   assert (iov);
+
+   for (i = 0; i < n_iovecs; i++) {
+      if (iov[i].iov_base == (void *)big_data) {
+         assert_cmpint (iov[i].iov_len, ==, big->len);
+         found_big = true;
+      }
+      total += iov[i].iov_len;
+   }
+
+   /* large documents are referenced, small ones coalesced with headers */
+   assert (found_big);
+   assert_cmpint (n_iovecs, ==, 3);
+   assert_cmpint (total, ==, length);
+   assert_cmpint (length, ==, 4 + (3 + big->len) + 2 * (3 + small->len) + 1);
+
+   bson_iovec_builder_destroy (builder);
+   bson_destroy (small);
+   bson_destroy (big);
+}
+
+
+static void
+test_iovec_unbalanced (void)
+{
+   bson_iovec_builder_t *builder;
+   size_t n_iovecs;
+   bson_t dst;
+
+   builder = bson_iovec_builder_new ();
+   assert (!bson_iovec_builder_end_document (builder));
+   assert (bson_iovec_builder_begin_document (builder, "a", -1));
+   assert (!bson_iovec_builder_get_iovecs (builder, &n_iovecs, NULL));
+   assert (!bson_iovec_builder_flatten (builder, &dst));
+   assert (bson_empty (&dst));
+   bson_destroy (&dst);
+
+   assert (bson_iovec_builder_end_document (builder));
+   assert (bson_iovec_builder_flatten (builder, &dst));
+   assert_cmpint (dst.len, ==, 13);
+   bson_destroy (&dst);
+
+   bson_iovec_builder_destroy (builder);
+
+   builder = bson_iovec_builder_new ();
+   assert (bson_iovec_builder_get_iovecs (builder, &n_iovecs, NULL));
+   assert_cmpint (n_iovecs, ==, 1);
+   bson_iovec_builder_destroy (builder);
+}
+
+
+static void
+test_iovec_write_fd (void)
+{
+   bson_iovec_builder_t *builder;
+   bson_t expected = BSON_INITIALIZER;
+   bson_reader_t *reader;
+   const bson_t *doc;
+   bson_error_t error;
+   bson_t *big;
+   bson_t *small;
+   bool eof;
+   int fd;
+   int i;
+
+   big = make_big (20);
+   small = BCON_NEW ("x", BCON_INT32 (1));
+   builder = bson_iovec_builder_new ();
+
+   /* more segments than one writev() call accepts on most systems */
+   for (i = 0; i < 1500; i++) {
+      assert (bson_iovec_builder_append_document (builder, "big", -1, big));
+      assert (bson_append_document (&expected, "big", -1, big));
+   }
+
+   fd = bson_open ("test-iovec.bson", O_WRONLY | O_CREAT | O_TRUNC, 0640);
+   assert (fd != -1);
+   assert (bson_iovec_builder_write_fd (builder, fd, &error));
+   bson_close (fd);
+
+   reader = bson_reader_new_from_file ("test-iovec.bson", &error);
+   assert (reader);
+   doc = bson_reader_read (reader, &eof);
+   assert (doc);
+   assert (bson_equal (doc, &expected));
+   assert (!bson_reader_read (reader, &eof));
+   assert (eof);
+   bson_reader_destroy (reader);
+
+   unlink ("test-iovec.bson");
+
+   bson_iovec_builder_destroy (builder);
+   bson_destroy (&expected);
+   bson_destroy (small);
+   bson_destroy (big);
+}
+
+
+void
+test_iovec_install (TestSuite *suite)
+{
+   TestSuite_Add (suite, "/bson/iovec/flatten", test_iovec_flatten);
+   TestSuite_Add (suite, "/bson/iovec/borrowed", test_iovec_borrowed);
+   TestSuite_Add (suite, "/bson/iovec/unbalanced", test_iovec_unbalanced);
+   TestSuite_Add (suite, "/bson/iovec/write_fd", test_iovec_write_fd);
+}
@@ -580,6 +580,27 @@ test_bson_iter_as_bool (void)
 }
 
 
+static void
+test_bson_iter_init_from_data (void)
+{
+   bson_iter_t iter;
+   bson_t *bson;
+
+   bson = BCON_NEW ("a", BCON_INT32 (1));
+
+   assert (bson_iter_init_from_data (&iter, bson_get_data (bson), bson->len));
+   assert (bson_iter_next (&iter));
+   assert_cmpstr (bson_iter_key (&iter), "a");
+   assert (!bson_iter_next (&iter));
+
+   assert (!bson_iter_init_from_data (&iter, bson_get_data (bson), 4));
+   assert (!bson_iter_init_from_data (&iter, bson_get_data (bson),
+                                      bson->len + 1));
+
+   bson_destroy (bson);
+}
+
+
 void
 test_iter_install (TestSuite *suite)
 {
@@ -604,4 +625,5 @@ test_iter_install (TestSuite *suite)
    TestSuite_Add (suite, "/bson/iter/find_descendant", test_bson_iter_find_descendant);
    TestSuite_Add (suite, "/bson/iter/as_bool", test_bson_iter_as_bool);
    TestSuite_Add (suite, "/bson/iter/binary_deprecated", test_bson_iter_binary_deprecated);
+   TestSuite_Add (suite, "/bson/iter/init_from_data", test_bson_iter_init_from_data);
 }
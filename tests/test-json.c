@@ -3,6 +3,9 @@
 #include <assert.h>
 #include <fcntl.h>
 #include <stdio.h>
+#ifndef _WIN32
+# include <unistd.h>
+#endif
 
 #include "bson-tests.h"
 #include "TestSuite.h"
@@ -942,6 +945,137 @@ test_bson_as_json_spacing (void)
    bson_destroy (&d);
 }
 
+
+static void
+test_json_reader_nonblocking_ingest (void)
+{
+   const char *chunks[] = { "{\"a\": 1", ", \"b\": [1, 2]} {\"c\"", ": true}" };
+   bson_json_reader_t *reader;
+   bson_error_t error;
+   bson_t *compare;
+   bson_t b;
+
+   reader = bson_json_data_reader_new (true, 0);
+   bson_json_reader_set_nonblocking (reader, true);
+
+   bson_init (&b);
+   assert_cmpint (bson_json_reader_read (reader, &b, &error), ==, 0);
+   assert (bson_json_reader_would_block (reader));
+
+   /* the first document is resumed with the same bson_t */
+   bson_json_data_reader_ingest (reader, (const uint8_t *)chunks[0],
+                                 strlen (chunks[0]));
+   assert_cmpint (bson_json_reader_read (reader, &b, &error), ==, 0);
+   assert (bson_json_reader_would_block (reader));
+
+   bson_json_data_reader_ingest (reader, (const uint8_t *)chunks[1],
+                                 strlen (chunks[1]));
+   assert_cmpint (bson_json_reader_read (reader, &b, &error), ==, 1);
+   assert (!bson_json_reader_would_block (reader));
+   compare = BCON_NEW ("a", BCON_INT32 (1),
+                       "b", "[", BCON_INT32 (1), BCON_INT32 (2), "]");
+   bson_eq_bson (&b, compare);
+   bson_destroy (compare);
+   bson_destroy (&b);
+
+   /* the rest of the chunk begins the second */
+   bson_init (&b);
+   assert_cmpint (bson_json_reader_read (reader, &b, &error), ==, 0);
+   assert (bson_json_reader_would_block (reader));
+
+   bson_json_data_reader_ingest (reader, (const uint8_t *)chunks[2],
+                                 strlen (chunks[2]));
+   assert_cmpint (bson_json_reader_read (reader, &b, &error), ==, 1);
+   compare = BCON_NEW ("c", BCON_BOOL (true));
+   bson_eq_bson (&b, compare);
+   bson_destroy (compare);
+   bson_destroy (&b);
+
+   /* ingesting nothing ends the stream */
+   bson_init (&b);
+   assert_cmpint (bson_json_reader_read (reader, &b, &error), ==, 0);
+   assert (bson_json_reader_would_block (reader));
+   bson_json_data_reader_ingest (reader, (const uint8_t *)"", 0);
+   assert_cmpint (bson_json_reader_read (reader, &b, &error), ==, 0);
+   assert (!bson_json_reader_would_block (reader));
+   bson_destroy (&b);
+
+   bson_json_reader_destroy (reader);
+}
+
+
+static void
+test_json_reader_nonblocking_truncated (void)
+{
+   const char *json = "{\"a\": [1, ";
+   bson_json_reader_t *reader;
+   bson_error_t error;
+   bson_t b;
+
+   reader = bson_json_data_reader_new (true, 0);
+   bson_json_reader_set_nonblocking (reader, true);
+   bson_init (&b);
+
+   bson_json_data_reader_ingest (reader, (const uint8_t *)json,
+                                 strlen (json));
+   assert_cmpint (bson_json_reader_read (reader, &b, &error), ==, 0);
+   assert (bson_json_reader_would_block (reader));
+
+   /* the stream ends inside the document */
+   bson_json_data_reader_ingest (reader, (const uint8_t *)"", 0);
+   assert_cmpint (bson_json_reader_read (reader, &b, &error), ==, -1);
+   assert (!bson_json_reader_would_block (reader));
+   assert_cmpint (error.domain, ==, BSON_ERROR_JSON);
+   assert_cmpint (error.code, ==, BSON_JSON_ERROR_READ_CORRUPT_JS);
+
+   bson_destroy (&b);
+   bson_json_reader_destroy (reader);
+}
+
+
+#ifndef _WIN32
+static void
+test_json_reader_nonblocking_fd (void)
+{
+   const char *json = "{\"hello\": \"world\"}";
+   bson_json_reader_t *reader;
+   bson_error_t error;
+   bson_t *compare;
+   bson_t b;
+   int fds[2];
+
+   assert (pipe (fds) == 0);
+   assert (fcntl (fds[0], F_SETFL, O_NONBLOCK) == 0);
+
+   reader = bson_json_reader_new_from_fd (fds[0], true);
+   bson_json_reader_set_nonblocking (reader, true);
+   bson_init (&b);
+
+   assert_cmpint (bson_json_reader_read (reader, &b, &error), ==, 0);
+   assert (bson_json_reader_would_block (reader));
+
+   assert (write (fds[1], json, 10) == 10);
+   assert_cmpint (bson_json_reader_read (reader, &b, &error), ==, 0);
+   assert (bson_json_reader_would_block (reader));
+
+   assert (write (fds[1], json + 10, strlen (json) - 10) ==
+           (ssize_t)(strlen (json) - 10));
+   assert_cmpint (bson_json_reader_read (reader, &b, &error), ==, 1);
+   compare = BCON_NEW ("hello", BCON_UTF8 ("world"));
+   bson_eq_bson (&b, compare);
+   bson_destroy (compare);
+   bson_destroy (&b);
+
+   close (fds[1]);
+   bson_init (&b);
+   assert_cmpint (bson_json_reader_read (reader, &b, &error), ==, 0);
+   assert (!bson_json_reader_would_block (reader));
+   bson_destroy (&b);
+
+   bson_json_reader_destroy (reader);
+}
+#endif
+
 void
 test_json_install (TestSuite *suite)
 {
@@ -976,6 +1110,11 @@ test_json_install (TestSuite *suite)
    TestSuite_Add (suite, "/bson/json/read/$numberLong", test_bson_json_number_long);
    TestSuite_Add (suite, "/bson/json/read/$numberLong/zero", test_bson_json_number_long_zero);
    TestSuite_Add (suite, "/bson/json/read/dbref", test_bson_json_dbref);
+   TestSuite_Add (suite, "/bson/json/read/nonblocking_ingest", test_json_reader_nonblocking_ingest);
+   TestSuite_Add (suite, "/bson/json/read/nonblocking_truncated", test_json_reader_nonblocking_truncated);
+#ifndef _WIN32
+   TestSuite_Add (suite, "/bson/json/read/nonblocking_fd", test_json_reader_nonblocking_fd);
+#endif
 #ifdef BSON_EXPERIMENTAL_FEATURES
    TestSuite_Add (suite, "/bson/as_json/decimal128", test_bson_as_json_decimal128);
    TestSuite_Add (suite, "/bson/json/read/$numberDecimal", test_bson_json_number_decimal);
@@ -0,0 +1,745 @@
+/*
+ * Copyright 2016 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <assert.h>
+#include <bcon.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#define BSON_INSIDE
+#include "bson-thread-private.h"
+#undef BSON_INSIDE
+
+#include "bson-tests.h"
+#include "TestSuite.h"
+
+
+#define N_DOCS 5000
+
+
+/* documents of about 1KB, so N_DOCS of them span several chunks */
+static uint8_t *
+make_stream (int     n_docs,
+             size_t *len)
+{
+   bson_writer_t *writer;
+   uint8_t *buf = NULL;
+   char str[1024];
+   bson_t *b;
+   int i;
+
+   *len = 0;
+   writer = bson_writer_new (&buf, len, 0, bson_realloc_ctx, NULL);
+
+   for (i = 0; i < n_docs; i++) {
+      memset (str, 'a' + i % 26, sizeof str - 1);
+      str[(i * 7) % (sizeof str - 1)] = '\0';
+
+      assert (bson_writer_begin (writer, &b));
+      BSON_APPEND_INT32 (b, "i", i);
+      BSON_APPEND_UTF8 (b, "s", str);
+      BCON_APPEND (b, "sub", "{", "q", "\"quoted\"", "d", BCON_DOUBLE (i), "}");
+      bson_writer_end (writer);
+   }
+
+   *len = bson_writer_get_length (writer);
+   bson_writer_destroy (writer);
+
+   return buf;
+}
+
+
+/* what bson-to-json.c would print for the documents in @buf */
+static char *
+expected_jsonl (const uint8_t *buf,
+                size_t         len,
+                int            n_docs)
+{
+   bson_reader_t *reader;
+   bson_string_t *str;
+   const bson_t *b;
+   char *json;
+   int i;
+
+   str = bson_string_new (NULL);
+   reader = bson_reader_new_from_data (buf, len);
+
+   for (i = 0; i < n_docs && (b = bson_reader_read (reader, NULL)); i++) {
+      json = bson_as_json (b, NULL);
+      bson_string_append (str, json);
+      bson_string_append_c (str, '\n');
+      bson_free (json);
+   }
+
+   bson_reader_destroy (reader);
+
+   return bson_string_free (str, false);
+}
+
+
+static char *
+read_file (const char *path)
+{
+   struct stat st;
+   char *buf;
+   int fd;
+
+   assert (stat (path, &st) == 0);
+   buf = bson_malloc ((size_t)st.st_size + 1);
+   fd = open (path, O_RDONLY);
+   assert (fd != -1);
+   assert (read (fd, buf, (size_t)st.st_size) == (ssize_t)st.st_size);
+   buf[st.st_size] = '\0';
+   close (fd);
+
+   return buf;
+}
+
+
+static bool
+to_jsonl_file (const char   *path,
+               const uint8_t *buf,
+               size_t         len,
+               uint32_t       n_threads,
+               bson_error_t  *error)
+{
+   bson_reader_t *reader;
+   bool ret;
+   int fd;
+
+   fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+   assert (fd != -1);
+
+   reader = bson_reader_new_from_data (buf, len);
+   ret = bson_to_jsonl (reader, fd, n_threads, error);
+   bson_reader_destroy (reader);
+   close (fd);
+
+   return ret;
+}
+
+
+static void
+test_jsonl_to_jsonl (void)
+{
+   const char *path = "test-jsonl-to-jsonl.json";
+   static const uint32_t n_threads[] = { 0, 1, 3, 8 };
+   bson_error_t error;
+   uint8_t *buf;
+   char *expected;
+   char *actual;
+   size_t len;
+   size_t i;
+
+   buf = make_stream (N_DOCS, &len);
+   assert (len > 2 * BSON_JSONL_CHUNK_SIZE);
+   expected = expected_jsonl (buf, len, N_DOCS);
+
+   for (i = 0; i < sizeof n_threads / sizeof n_threads[0]; i++) {
+      assert (to_jsonl_file (path, buf, len, n_threads[i], &error));
+      actual = read_file (path);
+      ASSERT_CMPSTR (actual, expected);
+      bson_free (actual);
+   }
+
+   bson_free (expected);
+   bson_free (buf);
+   unlink (path);
+}
+
+
+static void
+test_jsonl_to_jsonl_empty (void)
+{
+   const char *path = "test-jsonl-empty.json";
+   bson_error_t error;
+   bson_t *b;
+   char *actual;
+
+   assert (to_jsonl_file (path, (const uint8_t *)"", 0, 2, &error));
+   actual = read_file (path);
+   ASSERT_CMPSTR (actual, "");
+   bson_free (actual);
+
+   /* an empty document is written the way bson_as_json() writes it */
+   b = bson_new ();
+   assert (to_jsonl_file (path, bson_get_data (b), b->len, 0, &error));
+   actual = read_file (path);
+   ASSERT_CMPSTR (actual, "{ }\n");
+   bson_free (actual);
+   bson_destroy (b);
+
+   unlink (path);
+}
+
+
+static void
+test_jsonl_to_jsonl_errors (void)
+{
+   const char *path = "test-jsonl-errors.json";
+   bson_error_t error;
+   bson_reader_t *reader;
+   uint8_t *buf;
+   char *expected;
+   char *actual;
+   size_t len;
+   size_t offset = 0;
+   uint32_t doc_len;
+   int i;
+
+   buf = make_stream (N_DOCS, &len);
+
+   /* break the UTF-8 of a document in the second chunk */
+   for (i = 0; i < 2500; i++) {
+      memcpy (&doc_len, buf + offset, sizeof doc_len);
+      offset += BSON_UINT32_FROM_LE (doc_len);
+   }
+
+   /* the first byte of the string "s" follows "\x10i\0", int32, "\x02s\0" */
+   buf[offset + 4 + 3 + 4 + 3 + 4] = 0xff;
+
+   assert (!to_jsonl_file (path, buf, len, 4, &error));
+   ASSERT_ERROR_CONTAINS (error, BSON_ERROR_JSONL, BSON_ERROR_JSONL_INVALID,
+                          "Document 2500 cannot be converted");
+
+   expected = expected_jsonl (buf, len, 2500);
+   actual = read_file (path);
+   ASSERT_CMPSTR (actual, expected);
+   bson_free (actual);
+   bson_free (expected);
+
+   /* trailing garbage after the last document */
+   bson_free (buf);
+   buf = make_stream (10, &len);
+   buf = bson_realloc (buf, len + 4);
+   memset (buf + len, 0xff, 4);
+
+   assert (!to_jsonl_file (path, buf, len + 4, 2, &error));
+   ASSERT_ERROR_CONTAINS (error, BSON_ERROR_JSONL, BSON_ERROR_JSONL_CORRUPT,
+                          "Corrupt BSON at document 10");
+
+   expected = expected_jsonl (buf, len, 10);
+   actual = read_file (path);
+   ASSERT_CMPSTR (actual, expected);
+   bson_free (actual);
+   bson_free (expected);
+
+   /* a descriptor that cannot be written */
+   reader = bson_reader_new_from_data (buf, len);
+   assert (!bson_to_jsonl (reader, -1, 0, &error));
+   ASSERT_ERROR_CONTAINS (error, BSON_ERROR_JSONL, BSON_ERROR_JSONL_IO,
+                          "Failed to write");
+   bson_reader_destroy (reader);
+
+   bson_free (buf);
+   unlink (path);
+}
+
+
+#ifndef _WIN32
+typedef struct
+{
+   int            fd;
+   bson_string_t *str;
+} drain_t;
+
+
+/* reads a pipe slowly, so that its writer keeps finding it full */
+static void *
+drain_worker (void *data)
+{
+   drain_t *drain = data;
+   char buf[4096];
+   ssize_t r;
+
+   while ((r = read (drain->fd, buf, sizeof buf)) != 0) {
+      if (r > 0) {
+         bson_string_append_printf (drain->str, "%.*s", (int)r, buf);
+         usleep (100);
+      }
+   }
+
+   return NULL;
+}
+
+
+static void
+test_jsonl_to_jsonl_nonblocking (void)
+{
+   const char *path = "test-jsonl-nonblocking.json";
+   bson_reader_t *reader;
+   bson_thread_t thread;
+   bson_error_t error;
+   drain_t drain;
+   uint8_t *buf;
+   char *expected;
+   char *actual;
+   size_t len;
+   size_t half;
+   int fds[2];
+   int fd;
+
+   /* a reader that runs out of data is not corrupt */
+   buf = make_stream (10, &len);
+   expected = expected_jsonl (buf, len, 10);
+   half = len / 2;
+
+   reader = bson_reader_new_from_feed ();
+   bson_reader_feed (reader, buf, half);
+
+   fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+   assert (fd != -1);
+   assert (!bson_to_jsonl (reader, fd, 2, &error));
+   ASSERT_ERROR_CONTAINS (error, BSON_ERROR_JSONL,
+                          BSON_ERROR_JSONL_WOULD_BLOCK,
+                          "would block at document");
+
+   /* and carries on once fed the rest */
+   bson_reader_feed (reader, buf + half, len - half);
+   bson_reader_feed (reader, NULL, 0);
+   assert (bson_to_jsonl (reader, fd, 2, &error));
+   close (fd);
+   bson_reader_destroy (reader);
+
+   actual = read_file (path);
+   ASSERT_CMPSTR (actual, expected);
+   bson_free (actual);
+   bson_free (expected);
+   bson_free (buf);
+   unlink (path);
+
+   /* a writer that finds a non-blocking pipe full waits for it */
+   buf = make_stream (N_DOCS, &len);
+   expected = expected_jsonl (buf, len, N_DOCS);
+
+   assert (pipe (fds) == 0);
+   assert (fcntl (fds[1], F_SETFL, O_NONBLOCK) == 0);
+   drain.fd = fds[0];
+   drain.str = bson_string_new (NULL);
+   bson_thread_create (&thread, drain_worker, &drain);
+
+   reader = bson_reader_new_from_data (buf, len);
+   assert (bson_to_jsonl (reader, fds[1], 2, &error));
+   bson_reader_destroy (reader);
+   close (fds[1]);
+
+   bson_thread_join (thread);
+   close (fds[0]);
+   ASSERT_CMPSTR (drain.str->str, expected);
+
+   bson_string_free (drain.str, true);
+   bson_free (expected);
+   bson_free (buf);
+}
+#endif
+
+
+typedef struct
+{
+   bson_mutex_t  mutex;
+   char        **lines;    /* what each line gave, by line number */
+   uint64_t      n_lines;
+   uint64_t      last;
+   bool          ordered;
+   uint64_t      n_calls;
+   uint64_t      stop_at;
+} ingest_ctx_t;
+
+
+static bool
+ingest_cb (uint64_t            line,
+           const bson_t       *doc,
+           const bson_error_t *error,
+           void               *data)
+{
+   ingest_ctx_t *ctx = data;
+   bool ret;
+
+   assert (!doc != !error);
+
+   bson_mutex_lock (&ctx->mutex);
+   assert (line > 0 && line <= ctx->n_lines);
+   assert (!ctx->lines[line - 1]);
+   assert (!ctx->ordered || line > ctx->last);
+   ctx->last = line;
+
+   if (doc) {
+      ctx->lines[line - 1] = bson_as_json (doc, NULL);
+   } else {
+      ctx->lines[line - 1] = bson_strdup_printf ("error: %s", error->message);
+   }
+
+   ret = ++ctx->n_calls != ctx->stop_at;
+   bson_mutex_unlock (&ctx->mutex);
+
+   return ret;
+}
+
+
+static uint64_t
+count_lines (const char *text)
+{
+   uint64_t n = 1;
+
+   for (; *text; text++) {
+      n += *text == '\n';
+   }
+
+   return n;
+}
+
+
+/* the lines as bson_new_from_json() parses them one by one */
+static char *
+ingested_serially (const char *text)
+{
+   bson_string_t *str;
+   bson_error_t error;
+   const char *eol;
+   uint64_t n;
+   bson_t *b;
+   char *json;
+
+   str = bson_string_new (NULL);
+
+   for (n = 1; *text; n++, text = *eol ? eol + 1 : eol) {
+      eol = text + strcspn (text, "\n");
+
+      if (eol == text) {
+         continue;
+      }
+
+      if ((b = bson_new_from_json ((const uint8_t *)text, eol - text,
+                                   &error))) {
+         json = bson_as_json (b, NULL);
+         bson_string_append_printf (str, "%" PRIu64 ": %s\n", n, json);
+         bson_free (json);
+         bson_destroy (b);
+      } else {
+         bson_string_append_printf (str, "%" PRIu64 ": error: %s\n", n,
+                                    error.message);
+      }
+   }
+
+   return bson_string_free (str, false);
+}
+
+
+static bool
+ingest_text (const char         *path,
+             const char         *text,
+             uint32_t            n_threads,
+             bson_jsonl_flags_t  flags,
+             uint64_t            stop_at,
+             char              **result,
+             uint64_t           *n_calls,
+             bson_error_t       *error)
+{
+   bson_string_t *str;
+   ingest_ctx_t ctx = { 0 };
+   size_t len = strlen (text);
+   uint64_t i;
+   bool ret;
+   int fd;
+
+   fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+   assert (fd != -1);
+   assert (write (fd, text, len) == (ssize_t)len);
+   close (fd);
+
+   bson_mutex_init (&ctx.mutex);
+   ctx.n_lines = count_lines (text);
+   ctx.lines = bson_malloc0 (ctx.n_lines * sizeof *ctx.lines);
+   ctx.ordered = !(flags & BSON_JSONL_UNORDERED);
+   ctx.stop_at = stop_at;
+
+   fd = open (path, O_RDONLY);
+   assert (fd != -1);
+   ret = bson_jsonl_ingest (fd, n_threads, flags, ingest_cb, &ctx, error);
+   close (fd);
+   unlink (path);
+
+   str = bson_string_new (NULL);
+
+   for (i = 0; i < ctx.n_lines; i++) {
+      if (ctx.lines[i]) {
+         bson_string_append_printf (str, "%" PRIu64 ": %s\n", i + 1,
+                                    ctx.lines[i]);
+         bson_free (ctx.lines[i]);
+      }
+   }
+
+   *result = bson_string_free (str, false);
+   *n_calls = ctx.n_calls;
+   bson_free (ctx.lines);
+   bson_mutex_destroy (&ctx.mutex);
+
+   return ret;
+}
+
+
+static void
+test_jsonl_ingest (void)
+{
+   const char *path = "test-jsonl-ingest.json";
+   static const uint32_t n_threads[] = { 0, 1, 3, 8 };
+   static const bson_jsonl_flags_t flags[] = {
+      BSON_JSONL_NONE, BSON_JSONL_UNORDERED
+   };
+   bson_error_t error;
+   uint64_t n_calls;
+   uint8_t *buf;
+   char *text;
+   char *expected;
+   char *actual;
+   size_t len;
+   size_t i;
+   size_t j;
+
+   buf = make_stream (N_DOCS, &len);
+   text = expected_jsonl (buf, len, N_DOCS);
+   assert (strlen (text) > 2 * BSON_JSONL_CHUNK_SIZE);
+   expected = ingested_serially (text);
+
+   for (i = 0; i < sizeof n_threads / sizeof n_threads[0]; i++) {
+      for (j = 0; j < sizeof flags / sizeof flags[0]; j++) {
+         assert (ingest_text (path, text, n_threads[i], flags[j], 0,
+                              &actual, &n_calls, &error));
+         assert (n_calls == N_DOCS);
+         ASSERT_CMPSTR (actual, expected);
+         bson_free (actual);
+      }
+   }
+
+   bson_free (expected);
+   bson_free (text);
+   bson_free (buf);
+}
+
+
+static void
+test_jsonl_ingest_lines (void)
+{
+   const char *path = "test-jsonl-ingest-lines.json";
+   const char *text =
+      "{\"a\": 1}\n"
+      "\n"
+      "{\"b\": \n"
+      "{\"c\": 2} {\"d\": 3}\n"
+      "  \t\r\n"
+      "  {\"e\": [1, {\"f\": \"g\"}]}\r\n"
+      "{\"h\": true}";
+   bson_error_t error;
+   uint64_t n_calls;
+   char *actual;
+   int i;
+
+   for (i = 0; i < 2; i++) {
+      assert (ingest_text (path, text, 2, i ? BSON_JSONL_UNORDERED : 0, 0,
+                           &actual, &n_calls, &error));
+      assert (n_calls == 5);
+      assert (strstr (actual, "1: { \"a\" : 1 }\n"));
+      assert (strstr (actual, "3: error: "));
+      assert (strstr (actual, "4: error: More than one JSON document"));
+      assert (strstr (actual,
+                      "6: { \"e\" : [ 1, { \"f\" : \"g\" } ] }\n"));
+      assert (strstr (actual, "7: { \"h\" : true }\n"));
+      bson_free (actual);
+   }
+}
+
+
+static void
+test_jsonl_ingest_long_line (void)
+{
+   const char *path = "test-jsonl-ingest-long-line.json";
+   bson_string_t *str;
+   bson_error_t error;
+   uint64_t n_calls;
+   char *expected;
+   char *actual;
+   size_t i;
+
+   /* a line that spans several chunks, among short ones */
+   str = bson_string_new ("{\"a\": 1}\n{\"s\": \"");
+
+   for (i = 0; i < 3 * BSON_JSONL_CHUNK_SIZE; i++) {
+      bson_string_append_c (str, 'a' + i % 26);
+   }
+
+   bson_string_append (str, "\"}\n{\"b\": 2}\n");
+
+   expected = ingested_serially (str->str);
+   assert (ingest_text (path, str->str, 2, BSON_JSONL_NONE, 0, &actual,
+                        &n_calls, &error));
+   assert (n_calls == 3);
+   ASSERT_CMPSTR (actual, expected);
+
+   bson_free (actual);
+   bson_free (expected);
+   bson_string_free (str, true);
+}
+
+
+static void
+test_jsonl_ingest_stop (void)
+{
+   const char *path = "test-jsonl-ingest-stop.json";
+   bson_error_t error;
+   uint64_t n_calls;
+   uint8_t *buf;
+   char *text;
+   char *actual;
+   size_t len;
+
+   buf = make_stream (N_DOCS, &len);
+   text = expected_jsonl (buf, len, N_DOCS);
+
+   /* in order, nothing is delivered after the callback stops */
+   assert (ingest_text (path, text, 4, BSON_JSONL_NONE, 100, &actual,
+                        &n_calls, &error));
+   assert (n_calls == 100);
+   assert (strstr (actual, "100: "));
+   assert (!strstr (actual, "101: "));
+   bson_free (actual);
+
+   /* unordered, threads stop once they see the stop, which other threads
+    * can race past for a few lines */
+   assert (ingest_text (path, text, 4, BSON_JSONL_UNORDERED, 100, &actual,
+                        &n_calls, &error));
+   assert (n_calls >= 100 && n_calls < N_DOCS / 2);
+   bson_free (actual);
+
+   bson_free (text);
+   bson_free (buf);
+}
+
+
+#ifndef _WIN32
+typedef struct
+{
+   int         fd;
+   const char *text;
+} trickle_t;
+
+
+/* writes a pipe slowly, so that its reader keeps finding it empty */
+static void *
+trickle_worker (void *data)
+{
+   trickle_t *trickle = data;
+   size_t len = strlen (trickle->text);
+   size_t off;
+   size_t n;
+
+   for (off = 0; off < len; off += n) {
+      n = BSON_MIN (len - off, 1000);
+      assert (write (trickle->fd, trickle->text + off, n) == (ssize_t)n);
+      usleep (100);
+   }
+
+   close (trickle->fd);
+
+   return NULL;
+}
+
+
+static void
+test_jsonl_ingest_nonblocking (void)
+{
+   ingest_ctx_t ctx = { 0 };
+   bson_thread_t thread;
+   bson_error_t error;
+   trickle_t trickle;
+   uint8_t *buf;
+   char *text;
+   size_t len;
+   uint64_t i;
+   int fds[2];
+
+   buf = make_stream (200, &len);
+   text = expected_jsonl (buf, len, 200);
+
+   /* a reader that finds a non-blocking pipe empty waits for it */
+   assert (pipe (fds) == 0);
+   assert (fcntl (fds[0], F_SETFL, O_NONBLOCK) == 0);
+   trickle.fd = fds[1];
+   trickle.text = text;
+   bson_thread_create (&thread, trickle_worker, &trickle);
+
+   bson_mutex_init (&ctx.mutex);
+   ctx.n_lines = count_lines (text);
+   ctx.lines = bson_malloc0 (ctx.n_lines * sizeof *ctx.lines);
+   ctx.ordered = true;
+
+   assert (bson_jsonl_ingest (fds[0], 2, BSON_JSONL_NONE, ingest_cb, &ctx,
+                              &error));
+   assert (ctx.n_calls == 200);
+
+   bson_thread_join (thread);
+   close (fds[0]);
+
+   for (i = 0; i < ctx.n_lines; i++) {
+      bson_free (ctx.lines[i]);
+   }
+
+   bson_free (ctx.lines);
+   bson_mutex_destroy (&ctx.mutex);
+   bson_free (text);
+   bson_free (buf);
+}
+#endif
+
+
+static void
+test_jsonl_ingest_errors (void)
+{
+   bson_error_t error;
+   ingest_ctx_t ctx = { 0 };
+
+   assert (!bson_jsonl_ingest (-1, 2, BSON_JSONL_NONE, ingest_cb, &ctx,
+                               &error));
+   ASSERT_ERROR_CONTAINS (error, BSON_ERROR_JSONL, BSON_ERROR_JSONL_IO,
+                          "Failed to read");
+   assert (ctx.n_calls == 0);
+}
+
+
+void
+test_jsonl_install (TestSuite *suite)
+{
+   TestSuite_Add (suite, "/bson/jsonl/to_jsonl", test_jsonl_to_jsonl);
+   TestSuite_Add (suite, "/bson/jsonl/to_jsonl/empty",
+                  test_jsonl_to_jsonl_empty);
+   TestSuite_Add (suite, "/bson/jsonl/to_jsonl/errors",
+                  test_jsonl_to_jsonl_errors);
+#ifndef _WIN32
+   TestSuite_Add (suite, "/bson/jsonl/to_jsonl/nonblocking",
+                  test_jsonl_to_jsonl_nonblocking);
+#endif
+   TestSuite_Add (suite, "/bson/jsonl/ingest", test_jsonl_ingest);
+   TestSuite_Add (suite, "/bson/jsonl/ingest/lines", test_jsonl_ingest_lines);
+   TestSuite_Add (suite, "/bson/jsonl/ingest/long_line",
+                  test_jsonl_ingest_long_line);
+   TestSuite_Add (suite, "/bson/jsonl/ingest/stop", test_jsonl_ingest_stop);
+#ifndef _WIN32
+   TestSuite_Add (suite, "/bson/jsonl/ingest/nonblocking",
+                  test_jsonl_ingest_nonblocking);
+#endif
+   TestSuite_Add (suite, "/bson/jsonl/ingest/errors",
+                  test_jsonl_ingest_errors);
+}
@@ -1,23 +1,40 @@
 #include "TestSuite.h"
 
 
+extern void test_aggregate_install    (TestSuite *suite);
 extern void test_atomic_install       (TestSuite *suite);
 extern void test_bcon_basic_install   (TestSuite *suite);
 extern void test_bcon_extract_install (TestSuite *suite);
 extern void test_bson_install         (TestSuite *suite);
+extern void test_budget_install       (TestSuite *suite);
 extern void test_clock_install        (TestSuite *suite);
+extern void test_columnar_install     (TestSuite *suite);
+extern void test_compression_install  (TestSuite *suite);
 extern void test_decimal128_install   (TestSuite *suite);
 extern void test_endian_install       (TestSuite *suite);
 extern void test_error_install        (TestSuite *suite);
+extern void test_index_install        (TestSuite *suite);
+extern void test_iovec_install        (TestSuite *suite);
 extern void test_iso8601_install      (TestSuite *suite);
 extern void test_iter_install         (TestSuite *suite);
 extern void test_json_install         (TestSuite *suite);
+extern void test_jsonl_install        (TestSuite *suite);
+extern void test_matcher_install      (TestSuite *suite);
 extern void test_oid_install          (TestSuite *suite);
+extern void test_pool_install         (TestSuite *suite);
+extern void test_projection_install   (TestSuite *suite);
+extern void test_pull_parser_install  (TestSuite *suite);
 extern void test_reader_install       (TestSuite *suite);
+extern void test_shm_ring_install     (TestSuite *suite);
+extern void test_stats_install        (TestSuite *suite);
 extern void test_string_install       (TestSuite *suite);
+extern void test_struct_install       (TestSuite *suite);
 extern void test_utf8_install         (TestSuite *suite);
 extern void test_value_install        (TestSuite *suite);
 extern void test_version_install      (TestSuite *suite);
+extern void test_view_install         (TestSuite *suite);
+extern void test_visit_install        (TestSuite *suite);
+extern void test_walker_install       (TestSuite *suite);
 extern void test_writer_install       (TestSuite *suite);
 extern void test_bson_type_install    (TestSuite *suite);
 
@@ -31,22 +48,39 @@ main (int argc,
 
    TestSuite_Init (&suite, "", argc, argv);
 
+   test_aggregate_install (&suite);
    test_atomic_install (&suite);
    test_bcon_basic_install (&suite);
    test_bcon_extract_install (&suite);
    test_bson_install (&suite);
+   test_budget_install (&suite);
    test_clock_install (&suite);
+   test_columnar_install (&suite);
+   test_compression_install (&suite);
    test_error_install (&suite);
+   test_index_install (&suite);
+   test_iovec_install (&suite);
    test_endian_install (&suite);
    test_iso8601_install (&suite);
    test_iter_install (&suite);
    test_json_install (&suite);
+   test_jsonl_install (&suite);
+   test_matcher_install (&suite);
    test_oid_install (&suite);
+   test_pool_install (&suite);
+   test_projection_install (&suite);
+   test_pull_parser_install (&suite);
    test_reader_install (&suite);
+   test_shm_ring_install (&suite);
+   test_stats_install (&suite);
    test_string_install (&suite);
+   test_struct_install (&suite);
    test_utf8_install (&suite);
    test_value_install (&suite);
    test_version_install (&suite);
+   test_view_install (&suite);
+   test_visit_install (&suite);
+   test_walker_install (&suite);
    test_writer_install (&suite);
 #ifdef BSON_EXPERIMENTAL_FEATURES
    test_decimal128_install (&suite);
@@ -0,0 +1,375 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <assert.h>
+#include <fcntl.h>
+
+#include "bson-tests.h"
+#include "TestSuite.h"
+
+
+#ifndef BINARY_DIR
+# define BINARY_DIR "tests/binary"
+#endif
+
+
+static bool
+match_bson (bson_t     *filter,
+            const char *doc_json)
+{
+   bson_matcher_t *matcher;
+   bson_error_t error;
+   bson_t *doc;
+   bool ret;
+
+   doc = bson_new_from_json ((const uint8_t *)doc_json, -1, &error);
+   assert (doc);
+
+   matcher = bson_matcher_new (filter, &error);
+   if (!matcher) {
+      fprintf (stderr, "%s\n", error.message);
+      abort ();
+   }
+
+   ret = bson_matcher_match (matcher, doc);
+
+   bson_matcher_destroy (matcher);
+   bson_destroy (filter);
+   bson_destroy (doc);
+
+   return ret;
+}
+
+
+static bool
+match_json (const char *filter_json,
+            const char *doc_json)
+{
+   bson_error_t error;
+   bson_t *filter;
+
+   filter = bson_new_from_json ((const uint8_t *)filter_json, -1, &error);
+   assert (filter);
+
+   return match_bson (filter, doc_json);
+}
+
+
+/* the JSON parser reserves "$type", so build these filters with BCON */
+#define TYPE_FILTER(path, type) \
+   BCON_NEW (path, "{", "$type", type, "}")
+
+
+static void
+test_matcher_eq (void)
+{
+   assert (match_json ("{}", "{\"a\": 1}"));
+   assert (match_json ("{\"a\": 1}", "{\"a\": 1}"));
+   assert (match_json ("{\"a\": 1}", "{\"b\": 2, \"a\": 1.0}"));
+   assert (match_json ("{\"a\": {\"$numberLong\": \"1\"}}", "{\"a\": 1}"));
+   assert (!match_json ("{\"a\": 1}", "{\"a\": 2}"));
+   assert (!match_json ("{\"a\": 1}", "{\"a\": \"1\"}"));
+   assert (!match_json ("{\"a\": 1}", "{\"b\": 1}"));
+   assert (match_json ("{\"a\": \"x\", \"b\": true}",
+                       "{\"b\": true, \"a\": \"x\"}"));
+   assert (!match_json ("{\"a\": \"x\", \"b\": true}",
+                        "{\"b\": false, \"a\": \"x\"}"));
+   assert (match_json ("{\"a\": {\"$eq\": {\"b\": 1}}}",
+                       "{\"a\": {\"b\": 1}}"));
+   assert (match_json ("{\"a\": {\"b\": 1}}", "{\"a\": {\"b\": 1}}"));
+   assert (!match_json ("{\"a\": {\"b\": 1}}", "{\"a\": {\"b\": 1, \"c\": 2}}"));
+   assert (match_json ("{\"a\": {\"$oid\": \"000000000000000000000001\"}}",
+                       "{\"a\": {\"$oid\": \"000000000000000000000001\"}}"));
+
+   /* missing fields are equal to null */
+   assert (match_json ("{\"a\": null}", "{\"b\": 1}"));
+   assert (match_json ("{\"a\": null}", "{\"a\": null}"));
+   assert (!match_json ("{\"a\": null}", "{\"a\": 0}"));
+
+   /* the first occurrence of a duplicate key is used */
+   assert (match_json ("{\"a\": 1}", "{\"a\": 1, \"a\": 2}"));
+   assert (!match_json ("{\"a\": 2}", "{\"a\": 1, \"a\": 2}"));
+}
+
+
+static void
+test_matcher_ne (void)
+{
+   assert (match_json ("{\"a\": {\"$ne\": 1}}", "{\"a\": 2}"));
+   assert (match_json ("{\"a\": {\"$ne\": 1}}", "{\"b\": 1}"));
+   assert (!match_json ("{\"a\": {\"$ne\": 1}}", "{\"a\": 1}"));
+   assert (!match_json ("{\"a\": {\"$ne\": 1}}", "{\"a\": [3, 1]}"));
+   assert (!match_json ("{\"a\": {\"$ne\": null}}", "{\"b\": 1}"));
+}
+
+
+static void
+test_matcher_compare (void)
+{
+   assert (match_json ("{\"a\": {\"$gt\": 1}}", "{\"a\": 2}"));
+   assert (match_json ("{\"a\": {\"$gt\": 1}}", "{\"a\": 1.5}"));
+   assert (!match_json ("{\"a\": {\"$gt\": 1}}", "{\"a\": 1}"));
+   assert (match_json ("{\"a\": {\"$gte\": 1}}", "{\"a\": 1}"));
+   assert (match_json ("{\"a\": {\"$lt\": 1}}", "{\"a\": -1}"));
+   assert (!match_json ("{\"a\": {\"$lt\": 1}}", "{\"a\": 1}"));
+   assert (match_json ("{\"a\": {\"$lte\": 1}}", "{\"a\": 1}"));
+   assert (match_json ("{\"a\": {\"$gt\": 1, \"$lt\": 5}}", "{\"a\": 3}"));
+   assert (!match_json ("{\"a\": {\"$gt\": 1, \"$lt\": 5}}", "{\"a\": 5}"));
+   assert (!match_json ("{\"a\": {\"$gt\": 1}}", "{\"a\": \"2\"}"));
+   assert (!match_json ("{\"a\": {\"$gt\": 1}}", "{\"b\": 2}"));
+   assert (match_json ("{\"a\": {\"$gt\": \"abc\"}}", "{\"a\": \"abd\"}"));
+   assert (match_json ("{\"a\": {\"$gt\": \"abc\"}}", "{\"a\": \"abcd\"}"));
+   assert (!match_json ("{\"a\": {\"$gt\": \"abc\"}}", "{\"a\": \"ab\"}"));
+   assert (match_json ("{\"a\": {\"$lt\": {\"$date\": 1000}}}",
+                       "{\"a\": {\"$date\": 999}}"));
+
+   /* arrays match if any element matches */
+   assert (match_json ("{\"a\": {\"$gt\": 4}}", "{\"a\": [1, 5]}"));
+   assert (!match_json ("{\"a\": {\"$gt\": 5}}", "{\"a\": [1, 5]}"));
+   assert (match_json ("{\"a\": 5}", "{\"a\": [1, 5]}"));
+   assert (match_json ("{\"a\": [1, 5]}", "{\"a\": [1, 5]}"));
+}
+
+
+static void
+test_matcher_in (void)
+{
+   assert (match_json ("{\"a\": {\"$in\": [1, \"x\"]}}", "{\"a\": \"x\"}"));
+   assert (match_json ("{\"a\": {\"$in\": [1, \"x\"]}}", "{\"a\": 1.0}"));
+   assert (!match_json ("{\"a\": {\"$in\": [1, \"x\"]}}", "{\"a\": 2}"));
+   assert (!match_json ("{\"a\": {\"$in\": []}}", "{\"a\": 2}"));
+   assert (match_json ("{\"a\": {\"$in\": [2, 3]}}", "{\"a\": [1, 3]}"));
+   assert (match_json ("{\"a\": {\"$in\": [null]}}", "{\"b\": 1}"));
+   assert (!match_json ("{\"a\": {\"$in\": [1]}}", "{\"b\": 1}"));
+   assert (match_json ("{\"a\": {\"$nin\": [1, 2]}}", "{\"a\": 3}"));
+   assert (match_json ("{\"a\": {\"$nin\": [1, 2]}}", "{\"b\": 3}"));
+   assert (!match_json ("{\"a\": {\"$nin\": [1, 2]}}", "{\"a\": 2}"));
+   assert (!match_json ("{\"a\": {\"$nin\": [1, 2]}}", "{\"a\": [5, 1]}"));
+}
+
+
+static void
+test_matcher_exists_type (void)
+{
+   assert (match_json ("{\"a\": {\"$exists\": true}}", "{\"a\": null}"));
+   assert (!match_json ("{\"a\": {\"$exists\": true}}", "{\"b\": 1}"));
+   assert (match_json ("{\"a\": {\"$exists\": false}}", "{\"b\": 1}"));
+   assert (!match_json ("{\"a\": {\"$exists\": 0}}", "{\"a\": 1}"));
+   assert (match_json ("{\"a.b\": {\"$exists\": true}}", "{\"a\": {\"b\": 1}}"));
+   assert (!match_json ("{\"a.b\": {\"$exists\": true}}", "{\"a\": 1}"));
+
+   assert (match_bson (TYPE_FILTER ("a", BCON_UTF8 ("string")),
+                       "{\"a\": \"x\"}"));
+   assert (match_bson (TYPE_FILTER ("a", BCON_INT32 (2)), "{\"a\": \"x\"}"));
+   assert (!match_bson (TYPE_FILTER ("a", BCON_UTF8 ("string")),
+                        "{\"a\": 1}"));
+   assert (match_bson (TYPE_FILTER ("a", BCON_UTF8 ("number")),
+                       "{\"a\": 1.5}"));
+   assert (match_bson (TYPE_FILTER ("a", BCON_UTF8 ("number")),
+                       "{\"a\": {\"$numberLong\": \"1\"}}"));
+   assert (!match_bson (TYPE_FILTER ("a", BCON_UTF8 ("number")),
+                        "{\"a\": true}"));
+   assert (match_bson (TYPE_FILTER ("a", BCON_UTF8 ("array")),
+                       "{\"a\": [1]}"));
+   assert (match_bson (TYPE_FILTER ("a", BCON_UTF8 ("int")),
+                       "{\"a\": [\"x\", 1]}"));
+   assert (!match_bson (TYPE_FILTER ("a", BCON_UTF8 ("int")), "{\"b\": 1}"));
+}
+
+
+static void
+test_matcher_logical (void)
+{
+   const char *filter;
+
+   filter = "{\"$or\": [{\"a\": 1}, {\"b\": {\"$gt\": 5}}]}";
+   assert (match_json (filter, "{\"a\": 1}"));
+   assert (match_json (filter, "{\"a\": 2, \"b\": 6}"));
+   assert (!match_json (filter, "{\"a\": 2, \"b\": 5}"));
+
+   filter = "{\"$and\": [{\"a\": {\"$gt\": 1}}, {\"a\": {\"$lt\": 3}}]}";
+   assert (match_json (filter, "{\"a\": 2}"));
+   assert (!match_json (filter, "{\"a\": 3}"));
+
+   filter = "{\"c\": true, \"$or\": [{\"a\": 1}, "
+            "{\"$and\": [{\"b\": 2}, {\"d\": {\"$exists\": false}}]}]}";
+   assert (match_json (filter, "{\"c\": true, \"a\": 1}"));
+   assert (match_json (filter, "{\"c\": true, \"b\": 2}"));
+   assert (!match_json (filter, "{\"c\": true, \"b\": 2, \"d\": 0}"));
+   assert (!match_json (filter, "{\"c\": false, \"a\": 1}"));
+}
+
+
+static void
+test_matcher_paths (void)
+{
+   const char *doc;
+
+   doc = "{\"a\": {\"b\": {\"c\": 3}, \"d\": [10, {\"e\": \"x\"}]}, \"f\": 1}";
+
+   assert (match_json ("{\"a.b.c\": 3}", doc));
+   assert (match_json ("{\"a.b.c\": 3, \"a.d.0\": 10, \"f\": 1}", doc));
+   assert (match_json ("{\"a.d.1.e\": \"x\"}", doc));
+   assert (match_json ("{\"a.b\": {\"c\": 3}}", doc));
+   assert (!match_json ("{\"a.b.c\": 4}", doc));
+   assert (!match_json ("{\"a.x.c\": 3}", doc));
+   assert (!match_json ("{\"a.b.c.d\": 3}", doc));
+   assert (!match_json ("{\"f.g\": 1}", doc));
+   assert (match_bson (BCON_NEW ("a.b.c", "{", "$gt", BCON_INT32 (1), "}",
+                                 "a.b", "{", "$type", BCON_INT32 (3), "}"),
+                       doc));
+}
+
+
+static void
+test_matcher_invalid (void)
+{
+   const char *filters[] = {
+      "{\"a\": {\"$foo\": 1}}",
+      "{\"$foo\": 1}",
+      "{\"a\": {\"$in\": 1}}",
+      "{\"$or\": 1}",
+      "{\"$or\": []}",
+      "{\"$and\": [1]}",
+      "{\"$or\": [{\"a\": {\"$gt\": 1, \"$bar\": 2}}]}",
+   };
+   bson_matcher_t *matcher;
+   bson_error_t error;
+   bson_t *filter;
+   size_t i;
+
+   for (i = 0; i < sizeof filters / sizeof filters[0]; i++) {
+      filter = bson_new_from_json ((const uint8_t *)filters[i], -1, &error);
+      assert (filter);
+      matcher = bson_matcher_new (filter, &error);
+      assert (!matcher);
+      assert_cmpint (error.domain, ==, BSON_ERROR_MATCHER);
+      assert_cmpint (error.code, ==, BSON_ERROR_MATCHER_INVALID);
+      bson_destroy (filter);
+   }
+
+   filter = TYPE_FILTER ("a", BCON_UTF8 ("foo"));
+   assert (!bson_matcher_new (filter, &error));
+   assert_cmpint (error.code, ==, BSON_ERROR_MATCHER_INVALID);
+   bson_destroy (filter);
+
+   filter = TYPE_FILTER ("a", BCON_BOOL (true));
+   assert (!bson_matcher_new (filter, &error));
+   assert_cmpint (error.code, ==, BSON_ERROR_MATCHER_INVALID);
+   bson_destroy (filter);
+}
+
+
+static void
+test_matcher_many_paths (void)
+{
+   bson_matcher_t *matcher;
+   bson_t filter = BSON_INITIALIZER;
+   bson_t doc = BSON_INITIALIZER;
+   char key[16];
+   int i;
+
+   /* more paths than fit in the on-stack slot arrays */
+   for (i = 0; i < 40; i++) {
+      bson_snprintf (key, sizeof key, "k%d", i);
+      BSON_APPEND_INT32 (&filter, key, i);
+      BSON_APPEND_INT32 (&doc, key, i);
+   }
+
+   matcher = bson_matcher_new (&filter, NULL);
+   assert (matcher);
+   assert (bson_matcher_match (matcher, &doc));
+
+   BSON_APPEND_INT32 (&filter, "k40", 40);
+   bson_matcher_destroy (matcher);
+   matcher = bson_matcher_new (&filter, NULL);
+   assert (!bson_matcher_match (matcher, &doc));
+
+   bson_matcher_destroy (matcher);
+   bson_destroy (&filter);
+   bson_destroy (&doc);
+}
+
+
+/* {"a": <decimal128 1>}, built by hand as bson_append_decimal128 is
+ * experimental */
+static const uint8_t gDecimal128Doc[] = {
+   24, 0, 0, 0,
+   0x13, 'a', 0,
+   1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x40, 0x30,
+   0
+};
+
+
+static void
+test_matcher_decimal128 (void)
+{
+   bson_matcher_t *matcher;
+   bson_error_t error;
+   bson_t *filter;
+   bson_t doc;
+
+   assert (bson_init_static (&doc, gDecimal128Doc, sizeof gDecimal128Doc));
+
+   filter = BCON_NEW ("a", BCON_INT32 (1));
+   matcher = bson_matcher_new (filter, &error);
+   assert (matcher);
+   assert (!bson_matcher_match (matcher, &doc));
+   bson_matcher_destroy (matcher);
+   bson_destroy (filter);
+
+   filter = BCON_NEW ("a", "{", "$exists", BCON_BOOL (true), "}");
+   matcher = bson_matcher_new (filter, &error);
+   assert (bson_matcher_match (matcher, &doc));
+   bson_matcher_destroy (matcher);
+   bson_destroy (filter);
+
+   filter = TYPE_FILTER ("a", BCON_INT32 (BSON_TYPE_DECIMAL128));
+   matcher = bson_matcher_new (filter, &error);
+   assert (bson_matcher_match (matcher, &doc));
+   bson_matcher_destroy (matcher);
+   bson_destroy (filter);
+
+   /* as a filter operand */
+   matcher = bson_matcher_new (&doc, &error);
+#ifdef BSON_EXPERIMENTAL_FEATURES
+   assert (matcher);
+   assert (bson_matcher_match (matcher, &doc));
+   bson_matcher_destroy (matcher);
+#else
+   assert (!matcher);
+   ASSERT_ERROR_CONTAINS (error, BSON_ERROR_MATCHER,
+                          BSON_ERROR_MATCHER_INVALID, "Unsupported type");
+#endif
+}
+
+
+void
+test_matcher_install (TestSuite *suite)
+{
+   TestSuite_Add (suite, "/bson/matcher/eq", test_matcher_eq);
+   TestSuite_Add (suite, "/bson/matcher/ne", test_matcher_ne);
+   TestSuite_Add (suite, "/bson/matcher/compare", test_matcher_compare);
+   TestSuite_Add (suite, "/bson/matcher/in", test_matcher_in);
+   TestSuite_Add (suite, "/bson/matcher/exists_type",
+                  test_matcher_exists_type);
+   TestSuite_Add (suite, "/bson/matcher/logical", test_matcher_logical);
+   TestSuite_Add (suite, "/bson/matcher/paths", test_matcher_paths);
+   TestSuite_Add (suite, "/bson/matcher/invalid", test_matcher_invalid);
+   TestSuite_Add (suite, "/bson/matcher/many_paths", test_matcher_many_paths);
+   TestSuite_Add (suite, "/bson/matcher/decimal128", test_matcher_decimal128);
+}
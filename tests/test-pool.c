@@ -0,0 +1,178 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <assert.h>
+#include <fcntl.h>
+
+#include "bson-tests.h"
+#include "TestSuite.h"
+
+
+#ifndef BINARY_DIR
+# define BINARY_DIR "tests/binary"
+#endif
+
+
+static void
+fill (bson_t *bson,
+      int     n)
+{
+   char key[16];
+   int i;
+
+   for (i = 0; i < n; i++) {
+      bson_snprintf (key, sizeof key, "field%d", i);
+      BSON_APPEND_UTF8 (bson, key, "0123456789abcdef0123456789abcdef");
+   }
+}
+
+
+static void
+test_pool_reuse (void)
+{
+   bson_pool_stats_t stats;
+   bson_pool_t *pool;
+   const uint8_t *data;
+   bson_t *bson;
+
+   pool = bson_pool_new ();
+
+   bson = bson_pool_acquire (pool);
+   assert (bson_empty (bson));
+   fill (bson, 100);
+   data = bson_get_data (bson);
+   bson_pool_release (pool, bson);
+
+   bson_pool_get_stats (pool, &stats);
+   assert_cmpint (stats.n_idle, ==, 1);
+   assert_cmpint (stats.n_outstanding, ==, 0);
+   assert_cmpint (stats.idle_bytes, >=, 4096);
+
+   /* the document comes back empty, with the buffer it grew */
+   bson = bson_pool_acquire (pool);
+   assert (bson_empty (bson));
+   assert (bson_get_data (bson) == data);
+   assert (bson_validate (bson, BSON_VALIDATE_NONE, NULL));
+   fill (bson, 100);
+   assert (bson_get_data (bson) == data);
+   assert_cmpint (bson_count_keys (bson), ==, 100);
+
+   bson_pool_get_stats (pool, &stats);
+   assert_cmpint (stats.n_acquired, ==, 2);
+   assert_cmpint (stats.n_reused, ==, 1);
+   assert_cmpint (stats.n_idle, ==, 0);
+   assert_cmpint (stats.idle_bytes, ==, 0);
+
+   bson_pool_release (pool, bson);
+
+   /* acquired documents may also be freed directly */
+   bson = bson_pool_acquire (pool);
+   bson_destroy (bson);
+
+   bson_pool_destroy (pool);
+}
+
+
+static void
+test_pool_max_size (void)
+{
+   bson_pool_stats_t stats;
+   bson_pool_t *pool;
+   bson_t *bson;
+
+   pool = bson_pool_new ();
+   bson_pool_set_max_size (pool, 1024);
+
+   bson = bson_pool_acquire (pool);
+   fill (bson, 100);
+   bson_pool_release (pool, bson);
+
+   bson = bson_pool_acquire (pool);
+   fill (bson, 1);
+   bson_pool_release (pool, bson);
+
+   bson_pool_get_stats (pool, &stats);
+   assert_cmpint (stats.n_freed, ==, 1);
+   assert_cmpint (stats.n_reused, ==, 0);
+   assert_cmpint (stats.n_idle, ==, 1);
+
+   bson_pool_destroy (pool);
+}
+
+
+static void
+test_pool_trim (void)
+{
+   bson_pool_stats_t stats;
+   bson_pool_t *pool;
+   bson_t *docs[10];
+   int i;
+
+   pool = bson_pool_new ();
+
+   for (i = 0; i < 10; i++) {
+      docs[i] = bson_pool_acquire (pool);
+   }
+
+   for (i = 0; i < 10; i++) {
+      bson_pool_release (pool, docs[i]);
+   }
+
+   bson_pool_get_stats (pool, &stats);
+   assert_cmpint (stats.high_water, ==, 10);
+   assert_cmpint (stats.n_idle, ==, 10);
+
+   /* the burst of ten is within the high-water mark, so all are kept */
+   bson_pool_trim (pool);
+   bson_pool_get_stats (pool, &stats);
+   assert_cmpint (stats.n_idle, ==, 10);
+   assert_cmpint (stats.high_water, ==, 0);
+
+   /* afterwards only two are in use at once */
+   for (i = 0; i < 2; i++) {
+      docs[i] = bson_pool_acquire (pool);
+   }
+
+   bson_pool_release (pool, docs[0]);
+   bson_pool_trim (pool);
+
+   bson_pool_get_stats (pool, &stats);
+   assert_cmpint (stats.n_outstanding, ==, 1);
+   assert_cmpint (stats.n_idle, ==, 1);
+   assert_cmpint (stats.n_freed, ==, 8);
+
+   bson_pool_release (pool, docs[1]);
+
+   /* the pool trims itself periodically */
+   for (i = 0; i < BSON_POOL_TRIM_INTERVAL; i++) {
+      bson_pool_release (pool, bson_pool_acquire (pool));
+   }
+
+   bson_pool_get_stats (pool, &stats);
+   assert_cmpint (stats.n_idle, ==, 1);
+
+   bson_pool_destroy (pool);
+}
+
+
+void
+test_pool_install (TestSuite *suite)
+{
+   TestSuite_Add (suite, "/bson/pool/reuse", test_pool_reuse);
+   TestSuite_Add (suite, "/bson/pool/max_size", test_pool_max_size);
+   TestSuite_Add (suite, "/bson/pool/trim", test_pool_trim);
+}
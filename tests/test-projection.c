@@ -0,0 +1,259 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <assert.h>
+#include <fcntl.h>
+
+#include "bson-tests.h"
+#include "TestSuite.h"
+
+
+#ifndef BINARY_DIR
+# define BINARY_DIR "tests/binary"
+#endif
+
+
+static void
+assert_projection (const char *spec_json,
+                   const char *doc_json,
+                   const char *expected_json)
+{
+   bson_projection_t *projection;
+   bson_error_t error;
+   bson_t *spec;
+   bson_t *doc;
+   bson_t *expected;
+   bson_t dst;
+   char *str;
+   char *expected_str;
+
+   spec = bson_new_from_json ((const uint8_t *)spec_json, -1, &error);
+   doc = bson_new_from_json ((const uint8_t *)doc_json, -1, &error);
+   expected = bson_new_from_json ((const uint8_t *)expected_json, -1, &error);
+   assert (spec && doc && expected);
+
+   projection = bson_projection_new (spec, &error);
+   if (!projection) {
+      fprintf (stderr, "%s\n", error.message);
+      abort ();
+   }
+
+   assert (bson_projection_apply (projection, doc, &dst));
+   assert (bson_validate (&dst, BSON_VALIDATE_NONE, NULL));
+
+   str = bson_as_json (&dst, NULL);
+   expected_str = bson_as_json (expected, NULL);
+   assert_cmpstr (str, expected_str);
+
+   bson_free (str);
+   bson_free (expected_str);
+   bson_destroy (&dst);
+   bson_projection_destroy (projection);
+   bson_destroy (spec);
+   bson_destroy (doc);
+   bson_destroy (expected);
+}
+
+
+static void
+test_projection_include (void)
+{
+   assert_projection ("{\"a\": 1}",
+                      "{\"_id\": 1, \"a\": 2, \"b\": 3}",
+                      "{\"_id\": 1, \"a\": 2}");
+   assert_projection ("{\"a\": 1, \"b\": true}",
+                      "{\"_id\": 1, \"a\": 2, \"b\": 3, \"c\": 4}",
+                      "{\"_id\": 1, \"a\": 2, \"b\": 3}");
+   assert_projection ("{\"a\": 1, \"_id\": 0}",
+                      "{\"_id\": 1, \"a\": 2, \"b\": 3}",
+                      "{\"a\": 2}");
+   assert_projection ("{\"_id\": 1}",
+                      "{\"_id\": 1, \"a\": 2}",
+                      "{\"_id\": 1}");
+   assert_projection ("{\"c\": 1}",
+                      "{\"a\": 1, \"b\": 2}",
+                      "{}");
+   assert_projection ("{\"a\": 1}", "{}", "{}");
+   assert_projection ("{\"a\": 1, \"c\": 1}",
+                      "{\"a\": null, \"b\": null, \"c\": 3}",
+                      "{\"a\": null, \"c\": 3}");
+}
+
+
+static void
+test_projection_exclude (void)
+{
+   assert_projection ("{}",
+                      "{\"_id\": 1, \"a\": 2}",
+                      "{\"_id\": 1, \"a\": 2}");
+   assert_projection ("{\"_id\": 0}",
+                      "{\"_id\": 1, \"a\": 2}",
+                      "{\"a\": 2}");
+   assert_projection ("{\"b\": 0}",
+                      "{\"_id\": 1, \"a\": 2, \"b\": 3, \"c\": 4}",
+                      "{\"_id\": 1, \"a\": 2, \"c\": 4}");
+   assert_projection ("{\"a\": false, \"c\": 0}",
+                      "{\"a\": 1, \"b\": 2, \"c\": 3, \"d\": 4}",
+                      "{\"b\": 2, \"d\": 4}");
+}
+
+
+static void
+test_projection_nested (void)
+{
+   assert_projection ("{\"a.b\": 1}",
+                      "{\"_id\": 1, \"a\": {\"b\": 2, \"c\": 3}, \"d\": 4}",
+                      "{\"_id\": 1, \"a\": {\"b\": 2}}");
+   assert_projection ("{\"a\": {\"b\": 1}}",
+                      "{\"a\": {\"b\": 2, \"c\": 3}, \"d\": 4}",
+                      "{\"a\": {\"b\": 2}}");
+   assert_projection ("{\"a.b.c\": 1, \"a.d\": 1}",
+                      "{\"a\": {\"b\": {\"c\": 1, \"x\": 2}, \"d\": 3, "
+                      "\"e\": 4}}",
+                      "{\"a\": {\"b\": {\"c\": 1}, \"d\": 3}}");
+   assert_projection ("{\"a.b\": 0}",
+                      "{\"a\": {\"b\": 2, \"c\": 3}, \"d\": 4}",
+                      "{\"a\": {\"c\": 3}, \"d\": 4}");
+
+   /* a scalar under a nested path is dropped only by inclusion */
+   assert_projection ("{\"a.b\": 1}",
+                      "{\"a\": 1, \"d\": 4}",
+                      "{}");
+   assert_projection ("{\"a.b\": 0}",
+                      "{\"a\": 1, \"d\": 4}",
+                      "{\"a\": 1, \"d\": 4}");
+}
+
+
+static void
+test_projection_array (void)
+{
+   assert_projection ("{\"a.b\": 1}",
+                      "{\"a\": [{\"b\": 1, \"c\": 2}, 3, {\"c\": 4}, "
+                      "{\"b\": 5}]}",
+                      "{\"a\": [{\"b\": 1}, {}, {\"b\": 5}]}");
+   assert_projection ("{\"a.b\": 0}",
+                      "{\"a\": [{\"b\": 1, \"c\": 2}, 3, {\"c\": 4}]}",
+                      "{\"a\": [{\"c\": 2}, 3, {\"c\": 4}]}");
+   assert_projection ("{\"a\": 1}",
+                      "{\"a\": [1, 2, 3], \"b\": [4]}",
+                      "{\"a\": [1, 2, 3]}");
+}
+
+
+static void
+test_projection_invalid (void)
+{
+   const char *specs[] = {
+      "{\"a\": 1, \"b\": 0}",
+      "{\"a\": 0, \"b\": 1}",
+      "{\"a\": 1, \"a.b\": 1}",
+      "{\"a.b\": 1, \"a\": 1}",
+      "{\"a\": 1, \"a\": 1}",
+      "{\"a\": \"yes\"}",
+      "{\"a..b\": 1}",
+      "{\"a.\": 1}",
+   };
+   bson_projection_t *projection;
+   bson_error_t error;
+   bson_t *spec;
+   size_t i;
+
+   for (i = 0; i < sizeof specs / sizeof specs[0]; i++) {
+      spec = bson_new_from_json ((const uint8_t *)specs[i], -1, &error);
+      assert (spec);
+      projection = bson_projection_new (spec, &error);
+      assert (!projection);
+      assert_cmpint (error.domain, ==, BSON_ERROR_PROJECTION);
+      assert_cmpint (error.code, ==, BSON_ERROR_PROJECTION_INVALID);
+      bson_destroy (spec);
+   }
+}
+
+
+static void
+test_projection_corrupt (void)
+{
+   bson_projection_t *projection;
+   bson_t *spec;
+   bson_t src;
+   bson_t dst;
+   /* {"a": <unknown type 0x20>} */
+   const uint8_t bad[] = { 10, 0, 0, 0, 0x20, 'a', 0, 0, 0, 0 };
+
+   spec = BCON_NEW ("a", BCON_INT32 (1));
+   projection = bson_projection_new (spec, NULL);
+   assert (projection);
+
+   assert (bson_init_static (&src, bad, sizeof bad));
+   assert (!bson_projection_apply (projection, &src, &dst));
+   assert (bson_empty (&dst));
+   bson_destroy (&dst);
+
+   bson_projection_destroy (projection);
+   bson_destroy (spec);
+}
+
+
+static void
+test_projection_matches_copy (void)
+{
+   bson_projection_t *projection;
+   bson_t *spec;
+   bson_t *src;
+   bson_t dst;
+   bson_t expected;
+   char key[16];
+   int i;
+
+   src = bson_new ();
+   for (i = 0; i < 100; i++) {
+      bson_snprintf (key, sizeof key, "k%d", i);
+      BSON_APPEND_INT32 (src, key, i);
+   }
+
+   spec = BCON_NEW ("k3", BCON_INT32 (0),
+                    "k50", BCON_INT32 (0),
+                    "k99", BCON_INT32 (0));
+   projection = bson_projection_new (spec, NULL);
+   assert (projection);
+
+   assert (bson_projection_apply (projection, src, &dst));
+   bson_init (&expected);
+   bson_copy_to_excluding_noinit (src, &expected, "k3", "k50", "k99", NULL);
+   assert (bson_equal (&dst, &expected));
+
+   bson_destroy (&dst);
+   bson_destroy (&expected);
+   bson_projection_destroy (projection);
+   bson_destroy (spec);
+   bson_destroy (src);
+}
+
+
+void
+test_projection_install (TestSuite *suite)
+{
+   TestSuite_Add (suite, "/bson/projection/include", test_projection_include);
+   TestSuite_Add (suite, "/bson/projection/exclude", test_projection_exclude);
+   TestSuite_Add (suite, "/bson/projection/nested", test_projection_nested);
+   TestSuite_Add (suite, "/bson/projection/array", test_projection_array);
+   TestSuite_Add (suite, "/bson/projection/invalid", test_projection_invalid);
+   TestSuite_Add (suite, "/bson/projection/corrupt", test_projection_corrupt);
+   TestSuite_Add (suite, "/bson/projection/matches_copy",
+                  test_projection_matches_copy);
+}
@@ -0,0 +1,668 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <assert.h>
+#include <bcon.h>
+
+#include "bson-tests.h"
+#include "TestSuite.h"
+
+
+#define MAX_DEPTH 16
+
+
+/*
+ * Rebuilds the documents of a stream from a pull parser's events, so that
+ * the result can be compared to the input byte for byte.
+ */
+typedef struct
+{
+   bson_t         docs[MAX_DEPTH];
+   int            depth;
+   uint8_t       *stream;
+   size_t         stream_len;
+   uint8_t       *sliced;
+   size_t         sliced_len;
+   bson_value_t   begin;
+   char           key[64];
+   size_t         slice_size;
+   int            n_docs;
+} rebuild_t;
+
+
+static void
+rebuild_init (rebuild_t *r,
+              size_t     slice_size)
+{
+   memset (r, 0, sizeof *r);
+   r->slice_size = slice_size;
+}
+
+
+static void
+rebuild_append_doc (rebuild_t *r,
+                    bson_t    *doc)
+{
+   r->stream = bson_realloc (r->stream, r->stream_len + doc->len);
+   memcpy (r->stream + r->stream_len, bson_get_data (doc), doc->len);
+   r->stream_len += doc->len;
+   r->n_docs++;
+}
+
+
+static void
+rebuild_end_sliced (rebuild_t *r)
+{
+   bson_t *parent = &r->docs[r->depth - 1];
+   char *str;
+
+   if (r->begin.value_type == BSON_TYPE_BINARY) {
+      assert (r->sliced_len == r->begin.value.v_binary.data_len);
+      /* an empty binary has no slices */
+      bson_append_binary (parent, r->key, -1, r->begin.value.v_binary.subtype,
+                          r->sliced ? r->sliced : (const uint8_t *)"",
+                          (uint32_t)r->sliced_len);
+      return;
+   }
+
+   assert (r->sliced_len == r->begin.value.v_utf8.len);
+   str = bson_malloc (r->sliced_len + 1);
+   if (r->sliced_len) {
+      memcpy (str, r->sliced, r->sliced_len);
+   }
+
+   str[r->sliced_len] = '\0';
+
+   switch (r->begin.value_type) {
+   case BSON_TYPE_CODE:
+      bson_append_code (parent, r->key, -1, str);
+      break;
+   case BSON_TYPE_SYMBOL:
+      bson_append_symbol (parent, r->key, -1, str, (int)r->sliced_len);
+      break;
+   default:
+      assert (r->begin.value_type == BSON_TYPE_UTF8);
+      bson_append_utf8 (parent, r->key, -1, str, (int)r->sliced_len);
+      break;
+   }
+
+   bson_free (str);
+}
+
+
+/* handles every event until input is needed, returns false on error */
+static bool
+rebuild_events (rebuild_t          *r,
+                bson_pull_parser_t *parser,
+                bson_error_t       *error)
+{
+   bson_pull_event_t event;
+   bson_value_t value;
+   const uint8_t *slice;
+   const char *key;
+   uint32_t key_len;
+   size_t len;
+
+   for (;;) {
+      event = bson_pull_parser_next (parser, error);
+      key = bson_pull_parser_get_key (parser, &key_len);
+
+      switch (event) {
+      case BSON_PULL_NEED_INPUT:
+         assert (bson_pull_parser_get_depth (parser) >= (uint32_t)r->depth);
+         return true;
+
+      case BSON_PULL_DOCUMENT_BEGIN:
+         assert (bson_pull_parser_get_depth (parser) == (uint32_t)r->depth);
+         assert (bson_pull_parser_get_value (parser, &value));
+         assert (value.value_type == bson_pull_parser_get_type (parser));
+         assert (value.value.v_doc.data == NULL);
+         assert (value.value.v_doc.data_len >= 5);
+
+         if (r->depth == 0) {
+            assert (!key);
+            bson_init (&r->docs[0]);
+         } else if (value.value_type == BSON_TYPE_ARRAY) {
+            assert (key && strlen (key) == key_len);
+            bson_append_array_begin (&r->docs[r->depth - 1], key, key_len,
+                                     &r->docs[r->depth]);
+         } else {
+            assert (key && value.value_type == BSON_TYPE_DOCUMENT);
+            bson_append_document_begin (&r->docs[r->depth - 1], key,
+                                        key_len, &r->docs[r->depth]);
+         }
+
+         r->depth++;
+         assert (r->depth < MAX_DEPTH);
+         break;
+
+      case BSON_PULL_DOCUMENT_END:
+         assert (!key);
+         r->depth--;
+         assert (bson_pull_parser_get_depth (parser) == (uint32_t)r->depth);
+
+         if (r->depth == 0) {
+            assert (bson_pull_parser_get_type (parser) == BSON_TYPE_DOCUMENT);
+            rebuild_append_doc (r, &r->docs[0]);
+            bson_destroy (&r->docs[0]);
+         } else if (bson_pull_parser_get_type (parser) == BSON_TYPE_ARRAY) {
+            bson_append_array_end (&r->docs[r->depth - 1],
+                                   &r->docs[r->depth]);
+         } else {
+            bson_append_document_end (&r->docs[r->depth - 1],
+                                      &r->docs[r->depth]);
+         }
+
+         break;
+
+      case BSON_PULL_VALUE:
+         assert (key && bson_pull_parser_get_depth (parser) ==
+                 (uint32_t)r->depth);
+         assert (bson_pull_parser_get_value (parser, &value));
+         assert (value.value_type == bson_pull_parser_get_type (parser));
+         assert (bson_append_value (&r->docs[r->depth - 1], key, key_len,
+                                    &value));
+         break;
+
+      case BSON_PULL_VALUE_BEGIN:
+         assert (key && key_len < sizeof r->key);
+         memcpy (r->key, key, key_len + 1);
+         assert (bson_pull_parser_get_value (parser, &r->begin));
+         r->sliced_len = 0;
+         bson_free (r->sliced);
+         r->sliced = NULL;
+         break;
+
+      case BSON_PULL_VALUE_SLICE:
+         assert (!strcmp (key, r->key));
+         assert (!bson_pull_parser_get_value (parser, &value));
+         slice = bson_pull_parser_get_slice (parser, &len);
+         assert (slice && len > 0 && len <= r->slice_size);
+         r->sliced = bson_realloc (r->sliced, r->sliced_len + len);
+         memcpy (r->sliced + r->sliced_len, slice, len);
+         r->sliced_len += len;
+         break;
+
+      case BSON_PULL_VALUE_END:
+         assert (!strcmp (key, r->key));
+         rebuild_end_sliced (r);
+         break;
+
+      case BSON_PULL_ERROR:
+      default:
+         return false;
+      }
+   }
+}
+
+
+static void
+rebuild_destroy (rebuild_t *r)
+{
+   /* embedded documents being built share the top-level one's buffer */
+   if (r->depth > 0) {
+      bson_destroy (&r->docs[0]);
+   }
+
+   bson_free (r->stream);
+   bson_free (r->sliced);
+}
+
+
+/* parses @stream fed in chunks of @chunk bytes and checks the result */
+static void
+check_stream (const uint8_t *stream,
+              size_t         len,
+              int            n_docs,
+              size_t         chunk,
+              size_t         slice_size)
+{
+   bson_pull_parser_t *parser;
+   bson_error_t error;
+   rebuild_t r;
+   size_t off;
+   size_t n;
+
+   parser = bson_pull_parser_new ();
+   bson_pull_parser_set_slice_size (parser, slice_size);
+   rebuild_init (&r, slice_size);
+
+   for (off = 0; off < len; off += n) {
+      n = BSON_MIN (chunk, len - off);
+      bson_pull_parser_feed (parser, stream + off, n);
+      assert (rebuild_events (&r, parser, &error));
+   }
+
+   assert (bson_pull_parser_get_depth (parser) == 0);
+   assert (r.n_docs == n_docs);
+   assert (r.stream_len == len);
+   assert (!memcmp (r.stream, stream, len));
+
+   rebuild_destroy (&r);
+   bson_pull_parser_destroy (parser);
+}
+
+
+static void
+make_docs (bson_t *docs)
+{
+   bson_oid_t oid;
+   char *big;
+   uint8_t bin[300];
+   bson_t scope;
+   int i;
+
+   bson_oid_init_from_string (&oid, "000102030405060708090a0b");
+
+   for (i = 0; i < (int)sizeof bin; i++) {
+      bin[i] = (uint8_t)i;
+   }
+
+   big = bson_malloc (10001);
+   memset (big, 'x', 10000);
+   big[10000] = '\0';
+
+   bson_init (&scope);
+   BSON_APPEND_INT32 (&scope, "x", 1);
+
+   bson_init (&docs[0]);
+   BSON_APPEND_DOUBLE (&docs[0], "double", 1.5);
+   BSON_APPEND_UTF8 (&docs[0], "small", "hello");
+   BSON_APPEND_UTF8 (&docs[0], "empty", "");
+   BSON_APPEND_UTF8 (&docs[0], "big", big);
+   BSON_APPEND_BINARY (&docs[0], "bin", BSON_SUBTYPE_BINARY, bin, 300);
+   BSON_APPEND_BINARY (&docs[0], "bin0", BSON_SUBTYPE_USER, bin, 0);
+   BSON_APPEND_BINARY (&docs[0], "bin2", BSON_SUBTYPE_BINARY_DEPRECATED,
+                       bin, 7);
+   BSON_APPEND_UNDEFINED (&docs[0], "undefined");
+   BSON_APPEND_OID (&docs[0], "oid", &oid);
+   BSON_APPEND_BOOL (&docs[0], "bool", true);
+   BSON_APPEND_DATE_TIME (&docs[0], "date", 1234567890123LL);
+   BSON_APPEND_NULL (&docs[0], "null");
+   BSON_APPEND_REGEX (&docs[0], "regex", "^a.*b$", "imx");
+   BSON_APPEND_REGEX (&docs[0], "regex0", "", "");
+   BSON_APPEND_DBPOINTER (&docs[0], "dbpointer", "db.coll", &oid);
+   BSON_APPEND_CODE (&docs[0], "code", "function () {}");
+   BSON_APPEND_CODE (&docs[0], "bigcode", big + 9000);
+   BSON_APPEND_SYMBOL (&docs[0], "symbol", "sym");
+   BSON_APPEND_SYMBOL (&docs[0], "bigsymbol", big + 9500);
+   BSON_APPEND_CODE_WITH_SCOPE (&docs[0], "codewscope", "f ()", &scope);
+   BSON_APPEND_INT32 (&docs[0], "int32", -7);
+   BSON_APPEND_TIMESTAMP (&docs[0], "timestamp", 100, 2);
+   BSON_APPEND_INT64 (&docs[0], "int64", INT64_MAX);
+   BSON_APPEND_MAXKEY (&docs[0], "maxkey");
+   BSON_APPEND_MINKEY (&docs[0], "minkey");
+
+   bson_init (&docs[1]);
+
+   bson_init (&docs[2]);
+   BCON_APPEND (&docs[2],
+                "a", "[", "{", "b", "[", BCON_INT32 (1), "]", "}",
+                         "{", "}", "[", "]", "]",
+                "c", "{", "d", "{", "e", "{", "f", BCON_UTF8 (big + 5000),
+                                               "g", BCON_INT64 (5),
+                                          "}", "}", "}",
+                "", BCON_UTF8 ("empty key"));
+
+   bson_destroy (&scope);
+   bson_free (big);
+}
+
+
+static uint8_t *
+make_stream (size_t *len)
+{
+   bson_t docs[3];
+   uint8_t *stream = NULL;
+   int i;
+
+   *len = 0;
+   make_docs (docs);
+
+   for (i = 0; i < 3; i++) {
+      stream = bson_realloc (stream, *len + docs[i].len);
+      memcpy (stream + *len, bson_get_data (&docs[i]), docs[i].len);
+      *len += docs[i].len;
+      bson_destroy (&docs[i]);
+   }
+
+   return stream;
+}
+
+
+static void
+test_pull_parser_round_trip (void)
+{
+   static const size_t chunks[] = { 1, 3, 7, 64, 4096 };
+   static const size_t slice_sizes[] = { 1, 5, 100, BSON_PULL_SLICE_SIZE };
+   uint8_t *stream;
+   size_t len;
+   int i;
+   int j;
+
+   stream = make_stream (&len);
+
+   for (i = 0; i < (int)(sizeof chunks / sizeof chunks[0]); i++) {
+      for (j = 0; j < (int)(sizeof slice_sizes / sizeof slice_sizes[0]); j++) {
+         check_stream (stream, len, 3, chunks[i], slice_sizes[j]);
+      }
+   }
+
+   check_stream (stream, len, 3, len, BSON_PULL_SLICE_SIZE);
+
+   bson_free (stream);
+}
+
+
+static void
+test_pull_parser_events (void)
+{
+   bson_pull_parser_t *parser;
+   bson_error_t error;
+   bson_value_t value;
+   const uint8_t *slice;
+   uint32_t key_len;
+   size_t len;
+   bson_t *b;
+
+   b = BCON_NEW ("a", BCON_INT32 (1), "s", BCON_UTF8 ("abcdefgh"));
+   parser = bson_pull_parser_new ();
+   bson_pull_parser_set_slice_size (parser, 4);
+
+   assert (bson_pull_parser_next (parser, &error) == BSON_PULL_NEED_INPUT);
+   assert (bson_pull_parser_get_depth (parser) == 0);
+   assert (bson_pull_parser_get_type (parser) == BSON_TYPE_EOD);
+   assert (!bson_pull_parser_get_key (parser, &key_len));
+   assert (key_len == 0);
+
+   /* the length alone begins the document */
+   bson_pull_parser_feed (parser, bson_get_data (b), 4);
+   assert (bson_pull_parser_next (parser, &error) ==
+           BSON_PULL_DOCUMENT_BEGIN);
+   assert (bson_pull_parser_get_value (parser, &value));
+   assert (value.value_type == BSON_TYPE_DOCUMENT);
+   assert (value.value.v_doc.data_len == b->len);
+   assert (bson_pull_parser_next (parser, &error) == BSON_PULL_NEED_INPUT);
+   assert (bson_pull_parser_get_depth (parser) == 1);
+
+   bson_pull_parser_feed (parser, bson_get_data (b) + 4, b->len - 4);
+   assert (bson_pull_parser_next (parser, &error) == BSON_PULL_VALUE);
+   assert (!strcmp (bson_pull_parser_get_key (parser, &key_len), "a"));
+   assert (key_len == 1);
+   assert (bson_pull_parser_get_depth (parser) == 1);
+   assert (bson_pull_parser_get_type (parser) == BSON_TYPE_INT32);
+   assert (bson_pull_parser_get_value (parser, &value));
+   assert (value.value.v_int32 == 1);
+   assert (!bson_pull_parser_get_slice (parser, &len));
+   assert (len == 0);
+
+   assert (bson_pull_parser_next (parser, &error) == BSON_PULL_VALUE_BEGIN);
+   assert (!strcmp (bson_pull_parser_get_key (parser, NULL), "s"));
+   assert (bson_pull_parser_get_type (parser) == BSON_TYPE_UTF8);
+   assert (bson_pull_parser_get_value (parser, &value));
+   assert (value.value.v_utf8.len == 8);
+   assert (value.value.v_utf8.str == NULL);
+
+   assert (bson_pull_parser_next (parser, &error) == BSON_PULL_VALUE_SLICE);
+   slice = bson_pull_parser_get_slice (parser, &len);
+   assert (len == 4 && !memcmp (slice, "abcd", 4));
+   assert (bson_pull_parser_next (parser, &error) == BSON_PULL_VALUE_SLICE);
+   slice = bson_pull_parser_get_slice (parser, &len);
+   assert (len == 4 && !memcmp (slice, "efgh", 4));
+   assert (bson_pull_parser_next (parser, &error) == BSON_PULL_VALUE_END);
+   assert (!bson_pull_parser_get_value (parser, &value));
+
+   assert (bson_pull_parser_next (parser, &error) == BSON_PULL_DOCUMENT_END);
+   assert (bson_pull_parser_get_depth (parser) == 0);
+   assert (!bson_pull_parser_get_key (parser, NULL));
+   assert (bson_pull_parser_next (parser, &error) == BSON_PULL_NEED_INPUT);
+   assert (bson_pull_parser_get_depth (parser) == 0);
+
+   bson_pull_parser_destroy (parser);
+   bson_destroy (b);
+}
+
+
+static void
+check_corrupt (const uint8_t *data,
+               size_t         len,
+               const char    *message)
+{
+   bson_pull_parser_t *parser;
+   bson_error_t error;
+   rebuild_t r;
+   size_t i;
+   bool ok = true;
+
+   /* fed whole, and byte by byte */
+   parser = bson_pull_parser_new ();
+   rebuild_init (&r, BSON_PULL_SLICE_SIZE);
+   bson_pull_parser_feed (parser, data, len);
+   assert (!rebuild_events (&r, parser, &error));
+   ASSERT_ERROR_CONTAINS (error, BSON_ERROR_PULL, BSON_ERROR_PULL_CORRUPT,
+                          message);
+
+   /* the error persists until the parser is reset */
+   memset (&error, 0, sizeof error);
+   assert (bson_pull_parser_next (parser, &error) == BSON_PULL_ERROR);
+   ASSERT_ERROR_CONTAINS (error, BSON_ERROR_PULL, BSON_ERROR_PULL_CORRUPT,
+                          message);
+   assert (bson_pull_parser_get_type (parser) == BSON_TYPE_EOD);
+
+   rebuild_destroy (&r);
+   bson_pull_parser_reset (parser);
+   rebuild_init (&r, BSON_PULL_SLICE_SIZE);
+
+   for (i = 0; i < len && ok; i++) {
+      bson_pull_parser_feed (parser, data + i, 1);
+      ok = rebuild_events (&r, parser, &error);
+   }
+
+   assert (!ok);
+   ASSERT_ERROR_CONTAINS (error, BSON_ERROR_PULL, BSON_ERROR_PULL_CORRUPT,
+                          message);
+
+   rebuild_destroy (&r);
+   bson_pull_parser_destroy (parser);
+}
+
+
+static void
+test_pull_parser_corrupt (void)
+{
+   /* length too small */
+   static const uint8_t short_len[] = { 4, 0, 0, 0, 0 };
+   /* document ends before its length */
+   static const uint8_t early_end[] = { 6, 0, 0, 0, 0, 0 };
+   /* a field where the terminator should be */
+   static const uint8_t no_end[] = { 8, 0, 0, 0, 0x0a, 'a', 0, 0x0a };
+   /* unknown type */
+   static const uint8_t bad_type[] = { 8, 0, 0, 0, 0x42, 'a', 0, 0 };
+   /* key runs to the end of the document */
+   static const uint8_t bad_key[] = { 8, 0, 0, 0, 0x0a, 'a', 'b', 'c' };
+   /* int32 runs past the end of the document */
+   static const uint8_t bad_int32[] = { 10, 0, 0, 0, 0x10, 'a', 0, 1, 0, 0 };
+   /* string length larger than the document */
+   static const uint8_t bad_utf8[] = {
+      14, 0, 0, 0, 0x02, 'a', 0, 100, 0, 0, 0, 'b', 0, 0 };
+   /* string missing its NUL */
+   static const uint8_t no_nul[] = {
+      14, 0, 0, 0, 0x02, 'a', 0, 2, 0, 0, 0, 'b', 'c', 0 };
+   /* embedded document larger than its parent */
+   static const uint8_t bad_child[] = {
+      13, 0, 0, 0, 0x03, 'a', 0, 50, 0, 0, 0, 0, 0 };
+   /* embedded document that ends early */
+   static const uint8_t early_child[] = {
+      14, 0, 0, 0, 0x03, 'a', 0, 6, 0, 0, 0, 0, 0, 0 };
+   /* code with scope whose scope is longer than the value */
+   static const uint8_t bad_scope[] = {
+      23, 0, 0, 0, 0x0f, 'a', 0, 15, 0, 0, 0, 2, 0, 0, 0, 'x', 0,
+      6, 0, 0, 0, 0, 0 };
+   /* regex flags run to the end of the document */
+   static const uint8_t bad_regex[] = {
+      11, 0, 0, 0, 0x0b, 'a', 0, 'x', 0, 'i', 0 };
+
+   check_corrupt (short_len, sizeof short_len, "invalid document length");
+   check_corrupt (early_end, sizeof early_end,
+                  "document ended before its length");
+   check_corrupt (no_end, sizeof no_end, "missing end of document");
+   check_corrupt (bad_type, sizeof bad_type, "unknown type");
+   check_corrupt (bad_key, sizeof bad_key, "key is not terminated");
+   check_corrupt (bad_int32, sizeof bad_int32, "value exceeds document");
+   check_corrupt (bad_utf8, sizeof bad_utf8, "invalid value length");
+   check_corrupt (no_nul, sizeof no_nul, "invalid value");
+   check_corrupt (bad_child, sizeof bad_child, "invalid document length");
+   check_corrupt (early_child, sizeof early_child,
+                  "document ended before its length");
+   check_corrupt (bad_scope, sizeof bad_scope, "invalid value");
+   check_corrupt (bad_regex, sizeof bad_regex, "regex is not terminated");
+}
+
+
+static void
+test_pull_parser_decimal128 (void)
+{
+   /* {"a": <decimal128 1>} */
+   static const uint8_t data[] = {
+      24, 0, 0, 0, 0x13, 'a', 0,
+      1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x40, 0x30, 0 };
+
+#ifdef BSON_EXPERIMENTAL_FEATURES
+   {
+      bson_pull_parser_t *parser;
+      bson_error_t error;
+
+      parser = bson_pull_parser_new ();
+      bson_pull_parser_feed (parser, data, sizeof data);
+      assert (bson_pull_parser_next (parser, &error) ==
+              BSON_PULL_DOCUMENT_BEGIN);
+      assert (bson_pull_parser_next (parser, &error) == BSON_PULL_VALUE);
+      assert (bson_pull_parser_get_type (parser) == BSON_TYPE_DECIMAL128);
+      assert (bson_pull_parser_next (parser, &error) ==
+              BSON_PULL_DOCUMENT_END);
+      bson_pull_parser_destroy (parser);
+   }
+#else
+   /* the value cannot be boxed without experimental features */
+   check_corrupt (data, sizeof data, "unsupported type");
+#endif
+}
+
+
+static void
+test_pull_parser_reset (void)
+{
+   static const uint8_t bad[] = { 4, 0, 0, 0, 0 };
+   bson_pull_parser_t *parser;
+   bson_error_t error;
+   rebuild_t r;
+   bson_t *b;
+
+   b = BCON_NEW ("x", "[", BCON_INT32 (1), BCON_INT32 (2), "]");
+   parser = bson_pull_parser_new ();
+
+   bson_pull_parser_feed (parser, bad, sizeof bad);
+   assert (bson_pull_parser_next (parser, &error) == BSON_PULL_ERROR);
+
+   /* a reset parser starts a new stream, even mid-document */
+   bson_pull_parser_reset (parser);
+   bson_pull_parser_feed (parser, bson_get_data (b), 11);
+   rebuild_init (&r, BSON_PULL_SLICE_SIZE);
+   assert (rebuild_events (&r, parser, &error));
+   assert (bson_pull_parser_get_depth (parser) == 2);
+   rebuild_destroy (&r);
+
+   bson_pull_parser_reset (parser);
+   assert (bson_pull_parser_get_depth (parser) == 0);
+   bson_pull_parser_feed (parser, bson_get_data (b), b->len);
+   rebuild_init (&r, BSON_PULL_SLICE_SIZE);
+   assert (rebuild_events (&r, parser, &error));
+   assert (r.n_docs == 1);
+   assert (r.stream_len == b->len);
+   assert (!memcmp (r.stream, bson_get_data (b), b->len));
+   rebuild_destroy (&r);
+
+   bson_pull_parser_destroy (parser);
+   bson_destroy (b);
+}
+
+
+static void
+test_pull_parser_deep (void)
+{
+   bson_t docs[100];
+   uint8_t *stream;
+   size_t len;
+   int i;
+
+   /* deeper than the parser's initial stack */
+   bson_init (&docs[0]);
+
+   for (i = 1; i < 100; i++) {
+      bson_append_document_begin (&docs[i - 1], "d", 1, &docs[i]);
+   }
+
+   BSON_APPEND_INT32 (&docs[99], "x", 1);
+
+   for (i = 99; i > 0; i--) {
+      bson_append_document_end (&docs[i - 1], &docs[i]);
+   }
+
+   len = docs[0].len;
+   stream = bson_malloc (len);
+   memcpy (stream, bson_get_data (&docs[0]), len);
+   bson_destroy (&docs[0]);
+
+   /* events rather than a rebuild, which is limited to MAX_DEPTH */
+   {
+      bson_pull_parser_t *parser = bson_pull_parser_new ();
+      bson_pull_event_t event;
+      uint32_t max_depth = 0;
+      int n_begin = 0;
+      int n_end = 0;
+
+      bson_pull_parser_feed (parser, stream, len);
+
+      while ((event = bson_pull_parser_next (parser, NULL)) !=
+             BSON_PULL_NEED_INPUT) {
+         assert (event != BSON_PULL_ERROR);
+         n_begin += event == BSON_PULL_DOCUMENT_BEGIN;
+         n_end += event == BSON_PULL_DOCUMENT_END;
+         max_depth = BSON_MAX (max_depth, bson_pull_parser_get_depth (parser));
+      }
+
+      assert (n_begin == 100 && n_end == 100);
+      assert (max_depth == 100);
+      bson_pull_parser_destroy (parser);
+   }
+
+   bson_free (stream);
+}
+
+
+void
+test_pull_parser_install (TestSuite *suite)
+{
+   TestSuite_Add (suite, "/bson/pull_parser/round_trip",
+                  test_pull_parser_round_trip);
+   TestSuite_Add (suite, "/bson/pull_parser/events", test_pull_parser_events);
+   TestSuite_Add (suite, "/bson/pull_parser/corrupt", test_pull_parser_corrupt);
+   TestSuite_Add (suite, "/bson/pull_parser/decimal128",
+                  test_pull_parser_decimal128);
+   TestSuite_Add (suite, "/bson/pull_parser/reset", test_pull_parser_reset);
+   TestSuite_Add (suite, "/bson/pull_parser/deep", test_pull_parser_deep);
+}
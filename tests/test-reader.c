@@ -16,7 +16,11 @@
 
 
 #include <assert.h>
+#include <bcon.h>
 #include <fcntl.h>
+#ifndef _WIN32
+# include <unistd.h>
+#endif
 
 #include "bson-tests.h"
 #include "TestSuite.h"
@@ -313,6 +317,304 @@ test_reader_reset (void)
 }
 
 
+static void
+test_reader_seek_resync_data (void)
+{
+   uint8_t buffer[1024];
+   size_t offsets[10];
+   size_t len = 0;
+   bson_reader_t *reader;
+   const bson_t *b;
+   bson_iter_t iter;
+   bson_t doc;
+   bool eof;
+   int i;
+
+   for (i = 0; i < 10; i++) {
+      bson_init (&doc);
+      BSON_APPEND_INT32 (&doc, "i", i);
+      BSON_APPEND_UTF8 (&doc, "s", "\x05\x06\x07");
+      assert (len + doc.len <= sizeof buffer);
+      offsets[i] = len;
+      memcpy (&buffer[len], bson_get_data (&doc), doc.len);
+      len += doc.len;
+      bson_destroy (&doc);
+   }
+
+   reader = bson_reader_new_from_data (buffer, len);
+
+   /* resync from within the fourth document lands on the fifth */
+   assert (bson_reader_seek_resync (reader, (off_t)offsets[3] + 1));
+   assert_cmpint ((off_t)offsets[4], ==, bson_reader_tell (reader));
+   b = bson_reader_read (reader, &eof);
+   assert (b);
+   assert (bson_iter_init_find (&iter, b, "i"));
+   assert_cmpint (4, ==, bson_iter_int32 (&iter));
+
+   /* resync on a boundary is a no-op */
+   assert (bson_reader_seek_resync (reader, (off_t)offsets[1]));
+   assert_cmpint ((off_t)offsets[1], ==, bson_reader_tell (reader));
+
+   /* the final documents still form a chain that ends at end of data */
+   assert (bson_reader_seek_resync (reader, (off_t)offsets[8] + 2));
+   assert_cmpint ((off_t)offsets[9], ==, bson_reader_tell (reader));
+
+   assert (!bson_reader_seek_resync (reader, (off_t)offsets[9] + 1));
+   assert (!bson_reader_seek_resync (reader, (off_t)len + 1));
+
+   bson_reader_destroy (reader);
+}
+
+
+static void
+test_reader_seek_resync_fd (void)
+{
+   bson_reader_t *reader;
+   bson_error_t error;
+   const bson_t *b;
+   bool eof = false;
+   int count = 0;
+
+   reader = bson_reader_new_from_file (BINARY_DIR"/stream.bson", &error);
+   assert (reader);
+
+   assert (bson_reader_seek_resync (reader, 2503));
+   assert_cmpint (2505, ==, bson_reader_tell (reader));
+
+   while ((b = bson_reader_read (reader, &eof))) {
+      count++;
+   }
+
+   assert (eof);
+   assert_cmpint (count, ==, 499);
+
+   /* seeking backwards is allowed on file descriptors */
+   assert (bson_reader_seek_resync (reader, 10));
+   assert_cmpint (10, ==, bson_reader_tell (reader));
+   assert (bson_reader_read (reader, &eof));
+
+   assert (!bson_reader_seek_resync (reader, 5001));
+
+   bson_reader_destroy (reader);
+}
+
+
+static void
+test_reader_seek_resync_handle (void)
+{
+   bson_reader_t *reader;
+   int fd;
+
+   fd = bson_open (BINARY_DIR"/stream.bson", O_RDONLY);
+   assert (-1 != fd);
+
+   reader = bson_reader_new_from_handle ((void *)&fd,
+                                         &test_reader_from_handle_read,
+                                         &test_reader_from_handle_destroy);
+
+   assert (bson_reader_seek_resync (reader, 1001));
+   assert_cmpint (1005, ==, bson_reader_tell (reader));
+
+   /* generic handles can only move forward */
+   assert (!bson_reader_seek_resync (reader, 0));
+
+   bson_reader_destroy (reader);
+}
+
+
+static void
+test_partition_file (void)
+{
+   bson_reader_t *reader;
+   bson_error_t error;
+   off_t offsets[8];
+   bool eof;
+   int count = 0;
+   int i;
+
+   assert (bson_partition_file (BINARY_DIR"/stream.bson", 7, offsets, &error));
+   assert_cmpint (0, ==, offsets[0]);
+   assert_cmpint (5000, ==, offsets[7]);
+
+   for (i = 0; i < 7; i++) {
+      assert_cmpint (offsets[i], <=, offsets[i + 1]);
+      assert (offsets[i] % 5 == 0);
+
+      reader = bson_reader_new_from_file (BINARY_DIR"/stream.bson", &error);
+      assert (reader);
+
+      if (offsets[i] < offsets[i + 1]) {
+         assert (bson_reader_seek_resync (reader, offsets[i]));
+
+         while (bson_reader_tell (reader) < offsets[i + 1]) {
+            assert (bson_reader_read (reader, &eof));
+            count++;
+         }
+      }
+
+      bson_reader_destroy (reader);
+   }
+
+   assert_cmpint (count, ==, 1000);
+
+   assert (!bson_partition_file (BINARY_DIR"/does-not-exist.bson", 2,
+                                 offsets, &error));
+   assert_cmpint (error.domain, ==, BSON_ERROR_READER);
+}
+
+
+static void
+test_reader_feed (void)
+{
+   bson_reader_t *reader;
+   const bson_t *b;
+   bson_iter_t iter;
+   uint8_t *stream = NULL;
+   size_t stream_len = 0;
+   size_t chunk;
+   size_t off;
+   size_t n;
+   char big[3000];
+   bson_t *doc;
+   bool eof;
+   int count;
+   int i;
+
+   memset (big, 'x', sizeof big - 1);
+   big[sizeof big - 1] = '\0';
+
+   /* the large documents outgrow the initial buffer */
+   for (i = 0; i < 10; i++) {
+      doc = BCON_NEW ("i", BCON_INT32 (i),
+                      "s", BCON_UTF8 (i % 3 ? "small" : big));
+      stream = bson_realloc (stream, stream_len + doc->len);
+      memcpy (stream + stream_len, bson_get_data (doc), doc->len);
+      stream_len += doc->len;
+      bson_destroy (doc);
+   }
+
+   for (chunk = 1; chunk < 8; chunk += 3) {
+      reader = bson_reader_new_from_feed ();
+      count = 0;
+
+      b = bson_reader_read (reader, &eof);
+      assert (!b);
+      assert (!eof);
+      assert (bson_reader_would_block (reader));
+
+      for (off = 0; off < stream_len; off += n) {
+         n = BSON_MIN (chunk, stream_len - off);
+         bson_reader_feed (reader, stream + off, n);
+
+         while ((b = bson_reader_read (reader, &eof))) {
+            assert (bson_iter_init_find (&iter, b, "i"));
+            assert_cmpint (bson_iter_int32 (&iter), ==, count);
+            count++;
+         }
+
+         assert (!eof);
+         assert (bson_reader_would_block (reader));
+      }
+
+      assert_cmpint (count, ==, 10);
+      assert_cmpint (bson_reader_tell (reader), ==, (off_t)stream_len);
+
+      /* feeding nothing ends the stream */
+      bson_reader_feed (reader, stream, 0);
+      assert (!bson_reader_read (reader, &eof));
+      assert (eof);
+      assert (!bson_reader_would_block (reader));
+
+      bson_reader_destroy (reader);
+   }
+
+   bson_free (stream);
+}
+
+
+static void
+test_reader_feed_eof (void)
+{
+   bson_reader_t *reader;
+   const bson_t *b;
+   bson_iter_t iter;
+   bson_t *doc;
+   bool eof;
+   int i;
+
+   reader = bson_reader_new_from_feed ();
+
+   for (i = 0; i < 2; i++) {
+      doc = BCON_NEW ("i", BCON_INT32 (i));
+      bson_reader_feed (reader, bson_get_data (doc), doc->len);
+      bson_destroy (doc);
+   }
+
+   /* the end of the stream comes after the documents fed before it */
+   bson_reader_feed (reader, NULL, 0);
+
+   for (i = 0; i < 2; i++) {
+      b = bson_reader_read (reader, &eof);
+      assert (b);
+      assert (bson_iter_init_find (&iter, b, "i"));
+      assert_cmpint (bson_iter_int32 (&iter), ==, i);
+   }
+
+   assert (!bson_reader_read (reader, &eof));
+   assert (eof);
+   assert (!bson_reader_would_block (reader));
+
+   bson_reader_destroy (reader);
+}
+
+
+#ifndef _WIN32
+static void
+test_reader_nonblocking_fd (void)
+{
+   bson_reader_t *reader;
+   const bson_t *b;
+   bson_t *doc;
+   bool eof;
+   int fds[2];
+
+   doc = BCON_NEW ("hello", BCON_UTF8 ("world"));
+
+   assert (pipe (fds) == 0);
+   assert (fcntl (fds[0], F_SETFL, O_NONBLOCK) == 0);
+
+   /* creating the reader does not read */
+   reader = bson_reader_new_from_fd (fds[0], true);
+   bson_reader_set_nonblocking (reader, true);
+
+   b = bson_reader_read (reader, &eof);
+   assert (!b && !eof);
+   assert (bson_reader_would_block (reader));
+
+   /* half a document is kept while waiting for the rest */
+   assert (write (fds[1], bson_get_data (doc), 7) == 7);
+   b = bson_reader_read (reader, &eof);
+   assert (!b && !eof);
+   assert (bson_reader_would_block (reader));
+
+   assert (write (fds[1], bson_get_data (doc) + 7, doc->len - 7) ==
+           (ssize_t)(doc->len - 7));
+   b = bson_reader_read (reader, &eof);
+   assert (b);
+   assert (!bson_reader_would_block (reader));
+   assert (bson_equal (b, doc));
+
+   close (fds[1]);
+   b = bson_reader_read (reader, &eof);
+   assert (!b && eof);
+   assert (!bson_reader_would_block (reader));
+
+   bson_reader_destroy (reader);
+   bson_destroy (doc);
+}
+#endif
+
+
 void
 test_reader_install (TestSuite *suite)
 {
@@ -329,4 +631,17 @@ test_reader_install (TestSuite *suite)
                   test_reader_from_handle_corrupt);
    TestSuite_Add (suite, "/bson/reader/grow_buffer", test_reader_grow_buffer);
    TestSuite_Add (suite, "/bson/reader/reset", test_reader_reset);
+   TestSuite_Add (suite, "/bson/reader/seek_resync_data",
+                  test_reader_seek_resync_data);
+   TestSuite_Add (suite, "/bson/reader/seek_resync_fd",
+                  test_reader_seek_resync_fd);
+   TestSuite_Add (suite, "/bson/reader/seek_resync_handle",
+                  test_reader_seek_resync_handle);
+   TestSuite_Add (suite, "/bson/reader/feed", test_reader_feed);
+   TestSuite_Add (suite, "/bson/reader/feed_eof", test_reader_feed_eof);
+#ifndef _WIN32
+   TestSuite_Add (suite, "/bson/reader/nonblocking_fd",
+                  test_reader_nonblocking_fd);
+#endif
+   TestSuite_Add (suite, "/bson/partition_file", test_partition_file);
 }
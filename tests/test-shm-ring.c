@@ -0,0 +1,459 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <assert.h>
+#include <bcon.h>
+#include <bson.h>
+#define BSON_INSIDE
+#include "bson-thread-private.h"
+#undef BSON_INSIDE
+#include <stdio.h>
+
+#include "bson-tests.h"
+#include "TestSuite.h"
+
+
+#define N_PRODUCERS     4
+#define N_PER_PRODUCER  5000
+
+
+typedef struct
+{
+   uint8_t         *alloc;
+   uint8_t         *mem;
+   size_t           size;
+   bson_shm_ring_t *ring;
+} ring_fixture_t;
+
+
+static void
+ring_fixture_init (ring_fixture_t *fixture,
+                   size_t          capacity)
+{
+   bson_error_t error;
+
+   fixture->size = bson_shm_ring_get_required_size (capacity);
+   assert (fixture->size);
+   fixture->alloc = bson_malloc0 (fixture->size + 64);
+   fixture->mem = fixture->alloc + (64 - ((uintptr_t)fixture->alloc & 63));
+   fixture->ring = bson_shm_ring_new (fixture->mem, fixture->size, &error);
+   assert (fixture->ring);
+}
+
+
+static void
+ring_fixture_destroy (ring_fixture_t *fixture)
+{
+   bson_shm_ring_destroy (fixture->ring);
+   bson_free (fixture->alloc);
+}
+
+
+static void
+assert_doc_int32 (const bson_t *bson,
+                  const char   *key,
+                  int32_t       value)
+{
+   bson_iter_t iter;
+
+   assert (bson);
+   assert (bson_iter_init_find (&iter, bson, key));
+   assert (BSON_ITER_HOLDS_INT32 (&iter));
+   assert (bson_iter_int32 (&iter) == value);
+}
+
+
+static void
+test_shm_ring_push_read (void)
+{
+   ring_fixture_t fixture;
+   const bson_t *doc;
+   bson_t *b;
+   bool eof;
+   int32_t i;
+   int32_t j;
+
+   ring_fixture_init (&fixture, 1024);
+
+   /* wrap around the data area many times, several records at a time */
+   for (i = 0; i < 1000; i += 5) {
+      for (j = i; j < i + 5; j++) {
+         b = BCON_NEW ("i", BCON_INT32 (j), "s", "some padding text");
+         assert (bson_shm_ring_push (fixture.ring, b, 0));
+         bson_destroy (b);
+      }
+
+      for (j = i; j < i + 5; j++) {
+         doc = bson_shm_ring_read (fixture.ring, 0, &eof);
+         assert_doc_int32 (doc, "i", j);
+         assert (!eof);
+      }
+   }
+
+   assert (!bson_shm_ring_read (fixture.ring, 0, &eof));
+   assert (!eof);
+
+   ring_fixture_destroy (&fixture);
+}
+
+
+static void
+test_shm_ring_begin_end (void)
+{
+   ring_fixture_t fixture;
+   const bson_t *doc;
+   bson_t *b;
+   char big[200];
+   int32_t i;
+
+   ring_fixture_init (&fixture, 1024);
+   memset (big, 'x', sizeof big - 1);
+   big[sizeof big - 1] = '\0';
+
+   /* unused room is returned, so a generous max_size does not fill up */
+   for (i = 0; i < 100; i++) {
+      assert (bson_shm_ring_begin (fixture.ring, 200, 0, &b));
+      assert (BSON_APPEND_INT32 (b, "i", i));
+      bson_shm_ring_end (fixture.ring, b);
+
+      doc = bson_shm_ring_read (fixture.ring, 0, NULL);
+      assert_doc_int32 (doc, "i", i);
+      assert (doc->len == 12);
+   }
+
+   /* appending past max_size fails, leaving a valid document */
+   assert (bson_shm_ring_begin (fixture.ring, 100, 0, &b));
+   assert (BSON_APPEND_INT32 (b, "i", 1));
+   assert (!BSON_APPEND_UTF8 (b, "big", big));
+   bson_shm_ring_end (fixture.ring, b);
+   doc = bson_shm_ring_read (fixture.ring, 0, NULL);
+   assert_doc_int32 (doc, "i", 1);
+   assert (doc->len == 12);
+
+   /* a rolled back document is never read */
+   assert (bson_shm_ring_begin (fixture.ring, 100, 0, &b));
+   assert (BSON_APPEND_INT32 (b, "i", 2));
+   bson_shm_ring_rollback (fixture.ring, b);
+   assert (!bson_shm_ring_read (fixture.ring, 0, NULL));
+
+   assert (bson_shm_ring_begin (fixture.ring, 100, 0, &b));
+   assert (BSON_APPEND_INT32 (b, "i", 3));
+   bson_shm_ring_end (fixture.ring, b);
+   assert_doc_int32 (bson_shm_ring_read (fixture.ring, 0, NULL), "i", 3);
+
+   ring_fixture_destroy (&fixture);
+}
+
+
+static void
+test_shm_ring_interleaved (void)
+{
+   ring_fixture_t fixture;
+   bson_shm_ring_t *other;
+   bson_error_t error;
+   bson_t *a;
+   bson_t *b;
+
+   ring_fixture_init (&fixture, 1024);
+   other = bson_shm_ring_attach (fixture.mem, fixture.size, &error);
+   assert (other);
+
+   /* the record reserved first is read first, whichever ends first */
+   assert (bson_shm_ring_begin (fixture.ring, 100, 0, &a));
+   assert (bson_shm_ring_begin (other, 100, 0, &b));
+   assert (BSON_APPEND_INT32 (b, "i", 2));
+   assert (BSON_APPEND_INT32 (a, "i", 1));
+
+   /* "a" cannot shrink once "b" is reserved after it */
+   bson_shm_ring_end (fixture.ring, a);
+   bson_shm_ring_end (other, b);
+
+   assert_doc_int32 (bson_shm_ring_read (fixture.ring, 0, NULL), "i", 1);
+   assert_doc_int32 (bson_shm_ring_read (fixture.ring, 0, NULL), "i", 2);
+
+   /* a rollback before another reservation is published as a skip */
+   assert (bson_shm_ring_begin (fixture.ring, 100, 0, &a));
+   assert (bson_shm_ring_begin (other, 100, 0, &b));
+   assert (BSON_APPEND_INT32 (b, "i", 3));
+   bson_shm_ring_rollback (fixture.ring, a);
+   bson_shm_ring_end (other, b);
+
+   assert_doc_int32 (bson_shm_ring_read (fixture.ring, 0, NULL), "i", 3);
+   assert (!bson_shm_ring_read (fixture.ring, 0, NULL));
+
+   bson_shm_ring_destroy (other);
+   ring_fixture_destroy (&fixture);
+}
+
+
+static void
+test_shm_ring_full (void)
+{
+   ring_fixture_t fixture;
+   bson_t *b;
+   bson_t *big;
+   char str[600];
+   int n = 0;
+
+   ring_fixture_init (&fixture, 1024);
+   memset (str, 'x', sizeof str - 1);
+   str[sizeof str - 1] = '\0';
+
+   assert (bson_shm_ring_get_max_size (fixture.ring) == 504);
+   big = BCON_NEW ("s", str);
+   assert (!bson_shm_ring_push (fixture.ring, big, -1));
+   assert (!bson_shm_ring_begin (fixture.ring, 505, -1, &b));
+
+   b = BCON_NEW ("i", BCON_INT32 (1));
+
+   while (bson_shm_ring_push (fixture.ring, b, 0)) {
+      n++;
+   }
+
+   /* 16 byte documents in 24 byte records */
+   assert (n == 1024 / 24);
+   assert (!bson_shm_ring_push (fixture.ring, b, 1000));
+
+   /* the first document read is still held, the second frees it */
+   assert (bson_shm_ring_read (fixture.ring, 0, NULL));
+   assert (!bson_shm_ring_push (fixture.ring, b, 0));
+   assert (bson_shm_ring_read (fixture.ring, 0, NULL));
+   assert (bson_shm_ring_push (fixture.ring, b, 0));
+
+   bson_destroy (big);
+   bson_destroy (b);
+   ring_fixture_destroy (&fixture);
+}
+
+
+static void
+test_shm_ring_close (void)
+{
+   ring_fixture_t fixture;
+   bool eof = true;
+   bson_t *b;
+
+   ring_fixture_init (&fixture, 1024);
+
+   assert (!bson_shm_ring_read (fixture.ring, 1000, &eof));
+   assert (!eof);
+
+   b = BCON_NEW ("i", BCON_INT32 (1));
+   assert (bson_shm_ring_push (fixture.ring, b, 0));
+   assert (bson_shm_ring_push (fixture.ring, b, 0));
+   bson_shm_ring_close (fixture.ring);
+   assert (!bson_shm_ring_push (fixture.ring, b, 0));
+
+   assert (bson_shm_ring_read (fixture.ring, -1, &eof));
+   assert (!eof);
+   assert (bson_shm_ring_read (fixture.ring, -1, &eof));
+   assert (!eof);
+   assert (!bson_shm_ring_read (fixture.ring, -1, &eof));
+   assert (eof);
+
+   bson_destroy (b);
+   ring_fixture_destroy (&fixture);
+}
+
+
+static void
+test_shm_ring_attach_errors (void)
+{
+   ring_fixture_t fixture;
+   bson_shm_ring_t *ring;
+   bson_error_t error;
+
+   ring_fixture_init (&fixture, 4096);
+
+   assert (!bson_shm_ring_get_required_size (512));
+   assert (!bson_shm_ring_get_required_size (3000));
+   assert (bson_shm_ring_get_required_size (1024) == 1024 + 256);
+
+   assert (!bson_shm_ring_new (fixture.mem + 8, fixture.size - 8, &error));
+   ASSERT_ERROR_CONTAINS (error, BSON_ERROR_SHM_RING,
+                          BSON_ERROR_SHM_RING_INVALID, "aligned");
+   assert (!bson_shm_ring_new (fixture.mem, 1024, &error));
+   ASSERT_ERROR_CONTAINS (error, BSON_ERROR_SHM_RING,
+                          BSON_ERROR_SHM_RING_INVALID, "too small");
+
+   assert (!bson_shm_ring_attach (fixture.mem, 2048, &error));
+   ASSERT_ERROR_CONTAINS (error, BSON_ERROR_SHM_RING,
+                          BSON_ERROR_SHM_RING_INVALID, "does not fit");
+
+   ring = bson_shm_ring_attach (fixture.mem, fixture.size, &error);
+   assert (ring);
+   assert (bson_shm_ring_get_max_size (ring) == 2040);
+   bson_shm_ring_destroy (ring);
+
+   /* a size that is not a power of two is rounded down */
+   ring = bson_shm_ring_new (fixture.mem, fixture.size - 1, &error);
+   assert (ring);
+   assert (bson_shm_ring_get_max_size (ring) == 1016);
+   bson_shm_ring_destroy (ring);
+
+   memset (fixture.mem, 0, 4);
+   assert (!bson_shm_ring_attach (fixture.mem, fixture.size, &error));
+   ASSERT_ERROR_CONTAINS (error, BSON_ERROR_SHM_RING,
+                          BSON_ERROR_SHM_RING_INVALID, "does not hold");
+
+   ring_fixture_destroy (&fixture);
+}
+
+
+#ifndef _WIN32
+static void
+test_shm_ring_fd (void)
+{
+   bson_shm_ring_t *producer;
+   bson_shm_ring_t *consumer;
+   bson_error_t error;
+   FILE *file;
+   bson_t *b;
+   int fd;
+
+   file = tmpfile ();
+   assert (file);
+   fd = fileno (file);
+
+   assert (!bson_shm_ring_new_from_fd (fd, 1000, &error));
+   ASSERT_ERROR_CONTAINS (error, BSON_ERROR_SHM_RING,
+                          BSON_ERROR_SHM_RING_INVALID, "power of two");
+
+   producer = bson_shm_ring_new_from_fd (fd, 8192, &error);
+   assert (producer);
+   consumer = bson_shm_ring_attach_fd (fd, &error);
+   assert (consumer);
+   fclose (file);
+
+   b = BCON_NEW ("i", BCON_INT32 (7));
+   assert (bson_shm_ring_push (producer, b, 0));
+   bson_shm_ring_close (producer);
+   bson_destroy (b);
+
+   assert_doc_int32 (bson_shm_ring_read (consumer, 0, NULL), "i", 7);
+   assert (!bson_shm_ring_read (consumer, 0, NULL));
+
+   bson_shm_ring_destroy (producer);
+   bson_shm_ring_destroy (consumer);
+
+   assert (!bson_shm_ring_attach_fd (-1, &error));
+   ASSERT_ERROR_CONTAINS (error, BSON_ERROR_SHM_RING,
+                          BSON_ERROR_SHM_RING_MAP, "Failed to map");
+}
+#endif
+
+
+typedef struct
+{
+   ring_fixture_t *fixture;
+   int32_t         id;
+} producer_t;
+
+
+static void *
+producer_worker (void *data)
+{
+   producer_t *producer = data;
+   bson_shm_ring_t *ring;
+   bson_error_t error;
+   bson_t *b;
+   int32_t i;
+
+   ring = bson_shm_ring_attach (producer->fixture->mem,
+                                producer->fixture->size, &error);
+   assert (ring);
+
+   for (i = 0; i < N_PER_PRODUCER; i++) {
+      assert (bson_shm_ring_begin (ring, 64 + (i % 7) * 50, -1, &b));
+      assert (BSON_APPEND_INT32 (b, "p", producer->id));
+      assert (BSON_APPEND_INT32 (b, "i", i));
+
+      if (i % 10 == 9) {
+         bson_shm_ring_rollback (ring, b);
+      } else {
+         bson_shm_ring_end (ring, b);
+      }
+   }
+
+   bson_shm_ring_destroy (ring);
+
+   return NULL;
+}
+
+
+static void
+test_shm_ring_threads (void)
+{
+   bson_thread_t threads[N_PRODUCERS];
+   producer_t producers[N_PRODUCERS];
+   int32_t next[N_PRODUCERS] = { 0 };
+   ring_fixture_t fixture;
+   const bson_t *doc;
+   bson_iter_t iter;
+   int32_t p;
+   int32_t i;
+   int n = 0;
+
+   ring_fixture_init (&fixture, 4096);
+
+   for (p = 0; p < N_PRODUCERS; p++) {
+      producers[p].fixture = &fixture;
+      producers[p].id = p;
+      bson_thread_create (&threads[p], producer_worker, &producers[p]);
+   }
+
+   /* each producer's documents arrive in order, without its rollbacks */
+   while (n < N_PRODUCERS * (N_PER_PRODUCER - N_PER_PRODUCER / 10)) {
+      doc = bson_shm_ring_read (fixture.ring, -1, NULL);
+      assert (doc);
+      assert (bson_iter_init_find (&iter, doc, "p"));
+      p = bson_iter_int32 (&iter);
+      assert (p >= 0 && p < N_PRODUCERS);
+      assert (bson_iter_init_find (&iter, doc, "i"));
+      i = bson_iter_int32 (&iter);
+      assert (i == next[p]);
+      next[p] = i % 10 == 8 ? i + 2 : i + 1;
+      n++;
+   }
+
+   for (p = 0; p < N_PRODUCERS; p++) {
+      bson_thread_join (threads[p]);
+   }
+
+   bson_shm_ring_close (fixture.ring);
+   assert (!bson_shm_ring_read (fixture.ring, 0, NULL));
+
+   ring_fixture_destroy (&fixture);
+}
+
+
+void
+test_shm_ring_install (TestSuite *suite)
+{
+   TestSuite_Add (suite, "/bson/shm_ring/push_read", test_shm_ring_push_read);
+   TestSuite_Add (suite, "/bson/shm_ring/begin_end", test_shm_ring_begin_end);
+   TestSuite_Add (suite, "/bson/shm_ring/interleaved",
+                  test_shm_ring_interleaved);
+   TestSuite_Add (suite, "/bson/shm_ring/full", test_shm_ring_full);
+   TestSuite_Add (suite, "/bson/shm_ring/close", test_shm_ring_close);
+   TestSuite_Add (suite, "/bson/shm_ring/attach_errors",
+                  test_shm_ring_attach_errors);
+#ifndef _WIN32
+   TestSuite_Add (suite, "/bson/shm_ring/fd", test_shm_ring_fd);
+#endif
+   TestSuite_Add (suite, "/bson/shm_ring/threads", test_shm_ring_threads);
+}
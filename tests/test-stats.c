@@ -0,0 +1,267 @@
+/*
+ * Copyright 2016 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <assert.h>
+#include <bcon.h>
+
+#define BSON_INSIDE
+#include "bson-thread-private.h"
+#undef BSON_INSIDE
+
+#include "bson-tests.h"
+#include "TestSuite.h"
+
+
+#define N_THREADS    4
+#define N_PER_THREAD 100
+
+
+static int64_t
+stats_get (const bson_t *snapshot,
+           const char   *path)
+{
+   bson_iter_t iter;
+   bson_iter_t child;
+
+   if (!bson_iter_init (&iter, snapshot) ||
+       !bson_iter_find_descendant (&iter, path, &child)) {
+      return 0;
+   }
+
+   assert (BSON_ITER_HOLDS_INT64 (&child));
+
+   return bson_iter_int64 (&child);
+}
+
+
+/* the summary fields agree with the buckets they were computed from */
+static void
+stats_check_histogram (const bson_t *snapshot,
+                       const char   *path)
+{
+   bson_iter_t iter;
+   bson_iter_t hist;
+   bson_iter_t buckets;
+   bson_iter_t bucket;
+   int64_t count = 0;
+   int64_t prev = -1;
+   int64_t le;
+   int64_t p50, p90, p99, p999, min, max;
+
+   assert (bson_iter_init (&iter, snapshot));
+   assert (bson_iter_find_descendant (&iter, path, &hist));
+   assert (BSON_ITER_HOLDS_DOCUMENT (&hist));
+   assert (bson_iter_recurse (&hist, &iter));
+   assert (bson_iter_find (&iter, "buckets"));
+   assert (bson_iter_recurse (&iter, &buckets));
+
+   while (bson_iter_next (&buckets)) {
+      assert (bson_iter_recurse (&buckets, &bucket));
+      assert (bson_iter_find (&bucket, "le_ns"));
+      le = bson_iter_int64 (&bucket);
+      assert (le > prev);
+      prev = le;
+      assert (bson_iter_find (&bucket, "count"));
+      assert (bson_iter_int64 (&bucket) > 0);
+      count += bson_iter_int64 (&bucket);
+   }
+
+   assert (bson_iter_recurse (&hist, &iter));
+   assert (bson_iter_find (&iter, "count"));
+   assert (bson_iter_int64 (&iter) == count);
+
+   assert (bson_iter_find (&iter, "sum_ns"));
+   assert (bson_iter_find (&iter, "min_ns"));
+   min = bson_iter_int64 (&iter);
+   assert (bson_iter_find (&iter, "max_ns"));
+   max = bson_iter_int64 (&iter);
+   assert (bson_iter_find (&iter, "p50_ns"));
+   p50 = bson_iter_int64 (&iter);
+   assert (bson_iter_find (&iter, "p90_ns"));
+   p90 = bson_iter_int64 (&iter);
+   assert (bson_iter_find (&iter, "p99_ns"));
+   p99 = bson_iter_int64 (&iter);
+   assert (bson_iter_find (&iter, "p999_ns"));
+   p999 = bson_iter_int64 (&iter);
+
+   assert (min <= p50);
+   assert (p50 <= p90 && p90 <= p99 && p99 <= p999 && p999 <= max);
+   assert (max <= prev);
+}
+
+
+static void
+test_stats_disabled (void)
+{
+   bson_t snapshot;
+   bson_t *b;
+   bson_iter_t iter;
+   bson_iter_t child;
+
+   bson_stats_set_enabled (false);
+   bson_stats_reset ();
+
+   b = BCON_NEW ("a", BCON_INT32 (1));
+   assert (bson_validate (b, BSON_VALIDATE_NONE, NULL));
+   bson_free (bson_as_json (b, NULL));
+
+   bson_stats_snapshot (&snapshot);
+   assert (bson_iter_init_find (&iter, &snapshot, "enabled"));
+   assert (!bson_iter_bool (&iter));
+
+   /* every operation is present, with nothing recorded */
+   assert (bson_iter_init_find (&iter, &snapshot, "bson_validate"));
+   assert (bson_iter_recurse (&iter, &child));
+   assert (!bson_iter_next (&child));
+   assert (bson_iter_init_find (&iter, &snapshot, "bson_reader_read"));
+   assert (bson_iter_recurse (&iter, &child));
+   assert (!bson_iter_next (&child));
+
+   bson_destroy (&snapshot);
+   bson_destroy (b);
+}
+
+
+static void
+test_stats_operations (void)
+{
+   const char *json = "{\"a\": 1}";
+   bson_reader_t *reader;
+   bson_error_t error;
+   bson_t snapshot;
+   bson_t big = BSON_INITIALIZER;
+   bson_t small;
+   uint8_t *data;
+   bool eof;
+   int i;
+
+   bson_stats_set_enabled (true);
+   bson_stats_reset ();
+   assert (bson_stats_get_enabled ());
+
+   /* 8 bytes of JSON, and a 2 KiB document */
+   assert (bson_init_from_json (&small, json, -1, &error));
+
+   for (i = 0; i < 200; i++) {
+      BSON_APPEND_INT32 (&big, "k", i);
+   }
+
+   assert (big.len >= 1024 && big.len < 16384);
+
+   for (i = 0; i < 3; i++) {
+      assert (bson_validate (&big, BSON_VALIDATE_NONE, NULL));
+   }
+
+   bson_free (bson_as_json (&small, NULL));
+
+   /* two documents, then end of stream, which is not timed */
+   data = bson_malloc (small.len + big.len);
+   memcpy (data, bson_get_data (&small), small.len);
+   memcpy (data + small.len, bson_get_data (&big), big.len);
+   reader = bson_reader_new_from_data (data, small.len + big.len);
+   assert (bson_reader_read (reader, &eof));
+   assert (bson_reader_read (reader, &eof));
+   assert (!bson_reader_read (reader, &eof));
+   assert (eof);
+   bson_reader_destroy (reader);
+   bson_free (data);
+
+   bson_stats_snapshot (&snapshot);
+
+   assert (stats_get (&snapshot, "bson_init_from_json.0-63.count") == 1);
+   assert (stats_get (&snapshot, "bson_validate.1024-16383.count") == 3);
+   assert (stats_get (&snapshot, "bson_validate.0-63.count") == 0);
+   assert (stats_get (&snapshot, "bson_as_json.0-63.count") == 1);
+   assert (stats_get (&snapshot, "bson_reader_read.0-63.count") == 1);
+   assert (stats_get (&snapshot, "bson_reader_read.1024-16383.count") == 1);
+
+   stats_check_histogram (&snapshot, "bson_init_from_json.0-63");
+   stats_check_histogram (&snapshot, "bson_validate.1024-16383");
+   stats_check_histogram (&snapshot, "bson_reader_read.1024-16383");
+
+   bson_destroy (&snapshot);
+
+   /* reset clears, disabling stops recording */
+   bson_stats_reset ();
+   bson_stats_set_enabled (false);
+   assert (bson_validate (&big, BSON_VALIDATE_NONE, NULL));
+
+   bson_stats_snapshot (&snapshot);
+   assert (stats_get (&snapshot, "bson_validate.1024-16383.count") == 0);
+   bson_destroy (&snapshot);
+
+   bson_destroy (&small);
+   bson_destroy (&big);
+}
+
+
+static void *
+stats_worker (void *data)
+{
+   const bson_t *b = data;
+   int i;
+
+   for (i = 0; i < N_PER_THREAD; i++) {
+      assert (bson_validate (b, BSON_VALIDATE_NONE, NULL));
+   }
+
+   return NULL;
+}
+
+
+static void
+test_stats_threads (void)
+{
+   bson_thread_t threads[N_THREADS];
+   bson_t snapshot;
+   bson_t *b;
+   int i;
+
+   b = BCON_NEW ("a", BCON_INT32 (1));
+
+   bson_stats_set_enabled (true);
+   bson_stats_reset ();
+
+   for (i = 0; i < N_THREADS; i++) {
+      bson_thread_create (&threads[i], stats_worker, b);
+   }
+
+   for (i = 0; i < N_THREADS; i++) {
+      bson_thread_join (threads[i]);
+   }
+
+   /* the threads have exited, their histograms were kept */
+   stats_worker (b);
+   bson_stats_snapshot (&snapshot);
+   assert (stats_get (&snapshot, "bson_validate.0-63.count") ==
+           (N_THREADS + 1) * N_PER_THREAD);
+   stats_check_histogram (&snapshot, "bson_validate.0-63");
+   bson_destroy (&snapshot);
+
+   bson_stats_set_enabled (false);
+   bson_stats_reset ();
+   bson_destroy (b);
+}
+
+
+void
+test_stats_install (TestSuite *suite)
+{
+   TestSuite_Add (suite, "/bson/stats/disabled", test_stats_disabled);
+   TestSuite_Add (suite, "/bson/stats/operations", test_stats_operations);
+   TestSuite_Add (suite, "/bson/stats/threads", test_stats_threads);
+}
@@ -0,0 +1,289 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <assert.h>
+#include <fcntl.h>
+
+#include "bson-tests.h"
+#include "TestSuite.h"
+
+
+#ifndef BINARY_DIR
+# define BINARY_DIR "tests/binary"
+#endif
+
+
+typedef struct
+{
+   double x;
+   double y;
+} point_t;
+
+
+typedef struct
+{
+   int32_t     id;
+   int64_t     count;
+   double      score;
+   bool        active;
+   int64_t     created;
+   bson_oid_t  oid;
+   const char *name;
+   point_t     location;
+} record_t;
+
+
+static const bson_struct_field_t point_fields[] = {
+   BSON_STRUCT_FIELD (point_t, x, "x", BSON_STRUCT_DOUBLE),
+   BSON_STRUCT_FIELD (point_t, y, "y", BSON_STRUCT_DOUBLE),
+};
+
+
+static const bson_struct_field_t record_fields[] = {
+   BSON_STRUCT_FIELD (record_t, id, "_id", BSON_STRUCT_INT32),
+   BSON_STRUCT_FIELD (record_t, count, "count", BSON_STRUCT_INT64),
+   BSON_STRUCT_FIELD (record_t, score, "score", BSON_STRUCT_DOUBLE),
+   BSON_STRUCT_FIELD (record_t, active, "active", BSON_STRUCT_BOOL),
+   BSON_STRUCT_FIELD (record_t, created, "created", BSON_STRUCT_DATE_TIME),
+   BSON_STRUCT_FIELD (record_t, oid, "oid", BSON_STRUCT_OID),
+   BSON_STRUCT_FIELD (record_t, name, "name", BSON_STRUCT_UTF8),
+   BSON_STRUCT_FIELD_DOCUMENT (record_t, location, "location", point_fields),
+};
+
+
+static void
+init_record (record_t *r)
+{
+   memset (r, 0, sizeof *r);
+   r->id = 42;
+   r->count = 1LL << 40;
+   r->score = 0.5;
+   r->active = true;
+   r->created = 1400000000000LL;
+   bson_oid_init_from_string (&r->oid, "0123456789abcdef01234567");
+   r->name = "widget";
+   r->location.x = 1.5;
+   r->location.y = -2.5;
+}
+
+
+static void
+test_struct_encode (void)
+{
+   bson_struct_desc_t *desc;
+   bson_error_t error;
+   record_t r;
+   bson_t *expected;
+   bson_t doc = BSON_INITIALIZER;
+
+   desc = bson_struct_desc_new (record_fields,
+                                sizeof record_fields / sizeof record_fields[0],
+                                &error);
+   assert (desc);
+
+   init_record (&r);
+   expected = BCON_NEW ("_id", BCON_INT32 (42),
+                        "count", BCON_INT64 (1LL << 40),
+                        "score", BCON_DOUBLE (0.5),
+                        "active", BCON_BOOL (true),
+                        "created", BCON_DATE_TIME (1400000000000LL),
+                        "oid", BCON_OID (&r.oid),
+                        "name", BCON_UTF8 ("widget"),
+                        "location", "{",
+                           "x", BCON_DOUBLE (1.5),
+                           "y", BCON_DOUBLE (-2.5),
+                        "}");
+
+   assert (bson_encode_struct (desc, &r, &doc));
+   assert (bson_validate (&doc, BSON_VALIDATE_NONE, NULL));
+   assert (bson_equal (&doc, expected));
+   bson_destroy (&doc);
+
+   /* fields are appended to existing ones, and NULL strings become null */
+   r.name = NULL;
+   bson_init (&doc);
+   BSON_APPEND_UTF8 (&doc, "first", "value");
+   assert (bson_encode_struct (desc, &r, &doc));
+   assert (bson_validate (&doc, BSON_VALIDATE_NONE, NULL));
+   assert_cmpint (bson_count_keys (&doc), ==, 9);
+   assert (bson_has_field (&doc, "first"));
+   assert (bson_has_field (&doc, "location.y"));
+   {
+      bson_iter_t iter;
+      assert (bson_iter_init_find (&iter, &doc, "name"));
+      assert (BSON_ITER_HOLDS_NULL (&iter));
+   }
+
+   bson_destroy (&doc);
+   bson_destroy (expected);
+   bson_struct_desc_destroy (desc);
+}
+
+
+static void
+test_struct_decode (void)
+{
+   bson_struct_desc_t *desc;
+   bson_error_t error;
+   record_t in;
+   record_t out;
+   bson_t doc = BSON_INITIALIZER;
+   bson_t *widened;
+
+   desc = bson_struct_desc_new (record_fields,
+                                sizeof record_fields / sizeof record_fields[0],
+                                &error);
+   assert (desc);
+
+   init_record (&in);
+   assert (bson_encode_struct (desc, &in, &doc));
+
+   memset (&out, 0, sizeof out);
+   assert (bson_decode_struct (desc, &doc, &out, &error));
+   assert_cmpint (out.id, ==, in.id);
+   assert (out.count == in.count);
+   assert (out.score == in.score);
+   assert (out.active);
+   assert (out.created == in.created);
+   assert (bson_oid_equal (&out.oid, &in.oid));
+   assert_cmpstr (out.name, "widget");
+   assert (out.location.x == 1.5);
+   assert (out.location.y == -2.5);
+
+   /* missing members are untouched, unknown fields ignored, ints widen */
+   widened = BCON_NEW ("extra", BCON_UTF8 ("ignored"),
+                       "count", BCON_INT32 (7),
+                       "score", BCON_INT64 (3),
+                       "name", BCON_NULL);
+   memset (&out, 0, sizeof out);
+   out.id = -1;
+   out.name = "unchanged";
+   assert (bson_decode_struct (desc, widened, &out, &error));
+   assert_cmpint (out.id, ==, -1);
+   assert (out.count == 7);
+   assert (out.score == 3.0);
+   assert (out.name == NULL);
+
+   bson_destroy (widened);
+   bson_destroy (&doc);
+   bson_struct_desc_destroy (desc);
+}
+
+
+static void
+test_struct_decode_errors (void)
+{
+   bson_struct_desc_t *desc;
+   bson_error_t error;
+   record_t out;
+   bson_t *doc;
+   bson_t bad;
+   /* {"_id": <unknown type 0x20>} */
+   const uint8_t corrupt[] = { 12, 0, 0, 0, 0x20, '_', 'i', 'd', 0, 0, 0, 0 };
+
+   desc = bson_struct_desc_new (record_fields,
+                                sizeof record_fields / sizeof record_fields[0],
+                                &error);
+   assert (desc);
+
+   doc = BCON_NEW ("_id", BCON_UTF8 ("not a number"));
+   assert (!bson_decode_struct (desc, doc, &out, &error));
+   assert_cmpint (error.domain, ==, BSON_ERROR_STRUCT);
+   assert_cmpint (error.code, ==, BSON_ERROR_STRUCT_TYPE);
+   bson_destroy (doc);
+
+   doc = BCON_NEW ("location", "{", "x", BCON_BOOL (true), "}");
+   assert (!bson_decode_struct (desc, doc, &out, &error));
+   assert_cmpint (error.code, ==, BSON_ERROR_STRUCT_TYPE);
+   bson_destroy (doc);
+
+   assert (bson_init_static (&bad, corrupt, sizeof corrupt));
+   assert (!bson_decode_struct (desc, &bad, &out, &error));
+   assert_cmpint (error.code, ==, BSON_ERROR_STRUCT_CORRUPT);
+
+   bson_struct_desc_destroy (desc);
+}
+
+
+static void
+test_struct_desc_invalid (void)
+{
+   static const bson_struct_field_t dup[] = {
+      BSON_STRUCT_FIELD (point_t, x, "x", BSON_STRUCT_DOUBLE),
+      BSON_STRUCT_FIELD (point_t, y, "x", BSON_STRUCT_DOUBLE),
+   };
+   static const bson_struct_field_t empty_key[] = {
+      BSON_STRUCT_FIELD (point_t, x, "", BSON_STRUCT_DOUBLE),
+   };
+   static const bson_struct_field_t nested_dup[] = {
+      BSON_STRUCT_FIELD_DOCUMENT (record_t, location, "loc", dup),
+   };
+   bson_error_t error;
+
+   assert (!bson_struct_desc_new (dup, 2, &error));
+   assert_cmpint (error.domain, ==, BSON_ERROR_STRUCT);
+   assert_cmpint (error.code, ==, BSON_ERROR_STRUCT_INVALID);
+   assert (!bson_struct_desc_new (empty_key, 1, &error));
+   assert (!bson_struct_desc_new (nested_dup, 1, &error));
+}
+
+
+static void
+test_struct_many_fields (void)
+{
+   bson_struct_field_t fields[100];
+   bson_struct_desc_t *desc;
+   char keys[100][8];
+   int32_t in[100];
+   int32_t out[100];
+   bson_t doc = BSON_INITIALIZER;
+   bson_error_t error;
+   int i;
+
+   for (i = 0; i < 100; i++) {
+      bson_snprintf (keys[i], sizeof keys[i], "f%d", i);
+      fields[i].key = keys[i];
+      fields[i].type = BSON_STRUCT_INT32;
+      fields[i].offset = i * sizeof (int32_t);
+      fields[i].fields = NULL;
+      fields[i].n_fields = 0;
+      in[i] = i * 3;
+   }
+
+   desc = bson_struct_desc_new (fields, 100, &error);
+   assert (desc);
+   assert (bson_encode_struct (desc, in, &doc));
+   memset (out, 0, sizeof out);
+   assert (bson_decode_struct (desc, &doc, out, &error));
+   assert (!memcmp (in, out, sizeof in));
+
+   bson_destroy (&doc);
+   bson_struct_desc_destroy (desc);
+}
+
+
+void
+test_struct_install (TestSuite *suite)
+{
+   TestSuite_Add (suite, "/bson/struct/encode", test_struct_encode);
+   TestSuite_Add (suite, "/bson/struct/decode", test_struct_decode);
+   TestSuite_Add (suite, "/bson/struct/decode_errors",
+                  test_struct_decode_errors);
+   TestSuite_Add (suite, "/bson/struct/desc_invalid",
+                  test_struct_desc_invalid);
+   TestSuite_Add (suite, "/bson/struct/many_fields", test_struct_many_fields);
+}
@@ -0,0 +1,173 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <assert.h>
+#include <fcntl.h>
+
+#include "bson-tests.h"
+#include "TestSuite.h"
+
+
+#ifndef BINARY_DIR
+# define BINARY_DIR "tests/binary"
+#endif
+
+
+static void
+test_view_init (void)
+{
+   bson_view_t view;
+   bson_t *doc;
+   uint8_t bad[5] = { 5, 0, 0, 0, 1 };
+
+   assert (sizeof (bson_view_t) <= 16);
+
+   doc = BCON_NEW ("a", BCON_INT32 (1));
+
+   assert (bson_view_init (&view, bson_get_data (doc), doc->len));
+   assert (view.data == bson_get_data (doc));
+   assert_cmpint (view.len, ==, doc->len);
+
+   assert (!bson_view_init (&view, bson_get_data (doc), doc->len - 1));
+   assert (!view.data);
+   assert (!bson_view_init (&view, bad, sizeof bad));
+   assert (!bson_view_init (&view, bad, 4));
+
+   bson_view_init_from_bson (&view, doc);
+   assert (view.data == bson_get_data (doc));
+   assert_cmpint (view.len, ==, doc->len);
+
+   bson_destroy (doc);
+}
+
+
+static void
+test_view_iter (void)
+{
+   bson_view_t view;
+   bson_iter_t iter;
+   bson_iter_t child;
+   bson_t *doc;
+
+   doc = BCON_NEW ("a", BCON_INT32 (1),
+                   "B", "{", "c", BCON_UTF8 ("d"), "}");
+   bson_view_init_from_bson (&view, doc);
+
+   assert (bson_view_iter_init (&iter, &view));
+   assert (bson_iter_next (&iter));
+   assert_cmpstr (bson_iter_key (&iter), "a");
+   assert_cmpint (bson_iter_int32 (&iter), ==, 1);
+   assert (bson_iter_next (&iter));
+   assert (bson_iter_recurse (&iter, &child));
+   assert (bson_iter_find (&child, "c"));
+   assert (!bson_iter_next (&iter));
+
+   assert (bson_view_iter_init_find (&iter, &view, "B"));
+   assert (!bson_view_iter_init_find (&iter, &view, "b"));
+   assert (bson_view_iter_init_find_case (&iter, &view, "b"));
+   assert (bson_view_has_field (&view, "B.c"));
+   assert (!bson_view_has_field (&view, "B.d"));
+   assert_cmpint (bson_view_count_keys (&view), ==, 2);
+
+   memset (&view, 0, sizeof view);
+   assert (!bson_view_iter_init (&iter, &view));
+   assert_cmpint (bson_view_count_keys (&view), ==, 0);
+
+   bson_destroy (doc);
+}
+
+
+static void
+test_view_as_json (void)
+{
+   bson_view_t view;
+   bson_t *doc;
+   char *str;
+   char *expected;
+   size_t len;
+
+   doc = BCON_NEW ("a", BCON_INT32 (1), "b", "[", BCON_BOOL (true), "]");
+   bson_view_init_from_bson (&view, doc);
+
+   str = bson_view_as_json (&view, &len);
+   expected = bson_as_json (doc, NULL);
+   assert_cmpstr (str, expected);
+   assert_cmpint (len, ==, strlen (expected));
+
+   bson_free (str);
+   bson_free (expected);
+   bson_destroy (doc);
+}
+
+
+static void
+test_view_validate (void)
+{
+   bson_view_t view;
+   bson_t *doc;
+   size_t offset;
+
+   doc = BCON_NEW ("a", BCON_INT32 (1), "$b", BCON_INT32 (2));
+   bson_view_init_from_bson (&view, doc);
+
+   assert (bson_view_validate (&view, BSON_VALIDATE_NONE, &offset));
+   assert (!bson_view_validate (&view, BSON_VALIDATE_DOLLAR_KEYS, &offset));
+   assert_cmpint (offset, ==, 11);
+
+   bson_destroy (doc);
+}
+
+
+static void
+test_view_compare (void)
+{
+   bson_view_t views[3];
+   bson_t *docs[3];
+   int i;
+   int j;
+
+   docs[0] = BCON_NEW ("a", BCON_INT32 (1));
+   docs[1] = BCON_NEW ("a", BCON_INT32 (2));
+   docs[2] = BCON_NEW ("a", BCON_INT32 (1), "b", BCON_INT32 (1));
+
+   for (i = 0; i < 3; i++) {
+      bson_view_init_from_bson (&views[i], docs[i]);
+   }
+
+   for (i = 0; i < 3; i++) {
+      for (j = 0; j < 3; j++) {
+         assert_cmpint (bson_view_compare (&views[i], &views[j]), ==,
+                        bson_compare (docs[i], docs[j]));
+         assert (bson_view_equal (&views[i], &views[j]) == (i == j));
+      }
+   }
+
+   for (i = 0; i < 3; i++) {
+      bson_destroy (docs[i]);
+   }
+}
+
+
+void
+test_view_install (TestSuite *suite)
+{
+   TestSuite_Add (suite, "/bson/view/init", test_view_init);
+   TestSuite_Add (suite, "/bson/view/iter", test_view_iter);
+   TestSuite_Add (suite, "/bson/view/as_json", test_view_as_json);
+   TestSuite_Add (suite, "/bson/view/validate", test_view_validate);
+   TestSuite_Add (suite, "/bson/view/compare", test_view_compare);
+}
@@ -0,0 +1,497 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <assert.h>
+#include <bcon.h>
+#include <fcntl.h>
+
+#include "bson-tests.h"
+#include "TestSuite.h"
+
+#include <bson-visit.h>
+
+
+#ifndef BINARY_DIR
+# define BINARY_DIR "tests/binary"
+#endif
+
+
+static bson_t *
+get_bson (const char *filename)
+{
+   ssize_t len;
+   uint8_t buf[4096];
+   bson_t *b;
+   char real_filename[256];
+   int fd;
+
+   bson_snprintf (real_filename, sizeof real_filename, BINARY_DIR"/%s",
+                  filename);
+   real_filename[sizeof real_filename - 1] = '\0';
+
+   if (-1 == (fd = bson_open (real_filename, O_RDONLY))) {
+      fprintf (stderr, "Failed to bson_open: %s\n", real_filename);
+      abort ();
+   }
+   len = bson_read (fd, buf, sizeof buf);
+   assert (len > 0);
+   b = bson_new_from_data (buf, (uint32_t)len);
+   bson_close (fd);
+
+   return b;
+}
+
+
+/*
+ * Visitors that log each callback, to compare bson_iter_visit_all() with
+ * the walkers generated by BSON_VISIT_SPECIALIZE().
+ */
+static bool
+log_field (const bson_iter_t *iter,
+           const char        *key,
+           const char        *what,
+           void              *data)
+{
+   bson_string_append_printf (data, "%s:%s@%u ", what, key, iter->off);
+
+   /* a key of "stop" ends the visit early */
+   return !strcmp (key, "stop");
+}
+
+
+#define LOG(what) \
+   return log_field (iter, key, what, data)
+
+
+static bool
+log_before (const bson_iter_t *iter, const char *key, void *data)
+{
+   LOG ("before");
+}
+
+
+static bool
+log_after (const bson_iter_t *iter, const char *key, void *data)
+{
+   bson_string_append (data, "after ");
+   return false;
+}
+
+
+static void
+log_corrupt (const bson_iter_t *iter, void *data)
+{
+   bson_string_append_printf (data, "corrupt@%u ", iter->err_off);
+}
+
+
+static bool
+log_double (const bson_iter_t *iter, const char *key, double v, void *data)
+{
+   bson_string_append_printf (data, "%g ", v);
+   LOG ("double");
+}
+
+
+static bool
+log_utf8 (const bson_iter_t *iter, const char *key, size_t len,
+          const char *v, void *data)
+{
+   bson_string_append_printf (data, "%u:%s ", (unsigned)len, v);
+   LOG ("utf8");
+}
+
+
+static bool
+log_document (const bson_iter_t *iter, const char *key, const bson_t *v,
+              void *data)
+{
+   bson_string_append_printf (data, "%u ", v->len);
+   LOG ("document");
+}
+
+
+static bool
+log_array (const bson_iter_t *iter, const char *key, const bson_t *v,
+           void *data)
+{
+   bson_string_append_printf (data, "%u ", v->len);
+   LOG ("array");
+}
+
+
+static bool
+log_binary (const bson_iter_t *iter, const char *key, bson_subtype_t subtype,
+            size_t len, const uint8_t *v, void *data)
+{
+   bson_string_append_printf (data, "%d:%u ", subtype, (unsigned)len);
+   LOG ("binary");
+}
+
+
+static bool
+log_undefined (const bson_iter_t *iter, const char *key, void *data)
+{
+   LOG ("undefined");
+}
+
+
+static bool
+log_oid (const bson_iter_t *iter, const char *key, const bson_oid_t *v,
+         void *data)
+{
+   char str[25];
+
+   bson_oid_to_string (v, str);
+   bson_string_append_printf (data, "%s ", str);
+   LOG ("oid");
+}
+
+
+static bool
+log_bool (const bson_iter_t *iter, const char *key, bool v, void *data)
+{
+   bson_string_append_printf (data, "%d ", v);
+   LOG ("bool");
+}
+
+
+static bool
+log_date_time (const bson_iter_t *iter, const char *key, int64_t v,
+               void *data)
+{
+   bson_string_append_printf (data, "%" PRId64 " ", v);
+   LOG ("date_time");
+}
+
+
+static bool
+log_null (const bson_iter_t *iter, const char *key, void *data)
+{
+   LOG ("null");
+}
+
+
+static bool
+log_regex (const bson_iter_t *iter, const char *key, const char *regex,
+           const char *options, void *data)
+{
+   bson_string_append_printf (data, "/%s/%s ", regex, options);
+   LOG ("regex");
+}
+
+
+static bool
+log_dbpointer (const bson_iter_t *iter, const char *key, size_t len,
+               const char *collection, const bson_oid_t *oid, void *data)
+{
+   bson_string_append_printf (data, "%u:%s ", (unsigned)len, collection);
+   LOG ("dbpointer");
+}
+
+
+static bool
+log_code (const bson_iter_t *iter, const char *key, size_t len,
+          const char *v, void *data)
+{
+   bson_string_append_printf (data, "%u:%s ", (unsigned)len, v);
+   LOG ("code");
+}
+
+
+static bool
+log_symbol (const bson_iter_t *iter, const char *key, size_t len,
+            const char *v, void *data)
+{
+   bson_string_append_printf (data, "%u:%s ", (unsigned)len, v);
+   LOG ("symbol");
+}
+
+
+static bool
+log_codewscope (const bson_iter_t *iter, const char *key, size_t len,
+                const char *v, const bson_t *scope, void *data)
+{
+   bson_string_append_printf (data, "%u:%s:%u ", (unsigned)len, v,
+                              scope->len);
+   LOG ("codewscope");
+}
+
+
+static bool
+log_int32 (const bson_iter_t *iter, const char *key, int32_t v, void *data)
+{
+   bson_string_append_printf (data, "%d ", v);
+   LOG ("int32");
+}
+
+
+static bool
+log_timestamp (const bson_iter_t *iter, const char *key, uint32_t t,
+               uint32_t i, void *data)
+{
+   bson_string_append_printf (data, "%u:%u ", t, i);
+   LOG ("timestamp");
+}
+
+
+static bool
+log_int64 (const bson_iter_t *iter, const char *key, int64_t v, void *data)
+{
+   bson_string_append_printf (data, "%" PRId64 " ", v);
+   LOG ("int64");
+}
+
+
+static bool
+log_maxkey (const bson_iter_t *iter, const char *key, void *data)
+{
+   LOG ("maxkey");
+}
+
+
+static bool
+log_minkey (const bson_iter_t *iter, const char *key, void *data)
+{
+   LOG ("minkey");
+}
+
+
+static void
+log_unsupported (const bson_iter_t *iter, const char *key, uint32_t type,
+                 void *data)
+{
+   bson_string_append_printf (data, "unsupported:%s:%u ", key, type);
+}
+
+
+#ifdef BSON_EXPERIMENTAL_FEATURES
+static bool
+log_decimal128 (const bson_iter_t *iter, const char *key,
+                const bson_decimal128_t *v, void *data)
+{
+   char str[BSON_DECIMAL128_STRING];
+
+   bson_decimal128_to_string (v, str);
+   bson_string_append_printf (data, "%s ", str);
+   LOG ("decimal128");
+}
+#endif
+
+
+#undef LOG
+
+
+#ifdef BSON_EXPERIMENTAL_FEATURES
+# define LOG_DECIMAL128 , log_decimal128
+#else
+# define LOG_DECIMAL128
+#endif
+
+
+static const bson_visitor_t log_all = {
+   log_before, log_after, log_corrupt, log_double, log_utf8, log_document,
+   log_array, log_binary, log_undefined, log_oid, log_bool, log_date_time,
+   log_null, log_regex, log_dbpointer, log_code, log_symbol,
+   log_codewscope, log_int32, log_timestamp, log_int64, log_maxkey,
+   log_minkey, log_unsupported LOG_DECIMAL128
+};
+
+
+BSON_VISIT_SPECIALIZE (log_all_specialized, log_all)
+
+
+static const bson_visitor_t log_some = {
+   NULL, /* visit_before */
+   NULL, /* visit_after */
+   log_corrupt,
+   NULL, /* visit_double */
+   log_utf8,
+   NULL, /* visit_document */
+   NULL, /* visit_array */
+   NULL, /* visit_binary */
+   NULL, /* visit_undefined */
+   NULL, /* visit_oid */
+   NULL, /* visit_bool */
+   NULL, /* visit_date_time */
+   NULL, /* visit_null */
+   NULL, /* visit_regex */
+   NULL, /* visit_dbpointer */
+   NULL, /* visit_code */
+   NULL, /* visit_symbol */
+   NULL, /* visit_codewscope */
+   log_int32,
+};
+
+
+BSON_VISIT_SPECIALIZE (log_some_specialized, log_some)
+
+
+static void
+assert_same_visits (const bson_t *bson)
+{
+   bson_string_t *expected;
+   bson_string_t *actual;
+   bson_iter_t iter;
+   bool r;
+
+   expected = bson_string_new (NULL);
+   actual = bson_string_new (NULL);
+
+   assert (bson_iter_init (&iter, bson));
+   r = bson_iter_visit_all (&iter, &log_all, expected);
+   bson_string_append_printf (expected, "%d", r);
+   assert (bson_iter_init (&iter, bson));
+   r = log_all_specialized (&iter, actual);
+   bson_string_append_printf (actual, "%d", r);
+   ASSERT_CMPSTR (expected->str, actual->str);
+
+   bson_string_truncate (expected, 0);
+   bson_string_truncate (actual, 0);
+
+   assert (bson_iter_init (&iter, bson));
+   r = bson_iter_visit_all (&iter, &log_some, expected);
+   bson_string_append_printf (expected, "%d", r);
+   assert (bson_iter_init (&iter, bson));
+   r = log_some_specialized (&iter, actual);
+   bson_string_append_printf (actual, "%d", r);
+   ASSERT_CMPSTR (expected->str, actual->str);
+
+   bson_string_free (expected, true);
+   bson_string_free (actual, true);
+}
+
+
+static void
+test_visit_specialized_files (void)
+{
+   char filename[64];
+   bson_t *b;
+   int i;
+
+   for (i = 1; i <= 58; i++) {
+      bson_snprintf (filename, sizeof filename, "test%u.bson", i);
+      b = get_bson (filename);
+      assert_same_visits (b);
+      bson_destroy (b);
+   }
+
+   b = get_bson ("codewscope.bson");
+   assert_same_visits (b);
+   bson_destroy (b);
+
+   b = get_bson ("trailingnull.bson");
+   assert_same_visits (b);
+   bson_destroy (b);
+}
+
+
+static void
+test_visit_specialized_types (void)
+{
+   bson_oid_t oid;
+   bson_t *scope;
+   bson_t *b;
+
+   bson_oid_init_from_string (&oid, "000102030405060708090a0b");
+   scope = BCON_NEW ("x", BCON_INT32 (1));
+
+   b = BCON_NEW ("double", BCON_DOUBLE (1.5),
+                 "utf8", BCON_UTF8 ("hello"),
+                 "document", "{", "a", BCON_INT32 (1), "}",
+                 "array", "[", BCON_INT32 (1), "]",
+                 "binary", BCON_BIN (BSON_SUBTYPE_BINARY,
+                                     (const uint8_t *)"abc", 3),
+                 "undefined", BCON_UNDEFINED,
+                 "oid", BCON_OID (&oid),
+                 "bool", BCON_BOOL (true),
+                 "date_time", BCON_DATE_TIME (12345),
+                 "null", BCON_NULL,
+                 "regex", BCON_REGEX ("^a", "i"),
+                 "dbpointer", BCON_DBPOINTER ("db.coll", &oid),
+                 "code", BCON_CODE ("return 1;"),
+                 "symbol", BCON_SYMBOL ("sym"),
+                 "codewscope", BCON_CODEWSCOPE ("return x;", scope),
+                 "int32", BCON_INT32 (-1),
+                 "timestamp", BCON_TIMESTAMP (1, 2),
+                 "int64", BCON_INT64 (-2),
+                 "maxkey", BCON_MAXKEY,
+                 "minkey", BCON_MINKEY);
+#ifdef BSON_EXPERIMENTAL_FEATURES
+   {
+      bson_decimal128_t dec;
+
+      bson_decimal128_from_string ("1.5E+10", &dec);
+      BSON_APPEND_DECIMAL128 (b, "decimal128", &dec);
+   }
+#endif
+
+   assert_same_visits (b);
+
+   /* stopping early */
+   BSON_APPEND_INT32 (b, "stop", 1);
+   BSON_APPEND_INT32 (b, "after_stop", 1);
+   assert_same_visits (b);
+
+   bson_destroy (b);
+   bson_destroy (scope);
+}
+
+
+static void
+test_visit_specialized_corrupt (void)
+{
+   bson_t *doc;
+   uint8_t *buf;
+   bson_t b;
+
+   doc = BCON_NEW ("a", BCON_INT32 (1), "b", BCON_INT32 (2));
+   buf = bson_malloc (doc->len);
+
+   /* an unsupported type */
+   memcpy (buf, bson_get_data (doc), doc->len);
+   assert (buf[11] == BSON_TYPE_INT32);
+   buf[11] = 0x66;
+   assert (bson_init_static (&b, buf, doc->len));
+   assert_same_visits (&b);
+
+   /* a key that is not UTF-8 */
+   memcpy (buf, bson_get_data (doc), doc->len);
+   buf[12] = 0xff;
+   assert_same_visits (&b);
+
+   /* a truncated field */
+   memcpy (buf, bson_get_data (doc), doc->len);
+   buf[doc->len - 3] = 0;
+   buf[doc->len - 6] = 0;
+   assert_same_visits (&b);
+
+   bson_free (buf);
+   bson_destroy (doc);
+}
+
+
+void
+test_visit_install (TestSuite *suite)
+{
+   TestSuite_Add (suite, "/bson/visit/specialized/files",
+                  test_visit_specialized_files);
+   TestSuite_Add (suite, "/bson/visit/specialized/types",
+                  test_visit_specialized_types);
+   TestSuite_Add (suite, "/bson/visit/specialized/corrupt",
+                  test_visit_specialized_corrupt);
+}
@@ -0,0 +1,300 @@
+/*
+ * Copyright 2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <assert.h>
+#include <bcon.h>
+
+#include "bson-tests.h"
+#include "TestSuite.h"
+
+
+/*
+ * Builds { "a" : { "a" : ... { } } } with @depth embedded documents
+ * directly in a buffer, since nesting that deep with bson_append_document
+ * would need a bson_t per level.
+ */
+static uint8_t *
+nested_new (uint32_t  depth,
+            uint32_t *len)
+{
+   uint8_t *buf;
+   uint32_t l;
+   uint32_t i;
+
+   *len = 5 + depth * 8;
+   buf = bson_malloc0 (*len);
+
+   /* every level starts 7 bytes into its parent and ends 1 byte before */
+   for (i = 0; i <= depth; i++) {
+      l = BSON_UINT32_TO_LE (*len - i * 8);
+      memcpy (buf + i * 7, &l, 4);
+
+      if (i < depth) {
+         buf[i * 7 + 4] = BSON_TYPE_DOCUMENT;
+         buf[i * 7 + 5] = 'a';
+         buf[i * 7 + 6] = '\0';
+      }
+   }
+
+   return buf;
+}
+
+
+static void
+test_walker_events (void)
+{
+   bson_walker_t walker;
+   const bson_iter_t *iter;
+   bson_t *doc;
+
+   doc = BCON_NEW ("a", BCON_INT32 (1),
+                   "b", "{", "c", "[", BCON_INT32 (2), BCON_INT32 (3), "]",
+                   "}",
+                   "d", BCON_UTF8 ("x"));
+
+   assert (bson_walker_init (&walker, doc));
+
+#define NEXT(_event, _key, _depth) \
+   do { \
+      assert (bson_walker_next (&walker) == (_event)); \
+      iter = bson_walker_get_iter (&walker); \
+      assert (!strcmp (bson_iter_key (iter), (_key))); \
+      assert (bson_walker_get_depth (&walker) == (_depth)); \
+   } while (0)
+
+   NEXT (BSON_WALK_VALUE, "a", 0);
+   assert (bson_walker_get_offset (&walker) == 4);
+   assert (bson_iter_int32 (iter) == 1);
+   NEXT (BSON_WALK_DOCUMENT_BEGIN, "b", 0);
+   assert (bson_walker_get_offset (&walker) == 11);
+   NEXT (BSON_WALK_DOCUMENT_BEGIN, "c", 1);
+   assert (bson_walker_get_offset (&walker) == 18);
+   NEXT (BSON_WALK_VALUE, "0", 2);
+   assert (bson_walker_get_offset (&walker) == 25);
+   NEXT (BSON_WALK_VALUE, "1", 2);
+   assert (bson_iter_int32 (iter) == 3);
+   NEXT (BSON_WALK_DOCUMENT_END, "c", 1);
+   assert (BSON_ITER_HOLDS_ARRAY (iter));
+   NEXT (BSON_WALK_DOCUMENT_END, "b", 0);
+   assert (bson_walker_get_offset (&walker) == 11);
+   NEXT (BSON_WALK_VALUE, "d", 0);
+   assert (!strcmp (bson_iter_utf8 (iter, NULL), "x"));
+
+#undef NEXT
+
+   assert (bson_walker_next (&walker) == BSON_WALK_END);
+   assert (bson_walker_next (&walker) == BSON_WALK_END);
+
+   bson_walker_destroy (&walker);
+   bson_destroy (doc);
+}
+
+
+static void
+test_walker_max_depth (void)
+{
+   bson_walker_t walker;
+   bson_walk_event_t event;
+   uint32_t depth = 0;
+   uint32_t max = 0;
+   uint8_t *buf;
+   uint32_t len;
+   int too_deep = 0;
+
+   buf = nested_new (10, &len);
+
+   assert (bson_walker_init_from_data (&walker, buf, len));
+   bson_walker_set_max_depth (&walker, 3);
+
+   while ((event = bson_walker_next (&walker)) != BSON_WALK_END) {
+      assert (event != BSON_WALK_CORRUPT);
+
+      if (event == BSON_WALK_DOCUMENT_BEGIN) {
+         depth++;
+         max = BSON_MAX (max, depth);
+      } else if (event == BSON_WALK_DOCUMENT_END) {
+         depth--;
+      } else if (event == BSON_WALK_TOO_DEEP) {
+         assert (bson_walker_get_depth (&walker) == 3);
+         assert (bson_walker_get_offset (&walker) == 3 * 7 + 4);
+         too_deep++;
+      }
+   }
+
+   assert (depth == 0);
+   assert (max == 3);
+   assert (too_deep == 1);
+
+   bson_walker_destroy (&walker);
+   bson_free (buf);
+}
+
+
+static void
+test_walker_deep (void)
+{
+   bson_walker_t walker;
+   bson_walk_event_t event;
+   size_t offset;
+   uint8_t *buf;
+   uint32_t len;
+   bson_t b;
+   char *str;
+
+   /* far deeper than the C stack would allow a recursive walk, and than
+    * the frames kept inside the walker */
+   buf = nested_new (1000 * 1000, &len);
+   assert (bson_init_static (&b, buf, len));
+
+   assert (bson_walker_init (&walker, &b));
+
+   do {
+      event = bson_walker_next (&walker);
+   } while (event == BSON_WALK_DOCUMENT_BEGIN);
+
+   assert (event == BSON_WALK_DOCUMENT_END);
+   assert (bson_walker_get_depth (&walker) == 1000 * 1000 - 1);
+
+   do {
+      event = bson_walker_next (&walker);
+   } while (event == BSON_WALK_DOCUMENT_END);
+
+   assert (event == BSON_WALK_END);
+   bson_walker_destroy (&walker);
+
+   assert (bson_validate (&b, BSON_VALIDATE_NONE, &offset));
+
+   /* a bad key at the bottom is found at its offset */
+   buf[(1000 * 1000 - 1) * 7 + 5] = '$';
+   assert (!bson_validate (&b, BSON_VALIDATE_DOLLAR_KEYS, &offset));
+   assert (offset == (1000 * 1000 - 1) * 7 + 4);
+   buf[(1000 * 1000 - 1) * 7 + 5] = 'a';
+
+   str = bson_as_json (&b, NULL);
+   assert (str);
+   assert (strstr (str, "\"a\" : { ... }"));
+   bson_free (str);
+
+   bson_destroy (&b);
+   bson_free (buf);
+}
+
+
+static void
+test_walker_corrupt (void)
+{
+   bson_walker_t walker;
+   bson_walk_event_t event;
+   bson_t *doc;
+   uint8_t *buf;
+   size_t offset;
+   bson_t b;
+
+   doc = BCON_NEW ("a", "{", "b", "{", "c", BCON_INT32 (1), "}", "}");
+   buf = bson_malloc (doc->len);
+   memcpy (buf, bson_get_data (doc), doc->len);
+
+   /* the type of "c", two documents down */
+   assert (buf[18] == BSON_TYPE_INT32);
+   buf[18] = 0x66;
+
+   assert (bson_walker_init_from_data (&walker, buf, doc->len));
+
+   do {
+      event = bson_walker_next (&walker);
+   } while (event == BSON_WALK_DOCUMENT_BEGIN);
+
+   assert (event == BSON_WALK_CORRUPT);
+   assert (bson_walker_get_offset (&walker) == 21);
+   assert (bson_walker_next (&walker) == BSON_WALK_CORRUPT);
+   bson_walker_destroy (&walker);
+
+   assert (bson_init_static (&b, buf, doc->len));
+   assert (!bson_validate (&b, BSON_VALIDATE_NONE, &offset));
+   assert (offset == 21);
+   assert (!bson_as_json (&b, NULL));
+
+   /* an embedded document without its trailing byte */
+   memcpy (buf, bson_get_data (doc), doc->len);
+   buf[doc->len - 2] = 1;
+
+   assert (bson_walker_init_from_data (&walker, buf, doc->len));
+   assert (bson_walker_next (&walker) == BSON_WALK_DOCUMENT_BEGIN);
+   assert (bson_walker_next (&walker) == BSON_WALK_CORRUPT);
+   assert (bson_walker_get_offset (&walker) == 4);
+   bson_walker_destroy (&walker);
+
+   bson_free (buf);
+   bson_destroy (doc);
+}
+
+
+static void
+test_walker_scopes (void)
+{
+   bson_walker_t walker;
+   bson_t *scope;
+   bson_t doc;
+   size_t offset;
+   uint32_t events;
+
+   scope = BCON_NEW ("x", BCON_INT32 (1), "$y", BCON_INT32 (2));
+   bson_init (&doc);
+   BSON_APPEND_CODE_WITH_SCOPE (&doc, "code", "return x;", scope);
+
+   assert (bson_walker_init (&walker, &doc));
+   assert (bson_walker_next (&walker) == BSON_WALK_VALUE);
+   assert (bson_walker_next (&walker) == BSON_WALK_END);
+   bson_walker_destroy (&walker);
+
+   assert (bson_walker_init (&walker, &doc));
+   bson_walker_set_flags (&walker, BSON_WALKER_SCOPES);
+   assert (bson_walker_next (&walker) == BSON_WALK_DOCUMENT_BEGIN);
+   assert (BSON_ITER_HOLDS_CODEWSCOPE (bson_walker_get_iter (&walker)));
+
+   for (events = 0; bson_walker_next (&walker) == BSON_WALK_VALUE; events++) {
+   }
+
+   assert (events == 2);
+   assert (bson_walker_get_depth (&walker) == 0);
+   assert (bson_walker_next (&walker) == BSON_WALK_END);
+   bson_walker_destroy (&walker);
+
+   /* a bad key in a scope fails validation, at its offset in @doc */
+   assert (!bson_validate (&doc, BSON_VALIDATE_DOLLAR_KEYS, &offset));
+   assert (offset == doc.len - 1 - scope->len + 11);
+
+   /* and so does a bad key after a valid scope */
+   BSON_APPEND_INT32 (&doc, "z.w", 3);
+   assert (bson_validate (&doc, BSON_VALIDATE_NONE, NULL));
+   assert (!bson_validate (&doc, BSON_VALIDATE_DOT_KEYS, &offset));
+   assert (offset == doc.len - 1 - 9);
+
+   bson_destroy (&doc);
+   bson_destroy (scope);
+}
+
+
+void
+test_walker_install (TestSuite *suite)
+{
+   TestSuite_Add (suite, "/bson/walker/events", test_walker_events);
+   TestSuite_Add (suite, "/bson/walker/max_depth", test_walker_max_depth);
+   TestSuite_Add (suite, "/bson/walker/deep", test_walker_deep);
+   TestSuite_Add (suite, "/bson/walker/corrupt", test_walker_corrupt);
+   TestSuite_Add (suite, "/bson/walker/scopes", test_walker_scopes);
+}